@@ -1,12 +1,24 @@
 #include "cmds.h"
 
+#include <fcntl.h>
+#include <cstdio>
+#include <cstring>
+
 #include <filesystem>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <set>
+#include <unordered_map>
 
 #include <boost/algorithm/string.hpp>
 
+#include "docker/blobrefs.h"
 #include "docker/composeinfo.h"
 #include "docker/docker.h"
+#include "docker/dockerstore.h"
+#include "docker/imagerepositories.h"
+#include "docker/ocimanifest.h"
 #include "docker/restorableappengine.h"
 #include "http/httpclient.h"
 
@@ -106,6 +118,215 @@ int ListCmd::listApps(const std::string& store_root, bool wide) {
   return EXIT_SUCCESS;
 }
 
+namespace {
+
+struct BlobStats {
+  uint64_t unique{0};
+  uint64_t shared{0};
+  // the layers extracted size in the docker store, estimated
+  uint64_t docker{0};
+  std::size_t missing{0};
+};
+
+struct ImageStats {
+  std::string uri;
+  std::set<std::string> blobs;
+  std::set<std::string> layers;
+  BlobStats stats;
+};
+
+struct AppStats {
+  std::string name;
+  std::string hash;
+  std::set<std::string> blobs;
+  std::vector<ImageStats> images;
+  BlobStats stats;
+};
+
+BlobStats getBlobStats(const std::set<std::string>& blobs, const std::set<std::string>& layers,
+                       const std::unordered_map<std::string, uint64_t>& store_blobs,
+                       const std::unordered_map<std::string, unsigned int>& ref_counts) {
+  BlobStats stats;
+  for (const auto& blob : blobs) {
+    const auto blob_it{store_blobs.find(blob)};
+    if (blob_it == store_blobs.end()) {
+      ++stats.missing;
+      continue;
+    }
+    (ref_counts.at(blob) > 1 ? stats.shared : stats.unique) += blob_it->second;
+    if (layers.count(blob) > 0) {
+      stats.docker += blob_it->second * Docker::RestorableAppEngine::AverageCompressionRatio;
+    }
+  }
+  return stats;
+}
+
+Json::Value blobStatsToJson(const BlobStats& stats) {
+  Json::Value res;
+  res["unique_bytes"] = Json::UInt64(stats.unique);
+  res["shared_bytes"] = Json::UInt64(stats.shared);
+  res["docker_store_bytes_estimated"] = Json::UInt64(stats.docker);
+  res["missing_blobs"] = Json::UInt64(stats.missing);
+  return res;
+}
+
+void printBlobStats(const std::string& name, const BlobStats& stats) {
+  std::cout << std::left << std::setw(64) << name << std::right << std::setw(14) << stats.unique << std::setw(14)
+            << stats.shared << std::setw(16) << stats.docker;
+  if (stats.missing > 0) {
+    std::cout << "  (" << stats.missing << " blobs missing)";
+  }
+  std::cout << std::endl;
+}
+
+}  // namespace
+
+int StatsCmd::printStats(const std::string& store_root, bool json) {
+  const fs::path apps_dir{store_root + "/apps"};
+  const fs::path blob_dir{store_root + "/blobs/sha256"};
+  if (!fs::exists(apps_dir)) {
+    LOG_ERROR << "Apps' root directory does not exist: " << apps_dir;
+    return EXIT_FAILURE;
+  }
+
+  std::unordered_map<std::string, uint64_t> store_blobs;
+  if (fs::exists(blob_dir)) {
+    for (const auto& blob_entry : fs::directory_iterator{blob_dir}) {
+      if (blob_entry.is_regular_file()) {
+        store_blobs.emplace(blob_entry.path().filename().string(), blob_entry.file_size());
+      }
+    }
+  }
+
+  // the blob reference table kept by the App engine, if it accounts for all the store blobs then the App blobs
+  // are taken from it, otherwise they are gathered from the image manifests
+  const Docker::BlobRefs blob_refs{store_root + "/blob-refs.json"};
+  const bool use_blob_refs{blob_refs.isComplete()};
+  auto& manifests{Docker::OciManifestCache::instance()};
+  std::vector<AppStats> apps;
+  for (const auto& app_entry : fs::directory_iterator{apps_dir}) {
+    for (const auto& app_ver_entry : fs::directory_iterator{app_entry.path()}) {
+      AppStats app{app_entry.path().filename().string(), app_ver_entry.path().filename().string(), {}, {}, {}};
+      const auto compose_file{app_ver_entry.path() / Docker::RestorableAppEngine::ComposeFile};
+      const auto compose{Docker::ComposeInfo::load(compose_file.string())};
+      for (const auto& service : compose->services()) {
+        const auto image_uri{Docker::Uri::parseUri(service.image, false)};
+        const auto image_dir{app_ver_entry.path() / "images" / image_uri.registryHostname / image_uri.repo /
+                             image_uri.digest.hash()};
+        ImageStats image{service.image, {}, {}, {}};
+        try {
+          const auto image_index{manifests.imageIndex(image_dir.string())};
+          const auto& manifest_digest{image_index->manifest().digest};
+          const auto image_manifest{manifests.imageManifest(blob_dir.string(), manifest_digest)};
+          image.blobs.emplace(manifest_digest.hash());
+          image.blobs.emplace(image_manifest->config.digest.hash());
+          for (const auto& layer : image_manifest->layers) {
+            image.blobs.emplace(layer.digest.hash());
+            image.layers.emplace(layer.digest.hash());
+          }
+        } catch (const std::exception& exc) {
+          LOG_WARNING << "Failed to read the manifest of image " << service.image << ": " << exc.what();
+        }
+        app.images.emplace_back(std::move(image));
+      }
+
+      Docker::BlobRefs::Refs refs;
+      if (use_blob_refs && blob_refs.getRefs(app.name + "/" + app.hash, refs)) {
+        app.blobs = std::move(refs.blobs);
+      } else {
+        for (const auto& image : app.images) {
+          app.blobs.insert(image.blobs.begin(), image.blobs.end());
+        }
+      }
+      apps.emplace_back(std::move(app));
+    }
+  }
+
+  // the number of Apps and of distinct images referencing each blob
+  std::unordered_map<std::string, unsigned int> app_ref_counts;
+  std::unordered_map<std::string, unsigned int> image_ref_counts;
+  std::set<std::string> counted_images;
+  for (const auto& app : apps) {
+    for (const auto& blob : app.blobs) {
+      ++app_ref_counts[blob];
+    }
+    for (const auto& image : app.images) {
+      if (!counted_images.emplace(image.uri).second) {
+        continue;
+      }
+      for (const auto& blob : image.blobs) {
+        ++image_ref_counts[blob];
+      }
+    }
+  }
+
+  std::set<std::string> all_layers;
+  for (auto& app : apps) {
+    std::set<std::string> app_layers;
+    for (auto& image : app.images) {
+      image.stats = getBlobStats(image.blobs, image.layers, store_blobs, image_ref_counts);
+      app_layers.insert(image.layers.begin(), image.layers.end());
+    }
+    app.stats = getBlobStats(app.blobs, app_layers, store_blobs, app_ref_counts);
+    all_layers.insert(app_layers.begin(), app_layers.end());
+  }
+
+  uint64_t store_size{0};
+  uint64_t orphaned_size{0};
+  uint64_t docker_size{0};
+  std::map<std::string, uint64_t> orphaned_blobs;
+  for (const auto& blob : store_blobs) {
+    store_size += blob.second;
+    if (app_ref_counts.count(blob.first) == 0) {
+      orphaned_size += blob.second;
+      orphaned_blobs.emplace(blob);
+    } else if (all_layers.count(blob.first) > 0) {
+      docker_size += blob.second * Docker::RestorableAppEngine::AverageCompressionRatio;
+    }
+  }
+
+  if (json) {
+    Json::Value res;
+    for (const auto& app : apps) {
+      Json::Value app_json{blobStatsToJson(app.stats)};
+      app_json["name"] = app.name;
+      app_json["hash"] = app.hash;
+      for (const auto& image : app.images) {
+        Json::Value image_json{blobStatsToJson(image.stats)};
+        image_json["uri"] = image.uri;
+        app_json["images"].append(image_json);
+      }
+      res["apps"].append(app_json);
+    }
+    for (const auto& blob : orphaned_blobs) {
+      res["orphaned_blobs"][blob.first] = Json::UInt64(blob.second);
+    }
+    res["store_bytes"] = Json::UInt64(store_size);
+    res["docker_store_bytes_estimated"] = Json::UInt64(docker_size);
+    res["reclaimable_bytes"] = Json::UInt64(orphaned_size);
+    res["blob_refs_used"] = use_blob_refs;
+    std::cout << Utils::jsonToStr(res) << std::endl;
+    return EXIT_SUCCESS;
+  }
+
+  std::cout << std::left << std::setw(64) << "APP / IMAGE" << std::right << std::setw(14) << "UNIQUE" << std::setw(14)
+            << "SHARED" << std::setw(16) << "DOCKER (EST.)" << std::endl;
+  for (const auto& app : apps) {
+    printBlobStats(app.name + "@" + app.hash.substr(0, 12), app.stats);
+    for (const auto& image : app.images) {
+      printBlobStats("  " + image.uri, image.stats);
+    }
+  }
+  std::cout << "\nOrphaned blobs: " << orphaned_blobs.size() << std::endl;
+  for (const auto& blob : orphaned_blobs) {
+    std::cout << "  " << blob.first << " " << blob.second << std::endl;
+  }
+  std::cout << "Store size: " << store_size << " bytes in " << store_blobs.size() << " blobs" << std::endl;
+  std::cout << "Docker store size (estimated): " << docker_size << std::endl;
+  std::cout << "Reclaimable: " << orphaned_size << std::endl;
+  return EXIT_SUCCESS;
+}
+
 int RegisterCmd::hackDockerStore(const std::vector<std::string>& shortlist, const std::string& store_root,
                                  const std::string& docker_root) {
   LOG_INFO << "Registering the preloaded Apps at the docker store repository;"
@@ -118,49 +339,88 @@ int RegisterCmd::hackDockerStore(const std::vector<std::string>& shortlist, cons
     exit(EXIT_SUCCESS);
   }
 
-  const fs::path repositories_file{docker_root + "/image/overlay2/repositories.json"};
-  Json::Value repositories;
-  if (fs::exists(repositories_file)) {
-    repositories = Utils::parseJSONFile(repositories_file.string());
-  } else {
-    repositories = Utils::parseJSON("{\"Repositories\":{}}");
+  Docker::ImageRepositories repositories{docker_root};
+  for (const auto& app : apps) {
+    repositories.addApp(app.path.string(), store_root + "/blobs/sha256");
   }
+  if (!repositories.commit()) {
+    LOG_INFO << "All App images are registered in the docker store already";
+  }
+  return EXIT_SUCCESS;
+}
+
+int ExportCmd::exportDockerStore(const std::vector<std::string>& shortlist, const std::string& store_root,
+                                 const std::string& out_root) {
+  LOG_INFO << "Exporting the preloaded Apps' images to a docker store;"
+           << "\n\tshortlist: " << boost::algorithm::join(shortlist, ",") << "\n\tstore-root: " << store_root
+           << "\n\tout: " << out_root;
+
+  const auto apps{getStoreApps(store_root, shortlist)};
+  if (apps.size() == 0) {
+    LOG_INFO << "No any Apps found in the store; path:  " << store_root;
+    return EXIT_SUCCESS;
+  }
+
+  // the layout the docker daemon of the `overlay2` storage driver expects
+  fs::create_directories(fs::path{out_root} / "image" / Docker::DockerStore::Driver / "layerdb");
+  fs::create_directories(fs::path{out_root} / Docker::DockerStore::Driver);
+  Docker::DockerStore docker_store{out_root, store_root + "/blobs/sha256"};
 
   for (const auto& app : apps) {
     const fs::path app_compose_file{app.path / Docker::RestorableAppEngine::ComposeFile};
-    const Docker::ComposeInfo app_compose{app_compose_file.string()};
-    for (const Json::Value& service : app_compose.getServices()) {
-      const auto image_uri_str{app_compose.getImage(service)};
-      const auto image_uri{Docker::Uri::parseUri(image_uri_str, false)};
+    const auto app_compose{Docker::ComposeInfo::load(app_compose_file.string())};
+    for (const auto& service : app_compose->services()) {
+      const auto image_uri{Docker::Uri::parseUri(service.image, false)};
+      const auto image_dir{app.path / "images" / image_uri.registryHostname / image_uri.repo /
+                           image_uri.digest.hash()};
+      // tagged the same way as the images loaded by the App engine, so it finds them in the store
+      const std::string tag{image_uri.registryHostname + '/' + image_uri.repo + ':' + image_uri.digest.shortHash()};
+      LOG_INFO << "Exporting image: " << service.image;
+      docker_store.importImage(image_dir.string(), {service.image, tag});
+    }
+  }
+
+  docker_store.commit();
+  LOG_INFO << "Successfully exported Apps' images to " << out_root;
+  return EXIT_SUCCESS;
+}
 
-      const auto image_index_path{app.path / "images" / image_uri.registryHostname / image_uri.repo /
-                                  image_uri.digest.hash() / "index.json"};
-      const auto image_index{Utils::parseJSONFile(image_index_path.string())};
+int ImportCmd::importDockerStore(const std::string& src_root, const std::string& docker_root, bool force) {
+  LOG_INFO << "Importing the preloaded docker store;"
+           << "\n\tsrc: " << src_root << "\n\tdocker-root: " << docker_root;
 
-      // parse an image index to find a path to an image manifest
-      const Docker::HashedDigest manifest_digest(image_index["manifests"][0]["digest"].asString());
-      const auto image_manifest_path{store_root + "/blobs/sha256/" + manifest_digest.hash()};
-      const auto image_manifest{Utils::parseJSONFile(image_manifest_path)};
-      // parse an image manifest to get a digest of an image config
-      const Docker::HashedDigest config_digest(image_manifest["config"]["digest"].asString());
-      const auto image_repo{image_uri.registryHostname + "/" + image_uri.repo};
+  if (!Docker::DockerStore::isSupported(src_root)) {
+    LOG_ERROR << "Not a docker store generated by the `export` command: " << src_root;
+    return EXIT_FAILURE;
+  }
 
-      LOG_INFO << "Registering image: " << image_uri_str << " -> " << config_digest();
-      repositories["Repositories"][image_repo][image_uri_str] = config_digest();
+  // the store is moved as a whole, so the daemon sees either the old store or the new one and nothing in between
+  if (!fs::exists(docker_root) || fs::is_empty(docker_root)) {
+    if (std::rename(src_root.c_str(), docker_root.c_str()) != 0) {
+      throw std::runtime_error("Failed to move " + src_root + " to " + docker_root + ": " + std::strerror(errno));
     }
+  } else if (force) {
+    if (::renameat2(AT_FDCWD, src_root.c_str(), AT_FDCWD, docker_root.c_str(), RENAME_EXCHANGE) != 0) {
+      throw std::runtime_error("Failed to swap " + src_root + " and " + docker_root + ": " + std::strerror(errno));
+    }
+    // the previous store is at the source location now
+    fs::remove_all(src_root);
+  } else {
+    LOG_ERROR << "The docker data root is not empty, use --force to replace it: " << docker_root;
+    return EXIT_FAILURE;
   }
 
-  Utils::writeFile(repositories_file.string(), repositories);
+  LOG_INFO << "Successfully imported the preloaded docker store to " << docker_root;
   return EXIT_SUCCESS;
 }
 
 int RunCmd::runApps(const std::vector<std::string>& shortlist, const std::string& docker_host,
                     const std::string& store_root, const std::string& compose_root, const std::string& docker_root,
-                    const std::string& client, const std::string& compose_client) {
+                    const std::string& client, const std::string& compose_client, int jobs) {
   LOG_INFO << "Starting Apps prelaoded into the store: " << store_root
            << "\n\tshortlist: " << boost::algorithm::join(shortlist, ",") << "\n\tdocker-host: " << docker_host
            << "\n\tcompose-root: " << compose_root << "\n\tdocker-root: " << docker_root << "\n\tclient: " << client
-           << "\n\tcompose-client: " << client << std::endl;
+           << "\n\tcompose-client: " << client << "\n\tjobs: " << jobs << std::endl;
 
   const auto apps{getStoreApps(store_root, shortlist)};
   if (apps.size() == 0) {
@@ -169,21 +429,45 @@ int RunCmd::runApps(const std::vector<std::string>& shortlist, const std::string
     exit(EXIT_SUCCESS);
   }
 
-  auto http_client = std::make_shared<HttpClient>();
-  auto docker_client{std::make_shared<Docker::DockerClient>()};
-  auto registry_client{std::make_shared<Docker::RegistryClient>(http_client, "")};
-  Docker::RestorableAppEngine app_engine{store_root,    compose_root, docker_root, registry_client,
-                                         docker_client, client,       docker_host, compose_client};
-
-  for (const auto& app : apps) {
-    LOG_INFO << "Starting App: " << app.name;
-    AppEngine::Result res = app_engine.run(app);
-    if (!res) {
-      LOG_ERROR << res.err;
-      return static_cast<int>(res.status);
+  // each job runs its Apps by an engine of its own, along with its own HTTP and docker clients
+  const auto make_engine = [&]() {
+    auto http_client = std::make_shared<HttpClient>();
+    auto docker_client{std::make_shared<Docker::DockerClient>()};
+    auto registry_client{std::make_shared<Docker::RegistryClient>(http_client, "")};
+    return std::unique_ptr<Docker::RestorableAppEngine>{new Docker::RestorableAppEngine{
+        store_root, compose_root, docker_root, registry_client, docker_client, client, docker_host, compose_client}};
+  };
+  const auto app_engine{make_engine()};
+
+  if (jobs == 1) {
+    for (const auto& app : apps) {
+      LOG_INFO << "Starting App: " << app.name;
+      AppEngine::Result res = app_engine->run(app);
+      if (!res) {
+        LOG_ERROR << res.err;
+        return static_cast<int>(res.status);
+      }
     }
+    LOG_INFO << "Successfully started Apps";
+    return EXIT_SUCCESS;
   }
 
+  const AppEngine::Apps store_apps{apps.begin(), apps.end()};
+  const auto results{Docker::RestorableAppEngine::runApps(*app_engine, store_apps, jobs, make_engine)};
+  int rc{EXIT_SUCCESS};
+  for (std::size_t ii = 0; ii < apps.size(); ++ii) {
+    if (results[ii]) {
+      LOG_INFO << "Started App: " << apps[ii].name;
+      continue;
+    }
+    LOG_ERROR << "Failed to start App: " << apps[ii].name << ", err: " << results[ii].err;
+    if (rc == EXIT_SUCCESS) {
+      rc = static_cast<int>(results[ii].status);
+    }
+  }
+  if (rc != EXIT_SUCCESS) {
+    return rc;
+  }
   LOG_INFO << "Successfully started Apps";
   return EXIT_SUCCESS;
 }
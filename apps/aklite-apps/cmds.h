@@ -53,6 +53,30 @@ class ListCmd : public Cmd {
   po::options_description _options;
 };
 
+class StatsCmd : public Cmd {
+ public:
+  StatsCmd() : Cmd("stats", _options) {
+    _options.add_options()("help,h", "print usage")("log-level", po::value<int>()->default_value(2),
+                                                    "set log level 0-5 (trace, debug, info, warning, error, fatal)")(
+        "store-root", po::value<std::string>()->default_value("/var/sota/reset-apps"), "Image store root folder")(
+        "json", po::bool_switch()->default_value(false), "Print the stats in JSON format");
+  }
+
+  int operator()(const po::variables_map& vm) const override {
+    try {
+      return printStats(vm["store-root"].as<std::string>(), vm["json"].as<bool>());
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Failed to get the store stats: " << exc.what();
+      return EXIT_FAILURE;
+    }
+  }
+
+ private:
+  static int printStats(const std::string& store_root, bool json);
+
+  po::options_description _options;
+};
+
 class RegisterCmd : public Cmd {
  public:
   RegisterCmd() : Cmd("register", _options) {
@@ -85,6 +109,75 @@ class RegisterCmd : public Cmd {
   po::options_description _options;
 };
 
+class ExportCmd : public Cmd {
+ public:
+  ExportCmd() : Cmd("export", _options) {
+    _options.add_options()("help,h", "print usage")("log-level", po::value<int>()->default_value(2),
+                                                    "set log level 0-5 (trace, debug, info, warning, error, fatal)")(
+        "apps", po::value<std::string>()->default_value(""),
+        "Comma separated list of Apps to export, by default all Apps are exported")(
+        "store-root", po::value<std::string>()->default_value("/var/sota/reset-apps"), "Image store root folder")(
+        "out", po::value<std::string>()->default_value(""),
+        "Docker data root folder to generate, with the Apps' images unpacked into the overlay2 store");
+  }
+
+  int operator()(const po::variables_map& vm) const override {
+    try {
+      std::vector<std::string> apps;
+      if (!vm["apps"].as<std::string>().empty()) {
+        boost::split(apps, vm["apps"].as<std::string>(), boost::is_any_of(", "), boost::token_compress_on);
+      }
+
+      if (vm["out"].as<std::string>().empty()) {
+        throw std::invalid_argument("The output folder is not specified, use --out");
+      }
+
+      return exportDockerStore(apps, vm["store-root"].as<std::string>(), vm["out"].as<std::string>());
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Failed to export preloaded Apps's images: " << exc.what();
+      return EXIT_FAILURE;
+    }
+  }
+
+ private:
+  static int exportDockerStore(const std::vector<std::string>& shortlist, const std::string& store_root,
+                               const std::string& out_root);
+
+  po::options_description _options;
+};
+
+class ImportCmd : public Cmd {
+ public:
+  ImportCmd() : Cmd("import", _options) {
+    _options.add_options()("help,h", "print usage")("log-level", po::value<int>()->default_value(2),
+                                                    "set log level 0-5 (trace, debug, info, warning, error, fatal)")(
+        "src", po::value<std::string>()->default_value(""),
+        "Docker data root folder generated by the `export` command")(
+        "docker-root", po::value<std::string>()->default_value("/var/lib/docker"),
+        "Docker data root folder, the docker daemon must not be running")(
+        "force", po::bool_switch()->default_value(false), "Replace the docker data root if it is not empty");
+  }
+
+  int operator()(const po::variables_map& vm) const override {
+    try {
+      if (vm["src"].as<std::string>().empty()) {
+        throw std::invalid_argument("The source folder is not specified, use --src");
+      }
+
+      return importDockerStore(vm["src"].as<std::string>(), vm["docker-root"].as<std::string>(),
+                               vm["force"].as<bool>());
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Failed to import preloaded Apps's images: " << exc.what();
+      return EXIT_FAILURE;
+    }
+  }
+
+ private:
+  static int importDockerStore(const std::string& src_root, const std::string& docker_root, bool force);
+
+  po::options_description _options;
+};
+
 class RunCmd : public Cmd {
  public:
   RunCmd() : Cmd("run", _options) {
@@ -99,7 +192,9 @@ class RunCmd : public Cmd {
         "docker-root", po::value<std::string>()->default_value("/var/lib/docker"), "Docker data root folder")(
         "client", po::value<std::string>()->default_value("/usr/sbin/skopeo"), "A client to copy images")(
         "compose-client", po::value<std::string>()->default_value("/usr/bin/docker compose "),
-        "A client to manage compose apps");
+        "A client to manage compose apps")(
+        "jobs,j", po::value<int>()->default_value(1),
+        "Number of Apps to start in parallel, the images shared by Apps are loaded once ahead of starting them");
   }
 
   int operator()(const po::variables_map& vm) const override {
@@ -109,9 +204,14 @@ class RunCmd : public Cmd {
         boost::split(apps, vm["apps"].as<std::string>(), boost::is_any_of(", "), boost::token_compress_on);
       }
 
+      const auto jobs{vm["jobs"].as<int>()};
+      if (jobs < 1) {
+        throw std::invalid_argument("Invalid number of jobs, should be a positive integer: " + std::to_string(jobs));
+      }
+
       return runApps(apps, vm["docker-host"].as<std::string>(), vm["store-root"].as<std::string>(),
                      vm["compose-root"].as<std::string>(), vm["docker-root"].as<std::string>(),
-                     vm["client"].as<std::string>(), vm["compose-client"].as<std::string>());
+                     vm["client"].as<std::string>(), vm["compose-client"].as<std::string>(), jobs);
     } catch (const std::exception& exc) {
       LOG_ERROR << "Failed to run preloaded Apps: " << exc.what();
       return EXIT_FAILURE;
@@ -121,7 +221,7 @@ class RunCmd : public Cmd {
  private:
   static int runApps(const std::vector<std::string>& shortlist, const std::string& docker_host,
                      const std::string& store_root, const std::string& compose_root, const std::string& docker_root,
-                     const std::string& client, const std::string& compose_client);
+                     const std::string& client, const std::string& compose_client, int jobs);
 
   po::options_description _options;
 };
@@ -11,8 +11,11 @@ namespace po = boost::program_options;
 
 static std::vector<apps::aklite_apps::Cmd::Ptr> cmds{
     std::make_shared<apps::aklite_apps::ListCmd>(),
+    std::make_shared<apps::aklite_apps::StatsCmd>(),
     std::make_shared<apps::aklite_apps::RunCmd>(),
     std::make_shared<apps::aklite_apps::RegisterCmd>(),
+    std::make_shared<apps::aklite_apps::ExportCmd>(),
+    std::make_shared<apps::aklite_apps::ImportCmd>(),
 };
 
 static void print_usage() {
@@ -4,6 +4,10 @@
 #ifndef AKTUALIZR_LITE_API_H_
 #define AKTUALIZR_LITE_API_H_
 
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -15,6 +19,10 @@
 class Config;
 class LiteClient;
 
+namespace api {
+class FlowControlToken;
+}
+
 /**
  * A high-level representation of a TUF Target in terms applicable to a
  * FoundriesFactory.
@@ -75,6 +83,20 @@ class CheckInResult {
   std::vector<TufTarget> targets_;
 };
 
+/**
+ * The response from an AkliteClient call to CheckForUpdate()
+ */
+class UpdateCheckResult {
+ public:
+  UpdateCheckResult(CheckInResult::Status status, bool update_available, TufTarget latest)
+      : status(status), update_available(update_available), latest(std::move(latest)) {}
+  CheckInResult::Status status;
+  // Whether the latest Target version is newer than the current one
+  bool update_available;
+  // The latest Target of the primary, a Target with an empty name if there is none
+  TufTarget latest;
+};
+
 /**
  * The response from an AkliteClient call to Install
  */
@@ -113,6 +135,135 @@ class DownloadResult {
 std::ostream &operator<<(std::ostream &os, const InstallResult &res);
 std::ostream &operator<<(std::ostream &os, const DownloadResult &res);
 
+/**
+ * The response from an AkliteClient call to EstimateUpdateCost(), what
+ * downloading a Target would take, estimated without downloading any of its
+ * content. The sizes are in bytes.
+ */
+class UpdateCost {
+ public:
+  enum class Status {
+    Ok = 0,
+    Failed,
+  };
+  Status status{Status::Ok};
+  std::string description;
+
+  // The size of the static delta of the Target ostree commit, zero if the
+  // commit is present locally
+  uint64_t ostree_download{0};
+  // The storage the ostree delta requires to be applied
+  uint64_t ostree_usage{0};
+  // The App archives and image layers missing locally, the layers shared by
+  // several Apps are counted once
+  uint64_t app_archive_download{0};
+  uint64_t app_layer_download{0};
+  // The growth of the docker store once the missing layers are extracted
+  uint64_t docker_store_growth{0};
+  // The largest shortage of storage among the stores the content goes to,
+  // the download would fail with DownloadFailed_NoSpace unless it is zero
+  uint64_t space_shortfall{0};
+  // False if the size of some content is unknown, e.g. the ostree remote
+  // provides no static delta of the commit, the sizes are the lower bound then
+  bool exact{true};
+
+  // NOLINTNEXTLINE(hicpp-explicit-conversions,google-explicit-constructor)
+  operator bool() const { return status == Status::Ok; }
+  bool noSpace() const { return space_shortfall > 0; }
+  uint64_t download() const { return ostree_download + app_archive_download + app_layer_download; }
+};
+
+/**
+ * Progress of a Target download. It is reported periodically while a Target
+ * component is being downloaded and once its download completes.
+ */
+class DownloadProgress {
+ public:
+  enum class Source {
+    Ostree = 0,  // ostree commit pull, `name` is the commit hash
+    AppBlob,     // App blob download from a container registry, `name` is the blob URI
+    AppImages,   // pull of App images, `name` is the App URI
+  };
+
+  Source source;
+  std::string name;
+  // The current download phase, e.g. "Receiving objects"
+  std::string description;
+  uint64_t bytes_fetched{0};
+  // Zero if the total size is unknown
+  uint64_t bytes_total{0};
+  unsigned int percent{0};
+  double elapsed_sec{0};
+  // Average download rate since the download start, bytes per second
+  double rate{0};
+  bool completed{false};
+};
+
+using DownloadProgressCb = std::function<void(const DownloadProgress &)>;
+
+/**
+ * A token to cancel an asynchronous download or install with. It is backed by
+ * aktualizr's api::FlowControlToken, so the operation checks it and stops
+ * cleanly between its steps, e.g. ostree object batches or Apps.
+ */
+class CancellationToken {
+ public:
+  CancellationToken();
+  ~CancellationToken();
+  CancellationToken(const CancellationToken &) = delete;
+  CancellationToken(CancellationToken &&) = delete;
+  CancellationToken &operator=(const CancellationToken &) = delete;
+  CancellationToken &operator=(CancellationToken &&) = delete;
+
+  /**
+   * Request the operation to stop, returns false if it has been requested
+   * already.
+   */
+  bool Cancel();
+  bool IsCancelled() const;
+  const api::FlowControlToken *FlowControl() const { return token_.get(); }
+
+ private:
+  std::unique_ptr<api::FlowControlToken> token_;
+};
+
+struct SecondaryEcu {
+  SecondaryEcu(std::string serial, std::string hwid, std::string target_name)
+      : serial(std::move(serial)), hwid(std::move(hwid)), target_name(std::move(target_name)) {}
+  std::string serial;
+  std::string hwid;
+  std::string target_name;
+};
+
+/**
+ * An update of a secondary ECU to the given Target, see
+ * InstallContext::UpdateSecondaries().
+ */
+struct SecondaryUpdate {
+  // Receives the Target artifact content as it is downloaded, e.g. to stream
+  // it to the ECU flasher, returns false to abort the download. The content
+  // is not verified until it has been received in full, so it must not be
+  // applied before `Finish` is called, which happens only if the artifact
+  // length and hash match the verified Target.
+  using Sink = std::function<bool(const char *data, std::size_t size)>;
+  // Completes the ECU update once its artifact has been downloaded and verified
+  using Finish = std::function<InstallResult(const SecondaryEcu &)>;
+
+  SecondaryUpdate(SecondaryEcu ecu, TufTarget target, Sink sink, Finish finish = nullptr)
+      : ecu(std::move(ecu)), target(std::move(target)), sink(std::move(sink)), finish(std::move(finish)) {}
+  SecondaryEcu ecu;
+  TufTarget target;
+  Sink sink;
+  Finish finish;
+};
+
+struct SecondaryUpdateResult {
+  std::string serial;
+  DownloadResult download;
+  // Set if there is the update finish callback and the download succeeded
+  InstallResult install;
+};
+
 class InstallContext {
  public:
   InstallContext(const InstallContext &) = delete;
@@ -123,6 +274,21 @@ class InstallContext {
   virtual ~InstallContext() = default;
   virtual DownloadResult Download() = 0;
   virtual InstallResult Install() = 0;
+  /**
+   * Run Download() in a separate thread. The given callback receives the
+   * progress of this download in addition to the one set by
+   * AkliteClient::SetDownloadProgressCallback(). Once the token is cancelled
+   * the download stops between ostree object batches or Apps and fails. The
+   * context must outlive the returned future.
+   */
+  virtual std::future<DownloadResult> DownloadAsync(DownloadProgressCb progress_cb = nullptr,
+                                                    std::shared_ptr<CancellationToken> token = nullptr) = 0;
+  /**
+   * Run Install() in a separate thread. An install that has started is not
+   * interrupted since it can't be rolled back halfway, so the token only
+   * prevents it from starting. The context must outlive the returned future.
+   */
+  virtual std::future<InstallResult> InstallAsync(std::shared_ptr<CancellationToken> token = nullptr) = 0;
   virtual std::string GetCorrelationId() = 0;
 
   enum class SecondaryEvent {
@@ -138,18 +304,21 @@ class InstallContext {
 
   virtual void QueueEvent(std::string ecu_serial, SecondaryEvent event, std::string details) = 0;
 
+  /**
+   * Update the given secondary ECUs, up to `concurrency` of them at once.
+   * Each Target artifact is downloaded from the TUF repo and streamed to its
+   * sink while its hash is verified, then the update finish callback, if any,
+   * is invoked. The callbacks are invoked from the worker threads. The
+   * download and install events of all ECUs are queued in a single batch once
+   * all updates are done. The results are in the order of the given updates.
+   */
+  virtual std::vector<SecondaryUpdateResult> UpdateSecondaries(const std::vector<SecondaryUpdate> &updates,
+                                                               int concurrency = 4) = 0;
+
  protected:
   InstallContext() = default;
 };
 
-struct SecondaryEcu {
-  SecondaryEcu(std::string serial, std::string hwid, std::string target_name)
-      : serial(std::move(serial)), hwid(std::move(hwid)), target_name(std::move(target_name)) {}
-  std::string serial;
-  std::string hwid;
-  std::string target_name;
-};
-
 /**
  * The response from an AkliteClient call to GetDevice
  */
@@ -222,6 +391,15 @@ class AkliteClient {
    */
   CheckInResult CheckIn() const;
 
+  /**
+   * A cheap alternative to CheckIn() for frequent polling, it just tells
+   * whether there is a Target newer than GetCurrent() for the primary. The TUF
+   * metadata are refreshed only if their timestamp has changed, the device
+   * state is not reported, and just the latest Target matching the primary
+   * hardware ID and tags is looked up instead of listing all Targets.
+   */
+  UpdateCheckResult CheckForUpdate() const;
+
   /**
    * Return the active aktualizr-lite configuration.
    */
@@ -249,6 +427,15 @@ class AkliteClient {
   std::unique_ptr<InstallContext> Installer(const TufTarget &t, std::string reason = "",
                                             std::string correlation_id = "") const;
 
+  /**
+   * Estimate what downloading the given Target would take: the ostree and App
+   * content missing locally and whether it fits the storage. Just the
+   * metadata, i.e. the App manifests and the ostree delta superblock, are
+   * fetched, so it can be used to stage a rollout by bandwidth and skip the
+   * devices that would fail the download with DownloadFailed_NoSpace.
+   */
+  UpdateCost EstimateUpdateCost(const TufTarget &t) const;
+
   /**
    * Check if the Target has been installed but failed to boot. This would
    * make this be considered a "rollback target" and one we shouldn't consider
@@ -256,6 +443,14 @@ class AkliteClient {
    */
   bool IsRollback(const TufTarget &t) const;
 
+  /**
+   * Return the timing statistics of the utilities (skopeo, tar, compose, etc)
+   * run by aktualizr-lite, per command: the number of runs, failures and
+   * timeouts, the total and max wall time, the stderr size and the wall time
+   * histogram.
+   */
+  Json::Value GetExecStats() const;
+
   /**
    * Set the secondary ECUs managed by this device. Will update the status of
    * the ECUs on the device-gateway and instruct the CheckIn method to also
@@ -263,6 +458,13 @@ class AkliteClient {
    */
   InstallResult SetSecondaries(const std::vector<SecondaryEcu> &ecus);
 
+  /**
+   * Set a callback that receives the progress of Target downloads driven by
+   * InstallContext::Download(). The callback can be invoked from several
+   * threads, though not concurrently, so it should be quick and not block.
+   */
+  void SetDownloadProgressCallback(DownloadProgressCb cb);
+
   /**
    * Default files/paths to search for sota toml when configuration client.
    */
@@ -2,15 +2,25 @@
 
 #include <sys/file.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include "crypto/crypto.h"
+#include "downloader.h"
+#include "execstats.h"
 #include "helpers.h"
 #include "http/httpclient.h"
 #include "libaktualizr/config.h"
 #include "liteclient.h"
 #include "primary/reportqueue.h"
+#include "target.h"
+#include "utilities/apiqueue.h"
 
 const std::vector<boost::filesystem::path> AkliteClient::CONFIG_DIRS = {"/usr/lib/sota/conf.d", "/var/sota/sota.toml",
                                                                         "/etc/sota/conf.d/"};
@@ -28,6 +38,14 @@ TufTarget CheckInResult::GetLatest(std::string hwid) const {
   throw std::runtime_error("no target for this hwid");
 }
 
+CancellationToken::CancellationToken() : token_{new api::FlowControlToken()} {}
+
+CancellationToken::~CancellationToken() = default;
+
+bool CancellationToken::Cancel() { return token_->setAbort(); }
+
+bool CancellationToken::IsCancelled() const { return !token_->canContinue(false); }
+
 std::ostream& operator<<(std::ostream& os, const DownloadResult& res) {
   if (res.status == DownloadResult::Status::Ok) {
     os << "Ok/";
@@ -124,8 +142,23 @@ CheckInResult AkliteClient::CheckIn() const {
     status = CheckInResult::Status::OkCached;
   }
 
+  const auto catalog{client_->targetCatalog()};
+  std::vector<Uptane::HardwareIdentifier> hwids{hwidToFind};
+  for (const auto& hwid : secondary_hwids_) {
+    hwids.emplace_back(hwid);
+  }
+  // the catalog just tells which Targets match, they are listed in the order of the TUF metadata
+  std::set<std::string> found;
+  for (const auto& hwid : hwids) {
+    for (const auto& t : catalog->getTargets(hwid, client_->tags)) {
+      found.emplace(t->filename());
+    }
+  }
   std::vector<TufTarget> targets;
   for (const auto& t : client_->allTargets()) {
+    if (found.count(t.filename()) == 0) {
+      continue;
+    }
     int ver = 0;
     try {
       ver = std::stoi(t.custom_version(), nullptr, 0);
@@ -133,27 +166,40 @@ CheckInResult AkliteClient::CheckIn() const {
       LOG_ERROR << "Invalid version number format: " << t.custom_version();
       ver = -1;
     }
-    if (!target_has_tags(t, client_->tags)) {
-      continue;
-    }
-    for (const auto& it : t.hardwareIds()) {
-      if (it == hwidToFind) {
-        targets.emplace_back(t.filename(), t.sha256Hash(), ver, t.custom_data());
-        break;
-      }
-      for (const auto& hwid : secondary_hwids_) {
-        if (it == Uptane::HardwareIdentifier(hwid)) {
-          targets.emplace_back(t.filename(), t.sha256Hash(), ver, t.custom_data());
-          break;
-        }
-      }
-    }
+    targets.emplace_back(t.filename(), t.sha256Hash(), ver, t.custom_data());
   }
 
-  std::sort(targets.begin(), targets.end(), compareTargets);
+  // the Targets of the same version are kept in the TUF metadata order
+  std::stable_sort(targets.begin(), targets.end(), compareTargets);
   return CheckInResult(status, client_->config.provision.primary_ecu_hardware_id, targets);
 }
 
+UpdateCheckResult AkliteClient::CheckForUpdate() const {
+  auto status = CheckInResult::Status::Ok;
+  const TufTarget none{"", "", -1, Json::Value()};
+  // the metadata are not fetched at all if the timestamp role has not changed since the last check
+  const auto rc = client_->updateImageMeta();
+  if (!std::get<0>(rc)) {
+    LOG_WARNING << "Unable to update latest metadata, using local copy: " << std::get<1>(rc);
+    if (!client_->checkImageMetaOffline()) {
+      LOG_ERROR << "Unable to use local copy of TUF data";
+      return UpdateCheckResult(CheckInResult::Status::Failed, false, none);
+    }
+    status = CheckInResult::Status::OkCached;
+  }
+
+  const Uptane::HardwareIdentifier hwid(client_->config.provision.primary_ecu_hardware_id);
+  const auto latest{client_->targetCatalog()->getLatest(hwid, client_->tags)};
+  if (latest == nullptr) {
+    return UpdateCheckResult(status, false, none);
+  }
+  const auto current{client_->getCurrent()};
+  // neither a rebuild of the current version nor a Target older than the current one, e.g. after a tag change, is
+  // an update
+  const bool update_available{Target::Version(current.custom_version()) < Target::Version(latest->custom_version())};
+  return UpdateCheckResult(status, update_available, Target::toTufTarget(*latest));
+}
+
 boost::property_tree::ptree AkliteClient::GetConfig() const {
   std::stringstream ss;
   ss << client_->config;
@@ -215,31 +261,164 @@ class LiteInstall : public InstallContext {
     return InstallResult{status, ""};
   }
 
-  DownloadResult Download() override {
-    auto reason = reason_;
-    if (reason.empty()) {
-      reason = "Update to " + target_->filename();
-    }
+  DownloadResult Download() override { return download(nullptr, nullptr); }
 
-    client_->logTarget("Downloading: ", *target_);
+  std::future<DownloadResult> DownloadAsync(DownloadProgressCb progress_cb,
+                                            std::shared_ptr<CancellationToken> token) override {
+    return std::async(std::launch::async, [this, progress_cb, token]() {
+      return download(progress_cb, token ? token->FlowControl() : nullptr);
+    });
+  }
 
-    auto download_res{client_->download(*target_, reason)};
-    if (!download_res) {
-      return download_res;
+  std::future<InstallResult> InstallAsync(std::shared_ptr<CancellationToken> token) override {
+    return std::async(std::launch::async, [this, token]() {
+      if (token && token->IsCancelled()) {
+        return InstallResult{InstallResult::Status::Failed, "Install has been cancelled"};
+      }
+      return Install();
+    });
+  }
+
+  std::string GetCorrelationId() override { return target_->correlation_id(); }
+
+  void QueueEvent(std::string ecu_serial, SecondaryEvent event, std::string details) override {
+    auto e{makeEvent(ecu_serial, event, details)};
+    e->custom["targetName"] = target_->filename();
+    e->custom["version"] = target_->custom_version();
+    client_->report_queue->enqueue(std::move(e));
+  }
+
+  std::vector<SecondaryUpdateResult> UpdateSecondaries(const std::vector<SecondaryUpdate>& updates,
+                                                       int concurrency) override {
+    // the events of each ECU are collected by its worker and queued together once all the updates are done
+    std::vector<SecondaryUpdateResult> results(updates.size());
+    std::vector<std::vector<std::unique_ptr<ReportEvent>>> events(updates.size());
+    std::atomic<std::size_t> next{0};
+    // the ECU artifacts are checked against the verified Targets metadata rather than the given Targets
+    const auto catalog{client_->targetCatalog()};
+    const auto worker = [this, &updates, &results, &events, &next, &catalog]() {
+      // a curl handle per worker, HttpClient is not thread-safe
+      HttpClient http_client{*client_->http_client};
+      for (auto ii = next++; ii < updates.size(); ii = next++) {
+        results[ii] = updateSecondary(http_client, *catalog, updates[ii], events[ii]);
+      }
+    };
+    const auto worker_numb{std::min<std::size_t>(static_cast<std::size_t>(std::max(concurrency, 1)), updates.size())};
+    std::vector<std::thread> workers;
+    workers.reserve(worker_numb);
+    for (std::size_t ii = 0; ii < worker_numb; ++ii) {
+      workers.emplace_back(worker);
+    }
+    for (auto& worker_thread : workers) {
+      worker_thread.join();
     }
 
-    if (client_->VerifyTarget(*target_) != TargetStatus::kGood) {
-      data::InstallationResult ires{data::ResultCode::Numeric::kVerificationFailed, "Downloaded target is invalid"};
-      client_->notifyInstallFinished(*target_, ires);
-      return DownloadResult{DownloadResult::Status::VerificationFailed, ires.description};
+    for (auto& ecu_events : events) {
+      for (auto& e : ecu_events) {
+        client_->report_queue->enqueue(std::move(e));
+      }
     }
+    return results;
+  }
 
-    return DownloadResult{DownloadResult::Status::Ok, ""};
+ private:
+  struct ArtifactSink {
+    const SecondaryUpdate::Sink& sink;
+    const uint64_t expected_size;
+    MultiPartSHA256Hasher hasher;
+    uint64_t received_size{0};
+    bool aborted{false};
+    bool oversized{false};
+  };
+
+  static size_t writeArtifact(char* data, size_t size, size_t nmemb, void* userp) {
+    auto* artifact_sink{static_cast<ArtifactSink*>(userp)};
+    const auto len{size * nmemb};
+    // the server must not make the ECU flasher receive more than the Target states, the transfer is aborted then
+    if (artifact_sink->received_size + len > artifact_sink->expected_size) {
+      artifact_sink->oversized = true;
+      return 0;
+    }
+    artifact_sink->received_size += len;
+    artifact_sink->hasher.update(reinterpret_cast<const unsigned char*>(data), len);
+    if (!artifact_sink->sink(data, len)) {
+      artifact_sink->aborted = true;
+      // makes curl abort the transfer
+      return 0;
+    }
+    return len;
   }
 
-  std::string GetCorrelationId() override { return target_->correlation_id(); }
+  SecondaryUpdateResult updateSecondary(HttpClient& http_client, const TargetCatalog& catalog,
+                                        const SecondaryUpdate& update,
+                                        std::vector<std::unique_ptr<ReportEvent>>& events) {
+    const auto& target{update.target};
+    const auto add_event = [&](SecondaryEvent event, const std::string& details) {
+      auto e{makeEvent(update.ecu.serial, event, details)};
+      e->custom["targetName"] = target.Name();
+      e->custom["version"] = std::to_string(target.Version());
+      events.emplace_back(std::move(e));
+    };
+
+    SecondaryUpdateResult res{update.ecu.serial, {DownloadResult::Status::Ok, ""}, {}};
+    add_event(SecondaryEvent::DownloadStarted, "");
+    try {
+      const auto verified_target{catalog.find(target.Name())};
+      if (!verified_target) {
+        res.download = {DownloadResult::Status::DownloadFailed,
+                        "The ECU Target is not listed in the Targets metadata: " + target.Name()};
+      } else {
+        ArtifactSink artifact_sink{update.sink, verified_target->length(), MultiPartSHA256Hasher{}};
+        const auto url{client_->config.uptane.repo_server + "/targets/" + Utils::urlEncode(target.Name())};
+        const auto resp{http_client.download(url, writeArtifact, nullptr, &artifact_sink, 0)};
+        if (artifact_sink.oversized) {
+          res.download = {DownloadResult::Status::VerificationFailed,
+                          "The ECU artifact exceeds the Target length of " +
+                              std::to_string(verified_target->length()) + " bytes"};
+        } else if (artifact_sink.aborted) {
+          res.download = {DownloadResult::Status::DownloadFailed, "The ECU artifact sink aborted the download"};
+        } else if (!resp.isOk()) {
+          res.download = {DownloadResult::Status::DownloadFailed,
+                          "Failed to download " + url + ": " + resp.getStatusStr()};
+        } else if (artifact_sink.received_size != verified_target->length()) {
+          res.download = {DownloadResult::Status::DownloadFailed,
+                          "The ECU artifact is incomplete: " + std::to_string(artifact_sink.received_size) + " of " +
+                              std::to_string(verified_target->length()) + " bytes received"};
+        } else if (!boost::iequals(artifact_sink.hasher.getHexDigest(), verified_target->sha256Hash())) {
+          res.download = {DownloadResult::Status::VerificationFailed, "The ECU artifact hash mismatch"};
+        }
+      }
+    } catch (const std::exception& exc) {
+      res.download = {DownloadResult::Status::DownloadFailed, exc.what()};
+    }
+    if (!res.download) {
+      LOG_ERROR << "Failed to download " << target.Name() << " for ECU " << update.ecu.serial << ": "
+                << res.download.description;
+      add_event(SecondaryEvent::DownloadFailed, res.download.description);
+      return res;
+    }
+    add_event(SecondaryEvent::DownloadCompleted, "");
+
+    if (update.finish) {
+      add_event(SecondaryEvent::InstallStarted, "");
+      try {
+        res.install = update.finish(update.ecu);
+      } catch (const std::exception& exc) {
+        res.install = {InstallResult::Status::Failed, exc.what()};
+      }
+      if (res.install.status == InstallResult::Status::Ok) {
+        add_event(SecondaryEvent::InstallCompleted, res.install.description);
+      } else if (res.install.status == InstallResult::Status::NeedsCompletion) {
+        add_event(SecondaryEvent::InstallNeedsCompletion, res.install.description);
+      } else {
+        add_event(SecondaryEvent::InstallFailed, res.install.description);
+      }
+    }
+    return res;
+  }
 
-  void QueueEvent(std::string ecu_serial, SecondaryEvent event, std::string details) override {
+  std::unique_ptr<ReportEvent> makeEvent(const std::string& ecu_serial, SecondaryEvent event,
+                                         const std::string& details) {
     Uptane::EcuSerial serial(ecu_serial);
     std::unique_ptr<ReportEvent> e;
     if (event == InstallContext::SecondaryEvent::DownloadStarted) {
@@ -263,13 +442,31 @@ class LiteInstall : public InstallContext {
     if (!details.empty()) {
       e->custom["details"] = details;
     }
+    return e;
+  }
 
-    e->custom["targetName"] = target_->filename();
-    e->custom["version"] = target_->custom_version();
-    client_->report_queue->enqueue(std::move(e));
+  DownloadResult download(DownloadProgressCb progress_cb, const api::FlowControlToken* token) {
+    auto reason = reason_;
+    if (reason.empty()) {
+      reason = "Update to " + target_->filename();
+    }
+
+    client_->logTarget("Downloading: ", *target_);
+
+    auto download_res{client_->download(*target_, reason, token, std::move(progress_cb))};
+    if (!download_res) {
+      return download_res;
+    }
+
+    if (client_->VerifyTarget(*target_) != TargetStatus::kGood) {
+      data::InstallationResult ires{data::ResultCode::Numeric::kVerificationFailed, "Downloaded target is invalid"};
+      client_->notifyInstallFinished(*target_, ires);
+      return DownloadResult{DownloadResult::Status::VerificationFailed, ires.description};
+    }
+
+    return DownloadResult{DownloadResult::Status::Ok, ""};
   }
 
- private:
   std::shared_ptr<LiteClient> client_;
   std::unique_ptr<Uptane::Target> target_;
   std::string reason_;
@@ -296,16 +493,11 @@ std::unique_ptr<InstallContext> AkliteClient::Installer(const TufTarget& t, std:
   }
   // Make sure the metadata is loaded from storage and valid.
   client_->checkImageMetaOffline();
-  std::unique_ptr<Uptane::Target> target;
-  for (const auto& tt : client_->allTargets()) {
-    if (tt.filename() == t.Name()) {
-      target = std::make_unique<Uptane::Target>(tt);
-      break;
-    }
-  }
-  if (target == nullptr) {
+  const auto found_target{client_->targetCatalog()->find(t.Name())};
+  if (found_target == nullptr) {
     return nullptr;
   }
+  auto target{std::make_unique<Uptane::Target>(*found_target)};
   if (correlation_id.empty()) {
     boost::uuids::uuid tmp = boost::uuids::random_generator()();
     correlation_id = std::to_string(t.Version()) + "-" + boost::uuids::to_string(tmp);
@@ -318,6 +510,27 @@ std::unique_ptr<InstallContext> AkliteClient::Installer(const TufTarget& t, std:
   return std::make_unique<LiteInstall>(client_, std::move(target), reason);
 }
 
+UpdateCost AkliteClient::EstimateUpdateCost(const TufTarget& t) const {
+  UpdateCost cost;
+  try {
+    client_->checkImageMetaOffline();
+    // the Target Apps are taken from the verified metadata
+    const auto found_target{client_->targetCatalog()->find(t.Name())};
+    if (found_target == nullptr) {
+      cost.status = UpdateCost::Status::Failed;
+      cost.description = "Target not found: " + t.Name();
+      return cost;
+    }
+    cost = client_->downloader()->EstimateCost(Target::toTufTarget(*found_target));
+  } catch (const std::exception& exc) {
+    cost.status = UpdateCost::Status::Failed;
+    cost.description = "Failed to estimate the update cost: " + std::string(exc.what());
+  }
+  return cost;
+}
+
+Json::Value AkliteClient::GetExecStats() const { return ExecStats::instance().toJson(); }
+
 bool AkliteClient::IsRollback(const TufTarget& t) const {
   Json::Value target_json;
   target_json["hashes"]["sha256"] = t.Sha256Hash();
@@ -348,3 +561,5 @@ InstallResult AkliteClient::SetSecondaries(const std::vector<SecondaryEcu>& ecus
   secondary_hwids_ = std::move(hwids);
   return InstallResult{InstallResult::Status::Ok, ""};
 }
+
+void AkliteClient::SetDownloadProgressCallback(DownloadProgressCb cb) { client_->setDownloadProgressCb(std::move(cb)); }
@@ -0,0 +1,172 @@
+#include "apparchive.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/process/search_path.hpp>
+
+using ArchivePtr = std::unique_ptr<struct archive, decltype(&archive_read_free)>;
+using ArchiveWriterPtr = std::unique_ptr<struct archive, decltype(&archive_write_free)>;
+
+static std::string normalizeMember(const std::string& member) {
+  std::string res{member};
+  while (boost::starts_with(res, "./")) {
+    res.erase(0, 2);
+  }
+  return res;
+}
+
+// The data of a gzip archive are decompressed by the external parallel gunzip if `parallel` is set and the latter is
+// installed, it is worth the process spawn only if the whole archive is read
+static ArchivePtr openArchive(const boost::filesystem::path& path, std::size_t block_size, bool parallel = false) {
+  ArchivePtr reader{archive_read_new(), archive_read_free};
+  if (!reader) {
+    throw std::runtime_error("Failed to allocate an archive reader");
+  }
+  if (parallel && !AppArchive::parallelGunzip().empty() && AppArchive::isGzip(path)) {
+    archive_read_support_filter_program(reader.get(), AppArchive::parallelGunzip().c_str());
+  } else {
+    archive_read_support_filter_all(reader.get());
+  }
+  archive_read_support_format_tar(reader.get());
+  if (archive_read_open_filename(reader.get(), path.c_str(), block_size) != ARCHIVE_OK) {
+    throw std::runtime_error("Failed to open archive " + path.string() + ": " + archive_error_string(reader.get()));
+  }
+  return reader;
+}
+
+AppArchive::AppArchive(boost::filesystem::path path) : path_{std::move(path)} {}
+
+void AppArchive::extract(const boost::filesystem::path& dst_dir) const {
+  auto reader{openArchive(path_, ReadBlockSize, true)};
+  ArchiveWriterPtr writer{archive_write_disk_new(), archive_write_free};
+  if (!writer) {
+    throw std::runtime_error("Failed to allocate an archive writer");
+  }
+  // the same as `tar --overwrite -xf` does by default with the addition of the path sanity checks
+  archive_write_disk_set_options(writer.get(), ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_UNLINK |
+                                                   ARCHIVE_EXTRACT_SECURE_SYMLINKS | ARCHIVE_EXTRACT_SECURE_NODOTDOT);
+  archive_write_disk_set_standard_lookup(writer.get());
+
+  boost::filesystem::create_directories(dst_dir);
+  // the writer refuses to extract through symlinks, so the destination path itself must not have them
+  const auto dst_path{boost::filesystem::canonical(dst_dir)};
+  struct archive_entry* entry{nullptr};
+  int res;
+  while ((res = archive_read_next_header(reader.get(), &entry)) != ARCHIVE_EOF) {
+    if (res < ARCHIVE_WARN) {
+      throw std::runtime_error("Failed to read archive " + path_.string() + ": " + archive_error_string(reader.get()));
+    }
+    // the writer extracts relative to the current working dir, so the member paths are made relative to the
+    // destination dir instead of changing the process working dir
+    const std::string member{archive_entry_pathname(entry)};
+    if (boost::starts_with(member, "/")) {
+      throw std::runtime_error("Invalid archive " + path_.string() + ", absolute member path: " + member);
+    }
+    archive_entry_set_pathname(entry, (dst_path / member).c_str());
+    const char* hardlink{archive_entry_hardlink(entry)};
+    if (hardlink != nullptr) {
+      archive_entry_set_hardlink(entry, (dst_path / hardlink).c_str());
+    }
+
+    if (archive_write_header(writer.get(), entry) < ARCHIVE_WARN) {
+      throw std::runtime_error("Failed to extract " + member + " from " + path_.string() + ": " +
+                               archive_error_string(writer.get()));
+    }
+    const void* block;
+    std::size_t size;
+    la_int64_t offset;
+    while ((res = archive_read_data_block(reader.get(), &block, &size, &offset)) != ARCHIVE_EOF) {
+      if (res < ARCHIVE_WARN) {
+        break;
+      }
+      if (archive_write_data_block(writer.get(), block, size, offset) < 0) {
+        throw std::runtime_error("Failed to extract " + member + " from " + path_.string() + ": " +
+                                 archive_error_string(writer.get()));
+      }
+    }
+    if (res < ARCHIVE_WARN) {
+      throw std::runtime_error("Failed to read " + member + " from " + path_.string() + ": " +
+                               archive_error_string(reader.get()));
+    }
+    if (archive_write_finish_entry(writer.get()) < ARCHIVE_WARN) {
+      throw std::runtime_error("Failed to extract " + member + " from " + path_.string() + ": " +
+                               archive_error_string(writer.get()));
+    }
+  }
+  if (archive_write_close(writer.get()) != ARCHIVE_OK) {
+    throw std::runtime_error("Failed to extract archive " + path_.string() + ": " +
+                             archive_error_string(writer.get()));
+  }
+}
+
+std::string AppArchive::readFile(const std::string& member) const {
+  auto reader{openArchive(path_, ReadBlockSize)};
+  const auto member_path{normalizeMember(member)};
+  struct archive_entry* entry{nullptr};
+  int res;
+  while ((res = archive_read_next_header(reader.get(), &entry)) != ARCHIVE_EOF) {
+    if (res < ARCHIVE_WARN) {
+      throw std::runtime_error("Failed to read archive " + path_.string() + ": " + archive_error_string(reader.get()));
+    }
+    if (normalizeMember(archive_entry_pathname(entry)) != member_path) {
+      continue;
+    }
+    std::string content;
+    content.reserve(static_cast<std::size_t>(std::max<la_int64_t>(archive_entry_size(entry), 0)));
+    char buffer[ReadBlockSize / 8];
+    la_ssize_t read_size;
+    while ((read_size = archive_read_data(reader.get(), buffer, sizeof(buffer))) > 0) {
+      content.append(buffer, static_cast<std::size_t>(read_size));
+    }
+    if (read_size < 0) {
+      throw std::runtime_error("Failed to read " + member + " from " + path_.string() + ": " +
+                               archive_error_string(reader.get()));
+    }
+    return content;
+  }
+  throw std::runtime_error("No " + member + " found in archive " + path_.string());
+}
+
+uint64_t AppArchive::getExtractedSize() const {
+  auto reader{openArchive(path_, ReadBlockSize)};
+  uint64_t size{0};
+  struct archive_entry* entry{nullptr};
+  int res;
+  while ((res = archive_read_next_header(reader.get(), &entry)) != ARCHIVE_EOF) {
+    if (res < ARCHIVE_WARN) {
+      throw std::runtime_error("Failed to read archive " + path_.string() + ": " + archive_error_string(reader.get()));
+    }
+    // hardlinks have no content of their own
+    if (archive_entry_filetype(entry) == AE_IFREG && archive_entry_hardlink(entry) == nullptr &&
+        archive_entry_size(entry) > 0) {
+      size += static_cast<uint64_t>(archive_entry_size(entry));
+    }
+    // the next header read skips the member data
+  }
+  return size;
+}
+
+bool AppArchive::isGzip(const boost::filesystem::path& path) {
+  std::ifstream file{path.string(), std::ios::binary};
+  char magic[2]{};
+  return file.read(magic, sizeof(magic)) && magic[0] == '\x1f' && magic[1] == '\x8b';
+}
+
+const std::string& AppArchive::parallelGunzip() {
+  static const std::string cmd{[]() -> std::string {
+    const auto pigz{boost::process::search_path("pigz")};
+    if (pigz.empty()) {
+      return "";
+    }
+    return pigz.string() + " -d -p " + std::to_string(std::max(std::thread::hardware_concurrency(), 1U));
+  }()};
+  return cmd;
+}
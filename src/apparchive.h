@@ -0,0 +1,37 @@
+#ifndef AKTUALIZR_LITE_APP_ARCHIVE_H_
+#define AKTUALIZR_LITE_APP_ARCHIVE_H_
+
+#include <cstdint>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+// App archive, a (compressed) tarball, that is read and extracted in-process by means of libarchive
+class AppArchive {
+ public:
+  explicit AppArchive(boost::filesystem::path path);
+
+  // Extracts the whole archive into the given directory, the files existing in the directory are overwritten.
+  // The members that would be extracted outside of the directory are rejected.
+  void extract(const boost::filesystem::path& dst_dir) const;
+  // Reads the given member into memory, a member path may or may not start with `./`.
+  // Throws std::runtime_error if there is no such member.
+  std::string readFile(const std::string& member) const;
+  // Returns the total size of the archive regular files as specified in the member headers, i.e. the amount of
+  // storage the extracted archive occupies, not counting the file system overhead. The member data are not read.
+  uint64_t getExtractedSize() const;
+
+  // Whether the file starts with the gzip magic
+  static bool isGzip(const boost::filesystem::path& path);
+  // The command that decompresses gzip data from stdin to stdout on all the available cores, i.e. `pigz -d -p <N>`,
+  // empty if pigz is not installed. Unlike zstd, a gzip stream is decompressed on a single core by zlib, the
+  // command also runs the decompression in parallel with the tar parsing and the file writes.
+  static const std::string& parallelGunzip();
+
+ private:
+  static const std::size_t ReadBlockSize{64 * 1024};
+
+  const boost::filesystem::path path_;
+};
+
+#endif  // AKTUALIZR_LITE_APP_ARCHIVE_H_
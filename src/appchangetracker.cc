@@ -0,0 +1,152 @@
+#include "appchangetracker.h"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/range/iterator_range.hpp>
+
+#include "logging/logging.h"
+
+AppChangeTracker::AppChangeTracker(std::vector<boost::filesystem::path> roots,
+                                   ContainerEventsSeqFunc container_events_seq, std::chrono::seconds audit_interval)
+    : roots_{std::move(roots)},
+      container_events_seq_{std::move(container_events_seq)},
+      audit_interval_{audit_interval},
+      inotify_fd_{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)},
+      last_audit_{std::chrono::steady_clock::now()} {
+  if (inotify_fd_ == -1) {
+    LOG_WARNING << "Failed to initialize inotify, the state of all Apps is checked each time: "
+                << std::strerror(errno);
+  }
+}
+
+AppChangeTracker::~AppChangeTracker() {
+  if (inotify_fd_ != -1) {
+    close(inotify_fd_);
+  }
+}
+
+void AppChangeTracker::update(const std::string& context) {
+  if (inotify_fd_ == -1) {
+    setAllDirty();
+    return;
+  }
+  readFsEvents();
+  if (rewatch_) {
+    addWatches();
+  }
+
+  uint64_t events_seq{0};
+  if (!container_events_seq_ || !container_events_seq_(events_seq)) {
+    // a container might have changed unnoticed
+    setAllDirty();
+  } else if (events_seq != events_seq_) {
+    events_seq_ = events_seq;
+    setAllDirty();
+  }
+
+  if (context != context_) {
+    context_ = context;
+    setAllDirty();
+  }
+
+  const auto now{std::chrono::steady_clock::now()};
+  if (now - last_audit_ >= audit_interval_) {
+    LOG_DEBUG << "The Apps state audit interval has elapsed, checking all Apps";
+    last_audit_ = now;
+    setAllDirty();
+  }
+}
+
+bool AppChangeTracker::isDirty(const std::string& app, const std::string& uri) const {
+  const auto found_it{clean_apps_.find(app)};
+  return found_it == clean_apps_.end() || found_it->second != uri;
+}
+
+void AppChangeTracker::setClean(const std::string& app, const std::string& uri) { clean_apps_[app] = uri; }
+
+void AppChangeTracker::setAllDirty() { clean_apps_.clear(); }
+
+void AppChangeTracker::readFsEvents() {
+  alignas(struct inotify_event) char buf[4096];
+  while (true) {
+    const auto len{read(inotify_fd_, buf, sizeof(buf))};
+    if (len <= 0) {
+      if (len == -1 && errno != EAGAIN && errno != EINTR) {
+        LOG_WARNING << "Failed to read inotify events: " << std::strerror(errno);
+        setAllDirty();
+      }
+      return;
+    }
+    for (const char* ptr = buf; ptr < buf + len;) {
+      const auto* event{reinterpret_cast<const struct inotify_event*>(ptr)};
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      if ((event->mask & IN_Q_OVERFLOW) != 0) {
+        setAllDirty();
+        rewatch_ = true;
+        continue;
+      }
+      const auto watch_it{watches_.find(event->wd)};
+      if (watch_it == watches_.end()) {
+        continue;
+      }
+      if (watch_it->second.empty()) {
+        // an App directory has been added to or removed from a root
+        if (event->len > 0) {
+          clean_apps_.erase(event->name);
+        }
+        rewatch_ = true;
+      } else {
+        clean_apps_.erase(watch_it->second);
+      }
+      if ((event->mask & IN_IGNORED) != 0) {
+        watches_.erase(watch_it);
+        rewatch_ = true;
+      }
+    }
+  }
+}
+
+void AppChangeTracker::addWatches() {
+  rewatch_ = false;
+  for (const auto& root : roots_) {
+    boost::system::error_code ec;
+    if (!boost::filesystem::is_directory(root, ec)) {
+      // it is to be watched once created
+      rewatch_ = true;
+      continue;
+    }
+    addWatch(root, "");
+    for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(root, ec), {})) {
+      if (boost::filesystem::is_directory(entry.path(), ec)) {
+        addWatch(entry.path(), entry.path().filename().string());
+      }
+    }
+  }
+}
+
+void AppChangeTracker::addWatch(const boost::filesystem::path& path, const std::string& app) {
+  static const uint32_t mask{IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                             IN_DELETE_SELF | IN_MOVE_SELF};
+  // adding a watch of an already watched path returns the same descriptor
+  const auto wd{inotify_add_watch(inotify_fd_, path.c_str(), mask)};
+  if (wd == -1) {
+    LOG_WARNING << "Failed to watch " << path << ": " << std::strerror(errno);
+    // the App changes can't be tracked
+    clean_apps_.erase(app);
+    rewatch_ = true;
+    return;
+  }
+  if (watches_.count(wd) == 0) {
+    // the changes made before the watch has been added are unknown
+    if (app.empty()) {
+      setAllDirty();
+    } else {
+      clean_apps_.erase(app);
+    }
+  }
+  watches_[wd] = app;
+}
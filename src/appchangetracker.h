@@ -0,0 +1,63 @@
+#ifndef AKTUALIZR_LITE_APP_CHANGE_TRACKER_H_
+#define AKTUALIZR_LITE_APP_CHANGE_TRACKER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+// Tracks whether the state of installed Apps may have changed since it was checked the last time, so the state of
+// the unchanged (clean) Apps doesn't need to be checked again.
+//
+// An App becomes dirty if:
+//  - its directory or a file in it under any of the watched roots is changed (inotify);
+//  - any container event has happened or the events are not being received;
+//  - the context of the check, e.g. the current and the checked Targets, has changed;
+//  - the App URI has changed;
+//  - the audit interval has elapsed since the last full check, all Apps are dirty then.
+class AppChangeTracker {
+ public:
+  // Returns false if the container events are not followed at the moment, otherwise sets the sequence number of the
+  // last received container event
+  using ContainerEventsSeqFunc = std::function<bool(uint64_t&)>;
+
+  AppChangeTracker(std::vector<boost::filesystem::path> roots, ContainerEventsSeqFunc container_events_seq,
+                   std::chrono::seconds audit_interval);
+  ~AppChangeTracker();
+  AppChangeTracker(const AppChangeTracker&) = delete;
+  AppChangeTracker& operator=(const AppChangeTracker&) = delete;
+  AppChangeTracker(AppChangeTracker&&) = delete;
+  AppChangeTracker& operator=(AppChangeTracker&&) = delete;
+
+  // Collects the changes since the previous call, must be called before checking Apps
+  void update(const std::string& context);
+  bool isDirty(const std::string& app, const std::string& uri) const;
+  // Marks the App as clean, i.e. its state has been checked and it is as expected
+  void setClean(const std::string& app, const std::string& uri);
+  void setAllDirty();
+
+ private:
+  void readFsEvents();
+  void addWatches();
+  void addWatch(const boost::filesystem::path& path, const std::string& app);
+
+  const std::vector<boost::filesystem::path> roots_;
+  ContainerEventsSeqFunc container_events_seq_;
+  const std::chrono::seconds audit_interval_;
+
+  int inotify_fd_{-1};
+  // watch descriptor -> App name, empty for the roots
+  std::unordered_map<int, std::string> watches_;
+  bool rewatch_{true};
+  uint64_t events_seq_{0};
+  std::string context_;
+  std::chrono::steady_clock::time_point last_audit_;
+  // clean App -> its URI
+  std::unordered_map<std::string, std::string> clean_apps_;
+};
+
+#endif  // AKTUALIZR_LITE_APP_CHANGE_TRACKER_H_
@@ -0,0 +1,138 @@
+#include "appdiagnostics.h"
+
+#include <algorithm>
+#include <map>
+
+const std::size_t AppDiagnostics::MaxEntriesPerService;
+const std::size_t AppDiagnostics::MaxEntrySize;
+const std::size_t AppDiagnostics::MaxReportSize;
+
+static const std::string TruncatedMark{"\n... truncated\n"};
+
+AppDiagnostics::AppDiagnostics(std::size_t max_report_size)
+    : max_report_size_{std::max(max_report_size, TruncatedMark.size())} {}
+
+std::string AppDiagnostics::report(const Json::Value& apps_info) {
+  std::string state;
+  // <app>/<service> -> service info, the logs are listed in this order
+  std::map<std::string, const Json::Value*> failing;
+  for (Json::ValueConstIterator ii = apps_info.begin(); ii != apps_info.end(); ++ii) {
+    const auto app{ii.key().asString()};
+    state += app + ": " + (*ii)["uri"].asString() + "; state: " + (*ii)["state"].asString() + "\n";
+    const Json::Value& services{(*ii)["services"]};
+    for (Json::ValueConstIterator jj = services.begin(); jj != services.end(); ++jj) {
+      state += "\t" + (*jj)["name"].asString() + ": " + (*jj)["hash"].asString();
+      state += "; image: " + (*jj)["image"].asString();
+      state += "; state: " + (*jj)["state"].asString();
+      state += "; status: " + (*jj)["status"].asString() + "\n";
+      if ((*jj).isMember("health") && (*jj)["health"].asString() != "healthy") {
+        failing.emplace(app + "/" + (*jj)["name"].asString(), &(*jj));
+      }
+    }
+  }
+
+  std::string fingerprint{state};
+  for (const auto& service_info : failing) {
+    fingerprint += service_info.first + " " + getTransition(*service_info.second) + "\n";
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (fingerprint == fingerprint_) {
+    return report_;
+  }
+
+  std::unordered_map<std::string, Service> services;
+  for (const auto& service_info : failing) {
+    const auto transition{getTransition(*service_info.second)};
+    auto& service{services[service_info.first]};
+    const auto found{services_.find(service_info.first)};
+    if (found != services_.end()) {
+      service = std::move(found->second);
+    }
+    if (service.transition != transition) {
+      service.transition = transition;
+      service.entries.push_back({transition, getPrintableLogs((*service_info.second)["logs"].asString())});
+      if (service.entries.size() > MaxEntriesPerService) {
+        service.entries.pop_front();
+      }
+    }
+  }
+  // the services which are healthy again or gone are dropped along with their logs
+  services_ = std::move(services);
+
+  std::string report{state};
+  if (!services_.empty()) {
+    report += "# Logs of failing services:\n";
+    for (const auto& service_info : failing) {
+      // the latest logs go first, so they are the last ones to be cut
+      const auto& entries{services_.at(service_info.first).entries};
+      for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        report += service_info.first + " (" + it->transition + "):\n" + it->logs;
+        if (!it->logs.empty() && it->logs.back() != '\n') {
+          report += "\n";
+        }
+      }
+    }
+  }
+  if (report.size() > max_report_size_) {
+    report.resize(max_report_size_ - TruncatedMark.size());
+    report += TruncatedMark;
+  }
+
+  fingerprint_ = std::move(fingerprint);
+  report_ = report;
+  return report;
+}
+
+std::string AppDiagnostics::getTransition(const Json::Value& service) {
+  // e.g. `Up 2 hours (unhealthy)` -> `(unhealthy)`, `Exited (1) 5 minutes ago` -> `(1)`
+  const auto status{service["status"].asString()};
+  std::string details;
+  const auto begin{status.find('(')};
+  if (begin != std::string::npos) {
+    const auto end{status.find(')', begin)};
+    details = " " + status.substr(begin, end == std::string::npos ? std::string::npos : end - begin + 1);
+  }
+  return service["state"].asString() + details + "; " + service["health"].asString() + "; " +
+         service["hash"].asString();
+}
+
+std::string AppDiagnostics::demultiplexLogs(const std::string& logs) {
+  // the logs of a container without TTY are multiplexed, each frame starts with an 8 byte header: the stream type
+  // (0 - stdin, 1 - stdout, 2 - stderr), 3 zero bytes and the big-endian payload size
+  static const std::size_t HeaderSize{8};
+  std::string payload;
+  std::size_t pos{0};
+  while (pos + HeaderSize <= logs.size()) {
+    const auto* header{reinterpret_cast<const unsigned char*>(logs.data() + pos)};
+    if (header[0] > 2 || header[1] != 0 || header[2] != 0 || header[3] != 0) {
+      break;
+    }
+    const std::size_t size{(static_cast<std::size_t>(header[4]) << 24U) | (static_cast<std::size_t>(header[5]) << 16U) |
+                           (static_cast<std::size_t>(header[6]) << 8U) | static_cast<std::size_t>(header[7])};
+    pos += HeaderSize;
+    // a frame cut short is kept as far as it goes
+    payload.append(logs, pos, size);
+    pos += size;
+  }
+  if (pos == 0) {
+    // not a frame at all, the logs of a container with TTY are the raw output
+    return logs;
+  }
+  return payload;
+}
+
+std::string AppDiagnostics::getPrintableLogs(const std::string& logs) {
+  const auto payload{demultiplexLogs(logs)};
+  std::string printable;
+  printable.reserve(payload.size());
+  for (const char c : payload) {
+    if (c == '\n' || c == '\t' || (static_cast<unsigned char>(c) >= 0x20 && c != 0x7f)) {
+      printable += c;
+    }
+  }
+  // the last lines are the most relevant ones
+  if (printable.size() > MaxEntrySize) {
+    printable.erase(0, printable.size() - MaxEntrySize);
+  }
+  return printable;
+}
@@ -0,0 +1,55 @@
+#ifndef AKTUALIZR_LITE_APP_DIAGNOSTICS_H_
+#define AKTUALIZR_LITE_APP_DIAGNOSTICS_H_
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "json/json.h"
+
+// Collects the diagnostics of the App service containers for the install reports.
+//
+// The logs of a failing service, i.e. the one which health is not `healthy`, are captured once per its state
+// transition, e.g. to `exited (1)` or `running (unhealthy)`, and the last `MaxEntriesPerService` of them, each cut to
+// `MaxEntrySize`, are kept per service. A report lists the state of each App service, followed by the logs captured
+// for the failing ones, and it is cut to the given size, so the logs are dropped first. The report is built again
+// only if the state of any service has changed since the previous one. All methods are thread-safe.
+class AppDiagnostics {
+ public:
+  static const std::size_t MaxEntriesPerService{3};
+  static const std::size_t MaxEntrySize{2048};
+  static const std::size_t MaxReportSize{16384};
+
+  explicit AppDiagnostics(std::size_t max_report_size = MaxReportSize);
+
+  // Records the state of the Apps, as returned by AppEngine::getRunningAppsInfo(), and returns the report of it
+  std::string report(const Json::Value& apps_info);
+
+ private:
+  struct Entry {
+    std::string transition;
+    std::string logs;
+  };
+  struct Service {
+    std::string transition;
+    // the latest entry goes last
+    std::deque<Entry> entries;
+  };
+
+  static std::string getTransition(const Json::Value& service);
+  // Returns the payload of the multiplexed container log frames, or the logs as they are if they are not framed
+  static std::string demultiplexLogs(const std::string& logs);
+  static std::string getPrintableLogs(const std::string& logs);
+
+  const std::size_t max_report_size_;
+  std::mutex mutex_;
+  // <app>/<service> -> service
+  std::unordered_map<std::string, Service> services_;
+  // the state of the services the last report has been built of
+  std::string fingerprint_;
+  std::string report_;
+};
+
+#endif  // AKTUALIZR_LITE_APP_DIAGNOSTICS_H_
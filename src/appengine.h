@@ -1,10 +1,13 @@
 #ifndef AKTUALIZR_LITE_APP_ENGINE_H_
 #define AKTUALIZR_LITE_APP_ENGINE_H_
 
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
+#include <tuple>
 
 #include "json/json.h"
 
@@ -13,11 +16,15 @@ class AppEngine {
   class Client {
    public:
     using Ptr = std::shared_ptr<Client>;
+    // container states keyed by the compose project (App name), service name and service config hash
+    using ContainerStates = std::map<std::tuple<std::string, std::string, std::string>, std::string>;
 
     virtual void getContainers(Json::Value& root) = 0;
     virtual std::tuple<bool, std::string> getContainerState(const Json::Value& root, const std::string& app,
                                                             const std::string& service,
                                                             const std::string& hash) const = 0;
+    // Indexes the given container listing, so the state of each App service is found without scanning the listing
+    virtual ContainerStates getContainerStates(const Json::Value& root) const = 0;
     virtual std::string getContainerLogs(const std::string& id, int tail) = 0;
     virtual const Json::Value& engineInfo() const = 0;
     virtual const std::string& arch() const = 0;
@@ -62,6 +69,18 @@ class AppEngine {
   using Apps = std::vector<App>;
   using Ptr = std::shared_ptr<AppEngine>;
 
+  // What fetching Apps takes, in bytes
+  struct FetchCost {
+    uint64_t archive_size{0};
+    uint64_t layer_size{0};
+    // the growth of the container engine store once the layers are extracted
+    uint64_t store_growth{0};
+    // the largest shortage of storage among the stores the Apps go to
+    uint64_t shortfall{0};
+    // false if the size of some content is unknown
+    bool exact{true};
+  };
+
   virtual Result fetch(const App& app) = 0;
   virtual Result verify(const App& app) = 0;
   virtual Result install(const App& app) = 0;
@@ -72,6 +91,28 @@ class AppEngine {
   virtual bool isRunning(const App& app) const = 0;
   virtual Json::Value getRunningAppsInfo() const = 0;
   virtual void prune(const Apps& app_shortlist) = 0;
+  // Prepares a fetch of all the given Apps at once, ahead of the fetches of each App, e.g. resolves their metadata and
+  // checks whether the storage can accommodate all of them. By default each App fetch checks its own App.
+  virtual Result planFetch(const Apps& apps) {
+    (void)apps;
+    return true;
+  }
+  // Estimates what fetching the given Apps takes without fetching any App content, just their metadata. By default the
+  // cost is unknown.
+  virtual Result estimateFetch(const Apps& apps, FetchCost& cost) const {
+    (void)apps;
+    cost.exact = false;
+    return true;
+  }
+  // Loads images of the given Apps into the container engine at once, ahead of the Apps installation, so installing
+  // or running each App doesn't need to load its images. By default the images are loaded along with each App.
+  virtual Result installImages(const Apps& apps) {
+    (void)apps;
+    return true;
+  }
+  // Confirms that the given Apps run fine after their update, so whatever has been kept to roll them back fast is
+  // not needed anymore. Nothing is kept by default.
+  virtual void confirm(const Apps& apps) { (void)apps; }
 
   virtual ~AppEngine() = default;
   AppEngine(const AppEngine&&) = delete;
@@ -0,0 +1,140 @@
+#include "bootloaderenv.h"
+
+#include <cstdlib>
+
+#ifdef BUILD_AKLITE_WITH_LIBUBOOTENV
+#include <libuboot.h>
+#endif  // BUILD_AKLITE_WITH_LIBUBOOTENV
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace bootloader {
+
+// Runs the `fw_printenv`/`fw_setenv` like utilities, fiovb has no library interface to its Trusted Application
+class ShellEnv : public BootloaderEnv {
+ public:
+  ShellEnv(std::string get_cmd, std::string set_cmd) : get_cmd_{std::move(get_cmd)}, set_cmd_{std::move(set_cmd)} {}
+
+ protected:
+  boost::optional<std::string> read(const std::string& name) override {
+    std::string value;
+    if (Utils::shell(get_cmd_ + " " + name, &value) != 0) {
+      return boost::none;
+    }
+    return value;
+  }
+
+  bool write(const std::string& name, const std::string& value) override {
+    std::string sink;
+    return Utils::shell(set_cmd_ + " " + name + " " + value, &sink) == 0;
+  }
+
+ private:
+  const std::string get_cmd_;
+  const std::string set_cmd_;
+};
+
+#ifdef BUILD_AKLITE_WITH_LIBUBOOTENV
+// Accesses the U-Boot environment in-process, the environment is read from its storage once, when opened
+class UBootEnv : public BootloaderEnv {
+ public:
+  static constexpr const char* const ConfigFile{"/etc/fw_env.config"};
+
+  UBootEnv(const UBootEnv&) = delete;
+  UBootEnv(UBootEnv&&) = delete;
+  UBootEnv& operator=(const UBootEnv&) = delete;
+  UBootEnv& operator=(UBootEnv&&) = delete;
+  ~UBootEnv() override {
+    if (ctx_ != nullptr) {
+      if (opened_) {
+        libuboot_close(ctx_);
+      }
+      libuboot_exit(ctx_);
+    }
+  }
+
+  static std::shared_ptr<UBootEnv> create() {
+    std::shared_ptr<UBootEnv> env{new UBootEnv()};
+    if (libuboot_initialize(&env->ctx_, nullptr) < 0 || libuboot_read_config(env->ctx_, ConfigFile) < 0) {
+      LOG_WARNING << "Failed to read U-Boot environment config " << ConfigFile << ", falling back to fw_printenv";
+      return nullptr;
+    }
+    if (libuboot_open(env->ctx_) < 0) {
+      LOG_WARNING << "Failed to open U-Boot environment, falling back to fw_printenv";
+      return nullptr;
+    }
+    env->opened_ = true;
+    return env;
+  }
+
+ protected:
+  boost::optional<std::string> read(const std::string& name) override {
+    std::unique_ptr<char, decltype(&free)> value{libuboot_get_env(ctx_, name.c_str()), &free};
+    if (!value) {
+      return boost::none;
+    }
+    return std::string(value.get());
+  }
+
+  bool write(const std::string& name, const std::string& value) override {
+    return libuboot_set_env(ctx_, name.c_str(), value.c_str()) == 0 && libuboot_env_store(ctx_) == 0;
+  }
+
+ private:
+  UBootEnv() = default;
+
+  struct uboot_ctx* ctx_{nullptr};
+  bool opened_{false};
+};
+#endif  // BUILD_AKLITE_WITH_LIBUBOOTENV
+
+BootloaderEnv::Ptr BootloaderEnv::create(RollbackMode rollback_mode) {
+  switch (rollback_mode) {
+    case RollbackMode::kUbootMasked: {
+      Ptr env;
+#ifdef BUILD_AKLITE_WITH_LIBUBOOTENV
+      env = UBootEnv::create();
+#endif  // BUILD_AKLITE_WITH_LIBUBOOTENV
+      if (!env) {
+        env = std::make_shared<ShellEnv>("fw_printenv -n", "fw_setenv");
+      }
+      return env;
+    }
+    case RollbackMode::kFioVB:
+      return std::make_shared<ShellEnv>("fiovb_printenv", "fiovb_setenv");
+    default:
+      return nullptr;
+  }
+}
+
+boost::optional<std::string> BootloaderEnv::getVar(const std::string& name) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto cached_it{cache_.find(name)};
+  if (cached_it != cache_.end()) {
+    return cached_it->second;
+  }
+  auto value{read(name)};
+  if (value) {
+    cache_.emplace(name, *value);
+  }
+  return value;
+}
+
+bool BootloaderEnv::setVar(const std::string& name, const std::string& value) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto cached_it{cache_.find(name)};
+  if (cached_it != cache_.end() && cached_it->second == value) {
+    LOG_DEBUG << "Bootloader env variable " << name << " is already set to " << value;
+    return true;
+  }
+  if (!write(name, value)) {
+    // the variable may or may not be changed, so it's read again next time
+    cache_.erase(name);
+    return false;
+  }
+  cache_[name] = value;
+  return true;
+}
+
+}  // namespace bootloader
@@ -0,0 +1,53 @@
+#ifndef AKTUALIZR_LITE_BOOTLOADERENV_H_
+#define AKTUALIZR_LITE_BOOTLOADERENV_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/optional.hpp>
+
+#include "libaktualizr/config.h"
+
+namespace bootloader {
+
+/**
+ * @brief BootloaderEnv, the bootloader environment variables accessed from userspace.
+ *
+ * Each variable is read from the environment once per instance and then answered from memory, the writes go through
+ * to the environment and update the cached value, the writes that don't change a value are skipped. The variables are
+ * expected to be changed just through the instance and by the bootloader, i.e. on the next boot, so the components
+ * accessing the same variables should share one instance. All methods are thread-safe.
+ */
+class BootloaderEnv {
+ public:
+  using Ptr = std::shared_ptr<BootloaderEnv>;
+
+  // The environment of the given rollback mode, nullptr if the mode has no environment
+  static Ptr create(RollbackMode rollback_mode);
+
+  BootloaderEnv(const BootloaderEnv&) = delete;
+  BootloaderEnv(BootloaderEnv&&) = delete;
+  BootloaderEnv& operator=(const BootloaderEnv&) = delete;
+  BootloaderEnv& operator=(BootloaderEnv&&) = delete;
+  virtual ~BootloaderEnv() = default;
+
+  // Returns boost::none if the variable is not set or cannot be read, a failed read is not cached
+  boost::optional<std::string> getVar(const std::string& name);
+  bool setVar(const std::string& name, const std::string& value);
+
+ protected:
+  BootloaderEnv() = default;
+
+  virtual boost::optional<std::string> read(const std::string& name) = 0;
+  virtual bool write(const std::string& name, const std::string& value) = 0;
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::string> cache_;
+};
+
+}  // namespace bootloader
+
+#endif  // AKTUALIZR_LITE_BOOTLOADERENV_H_
@@ -11,11 +11,13 @@ namespace bootloader {
 
 std::string getVersion(const std::string& deployment_dir, const std::string& ver_file, const std::string& hash);
 
-BootloaderLite::BootloaderLite(BootloaderConfig config, INvStorage& storage, OSTree::Sysroot::Ptr sysroot)
-    : Bootloader(std::move(config), storage), sysroot_{std::move(sysroot)} {}
+BootloaderLite::BootloaderLite(BootloaderConfig config, INvStorage& storage, OSTree::Sysroot::Ptr sysroot,
+                               BootloaderEnv::Ptr env)
+    : Bootloader(std::move(config), storage),
+      sysroot_{std::move(sysroot)},
+      env_{env ? std::move(env) : BootloaderEnv::create(config_.rollback_mode)} {}
 
 void BootloaderLite::installNotify(const Uptane::Target& target) const {
-  std::string sink;
   switch (config_.rollback_mode) {
     case RollbackMode::kBootloaderNone:
     case RollbackMode::kUbootGeneric:
@@ -25,15 +27,15 @@ void BootloaderLite::installNotify(const Uptane::Target& target) const {
       if (version.empty()) {
         return;
       }
-      std::string sink;
-      if (Utils::shell("fw_printenv -n bootfirmware_version", &sink) != 0) {
+      const auto cur_version{env_->getVar("bootfirmware_version")};
+      if (!cur_version) {
         LOG_WARNING << "Failed to read bootfirmware_version";
         return;
       }
-      LOG_INFO << "Current boot firmware version: " << sink;
-      if (sink != version) {
+      LOG_INFO << "Current boot firmware version: " << *cur_version;
+      if (*cur_version != version) {
         LOG_INFO << "Update firmware to version: " << version;
-        if (Utils::shell("fw_setenv bootupgrade_available 1", &sink) != 0) {
+        if (!env_->setVar("bootupgrade_available", "1")) {
           LOG_WARNING << "Failed to set bootupgrade_available";
         }
       }
@@ -43,15 +45,14 @@ void BootloaderLite::installNotify(const Uptane::Target& target) const {
       if (version.empty()) {
         return;
       }
-      std::string sink;
-      if (Utils::shell("fiovb_printenv bootfirmware_version", &sink) != 0) {
+      const auto cur_version{env_->getVar("bootfirmware_version")};
+      if (!cur_version) {
         LOG_WARNING << "Failed to read bootfirmware_version";
-        sink = std::string();
       }
-      LOG_INFO << "Current firmware version: " << sink;
-      if (sink != version) {
+      LOG_INFO << "Current firmware version: " << cur_version.value_or("");
+      if (cur_version.value_or("") != version) {
         LOG_INFO << "Update firmware to version: " << version;
-        if (Utils::shell("fiovb_setenv bootupgrade_available 1", &sink) != 0) {
+        if (!env_->setVar("bootupgrade_available", "1")) {
           LOG_WARNING << "Failed to set bootupgrade_available";
         }
       }
@@ -99,26 +100,23 @@ std::string getVersion(const std::string& deployment_dir, const std::string& ver
 }
 
 bool BootloaderLite::isUpdateInProgress() const {
-  const std::unordered_map<RollbackMode, std::string> typeToCmd{
-      {RollbackMode::kUbootMasked, "fw_printenv -n"},
-      {RollbackMode::kFioVB, "fiovb_printenv"},
-  };
-  if (0 == typeToCmd.count(config_.rollback_mode)) {
+  if (!env_) {
     return false;
   }
-  int bootupgrade_available{readBootUpgradeAvailable(typeToCmd.at(config_.rollback_mode))};
+  int bootupgrade_available{readBootUpgradeAvailable(*env_)};
   return bootupgrade_available == 1;
 }
 
-int BootloaderLite::readBootUpgradeAvailable(const std::string& get_cmd) {
+int BootloaderLite::readBootUpgradeAvailable(BootloaderEnv& env) {
   int bootupgrade_available{0};
-  std::string ba_str{"0"};
 
   try {
-    if (Utils::shell(get_cmd + " bootupgrade_available", &ba_str) != 0) {
+    const auto ba_str{env.getVar("bootupgrade_available")};
+    if (!ba_str) {
       LOG_ERROR << "Failed to read bootupgrade_available, assume it is set to 0";
+      return bootupgrade_available;
     }
-    bootupgrade_available = std::stoi(ba_str);
+    bootupgrade_available = std::stoi(*ba_str);
   } catch (const std::exception& exc) {
     LOG_ERROR << "Failed to get `bootupgrade_available` value: " << exc.what() << "; assume it is set to 0";
   }
@@ -2,6 +2,7 @@
 #define AKTUALIZR_LITE_BOOTLOADERLITE_H_
 
 #include "bootloader/bootloader.h"
+#include "bootloader/bootloaderenv.h"
 #include "libaktualizr/config.h"
 #include "ostree/sysroot.h"
 
@@ -27,16 +28,19 @@ class BootloaderLite : public Bootloader, public BootFwUpdateStatus {
  public:
   static constexpr const char* const VersionFile{"/usr/lib/firmware/version.txt"};
 
-  explicit BootloaderLite(BootloaderConfig config, INvStorage& storage, OSTree::Sysroot::Ptr sysroot);
+  // The bootloader env is created for the configured rollback mode if not given
+  explicit BootloaderLite(BootloaderConfig config, INvStorage& storage, OSTree::Sysroot::Ptr sysroot,
+                          BootloaderEnv::Ptr env = nullptr);
 
   void installNotify(const Uptane::Target& target) const override;
 
   bool isUpdateInProgress() const override;
 
  private:
-  static int readBootUpgradeAvailable(const std::string& get_cmd);
+  static int readBootUpgradeAvailable(BootloaderEnv& env);
 
   OSTree::Sysroot::Ptr sysroot_;
+  BootloaderEnv::Ptr env_;
 };
 
 }  // namespace bootloader
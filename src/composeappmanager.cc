@@ -1,18 +1,56 @@
 #include "composeappmanager.h"
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif  // __GLIBC__
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
 #include <set>
+#include <thread>
 
 #include <boost/format.hpp>
 #include <boost/process.hpp>
 
 #include "bootloader/bootloaderlite.h"
+#include "docker/ocimanifest.h"
 #include "docker/restorableappengine.h"
+#include "resourcecontrol.h"
 #include "target.h"
+#include "updatetrace.h"
 #ifdef BUILD_AKLITE_WITH_NERDCTL
 #include "containerd/client.h"
 #include "containerd/engine.h"
 #endif  // BUILD_AKLITE_WITH_NERDCTL
 
+const int ComposeAppManager::Config::MemoryPerDownload;
+
+namespace {
+
+// Parses the value of an integer sota.toml:pacman option, the value must not be less than `min`
+int parseIntParam(const std::string& raw, const std::string& name, int min) {
+  int value;
+  try {
+    value = std::stoi(raw);
+  } catch (const std::exception& exc) {
+    LOG_ERROR << "Invalid sota.toml:pacman:" << name << " value, should be an integer, got " << raw
+              << ", err: " << exc.what();
+    throw;
+  }
+  if (value < min) {
+    const std::string expected{min == 0   ? "a non-negative integer"
+                               : min == 1 ? "a positive integer"
+                                          : "an integer not less than " + std::to_string(min)};
+    throw std::invalid_argument("Invalid sota.toml:pacman:" + name + " value, should be " + expected + ", got " + raw);
+  }
+  return value;
+}
+
+}  // namespace
+
 ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
   const std::map<std::string, std::string> raw = pconfig.extra;
 
@@ -47,9 +85,43 @@ ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
   if (raw.count("create_apps_tree") == 1) {
     create_apps_tree = boost::lexical_cast<bool>(raw.at("create_apps_tree"));
   }
+  if (raw.count("offline_in_place_install") == 1) {
+    offline_in_place_install = boost::lexical_cast<bool>(raw.at("offline_in_place_install"));
+  }
+  if (raw.count("lazy_pull_snapshotter") == 1) {
+    lazy_pull_snapshotter = raw.at("lazy_pull_snapshotter");
+  }
+  if (raw.count("app_update_mode") == 1) {
+    app_update_mode = raw.at("app_update_mode");
+    if (app_update_mode != "recreate" && app_update_mode != "switchover") {
+      throw std::invalid_argument(
+          "Invalid sota.toml:pacman:app_update_mode value, should be `recreate` or `switchover`, got " +
+          app_update_mode);
+    }
+  }
+  if (raw.count("retain_previous_apps") == 1) {
+    retain_previous_apps = boost::lexical_cast<bool>(raw.at("retain_previous_apps"));
+  }
+  if (raw.count("store_eviction") == 1) {
+    store_eviction = boost::lexical_cast<bool>(raw.at("store_eviction"));
+  }
+  if (raw.count("deferred_cleanup") == 1) {
+    deferred_cleanup = boost::lexical_cast<bool>(raw.at("deferred_cleanup"));
+  }
+  if (raw.count("overlapped_download") == 1) {
+    overlapped_download = boost::lexical_cast<bool>(raw.at("overlapped_download"));
+  }
+  if (raw.count("registry_mirrors") == 1) {
+    registry_mirrors = raw.at("registry_mirrors");
+    // fail on the agent start rather than on the first App fetch
+    Docker::RegistryMirrors{registry_mirrors};
+  }
   if (raw.count("images_data_root") == 1) {
     images_data_root = raw.at("images_data_root");
   }
+  if (raw.count("docker_stop_cmd") == 1) {
+    docker_stop_cmd = raw.at("docker_stop_cmd");
+  }
   if (raw.count("docker_images_reload_cmd") == 1) {
     docker_images_reload_cmd = raw.at("docker_images_reload_cmd");
   }
@@ -65,6 +137,14 @@ ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
     boost::algorithm::to_lower(val);
     docker_prune = val != "0" && val != "false";
   }
+  if (raw.count("docker_prune_mode") == 1) {
+    docker_prune_mode = raw.at("docker_prune_mode");
+    if (docker_prune_mode != "full" && docker_prune_mode != "selective") {
+      throw std::invalid_argument(
+          "Invalid sota.toml:pacman:docker_prune_mode value, should be `full` or `selective`, got " +
+          docker_prune_mode);
+    }
+  }
 
   if (raw.count("force_update") > 0) {
     force_update = boost::lexical_cast<bool>(raw.at("force_update"));
@@ -98,8 +178,101 @@ ComposeAppManager::Config::Config(const PackageConfig& pconfig) {
       throw;
     }
   }
+
+  if (raw.count("fetch_concurrency") > 0) {
+    fetch_concurrency = parseIntParam(raw.at("fetch_concurrency"), "fetch_concurrency", 1);
+  }
+
+  if (raw.count("image_puller") > 0) {
+    image_puller = raw.at("image_puller");
+    if (image_puller != "skopeo" && image_puller != "native") {
+      throw std::invalid_argument("Invalid sota.toml:pacman:image_puller value, should be `skopeo` or `native`, got " +
+                                  image_puller);
+    }
+  }
+
+  if (raw.count("image_pull_concurrency") > 0) {
+    image_pull_concurrency = parseIntParam(raw.at("image_pull_concurrency"), "image_pull_concurrency", 1);
+  }
+
+  if (raw.count("compose_pull_concurrency") > 0) {
+    compose_pull_concurrency = parseIntParam(raw.at("compose_pull_concurrency"), "compose_pull_concurrency", 1);
+  }
+  if (raw.count("compose_pull_retries") > 0) {
+    compose_pull_retries = parseIntParam(raw.at("compose_pull_retries"), "compose_pull_retries", 0);
+  }
+
+  if (raw.count("download_rate_limit") > 0) {
+    download_rate_limit = parseIntParam(raw.at("download_rate_limit"), "download_rate_limit", 0);
+  }
+
+  if (raw.count("image_install_concurrency") > 0) {
+    image_install_concurrency = parseIntParam(raw.at("image_install_concurrency"), "image_install_concurrency", 1);
+  }
+
+  if (raw.count("image_install_mode") > 0) {
+    image_install_mode = raw.at("image_install_mode");
+    if (image_install_mode != "daemon" && image_install_mode != "direct") {
+      throw std::invalid_argument(
+          "Invalid sota.toml:pacman:image_install_mode value, should be either `daemon` or `direct`, got " +
+          image_install_mode);
+    }
+  }
+
+  if (raw.count("deep_verify_apps") > 0) {
+    deep_verify_apps = boost::lexical_cast<bool>(raw.at("deep_verify_apps"));
+  }
+
+  if (raw.count("follow_docker_events") > 0) {
+    follow_docker_events = boost::lexical_cast<bool>(raw.at("follow_docker_events"));
+  }
+
+  if (raw.count("native_compose") > 0) {
+    native_compose = boost::lexical_cast<bool>(raw.at("native_compose"));
+  }
+
+  if (raw.count("app_start_concurrency") > 0) {
+    app_start_concurrency = parseIntParam(raw.at("app_start_concurrency"), "app_start_concurrency", 1);
+  }
+
+  if (raw.count("app_stop_concurrency") > 0) {
+    app_stop_concurrency = parseIntParam(raw.at("app_stop_concurrency"), "app_stop_concurrency", 1);
+  }
+
+  if (raw.count("apps_audit_interval") > 0) {
+    apps_audit_interval = parseIntParam(raw.at("apps_audit_interval"), "apps_audit_interval", 0);
+  }
+
+  if (raw.count("memory_budget") > 0) {
+    memory_budget = parseIntParam(raw.at("memory_budget"), "memory_budget", 0);
+    if (memory_budget > 0) {
+      // each concurrent blob download holds its write and curl buffers and a TLS session
+      const int max_downloads{std::max(1, memory_budget / MemoryPerDownload)};
+      if (fetch_concurrency * image_pull_concurrency > max_downloads) {
+        fetch_concurrency = std::min(fetch_concurrency, max_downloads);
+        image_pull_concurrency = std::max(1, std::min(image_pull_concurrency, max_downloads / fetch_concurrency));
+        LOG_INFO << "Fetch concurrency is limited to " << fetch_concurrency << " and image pull concurrency to "
+                 << image_pull_concurrency << " by the memory budget of " << memory_budget << " MiB";
+      }
+    }
+  }
+
+  if (raw.count("app_start_order") == 1) {
+    std::vector<std::string> stages;
+    boost::split(stages, raw.at("app_start_order"), boost::is_any_of(";"));
+    for (const auto& stage : stages) {
+      std::vector<std::string> stage_apps;
+      boost::split(stage_apps, stage, boost::is_any_of(", "), boost::token_compress_on);
+      stage_apps.erase(std::remove(stage_apps.begin(), stage_apps.end(), ""), stage_apps.end());
+      if (!stage_apps.empty()) {
+        app_start_order.push_back(stage_apps);
+      }
+    }
+  }
 }
 
+const std::string ComposeAppManager::CleanupPendingFile{".cleanup-pending"};
+
 ComposeAppManager::ComposeAppManager(const PackageConfig& pconfig, const BootloaderConfig& bconfig,
                                      const std::shared_ptr<INvStorage>& storage,
                                      const std::shared_ptr<HttpInterface>& http,
@@ -109,7 +282,30 @@ ComposeAppManager::ComposeAppManager(const PackageConfig& pconfig, const Bootloa
       cfg_{pconfig},
       app_engine_{std::move(app_engine)} {
   if (!app_engine_) {
-    auto registry_client{std::make_shared<Docker::RegistryClient>(http, cfg_.hub_auth_creds_endpoint)};
+    RateLimiter::Ptr rate_limiter;
+    if (cfg_.download_rate_limit > 0) {
+      LOG_INFO << "App download rate is limited to " << cfg_.download_rate_limit << " KiB/s";
+      rate_limiter = std::make_shared<RateLimiter>(static_cast<std::size_t>(cfg_.download_rate_limit) * 1024);
+    }
+    auto registry_client{std::make_shared<Docker::RegistryClient>(
+        http, cfg_.hub_auth_creds_endpoint, Docker::RegistryClient::DefaultHttpClientFactory,
+        // the cache is pruned along with the restorable App store
+        !!cfg_.reset_apps ? cfg_.reset_apps_root / "manifests" : boost::filesystem::path(), rate_limiter)};
+    registry_client->setProgressCb([this](const DownloadProgress& progress) { reportProgress(progress); });
+    if (cfg_.memory_budget > 0) {
+      registry_client->setWriteBufferSize(Docker::RegistryClient::LowMemWriteBufferSize);
+      Docker::OciManifestCache::instance().setMaxEntries(Config::LowMemManifestCacheSize);
+    }
+    if (!cfg_.registry_mirrors.empty()) {
+      registry_client->setMirrors(std::make_shared<Docker::RegistryMirrors>(cfg_.registry_mirrors));
+    }
+    if (peerCache()) {
+      registry_client->setPeerCache(peerCache());
+      if (!!cfg_.reset_apps) {
+        // just the blobs moved to the store after being verified are served, never the ones being downloaded
+        peerCache()->serveBlobs(cfg_.reset_apps_root / "blobs" / "sha256");
+      }
+    }
     std::string compose_cmd{boost::filesystem::canonical(cfg_.compose_bin).string() + " "};
 
     if (cfg_.compose_bin.filename().compare("docker") == 0) {
@@ -130,33 +326,100 @@ ComposeAppManager::ComposeAppManager(const PackageConfig& pconfig, const Bootloa
 
     const std::string skopeo_cmd{boost::filesystem::canonical(cfg_.skopeo_bin).string()};
     std::string docker_host{"unix:///var/run/docker.sock"};
+    const auto createDockerClient = [this]() {
+      auto docker_client{std::make_shared<Docker::DockerClient>("unix:///var/run/docker.sock",
+                                                                Docker::DockerClient::DefMaxConnections)};
+      if (cfg_.follow_docker_events) {
+        docker_client->followEvents(Docker::DockerClient::DefaultHttpClientFactory("unix:///var/run/docker.sock"));
+        container_events_seq_ = [docker_client](uint64_t& seq) { return docker_client->getEventsSeq(seq); };
+      }
+      return docker_client;
+    };
 
     if (!!cfg_.reset_apps) {
       auto env{boost::this_process::environment()};
       if (env.end() != env.find("DOCKER_HOST")) {
         docker_host = env.get("DOCKER_HOST");
       }
-      app_engine_ = std::make_shared<Docker::RestorableAppEngine>(
-          cfg_.reset_apps_root, cfg_.apps_root, cfg_.images_data_root, registry_client,
-          std::make_shared<Docker::DockerClient>(), skopeo_cmd, docker_host, compose_cmd,
-          Docker::RestorableAppEngine::GetDefStorageSpaceFunc(cfg_.storage_watermark));
+      Docker::ImagePuller::Ptr image_puller;
+      if (cfg_.image_puller == "native") {
+        image_puller = std::make_shared<Docker::ImagePuller>(registry_client, cfg_.reset_apps_root / "blobs",
+                                                             cfg_.image_pull_concurrency);
+      }
+      auto restorable_app_engine{std::make_shared<Docker::RestorableAppEngine>(
+          cfg_.reset_apps_root, cfg_.apps_root, cfg_.images_data_root, registry_client, createDockerClient(), skopeo_cmd,
+          docker_host, compose_cmd,
+          Docker::RestorableAppEngine::GetDefStorageSpaceFunc(cfg_.storage_watermark),
+          [](const Docker::Uri& /* app_uri */, const std::string& image_uri) { return "docker://" + image_uri; }, true,
+          image_puller)};
+      restorable_app_engine->setProgressCb([this](const DownloadProgress& progress) { reportProgress(progress); });
+      restorable_app_engine->setCancelCheck([this]() { return isDownloadCancelled(); });
+      restorable_app_engine->setDeepVerify(cfg_.deep_verify_apps);
+      restorable_app_engine->setInstallConcurrency(cfg_.image_install_concurrency);
+      restorable_app_engine->setFetchConcurrency(cfg_.fetch_concurrency);
+      if (cfg_.image_install_mode == "direct") {
+        restorable_app_engine->setDirectImageInstall(cfg_.docker_stop_cmd, cfg_.docker_images_reload_cmd);
+      }
+      if (cfg_.app_update_mode == "switchover" && !cfg_.native_compose) {
+        LOG_WARNING << "Apps are updated by recreating their containers, sota.toml:pacman:app_update_mode "
+                       "`switchover` requires sota.toml:pacman:native_compose to be enabled";
+      }
+      restorable_app_engine->setNativeCompose(cfg_.native_compose, cfg_.app_update_mode == "switchover");
+      restorable_app_engine->setRetainPrevious(cfg_.retain_previous_apps);
+      restorable_app_engine->setStoreEviction(cfg_.store_eviction);
+      if (cfg_.docker_prune_mode == "selective") {
+        if (cfg_.compose_bin.filename().compare("docker") == 0) {
+          restorable_app_engine->setSelectiveDockerPrune(boost::filesystem::canonical(cfg_.compose_bin).string());
+        } else {
+          LOG_WARNING << "The whole docker store is pruned, sota.toml:pacman:docker_prune_mode `selective` requires "
+                         "sota.toml:pacman:compose_bin to be the docker CLI";
+        }
+      }
+      if (cfg_.create_apps_tree) {
+        restorable_app_engine->setAppTree(cfg_.apps_tree);
+      }
+      app_engine_ = restorable_app_engine;
     } else {
 #ifdef BUILD_AKLITE_WITH_NERDCTL
       if (cfg_.compose_bin.filename().compare("nerdctl") == 0) {
         const auto nerdctl_cmd{boost::filesystem::canonical(cfg_.compose_bin).string()};
-        app_engine_ =
-            std::make_shared<containerd::Engine>(cfg_.apps_root, nerdctl_cmd + " compose ",
-                                                 std::make_shared<containerd::Client>(nerdctl_cmd), registry_client);
+        auto containerd_client{std::make_shared<containerd::Client>(nerdctl_cmd)};
+        if (cfg_.follow_docker_events) {
+          containerd_client->followEvents();
+          container_events_seq_ = [containerd_client](uint64_t& seq) { return containerd_client->getEventsSeq(seq); };
+        }
+        app_engine_ = std::make_shared<containerd::Engine>(cfg_.apps_root, nerdctl_cmd, containerd_client,
+                                                           registry_client, cfg_.lazy_pull_snapshotter);
       } else
 #endif  // BUILD_AKLITE_WITH_NERDCTL
       {
-        app_engine_ = std::make_shared<Docker::ComposeAppEngine>(
-            cfg_.apps_root, compose_cmd, std::make_shared<Docker::DockerClient>(), registry_client);
+        auto compose_app_engine{std::make_shared<Docker::ComposeAppEngine>(cfg_.apps_root, compose_cmd,
+                                                                            createDockerClient(), registry_client)};
+        compose_app_engine->setImagePull(cfg_.compose_pull_concurrency, cfg_.compose_pull_retries);
+        app_engine_ = compose_app_engine;
+      }
+    }
+
+    if (cfg_.apps_audit_interval > 0) {
+      if (container_events_seq_) {
+        app_change_tracker_.reset(new AppChangeTracker({cfg_.apps_root, cfg_.reset_apps_root / "apps"},
+                                                       container_events_seq_,
+                                                       std::chrono::seconds(cfg_.apps_audit_interval)));
+      } else {
+        LOG_WARNING << "The Apps state is checked each time, sota.toml:pacman:apps_audit_interval requires "
+                       "sota.toml:pacman:follow_docker_events to be enabled";
       }
     }
   }
 }
 
+ComposeAppManager::~ComposeAppManager() {
+  waitForCleanup();
+  if (cleanup_thread_.joinable()) {
+    cleanup_thread_.join();
+  }
+}
+
 // Returns an intersection of apps specified in Target and the configuration
 ComposeAppManager::AppsContainer ComposeAppManager::getApps(const Uptane::Target& t) const {
   AppsContainer apps;
@@ -192,8 +455,13 @@ ComposeAppManager::AppsContainer ComposeAppManager::getApps(const Uptane::Target
 ComposeAppManager::AppsContainer ComposeAppManager::getAppsToUpdate(const Uptane::Target& t) const {
   AppsContainer apps_to_update;
 
-  auto currently_installed_target_apps = Target::appsJson(OstreeManager::getCurrent());
+  const auto current_target{OstreeManager::getCurrent()};
+  auto currently_installed_target_apps = Target::appsJson(current_target);
   auto new_target_apps = getApps(t);  // intersection of apps specified in Target and the configuration
+  if (app_change_tracker_) {
+    app_change_tracker_->update(current_target.filename() + ":" + current_target.sha256Hash() + ":" + t.filename() +
+                                ":" + t.sha256Hash());
+  }
 
   for (const auto& app_pair : new_target_apps) {
     const auto& app_name = app_pair.first;
@@ -213,6 +481,11 @@ ComposeAppManager::AppsContainer ComposeAppManager::getAppsToUpdate(const Uptane
       continue;
     }
 
+    if (app_change_tracker_ && !app_change_tracker_->isDirty(app_name, app_pair.second)) {
+      LOG_DEBUG << app_name << " has not changed since its last status check";
+      continue;
+    }
+
     if (!boost::filesystem::exists(cfg_.apps_root / app_name) ||
         !boost::filesystem::exists(cfg_.apps_root / app_name / Docker::ComposeAppEngine::ComposeFile)) {
       // an App that is supposed to be installed has been removed somehow, let's install it again
@@ -228,12 +501,17 @@ ComposeAppManager::AppsContainer ComposeAppManager::getAppsToUpdate(const Uptane
       LOG_INFO << app_name << " update will be re-installed or completed";
       continue;
     }
+    if (app_change_tracker_) {
+      app_change_tracker_->setClean(app_name, app_pair.second);
+    }
   }
 
   return apps_to_update;
 }
 
 bool ComposeAppManager::checkForAppsToUpdate(const Uptane::Target& target) {
+  // the App store is not checked while it is being pruned
+  waitForCleanup();
   cur_apps_to_fetch_and_update_ = getAppsToUpdate(target);
   if (!!cfg_.reset_apps) {
     cur_apps_to_fetch_ = getAppsToFetch(target);
@@ -243,11 +521,95 @@ bool ComposeAppManager::checkForAppsToUpdate(const Uptane::Target& target) {
 }
 
 DownloadResult ComposeAppManager::Download(const TufTarget& target) {
+  waitForCleanup();
+  if (cfg_.overlapped_download) {
+    return downloadOverlapped(target);
+  }
   auto ostree_download_res{RootfsTreeManager::Download(target)};
   if (!ostree_download_res) {
     return ostree_download_res;
   }
+  return downloadApps(target);
+}
+
+UpdateCost ComposeAppManager::EstimateCost(const TufTarget& target) {
+  auto cost{RootfsTreeManager::EstimateCost(target)};
+  AppEngine::Apps apps;
+  for (const auto& app : getAppsToFetch(Target::fromTufTarget(target))) {
+    apps.push_back({app.first, app.second});
+  }
+  if (apps.empty()) {
+    return cost;
+  }
+  AppEngine::FetchCost apps_cost;
+  const auto res{app_engine_->estimateFetch(apps, apps_cost)};
+  if (!res) {
+    LOG_WARNING << "Failed to estimate the App fetch cost: " << res.err;
+    cost.status = UpdateCost::Status::Failed;
+    cost.description = "Failed to estimate the App fetch cost: " + res.err;
+    return cost;
+  }
+  cost.app_archive_download = apps_cost.archive_size;
+  cost.app_layer_download = apps_cost.layer_size;
+  cost.docker_store_growth = apps_cost.store_growth;
+  cost.space_shortfall = std::max(cost.space_shortfall, apps_cost.shortfall);
+  cost.exact = cost.exact && apps_cost.exact;
+  return cost;
+}
+
+DownloadResult ComposeAppManager::downloadOverlapped(const TufTarget& target) {
+  // the downloads check the token of their own, so each of them can be stopped once the other one fails
+  api::FlowControlToken token;
+  const auto* const user_token{swapFlowControlToken(&token)};
+  std::atomic_bool ostree_failed_first{false};
+  auto ostree_download = std::async(std::launch::async, [this, &target, &token, &ostree_failed_first]() {
+    auto res{RootfsTreeManager::Download(target)};
+    if (!res && token.setAbort()) {
+      LOG_ERROR << "The ostree download has failed, stopping the App download";
+      ostree_failed_first = true;
+    }
+    return res;
+  });
+  // the cancellation of the download is passed on to both of them
+  std::atomic_bool done{false};
+  std::thread cancel_watcher{[&token, &done, user_token]() {
+    while (!done) {
+      if (user_token != nullptr && !user_token->canContinue(false)) {
+        token.setAbort();
+        break;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(CancelCheckIntervalMs));
+    }
+  }};
 
+  DownloadResult res{DownloadResult::Status::Ok, ""};
+  std::exception_ptr apps_exc;
+  try {
+    res = downloadApps(target);
+  } catch (...) {
+    apps_exc = std::current_exception();
+    res = {DownloadResult::Status::DownloadFailed, "App download has failed"};
+  }
+  if (!res && token.setAbort()) {
+    LOG_ERROR << "The App download has failed, stopping the ostree download";
+  }
+  ostree_download.wait();
+  done = true;
+  cancel_watcher.join();
+  swapFlowControlToken(user_token);
+  if (apps_exc) {
+    std::rethrow_exception(apps_exc);
+  }
+  const auto ostree_download_res{ostree_download.get()};
+
+  // the failure which has stopped the other download is reported, the other one just reports the cancellation
+  if (ostree_failed_first || (res && !ostree_download_res)) {
+    return ostree_download_res;
+  }
+  return res;
+}
+
+DownloadResult ComposeAppManager::downloadApps(const TufTarget& target) {
   DownloadResult res{DownloadResult::Status::Ok, ""};
   const Uptane::Target uptane_target{Target::fromTufTarget(target)};
 
@@ -267,24 +629,94 @@ DownloadResult ComposeAppManager::Download(const TufTarget& target) {
   all_apps_to_fetch.insert(cur_apps_to_fetch_and_update_.begin(), cur_apps_to_fetch_and_update_.end());
   all_apps_to_fetch.insert(cur_apps_to_fetch_.begin(), cur_apps_to_fetch_.end());
 
-  for (const auto& pair : all_apps_to_fetch) {
-    LOG_INFO << "Fetching " << pair.first << " -> " << pair.second;
-    const auto fetch_res{app_engine_->fetch({pair.first, pair.second})};
-    if (!fetch_res) {
-      const std::string err_desc{boost::str(boost::format("failed to fetch App; app: %s; uri: %s; err: %s") %
-                                            pair.first % pair.second % fetch_res.err)};
-      LOG_ERROR << err_desc;
-      res = {
-          fetch_res.noSpace() ? DownloadResult::Status::DownloadFailed_NoSpace : DownloadResult::Status::DownloadFailed,
-          err_desc};
-      break;
+  const std::vector<std::pair<std::string, std::string>> apps_to_fetch{all_apps_to_fetch.begin(),
+                                                                        all_apps_to_fetch.end()};
+  // resolve all Apps and make a single storage decision for the whole Target before pulling any App image
+  AppEngine::Apps apps;
+  for (const auto& pair : apps_to_fetch) {
+    apps.push_back({pair.first, pair.second});
+  }
+  const auto plan_res{app_engine_->planFetch(apps)};
+  if (!plan_res) {
+    const std::string err_desc{"failed to fetch Apps; err: " + plan_res.err};
+    LOG_ERROR << err_desc;
+    are_apps_checked_ = false;
+    return {plan_res.noSpace() ? DownloadResult::Status::DownloadFailed_NoSpace : DownloadResult::Status::DownloadFailed,
+            err_desc};
+  }
+
+  std::atomic_size_t next_app{0};
+  std::atomic_bool failed{false};
+  std::mutex res_mutex;
+
+  // Each worker picks up the next not-yet-fetched App, once any of the App fetches fails or the download is cancelled
+  // the workers don't start fetching new Apps, Apps being fetched at that moment are fetched to the end.
+  const auto fetch_apps = [&]() {
+    for (auto ii = next_app++; ii < apps_to_fetch.size() && !failed; ii = next_app++) {
+      if (isDownloadCancelled()) {
+        std::lock_guard<std::mutex> lock{res_mutex};
+        if (!failed.exchange(true)) {
+          res = {DownloadResult::Status::DownloadFailed, "Download has been cancelled"};
+        }
+        break;
+      }
+      const auto& pair{apps_to_fetch[ii]};
+      LOG_INFO << "Fetching " << pair.first << " -> " << pair.second;
+      UpdateTrace::Span span{"app_fetch", pair.first};
+      const auto fetch_res{app_engine_->fetch({pair.first, pair.second})};
+      if (!fetch_res) {
+        span.setFailed();
+        const std::string err_desc{boost::str(boost::format("failed to fetch App; app: %s; uri: %s; err: %s") %
+                                              pair.first % pair.second % fetch_res.err)};
+        LOG_ERROR << err_desc;
+        std::lock_guard<std::mutex> lock{res_mutex};
+        if (!failed.exchange(true)) {
+          res = {fetch_res.noSpace() ? DownloadResult::Status::DownloadFailed_NoSpace
+                                     : DownloadResult::Status::DownloadFailed,
+                 err_desc};
+        }
+      }
+    }
+  };
+
+  const auto worker_numb{
+      std::min(static_cast<std::size_t>(cfg_.fetch_concurrency), std::max<std::size_t>(apps_to_fetch.size(), 1))};
+  if (worker_numb > 1) {
+    LOG_INFO << "Fetching " << apps_to_fetch.size() << " Apps, up to " << worker_numb << " Apps concurrently";
+    std::vector<std::thread> workers;
+    workers.reserve(worker_numb);
+    for (std::size_t ii = 0; ii < worker_numb; ++ii) {
+      workers.emplace_back(fetch_apps);
     }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  } else {
+    fetch_apps();
   }
 
+  if (cfg_.memory_budget > 0) {
+    checkMemoryBudget();
+  }
   are_apps_checked_ = false;
   return res;
 }
 
+void ComposeAppManager::checkMemoryBudget() const {
+  const auto peak_rss{UpdateTrace::getPeakRss()};
+  const uint64_t budget{static_cast<uint64_t>(cfg_.memory_budget) * 1024 * 1024};
+  if (peak_rss > budget) {
+    LOG_WARNING << "Peak memory usage of " << peak_rss / 1024 << " KiB exceeds the budget of " << cfg_.memory_budget
+                << " MiB";
+  } else {
+    LOG_INFO << "Peak memory usage: " << peak_rss / 1024 << " KiB, budget: " << cfg_.memory_budget << " MiB";
+  }
+#ifdef __GLIBC__
+  // give the heap freed by the download workers back to the system
+  malloc_trim(0);
+#endif  // __GLIBC__
+}
+
 bool ComposeAppManager::fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const KeyManager& keys,
                                     const FetcherProgressCb& progress_cb, const api::FlowControlToken* token) {
   (void)target;
@@ -297,6 +729,7 @@ bool ComposeAppManager::fetchTarget(const Uptane::Target& target, Uptane::Fetche
 }
 
 TargetStatus ComposeAppManager::verifyTarget(const Uptane::Target& target) const {
+  waitForCleanup();
   const auto ostree_target_status{RootfsTreeManager::verifyTarget(target)};
   if (TargetStatus::kGood != ostree_target_status) {
     return ostree_target_status;
@@ -315,6 +748,7 @@ TargetStatus ComposeAppManager::verifyTarget(const Uptane::Target& target) const
 }
 
 data::InstallationResult ComposeAppManager::install(const Uptane::Target& target) const {
+  waitForCleanup();
   data::InstallationResult res{RootfsTreeManager::install(target)};
   if (res.result_code.num_code == data::ResultCode::Numeric::kInstallFailed) {
     LOG_ERROR << "OSTree target installation has failed, skipping Docker Compose Apps";
@@ -332,10 +766,23 @@ data::InstallationResult ComposeAppManager::install(const Uptane::Target& target
     // make sure we install what we fecthed
     if (!cur_apps_to_fetch_and_update_.empty()) {
       res.description += "\n# Apps installed:";
+
+      AppEngine::Apps apps_to_install;
+      for (const auto& pair : cur_apps_to_fetch_and_update_) {
+        apps_to_install.emplace_back(AppEngine::App{pair.first, pair.second});
+      }
+      auto& non_const_app_engine = (const_cast<ComposeAppManager*>(this))->app_engine_;
+      const auto images_res{non_const_app_engine->installImages(apps_to_install)};
+      if (!images_res) {
+        // the images that have not been loaded are loaded again along with their App, and the App install fails
+        // if it is still impossible
+        LOG_WARNING << "Failed to load some of App images ahead of the Apps installation: " << images_res.err;
+      }
     }
 
     for (const auto& pair : cur_apps_to_fetch_and_update_) {
       LOG_INFO << "Installing " << pair.first << " -> " << pair.second;
+      UpdateTrace::Span span{"app_install", pair.first};
       // I have no idea via the package manager interface method install() is const which is not a const
       // method by its definition/nature
       auto& non_const_app_engine = (const_cast<ComposeAppManager*>(this))->app_engine_;
@@ -343,6 +790,7 @@ data::InstallationResult ComposeAppManager::install(const Uptane::Target& target
                                                      : non_const_app_engine->run({pair.first, pair.second});
 
       if (!run_res) {
+        span.setFailed();
         const std::string err_desc{boost::str(boost::format("failed to install App; app: %s; uri: %s; err: %s") %
                                               pair.first % pair.second % run_res.err)};
         LOG_ERROR << err_desc;
@@ -402,6 +850,7 @@ data::InstallationResult ComposeAppManager::install(const Uptane::Target& target
 }
 
 data::InstallationResult ComposeAppManager::finalizeInstall(const Uptane::Target& target) {
+  waitForCleanup();
   auto ir = OstreeManager::finalizeInstall(target);
 
   if (ir.result_code.num_code == data::ResultCode::Numeric::kOk) {
@@ -410,12 +859,13 @@ data::InstallationResult ComposeAppManager::finalizeInstall(const Uptane::Target
     stopDisabledComposeApps(target);
     LOG_INFO << "Starting Apps after successful boot on a new version of OSTree-based sysroot...";
     // "finalize" (run) Apps that were pulled and created before reboot
-    for (const auto& app_pair : getApps(target)) {
-      const AppEngine::Result run_res = app_engine_->run({app_pair.first, app_pair.second});
-      if (!run_res) {
+    for (const auto& stage : getAppStartStages(target, getApps(target))) {
+      const auto run_res{startApps(stage)};
+      if (!run_res.second) {
+        const auto& app{run_res.first};
         const std::string err_desc{boost::str(
             boost::format("failed to start App after booting on a new sysroot version; app: %s; uri: %s; err: %s") %
-            app_pair.first % app_pair.second % run_res.err)};
+            app.name % app.uri % run_res.second.err)};
 
         LOG_ERROR << err_desc;
         // Do we need to set some flag for the uboot and trigger a system reboot in order to boot on a previous
@@ -425,22 +875,16 @@ data::InstallationResult ComposeAppManager::finalizeInstall(const Uptane::Target
         // this is a hack to distinguish between ostree install (rollback) and App start failures.
         // data::ResultCode::Numeric::kInstallFailed - boot on a new ostree version failed (rollback at boot)
         // data::ResultCode::Numeric::kCustomError - boot on a new version was successful but new App failed to start
-        return data::InstallationResult(run_res.imagePullFailure() ? data::ResultCode::Numeric::kDownloadFailed
-                                                                   : data::ResultCode::Numeric::kCustomError,
+        return data::InstallationResult(run_res.second.imagePullFailure() ? data::ResultCode::Numeric::kDownloadFailed
+                                                                          : data::ResultCode::Numeric::kCustomError,
                                         ir.description);
       }
     }
-    handleRemovedApps(target);
-    if (cfg_.docker_prune) {
-      AppEngine::Apps app_shortlist;
-      const auto enabled_apps{getAppsToFetch(target, false)};
-
-      std::for_each(enabled_apps.cbegin(), enabled_apps.cend(),
-                    [&app_shortlist](const std::pair<std::string, std::string>& val) {
-                      app_shortlist.emplace_back(AppEngine::App{val.first, val.second});
-                    });
-
-      app_engine_->prune(app_shortlist);
+    if (cfg_.deferred_cleanup) {
+      LOG_INFO << "The removal of disabled Apps and the store prune are deferred till Apps are found running";
+      Utils::writeFile(cfg_.apps_root / CleanupPendingFile, target.filename());
+    } else {
+      cleanUp(target);
     }
   }
 
@@ -450,6 +894,144 @@ data::InstallationResult ComposeAppManager::finalizeInstall(const Uptane::Target
   return ir;
 }
 
+void ComposeAppManager::cleanUp(const Uptane::Target& target) const {
+  handleRemovedApps(target);
+  if (cfg_.docker_prune) {
+    AppEngine::Apps app_shortlist;
+    const auto enabled_apps{getAppsToFetch(target, false)};
+
+    std::for_each(enabled_apps.cbegin(), enabled_apps.cend(),
+                  [&app_shortlist](const std::pair<std::string, std::string>& val) {
+                    app_shortlist.emplace_back(AppEngine::App{val.first, val.second});
+                  });
+
+    app_engine_->prune(app_shortlist);
+  }
+}
+
+bool ComposeAppManager::runDeferredCleanup(const Uptane::Target& target) {
+  if (cleanup_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock{cleanup_mutex_};
+      if (cleanup_running_) {
+        return true;
+      }
+    }
+    cleanup_thread_.join();
+  }
+  const auto pending_file{cfg_.apps_root / CleanupPendingFile};
+  if (!boost::filesystem::exists(pending_file)) {
+    return false;
+  }
+  LOG_INFO << "Starting the deferred removal of disabled Apps and the store prune";
+  {
+    std::lock_guard<std::mutex> lock{cleanup_mutex_};
+    cleanup_running_ = true;
+  }
+  cleanup_thread_ = std::thread([this, target, pending_file]() {
+    ResourceControl::LowPriorityScope low_priority;
+    try {
+      cleanUp(target);
+      boost::filesystem::remove(pending_file);
+      LOG_INFO << "The deferred cleanup has completed";
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "The deferred cleanup has failed, it will be retried at the next update cycle: " << exc.what();
+    }
+    std::lock_guard<std::mutex> lock{cleanup_mutex_};
+    cleanup_running_ = false;
+    cleanup_cv_.notify_all();
+  });
+  return true;
+}
+
+void ComposeAppManager::waitForCleanup() const {
+  std::unique_lock<std::mutex> lock{cleanup_mutex_};
+  cleanup_cv_.wait(lock, [this]() { return !cleanup_running_; });
+}
+
+std::vector<AppEngine::Apps> ComposeAppManager::getAppStartStages(const Uptane::Target& target,
+                                                                  const AppsContainer& apps) const {
+  auto order{Target::appStartOrder(target)};
+  if (order.empty()) {
+    order = cfg_.app_start_order;
+  }
+  std::vector<std::string> app_names;
+  for (const auto& app : apps) {
+    app_names.push_back(app.first);
+  }
+  std::vector<AppEngine::Apps> stages;
+  for (const auto& stage_app_names : splitIntoStages(order, app_names)) {
+    AppEngine::Apps stage;
+    for (const auto& app_name : stage_app_names) {
+      stage.push_back({app_name, apps.at(app_name)});
+    }
+    stages.push_back(stage);
+  }
+  return stages;
+}
+
+std::vector<std::vector<std::string>> ComposeAppManager::splitIntoStages(
+    const std::vector<std::vector<std::string>>& order, const std::vector<std::string>& apps) {
+  std::vector<std::vector<std::string>> stages(std::max<std::size_t>(order.size(), 1));
+  std::set<std::string> ordered_apps;
+  for (std::size_t ii = 0; ii < order.size(); ++ii) {
+    for (const auto& app_name : order[ii]) {
+      // the order may list Apps which are not enabled on the device
+      if (std::find(apps.begin(), apps.end(), app_name) != apps.end() && ordered_apps.emplace(app_name).second) {
+        stages[ii].push_back(app_name);
+      }
+    }
+  }
+  for (const auto& app_name : apps) {
+    if (ordered_apps.count(app_name) == 0) {
+      stages.front().push_back(app_name);
+    }
+  }
+  stages.erase(std::remove_if(stages.begin(), stages.end(),
+                              [](const std::vector<std::string>& stage) { return stage.empty(); }),
+               stages.end());
+  return stages;
+}
+
+std::pair<AppEngine::App, AppEngine::Result> ComposeAppManager::startApps(const AppEngine::Apps& apps) {
+  std::pair<AppEngine::App, AppEngine::Result> res{AppEngine::App{}, true};
+  std::atomic_size_t next_app{0};
+  std::atomic_bool failed{false};
+  std::mutex res_mutex;
+
+  // The same as with the App fetches, the Apps being started at the moment of a failure are started to the end
+  const auto start_apps = [&]() {
+    for (auto ii = next_app++; ii < apps.size() && !failed; ii = next_app++) {
+      const auto& app{apps[ii]};
+      LOG_INFO << "Starting " << app.name << " -> " << app.uri;
+      const AppEngine::Result run_res = app_engine_->run(app);
+      if (!run_res) {
+        std::lock_guard<std::mutex> lock{res_mutex};
+        if (!failed.exchange(true)) {
+          res = {app, run_res};
+        }
+      }
+    }
+  };
+
+  const auto worker_numb{
+      std::min(static_cast<std::size_t>(cfg_.app_start_concurrency), std::max<std::size_t>(apps.size(), 1))};
+  if (worker_numb > 1) {
+    LOG_INFO << "Starting " << apps.size() << " Apps, up to " << worker_numb << " Apps concurrently";
+    std::vector<std::thread> workers;
+    workers.reserve(worker_numb);
+    for (std::size_t ii = 0; ii < worker_numb; ++ii) {
+      workers.emplace_back(start_apps);
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  } else {
+    start_apps();
+  }
+  return res;
+}
+
 void ComposeAppManager::handleRemovedApps(const Uptane::Target& target) const {
   removeDisabledComposeApps(target);
 
@@ -468,6 +1050,14 @@ void ComposeAppManager::handleRemovedApps(const Uptane::Target& target) const {
   }
 }
 
+void ComposeAppManager::confirmApps(const Uptane::Target& target) const {
+  AppEngine::Apps apps;
+  for (const auto& app : getApps(target)) {
+    apps.emplace_back(AppEngine::App{app.first, app.second});
+  }
+  app_engine_->confirm(apps);
+}
+
 void ComposeAppManager::stopDisabledComposeApps(const Uptane::Target& target) const {
   forEachRemovedApp(target, [](AppEngine::Ptr& app_engine, const std::string& app_name) {
     LOG_WARNING << "Docker Compose App(" << app_name
@@ -506,38 +1096,57 @@ void ComposeAppManager::forEachRemovedApp(
   // i.e. the apps that are supposed to be installed and running
   const auto& current_apps = getApps(target);
 
+  std::vector<std::string> removed_apps;
   for (auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(cfg_.apps_root), {})) {
     if (boost::filesystem::is_directory(entry)) {
       std::string name = entry.path().filename().native();
       if (current_apps.find(name) == current_apps.end()) {
-        auto& non_const_app_engine = (const_cast<ComposeAppManager*>(this))->app_engine_;
-        action(non_const_app_engine, name);
+        removed_apps.push_back(name);
       }
     }
   }
-}
 
-Json::Value ComposeAppManager::getRunningAppsInfo() const { return app_engine_->getRunningAppsInfo(); }
-std::string ComposeAppManager::getRunningAppsInfoForReport() const {
-  std::string result;
-  const auto apps_info = getRunningAppsInfo();
-  for (Json::ValueConstIterator ii = apps_info.begin(); ii != apps_info.end(); ++ii) {
-    result += ii.key().asString() + ": " + (*ii)["uri"].asString() + "; state: " + (*ii)["state"].asString() + "\n";
-    ;
-
-    Json::Value services = (*ii)["services"];
-    for (Json::ValueConstIterator jj = services.begin(); jj != services.end(); ++jj) {
-      result += "\t" + (*jj)["name"].asString() + ": " + (*jj)["hash"].asString();
-      result += "; image: " + (*jj)["image"].asString();
-      result += "; state: " + (*jj)["state"].asString();
-      result += "; status: " + (*jj)["status"].asString() + "\n";
+  // The Apps are stopped in the reverse start order, i.e. an App is stopped before the Apps it is started after.
+  // The Apps of each stage are stopped concurrently, so stopping several Apps takes about one container stop timeout.
+  auto order{cfg_.app_start_order};
+  std::reverse(order.begin(), order.end());
+  auto& non_const_app_engine = (const_cast<ComposeAppManager*>(this))->app_engine_;
+  for (const auto& stage : splitIntoStages(order, removed_apps)) {
+    std::atomic_size_t next_app{0};
+    const auto stop_apps = [&]() {
+      for (auto ii = next_app++; ii < stage.size(); ii = next_app++) {
+        action(non_const_app_engine, stage[ii]);
+      }
+    };
+
+    const auto worker_numb{std::min(static_cast<std::size_t>(cfg_.app_stop_concurrency), stage.size())};
+    if (worker_numb > 1) {
+      std::vector<std::thread> workers;
+      workers.reserve(worker_numb);
+      for (std::size_t ii = 0; ii < worker_numb; ++ii) {
+        workers.emplace_back(stop_apps);
+      }
+      for (auto& worker : workers) {
+        worker.join();
+      }
+    } else {
+      stop_apps();
     }
   }
-  return result;
+}
+
+Json::Value ComposeAppManager::getRunningAppsInfo() const {
+  // the Apps being removed by the cleanup are not reported
+  waitForCleanup();
+  return app_engine_->getRunningAppsInfo();
+}
+std::string ComposeAppManager::getRunningAppsInfoForReport() const {
+  return app_diagnostics_.report(getRunningAppsInfo());
 }
 
 Json::Value ComposeAppManager::getAppsState() const {
   Json::Value apps_state;
+  waitForCleanup();
 
   try {
     auto apps{app_engine_->getRunningAppsInfo()};
@@ -599,16 +1208,43 @@ bool ComposeAppManager::compareAppsStates(const Json::Value& left, const Json::V
       // Different set of Apps
       return false;
     }
-    if ((*ii)["state"] != right["apps"][app_name]["state"] || (*ii)["uri"] != right["apps"][app_name]["uri"]) {
-      return false;
-    }
-    if ((*ii)["services"].size() != right["apps"][app_name]["services"].size()) {
+    if (!compareAppStates(*ii, right["apps"][app_name])) {
       return false;
     }
   }
   return true;
 }
 
+bool ComposeAppManager::compareAppStates(const Json::Value& left, const Json::Value& right) {
+  return left["state"] == right["state"] && left["uri"] == right["uri"] &&
+         left["services"].size() == right["services"].size();
+}
+
+Json::Value ComposeAppManager::getAppsStateDelta(const Json::Value& base, const Json::Value& state) {
+  Json::Value delta{state};
+  delta["delta"] = true;
+  delta["apps"] = Json::Value(Json::objectValue);
+  delta["removed_apps"] = Json::Value(Json::arrayValue);
+  const auto& base_apps{base["apps"]};
+  const auto& apps{state["apps"]};
+  for (Json::ValueConstIterator ii = apps.begin(); ii != apps.end(); ++ii) {
+    const auto app_name{ii.key().asString()};
+    if (!base_apps.isMember(app_name) || !compareAppStates(base_apps[app_name], *ii)) {
+      delta["apps"][app_name] = *ii;
+    }
+  }
+  for (Json::ValueConstIterator ii = base_apps.begin(); ii != base_apps.end(); ++ii) {
+    if (!apps.isMember(ii.key().asString())) {
+      delta["removed_apps"].append(ii.key());
+    }
+  }
+  return delta;
+}
+
+bool ComposeAppManager::getAppsStateSeq(uint64_t& seq) const {
+  return container_events_seq_ && container_events_seq_(seq);
+}
+
 ComposeAppManager::AppsContainer ComposeAppManager::getAppsToFetch(const Uptane::Target& target,
                                                                    bool check_store) const {
   AppsContainer apps;
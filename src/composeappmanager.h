@@ -1,12 +1,18 @@
 #ifndef AKTUALIZR_LITE_COMPOSE_APP_MANAGER_H_
 #define AKTUALIZR_LITE_COMPOSE_APP_MANAGER_H_
 
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
+#include "appchangetracker.h"
+#include "appdiagnostics.h"
 #include "docker/composeappengine.h"
 #include "docker/docker.h"
+#include "docker/imagepuller.h"
 #include "ostree/sysroot.h"
 #include "rootfstreemanager.h"
 
@@ -25,25 +31,117 @@ class ComposeAppManager : public RootfsTreeManager {
     boost::filesystem::path compose_bin{"/usr/bin/docker"};
     boost::filesystem::path skopeo_bin{"/sbin/skopeo"};
     bool docker_prune{true};
+    // restorable Apps only, either `full` (all unused images and stopped containers of the docker store are pruned)
+    // or `selective` (just the images of the removed App versions and the containers of the removed Apps are
+    // removed, in the background), the latter requires `compose_bin` to be the docker CLI
+    std::string docker_prune_mode{"full"};
     bool force_update{false};
+    // an ostree repo the App files are stored in and hardlinked from into `apps_root` if `create_apps_tree` is set,
+    // it must be on the `apps_root` volume, otherwise Apps are extracted from their archives as by default
     boost::filesystem::path apps_tree{"/var/sota/compose-apps-tree"};
     bool create_apps_tree{false};
     boost::filesystem::path images_data_root{"/var/lib/docker"};
-    std::string docker_images_reload_cmd{"systemctl reload docker"};
+    // the docker daemon is stopped by `docker_stop_cmd` for the `direct` image install and started by
+    // `docker_images_reload_cmd` after it
+    std::string docker_stop_cmd{"systemctl stop docker"};
+    std::string docker_images_reload_cmd{"systemctl restart docker"};
     std::string hub_auth_creds_endpoint{Docker::RegistryClient::DefAuthCredsEndpoint};
     bool create_containers_before_reboot{true};
     int storage_watermark{80};
+    // max number of Apps fetched concurrently, 1 means sequential fetching
+    int fetch_concurrency{1};
+    // a utility to pull App images with, either `skopeo` or `native` (in-process puller)
+    std::string image_puller{"skopeo"};
+    // max number of image blobs downloaded concurrently by the native image puller
+    int image_pull_concurrency{Docker::ImagePuller::DefConcurrency};
+    // max number of App images pulled concurrently by the non-restorable App engine, each by `compose pull <service>`,
+    // 1 along with no retries means all images of an App are pulled by a single sequential `compose pull`
+    int compose_pull_concurrency{1};
+    // how many times a failed image pull of the non-restorable App engine is retried, the backoff doubles each time
+    int compose_pull_retries{0};
+    // max overall rate of App blob downloads in KiB per second, 0 means no limit
+    int download_rate_limit{0};
+    // hash each App layer blob while checking whether Apps are fetched, by default just the blob size is checked
+    bool deep_verify_apps{false};
+    // max number of App images loaded into the docker daemon concurrently during Apps installation
+    int image_install_concurrency{1};
+    // how App images are installed, either `daemon` (`skopeo copy` to the docker daemon) or `direct` (imported
+    // into the docker store directly while the docker daemon is stopped)
+    std::string image_install_mode{"daemon"};
+    // keep the container listing in memory and refresh it only after docker reports a container event
+    bool follow_docker_events{false};
+    // bring Apps up and down through the Docker Engine API if their compose file allows it, otherwise and by
+    // default by means of `compose_bin`
+    bool native_compose{false};
+    // how the updated services of a running App are replaced, either `recreate` (their containers are stopped and
+    // recreated) or `switchover` (their new containers are created while the old ones keep running, and the old
+    // ones are kept till the new ones have started, so they are switched back to on a failure), the latter
+    // applies to the Apps brought up natively only, see `native_compose`
+    std::string app_update_mode{"recreate"};
+    // keep the version an App is updated from in the store, as well as its images and the stopped containers of
+    // the Apps switched over natively, till the App is found running at the following update cycle, so a rollback
+    // to it just switches the containers over, requires `reset_apps`
+    bool retain_previous_apps{false};
+    // evict the least recently installed App versions that are not running from the `reset_apps` store if a Target
+    // fetch doesn't fit it, instead of failing the fetch, requires `reset_apps`
+    bool store_eviction{false};
+    // run the removal of the disabled Apps and the store prune which follow the Apps start after booting on a new
+    // Target version in the background, at the lowest CPU and IO priority, once the Apps are found running at the
+    // following update cycle, instead of before the installation is reported. A pending cleanup survives a restart.
+    bool deferred_cleanup{false};
+    // run the ostree pull and the App fetches of a Target at the same time instead of fetching Apps once the pull is
+    // over, the progress of both is reported as they go, and the failure of either stops the other one
+    bool overlapped_download{false};
+    // max number of Apps started concurrently after booting on a new Target version, 1 means sequential start
+    int app_start_concurrency{1};
+    // max number of disabled or removed Apps stopped concurrently, 1 means sequential stop
+    int app_stop_concurrency{1};
+    // if positive, the state of an App is checked again only after a change of its files, a container event (requires
+    // `follow_docker_events`) or a Target change, and the state of all Apps is checked at least once per the given
+    // number of seconds. By default the state of all Apps is checked each time.
+    int apps_audit_interval{0};
+    // the stages Apps are started in, e.g. `db; broker, ui`, the Apps of a stage are started once all Apps of the
+    // previous stages have started, the Apps not listed are started along with the first stage. The order declared
+    // by the Target takes precedence. Apps are stopped in the reverse order of the stages.
+    std::vector<std::vector<std::string>> app_start_order;
+    // offline update only, install App images right from the update bundle instead of copying them into
+    // `reset_apps_root` first, the images are copied into `reset_apps_root` at a low priority after the install
+    bool offline_in_place_install{false};
+    // nerdctl/containerd only, the snapshotter to pull App images lazily with, e.g. `stargz` or `soci`, an App is
+    // started before its image layers are fetched and the whole images are fetched in the background afterwards.
+    // By default the images are fully pulled before starting Apps.
+    std::string lazy_pull_snapshotter;
+    // the pull-through mirrors to fetch App manifests, blobs and images from before their registries,
+    // `<registry>=<mirror>[,<mirror>...][;<registry>=...]`, e.g. `hub.foundries.io=mirror.local:5000`
+    std::string registry_mirrors;
+    // if positive, the memory budget of the agent in MiB, e.g. 32 on the smallest devices, the App fetch and image
+    // pull concurrency is limited to `MemoryPerDownload` MiB per concurrent blob download, smaller download buffers
+    // and manifest cache are used, and the peak memory usage is checked against the budget after each download
+    int memory_budget{0};
+    static const int MemoryPerDownload{4};
+    static const std::size_t LowMemManifestCacheSize{64};
   };
 
   using AppsContainer = std::unordered_map<std::string, std::string>;
+  // how often the overlapped downloads check whether the download has been cancelled
+  static const int CancelCheckIntervalMs{100};
+  // marks the cleanup deferred by finalizeInstall(), stored in `apps_root`
+  static const std::string CleanupPendingFile;
 
   ComposeAppManager(const PackageConfig& pconfig, const BootloaderConfig& bconfig,
                     const std::shared_ptr<INvStorage>& storage, const std::shared_ptr<HttpInterface>& http,
                     std::shared_ptr<OSTree::Sysroot> sysroot, const KeyManager& keys,
                     AppEngine::Ptr app_engine = nullptr);
+  ~ComposeAppManager() override;
+  ComposeAppManager(const ComposeAppManager&) = delete;
+  ComposeAppManager& operator=(const ComposeAppManager&) = delete;
+  ComposeAppManager(ComposeAppManager&&) = delete;
+  ComposeAppManager& operator=(ComposeAppManager&&) = delete;
 
   std::string name() const override { return Name; }
   DownloadResult Download(const TufTarget& target) override;
+  // Adds the cost of the Target Apps missing in the store to the ostree one
+  UpdateCost EstimateCost(const TufTarget& target) override;
   bool fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const KeyManager& keys,
                    const FetcherProgressCb& progress_cb, const api::FlowControlToken* token) override;
 
@@ -58,16 +156,50 @@ class ComposeAppManager : public RootfsTreeManager {
   bool checkForAppsToUpdate(const Uptane::Target& target);
   void setAppsNotChecked() { are_apps_checked_ = false; }
   void handleRemovedApps(const Uptane::Target& target) const;
+  // Releases the previous versions of the given Target's Apps kept for a rollback, see `retain_previous_apps`
+  void confirmApps(const Uptane::Target& target) const;
+  // Starts the cleanup deferred by finalizeInstall() in the background if it is pending, see `deferred_cleanup`.
+  // Returns false if there is no cleanup pending or in progress.
+  bool runDeferredCleanup(const Uptane::Target& target);
   Json::Value getAppsState() const;
   static bool compareAppsStates(const Json::Value& left, const Json::Value& right);
+  // Returns the given Apps state with just the Apps which state differs from the base one, and the names of the
+  // Apps missing in it listed in `removed_apps`
+  static Json::Value getAppsStateDelta(const Json::Value& base, const Json::Value& state);
+  // Returns false if the container events are not followed, otherwise sets a number which changes along with the
+  // Apps state, so the state doesn't need to be obtained again as long as the number is the same
+  bool getAppsStateSeq(uint64_t& seq) const;
 
  private:
   Json::Value getRunningAppsInfo() const;
+  // The state of the Apps and the logs of their failing services, bounded in size, see AppDiagnostics
   std::string getRunningAppsInfoForReport() const;
+  // Pulls the Target's ostree commit and fetches its Apps concurrently, see `overlapped_download`
+  DownloadResult downloadOverlapped(const TufTarget& target);
+  // Fetches the Target's Apps to be updated, up to `fetch_concurrency` Apps at once
+  DownloadResult downloadApps(const TufTarget& target);
 
   AppsContainer getAppsToFetch(const Uptane::Target& target, bool check_store = true) const;
+  // Splits the given Target's Apps into the stages they are to be started in
+  std::vector<AppEngine::Apps> getAppStartStages(const Uptane::Target& target, const AppsContainer& apps) const;
+  // Starts the given Apps, up to `app_start_concurrency` at once, no more Apps are started once any of them fails.
+  // Returns the first failed App along with its result, or the result of success.
+  std::pair<AppEngine::App, AppEngine::Result> startApps(const AppEngine::Apps& apps);
+  // Splits the given Apps into the stages of the given order, the Apps not listed in the order go to the first stage
+  static std::vector<std::vector<std::string>> splitIntoStages(const std::vector<std::vector<std::string>>& order,
+                                                               const std::vector<std::string>& apps);
+  static bool compareAppStates(const Json::Value& left, const Json::Value& right);
   void stopDisabledComposeApps(const Uptane::Target& target) const;
+  // Removes the disabled Apps and prunes the store once the Target's Apps have started after a reboot
+  void cleanUp(const Uptane::Target& target) const;
+  // Waits for the deferred cleanup in progress, if any, so it doesn't prune the content of the following update and
+  // the Apps state is not obtained while Apps are being removed. It may be called by any thread.
+  void waitForCleanup() const;
+  // Logs the peak memory usage against `memory_budget` and releases the free heap memory
+  void checkMemoryBudget() const;
   void removeDisabledComposeApps(const Uptane::Target& target) const;
+  // Invokes the action for each installed App which is not in the Target or the config, for up to
+  // `app_stop_concurrency` Apps at once
   void forEachRemovedApp(const Uptane::Target& target,
                          const std::function<void(AppEngine::Ptr&, const std::string&)>& action) const;
 
@@ -76,6 +208,14 @@ class ComposeAppManager : public RootfsTreeManager {
   mutable AppsContainer cur_apps_to_fetch_;
   bool are_apps_checked_{false};
   AppEngine::Ptr app_engine_;
+  AppChangeTracker::ContainerEventsSeqFunc container_events_seq_;
+  std::unique_ptr<AppChangeTracker> app_change_tracker_;
+  mutable AppDiagnostics app_diagnostics_;
+  // joined only by the update cycle thread, the other ones wait for `cleanup_running_` to be reset
+  std::thread cleanup_thread_;
+  mutable std::mutex cleanup_mutex_;
+  mutable std::condition_variable cleanup_cv_;
+  bool cleanup_running_{false};
 };
 
 #endif  // AKTUALIZR_LITE_COMPOSE_APP_MANAGER_H_
@@ -1,6 +1,6 @@
 #include "client.h"
 
-#include <boost/process.hpp>
+#include <boost/algorithm/string.hpp>
 
 #include "exec.h"
 #include "logging/logging.h"
@@ -12,30 +12,124 @@ namespace containerd {
 
 Client::Client(std::string nerdctl_path) : nerdctl_{std::move(nerdctl_path)} {}
 
+Client::~Client() {
+  if (events_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock{cache_mutex_};
+      stop_ = true;
+      if (events_proc_ && events_proc_->running()) {
+        // makes the reader get EOF
+        events_proc_->terminate();
+      }
+    }
+    stop_cv_.notify_all();
+    events_thread_.join();
+  }
+}
+
+void Client::followEvents() {
+  if (events_thread_.joinable()) {
+    return;
+  }
+  events_thread_ = std::thread(&Client::readEvents, this);
+}
+
+bool Client::getEventsSeq(uint64_t& seq) {
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  seq = events_seq_;
+  return events_connected_;
+}
+
 void Client::getContainers(Json::Value& root) {
+  uint64_t seq{0};
+  {
+    std::lock_guard<std::mutex> lock{cache_mutex_};
+    if (events_connected_ && cache_valid_ && cache_seq_ == events_seq_) {
+      root = containers_cache_;
+      return;
+    }
+    seq = events_seq_;
+  }
+  listContainers(root);
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  if (events_connected_) {
+    // an event received while listing makes the listing stale straight away
+    containers_cache_ = root;
+    cache_seq_ = seq;
+    cache_valid_ = true;
+  }
+}
+
+void Client::listContainers(Json::Value& root) {
   Json::Value ctrs{Json::arrayValue};
-  const std::string cmd{nerdctl_ + " ps -a --format json"};
+  // one container per line
+  std::vector<std::string> ctr_jsons;
+  const auto output{run("ps -a --format json", "Failed to list containers")};
+  boost::split(ctr_jsons, output, boost::is_any_of("\n"), boost::token_compress_on);
+  for (const auto& ctr_json : ctr_jsons) {
+    if (!boost::trim_copy(ctr_json).empty()) {
+      ctrs.append(Utils::parseJSON(ctr_json));
+    }
+  }
+  root = ctrs;
+}
+
+void Client::readEvents() {
+  while (!stop_) {
+    bp::ipstream events;
+    {
+      std::lock_guard<std::mutex> lock{cache_mutex_};
+      if (stop_) {
+        // the process is terminated under the lock, so it must not be started once the client is being destroyed
+        break;
+      }
+      try {
+        events_proc_.reset(new bp::child(nerdctl_ + " events --format json", bp::std_out > events,
+                                         bp::std_err > bp::null));
+        events_connected_ = true;
+      } catch (const std::exception& exc) {
+        LOG_DEBUG << "Failed to start the containerd events stream: " << exc.what();
+      }
+      cache_valid_ = false;
+      // the events might have been missed while the stream has not been running
+      ++events_seq_;
+    }
 
-  bp::ipstream is;
-  bp::child c(cmd, bp::std_out > is);
+    std::string event;
+    while (events_proc_ && std::getline(events, event)) {
+      // each line is a containerd event, e.g. a container or task one, whatever it is the container listing is stale
+      onEvent();
+    }
+    if (!stop_) {
+      LOG_DEBUG << "Containerd events stream has been stopped";
+    }
 
-  std::string ctr_json;
-  while (c.running() && std::getline(is, ctr_json) && !ctr_json.empty()) {
-    ctrs.append(Utils::parseJSON(ctr_json));
+    std::unique_lock<std::mutex> lock{cache_mutex_};
+    if (events_proc_) {
+      events_proc_->wait();
+      events_proc_.reset();
+    }
+    events_connected_ = false;
+    cache_valid_ = false;
+    containers_cache_ = Json::Value();
+    // restart, containerd might have been restarted
+    stop_cv_.wait_for(lock, std::chrono::seconds(1), [this]() { return !!stop_; });
   }
-  // TODO wait with timeout and make sure that exit code is verified
-  c.wait();
-  root = ctrs;
+}
+
+void Client::onEvent() {
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  ++events_seq_;
 }
 
 std::tuple<bool, std::string> Client::getContainerState(const Json::Value& root, const std::string& app,
                                                         const std::string& service, const std::string& hash) const {
   for (Json::ValueConstIterator ii = root.begin(); ii != root.end(); ++ii) {
-    Json::Value val = *ii;
-    if (val["Labels"]["com.docker.compose.project"].asString() == app) {
-      if (val["Labels"]["com.docker.compose.service"].asString() == service) {
-        if (val["Labels"]["io.compose-spec.config-hash"].asString() == hash) {
-          return {true, val["State"]["Status"].asString()};
+    const Json::Value& labels{(*ii)["Labels"]};
+    if (labels["com.docker.compose.project"].asString() == app) {
+      if (labels["com.docker.compose.service"].asString() == service) {
+        if (labels["io.compose-spec.config-hash"].asString() == hash) {
+          return {true, (*ii)["State"]["Status"].asString()};
         }
       }
     }
@@ -43,35 +137,60 @@ std::tuple<bool, std::string> Client::getContainerState(const Json::Value& root,
   return {false, ""};
 }
 
-std::string Client::getContainerLogs(const std::string& /*id*/, int /*tail*/) {
-  // TODO
-  throw std::runtime_error("Log fetching is not implemented for containerd");
+AppEngine::Client::ContainerStates Client::getContainerStates(const Json::Value& root) const {
+  ContainerStates states;
+  for (Json::ValueConstIterator ii = root.begin(); ii != root.end(); ++ii) {
+    const Json::Value& labels{(*ii)["Labels"]};
+    const std::string app{labels["com.docker.compose.project"].asString()};
+    if (app.empty()) {
+      continue;
+    }
+    states.emplace(std::make_tuple(app, labels["com.docker.compose.service"].asString(),
+                                   labels["io.compose-spec.config-hash"].asString()),
+                   (*ii)["State"]["Status"].asString());
+  }
+  return states;
+}
+
+std::string Client::getContainerLogs(const std::string& id, int tail) {
+  return run("logs --tail " + std::to_string(tail) + " " + id, "Failed to get logs of container " + id);
 }
 
 const Json::Value& Client::engineInfo() const {
-  // It's needed only for restorable Apps
-  throw std::runtime_error("Engine info fetching is not implemented for containerd");
+  std::lock_guard<std::mutex> lock{engine_info_mutex_};
+  if (!engine_info_) {
+    // not cached if the command fails, so it is retried on the next use
+    engine_info_ = Utils::parseJSON(run("version --format json", "Failed to get the containerd engine info"));
+    arch_ = engine_info_["Client"].get("Arch", Json::Value()).asString();
+  }
+  return engine_info_;
 }
+
 const std::string& Client::arch() const {
-  // It's needed only for restorable Apps
-  throw std::runtime_error("Arch obtaining is not implemented for containerd");
+  engineInfo();
+  std::lock_guard<std::mutex> lock{engine_info_mutex_};
+  return arch_;
 }
 
 void Client::pruneImages() {
-  // https://github.com/containerd/nerdctl/issues/648
-  // Allegedly the prune cmd is supported in nerdctl v0.22.0, currently, LmP runs 0.18.0
-  // Also, I tried v0.22.0 and it doesn't work for me...
-  LOG_ERROR << "Image prunning is not supported in nerdctl";
+  // not supported by nerdctl before v0.22.0
+  try {
+    run("image prune --all --force", "Failed to prune images");
+  } catch (const std::exception& exc) {
+    LOG_ERROR << "Image prunning has failed, it might be not supported by the nerdctl version: " << exc.what();
+  }
 }
 
 void Client::pruneContainers() {
-  // https://github.com/containerd/nerdctl/issues/648
-  // Allegedly the prune cmd is supported in nerdctl v0.22.0, currently, LmP runs 0.18.0
-  // Also, I tried v0.22.0 and it doesn't work for me...
-  LOG_ERROR << "Container prunning is not supported in nerdctl";
+  // not supported by nerdctl before v0.22.0
+  try {
+    run("container prune --force", "Failed to prune containers");
+  } catch (const std::exception& exc) {
+    LOG_ERROR << "Container prunning has failed, it might be not supported by the nerdctl version: " << exc.what();
+  }
 }
 
-Json::Value Client::getRunningApps(const std::function<void(const std::string&, Json::Value&)>& /* ext_func */) {
+Json::Value Client::getRunningApps(const std::function<void(const std::string&, Json::Value&)>& ext_func) {
   Json::Value apps;
   Json::Value containers;
 
@@ -103,14 +222,27 @@ Json::Value Client::getRunningApps(const std::function<void(const std::string&,
       service_attributes["health"] = "unhealthy";
     }
 
-    // TODO: logs
-    //    if (service_attributes["health"] != "healthy") {
-    //      service_attributes["logs"] = getContainerLogs(val["Id"].asString());
-    //    }
+    if (service_attributes["health"] != "healthy") {
+      try {
+        service_attributes["logs"] = getContainerLogs(val["ID"].asString(), 5);
+      } catch (const std::exception& exc) {
+        LOG_WARNING << "Failed to get logs of container " << val["ID"].asString() << ": " << exc.what();
+      }
+    }
 
     apps[app_name]["services"].append(service_attributes);
+
+    if (ext_func) {
+      ext_func(app_name, apps[app_name]);
+    }
   }
   return apps;
 }
 
+std::string Client::run(const std::string& args, const std::string& err_msg) const {
+  std::future<std::string> output;
+  exec(nerdctl_ + " " + args, err_msg, bp::std_out > output);
+  return output.get();
+}
+
 }  // namespace containerd
@@ -1,6 +1,14 @@
 #ifndef AKTUALIZR_LITE_CONTAINERD_CLIENT_H
 #define AKTUALIZR_LITE_CONTAINERD_CLIENT_H
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <boost/process.hpp>
+
 #include "appengine.h"
 
 namespace containerd {
@@ -8,10 +16,24 @@ namespace containerd {
 class Client : public AppEngine::Client {
  public:
   explicit Client(std::string nerdctl_path);
+  ~Client() override;
+  Client(const Client&) = delete;
+  Client& operator=(const Client&) = delete;
+  Client(Client&&) = delete;
+  Client& operator=(Client&&) = delete;
+
+  // Makes the client keep the last container listing in memory and follow the containerd events streamed by
+  // `nerdctl events`, so the containers are listed again only after an event. The containers are listed on
+  // each query as long as the events stream is not running.
+  void followEvents();
+  // Returns false if the events stream is not running, otherwise sets the number of the events received so far,
+  // the number changes on each event and restart of the stream
+  bool getEventsSeq(uint64_t& seq);
 
   void getContainers(Json::Value& root) override;
   std::tuple<bool, std::string> getContainerState(const Json::Value& root, const std::string& app,
                                                   const std::string& service, const std::string& hash) const override;
+  ContainerStates getContainerStates(const Json::Value& root) const override;
   std::string getContainerLogs(const std::string& id, int tail) override;
   const Json::Value& engineInfo() const override;
   const std::string& arch() const override;
@@ -20,7 +42,28 @@ class Client : public AppEngine::Client {
   void pruneContainers() override;
 
  private:
+  std::string run(const std::string& args, const std::string& err_msg) const;
+  void listContainers(Json::Value& root);
+  void readEvents();
+  void onEvent();
+
   const std::string nerdctl_;
+
+  mutable std::mutex engine_info_mutex_;
+  mutable Json::Value engine_info_;
+  mutable std::string arch_;
+
+  // the container listing cache, valid while the events stream is running and no event has come since the listing
+  std::thread events_thread_;
+  std::mutex cache_mutex_;
+  std::condition_variable stop_cv_;
+  std::atomic_bool stop_{false};
+  std::unique_ptr<boost::process::child> events_proc_;
+  bool events_connected_{false};
+  uint64_t events_seq_{0};
+  uint64_t cache_seq_{0};
+  bool cache_valid_{false};
+  Json::Value containers_cache_;
 };
 
 }  // namespace containerd
@@ -1,18 +1,71 @@
 #include "engine.h"
+
+#include "docker/composeinfo.h"
 #include "exec.h"
 
 namespace containerd {
 
+static std::string getComposeCmd(const std::string& nerdctl_bin, const std::string& snapshotter) {
+  return nerdctl_bin + (snapshotter.empty() ? "" : " --snapshotter=" + snapshotter) + " compose ";
+}
+
+Engine::Engine(boost::filesystem::path root_dir, const std::string& nerdctl_bin, AppEngine::Client::Ptr client,
+               Docker::RegistryClient::Ptr registry_client, std::string lazy_pull_snapshotter)
+    : Docker::ComposeAppEngine(std::move(root_dir), getComposeCmd(nerdctl_bin, lazy_pull_snapshotter),
+                               std::move(client), std::move(registry_client)),
+      nerdctl_{nerdctl_bin},
+      lazy_pull_snapshotter_{std::move(lazy_pull_snapshotter)} {}
+
+Engine::~Engine() {
+  std::lock_guard<std::mutex> lock{completions_mutex_};
+  for (auto& completion : completions_) {
+    // an unfinished pull goes on after the agent exits
+    completion.detach();
+  }
+}
+
 void Engine::pullImages(const App& app) {
-  LOG_INFO << "Pulling containers";
+  LOG_INFO << "Pulling containers" << (lazy_pull_snapshotter_.empty() ? "" : ", lazily by " + lazy_pull_snapshotter_);
   runComposeCmd(app, "pull", "failed to pull App images");
 }
 void Engine::installApp(const App& app) {
   LOG_INFO << "Installing App";
   runComposeCmd(app, "up --remove-orphans -d", "failed to install App");
+  if (!lazy_pull_snapshotter_.empty()) {
+    completeImagePull(app);
+  }
 }
 void Engine::runComposeCmd(const App& app, const std::string& cmd, const std::string& err_msg) const {
   exec(compose_ + "--project-directory " + appRoot(app).string() + " " + cmd, err_msg);
 }
 
+void Engine::completeImagePull(const App& app) {
+  std::vector<std::string> images;
+  try {
+    const auto compose{Docker::ComposeInfo::load((appRoot(app) / ComposeFile).string())};
+    for (const auto& service : compose->services()) {
+      images.emplace_back(service.image);
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << app.name << ": failed to get the App images to fetch in the background: " << exc.what();
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock{completions_mutex_};
+  // `running()` reaps the finished pulls
+  completions_.remove_if([](boost::process::child& completion) { return !completion.running(); });
+  for (const auto& image : images) {
+    // fetches all the image blobs into the content store, the content is already unpacked by the snapshotter
+    const std::string cmd{nerdctl_ + " --snapshotter=" + lazy_pull_snapshotter_ + " pull --unpack=false " + image};
+    try {
+      completions_.emplace_back(cmd, boost::process::std_out > boost::process::null,
+                                boost::process::std_err > boost::process::null);
+      LOG_INFO << app.name << ": fetching the whole image in the background: " << image;
+    } catch (const std::exception& exc) {
+      LOG_WARNING << app.name << ": failed to fetch the whole image in the background: " << image << ", err: "
+                  << exc.what();
+    }
+  }
+}
+
 }  // namespace containerd
@@ -1,21 +1,44 @@
 #ifndef AKTUALIZR_LITE_CONTAINERD_ENGINE_H
 #define AKTUALIZR_LITE_CONTAINERD_ENGINE_H
 
+#include <list>
+#include <mutex>
+
+#include <boost/process.hpp>
+
 #include "docker/composeappengine.h"
 
 namespace containerd {
 
+/**
+ * @brief Engine, manages Apps by means of `nerdctl compose`.
+ *
+ * If a lazy pull snapshotter is set, e.g. `stargz` or `soci`, the App images of a lazily pullable format are pulled
+ * and unpacked by the snapshotter, so an App starts once its image metadata is fetched and the layer content is
+ * fetched on demand. The whole content of each App image is fetched into the containerd content store in
+ * the background once the App is started, so the App can be restarted without the network later on.
+ */
 class Engine : public Docker::ComposeAppEngine {
  public:
-  Engine(boost::filesystem::path root_dir, std::string compose_bin, AppEngine::Client::Ptr client,
-         Docker::RegistryClient::Ptr registry_client)
-      : Docker::ComposeAppEngine(std::move(root_dir), std::move(compose_bin), std::move(client),
-                                 std::move(registry_client)) {}
+  Engine(boost::filesystem::path root_dir, const std::string& nerdctl_bin, AppEngine::Client::Ptr client,
+         Docker::RegistryClient::Ptr registry_client, std::string lazy_pull_snapshotter = "");
+  ~Engine() override;
+  Engine(const Engine&) = delete;
+  Engine& operator=(const Engine&) = delete;
+  Engine(Engine&&) = delete;
+  Engine& operator=(Engine&&) = delete;
 
  private:
   void pullImages(const App& app) override;
   void installApp(const App& app) override;
   void runComposeCmd(const App& app, const std::string& cmd, const std::string& err_msg) const override;
+  void completeImagePull(const App& app);
+
+  const std::string nerdctl_;
+  const std::string lazy_pull_snapshotter_;
+  std::mutex completions_mutex_;
+  // the background pulls of the lazily pulled App images
+  std::list<boost::process::child> completions_;
 };
 
 }  // namespace containerd
@@ -0,0 +1,66 @@
+#include "apptree.h"
+
+#include "apparchive.h"
+#include "logging/logging.h"
+#include "ostree/repo.h"
+
+namespace Docker {
+
+const std::string AppTree::BranchPrefix{"apps/"};
+
+AppTree::AppTree(boost::filesystem::path path)
+    : path_{std::move(path)},
+      staging_root_{path_.string() + "-staging"},
+      repo_{new OSTree::Repo(path_.string(), true, OSTREE_REPO_MODE_BARE_USER_ONLY)} {}
+
+AppTree::~AppTree() = default;
+
+void AppTree::checkout(const boost::filesystem::path& archive, const std::string& archive_hash,
+                       const boost::filesystem::path& dst_dir) {
+  const auto branch{BranchPrefix + archive_hash};
+  std::lock_guard<std::mutex> lock{mutex_};
+
+  std::string commit_hash;
+  const auto refs{repo_->getRefs()};
+  const auto ref_it{refs.find(branch)};
+  if (ref_it != refs.end()) {
+    commit_hash = ref_it->second;
+  } else {
+    const auto staging_dir{staging_root_ / archive_hash};
+    boost::filesystem::remove_all(staging_dir);
+    boost::filesystem::create_directories(staging_dir);
+    try {
+      AppArchive(archive).extract(staging_dir);
+      commit_hash = repo_->commit(staging_dir.string(), branch);
+    } catch (...) {
+      boost::filesystem::remove_all(staging_dir);
+      throw;
+    }
+    boost::filesystem::remove_all(staging_dir);
+    LOG_DEBUG << "App archive " << archive << " committed to " << path_ << ", commit: " << commit_hash;
+  }
+
+  boost::filesystem::create_directories(dst_dir);
+  repo_->checkoutHardlinks(commit_hash, dst_dir.string());
+}
+
+void AppTree::prune(const std::unordered_set<std::string>& kept_archives) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  bool removed{false};
+  for (const auto& ref : repo_->getRefs()) {
+    if (ref.first.compare(0, BranchPrefix.size(), BranchPrefix) != 0 ||
+        kept_archives.count(ref.first.substr(BranchPrefix.size())) > 0) {
+      continue;
+    }
+    LOG_INFO << "Removing App archive commit from " << path_ << ": " << ref.first;
+    repo_->removeRef(ref.first);
+    removed = true;
+  }
+  if (removed) {
+    repo_->prune();
+  }
+  // leftovers of an interrupted commit
+  boost::filesystem::remove_all(staging_root_);
+}
+
+}  // namespace Docker
@@ -0,0 +1,57 @@
+#ifndef AKTUALIZR_LITE_APP_TREE_H_
+#define AKTUALIZR_LITE_APP_TREE_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+#include <boost/filesystem.hpp>
+
+namespace OSTree {
+class Repo;
+}
+
+namespace Docker {
+
+/**
+ * @brief AppTree, a local ostree repo of the App archive contents.
+ *
+ * The content of each App archive is committed to the repo once, to the branch `apps/<archive hash>`, and checked out
+ * into an App install dir by hardlinking the repo files. The files that are the same across App versions and across
+ * Apps are stored once, and an App update that changes a few files costs just their size. The App install dirs must
+ * be on the repo file system, and the checked out files must never be modified in place since they are shared with
+ * the repo and the other checkouts.
+ */
+class AppTree {
+ public:
+  static const std::string BranchPrefix;
+
+  // Creates the repo in the bare-user-only mode if it doesn't exist
+  explicit AppTree(boost::filesystem::path path);
+  ~AppTree();
+
+  AppTree(const AppTree&) = delete;
+  AppTree(AppTree&&) = delete;
+  AppTree& operator=(const AppTree&) = delete;
+  AppTree& operator=(AppTree&&) = delete;
+
+  // Checks out the content of the given App archive into `dst_dir`, the archive is committed to the repo first if it
+  // hasn't been yet. The files existing in `dst_dir` are overwritten, like an archive extraction does.
+  void checkout(const boost::filesystem::path& archive, const std::string& archive_hash,
+                const boost::filesystem::path& dst_dir);
+  // Removes the App archive commits not listed in `kept_archives` and the repo objects that only they referenced
+  void prune(const std::unordered_set<std::string>& kept_archives);
+
+ private:
+  const boost::filesystem::path path_;
+  // the App archives are extracted next to the repo, so their files can be committed without crossing file systems
+  const boost::filesystem::path staging_root_;
+  std::unique_ptr<OSTree::Repo> repo_;
+  // a repo supports just one transaction at a time
+  std::mutex mutex_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_APP_TREE_H_
@@ -0,0 +1,92 @@
+#include "blobindex.h"
+
+#include <unordered_set>
+
+namespace Docker {
+
+BlobIndex::BlobIndex(boost::filesystem::path blob_dir) : blob_dir_{std::move(blob_dir)} {}
+
+bool BlobIndex::isPresent(const std::string& hash) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  build();
+  return blobs_.count(hash) > 0;
+}
+
+bool BlobIndex::getSize(const std::string& hash, uint64_t& size) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  build();
+  const auto blob_it{blobs_.find(hash)};
+  if (blob_it == blobs_.end()) {
+    return false;
+  }
+  size = blob_it->second;
+  return true;
+}
+
+void BlobIndex::update(const std::string& hash) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!built_) {
+    // the blob is taken into account once the index is built
+    return;
+  }
+  boost::system::error_code ec;
+  const auto size{boost::filesystem::file_size(blob_dir_ / hash, ec)};
+  if (ec) {
+    blobs_.erase(hash);
+  } else {
+    blobs_[hash] = size;
+  }
+}
+
+void BlobIndex::remove(const std::string& hash) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  blobs_.erase(hash);
+}
+
+void BlobIndex::invalidate() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  blobs_.clear();
+  built_ = false;
+}
+
+BlobIndex::BlobSize BlobIndex::reserve(const std::string& owner,
+                                       const std::unordered_map<std::string, BlobSize>& blobs) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  build();
+  reservations_[owner] = blobs;
+
+  BlobSize total_size;
+  std::unordered_set<std::string> counted;
+  for (const auto& reservation : reservations_) {
+    for (const auto& blob : reservation.second) {
+      if (blobs_.count(blob.first) == 0 && counted.emplace(blob.first).second) {
+        total_size.size += blob.second.size;
+        total_size.usage += blob.second.usage;
+      }
+    }
+  }
+  return total_size;
+}
+
+void BlobIndex::release(const std::string& owner) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  reservations_.erase(owner);
+}
+
+void BlobIndex::build() const {
+  if (built_) {
+    return;
+  }
+  blobs_.clear();
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator it{blob_dir_, ec}, end; !ec && it != end; it.increment(ec)) {
+    boost::system::error_code size_ec;
+    const auto size{boost::filesystem::file_size(it->path(), size_ec)};
+    if (!size_ec) {
+      blobs_.emplace(it->path().filename().string(), size);
+    }
+  }
+  built_ = true;
+}
+
+}  // namespace Docker
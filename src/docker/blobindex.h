@@ -0,0 +1,59 @@
+#ifndef AKTUALIZR_LITE_BLOB_INDEX_H_
+#define AKTUALIZR_LITE_BLOB_INDEX_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief BlobIndex, an in-memory index of the blobs present in the App store and their sizes.
+ *
+ * The index is built by listing the blob directory once, on the first query, and then it is kept up to date by
+ * the App fetch and prune. It also keeps track of the blobs that are about to be downloaded by the ongoing
+ * App fetches, so the storage required by all Apps being fetched can be estimated without counting
+ * the layers they share more than once. All methods are thread-safe.
+ */
+class BlobIndex {
+ public:
+  struct BlobSize {
+    // the blob size in the App store
+    uint64_t size{0};
+    // the amount of storage the blob occupies in the docker store once extracted
+    uint64_t usage{0};
+  };
+
+  explicit BlobIndex(boost::filesystem::path blob_dir);
+
+  bool isPresent(const std::string& hash) const;
+  // Returns false if the blob is not present
+  bool getSize(const std::string& hash, uint64_t& size) const;
+
+  // Re-reads the blob state from the store
+  void update(const std::string& hash);
+  void remove(const std::string& hash);
+  // Drops the whole index, it is rebuilt on the next query
+  void invalidate();
+
+  // Records the blobs the given owner is about to download, and returns the total sizes of all recorded blobs which
+  // are not present, including the ones recorded by other owners
+  BlobSize reserve(const std::string& owner, const std::unordered_map<std::string, BlobSize>& blobs);
+  void release(const std::string& owner);
+
+ private:
+  void build() const;
+
+  const boost::filesystem::path blob_dir_;
+  mutable std::mutex mutex_;
+  mutable bool built_{false};
+  mutable std::unordered_map<std::string, uint64_t> blobs_;
+  std::unordered_map<std::string, std::unordered_map<std::string, BlobSize>> reservations_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_BLOB_INDEX_H_
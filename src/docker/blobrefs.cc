@@ -0,0 +1,178 @@
+#include "blobrefs.h"
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+BlobRefs::BlobRefs(boost::filesystem::path file) : file_{std::move(file)} { load(); }
+
+bool BlobRefs::isComplete() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return complete_;
+}
+
+void BlobRefs::setComplete() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!complete_) {
+    complete_ = true;
+    dirty_ = true;
+  }
+}
+
+bool BlobRefs::hasOwner(const std::string& owner) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return owners_.count(owner) > 0;
+}
+
+std::vector<std::string> BlobRefs::owners() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::vector<std::string> res;
+  res.reserve(owners_.size());
+  for (const auto& owner : owners_) {
+    res.emplace_back(owner.first);
+  }
+  return res;
+}
+
+bool BlobRefs::getRefs(const std::string& owner, Refs& refs) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto owner_it{owners_.find(owner)};
+  if (owner_it == owners_.end()) {
+    return false;
+  }
+  refs = owner_it->second;
+  return true;
+}
+
+std::vector<std::string> BlobRefs::add(const std::string& owner, Refs refs) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::vector<std::string> unreferenced;
+  auto owner_it{owners_.find(owner)};
+  if (owner_it != owners_.end() && owner_it->second.blobs == refs.blobs &&
+      owner_it->second.manifests == refs.manifests) {
+    return unreferenced;
+  }
+  // the new references are counted first, so the blobs referenced by both the replaced and new ones stay
+  for (const auto& blob : refs.blobs) {
+    ++counts_[blob];
+  }
+  if (owner_it != owners_.end()) {
+    for (const auto& blob : owner_it->second.blobs) {
+      auto count_it{counts_.find(blob)};
+      if (count_it == counts_.end() || --count_it->second == 0) {
+        if (count_it != counts_.end()) {
+          counts_.erase(count_it);
+        }
+        unreferenced.emplace_back(blob);
+      }
+    }
+  }
+  owners_[owner] = std::move(refs);
+  dirty_ = true;
+  return unreferenced;
+}
+
+std::vector<std::string> BlobRefs::remove(const std::string& owner) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::vector<std::string> unreferenced;
+  auto owner_it{owners_.find(owner)};
+  if (owner_it == owners_.end()) {
+    return unreferenced;
+  }
+  for (const auto& blob : owner_it->second.blobs) {
+    auto count_it{counts_.find(blob)};
+    if (count_it == counts_.end() || --count_it->second == 0) {
+      if (count_it != counts_.end()) {
+        counts_.erase(count_it);
+      }
+      unreferenced.emplace_back(blob);
+    }
+  }
+  owners_.erase(owner_it);
+  dirty_ = true;
+  return unreferenced;
+}
+
+bool BlobRefs::isReferenced(const std::string& blob) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return counts_.count(blob) > 0;
+}
+
+std::unordered_set<std::string> BlobRefs::manifests() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::unordered_set<std::string> res;
+  for (const auto& owner : owners_) {
+    res.insert(owner.second.manifests.begin(), owner.second.manifests.end());
+  }
+  return res;
+}
+
+void BlobRefs::flush() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!dirty_ || file_.empty()) {
+    return;
+  }
+
+  Json::Value table;
+  table["complete"] = complete_;
+  table["owners"] = Json::Value(Json::objectValue);
+  for (const auto& owner : owners_) {
+    Json::Value& value{table["owners"][owner.first]};
+    value["blobs"] = Json::Value(Json::arrayValue);
+    for (const auto& blob : owner.second.blobs) {
+      value["blobs"].append(blob);
+    }
+    value["manifests"] = Json::Value(Json::arrayValue);
+    for (const auto& manifest : owner.second.manifests) {
+      value["manifests"].append(manifest);
+    }
+  }
+
+  try {
+    // write to a temporary file and move it to the table file so the table file is never half-written
+    const boost::filesystem::path tmp_file{file_.string() + ".tmp"};
+    Utils::writeFile(tmp_file, Utils::jsonToCanonicalStr(table));
+    boost::filesystem::rename(tmp_file, file_);
+    dirty_ = false;
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to store the blob reference table " << file_ << ": " << exc.what();
+  }
+}
+
+void BlobRefs::load() {
+  if (file_.empty() || !boost::filesystem::exists(file_)) {
+    return;
+  }
+  try {
+    const auto table{Utils::parseJSONFile(file_)};
+    if (!table.isObject() || !table["complete"].isBool() || !table["owners"].isObject()) {
+      LOG_WARNING << "Invalid blob reference table " << file_ << ", it will be rebuilt";
+      return;
+    }
+    for (Json::ValueConstIterator it = table["owners"].begin(); it != table["owners"].end(); ++it) {
+      const auto& value{*it};
+      if (!value["blobs"].isArray() || !value["manifests"].isArray()) {
+        // an owner that is not accounted makes the whole table useless
+        throw std::invalid_argument("invalid entry of " + it.key().asString());
+      }
+      Refs refs;
+      for (const auto& blob : value["blobs"]) {
+        refs.blobs.emplace(blob.asString());
+        ++counts_[blob.asString()];
+      }
+      for (const auto& manifest : value["manifests"]) {
+        refs.manifests.emplace(manifest.asString());
+      }
+      owners_.emplace(it.key().asString(), std::move(refs));
+    }
+    complete_ = table["complete"].asBool();
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to load the blob reference table " << file_ << ", it will be rebuilt: " << exc.what();
+    owners_.clear();
+    counts_.clear();
+    complete_ = false;
+  }
+}
+
+}  // namespace Docker
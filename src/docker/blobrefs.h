@@ -0,0 +1,70 @@
+#ifndef AKTUALIZR_LITE_BLOB_REFS_H_
+#define AKTUALIZR_LITE_BLOB_REFS_H_
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief BlobRefs, a persistent reference-count table of the App store blobs.
+ *
+ * Each App version, i.e. an owner, records the blobs and the cached manifests it references when it is fetched,
+ * a blob's reference count is the number of owners that reference it. Removing an owner yields the blobs which
+ * count dropped to zero, so the store can be pruned without re-parsing manifests of all Apps and without listing
+ * the whole blob directory.
+ *
+ * The table is complete if it has been built by a full store scan at least once, i.e. it accounts for all
+ * the blobs found in the store. A missing or corrupted table file makes it incomplete, and it is up to the caller
+ * to rebuild it. All methods are thread-safe.
+ */
+class BlobRefs {
+ public:
+  struct Refs {
+    std::set<std::string> blobs;
+    std::set<std::string> manifests;
+  };
+
+  // The table is not persisted if the file path is empty
+  explicit BlobRefs(boost::filesystem::path file = "");
+
+  bool isComplete() const;
+  void setComplete();
+
+  bool hasOwner(const std::string& owner) const;
+  std::vector<std::string> owners() const;
+  // Returns false if there is no such owner
+  bool getRefs(const std::string& owner, Refs& refs) const;
+  // Records or replaces references of the given owner, returns the blobs that were referenced by the replaced
+  // references only, so they are not referenced by anyone anymore
+  std::vector<std::string> add(const std::string& owner, Refs refs);
+  // Drops references of the given owner and returns the blobs that are not referenced by anyone anymore
+  std::vector<std::string> remove(const std::string& owner);
+
+  bool isReferenced(const std::string& blob) const;
+  std::unordered_set<std::string> manifests() const;
+
+  // Stores the table if it has been changed since the last flush
+  void flush();
+
+ private:
+  void load();
+
+  const boost::filesystem::path file_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Refs> owners_;
+  // blob hash -> the number of owners referencing it
+  std::unordered_map<std::string, unsigned int> counts_;
+  bool complete_{false};
+  bool dirty_{false};
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_BLOB_REFS_H_
@@ -3,12 +3,27 @@
 #include "dockerclient.h"
 
 #include <sys/statvfs.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/process.hpp>
 
+#include "apparchive.h"
 #include "exec.h"
 
 namespace Docker {
 
+class ImagePullError : public std::runtime_error {
+ public:
+  ImagePullError(const std::string& image, const std::string& err)
+      : std::runtime_error("failed to pull App image " + image + ": " + err) {}
+};
+
+const int ComposeAppEngine::PullRetryBackoffSec;
+
 ComposeAppEngine::ComposeAppEngine(boost::filesystem::path root_dir, std::string compose_bin,
                                    AppEngine::Client::Ptr client, Docker::RegistryClient::Ptr registry_client)
     : root_{std::move(root_dir)},
@@ -27,13 +42,15 @@ AppEngine::Result ComposeAppEngine::fetch(const App& app) {
     download(app);
     state.setState(AppState::State::kDownloaded);
 
-    runComposeCmd(app, "config", "compose App validation failed");
+    verifyComposeApp(app, "compose App validation failed");
     state.setState(AppState::State::kVerified);
 
     pullImages(app);
     state.setState(AppState::State::kPulled);
 
     result = true;
+  } catch (const ImagePullError& exc) {
+    result = {Result::ID::ImagePullFailure, exc.what()};
   } catch (const std::exception& exc) {
     result = {false, exc.what()};
   }
@@ -208,8 +225,8 @@ bool ComposeAppEngine::isRunning(const App& app) const {
 
   // let's fallback or do double check
   try {
-    ComposeInfo info((appRoot(app) / ComposeFile).string());
-    std::vector<Json::Value> services = info.getServices();
+    const auto info{ComposeInfo::load((appRoot(app) / ComposeFile).string())};
+    const auto& services{info->services()};
     if (services.empty()) {
       LOG_WARNING << "App: " << app.name << ", no services in docker file!";
       return false;
@@ -217,13 +234,14 @@ bool ComposeAppEngine::isRunning(const App& app) const {
 
     Json::Value containers;
     client_->getContainers(containers);
-
-    for (std::size_t i = 0; i < services.size(); i++) {
-      std::string service = services[i].asString();
-      std::string hash = info.getHash(services[i]);
-      const auto container_state{client_->getContainerState(containers, app.name, service, hash)};
-      if (std::get<0>(container_state) /* container exists */ &&
-          std::get<1>(container_state) != "created" /* container was started */) {
+    const auto container_states{client_->getContainerStates(containers)};
+
+    for (const auto& compose_service : services) {
+      const std::string& service = compose_service.name;
+      const std::string& hash = compose_service.hash;
+      const auto container_state{container_states.find(std::make_tuple(app.name, service, hash))};
+      if (container_state != container_states.end() /* container exists */ &&
+          container_state->second != "created" /* container was started */) {
         continue;
       }
       LOG_WARNING << "App: " << app.name << ", service: " << service << ", hash: " << hash << ", not running!";
@@ -274,25 +292,29 @@ void ComposeAppEngine::download(const App& app) {
   Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
   Manifest manifest{registry_client_->getAppManifest(uri, Manifest::Format)};
 
-  const std::string archive_file_name{uri.digest.shortHash() + '.' + app.name + ArchiveExt};
+  const std::string archive_file_name{uri.digest.shortHash() + '.' + app.name + manifest.archiveExt()};
   Docker::Uri archive_uri{uri.createUri(Docker::HashedDigest(manifest.archiveDigest()))};
 
-  uint64_t available_storage;
-  if (checkAvailableStorageSpace(appRoot(app), available_storage)) {
-    // assume that an extracted files total size is up to 10x larger than the archive size
+  const auto checkAvailableStorage = [this, &app](uint64_t need_storage, const std::string& purpose) {
+    uint64_t available_storage;
+    if (!checkAvailableStorageSpace(appRoot(app), available_storage)) {
+      LOG_WARNING << "Failed to get an available storage space, continuing to " << purpose;
+      return;
+    }
     // 80% is a storage space watermark, we don't want to fill a storage volume above it
-    auto need_storage = manifest.archiveSize() * 10;
     auto available_for_apps = static_cast<uint64_t>(available_storage * 0.8);
     if (need_storage > available_for_apps) {
-      throw std::runtime_error("There is no sufficient storage space available to download App archive, available: " +
-                               std::to_string(available_for_apps) + " need: " + std::to_string(need_storage));
+      throw std::runtime_error("There is no sufficient storage space available to " + purpose +
+                               ", available: " + std::to_string(available_for_apps) +
+                               " need: " + std::to_string(need_storage));
     }
-  } else {
-    LOG_WARNING << "Failed to get an available storage space, continuing with App archive download";
-  }
+  };
 
+  checkAvailableStorage(manifest.archiveSize(), "download App archive");
   registry_client_->downloadBlob(archive_uri, appRoot(app) / archive_file_name, manifest.archiveSize());
   verifyAppArchive(app, archive_file_name);
+  // the exact size of the extracted files is known once the archive is downloaded
+  checkAvailableStorage(AppArchive(appRoot(app) / archive_file_name).getExtractedSize(), "extract App archive");
   extractAppArchive(app, archive_file_name);
 
   LOG_DEBUG << app.name << ": App has been downloaded";
@@ -301,17 +323,82 @@ void ComposeAppEngine::download(const App& app) {
 AppEngine::Result ComposeAppEngine::verify(const App& app) {
   Result result{true};
   try {
-    LOG_INFO << "Validating compose file";
-    runComposeCmd(app, "config", "compose file validation failed");
+    verifyComposeApp(app, "compose file validation failed");
   } catch (const std::exception& exc) {
     result = {false, exc.what()};
   }
   return result;
 }
 
+void ComposeAppEngine::verifyComposeApp(const App& app, const std::string& err_msg) {
+  const auto digest{Uri::parseUri(app.uri).digest.hash()};
+  if (verify_cache_.isVerified(digest)) {
+    LOG_DEBUG << app.name << ": compose file has been validated already";
+    return;
+  }
+  LOG_INFO << "Validating compose file";
+  runComposeCmd(app, "config", err_msg);
+  verify_cache_.setVerified(digest);
+}
+
 void ComposeAppEngine::pullImages(const App& app) {
   LOG_INFO << "Pulling containers";
-  runComposeCmd(app, "pull --no-parallel", "failed to pull App images");
+  if (pull_concurrency_ <= 1 && pull_retries_ == 0) {
+    runComposeCmd(app, "pull --no-parallel", "failed to pull App images");
+    return;
+  }
+
+  // an image shared by several services is pulled once, by means of the first of them
+  std::vector<std::pair<std::string, std::string>> images;
+  for (const auto& service : ComposeInfo::load((appRoot(app) / ComposeFile).string())->services()) {
+    if (!service.image.empty() && std::none_of(images.begin(), images.end(),
+                     [&service](const std::pair<std::string, std::string>& image) {
+                       return image.first == service.image;
+                     })) {
+      images.emplace_back(service.image, service.name);
+    }
+  }
+
+  std::atomic<std::size_t> next{0};
+  std::atomic_bool failed{false};
+  std::mutex err_mutex;
+  std::exception_ptr err;
+  const auto pull = [&]() {
+    for (auto ii = next++; ii < images.size() && !failed; ii = next++) {
+      const auto& image{images[ii]};
+      for (int attempt = 0;; ++attempt) {
+        try {
+          runComposeCmd(app, "pull " + image.second, "failed to pull App image");
+          break;
+        } catch (const std::exception& exc) {
+          if (attempt >= pull_retries_ || failed) {
+            std::lock_guard<std::mutex> lock{err_mutex};
+            if (!failed.exchange(true)) {
+              err = std::make_exception_ptr(ImagePullError(image.first, exc.what()));
+            }
+            break;
+          }
+          const auto backoff{PullRetryBackoffSec << std::min(attempt, 10)};
+          LOG_WARNING << app.name << ": failed to pull image " << image.first << ", retrying in " << backoff
+                      << " seconds; " << exc.what();
+          std::this_thread::sleep_for(std::chrono::seconds(backoff));
+        }
+      }
+    }
+  };
+  const auto worker_numb{std::min(static_cast<std::size_t>(std::max(pull_concurrency_, 1)), images.size())};
+  LOG_INFO << app.name << ": pulling " << images.size() << " images, up to " << worker_numb << " concurrently";
+  std::vector<std::thread> workers;
+  for (std::size_t ii = 1; ii < worker_numb; ++ii) {
+    workers.emplace_back(pull);
+  }
+  pull();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  if (err) {
+    std::rethrow_exception(err);
+  }
 }
 
 void ComposeAppEngine::installApp(const App& app) {
@@ -326,20 +413,20 @@ void ComposeAppEngine::start(const App& app) {
 
 bool ComposeAppEngine::areContainersCreated(const App& app) {
   bool result{true};
-  ComposeInfo info((appRoot(app) / ComposeFile).string());
-  std::vector<Json::Value> services = info.getServices();
+  const auto info{ComposeInfo::load((appRoot(app) / ComposeFile).string())};
+  const auto& services{info->services()};
   if (services.empty()) {
     throw std::runtime_error("No services found in App's compose file");
   }
 
   Json::Value containers;
   client_->getContainers(containers);
+  const auto container_states{client_->getContainerStates(containers)};
 
-  for (std::size_t i = 0; i < services.size(); i++) {
-    std::string service = services[i].asString();
-    std::string hash = info.getHash(services[i]);
-    const auto container_state{client_->getContainerState(containers, app.name, service, hash)};
-    if (std::get<0>(container_state) /* container exists */) {
+  for (const auto& compose_service : services) {
+    const std::string& service = compose_service.name;
+    const std::string& hash = compose_service.hash;
+    if (container_states.count(std::make_tuple(app.name, service, hash)) > 0 /* container exists */) {
       continue;
     }
     LOG_WARNING << "App: " << app.name << ", service: " << service << ", hash: " << hash << ", not running!";
@@ -379,7 +466,14 @@ void ComposeAppEngine::verifyAppArchive(const App& app, const std::string& archi
 
 void ComposeAppEngine::extractAppArchive(const App& app, const std::string& archive_file_name,
                                          bool delete_after_extraction) {
-  exec("tar -xzf " + archive_file_name, "failed to extract App archive", boost::process::start_dir = appRoot(app));
+  // the compression is told by the extension the archive is stored with, see Manifest::archiveExt()
+  std::string flags{"-xzf "};
+  if (boost::algorithm::ends_with(archive_file_name, Manifest::ZstdArchiveExt)) {
+    flags = "--zstd -xf ";
+  } else if (!AppArchive::parallelGunzip().empty()) {
+    flags = "-I \"" + AppArchive::parallelGunzip() + "\" -xf ";
+  }
+  exec("tar " + flags + archive_file_name, "failed to extract App archive", boost::process::start_dir = appRoot(app));
   if (delete_after_extraction) {
     exec("rm -f " + archive_file_name, "failed to delete App archive", boost::process::start_dir = appRoot(app));
   }
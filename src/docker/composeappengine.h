@@ -6,6 +6,7 @@
 #include <boost/filesystem.hpp>
 
 #include "appengine.h"
+#include "docker/composeverifycache.h"
 #include "docker/docker.h"
 #include "docker/dockerclient.h"
 
@@ -34,6 +35,14 @@ class ComposeAppEngine : public AppEngine {
   }
 
   static void pruneDockerStore(AppEngine::Client& client);
+  // Makes App images pulled one by one, by `compose pull <service>`, up to `concurrency` images at once, a failed
+  // pull is retried up to `retries` times after `PullRetryBackoffSec`, doubled with each retry. The App fetch fails
+  // with `ImagePullFailure` naming the image that has failed. By default all App images are pulled by a single
+  // sequential `compose pull`.
+  void setImagePull(int concurrency, int retries) {
+    pull_concurrency_ = concurrency;
+    pull_retries_ = retries;
+  }
 
  protected:
   virtual void pullImages(const App& app);
@@ -46,6 +55,7 @@ class ComposeAppEngine : public AppEngine {
   static constexpr const char* const MetaDir{".meta"};
   static constexpr const char* const VersionFile{".version"};
   static constexpr const char* const StateFile{".state"};
+  static const int PullRetryBackoffSec{5};
 
   class AppState {
    public:
@@ -121,10 +131,16 @@ class ComposeAppEngine : public AppEngine {
   static bool checkAvailableStorageSpace(const boost::filesystem::path& app_root, uint64_t& out_available_size);
   void verifyAppArchive(const App& app, const std::string& archive_file_name);
   void extractAppArchive(const App& app, const std::string& archive_file_name, bool delete_after_extraction = true);
+  // Runs `compose config` unless the App version has been verified by the same compose version already
+  void verifyComposeApp(const App& app, const std::string& err_msg);
 
   const boost::filesystem::path root_;
   AppEngine::Client::Ptr client_;
   Docker::RegistryClient::Ptr registry_client_;
+  // keyed by the App manifest digest, which pins the App archive digest
+  ComposeVerifyCache verify_cache_{compose_, root_ / ".compose-verify-cache.json"};
+  int pull_concurrency_{1};
+  int pull_retries_{0};
 };
 
 }  // namespace Docker
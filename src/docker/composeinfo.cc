@@ -1,11 +1,57 @@
 #include "composeinfo.h"
 #include <glib.h>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "crypto/crypto.h"
 #include "logging/logging.h"
+#include "utilities/utils.h"
 #include "yaml2json.h"
 
 namespace Docker {
 
-ComposeInfo::ComposeInfo(const std::string& yaml) : json_(yaml) {}
+ComposeInfo::ComposeInfo(const std::string& yaml) : ComposeInfo(Yaml2Json(yaml)) {}
+
+ComposeInfo::ComposeInfo(Yaml2Json json) : json_(std::move(json)) {
+  for (const auto& service : getServices()) {
+    services_.push_back({service.asString(), getImage(service), getHash(service)});
+  }
+}
+
+ComposeInfo::Ptr ComposeInfo::load(const std::string& yaml) {
+  if (!boost::filesystem::exists(yaml)) {
+    throw std::runtime_error("Compose file does not exist: " + yaml);
+  }
+  return loadContent(Utils::readFile(yaml));
+}
+
+ComposeInfo::Ptr ComposeInfo::loadContent(const std::string& content) {
+  static std::mutex cache_mutex;
+  // compose file content hash -> parsed compose file, the oldest entries are at the front of the list
+  static std::unordered_map<std::string, Ptr> cache;
+  static std::list<std::string> cache_order;
+
+  const auto content_hash{Crypto::sha256digest(content)};
+  {
+    std::lock_guard<std::mutex> lock{cache_mutex};
+    const auto found_it{cache.find(content_hash)};
+    if (found_it != cache.end()) {
+      return found_it->second;
+    }
+  }
+
+  Ptr compose{std::make_shared<const ComposeInfo>(Yaml2Json::fromString(content))};
+
+  std::lock_guard<std::mutex> lock{cache_mutex};
+  if (cache.emplace(content_hash, compose).second) {
+    cache_order.push_back(content_hash);
+    if (cache_order.size() > MaxCacheSize) {
+      cache.erase(cache_order.front());
+      cache_order.pop_front();
+    }
+  }
+  return compose;
+}
 
 std::vector<Json::Value> ComposeInfo::getServices() const {
   Json::Value p = json_.root_["services"];
@@ -2,6 +2,7 @@
 #define AKTUALIZR_LITE_COMPOSE_INFO_H
 
 #include <json/json.h>
+#include <memory>
 #include <string>
 #include <vector>
 #include "yaml2json.h"
@@ -10,13 +11,37 @@ namespace Docker {
 
 class ComposeInfo {
  public:
+  using Ptr = std::shared_ptr<const ComposeInfo>;
+
+  struct Service {
+    std::string name;
+    std::string image;
+    // the `io.compose-spec.config-hash` label value
+    std::string hash;
+  };
+
+  // Max number of parsed compose files kept in the cache
+  static const std::size_t MaxCacheSize{64};
+
   explicit ComposeInfo(const std::string& yaml);
+  explicit ComposeInfo(Yaml2Json json);
+
+  // Returns a parsed compose file, the parsed files are cached by their content hash so each distinct
+  // compose file, i.e. each App version, is parsed just once per process lifetime. Thread-safe.
+  static Ptr load(const std::string& yaml);
+  // The same as load() but takes the compose file content, e.g. read from an App archive
+  static Ptr loadContent(const std::string& content);
+
   std::vector<Json::Value> getServices() const;
   std::string getImage(const Json::Value& service) const;
   std::string getHash(const Json::Value& service) const;
+  const std::vector<Service>& services() const { return services_; }
+  // the whole compose file content
+  const Json::Value& json() const { return json_.root_; }
 
  private:
   Yaml2Json json_;
+  std::vector<Service> services_;
 };
 
 }  // namespace Docker
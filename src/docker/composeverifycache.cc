@@ -0,0 +1,94 @@
+#include "composeverifycache.h"
+
+#include <algorithm>
+#include <future>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include "exec.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+const std::size_t ComposeVerifyCache::MaxEntries;
+
+ComposeVerifyCache::ComposeVerifyCache(std::string compose_cmd, boost::filesystem::path file)
+    : compose_cmd_{std::move(compose_cmd)}, file_{std::move(file)} {
+  load();
+}
+
+bool ComposeVerifyCache::isVerified(const std::string& digest) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto key{getKey(digest)};
+  return key && std::find(entries_.begin(), entries_.end(), *key) != entries_.end();
+}
+
+void ComposeVerifyCache::setVerified(const std::string& digest) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto key{getKey(digest)};
+  if (!key || std::find(entries_.begin(), entries_.end(), *key) != entries_.end()) {
+    return;
+  }
+  entries_.emplace_back(*key);
+  while (entries_.size() > MaxEntries) {
+    entries_.pop_front();
+  }
+  store();
+}
+
+boost::optional<std::string> ComposeVerifyCache::getKey(const std::string& digest) const {
+  if (!compose_version_) {
+    try {
+      std::future<std::string> output;
+      exec(compose_cmd_ + " version --short", "failed to get the compose version",
+           boost::process::std_out > output);
+      compose_version_ = boost::algorithm::trim_copy(output.get());
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "The compose verification results are not cached: " << exc.what();
+      compose_version_ = std::string();
+    }
+  }
+  if (compose_version_->empty()) {
+    return boost::none;
+  }
+  return digest + "@" + *compose_version_;
+}
+
+void ComposeVerifyCache::store() const {
+  if (file_.empty()) {
+    return;
+  }
+  Json::Value entries{Json::arrayValue};
+  for (const auto& entry : entries_) {
+    entries.append(entry);
+  }
+  try {
+    // write to a temporary file and move it to the cache file so the cache file is never half-written
+    const boost::filesystem::path tmp_file{file_.string() + ".tmp"};
+    Utils::writeFile(tmp_file, Utils::jsonToCanonicalStr(entries));
+    boost::filesystem::rename(tmp_file, file_);
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to store the compose verification cache " << file_ << ": " << exc.what();
+  }
+}
+
+void ComposeVerifyCache::load() {
+  if (file_.empty() || !boost::filesystem::exists(file_)) {
+    return;
+  }
+  try {
+    const auto entries{Utils::parseJSONFile(file_)};
+    if (!entries.isArray()) {
+      throw std::invalid_argument("unexpected format");
+    }
+    for (const auto& entry : entries) {
+      entries_.emplace_back(entry.asString());
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to load the compose verification cache " << file_ << ", it is dropped: " << exc.what();
+    entries_.clear();
+  }
+}
+
+}  // namespace Docker
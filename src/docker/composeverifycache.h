@@ -0,0 +1,49 @@
+#ifndef AKTUALIZR_LITE_COMPOSE_VERIFY_CACHE_H_
+#define AKTUALIZR_LITE_COMPOSE_VERIFY_CACHE_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+namespace Docker {
+
+/**
+ * @brief ComposeVerifyCache, a persistent record of the App versions which compose project has passed
+ * `compose config`.
+ *
+ * An entry is keyed by the digest of the App content, e.g. the App archive digest, and the version of the compose
+ * binary that has verified the content, so an App version is verified just once per compose version and the
+ * subsequent checks are lookups. The compose version is queried once per cache instance, on the first lookup,
+ * and nothing is cached if it cannot be figured out. Only the latest `MaxEntries` entries are kept.
+ * All methods are thread-safe.
+ */
+class ComposeVerifyCache {
+ public:
+  static const std::size_t MaxEntries{128};
+
+  // The cache is not persisted if the file path is empty
+  explicit ComposeVerifyCache(std::string compose_cmd, boost::filesystem::path file = "");
+
+  bool isVerified(const std::string& digest) const;
+  void setVerified(const std::string& digest);
+
+ private:
+  // The key of the given digest, none if the compose version is unknown
+  boost::optional<std::string> getKey(const std::string& digest) const;
+  void load();
+  void store() const;
+
+  const std::string compose_cmd_;
+  const boost::filesystem::path file_;
+  mutable std::mutex mutex_;
+  mutable boost::optional<std::string> compose_version_;
+  // the keys, the oldest first
+  std::deque<std::string> entries_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_COMPOSE_VERIFY_CACHE_H_
@@ -0,0 +1,110 @@
+#include "contentindex.h"
+
+#include <sys/stat.h>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+ContentIndex::ContentIndex(boost::filesystem::path file) : file_{std::move(file)} { load(); }
+
+bool ContentIndex::isVerified(const boost::filesystem::path& path, const std::string& hash) const {
+  FileStat stat{};
+  if (!getFileStat(path, stat)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto entry_it{entries_.find(path.string())};
+  return entry_it != entries_.end() && entry_it->second.hash == hash && entry_it->second.stat == stat;
+}
+
+void ContentIndex::setVerified(const boost::filesystem::path& path, const std::string& hash) {
+  FileStat stat{};
+  if (!getFileStat(path, stat)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  entries_[path.string()] = {hash, stat};
+  dirty_ = true;
+}
+
+void ContentIndex::flush() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (!dirty_ || file_.empty()) {
+    return;
+  }
+
+  Json::Value index;
+  for (const auto& entry : entries_) {
+    Json::Value& value{index[entry.first]};
+    value["hash"] = entry.second.hash;
+    value["size"] = static_cast<Json::UInt64>(entry.second.stat.size);
+    value["mtime"] = static_cast<Json::Int64>(entry.second.stat.mtime_ns);
+    value["inode"] = static_cast<Json::UInt64>(entry.second.stat.inode);
+  }
+
+  try {
+    // write to a temporary file and move it to the index file so the index file is never half-written
+    const boost::filesystem::path tmp_file{file_.string() + ".tmp"};
+    Utils::writeFile(tmp_file, Utils::jsonToCanonicalStr(index));
+    boost::filesystem::rename(tmp_file, file_);
+    dirty_ = false;
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to store the content index " << file_ << ": " << exc.what();
+  }
+}
+
+void ContentIndex::prune() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    for (auto entry_it = entries_.begin(); entry_it != entries_.end();) {
+      if (!boost::filesystem::exists(entry_it->first)) {
+        entry_it = entries_.erase(entry_it);
+        dirty_ = true;
+      } else {
+        ++entry_it;
+      }
+    }
+  }
+  flush();
+}
+
+bool ContentIndex::getFileStat(const boost::filesystem::path& path, FileStat& stat) {
+  struct stat st {};
+  if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return false;
+  }
+  stat.size = static_cast<uint64_t>(st.st_size);
+  stat.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  stat.inode = static_cast<uint64_t>(st.st_ino);
+  return true;
+}
+
+void ContentIndex::load() {
+  if (file_.empty() || !boost::filesystem::exists(file_)) {
+    return;
+  }
+  try {
+    const auto index{Utils::parseJSONFile(file_)};
+    if (!index.isObject()) {
+      LOG_WARNING << "Invalid content index " << file_ << ", it will be rebuilt";
+      return;
+    }
+    for (Json::ValueConstIterator it = index.begin(); it != index.end(); ++it) {
+      const auto& value{*it};
+      if (!value.isObject() || !value["hash"].isString() || !value["size"].isUInt64() ||
+          !value["mtime"].isInt64() || !value["inode"].isUInt64()) {
+        continue;
+      }
+      entries_[it.key().asString()] = {
+          value["hash"].asString(),
+          {value["size"].asUInt64(), value["mtime"].asInt64(), value["inode"].asUInt64()}};
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to load the content index " << file_ << ", it will be rebuilt: " << exc.what();
+    entries_.clear();
+  }
+}
+
+}  // namespace Docker
@@ -0,0 +1,60 @@
+#ifndef AKTUALIZR_LITE_CONTENT_INDEX_H_
+#define AKTUALIZR_LITE_CONTENT_INDEX_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief ContentIndex, a persistent index of files which content has been verified, i.e. its hash matches
+ * the expected one.
+ *
+ * A file is considered verified as long as its size, modification time and inode are the same as they were at the
+ * moment of its verification, so the file content doesn't need to be re-read and re-hashed on each check.
+ * The index is just a cache, it is rebuilt from scratch if its file is missing or corrupted, so it is enough
+ * to replace the file atomically to keep it consistent. All methods are thread-safe.
+ */
+class ContentIndex {
+ public:
+  // The index is not persisted if the file path is empty
+  explicit ContentIndex(boost::filesystem::path file = "");
+
+  bool isVerified(const boost::filesystem::path& path, const std::string& hash) const;
+  void setVerified(const boost::filesystem::path& path, const std::string& hash);
+  // Stores the index if it has been changed since the last flush
+  void flush();
+  // Drops entries of files that do not exist anymore
+  void prune();
+
+ private:
+  struct FileStat {
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t inode;
+
+    bool operator==(const FileStat& other) const {
+      return size == other.size && mtime_ns == other.mtime_ns && inode == other.inode;
+    }
+  };
+  struct Entry {
+    std::string hash;
+    FileStat stat;
+  };
+
+  static bool getFileStat(const boost::filesystem::path& path, FileStat& stat);
+  void load();
+
+  const boost::filesystem::path file_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  bool dirty_{false};
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_CONTENT_INDEX_H_
@@ -1,5 +1,11 @@
 #include "docker.h"
-#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
@@ -14,16 +20,16 @@
 namespace Docker {
 
 Uri Uri::parseUri(const std::string& uri, bool factory_app) {
+  // <registryHostname>/<name>@<digest>, <name> == [<factory>/]<app>
+  // The URI is parsed by the positions of its elements, so each member is built straight from it.
   // check whether uri is pinned
-  auto split_pos = uri.find('@');
+  const auto split_pos = uri.find('@');
   if (split_pos == std::string::npos) {
     throw std::invalid_argument("Invalid URI: digest/'@' not found in " + uri);
   }
 
-  auto digest = uri.substr(split_pos + 1);
-
   // find start of <name> (aka path) position
-  auto name_pos_start = uri.find('/', 0);
+  const auto name_pos_start = uri.find('/', 0);
   if (name_pos_start == std::string::npos) {
     throw std::invalid_argument("Invalid URI: image name/path is not found in " + uri);
   }
@@ -32,43 +38,123 @@ Uri Uri::parseUri(const std::string& uri, bool factory_app) {
     throw std::invalid_argument("Invalid URI: image name/path is not present before digest; uri: " + uri);
   }
 
-  auto registry_hostname = uri.substr(0, name_pos_start);
-  auto name = uri.substr(name_pos_start + 1, split_pos - name_pos_start - 1);
-
-  auto app_pos_start = name.rfind('/');
-  std::string factory;
-  if (app_pos_start != std::string::npos) {
-    factory = name.substr(0, app_pos_start);
-  } else {
-    app_pos_start = -1;
-  }
-  auto app = name.substr(app_pos_start + 1, name.size() - app_pos_start - 1);
-
-  if (factory_app && (factory.empty() || factory.find('/') != std::string::npos)) {
+  const auto name_pos = name_pos_start + 1;
+  const auto app_sep_pos = uri.rfind('/', split_pos - 1);
+  // the separator found is the one which ends the hostname if the name consists of a single element
+  const bool has_factory{app_sep_pos != name_pos_start};
+  if (factory_app && (!has_factory || app_sep_pos == name_pos || uri.find('/', name_pos) != app_sep_pos)) {
     throw std::invalid_argument("Invalid URI: invalid name format of a factory image, must be <factory>/<repo>; uri: " +
                                 uri);
   }
 
-  return Uri{HashedDigest{digest}, app, factory, name, registry_hostname};
+  return Uri{HashedDigest{uri.substr(split_pos + 1)}, uri.substr(app_sep_pos + 1, split_pos - app_sep_pos - 1),
+             has_factory ? uri.substr(name_pos, app_sep_pos - name_pos) : std::string(),
+             uri.substr(name_pos, split_pos - name_pos), uri.substr(0, name_pos_start)};
 }
 
-Uri Uri::createUri(const HashedDigest& digest_in) const {
-  return Uri{HashedDigest{digest_in}, app, factory, repo, registryHostname};
-}
+Uri Uri::createUri(const HashedDigest& digest_in) const { return Uri{digest_in, app, factory, repo, registryHostname}; }
 
 const std::string HashedDigest::Type{"sha256:"};
 
-HashedDigest::HashedDigest(const std::string& hash_digest) : digest_{boost::algorithm::to_lower_copy(hash_digest)} {
-  if (Type != digest_.substr(0, Type.length())) {
+HashedDigest::HashedDigest(const std::string& hash_digest) : digest_{hash_digest} {
+  if (digest_.size() < Type.size() || !std::equal(Type.begin(), Type.end(), digest_.begin(), [](char type_c, char c) {
+        return type_c == std::tolower(static_cast<unsigned char>(c));
+      })) {
     throw std::invalid_argument("Unsupported hash type: " + hash_digest);
   }
-
-  hash_ = digest_.substr(Type.length());
-  if (64 != hash_.size()) {
+  if (2 * HashSize != digest_.size() - Type.size()) {
     throw std::invalid_argument("Invalid hash size: " + hash_digest);
   }
 
-  short_hash_ = hash_.substr(0, 7);
+  // lower the case and decode the hash in a single pass. A non-hex char is not rejected here, such a hash just
+  // doesn't match any content, so its binary form is only good for hashing, and the comparison falls back to the text.
+  const auto nibble = [](char& c) {
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (c >= '0' && c <= '9') {
+      return static_cast<uint8_t>(c - '0');
+    }
+    if (c >= 'a' && c <= 'f') {
+      return static_cast<uint8_t>(c - 'a' + 10);
+    }
+    return static_cast<uint8_t>(c & 0x0f);
+  };
+  std::copy(Type.begin(), Type.end(), digest_.begin());
+  for (std::size_t ii = 0; ii < HashSize; ++ii) {
+    auto* const hex{&digest_[Type.size() + 2 * ii]};
+    binary_[ii] = static_cast<uint8_t>(nibble(hex[0]) << 4 | nibble(hex[1]));
+  }
+  hash_ = digest_.substr(Type.size());
+}
+
+static HashedDigest getDescriptorDigest(const Json::Value& value) {
+  if (!value.isObject() || !value["digest"].isString()) {
+    throw std::invalid_argument("Invalid descriptor, missing or incorrect `digest` field: " +
+                                Utils::jsonToCanonicalStr(value));
+  }
+  return HashedDigest{value["digest"].asString()};
+}
+
+Descriptor::Descriptor(const Json::Value& value)
+    : mediaType{value.get("mediaType", "").asString()},
+      digest{getDescriptorDigest(value)},
+      // According to the spec the `size` field must be int64
+      size{value["size"].isInt64() ? value["size"].asInt64() : -1},
+      architecture{value["platform"]["architecture"].asString()},
+      os{value["platform"]["os"].asString()} {
+  if (size < 0) {
+    throw std::invalid_argument("Invalid descriptor, missing or incorrect `size` field: " +
+                                Utils::jsonToCanonicalStr(value));
+  }
+}
+
+bool Descriptor::isZstdMediaType(const std::string& media_type) {
+  return boost::algorithm::ends_with(media_type, "+zstd") || boost::algorithm::ends_with(media_type, ".zstd");
+}
+
+Manifest::Manifest(const Json::Value& value) {
+  auto manifest_version{value["annotations"]["compose-app"].asString()};
+  if (manifest_version.empty()) {
+    throw std::runtime_error("Got invalid App manifest, missing a manifest version: " +
+                             Utils::jsonToCanonicalStr(value));
+  }
+  if (Version != manifest_version) {
+    throw std::runtime_error("Got unsupported App manifest version: " + Utils::jsonToCanonicalStr(value));
+  }
+
+  archive_digest_ = value["layers"][0]["digest"].asString();
+  if (archive_digest_.empty()) {
+    throw std::runtime_error("Got invalid App manifest, failed to extract App Archive digest from App manifest: " +
+                             Utils::jsonToCanonicalStr(value));
+  }
+  const uint64_t arch_size{value["layers"][0]["size"].asUInt64()};
+  if (0 == arch_size || arch_size > std::numeric_limits<size_t>::max()) {
+    throw std::runtime_error("Invalid size of App Archive is specified in App manifest: " +
+                             Utils::jsonToCanonicalStr(value));
+  }
+  archive_size_ = arch_size;
+  zstd_archive_ = Descriptor::isZstdMediaType(value["layers"][0]["mediaType"].asString());
+
+  const auto& manifests{value["manifests"]};
+  has_layers_manifests_ = manifests.isArray();
+  if (has_layers_manifests_) {
+    for (const auto& layers_manifest : manifests) {
+      layers_manifests_.emplace_back(layers_manifest);
+    }
+  }
+}
+
+boost::optional<Descriptor> Manifest::layersManifest(const std::string& arch) const {
+  if (!has_layers_manifests_) {
+    LOG_WARNING << "App manifest doesn't include layers manifests";
+    return boost::none;
+  }
+  for (const auto& layers_manifest : layers_manifests_) {
+    if (arch == layers_manifest.architecture) {
+      return layers_manifest;
+    }
+  }
+  LOG_WARNING << "App manifest doesn't include a layers manifest of a given architecture: " << arch;
+  return boost::none;
 }
 
 const RegistryClient::HttpClientFactory RegistryClient::DefaultHttpClientFactory =
@@ -79,6 +165,7 @@ const RegistryClient::HttpClientFactory RegistryClient::DefaultHttpClientFactory
 const std::string RegistryClient::ManifestEndpoint{"/manifests/"};
 const std::string RegistryClient::BlobEndpoint{"/blobs/"};
 const std::string RegistryClient::SupportedRegistryVersion{"/v2/"};
+const std::string RegistryClient::PartFileExt{".part"};
 
 const std::string RegistryClient::BearerAuth::Header{"www-authenticate"};
 const std::string RegistryClient::BearerAuth::AuthType{"bearer"};
@@ -149,13 +236,46 @@ RegistryClient::BearerAuth::BearerAuth(const std::string& auth_header_value) {
 }
 
 RegistryClient::RegistryClient(std::shared_ptr<HttpInterface> ota_lite_client, std::string auth_creds_endpoint,
-                               HttpClientFactory http_client_factory)
+                               HttpClientFactory http_client_factory, boost::filesystem::path manifest_cache_dir,
+                               RateLimiter::Ptr rate_limiter)
     : auth_creds_endpoint_{std::move(auth_creds_endpoint)},
       ota_lite_client_{std::move(ota_lite_client)},
-      http_client_factory_{std::move(http_client_factory)} {}
+      http_client_factory_{std::move(http_client_factory)},
+      manifest_cache_dir_{std::move(manifest_cache_dir)},
+      rate_limiter_{std::move(rate_limiter)} {}
 
 std::string RegistryClient::getAppManifest(const Uri& uri, const std::string& format,
                                            boost::optional<std::int64_t> manifest_size) const {
+  const auto cached_manifest{getCachedManifest(uri, manifest_size)};
+  if (!!cached_manifest) {
+    LOG_DEBUG << "Got App manifest from the cache: " << uri.digest();
+    return *cached_manifest;
+  }
+
+  std::string manifest;
+  // the manifest requests are small, so their duration is a fair measure of the mirror latency
+  sendToMirrors(
+      uri, [&](const Uri& src_uri) { manifest = fetchAppManifest(src_uri, format, manifest_size); }, true);
+  cacheManifest(uri, manifest);
+  return manifest;
+}
+
+void RegistryClient::sendToMirrors(const Uri& uri, const std::function<void(const Uri&)>& request,
+                                   bool track_latency) const {
+  if (!mirrors_) {
+    request(uri);
+    return;
+  }
+  mirrors_->send(
+      uri.registryHostname,
+      [&](const std::string& host) {
+        request(host == uri.registryHostname ? uri : Uri{uri.digest, uri.app, uri.factory, uri.repo, host});
+      },
+      track_latency);
+}
+
+std::string RegistryClient::fetchAppManifest(const Uri& uri, const std::string& format,
+                                             boost::optional<std::int64_t> manifest_size) const {
   const std::string manifest_url{composeManifestUrl(uri)};
   LOG_DEBUG << "Downloading App manifest: " << manifest_url;
 
@@ -167,17 +287,21 @@ std::string RegistryClient::getAppManifest(const Uri& uri, const std::string& fo
     manifest_max_size = *manifest_size;
   }
   std::function<HttpResponse()> doGetManifestRequest = [&]() {
-    auto registry_repo_client{http_client_factory_(&registry_repo_request_headers, &header_to_get)};
+    auto registry_repo_client{getHttpClient(uri.registryHostname, &registry_repo_request_headers, &header_to_get)};
     return registry_repo_client->get(manifest_url, manifest_max_size);
   };
 
+  const auto cached_auth_header{getCachedAuthHeader(uri)};
+  if (!!cached_auth_header) {
+    registry_repo_request_headers.push_back(*cached_auth_header);
+  }
+
   auto manifest_resp = doGetManifestRequest();
   if (manifest_resp.http_status_code == 401) {
-    if (manifest_resp.headers.empty() || manifest_resp.headers.count(BearerAuth::Header) == 0) {
-      throw std::runtime_error("No `" + BearerAuth::Header + "` header found in the 401 response");
+    if (!!cached_auth_header) {
+      registry_repo_request_headers.pop_back();
     }
-    auto auth_header{getBearerAuthHeader(BearerAuth(manifest_resp.headers[BearerAuth::Header]))};
-    registry_repo_request_headers.push_back(auth_header);
+    registry_repo_request_headers.push_back(authorize(uri, manifest_resp, !!cached_auth_header));
     manifest_resp = doGetManifestRequest();
   }
 
@@ -211,44 +335,210 @@ std::string RegistryClient::getAppManifest(const Uri& uri, const std::string& fo
   return manifest_resp.body;
 }
 
+boost::optional<std::string> RegistryClient::getCachedManifest(const Uri& uri,
+                                                               boost::optional<std::int64_t> manifest_size) const {
+  if (manifest_cache_dir_.empty()) {
+    return boost::none;
+  }
+  const auto manifest_file{manifest_cache_dir_ / uri.digest.hash()};
+  boost::system::error_code ec;
+  const auto file_size{boost::filesystem::file_size(manifest_file, ec)};
+  if (ec || file_size > static_cast<boost::uintmax_t>(!!manifest_size ? *manifest_size : DefManifestMaxSize)) {
+    return boost::none;
+  }
+
+  const auto manifest{Utils::readFile(manifest_file)};
+  // a manifest is immutable and identified by its digest, so it's always safe to use a cached one if the digest fits
+  if (boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(manifest))) != uri.digest.hash()) {
+    LOG_WARNING << "Removing invalid cached manifest: " << manifest_file;
+    boost::filesystem::remove(manifest_file, ec);
+    return boost::none;
+  }
+  return manifest;
+}
+
+void RegistryClient::cacheManifest(const Uri& uri, const std::string& manifest) const {
+  if (manifest_cache_dir_.empty()) {
+    return;
+  }
+  try {
+    // write and then rename so a concurrent reader never gets a partially written manifest
+    const auto manifest_file{manifest_cache_dir_ / uri.digest.hash()};
+    const auto tmp_file{manifest_cache_dir_ / boost::filesystem::unique_path("%%%%-%%%%.tmp")};
+    Utils::writeFile(tmp_file, manifest);
+    boost::filesystem::rename(tmp_file, manifest_file);
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to cache manifest " << uri.digest() << ": " << exc.what();
+  }
+}
+
+void RegistryClient::pruneManifestCache(const std::unordered_set<std::string>& hash_shortlist) const {
+  if (manifest_cache_dir_.empty() || !boost::filesystem::is_directory(manifest_cache_dir_)) {
+    return;
+  }
+  for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(manifest_cache_dir_), {})) {
+    if (hash_shortlist.count(entry.path().filename().string()) == 0) {
+      LOG_DEBUG << "Removing cached manifest: " << entry.path();
+      boost::system::error_code ec;
+      boost::filesystem::remove(entry.path(), ec);
+    }
+  }
+}
+
+// Writes a downloaded blob to a file. Received data are accumulated in a large buffer that is hashed and written to
+// the file by a single pwrite() once full, so there is no per-chunk write or stream seek overhead. The file space is
+// preallocated up to the expected blob size to avoid its fragmentation while the file grows.
+// If a rate limiter is set then the receiving is paused as long as it is needed to keep the download rate within
+// the limit, curl stops reading from the socket meanwhile so the sender is throttled by TCP flow control.
 struct DownloadCtx {
-  DownloadCtx(std::ostream& out_stream_in, MultiPartHasher& hasher_in, std::size_t expected_size_in)
-      : out_stream{out_stream_in}, hasher{hasher_in}, expected_size{expected_size_in} {}
+  static const std::size_t ReadBufferSize{64 * 1024};
+
+  DownloadCtx(boost::filesystem::path filepath_in, std::size_t expected_size_in, RateLimiter* rate_limiter_in,
+              DownloadProgressMeter* progress_meter_in, std::size_t write_buffer_size_in)
+      : filepath{std::move(filepath_in)},
+        expected_size{expected_size_in},
+        rate_limiter{rate_limiter_in},
+        progress_meter{progress_meter_in},
+        write_buffer_size{write_buffer_size_in} {}
+  ~DownloadCtx() {
+    try {
+      // make the received data available for resuming of the download
+      close();
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to store received data: " << exc.what();
+    }
+  }
+  DownloadCtx(const DownloadCtx&) = delete;
+  DownloadCtx& operator=(const DownloadCtx&) = delete;
+  DownloadCtx(DownloadCtx&&) = delete;
+  DownloadCtx& operator=(DownloadCtx&&) = delete;
 
-  std::ostream& out_stream;
-  MultiPartHasher& hasher;
+  boost::filesystem::path filepath;
   std::size_t expected_size;
+  RateLimiter* rate_limiter;
+  DownloadProgressMeter* progress_meter;
+  const std::size_t write_buffer_size;
+  int fd{-1};
+  std::vector<char> buffer;
+  MultiPartSHA256Hasher hasher;
 
+  // the amount of data stored in the file, and the amount of data received and stored in the file or the buffer
   std::size_t written_size{0};
   std::size_t received_size{0};
 
   std::size_t write(const char* data, std::size_t size) {
     assert(data);
 
-    received_size = written_size + size;
-    if (received_size > expected_size) {
-      LOG_ERROR << "!!! Received data size exceeds the expected size: " << received_size << " != " << expected_size;
+    if (received_size + size > expected_size) {
+      LOG_ERROR << "!!! Received data size exceeds the expected size: " << received_size + size
+                << " != " << expected_size;
       return (size + 1);  // returning value that is not equal to received data size will make curl fail
     }
 
-    if (!out_stream.good()) {
-      LOG_ERROR << "Output stream is at a bad state: " << out_stream.rdstate();
+    if (fd == -1) {
+      LOG_ERROR << "Output file is not opened: " << filepath;
       return (size + 1);  // returning value that is not equal to received data size will make curl fail
     }
 
-    auto start_pos = out_stream.tellp();
-    out_stream.write(data, size);
-    auto end_pos = out_stream.tellp();
+    if (rate_limiter != nullptr) {
+      rate_limiter->consume(size);
+    }
 
-    written_size += (end_pos - start_pos);
-    hasher.update(reinterpret_cast<const unsigned char*>(data), size);
-    return (end_pos - start_pos);
+    try {
+      if (buffer.size() + size > write_buffer_size) {
+        flush();
+      }
+      buffer.insert(buffer.end(), data, data + size);
+    } catch (const std::exception& exc) {
+      LOG_ERROR << "Failed to write received data: " << exc.what();
+      return (size + 1);  // returning value that is not equal to received data size will make curl fail
+    }
+    received_size += size;
+    progress_meter->update(received_size);
+    return size;
+  }
+
+  void flush() {
+    std::size_t flushed{0};
+    while (flushed < buffer.size()) {
+      const auto res{pwrite(fd, buffer.data() + flushed, buffer.size() - flushed,
+                            static_cast<off_t>(written_size + flushed))};
+      if (res < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Failed to write to a file: " + filepath.string() + ", err: " + std::strerror(errno));
+      }
+      flushed += static_cast<std::size_t>(res);
+    }
+    hasher.update(reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size());
+    written_size += buffer.size();
+    buffer.clear();
   }
-  void reset() {
-    out_stream.seekp(std::ios_base::beg);
+
+  // (Re)open the output file so the data received next are written at the given offset.
+  // The data already stored in the file before the offset are fed to the hasher, the rest is discarded.
+  // Returns the offset the download should be continued from.
+  std::size_t open(std::size_t offset) {
+    if (fd != -1) {
+      ::close(fd);
+      fd = -1;
+    }
+    buffer.clear();
     hasher.reset();
     written_size = 0;
     received_size = 0;
+
+    if (!boost::filesystem::exists(filepath)) {
+      offset = 0;
+    } else if (offset > expected_size) {
+      LOG_WARNING << "Size of the partially downloaded blob exceeds the expected size, starting from scratch: "
+                  << filepath;
+      offset = 0;
+    }
+
+    fd = ::open(filepath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+      throw std::runtime_error("Failed to open a file: " + filepath.string() + ", err: " + std::strerror(errno));
+    }
+    if (ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+      throw std::runtime_error("Failed to truncate a file: " + filepath.string() + ", err: " + std::strerror(errno));
+    }
+    // keep the file size unchanged since it denotes the amount of data received so far
+    if (expected_size > offset &&
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(expected_size - offset)) !=
+            0) {
+      LOG_DEBUG << "Failed to preallocate space for a blob: " << filepath << ", err: " << std::strerror(errno);
+    }
+
+    std::array<char, ReadBufferSize> buf{};
+    ssize_t read_size;
+    while (written_size < offset && (read_size = pread(fd, buf.data(), buf.size(), written_size)) > 0) {
+      hasher.update(reinterpret_cast<const unsigned char*>(buf.data()), static_cast<std::size_t>(read_size));
+      written_size += static_cast<std::size_t>(read_size);
+    }
+    if (written_size != offset) {
+      throw std::runtime_error("Failed to read the partially downloaded blob: " + filepath.string());
+    }
+    received_size = written_size;
+    buffer.reserve(write_buffer_size);
+    return offset;
+  }
+
+  void close() {
+    if (fd == -1) {
+      return;
+    }
+    // the fd is closed even if the buffered data can't be written out
+    try {
+      flush();
+    } catch (...) {
+      ::close(fd);
+      fd = -1;
+      throw;
+    }
+    ::close(fd);
+    fd = -1;
   }
 };
 
@@ -260,58 +550,108 @@ static size_t DownloadHandler(char* data, size_t buf_size, size_t buf_numb, void
 }
 
 void RegistryClient::downloadBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const {
-  auto compose_app_blob_url{composeBlobUrl(uri)};
+  // a partially downloaded blob is resumed from the Registry, the peers serve just complete blobs
+  if (peer_cache_ && !boost::filesystem::exists(filepath.string() + PartFileExt)) {
+    DownloadProgressMeter progress_meter{progress_cb_, DownloadProgress::Source::AppBlob,
+                                         uri.registryHostname + "/" + uri.repo + "@" + uri.digest(), expected_size};
+    progress_meter.start();
+    if (peer_cache_->fetchBlob(uri.digest.hash(), expected_size, filepath,
+                               [&progress_meter](uint64_t fetched) { progress_meter.update(fetched); })) {
+      progress_meter.complete();
+      return;
+    }
+  }
+  // the `.part` file left by a failed mirror is resumed from the next one, the blob is the same
+  sendToMirrors(uri, [&](const Uri& src_uri) { fetchBlob(src_uri, filepath, expected_size); });
+}
 
-  LOG_DEBUG << "Downloading App blob: " << compose_app_blob_url;
+void RegistryClient::fetchBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const {
+  auto compose_app_blob_url{composeBlobUrl(uri)};
 
-  std::ofstream output_file{filepath.string(), std::ios_base::out | std::ios_base::binary};
-  if (!output_file.is_open()) {
-    throw std::runtime_error("Failed to open a file: " + filepath.string());
+  // The blob is downloaded to the `.part` file which is moved to the destination file once the download completes.
+  // If the `.part` file is left after the previous download attempt then the download is resumed from its end.
+  const boost::filesystem::path part_filepath{filepath.string() + PartFileExt};
+  DownloadProgressMeter progress_meter{progress_cb_, DownloadProgress::Source::AppBlob,
+                                       uri.registryHostname + "/" + uri.repo + "@" + uri.digest(), expected_size};
+  DownloadCtx download_ctx{part_filepath, expected_size, rate_limiter_.get(), &progress_meter, write_buffer_size_};
+  std::size_t offset{download_ctx.open(
+      boost::filesystem::exists(part_filepath) ? boost::filesystem::file_size(part_filepath) : 0)};
+  progress_meter.start(offset);
+
+  if (offset > 0) {
+    LOG_INFO << "Resuming App blob download from " << offset << " of " << expected_size
+             << " bytes: " << compose_app_blob_url;
+  } else {
+    LOG_DEBUG << "Downloading App blob: " << compose_app_blob_url;
   }
-  MultiPartSHA256Hasher hasher;
-  DownloadCtx download_ctx{output_file, hasher, expected_size};
 
   const std::set<std::string> header_to_get{BearerAuth::Header};
   std::vector<std::string> registry_repo_request_headers;
+  const auto cached_auth_header{getCachedAuthHeader(uri)};
+  if (!!cached_auth_header) {
+    registry_repo_request_headers.push_back(*cached_auth_header);
+  }
   std::function<HttpResponse()> doDownloadBlobRequest = [&]() {
-    auto registry_repo_client{http_client_factory_(&registry_repo_request_headers, &header_to_get)};
-    return registry_repo_client->download(compose_app_blob_url, DownloadHandler, nullptr, &download_ctx, 0);
+    auto registry_repo_client{getHttpClient(uri.registryHostname, &registry_repo_request_headers, &header_to_get)};
+    return registry_repo_client->download(compose_app_blob_url, DownloadHandler, nullptr, &download_ctx,
+                                          static_cast<curl_off_t>(offset));
   };
 
-  auto get_blob_resp = doDownloadBlobRequest();
-  if (get_blob_resp.http_status_code == 401) {
-    if (get_blob_resp.headers.empty() || get_blob_resp.headers.count(BearerAuth::Header) == 0) {
-      throw std::runtime_error("No `" + BearerAuth::Header + "` header found in the 401 response");
+  // nothing to download if the previous attempt received all the data but failed to move the `.part` file
+  if (offset < expected_size) {
+    auto get_blob_resp = doDownloadBlobRequest();
+    if (get_blob_resp.http_status_code == 401) {
+      if (!!cached_auth_header) {
+        registry_repo_request_headers.pop_back();
+      }
+      registry_repo_request_headers.push_back(authorize(uri, get_blob_resp, !!cached_auth_header));
+      // drop the 401 response body if any
+      offset = download_ctx.open(offset);
+      get_blob_resp = doDownloadBlobRequest();
+    }
+    if (offset > 0 && get_blob_resp.http_status_code == 200) {
+      // the registry ignored the range request and sent the whole blob, start from scratch
+      LOG_WARNING << "Registry does not support resuming of blob downloads, downloading the whole blob: "
+                  << compose_app_blob_url;
+      offset = download_ctx.open(0);
+      progress_meter.start(offset);
+      get_blob_resp = doDownloadBlobRequest();
+    }
+    if (get_blob_resp.http_status_code != (offset > 0 ? 206 : 200)) {
+      // the received data is an error response body rather than a part of the blob, drop it so neither the next
+      // attempt nor a mirror resumes the download after it
+      download_ctx.open(offset);
+      throw std::runtime_error("Failed to download App blob: " + get_blob_resp.getStatusStr());
+    }
+    if (!get_blob_resp.isOk()) {
+      // the `.part` file is preserved so the next download attempt continues from where this one has stopped
+      throw std::runtime_error("Failed to download App blob: " + get_blob_resp.getStatusStr());
     }
-    auto auth_header{getBearerAuthHeader(BearerAuth(get_blob_resp.headers[BearerAuth::Header]))};
-    registry_repo_request_headers.push_back(auth_header);
-    download_ctx.reset();
-    get_blob_resp = doDownloadBlobRequest();
-  }
-  if (!get_blob_resp.isOk()) {
-    throw std::runtime_error("Failed to download App blob: " + get_blob_resp.getStatusStr());
   }
 
-  output_file.close();
+  download_ctx.close();
   std::size_t recv_blob_file_size{download_ctx.written_size};
 
   if (recv_blob_file_size != expected_size) {
-    std::remove(filepath.c_str());
+    std::remove(part_filepath.c_str());
     throw std::runtime_error(
         "Size of downloaded App blob does not equal to "
         "the expected one: " +
         std::to_string(recv_blob_file_size) + " != " + std::to_string(expected_size));
   }
 
-  auto recv_blob_hash{boost::algorithm::to_lower_copy(hasher.getHexDigest())};
+  auto recv_blob_hash{boost::algorithm::to_lower_copy(download_ctx.hasher.getHexDigest())};
 
   if (recv_blob_hash != uri.digest.hash()) {
-    std::remove(filepath.c_str());
+    std::remove(part_filepath.c_str());
     throw std::runtime_error(
         "Hash of downloaded App blob does not equal to "
         "the expected one: " +
         recv_blob_hash + " != " + uri.digest.hash());
   }
+
+  boost::filesystem::rename(part_filepath, filepath);
+  progress_meter.complete();
 }
 
 std::string RegistryClient::getBasicAuthHeader() const {
@@ -344,11 +684,14 @@ std::string RegistryClient::getBasicAuthHeader() const {
   return "authorization: basic " + encoded_auth_secret;
 }
 
-std::string RegistryClient::getBearerAuthHeader(const BearerAuth& bearer) const {
-  LOG_DEBUG << "Getting Docker Registry token from " << bearer.Realm;
+std::string RegistryClient::getBearerAuthHeader(const BearerAuth& bearer, bool anonymous) const {
+  LOG_DEBUG << "Getting Docker Registry " << (anonymous ? "anonymous " : "") << "token from " << bearer.Realm;
 
-  std::vector<std::string> auth_header = {getBasicAuthHeader()};
-  auto registry_client{http_client_factory_(&auth_header, nullptr)};
+  std::vector<std::string> basic_auth_header;
+  if (!anonymous) {
+    basic_auth_header.emplace_back(getBasicAuthHeader());
+  }
+  auto registry_client{getHttpClient(bearer.Realm, &basic_auth_header, nullptr)};
   auto token_resp = registry_client->get(bearer.uri(), AuthMaterialMaxSize);
 
   if (!token_resp.isOk()) {
@@ -356,13 +699,102 @@ std::string RegistryClient::getBearerAuthHeader(const BearerAuth& bearer) const
                              "; error: " + token_resp.getStatusStr());
   }
 
-  auto token = token_resp.getJson()["token"].asString();
+  const auto token_json{token_resp.getJson()};
+  auto token = token_json["token"].asString();
   if (token.empty()) {
     throw std::runtime_error("Got invalid token from Docker Registry: " + token_resp.body);
   }
 
   LOG_DEBUG << "Got Docker Registry token: " << token;
-  return "authorization: bearer " + token;
+  const std::string auth_header{"authorization: bearer " + token};
+
+  int expires_in{DefTokenExpiresInSec};
+  if (token_json.isMember("expires_in") && token_json["expires_in"].isInt()) {
+    expires_in = token_json["expires_in"].asInt();
+  }
+  if (expires_in > TokenExpiryMarginSec) {
+    std::lock_guard<std::mutex> lock{token_cache_mutex_};
+    token_cache_[tokenKey(bearer, anonymous)] =
+        Token{auth_header, std::chrono::steady_clock::now() + std::chrono::seconds(expires_in - TokenExpiryMarginSec)};
+  }
+  return auth_header;
+}
+
+boost::optional<std::string> RegistryClient::getCachedAuthHeader(const Uri& uri) const {
+  std::lock_guard<std::mutex> lock{token_cache_mutex_};
+  const auto repo_auth_it{repo_auth_.find(repoKey(uri))};
+  if (repo_auth_it == repo_auth_.end()) {
+    return boost::none;
+  }
+  const auto token_it{token_cache_.find(repo_auth_it->second)};
+  if (token_it == token_cache_.end()) {
+    return boost::none;
+  }
+  if (token_it->second.expires_at <= std::chrono::steady_clock::now()) {
+    token_cache_.erase(token_it);
+    return boost::none;
+  }
+  return token_it->second.auth_header;
+}
+
+std::string RegistryClient::authorize(const Uri& uri, const HttpResponse& unauth_resp, bool invalidate) const {
+  const auto auth_header_it{unauth_resp.headers.find(BearerAuth::Header)};
+  if (auth_header_it == unauth_resp.headers.end()) {
+    throw std::runtime_error("No `" + BearerAuth::Header + "` header found in the 401 response");
+  }
+  const BearerAuth bearer{auth_header_it->second};
+  // the credentials are of the registry, a mirror must not get them even if it refers to the registry token realm
+  const bool anonymous{!!mirrors_ && mirrors_->isMirror(uri.registryHostname)};
+  {
+    std::lock_guard<std::mutex> lock{token_cache_mutex_};
+    if (invalidate) {
+      LOG_DEBUG << "Cached Docker Registry token has been rejected, getting a new one";
+      token_cache_.erase(tokenKey(bearer, anonymous));
+      dropHttpClients(uri.registryHostname);
+    }
+    repo_auth_[repoKey(uri)] = tokenKey(bearer, anonymous);
+  }
+  return getBearerAuthHeader(bearer, anonymous);
+}
+
+std::shared_ptr<HttpInterface> RegistryClient::getHttpClient(const std::string& host,
+                                                             const std::vector<std::string>* headers,
+                                                             const std::set<std::string>* response_header_names) const {
+  std::string key{host};
+  if (headers != nullptr) {
+    key += "\n" + boost::algorithm::join(*headers, "\n");
+  }
+  if (response_header_names != nullptr) {
+    key += "\n" + boost::algorithm::join(*response_header_names, ",");
+  }
+
+  std::shared_ptr<HttpInterface> client;
+  {
+    std::lock_guard<std::mutex> lock{http_clients_mutex_};
+    const auto found_it{std::find_if(idle_http_clients_.begin(), idle_http_clients_.end(),
+                                     [&key](const IdleHttpClient& idle) { return idle.key == key; })};
+    if (found_it != idle_http_clients_.end()) {
+      client = found_it->client;
+      idle_http_clients_.erase(found_it);
+    }
+  }
+  if (!client) {
+    client = http_client_factory_(headers, response_header_names);
+  }
+
+  // put the client back to the idle pool once a caller is done with it
+  return std::shared_ptr<HttpInterface>(client.get(), [this, host, key, client](HttpInterface*) {
+    std::lock_guard<std::mutex> lock{http_clients_mutex_};
+    idle_http_clients_.push_front({host, key, client});
+    if (idle_http_clients_.size() > MaxIdleHttpClients) {
+      idle_http_clients_.pop_back();
+    }
+  });
+}
+
+void RegistryClient::dropHttpClients(const std::string& host) const {
+  std::lock_guard<std::mutex> lock{http_clients_mutex_};
+  idle_http_clients_.remove_if([&host](const IdleHttpClient& idle) { return idle.host == host; });
 }
 
 }  // namespace Docker
@@ -1,29 +1,60 @@
 #ifndef AKTUALIZR_LITE_DOCKER_H_
 #define AKTUALIZR_LITE_DOCKER_H_
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <limits>
+#include <list>
+#include <mutex>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <boost/optional.hpp>
 
 #include <http/httpinterface.h>
 
+#include "downloadpolicy.h"
+#include "downloadprogress.h"
+#include "peercache.h"
+#include "registrymirrors.h"
+
 namespace Docker {
 
 struct HashedDigest {
   static const std::string Type;
+  static const std::size_t HashSize{32};
+  using Binary = std::array<uint8_t, HashSize>;
+
+  // Hashes the digest by its binary form, e.g. for the digest keyed unordered containers
+  struct Hasher {
+    std::size_t operator()(const HashedDigest& digest) const {
+      std::size_t res;
+      std::memcpy(&res, digest.binary_.data(), sizeof(res));
+      return res;
+    }
+  };
 
   explicit HashedDigest(const std::string& hash_digest);
 
   const std::string& operator()() const { return digest_; }
   const std::string& hash() const { return hash_; }
-  const std::string& shortHash() const { return short_hash_; }
+  std::string shortHash() const { return hash_.substr(0, 7); }
+  const Binary& binary() const { return binary_; }
+
+  // the binary forms differ for almost any two different hashes, so the text is compared only if they are equal
+  bool operator==(const HashedDigest& other) const { return binary_ == other.binary_ && hash_ == other.hash_; }
+  bool operator!=(const HashedDigest& other) const { return !(*this == other); }
+  bool operator<(const HashedDigest& other) const { return hash_ < other.hash_; }
 
  private:
   std::string digest_;
   std::string hash_;
-  std::string short_hash_;
+  Binary binary_;
 };
 
 struct Uri {
@@ -42,61 +73,52 @@ struct Uri {
   const std::string registryHostname;
 };
 
-struct Manifest : Json::Value {
+// A content descriptor, https://github.com/opencontainers/image-spec/blob/main/descriptor.md
+struct Descriptor {
+  // Throws std::invalid_argument if the digest or the size is missing or invalid
+  explicit Descriptor(const Json::Value& value);
+
+  std::string mediaType;
+  HashedDigest digest;
+  std::int64_t size;
+  // the platform of an image index entry, empty if not specified
+  std::string architecture;
+  std::string os;
+
+  // Whether the content is zstd-compressed, e.g. `application/vnd.oci.image.layer.v1.tar+zstd`, otherwise it is
+  // either gzip-compressed or not compressed
+  bool isZstd() const { return isZstdMediaType(mediaType); }
+  static bool isZstdMediaType(const std::string& media_type);
+};
+
+// The App manifest, it is parsed and validated once, at the construction
+class Manifest {
+ public:
   static constexpr const char* const Format{"application/vnd.oci.image.manifest.v1+json"};
   static constexpr const char* const IndexFormat{"application/vnd.oci.image.index.v1+json"};
   static constexpr const char* const Version{"v1"};
   static constexpr const char* const ArchiveExt{".tgz"};
+  static constexpr const char* const ZstdArchiveExt{".tar.zst"};
   static constexpr const char* const Filename{"manifest.json"};
 
   explicit Manifest(const std::string& json_str) : Manifest(Utils::parseJSON(json_str)) {}
-  explicit Manifest(const Json::Value& value = Json::Value()) : Json::Value(value) {
-    auto manifest_version{(*this)["annotations"]["compose-app"].asString()};
-    if (manifest_version.empty()) {
-      throw std::runtime_error("Got invalid App manifest, missing a manifest version: " +
-                               Utils::jsonToCanonicalStr(value));
-    }
-    if (Version != manifest_version) {
-      throw std::runtime_error("Got unsupported App manifest version: " + Utils::jsonToCanonicalStr(value));
-    }
-  }
+  explicit Manifest(const Json::Value& value = Json::Value());
 
-  std::string archiveDigest() const {
-    auto digest{(*this)["layers"][0]["digest"].asString()};
-    if (digest.empty()) {
-      throw std::runtime_error("Got invalid App manifest, failed to extract App Archive digest from App manifest: " +
-                               Utils::jsonToCanonicalStr(*this));
-    }
-    return digest;
-  }
+  const std::string& archiveDigest() const { return archive_digest_; }
+  size_t archiveSize() const { return archive_size_; }
+  // The App archive is zstd-compressed if its media type says so, e.g. `application/vnd.oci.image.layer.v1.tar+zstd`
+  bool isZstdArchive() const { return zstd_archive_; }
+  // The extension of the stored App archive file, it follows the archive compression
+  const char* archiveExt() const { return zstd_archive_ ? ZstdArchiveExt : ArchiveExt; }
+  // The descriptor of the App layers manifest of the given architecture, none if the App manifest doesn't include it
+  boost::optional<Descriptor> layersManifest(const std::string& arch) const;
 
-  size_t archiveSize() const {
-    uint64_t arch_size{(*this)["layers"][0]["size"].asUInt64()};
-    if (0 == arch_size || arch_size > std::numeric_limits<size_t>::max()) {
-      throw std::runtime_error("Invalid size of App Archive is specified in App manifest: " +
-                               Utils::jsonToCanonicalStr(*this));
-    }
-
-    return arch_size;
-  }
-
-  Json::Value layersManifest(const std::string& arch) const {
-    const Json::Value manifests{(*this)["manifests"]};
-    if (!manifests.isArray()) {
-      LOG_WARNING << "App manifest doesn't include layers manifests";
-      return Json::Value();
-    }
-
-    for (Json::ValueConstIterator ii = manifests.begin(); ii != manifests.end(); ++ii) {
-      const auto man_arch{(*ii)["platform"]["architecture"].asString()};
-      if (arch == man_arch) {
-        return *ii;
-      }
-    }
-
-    LOG_WARNING << "App manifest doesn't include a layers manifest of a given architecture: " << arch;
-    return Json::Value();
-  }
+ private:
+  std::string archive_digest_;
+  size_t archive_size_;
+  bool zstd_archive_{false};
+  bool has_layers_manifests_{false};
+  std::vector<Descriptor> layers_manifests_;
 };
 
 class RegistryClient {
@@ -109,6 +131,17 @@ class RegistryClient {
   static const std::string ManifestEndpoint;
   static const std::string BlobEndpoint;
   static const std::string SupportedRegistryVersion;
+  static const std::string PartFileExt;
+  // The default token lifetime if a token response doesn't specify it, see
+  // https://github.com/distribution/distribution/blob/main/docs/spec/auth/token.md#token-response-fields
+  static const int DefTokenExpiresInSec{60};
+  // A token is considered expired a bit earlier than its actual expiration time to avoid 401 on its use
+  static const int TokenExpiryMarginSec{10};
+  // Max number of idle HTTP clients kept for reuse
+  static const std::size_t MaxIdleHttpClients{8};
+  // The amount of received blob data accumulated in memory before it is hashed and written to the file
+  static const std::size_t DefWriteBufferSize{1024 * 1024};
+  static const std::size_t LowMemWriteBufferSize{64 * 1024};
 
   struct BearerAuth {
     static const std::string Header;
@@ -127,17 +160,67 @@ class RegistryClient {
   static const HttpClientFactory DefaultHttpClientFactory;
   using Ptr = std::shared_ptr<RegistryClient>;
 
+  // If `manifest_cache_dir` is set then received manifests are stored in it by their digests,
+  // and getAppManifest() serves a manifest from the cache if it is there and its digest matches.
+  // If `rate_limiter` is set then the overall rate of blob downloads is limited by it.
   explicit RegistryClient(std::shared_ptr<HttpInterface> ota_lite_client,
                           std::string auth_creds_endpoint = DefAuthCredsEndpoint,
-                          HttpClientFactory http_client_factory = RegistryClient::DefaultHttpClientFactory);
+                          HttpClientFactory http_client_factory = RegistryClient::DefaultHttpClientFactory,
+                          boost::filesystem::path manifest_cache_dir = "", RateLimiter::Ptr rate_limiter = nullptr);
 
   std::string getAppManifest(const Uri& uri, const std::string& format,
                              boost::optional<std::int64_t> manifest_size = boost::none) const;
   void downloadBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const;
+  // Sets a callback receiving the progress of blob downloads, it must be set before any download starts
+  void setProgressCb(DownloadProgressCb cb) { progress_cb_ = std::move(cb); }
+  // Sets the LAN peer cache to try before the Registry on blob downloads, it must be set before any download starts
+  void setPeerCache(PeerCache::Ptr peer_cache) { peer_cache_ = std::move(peer_cache); }
+  // Sets the mirrors to request the manifests and blobs from before their registries, it must be set before any
+  // request is sent
+  void setMirrors(RegistryMirrors::Ptr mirrors) { mirrors_ = std::move(mirrors); }
+  // Sets the per-download write buffer size, a smaller one means more writes but less memory, it must be set before
+  // any download starts
+  void setWriteBufferSize(std::size_t size) { write_buffer_size_ = size; }
+  // Sends the request to the mirrors of the registry of the given URI and then to the registry itself until it
+  // succeeds, the request receives the URI with the registry hostname replaced by the mirror one
+  void sendToMirrors(const Uri& uri, const std::function<void(const Uri&)>& request, bool track_latency = false) const;
+  // Removes cached manifests except the ones which hashes are listed in the shortlist
+  void pruneManifestCache(const std::unordered_set<std::string>& hash_shortlist) const;
 
  private:
+  struct Token {
+    std::string auth_header;
+    std::chrono::steady_clock::time_point expires_at;
+  };
+
+  std::string fetchAppManifest(const Uri& uri, const std::string& format,
+                               boost::optional<std::int64_t> manifest_size) const;
+  void fetchBlob(const Uri& uri, const boost::filesystem::path& filepath, size_t expected_size) const;
+
   std::string getBasicAuthHeader() const;
-  std::string getBearerAuthHeader(const BearerAuth& bearer) const;
+  // The token is requested anonymously if `anonymous` is set, otherwise the registry credentials are sent along
+  std::string getBearerAuthHeader(const BearerAuth& bearer, bool anonymous) const;
+  // Returns an auth header with a not expired token obtained for the given repo before if any
+  boost::optional<std::string> getCachedAuthHeader(const Uri& uri) const;
+  // Gets a token for the given repo and caches it, a cached token is dropped if `invalidate` is set. The registry
+  // credentials are sent only to the token realm of the registry itself, a mirror gets an anonymous token.
+  std::string authorize(const Uri& uri, const HttpResponse& unauth_resp, bool invalidate) const;
+
+  static std::string repoKey(const Uri& uri) { return uri.registryHostname + "/" + uri.repo; }
+  static std::string tokenKey(const BearerAuth& bearer, bool anonymous) {
+    return (anonymous ? "anonymous:" : "") + bearer.uri();
+  }
+
+  boost::optional<std::string> getCachedManifest(const Uri& uri, boost::optional<std::int64_t> manifest_size) const;
+  void cacheManifest(const Uri& uri, const std::string& manifest) const;
+
+  // Returns an HTTP client for sending requests with the given headers to the given host. An idle client created
+  // for the same host and headers is reused if any, so are its established connections (TCP/TLS sessions) to the host.
+  // The client returns to the idle pool once the returned pointer is released, it must not outlive RegistryClient.
+  std::shared_ptr<HttpInterface> getHttpClient(const std::string& host, const std::vector<std::string>* headers,
+                                               const std::set<std::string>* response_header_names) const;
+  // Drops idle HTTP clients bound to the given host, e.g. if their auth header is not valid anymore
+  void dropHttpClients(const std::string& host) const;
 
   static std::string composeManifestUrl(const Uri& uri) {
     return "https://" + uri.registryHostname + SupportedRegistryVersion + uri.repo + ManifestEndpoint + uri.digest();
@@ -150,6 +233,27 @@ class RegistryClient {
   const std::string auth_creds_endpoint_;
   std::shared_ptr<HttpInterface> ota_lite_client_;
   HttpClientFactory http_client_factory_;
+  const boost::filesystem::path manifest_cache_dir_;
+  RateLimiter::Ptr rate_limiter_;
+  DownloadProgressCb progress_cb_;
+  PeerCache::Ptr peer_cache_;
+  RegistryMirrors::Ptr mirrors_;
+  std::size_t write_buffer_size_{DefWriteBufferSize};
+
+  mutable std::mutex token_cache_mutex_;
+  // <registry-hostname>/<repo> -> tokenKey() of Bearer auth params requested by Registry to access the repo
+  mutable std::unordered_map<std::string, std::string> repo_auth_;
+  // tokenKey(), i.e. (anonymous, realm, service, scope) -> token
+  mutable std::unordered_map<std::string, Token> token_cache_;
+
+  struct IdleHttpClient {
+    std::string host;
+    std::string key;
+    std::shared_ptr<HttpInterface> client;
+  };
+  mutable std::mutex http_clients_mutex_;
+  // the most recently used clients are at the front
+  mutable std::list<IdleHttpClient> idle_http_clients_;
 };
 
 }  // namespace Docker
@@ -1,4 +1,7 @@
 #include "dockerclient.h"
+#include <cctype>
+#include <chrono>
+#include <unordered_set>
 #include <boost/format.hpp>
 #include <boost/process.hpp>
 #include "http/httpclient.h"
@@ -7,6 +10,9 @@
 
 namespace Docker {
 
+const std::chrono::seconds DockerClient::HealthCacheTtl{30};
+const std::size_t DockerClient::DefMaxConnections;
+
 const DockerClient::HttpClientFactory DockerClient::DefaultHttpClientFactory = [](const std::string& docker_host_in) {
   std::string docker_host{docker_host_in};
   auto env{boost::this_process::environment()};
@@ -23,15 +29,167 @@ const DockerClient::HttpClientFactory DockerClient::DefaultHttpClientFactory = [
   return std::make_shared<HttpClient>(socket);
 };
 
-DockerClient::DockerClient(std::shared_ptr<HttpInterface> http_client)
-    : http_client_{std::move(http_client)},
-      engine_info_{getEngineInfo()},
-      arch_{engine_info_.get("Arch", Json::Value()).asString()} {}
+DockerClient::DockerClient(std::shared_ptr<HttpInterface> http_client) : max_connections_{1}, connection_numb_{1} {
+  idle_connections_.emplace_back(std::move(http_client));
+}
+
+DockerClient::DockerClient(std::string docker_host, std::size_t max_connections,
+                           HttpClientFactory http_client_factory)
+    : docker_host_{std::move(docker_host)},
+      max_connections_{std::max<std::size_t>(max_connections, 1)},
+      http_client_factory_{std::move(http_client_factory)} {}
+
+std::shared_ptr<HttpInterface> DockerClient::getConnection() const {
+  std::shared_ptr<HttpInterface> connection;
+  {
+    std::unique_lock<std::mutex> lock{connections_mutex_};
+    connections_cv_.wait(lock, [this]() { return !idle_connections_.empty() || connection_numb_ < max_connections_; });
+    if (!idle_connections_.empty()) {
+      // the most recently used connection is the most likely to be still open
+      connection = idle_connections_.back();
+      idle_connections_.pop_back();
+    } else {
+      ++connection_numb_;
+    }
+  }
+  if (!connection) {
+    try {
+      connection = http_client_factory_(docker_host_);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock{connections_mutex_};
+      --connection_numb_;
+      connections_cv_.notify_one();
+      throw;
+    }
+  }
+  return std::shared_ptr<HttpInterface>(connection.get(), [this, connection](HttpInterface*) {
+    {
+      std::lock_guard<std::mutex> lock{connections_mutex_};
+      idle_connections_.push_back(connection);
+    }
+    connections_cv_.notify_one();
+  });
+}
+
+const Json::Value& DockerClient::engineInfo() const {
+  std::lock_guard<std::mutex> lock{engine_info_mutex_};
+  if (!engine_info_) {
+    // not cached if the request fails, so it is retried on the next use
+    engine_info_ = getEngineInfo();
+    arch_ = engine_info_.get("Arch", Json::Value()).asString();
+  }
+  return engine_info_;
+}
+
+const std::string& DockerClient::arch() const {
+  engineInfo();
+  std::lock_guard<std::mutex> lock{engine_info_mutex_};
+  return arch_;
+}
+
+DockerClient::~DockerClient() {
+  if (events_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock{cache_mutex_};
+      stop_ = true;
+    }
+    stop_cv_.notify_all();
+    events_thread_.join();
+  }
+}
+
+void DockerClient::followEvents(std::shared_ptr<HttpInterface> events_http_client) {
+  if (events_thread_.joinable()) {
+    return;
+  }
+  events_http_client_ = std::move(events_http_client);
+  events_thread_ = std::thread(&DockerClient::readEvents, this);
+}
 
 void DockerClient::getContainers(Json::Value& root) {
+  uint64_t seq{0};
+  {
+    std::lock_guard<std::mutex> lock{cache_mutex_};
+    if (events_connected_ && cache_valid_ && cache_seq_ == events_seq_) {
+      root = containers_cache_;
+      return;
+    }
+    seq = events_seq_;
+  }
+  listContainers(root);
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  if (events_connected_) {
+    // an event received while listing makes the listing stale straight away
+    containers_cache_ = root;
+    cache_seq_ = seq;
+    cache_valid_ = true;
+  }
+}
+
+void DockerClient::readEvents() {
+  // curl --unix-socket /var/run/docker.sock http://localhost/events?since=<time>&filters={"type":["container"]}
+  static const std::string filters{"%7B%22type%22%3A%5B%22container%22%5D%7D"};
+  while (!stop_) {
+    // the events happened between the stream (re)connection and the last listing are replayed
+    const auto since{std::chrono::duration_cast<std::chrono::seconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count() -
+                     1};
+    {
+      std::lock_guard<std::mutex> lock{cache_mutex_};
+      events_connected_ = true;
+      cache_valid_ = false;
+      // the events might have been missed while disconnected
+      ++events_seq_;
+    }
+    const auto resp{events_http_client_->download(
+        "http://localhost/events?since=" + std::to_string(since) + "&filters=" + filters, EventsHandler,
+        EventsProgressHandler, this, 0)};
+    if (!stop_) {
+      LOG_DEBUG << "Docker events stream has been disconnected: " << resp.error_message;
+    }
+
+    std::unique_lock<std::mutex> lock{cache_mutex_};
+    events_connected_ = false;
+    cache_valid_ = false;
+    containers_cache_ = Json::Value();
+    // reconnect, the dockerd closes an idle stream or it might have been restarted
+    stop_cv_.wait_for(lock, std::chrono::seconds(1), [this]() { return !!stop_; });
+  }
+}
+
+bool DockerClient::getEventsSeq(uint64_t& seq) {
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  seq = events_seq_;
+  return events_connected_;
+}
+
+void DockerClient::onEvent() {
+  std::lock_guard<std::mutex> lock{cache_mutex_};
+  ++events_seq_;
+}
+
+size_t DockerClient::EventsHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+  (void)data;
+  // each chunk is one or more container events, whatever they are the container listing is stale
+  reinterpret_cast<DockerClient*>(user_ctx)->onEvent();
+  return buf_size * buf_numb;
+}
+
+int DockerClient::EventsProgressHandler(void* user_ctx, curl_off_t dl_total, curl_off_t dl_now, curl_off_t ul_total,
+                                        curl_off_t ul_now) {
+  (void)dl_total;
+  (void)dl_now;
+  (void)ul_total;
+  (void)ul_now;
+  // a non-zero value aborts the stream
+  return reinterpret_cast<DockerClient*>(user_ctx)->stop_ ? 1 : 0;
+}
+
+void DockerClient::listContainers(Json::Value& root) {
   // curl --unix-socket /var/run/docker.sock http://localhost/containers/json?all=1
   const std::string cmd{"http://localhost/containers/json?all=1"};
-  auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
+  auto resp = getConnection()->get(cmd, HttpInterface::kNoLimit);
   if (resp.isOk()) {
     root = resp.getJson();
   }
@@ -46,11 +204,11 @@ std::tuple<bool, std::string> DockerClient::getContainerState(const Json::Value&
                                                               const std::string& service,
                                                               const std::string& hash) const {
   for (Json::ValueConstIterator ii = root.begin(); ii != root.end(); ++ii) {
-    Json::Value val = *ii;
-    if (val["Labels"]["com.docker.compose.project"].asString() == app) {
-      if (val["Labels"]["com.docker.compose.service"].asString() == service) {
-        if (val["Labels"]["io.compose-spec.config-hash"].asString() == hash) {
-          return {true, val["State"].asString()};
+    const Json::Value& labels{(*ii)["Labels"]};
+    if (labels["com.docker.compose.project"].asString() == app) {
+      if (labels["com.docker.compose.service"].asString() == service) {
+        if (labels["io.compose-spec.config-hash"].asString() == hash) {
+          return {true, (*ii)["State"].asString()};
         }
       }
     }
@@ -58,9 +216,25 @@ std::tuple<bool, std::string> DockerClient::getContainerState(const Json::Value&
   return {false, ""};
 }
 
+AppEngine::Client::ContainerStates DockerClient::getContainerStates(const Json::Value& root) const {
+  ContainerStates states;
+  for (Json::ValueConstIterator ii = root.begin(); ii != root.end(); ++ii) {
+    const Json::Value& labels{(*ii)["Labels"]};
+    const std::string app{labels["com.docker.compose.project"].asString()};
+    if (app.empty()) {
+      // not a compose App container
+      continue;
+    }
+    states.emplace(std::make_tuple(app, labels["com.docker.compose.service"].asString(),
+                                   labels["io.compose-spec.config-hash"].asString()),
+                   (*ii)["State"].asString());
+  }
+  return states;
+}
+
 Json::Value DockerClient::getContainerInfo(const std::string& id) {
   const std::string cmd{"http://localhost/containers/" + id + "/json"};
-  auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
+  auto resp = getConnection()->get(cmd, HttpInterface::kNoLimit);
   if (!resp.isOk()) {
     throw std::runtime_error("Request to dockerd has failed: " + cmd);
   }
@@ -69,7 +243,7 @@ Json::Value DockerClient::getContainerInfo(const std::string& id) {
 
 std::string DockerClient::getContainerLogs(const std::string& id, int tail) {
   const std::string cmd{"http://localhost/containers/" + id + "/logs?stderr=1&tail=" + std::to_string(tail)};
-  auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
+  auto resp = getConnection()->get(cmd, HttpInterface::kNoLimit);
   if (!resp.isOk()) {
     throw std::runtime_error("Request to dockerd has failed: " + cmd);
   }
@@ -81,37 +255,92 @@ Json::Value DockerClient::getRunningApps(const std::function<void(const std::str
   Json::Value containers;
   getContainers(containers);
 
-  for (Json::ValueIterator ii = containers.begin(); ii != containers.end(); ++ii) {
-    Json::Value val = *ii;
+  std::lock_guard<std::mutex> lock{health_cache_mutex_};
+  const auto now{std::chrono::steady_clock::now()};
+  std::unordered_map<std::string, ContainerHealth> health_cache;
+
+  // The container health is re-used as long as the container stays in the same state, e.g. `running (healthy)` or
+  // `exited (1)`, and the result of its inspection is not older than the TTL. The logs are fetched only when the
+  // container turns unhealthy or changes its state being unhealthy.
+  // The containers are inspected concurrently first, and then the logs of the unhealthy ones are fetched.
+  // container ID -> whether the container health check status or exit code is inspected, and the inspection result
+  std::unordered_map<std::string, std::pair<bool, std::future<Json::Value>>> inspections;
+  std::unordered_set<std::string> updated;
+  for (Json::ValueConstIterator ii = containers.begin(); ii != containers.end(); ++ii) {
+    const Json::Value& val{*ii};
+    if (val["Labels"]["com.docker.compose.project"].asString().empty()) {
+      continue;
+    }
+    const std::string id{val["Id"].asString()};
+    const std::string state{val["State"].asString()};
+    const std::string status{val["Status"].asString()};
+    const std::string transition{state + getStatusDetails(status)};
+    const auto cached{health_cache_.find(id)};
+    if (cached != health_cache_.end() && cached->second.transition == transition &&
+        now - cached->second.inspected < HealthCacheTtl) {
+      health_cache.emplace(id, cached->second);
+      continue;
+    }
+
+    ContainerHealth health;
+    health.transition = transition;
+    health.inspected = now;
+    // (created|restarting|running|removing|paused|exited|dead)
+    health.health = (state == "dead") ? "unhealthy" : "healthy";
+    const bool health_check{status.find("health") != std::string::npos};
+    if (health_check || state == "exited") {
+      inspections.emplace(id, std::make_pair(health_check, getContainerInfoAsync(id)));
+    }
+    health_cache.emplace(id, std::move(health));
+    updated.emplace(id);
+  }
+
+  std::unordered_map<std::string, std::future<std::string>> logs;
+  for (auto& inspection : inspections) {
+    const auto info{inspection.second.second.get()};
+    auto& health{health_cache.at(inspection.first)};
+    if (inspection.second.first) {
+      health.health = info["State"]["Health"]["Status"].asString();
+    } else if (info["State"]["ExitCode"].asInt() != 0) {
+      health.health = "unhealthy";
+    }
+  }
+  for (const auto& id : updated) {
+    auto& health{health_cache.at(id)};
+    if (health.health == "healthy") {
+      continue;
+    }
+    const auto cached{health_cache_.find(id)};
+    if (cached != health_cache_.end() && cached->second.transition == health.transition &&
+        cached->second.health == health.health) {
+      health.logs = cached->second.logs;
+    } else {
+      logs.emplace(id, getContainerLogsAsync(id, 5));
+    }
+  }
+  for (auto& log : logs) {
+    health_cache.at(log.first).logs = log.second.get();
+  }
+
+  for (Json::ValueConstIterator ii = containers.begin(); ii != containers.end(); ++ii) {
+    const Json::Value& val{*ii};
 
     std::string app_name = val["Labels"]["com.docker.compose.project"].asString();
     if (app_name.empty()) {
       continue;
     }
 
-    std::string state = val["State"].asString();
-    std::string status = val["Status"].asString();
-
     Json::Value service_attributes;
     service_attributes["name"] = val["Labels"]["com.docker.compose.service"].asString();
     service_attributes["hash"] = val["Labels"]["io.compose-spec.config-hash"].asString();
     service_attributes["image"] = val["Image"].asString();
-    service_attributes["state"] = state;
-    service_attributes["status"] = status;
+    service_attributes["state"] = val["State"].asString();
+    service_attributes["status"] = val["Status"].asString();
 
-    // (created|restarting|running|removing|paused|exited|dead)
-    service_attributes["health"] = "healthy";
-    if (status.find("health") != std::string::npos) {
-      service_attributes["health"] = getContainerInfo(val["Id"].asString())["State"]["Health"]["Status"].asString();
-    } else {
-      if (state == "dead" ||
-          (state == "exited" && getContainerInfo(val["Id"].asString())["State"]["ExitCode"].asInt() != 0)) {
-        service_attributes["health"] = "unhealthy";
-      }
-    }
-
-    if (service_attributes["health"] != "healthy") {
-      service_attributes["logs"] = getContainerLogs(val["Id"].asString(), 5);
+    const auto& health{health_cache.at(val["Id"].asString())};
+    service_attributes["health"] = health.health;
+    if (health.health != "healthy") {
+      service_attributes["logs"] = health.logs;
     }
 
     apps[app_name]["services"].append(service_attributes);
@@ -120,9 +349,153 @@ Json::Value DockerClient::getRunningApps(const std::function<void(const std::str
       ext_func(app_name, apps[app_name]);
     }
   }
+  // the containers which are not listed anymore are dropped from the cache
+  health_cache_ = std::move(health_cache);
   return apps;
 }
 
+std::string DockerClient::getStatusDetails(const std::string& status) {
+  // e.g. `Up 2 hours (healthy)` -> `(healthy)`, `Exited (1) 5 minutes ago` -> `(1)`
+  const auto begin{status.find('(')};
+  if (begin == std::string::npos) {
+    return "";
+  }
+  const auto end{status.find(')', begin)};
+  return status.substr(begin, end == std::string::npos ? std::string::npos : end - begin + 1);
+}
+
+std::launch DockerClient::asyncPolicy() const {
+  // nothing to send concurrently over a single connection, so the request is sent by the future's `get()`
+  return max_connections_ > 1 ? std::launch::async : std::launch::deferred;
+}
+
+std::future<Json::Value> DockerClient::getContainersAsync() {
+  return std::async(asyncPolicy(), [this]() {
+    Json::Value containers;
+    getContainers(containers);
+    return containers;
+  });
+}
+
+std::future<Json::Value> DockerClient::getContainerInfoAsync(const std::string& id) {
+  return std::async(asyncPolicy(), [this, id]() { return getContainerInfo(id); });
+}
+
+std::future<std::string> DockerClient::getContainerLogsAsync(const std::string& id, int tail) {
+  return std::async(asyncPolicy(), [this, id, tail]() { return getContainerLogs(id, tail); });
+}
+
+std::string DockerClient::createContainer(const std::string& name, const Json::Value& config) {
+  const std::string cmd{"http://localhost/containers/create?name=" + name};
+  auto resp = getConnection()->post(cmd, config);
+  if (!resp.isOk()) {
+    throw std::runtime_error("Failed to create container " + name + ": " + resp.getStatusStr() + " " + resp.body);
+  }
+  const auto id{resp.getJson()["Id"].asString()};
+  if (id.empty()) {
+    throw std::runtime_error("Failed to create container " + name + ", no container ID in the response");
+  }
+  return id;
+}
+
+void DockerClient::startContainer(const std::string& id) {
+  // 304 - the container is already started
+  const std::string cmd{"http://localhost/containers/" + id + "/start"};
+  auto resp = getConnection()->post(cmd, Json::nullValue);
+  if (!resp.isOk()) {
+    throw std::runtime_error("Failed to start container " + id + ": " + resp.getStatusStr() + " " + resp.body);
+  }
+}
+
+void DockerClient::stopContainer(const std::string& id) {
+  // 304 - the container is already stopped
+  const std::string cmd{"http://localhost/containers/" + id + "/stop"};
+  auto resp = getConnection()->post(cmd, Json::nullValue);
+  if (!resp.isOk()) {
+    throw std::runtime_error("Failed to stop container " + id + ": " + resp.getStatusStr() + " " + resp.body);
+  }
+}
+
+void DockerClient::renameContainer(const std::string& id, const std::string& name) {
+  const std::string cmd{"http://localhost/containers/" + id + "/rename?name=" + name};
+  auto resp = getConnection()->post(cmd, Json::nullValue);
+  if (!resp.isOk()) {
+    throw std::runtime_error("Failed to rename container " + id + " to " + name + ": " + resp.getStatusStr() + " " +
+                             resp.body);
+  }
+}
+
+void DockerClient::removeContainers(const std::vector<std::string>& labels) {
+  // the client has no means to send DELETE requests, so the stopped containers are removed by prune
+  const std::string cmd{"http://localhost/containers/prune?filters=" + getLabelFilters(labels)};
+  auto resp = getConnection()->post(cmd, Json::nullValue);
+  if (!resp.isOk()) {
+    throw std::runtime_error("Failed to remove containers: " + resp.getStatusStr());
+  }
+}
+
+void DockerClient::createNetwork(const std::string& name, const Json::Value& labels) {
+  Json::Value config;
+  config["Name"] = name;
+  config["CheckDuplicate"] = true;
+  config["Labels"] = labels;
+  auto resp = getConnection()->post("http://localhost/networks/create", config);
+  if (!resp.isOk()) {
+    throw std::runtime_error("Failed to create network " + name + ": " + resp.getStatusStr() + " " + resp.body);
+  }
+}
+
+bool DockerClient::isNetworkPresent(const std::string& name) {
+  const std::string cmd{"http://localhost/networks/" + name};
+  auto resp = getConnection()->get(cmd, HttpInterface::kNoLimit);
+  if (resp.http_status_code == 404) {
+    return false;
+  }
+  if (!resp.isOk()) {
+    throw std::runtime_error("Request to dockerd has failed: " + cmd);
+  }
+  return true;
+}
+
+void DockerClient::removeNetworks(const std::vector<std::string>& labels) {
+  const std::string cmd{"http://localhost/networks/prune?filters=" + getLabelFilters(labels)};
+  auto resp = getConnection()->post(cmd, Json::nullValue);
+  if (!resp.isOk()) {
+    throw std::runtime_error("Failed to remove networks: " + resp.getStatusStr());
+  }
+}
+
+bool DockerClient::isImagePresent(const std::string& image) {
+  const std::string cmd{"http://localhost/images/" + image + "/json"};
+  auto resp = getConnection()->get(cmd, HttpInterface::kNoLimit);
+  if (resp.http_status_code == 404) {
+    return false;
+  }
+  if (!resp.isOk()) {
+    throw std::runtime_error("Request to dockerd has failed: " + cmd);
+  }
+  return true;
+}
+
+std::string DockerClient::getLabelFilters(const std::vector<std::string>& labels) {
+  // filters={"label":["<label>=<value>",...]}, URL-encoded
+  Json::Value filters;
+  filters["label"] = Json::Value(Json::arrayValue);
+  for (const auto& label : labels) {
+    filters["label"].append(label);
+  }
+  const std::string str{Utils::jsonToCanonicalStr(filters)};
+  std::string encoded;
+  for (const unsigned char c : str) {
+    if (std::isalnum(c) != 0 || c == '-' || c == '_' || c == '.' || c == '~') {
+      encoded += static_cast<char>(c);
+    } else {
+      encoded += (boost::format("%%%02X") % static_cast<int>(c)).str();
+    }
+  }
+  return encoded;
+}
+
 void DockerClient::pruneImages() {
   // curl -G -X POST --unix-socket <sock> "http://localhost/images/prune" --data-urlencode
   // 'filters={"dangling":{"false":true},"label!":{"aktualizr-no-prune":true}}'
@@ -131,7 +504,7 @@ void DockerClient::pruneImages() {
       "http://localhost/images/"
       "prune?filters=%7B%22dangling%22%3A%7B%22false%22%3Atrue%7D%2C%22label%21%22%3A%7B%22aktualizr-no-prune%22%"
       "3Atrue%7D%7D"};
-  auto resp = http_client_->post(cmd, Json::nullValue);
+  auto resp = getConnection()->post(cmd, Json::nullValue);
   if (!resp.isOk()) {
     throw std::runtime_error("Failed to prune unused images: " + resp.getStatusStr());
   }
@@ -142,16 +515,16 @@ void DockerClient::pruneContainers() {
   // filters=%7B%22label%21%22%3A%7B%22aktualizr-no-prune%22%3Atrue%7D%7D
   const std::string cmd{
       "http://localhost/containers/prune?filters=%7B%22label%21%22%3A%7B%22aktualizr-no-prune%22%3Atrue%7D%7D"};
-  auto resp = http_client_->post(cmd, Json::nullValue);
+  auto resp = getConnection()->post(cmd, Json::nullValue);
   if (!resp.isOk()) {
     throw std::runtime_error("Failed to prune unused containers: " + resp.getStatusStr());
   }
 }
 
-Json::Value DockerClient::getEngineInfo() {
+Json::Value DockerClient::getEngineInfo() const {
   Json::Value info;
   const std::string cmd{"http://localhost/version"};
-  auto resp = http_client_->get(cmd, HttpInterface::kNoLimit);
+  auto resp = getConnection()->get(cmd, HttpInterface::kNoLimit);
   if (resp.isOk()) {
     info = resp.getJson();
   }
@@ -1,8 +1,18 @@
 #ifndef AKTUALIZR_LITE_DOCKER_CLIENT_H
 #define AKTUALIZR_LITE_DOCKER_CLIENT_H
 #include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <future>
+#include <list>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "appengine.h"
 #include "http/httpinterface.h"
@@ -14,27 +24,114 @@ class DockerClient : public AppEngine::Client {
   using Ptr = std::shared_ptr<DockerClient>;
   using HttpClientFactory = std::function<std::shared_ptr<HttpInterface>(const std::string& docker_host)>;
   static const HttpClientFactory DefaultHttpClientFactory;
+  // for how long the health of a container which state has not changed is re-used by `getRunningApps()`
+  static const std::chrono::seconds HealthCacheTtl;
 
+  // default max number of connections to the docker daemon used at once by the concurrent requests
+  static const std::size_t DefMaxConnections{4};
+
+  // Sends all requests over the given client, one at a time
   explicit DockerClient(
       std::shared_ptr<HttpInterface> http_client = DefaultHttpClientFactory("unix:///var/run/docker.sock"));
+  // Sends requests over up to `max_connections` persistent connections at once, opened on demand by the factory.
+  // Neither of the constructors sends any request, the engine info is requested on its first use.
+  DockerClient(std::string docker_host, std::size_t max_connections,
+               HttpClientFactory http_client_factory = DefaultHttpClientFactory);
+  ~DockerClient() override;
+  DockerClient(const DockerClient&) = delete;
+  DockerClient& operator=(const DockerClient&) = delete;
+  DockerClient(DockerClient&&) = delete;
+  DockerClient& operator=(DockerClient&&) = delete;
+
+  // Makes the client keep the last container listing in memory and follow the docker events stream, received over
+  // the given client, so the listing is requested again only after a container event. The containers are listed on
+  // each query as long as the events stream is not connected.
+  void followEvents(std::shared_ptr<HttpInterface> events_http_client);
+  // Returns false if the events stream is not connected, otherwise sets the number of the container events received
+  // so far, the number changes on each event and reconnection
+  bool getEventsSeq(uint64_t& seq);
 
   void getContainers(Json::Value& root) override;
   std::tuple<bool, std::string> getContainerState(const Json::Value& root, const std::string& app,
                                                   const std::string& service, const std::string& hash) const override;
+  ContainerStates getContainerStates(const Json::Value& root) const override;
   std::string getContainerLogs(const std::string& id, int tail) override;
-  const Json::Value& engineInfo() const override { return engine_info_; }
-  const std::string& arch() const override { return arch_; }
+  const Json::Value& engineInfo() const override;
+  const std::string& arch() const override;
   Json::Value getRunningApps(const std::function<void(const std::string&, Json::Value&)>& ext_func) override;
   void pruneImages() override;
   void pruneContainers() override;
 
+  // The requests are sent concurrently with each other and with the synchronous ones, as long as there are
+  // connections available. A client with a single connection sends the request once the result is requested.
+  std::future<Json::Value> getContainersAsync();
+  std::future<Json::Value> getContainerInfoAsync(const std::string& id);
+  std::future<std::string> getContainerLogsAsync(const std::string& id, int tail);
+
+  // Docker Engine API calls to manage containers with, the label filters are `<label>=<value>` strings which
+  // are all to match
+  std::string createContainer(const std::string& name, const Json::Value& config);
+  void startContainer(const std::string& id);
+  void stopContainer(const std::string& id);
+  void renameContainer(const std::string& id, const std::string& name);
+  // Removes the stopped containers which match all the given labels
+  void removeContainers(const std::vector<std::string>& labels);
+  void createNetwork(const std::string& name, const Json::Value& labels);
+  bool isNetworkPresent(const std::string& name);
+  // Removes the unused networks which match all the given labels
+  void removeNetworks(const std::vector<std::string>& labels);
+  bool isImagePresent(const std::string& image);
+
  private:
-  Json::Value getEngineInfo();
+  // Returns a connection to the daemon, waits for an idle one if the max number of connections is in use. The
+  // connection returns to the idle ones once the returned pointer is released.
+  std::shared_ptr<HttpInterface> getConnection() const;
+  std::launch asyncPolicy() const;
+  Json::Value getEngineInfo() const;
   Json::Value getContainerInfo(const std::string& id);
+  void listContainers(Json::Value& root);
+  void readEvents();
+  void onEvent();
+  static std::string getLabelFilters(const std::vector<std::string>& labels);
+  // Returns the part of a container status that changes along with the container state only
+  static std::string getStatusDetails(const std::string& status);
+
+  static size_t EventsHandler(char* data, size_t buf_size, size_t buf_numb, void* user_ctx);
+  static int EventsProgressHandler(void* user_ctx, curl_off_t dl_total, curl_off_t dl_now, curl_off_t ul_total,
+                                   curl_off_t ul_now);
+
+  const std::string docker_host_;
+  const std::size_t max_connections_;
+  HttpClientFactory http_client_factory_;
+  mutable std::mutex connections_mutex_;
+  mutable std::condition_variable connections_cv_;
+  mutable std::list<std::shared_ptr<HttpInterface>> idle_connections_;
+  mutable std::size_t connection_numb_{0};
+
+  mutable std::mutex engine_info_mutex_;
+  mutable Json::Value engine_info_;
+  mutable std::string arch_;
+
+  // the container listing cache, valid while the events stream is connected and no event has come since the listing
+  std::shared_ptr<HttpInterface> events_http_client_;
+  std::thread events_thread_;
+  std::mutex cache_mutex_;
+  std::condition_variable stop_cv_;
+  std::atomic_bool stop_{false};
+  bool events_connected_{false};
+  uint64_t events_seq_{0};
+  uint64_t cache_seq_{0};
+  bool cache_valid_{false};
+  Json::Value containers_cache_;
 
-  std::shared_ptr<HttpInterface> http_client_;
-  const Json::Value engine_info_;
-  const std::string arch_;
+  struct ContainerHealth {
+    std::string transition;
+    std::chrono::steady_clock::time_point inspected;
+    std::string health;
+    std::string logs;
+  };
+  std::mutex health_cache_mutex_;
+  std::unordered_map<std::string, ContainerHealth> health_cache_;
 };
 
 }  // namespace Docker
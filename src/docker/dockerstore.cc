@@ -0,0 +1,496 @@
+#include "dockerstore.h"
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <zlib.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/optional.hpp>
+#include <boost/process.hpp>
+
+#include "apparchive.h"
+#include "crypto/crypto.h"
+#include "docker/docker.h"
+#include "docker/ocimanifest.h"
+#include "exec.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+static const std::string WhiteoutPrefix{".wh."};
+static const std::string OpaqueWhiteout{".wh..wh..opq"};
+
+namespace {
+
+const std::size_t TarBlockSize{512};
+
+// CRC-64 of the ISO polynomial, the same as Go's hash/crc64 one, tar-split identifies the file contents by it
+uint64_t crc64Update(uint64_t crc, const char* data, std::size_t size) {
+  static const auto table = []() {
+    std::array<uint64_t, 256> t{};
+    for (uint64_t ii = 0; ii < t.size(); ++ii) {
+      uint64_t c{ii};
+      for (int bit = 0; bit < 8; ++bit) {
+        c = (c & 1U) != 0 ? (c >> 1U) ^ 0xD800000000000000ULL : c >> 1U;
+      }
+      t[ii] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (std::size_t ii = 0; ii < size; ++ii) {
+    crc = table[static_cast<uint8_t>(crc) ^ static_cast<uint8_t>(data[ii])] ^ (crc >> 8U);
+  }
+  return ~crc;
+}
+
+// Parses a numeric tar header field, either octal or, if its high bit is set, the GNU base-256 one
+uint64_t parseTarNumber(const char* field, std::size_t size) {
+  uint64_t value{0};
+  if ((static_cast<uint8_t>(field[0]) & 0x80U) != 0) {
+    value = static_cast<uint8_t>(field[0]) & 0x7FU;
+    for (std::size_t ii = 1; ii < size; ++ii) {
+      value = (value << 8U) | static_cast<uint8_t>(field[ii]);
+    }
+    return value;
+  }
+  std::size_t ii{0};
+  while (ii < size && field[ii] == ' ') {
+    ++ii;
+  }
+  for (; ii < size && field[ii] >= '0' && field[ii] <= '7'; ++ii) {
+    value = (value << 3U) | static_cast<uint64_t>(field[ii] - '0');
+  }
+  return value;
+}
+
+std::string getTarString(const char* field, std::size_t size) { return std::string(field, strnlen(field, size)); }
+
+// Writes the entries of a tar-split file, i.e. gzipped JSON lines, see github.com/vbatts/tar-split
+class TarSplitWriter {
+ public:
+  explicit TarSplitWriter(const boost::filesystem::path& path) : file_{gzopen(path.c_str(), "wb")} {
+    if (file_ == nullptr) {
+      throw std::runtime_error("Failed to open " + path.string() + " for writing");
+    }
+  }
+  ~TarSplitWriter() {
+    if (file_ != nullptr) {
+      gzclose(file_);
+    }
+  }
+  TarSplitWriter(const TarSplitWriter&) = delete;
+  TarSplitWriter& operator=(const TarSplitWriter&) = delete;
+  TarSplitWriter(TarSplitWriter&&) = delete;
+  TarSplitWriter& operator=(TarSplitWriter&&) = delete;
+
+  // the raw tar stream bytes, i.e. the headers, the padding and the end of the archive
+  void addSegment(const std::string& data) {
+    if (data.empty()) {
+      return;
+    }
+    Json::Value entry;
+    entry["type"] = SegmentType;
+    entry["payload"] = Utils::toBase64(data);
+    add(entry);
+  }
+
+  // the file content, which is read from the layer dir on the tar stream reassembly
+  void addFile(const std::string& name, uint64_t size, uint64_t crc) {
+    Json::Value entry;
+    entry["type"] = FileType;
+    entry["name"] = name;
+    entry["payload"] = Json::nullValue;
+    if (size > 0) {
+      entry["size"] = Json::UInt64(size);
+      std::string checksum(sizeof(crc), '\0');
+      for (std::size_t ii = 0; ii < sizeof(crc); ++ii) {
+        checksum[ii] = static_cast<char>((crc >> (8U * (sizeof(crc) - 1 - ii))) & 0xFFU);
+      }
+      entry["payload"] = Utils::toBase64(checksum);
+    }
+    add(entry);
+  }
+
+  void close() {
+    const auto res{gzclose(file_)};
+    file_ = nullptr;
+    if (res != Z_OK) {
+      throw std::runtime_error("Failed to write a tar-split file: " + std::to_string(res));
+    }
+  }
+
+ private:
+  static const int FileType{1};
+  static const int SegmentType{2};
+
+  void add(Json::Value& entry) {
+    entry["position"] = position_++;
+    const auto line{Utils::jsonToCanonicalStr(entry) + "\n"};
+    if (gzwrite(file_, line.data(), static_cast<unsigned>(line.size())) != static_cast<int>(line.size())) {
+      throw std::runtime_error("Failed to write a tar-split entry");
+    }
+  }
+
+  gzFile file_;
+  int position_{0};
+};
+
+// Splits the tar stream read by the given function into the tar-split entries. The content of the regular files is
+// replaced by their checksums, all the other bytes are stored as they are, so the stream is reassembled byte for byte.
+void splitTar(const std::function<std::size_t(char*, std::size_t)>& read, TarSplitWriter& writer) {
+  const auto read_full = [&read](char* buf, std::size_t size) {
+    std::size_t total{0};
+    while (total < size) {
+      const auto received{read(buf + total, size - total)};
+      if (received == 0) {
+        break;
+      }
+      total += received;
+    }
+    return total;
+  };
+  std::array<char, 64 * 1024> buf{};
+  // reads the given number of bytes, appends them to the raw bytes if given and updates the checksum if given
+  const auto consume = [&](uint64_t size, std::string* raw, uint64_t* crc) {
+    while (size > 0) {
+      const auto chunk{read_full(buf.data(), static_cast<std::size_t>(std::min<uint64_t>(size, buf.size())))};
+      if (chunk == 0) {
+        throw std::runtime_error("Unexpected end of a layer tar stream");
+      }
+      if (raw != nullptr) {
+        raw->append(buf.data(), chunk);
+      }
+      if (crc != nullptr) {
+        *crc = crc64Update(*crc, buf.data(), chunk);
+      }
+      size -= chunk;
+    }
+  };
+  const auto padded = [](uint64_t size) { return (size + TarBlockSize - 1) / TarBlockSize * TarBlockSize; };
+
+  std::string raw;
+  std::string long_name;
+  std::string pax_path;
+  boost::optional<uint64_t> pax_size;
+  std::array<char, TarBlockSize> header{};
+  while (true) {
+    const auto header_size{read_full(header.data(), header.size())};
+    raw.append(header.data(), header_size);
+    if (header_size < header.size() ||
+        std::all_of(header.begin(), header.end(), [](char c) { return c == '\0'; })) {
+      // the end of the archive, it and whatever follows are stored as they are
+      break;
+    }
+    const char type{header[156]};
+    uint64_t size{parseTarNumber(&header[124], 12)};
+    if (type == 'x' || type == 'L') {
+      // the extended header of the next entry
+      std::string content;
+      consume(padded(size), &content, nullptr);
+      raw += content;
+      content.resize(static_cast<std::size_t>(size));
+      if (type == 'L') {
+        long_name = content.c_str();
+        continue;
+      }
+      // the PAX records, `<length> <key>=<value>\n`
+      std::size_t pos{0};
+      while (pos < content.size()) {
+        const auto space{content.find(' ', pos)};
+        if (space == std::string::npos) {
+          break;
+        }
+        const auto len{static_cast<std::size_t>(std::strtoul(content.c_str() + pos, nullptr, 10))};
+        if (len <= space - pos || pos + len > content.size()) {
+          break;
+        }
+        const auto record{content.substr(space + 1, pos + len - space - 2)};
+        const auto eq{record.find('=')};
+        if (eq != std::string::npos) {
+          if (record.compare(0, eq, "path") == 0) {
+            pax_path = record.substr(eq + 1);
+          } else if (record.compare(0, eq, "size") == 0) {
+            pax_size = std::stoull(record.substr(eq + 1));
+          }
+        }
+        pos += len;
+      }
+      continue;
+    }
+
+    if (!!pax_size) {
+      size = *pax_size;
+    }
+    std::string name{pax_path.empty() ? long_name : pax_path};
+    if (name.empty()) {
+      name = getTarString(&header[0], 100);
+      // the prefix field is there in the POSIX ustar headers only, the GNU ones use its bytes otherwise
+      if (std::memcmp(&header[257], "ustar\0", 6) == 0) {
+        const auto prefix{getTarString(&header[345], 155)};
+        if (!prefix.empty()) {
+          name = prefix + "/" + name;
+        }
+      }
+    }
+    pax_path.clear();
+    long_name.clear();
+    pax_size = boost::none;
+
+    if (type == '0' || type == '\0' || type == '7') {
+      writer.addSegment(raw);
+      raw.clear();
+      uint64_t crc{0};
+      consume(size, nullptr, &crc);
+      writer.addFile(name, size, crc);
+      consume(padded(size) - size, &raw, nullptr);
+    } else {
+      // the content of any other entry, e.g. a global PAX header, is stored as it is
+      consume(padded(size), &raw, nullptr);
+    }
+  }
+  std::size_t received;
+  while ((received = read_full(buf.data(), buf.size())) > 0) {
+    raw.append(buf.data(), received);
+  }
+  writer.addSegment(raw);
+}
+
+}  // namespace
+
+DockerStore::DockerStore(boost::filesystem::path docker_root, boost::filesystem::path blob_dir, bool link_blobs)
+    : docker_root_{std::move(docker_root)},
+      image_root_{docker_root_ / "image" / Driver},
+      layer_root_{docker_root_ / Driver},
+      blob_dir_{std::move(blob_dir)},
+      link_blobs_{link_blobs},
+      repositories_{docker_root_} {}
+
+bool DockerStore::isSupported(const boost::filesystem::path& docker_root) {
+  return boost::filesystem::is_directory(docker_root / "image" / Driver / "layerdb") &&
+         boost::filesystem::is_directory(docker_root / Driver);
+}
+
+std::string DockerStore::importImage(const boost::filesystem::path& image_dir, const std::vector<std::string>& refs,
+                                     const boost::filesystem::path& blob_dir) {
+  const auto& src_blob_dir{blob_dir.empty() ? blob_dir_ : blob_dir};
+  auto& manifests{OciManifestCache::instance()};
+  const auto index{manifests.imageIndex(image_dir)};
+  const auto manifest{manifests.imageManifest(src_blob_dir, index->manifest().digest)};
+  const auto& config_digest{manifest->config.digest};
+  const auto config{Utils::parseJSONFile(src_blob_dir / config_digest.hash())};
+
+  const auto& layers{manifest->layers};
+  const auto& diff_ids{config["rootfs"]["diff_ids"]};
+  if (!diff_ids.isArray() || layers.size() != diff_ids.size()) {
+    throw std::runtime_error("Layers of image " + image_dir.string() + " don't match its config");
+  }
+
+  std::string parent_chain_id;
+  for (Json::ArrayIndex ii = 0; ii < diff_ids.size(); ++ii) {
+    const std::string diff_id{diff_ids[ii].asString()};
+    const std::string chain_id{getChainID(parent_chain_id, diff_id)};
+    if (!boost::filesystem::exists(image_root_ / "layerdb" / "sha256" / HashedDigest(chain_id).hash())) {
+      const auto blob{src_blob_dir / layers[ii].digest.hash()};
+      LOG_DEBUG << "Importing layer " << blob << " --> " << chain_id;
+      importLayer(blob, layers[ii].isZstd(), diff_id, chain_id, parent_chain_id);
+    }
+    parent_chain_id = chain_id;
+  }
+  importConfig(src_blob_dir, config_digest.hash());
+
+  std::lock_guard<std::mutex> lock{repositories_mutex_};
+  for (const auto& ref : refs) {
+    repositories_.add(ref, config_digest());
+  }
+  return config_digest();
+}
+
+bool DockerStore::isImported(const boost::filesystem::path& image_dir, const std::string& ref,
+                             const boost::filesystem::path& blob_dir) const {
+  auto& manifests{OciManifestCache::instance()};
+  const auto index{manifests.imageIndex(image_dir)};
+  const auto manifest{manifests.imageManifest(blob_dir.empty() ? blob_dir_ : blob_dir, index->manifest().digest)};
+  const auto& config_digest{manifest->config.digest};
+  {
+    std::lock_guard<std::mutex> lock{repositories_mutex_};
+    if (repositories_.get(ref) != config_digest()) {
+      return false;
+    }
+  }
+  return boost::filesystem::exists(image_root_ / "imagedb" / "content" / "sha256" / config_digest.hash());
+}
+
+void DockerStore::commit() {
+  std::lock_guard<std::mutex> lock{repositories_mutex_};
+  repositories_.commit();
+}
+
+std::string DockerStore::getChainID(const std::string& parent_chain_id, const std::string& diff_id) {
+  if (parent_chain_id.empty()) {
+    return diff_id;
+  }
+  return "sha256:" + boost::algorithm::to_lower_copy(
+                         boost::algorithm::hex(Crypto::sha256digest(parent_chain_id + " " + diff_id)));
+}
+
+std::string DockerStore::generateID(std::size_t len, const char* alphabet) {
+  static std::mutex generator_mutex;
+  static std::mt19937_64 generator{std::random_device{}()};
+  const std::size_t alphabet_len{std::strlen(alphabet)};
+  std::uniform_int_distribution<std::size_t> distribution{0, alphabet_len - 1};
+
+  std::lock_guard<std::mutex> lock{generator_mutex};
+  std::string id(len, '0');
+  for (auto& c : id) {
+    c = alphabet[distribution(generator)];
+  }
+  return id;
+}
+
+void DockerStore::convertWhiteouts(const boost::filesystem::path& dir) {
+  std::vector<boost::filesystem::path> whiteouts;
+  for (boost::filesystem::recursive_directory_iterator it{dir}, end; it != end; ++it) {
+    if (boost::starts_with(it->path().filename().string(), WhiteoutPrefix)) {
+      whiteouts.emplace_back(it->path());
+    }
+  }
+
+  for (const auto& whiteout : whiteouts) {
+    const auto name{whiteout.filename().string()};
+    boost::filesystem::remove(whiteout);
+    if (name == OpaqueWhiteout) {
+      // the directory content of the lower layers is hidden
+      if (::setxattr(whiteout.parent_path().c_str(), "trusted.overlay.opaque", "y", 1, 0) != 0) {
+        throw std::runtime_error("Failed to mark " + whiteout.parent_path().string() +
+                                 " as opaque: " + std::strerror(errno));
+      }
+    } else {
+      // the file of the lower layers is removed
+      const auto removed{whiteout.parent_path() / name.substr(WhiteoutPrefix.size())};
+      if (::mknod(removed.c_str(), S_IFCHR, makedev(0, 0)) != 0) {
+        throw std::runtime_error("Failed to create a whiteout " + removed.string() + ": " + std::strerror(errno));
+      }
+    }
+  }
+}
+
+void DockerStore::writeTarSplit(const boost::filesystem::path& blob, bool zstd, const boost::filesystem::path& dst) {
+  TarSplitWriter writer{dst};
+  if (zstd) {
+    boost::process::ipstream out;
+    boost::process::child child{"zstd -dcq " + blob.string(), boost::process::std_out > out};
+    splitTar(
+        [&out](char* data, std::size_t size) {
+          out.read(data, static_cast<std::streamsize>(size));
+          return static_cast<std::size_t>(out.gcount());
+        },
+        writer);
+    child.wait();
+    if (child.exit_code() != EXIT_SUCCESS) {
+      throw std::runtime_error("Failed to decompress layer " + blob.string());
+    }
+  } else {
+    // zlib reads an uncompressed tarball as it is
+    std::unique_ptr<gzFile_s, int (*)(gzFile)> in{gzopen(blob.c_str(), "rb"), gzclose};
+    if (!in) {
+      throw std::runtime_error("Failed to open layer " + blob.string());
+    }
+    splitTar(
+        [&in, &blob](char* data, std::size_t size) {
+          const auto res{gzread(in.get(), data, static_cast<unsigned>(size))};
+          if (res < 0) {
+            throw std::runtime_error("Failed to decompress layer " + blob.string());
+          }
+          return static_cast<std::size_t>(res);
+        },
+        writer);
+  }
+  writer.close();
+}
+
+uint64_t DockerStore::getDirSize(const boost::filesystem::path& dir) {
+  uint64_t size{0};
+  for (boost::filesystem::recursive_directory_iterator it{dir}, end; it != end; ++it) {
+    if (it->symlink_status().type() == boost::filesystem::regular_file) {
+      size += boost::filesystem::file_size(it->path());
+    }
+  }
+  return size;
+}
+
+void DockerStore::importConfig(const boost::filesystem::path& blob_dir, const std::string& config_hash) {
+  const auto dst{image_root_ / "imagedb" / "content" / "sha256" / config_hash};
+  if (boost::filesystem::exists(dst)) {
+    return;
+  }
+  boost::filesystem::create_directories(dst.parent_path());
+  boost::system::error_code ec;
+  if (link_blobs_) {
+    // the config is never modified, so it can be shared with the App store
+    boost::filesystem::create_hard_link(blob_dir / config_hash, dst, ec);
+  }
+  if (!link_blobs_ || ec) {
+    boost::filesystem::copy_file(blob_dir / config_hash, dst, boost::filesystem::copy_option::overwrite_if_exists);
+  }
+}
+
+void DockerStore::importLayer(const boost::filesystem::path& blob, bool zstd, const std::string& diff_id,
+                              const std::string& chain_id, const std::string& parent_chain_id) {
+  const auto cache_id{generateID(64, "0123456789abcdef")};
+  const auto link_id{generateID(26, "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789")};
+  const auto layer_dir{layer_root_ / cache_id};
+  const auto diff_dir{layer_dir / "diff"};
+
+  boost::filesystem::create_directories(diff_dir);
+  std::string compression;
+  if (zstd) {
+    compression = "--zstd ";
+  } else if (!AppArchive::parallelGunzip().empty() && AppArchive::isGzip(blob)) {
+    compression = "-I \"" + AppArchive::parallelGunzip() + "\" ";
+  }
+  exec(boost::format{"tar --numeric-owner --xattrs --xattrs-include=* %s-xf %s -C %s"} % compression % blob % diff_dir,
+       "failed to extract layer");
+  convertWhiteouts(diff_dir);
+
+  Utils::writeFile(layer_dir / "link", link_id);
+  boost::filesystem::create_directories(layer_root_ / "l");
+  boost::filesystem::create_symlink(boost::filesystem::path("..") / cache_id / "diff", layer_root_ / "l" / link_id);
+  if (!parent_chain_id.empty()) {
+    // the lower dirs list, starting from the nearest parent
+    const auto parent_dir{image_root_ / "layerdb" / "sha256" / HashedDigest(parent_chain_id).hash()};
+    const auto parent_layer_dir{layer_root_ / Utils::readFile(parent_dir / "cache-id")};
+    std::string lower{"l/" + Utils::readFile(parent_layer_dir / "link")};
+    if (boost::filesystem::exists(parent_layer_dir / "lower")) {
+      lower += ":" + Utils::readFile(parent_layer_dir / "lower");
+    }
+    Utils::writeFile(layer_dir / "lower", lower);
+    boost::filesystem::create_directories(layer_dir / "work");
+  }
+
+  // the layer becomes visible to the daemon once its dir is moved into the layer DB
+  const auto tmp_dir{image_root_ / "layerdb" / "tmp" / ("write-set-" + cache_id)};
+  boost::filesystem::create_directories(tmp_dir);
+  // the daemon reassembles the layer tarball from its tar-split and the layer files on `docker save` and `push`
+  writeTarSplit(blob, zstd, tmp_dir / "tar-split.json.gz");
+  Utils::writeFile(tmp_dir / "diff", diff_id);
+  Utils::writeFile(tmp_dir / "size", std::to_string(getDirSize(diff_dir)));
+  Utils::writeFile(tmp_dir / "cache-id", cache_id);
+  if (!parent_chain_id.empty()) {
+    Utils::writeFile(tmp_dir / "parent", parent_chain_id);
+  }
+  boost::filesystem::create_directories(image_root_ / "layerdb" / "sha256");
+  boost::filesystem::rename(tmp_dir, image_root_ / "layerdb" / "sha256" / HashedDigest(chain_id).hash());
+}
+
+}  // namespace Docker
@@ -0,0 +1,81 @@
+#ifndef AKTUALIZR_LITE_DOCKER_STORE_H_
+#define AKTUALIZR_LITE_DOCKER_STORE_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "docker/imagerepositories.h"
+
+namespace Docker {
+
+/**
+ * @brief DockerStore, imports images from the App store, i.e. an OCI image layout with a shared blob directory,
+ * directly into the docker image and layer store of the `overlay2` storage driver. It is an alternative to
+ * `skopeo copy ... docker-daemon:` that streams each layer through the daemon API.
+ *
+ * <docker-data-root>/
+ *   image/overlay2/
+ *     repositories.json (image references -> image IDs)
+ *     imagedb/content/sha256/<image-id> (image config, a hardlink to the App store blob if possible)
+ *     layerdb/sha256/<chain-id>/ (diff, size, cache-id, parent, tar-split.json.gz)
+ *   overlay2/
+ *     <cache-id>/ (diff, link, lower, work)
+ *     l/<link-id> -> ../<cache-id>/diff
+ *
+ * Each layer is extracted just once, right into the driver's `diff` directory, the OCI whiteouts are converted into
+ * the overlay ones, and its `tar-split.json.gz` is written so the daemon can reassemble the layer tarball.
+ * The layers present in the store already are not touched.
+ * The daemon reads its image and layer store only at its start, and it writes its in-memory copy of
+ * `repositories.json` over the file, so it is up to the caller to stop the daemon before the import and start it
+ * again after `commit()`. The import is thread-safe as long as concurrent imports don't share layers.
+ */
+class DockerStore {
+ public:
+  static constexpr const char* const Driver{"overlay2"};
+
+  DockerStore(boost::filesystem::path docker_root, boost::filesystem::path blob_dir, bool link_blobs = true);
+
+  // Whether the given docker data root holds a store of the supported storage driver
+  static bool isSupported(const boost::filesystem::path& docker_root);
+
+  // Imports the image stored in the given OCI image layout dir and tags it with the given references,
+  // returns the image ID. The image blobs are read from the given blob dir, by default from the store one.
+  std::string importImage(const boost::filesystem::path& image_dir, const std::vector<std::string>& refs,
+                          const boost::filesystem::path& blob_dir = {});
+  // Stores the image references recorded by importImage(), nothing is written if none of them is new
+  void commit();
+  // Whether the image stored in the given OCI image layout dir is present in the docker store and tagged with the
+  // given reference, e.g. the store has been preloaded at the device image build time
+  bool isImported(const boost::filesystem::path& image_dir, const std::string& ref,
+                  const boost::filesystem::path& blob_dir = {}) const;
+
+ private:
+  static std::string getChainID(const std::string& parent_chain_id, const std::string& diff_id);
+  static std::string generateID(std::size_t len, const char* alphabet);
+  static void convertWhiteouts(const boost::filesystem::path& dir);
+  // Writes the tar-split of the given layer blob, the layer tarball can't be reassembled by the daemon without it
+  static void writeTarSplit(const boost::filesystem::path& blob, bool zstd, const boost::filesystem::path& dst);
+  static uint64_t getDirSize(const boost::filesystem::path& dir);
+
+  void importConfig(const boost::filesystem::path& blob_dir, const std::string& config_hash);
+  // The layer blob is extracted as a zstd-compressed tarball if `zstd` is set, otherwise its compression, if any, is
+  // detected by tar
+  void importLayer(const boost::filesystem::path& blob, bool zstd, const std::string& diff_id,
+                   const std::string& chain_id, const std::string& parent_chain_id);
+
+  const boost::filesystem::path docker_root_;
+  const boost::filesystem::path image_root_;
+  const boost::filesystem::path layer_root_;
+  const boost::filesystem::path blob_dir_;
+  const bool link_blobs_;
+
+  mutable std::mutex repositories_mutex_;
+  ImageRepositories repositories_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_DOCKER_STORE_H_
@@ -0,0 +1,97 @@
+#include "fetchjournal.h"
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+const std::string FetchJournal::AppStep{"app"};
+
+FetchJournal::FetchJournal(boost::filesystem::path file) : file_{std::move(file)} { load(); }
+
+void FetchJournal::begin(const std::string& plan) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (plan_ == plan) {
+    if (!steps_.empty()) {
+      LOG_INFO << "Resuming the App fetch, steps completed by the previous attempt are skipped";
+    }
+    return;
+  }
+  plan_ = plan;
+  steps_.clear();
+  store();
+}
+
+bool FetchJournal::isDone(const std::string& owner, const std::string& step) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  const auto it{steps_.find(owner)};
+  return it != steps_.end() && it->second.count(step) > 0;
+}
+
+void FetchJournal::setDone(const std::string& owner, const std::string& step) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (steps_[owner].emplace(step).second) {
+    store();
+  }
+}
+
+void FetchJournal::reset(const std::string& owner) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (steps_.erase(owner) > 0) {
+    store();
+  }
+}
+
+void FetchJournal::store() const {
+  if (file_.empty()) {
+    return;
+  }
+  Json::Value journal;
+  journal["plan"] = plan_;
+  journal["owners"] = Json::Value(Json::objectValue);
+  for (const auto& owner : steps_) {
+    Json::Value& steps{journal["owners"][owner.first]};
+    steps = Json::Value(Json::arrayValue);
+    for (const auto& step : owner.second) {
+      steps.append(step);
+    }
+  }
+
+  try {
+    // write to a temporary file and move it to the journal file so the journal file is never half-written
+    const boost::filesystem::path tmp_file{file_.string() + ".tmp"};
+    Utils::writeFile(tmp_file, Utils::jsonToCanonicalStr(journal));
+    boost::filesystem::rename(tmp_file, file_);
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to store the App fetch journal " << file_ << ": " << exc.what();
+  }
+}
+
+void FetchJournal::load() {
+  if (file_.empty() || !boost::filesystem::exists(file_)) {
+    return;
+  }
+  try {
+    const auto journal{Utils::parseJSONFile(file_)};
+    if (!journal.isObject() || !journal["plan"].isString() || !journal["owners"].isObject()) {
+      throw std::invalid_argument("unexpected format");
+    }
+    for (Json::ValueConstIterator it = journal["owners"].begin(); it != journal["owners"].end(); ++it) {
+      if (!it->isArray()) {
+        throw std::invalid_argument("invalid entry of " + it.key().asString());
+      }
+      auto& steps{steps_[it.key().asString()]};
+      for (const auto& step : *it) {
+        steps.emplace(step.asString());
+      }
+    }
+    plan_ = journal["plan"].asString();
+  } catch (const std::exception& exc) {
+    // nothing is skipped then, the next fetch verifies and fetches everything
+    LOG_WARNING << "Failed to load the App fetch journal " << file_ << ", it is dropped: " << exc.what();
+    steps_.clear();
+    plan_.clear();
+  }
+}
+
+}  // namespace Docker
@@ -0,0 +1,50 @@
+#ifndef AKTUALIZR_LITE_FETCH_JOURNAL_H_
+#define AKTUALIZR_LITE_FETCH_JOURNAL_H_
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+namespace Docker {
+
+/**
+ * @brief FetchJournal, a persistent record of the completed steps of the App fetches in flight.
+ *
+ * An owner, i.e. an App version, records a step once its result has been verified and stored, e.g. `AppStep` once
+ * the App manifest and archive are in the store, or an image digest once the image is pulled. The next fetch
+ * attempt, e.g. the one after a power cut, skips the recorded steps and a failed fetch keeps what they have brought.
+ * The journal belongs to a fetch plan, the set of the Apps of a Target, and starting another plan drops the records.
+ * Each change is stored right away, so the journal file is never behind the store. All methods are thread-safe.
+ */
+class FetchJournal {
+ public:
+  // The App manifest, archive and compose file are fetched
+  static const std::string AppStep;
+
+  // The journal is not persisted if the file path is empty
+  explicit FetchJournal(boost::filesystem::path file = "");
+
+  // Starts the journal of the given fetch plan, the records of a different plan are dropped
+  void begin(const std::string& plan);
+  bool isDone(const std::string& owner, const std::string& step) const;
+  void setDone(const std::string& owner, const std::string& step);
+  // Drops the records of the given owner, e.g. once its App version is removed
+  void reset(const std::string& owner);
+
+ private:
+  void load();
+  void store() const;
+
+  const boost::filesystem::path file_;
+  mutable std::mutex mutex_;
+  std::string plan_;
+  // owner -> the completed steps
+  std::unordered_map<std::string, std::set<std::string>> steps_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_FETCH_JOURNAL_H_
@@ -0,0 +1,176 @@
+#include "imagepuller.h"
+
+#include <thread>
+
+#include <boost/algorithm/string/join.hpp>
+
+#include "logging/logging.h"
+
+namespace Docker {
+
+ImagePuller::ImagePuller(RegistryClient::Ptr registry_client, boost::filesystem::path blobs_dir, int concurrency)
+    : registry_client_{std::move(registry_client)}, blobs_dir_{std::move(blobs_dir)}, concurrency_{concurrency} {
+  if (concurrency_ < 1) {
+    throw std::invalid_argument("Invalid image pull concurrency, should be a positive integer, got " +
+                                std::to_string(concurrency_));
+  }
+}
+
+void ImagePuller::pull(const std::vector<Image>& images, const std::string& arch, const CancelCheck& is_cancelled) {
+  boost::filesystem::create_directories(blobs_dir_ / "sha256");
+
+  std::vector<Json::Value> manifest_descs;
+  std::vector<Blob> blobs;
+  std::set<std::string> blob_digests;
+  for (const auto& image : images) {
+    if (is_cancelled && is_cancelled()) {
+      throw std::runtime_error("Image pull has been cancelled");
+    }
+    LOG_INFO << image.uri.app << ": pulling image manifest: " << image.uri.registryHostname << "/" << image.uri.repo
+             << "@" << image.uri.digest();
+
+    const auto manifest{pullManifest(image.uri, arch)};
+    manifest_descs.emplace_back(manifest.first);
+
+    std::vector<const Descriptor*> blob_descs{&manifest.second.config};
+    for (const auto& layer : manifest.second.layers) {
+      blob_descs.emplace_back(&layer);
+    }
+    for (const auto* blob_desc : blob_descs) {
+      if (static_cast<uint64_t>(blob_desc->size) > RegistryClient::MaxBlobSize) {
+        throw std::runtime_error("Got invalid image manifest, too big blob: " + blob_desc->digest() +
+                                 ", size: " + std::to_string(blob_desc->size));
+      }
+      const Uri blob_uri{image.uri.createUri(blob_desc->digest)};
+      // the same layer can be referenced by several images, download it just once
+      if (blob_digests.emplace(blob_uri.digest()).second) {
+        blobs.push_back({blob_uri, static_cast<std::size_t>(blob_desc->size)});
+      }
+    }
+  }
+
+  std::atomic_size_t next_blob{0};
+  std::atomic_bool failed{false};
+  std::mutex err_mutex;
+  std::string err;
+  const auto pull_blobs = [&]() {
+    for (auto ii = next_blob++; ii < blobs.size() && !failed; ii = next_blob++) {
+      try {
+        pullBlob(blobs[ii], is_cancelled);
+      } catch (const std::exception& exc) {
+        std::lock_guard<std::mutex> lock{err_mutex};
+        if (!failed.exchange(true)) {
+          err = exc.what();
+        }
+      }
+    }
+  };
+
+  const auto worker_numb{std::min(static_cast<std::size_t>(concurrency_), blobs.size())};
+  std::vector<std::thread> workers;
+  workers.reserve(worker_numb);
+  for (std::size_t ii = 0; ii < worker_numb; ++ii) {
+    workers.emplace_back(pull_blobs);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  if (failed) {
+    throw std::runtime_error("Failed to pull image blob: " + err);
+  }
+
+  // an image layout is written at the very end, so its presence means that all image blobs are in the blob dir
+  for (std::size_t ii = 0; ii < images.size(); ++ii) {
+    writeImageLayout(images[ii].dir, manifest_descs[ii]);
+  }
+}
+
+std::pair<Json::Value, ImageManifest> ImagePuller::pullManifest(const Uri& uri, const std::string& arch) const {
+  const std::string accept{boost::algorithm::join(
+      std::vector<std::string>{OciManifestFormat, ManifestFormat, OciIndexFormat, ManifestListFormat}, ",")};
+
+  std::string manifest_digest{uri.digest()};
+  std::string manifest_str{registry_client_->getAppManifest(uri, accept)};
+  Json::Value manifest{Utils::parseJSON(manifest_str)};
+
+  if (manifest.isMember("manifests")) {
+    // a multi-platform image, find the image of the given architecture
+    const ImageIndex index{manifest};
+    const auto* found{index.find(arch)};
+    if (found == nullptr) {
+      throw std::runtime_error("No image manifest found for the given architecture; image: " + uri.repo +
+                               ", arch: " + arch);
+    }
+    manifest_digest = found->digest();
+    manifest_str = registry_client_->getAppManifest(uri.createUri(found->digest), accept, found->size);
+    manifest = Utils::parseJSON(manifest_str);
+  }
+  const ImageManifest image_manifest{manifest};
+
+  const Uri manifest_uri{uri.createUri(HashedDigest(manifest_digest))};
+  const auto manifest_path{blobPath(manifest_uri)};
+  if (!boost::filesystem::exists(manifest_path) || boost::filesystem::file_size(manifest_path) != manifest_str.size()) {
+    Utils::writeFile(manifest_path, manifest_str);
+  }
+
+  Json::Value manifest_desc;
+  manifest_desc["mediaType"] = manifest.get("mediaType", OciManifestFormat).asString();
+  manifest_desc["digest"] = manifest_uri.digest();
+  manifest_desc["size"] = static_cast<Json::UInt64>(manifest_str.size());
+  return {manifest_desc, image_manifest};
+}
+
+void ImagePuller::pullBlob(const Blob& blob, const CancelCheck& is_cancelled) {
+  if (is_cancelled && is_cancelled()) {
+    throw std::runtime_error("Image pull has been cancelled");
+  }
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    // wait for a free download slot and for completion of a download of the same blob by a concurrent pull() call
+    cv_.wait(lock, [this, &blob]() {
+      return active_download_numb_ < concurrency_ && in_flight_blobs_.count(blob.uri.digest()) == 0;
+    });
+    if (isBlobPresent(blob)) {
+      LOG_DEBUG << "Image blob is already present: " << blob.uri.digest();
+      return;
+    }
+    ++active_download_numb_;
+    in_flight_blobs_.emplace(blob.uri.digest());
+  }
+
+  const auto release = [this, &blob]() {
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      --active_download_numb_;
+      in_flight_blobs_.erase(blob.uri.digest());
+    }
+    cv_.notify_all();
+  };
+
+  try {
+    LOG_INFO << blob.uri.app << ": downloading image blob: " << blob.uri.digest() << ", size: " << blob.size;
+    registry_client_->downloadBlob(blob.uri, blobPath(blob.uri), blob.size);
+  } catch (...) {
+    release();
+    throw;
+  }
+  release();
+}
+
+bool ImagePuller::isBlobPresent(const Blob& blob) const {
+  const auto path{blobPath(blob.uri)};
+  boost::system::error_code ec;
+  return boost::filesystem::file_size(path, ec) == blob.size && !ec;
+}
+
+void ImagePuller::writeImageLayout(const boost::filesystem::path& dir, const Json::Value& manifest_desc) {
+  Json::Value index;
+  index["schemaVersion"] = 2;
+  index["manifests"].append(manifest_desc);
+
+  boost::filesystem::create_directories(dir);
+  Utils::writeFile(dir / LayoutFile, std::string("{\"imageLayoutVersion\": \"1.0.0\"}"));
+  Utils::writeFile(dir / IndexFile, Utils::jsonToCanonicalStr(index));
+}
+
+}  // namespace Docker
@@ -0,0 +1,91 @@
+#ifndef AKTUALIZR_LITE_IMAGE_PULLER_H_
+#define AKTUALIZR_LITE_IMAGE_PULLER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "docker/docker.h"
+#include "docker/ocimanifest.h"
+
+namespace Docker {
+
+/**
+ * @brief ImagePuller, pulls container images from Registries into an OCI image layout with a shared blob directory,
+ * a drop-in replacement of `skopeo copy --dest-shared-blob-dir <blobs-dir> docker://<image> oci:<image-dir>`
+ *
+ * <image-dir>/
+ *   index.json (refers to the image manifest blob)
+ *   oci-layout
+ *
+ * <blobs-dir>/
+ *   sha256/ (image manifests, configs and layers of all images)
+ *
+ * Missing blobs of all images passed to a single pull() call are downloaded concurrently, a blob referenced by several
+ * images is downloaded just once. The total number of concurrent blob downloads is capped by the puller instance,
+ * including the downloads of concurrent pull() calls.
+ */
+class ImagePuller {
+ public:
+  using Ptr = std::shared_ptr<ImagePuller>;
+
+  static constexpr const char* const ManifestFormat{"application/vnd.docker.distribution.manifest.v2+json"};
+  static constexpr const char* const ManifestListFormat{
+      "application/vnd.docker.distribution.manifest.list.v2+json"};
+  static constexpr const char* const OciManifestFormat{"application/vnd.oci.image.manifest.v1+json"};
+  static constexpr const char* const OciIndexFormat{"application/vnd.oci.image.index.v1+json"};
+  static constexpr const char* const IndexFile{"index.json"};
+  static constexpr const char* const LayoutFile{"oci-layout"};
+  static const int DefConcurrency{4};
+
+  struct Image {
+    Image(Uri uri_in, boost::filesystem::path dir_in) : uri{std::move(uri_in)}, dir{std::move(dir_in)} {}
+    const Uri uri;
+    const boost::filesystem::path dir;
+  };
+
+  // Returns true if the pull is to stop
+  using CancelCheck = std::function<bool()>;
+
+  ImagePuller(RegistryClient::Ptr registry_client, boost::filesystem::path blobs_dir, int concurrency = DefConcurrency);
+
+  // Pulls the given images, a manifest list/index is resolved to the image manifest of the given architecture.
+  // Throws std::runtime_error on the first failure, the downloads that are in progress at that moment are completed.
+  // The pull fails before starting a download of a next manifest or blob once `is_cancelled` returns true.
+  void pull(const std::vector<Image>& images, const std::string& arch, const CancelCheck& is_cancelled = nullptr);
+
+ private:
+  struct Blob {
+    Uri uri;
+    std::size_t size;
+  };
+
+  // Returns the image manifest descriptor and the image manifest itself, the manifest blob is stored in the blob dir
+  std::pair<Json::Value, ImageManifest> pullManifest(const Uri& uri, const std::string& arch) const;
+  void pullBlob(const Blob& blob, const CancelCheck& is_cancelled);
+  boost::filesystem::path blobPath(const Uri& uri) const { return blobs_dir_ / "sha256" / uri.digest.hash(); }
+  bool isBlobPresent(const Blob& blob) const;
+
+  static void writeImageLayout(const boost::filesystem::path& dir, const Json::Value& manifest_desc);
+
+  RegistryClient::Ptr registry_client_;
+  const boost::filesystem::path blobs_dir_;
+  const int concurrency_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int active_download_numb_{0};
+  // blobs being downloaded at the moment
+  std::set<std::string> in_flight_blobs_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_IMAGE_PULLER_H_
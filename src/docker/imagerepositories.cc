@@ -0,0 +1,128 @@
+#include "imagerepositories.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <system_error>
+
+#include "docker/composeinfo.h"
+#include "docker/restorableappengine.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace Docker {
+
+constexpr const char* const ImageRepositories::Filename;
+
+static void syncAndClose(int fd, const boost::filesystem::path& path) {
+  const int sr{::fsync(fd)};
+  const int err{errno};
+  ::close(fd);
+  if (-1 == sr) {
+    throw std::system_error(err, std::system_category(), "Failed to sync " + path.string());
+  }
+}
+
+static void writeFileAtomically(const boost::filesystem::path& path, const std::string& content) {
+  const boost::filesystem::path tmp_file{path.string() + ".tmp"};
+  const int fd{::open(tmp_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR)};
+  if (-1 == fd) {
+    throw std::system_error(errno, std::system_category(), "Failed to open/create a file: " + tmp_file.string());
+  }
+  std::size_t written{0};
+  while (written < content.size()) {
+    const auto wr{::write(fd, content.data() + written, content.size() - written)};
+    if (-1 == wr && errno == EINTR) {
+      continue;
+    }
+    if (-1 == wr) {
+      const int err{errno};
+      ::close(fd);
+      ::remove(tmp_file.c_str());
+      throw std::system_error(err, std::system_category(), "Failed to write to a file: " + tmp_file.string());
+    }
+    written += static_cast<std::size_t>(wr);
+  }
+  syncAndClose(fd, tmp_file);
+
+  if (-1 == ::rename(tmp_file.c_str(), path.c_str())) {
+    const int err{errno};
+    ::remove(tmp_file.c_str());
+    throw std::system_error(err, std::system_category(), "Failed to rename the tmp file to: " + path.string());
+  }
+  // the rename itself is durable once the dir entry is synced
+  const int dir_fd{::open(path.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+  if (-1 == dir_fd) {
+    throw std::system_error(errno, std::system_category(), "Failed to open a dir: " + path.parent_path().string());
+  }
+  syncAndClose(dir_fd, path.parent_path());
+}
+
+ImageRepositories::ImageRepositories(const boost::filesystem::path& docker_root, OciManifestCache& manifests)
+    : file_{docker_root / "image" / "overlay2" / Filename}, manifests_{manifests} {
+  if (boost::filesystem::exists(file_)) {
+    repositories_ = Utils::parseJSONFile(file_);
+  }
+  if (!repositories_.isObject() || !repositories_["Repositories"].isObject()) {
+    repositories_ = Utils::parseJSON("{\"Repositories\":{}}");
+  }
+}
+
+std::string ImageRepositories::getRepo(const std::string& ref) {
+  // the repo itself may contain a registry port
+  const auto digest_pos{ref.find('@')};
+  const auto tag_pos{ref.rfind(':')};
+  const auto repo_end{digest_pos != std::string::npos ? digest_pos
+                      : (tag_pos != std::string::npos && ref.find('/', tag_pos) == std::string::npos)
+                          ? tag_pos
+                          : ref.size()};
+  return ref.substr(0, repo_end);
+}
+
+bool ImageRepositories::add(const std::string& ref, const std::string& image_id) {
+  auto& repo{repositories_["Repositories"][getRepo(ref)]};
+  if (repo.isObject() && repo.get(ref, "").asString() == image_id) {
+    return false;
+  }
+  repo[ref] = image_id;
+  modified_ = true;
+  return true;
+}
+
+std::string ImageRepositories::get(const std::string& ref) const {
+  const auto& repo{repositories_["Repositories"][getRepo(ref)]};
+  return repo.isObject() ? repo.get(ref, "").asString() : "";
+}
+
+std::string ImageRepositories::addImage(const std::string& ref, const boost::filesystem::path& image_dir,
+                                        const boost::filesystem::path& blob_dir) {
+  // an image index points to an image manifest, and the manifest to an image config which digest is the image ID
+  const auto index{manifests_.imageIndex(image_dir)};
+  const auto manifest{manifests_.imageManifest(blob_dir, index->manifest().digest)};
+  const auto image_id{manifest->config.digest()};
+  if (add(ref, image_id)) {
+    LOG_INFO << "Registering image: " << ref << " -> " << image_id;
+  }
+  return image_id;
+}
+
+void ImageRepositories::addApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& blob_dir) {
+  const auto compose{ComposeInfo::load((app_dir / RestorableAppEngine::ComposeFile).string())};
+  for (const auto& service : compose->services()) {
+    const auto image_uri{Uri::parseUri(service.image, false)};
+    addImage(service.image, app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash(),
+             blob_dir);
+  }
+}
+
+bool ImageRepositories::commit() {
+  if (!modified_) {
+    return false;
+  }
+  boost::filesystem::create_directories(file_.parent_path());
+  writeFileAtomically(file_, Utils::jsonToCanonicalStr(repositories_));
+  modified_ = false;
+  return true;
+}
+
+}  // namespace Docker
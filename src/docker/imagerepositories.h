@@ -0,0 +1,57 @@
+#ifndef AKTUALIZR_LITE_IMAGE_REPOSITORIES_H_
+#define AKTUALIZR_LITE_IMAGE_REPOSITORIES_H_
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "docker/ocimanifest.h"
+#include "json/json.h"
+
+namespace Docker {
+
+/**
+ * @brief ImageRepositories, the image references known to the docker store of the `overlay2` storage driver, i.e.
+ * <docker-data-root>/image/overlay2/repositories.json that maps each image reference to its image ID.
+ *
+ * The references are added in a batch and stored by commit() at once. The file is replaced atomically, it is written
+ * to a temporary file that is synced and renamed over the original one, so a power loss leaves either the previous
+ * or the new references in place. Nothing is written if the batch hasn't changed any reference. The image IDs are
+ * resolved through the given manifest cache, so an image index or manifest shared by several Apps is parsed once.
+ * It is not thread-safe.
+ */
+class ImageRepositories {
+ public:
+  static constexpr const char* const Filename{"repositories.json"};
+
+  explicit ImageRepositories(const boost::filesystem::path& docker_root,
+                             OciManifestCache& manifests = OciManifestCache::instance());
+
+  // The repo of the given reference, a reference is either <repo>@<digest> or <repo>:<tag>
+  static std::string getRepo(const std::string& ref);
+
+  // Maps the reference to the image ID, returns false if it has been mapped to it already
+  bool add(const std::string& ref, const std::string& image_id);
+  // The image ID the reference is mapped to, empty if there is no such reference
+  std::string get(const std::string& ref) const;
+  // Maps the reference to the ID of the image stored in the given OCI image layout dir, returns the image ID
+  std::string addImage(const std::string& ref, const boost::filesystem::path& image_dir,
+                       const boost::filesystem::path& blob_dir);
+  // Maps the URIs of the App service images, stored in the App dir of the App store, to their IDs
+  void addApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& blob_dir);
+
+  bool isModified() const { return modified_; }
+  // Stores the references if any of them has been added or changed since the load or the previous commit,
+  // returns false if there was nothing to store
+  bool commit();
+
+ private:
+  const boost::filesystem::path file_;
+  OciManifestCache& manifests_;
+  Json::Value repositories_;
+  bool modified_{false};
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_IMAGE_REPOSITORIES_H_
@@ -0,0 +1,712 @@
+#include "nativecompose.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+#include "logging/logging.h"
+
+namespace Docker {
+
+const std::string NativeCompose::ProjectLabel{"com.docker.compose.project"};
+const std::string NativeCompose::ServiceLabel{"com.docker.compose.service"};
+const std::string NativeCompose::ConfigHashLabel{"io.compose-spec.config-hash"};
+
+// the name suffix of the old container of a service while it is being switched over and after it, if it is retained
+static const std::string RetainedSuffix{"-prev"};
+// the label of the containers which the docker store prune doesn't remove
+static const std::string NoPruneLabel{"aktualizr-no-prune"};
+
+static bool isExtension(const std::string& key) { return boost::starts_with(key, "x-"); }
+
+static bool isDigits(const std::string& str) {
+  return !str.empty() && std::all_of(str.begin(), str.end(), [](char c) { return std::isdigit(c) != 0; });
+}
+
+static bool containsVariable(const Json::Value& value) {
+  if (value.isString()) {
+    return value.asString().find('$') != std::string::npos;
+  }
+  if (value.isObject() || value.isArray()) {
+    for (Json::ValueConstIterator ii = value.begin(); ii != value.end(); ++ii) {
+      if ((value.isObject() && ii.name().find('$') != std::string::npos) || containsVariable(*ii)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// The characters `compose config` accepts in a service name
+static bool isServiceName(const std::string& name) {
+  return !name.empty() && std::all_of(name.begin(), name.end(), [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) != 0 || c == '.' || c == '_' || c == '-';
+  });
+}
+
+// `[registry/]repo[:tag][@digest]`, just the characters are checked, the daemon rejects a malformed reference on the
+// container creation anyway
+static bool isImageReference(const std::string& image) {
+  return !image.empty() && image.front() != '/' && image.front() != ':' && image.front() != '@' &&
+         std::all_of(image.begin(), image.end(), [](char c) {
+           return std::isalnum(static_cast<unsigned char>(c)) != 0 || c == '.' || c == '_' || c == '-' || c == '/' ||
+                  c == ':' || c == '@';
+         });
+}
+
+static bool isEnvName(const std::string& name) {
+  return !name.empty() && name.find_first_of("= \t\n") == std::string::npos;
+}
+
+static std::vector<std::string> splitCommand(const std::string& command) {
+  std::vector<std::string> args;
+  boost::split(args, command, boost::is_any_of(" \t\n"), boost::token_compress_on);
+  args.erase(std::remove(args.begin(), args.end(), ""), args.end());
+  return args;
+}
+
+static bool isSimpleCommand(const Json::Value& command) {
+  if (command.isArray()) {
+    return std::all_of(command.begin(), command.end(), [](const Json::Value& arg) { return arg.isString(); });
+  }
+  // a command string is split by compose by the shell rules, just the ones with no quoting are split the same here
+  return command.isString() && command.asString().find_first_of("\"'\\") == std::string::npos;
+}
+
+static Json::Value toArgs(const Json::Value& command) {
+  if (command.isArray()) {
+    return command;
+  }
+  Json::Value args{Json::arrayValue};
+  for (const auto& arg : splitCommand(command.asString())) {
+    args.append(arg);
+  }
+  return args;
+}
+
+// Splits `[[host-ip:]host-port:]container-port[/protocol]`, returns false if the format is not supported
+static bool parsePort(const Json::Value& port, std::string& host_ip, std::string& host_port,
+                      std::string& container_port) {
+  if (!port.isString() && !port.isUInt()) {
+    return false;
+  }
+  std::string str{port.isString() ? port.asString() : std::to_string(port.asUInt())};
+  std::string protocol{"tcp"};
+  const auto proto_pos{str.find('/')};
+  if (proto_pos != std::string::npos) {
+    protocol = str.substr(proto_pos + 1);
+    str = str.substr(0, proto_pos);
+    if (protocol != "tcp" && protocol != "udp") {
+      return false;
+    }
+  }
+  std::vector<std::string> parts;
+  boost::split(parts, str, boost::is_any_of(":"));
+  if (parts.empty() || parts.size() > 3) {
+    return false;
+  }
+  container_port = parts.back() + "/" + protocol;
+  host_port = parts.size() > 1 ? parts[parts.size() - 2] : "";
+  host_ip = parts.size() > 2 ? parts[0] : "";
+  // neither port ranges nor IPv6 addresses
+  return isDigits(parts.back()) && (host_port.empty() || isDigits(host_port)) &&
+         host_ip.find_first_of("[]") == std::string::npos;
+}
+
+static bool isBindVolume(const Json::Value& volume) {
+  if (!volume.isString()) {
+    return false;
+  }
+  std::vector<std::string> parts;
+  boost::split(parts, volume.asString(), boost::is_any_of(":"));
+  if (parts.size() < 2 || parts.size() > 3 || parts[1].empty()) {
+    return false;
+  }
+  if (parts.size() == 3 && parts[2] != "ro" && parts[2] != "rw") {
+    return false;
+  }
+  // a named volume must be created by compose
+  return boost::starts_with(parts[0], "/") || boost::starts_with(parts[0], "./") || boost::starts_with(parts[0], "../");
+}
+
+static std::vector<std::string> getDependencies(const Json::Value& service_config) {
+  std::vector<std::string> dependencies;
+  const auto& depends_on{service_config["depends_on"]};
+  if (depends_on.isArray()) {
+    for (const auto& dependency : depends_on) {
+      dependencies.push_back(dependency.asString());
+    }
+  } else if (depends_on.isObject()) {
+    dependencies = depends_on.getMemberNames();
+  }
+  return dependencies;
+}
+
+static std::string getUnsupportedServiceFeature(const Json::Value& services, const std::string& name) {
+  static const std::set<std::string> supported_keys{
+      "image",   "labels",   "environment", "command",   "entrypoint", "restart",    "network_mode",  "working_dir",
+      "user",    "hostname", "privileged",  "read_only", "volumes",    "ports",      "depends_on",    "container_name"};
+  if (!isServiceName(name)) {
+    return "invalid service name";
+  }
+  const auto& service{services[name]};
+  if (!service.isObject()) {
+    return "invalid service definition";
+  }
+  for (const auto& key : service.getMemberNames()) {
+    if (supported_keys.count(key) == 0 && !isExtension(key)) {
+      return "service key `" + key + "`";
+    }
+  }
+  if (!service["image"].isString() || service["image"].asString().empty()) {
+    return "service without image";
+  }
+  if (!isImageReference(service["image"].asString())) {
+    return "invalid image reference `" + service["image"].asString() + "`";
+  }
+
+  const auto& labels{service["labels"]};
+  if (!labels.isNull() && !labels.isObject()) {
+    return "labels list";
+  }
+  for (const auto& label : labels) {
+    if (!label.isString()) {
+      return "non-string label value";
+    }
+  }
+
+  const auto& environment{service["environment"]};
+  if (environment.isArray()) {
+    for (const auto& var : environment) {
+      if (!var.isString() || var.asString().find('=') == std::string::npos) {
+        return "environment variable without value";
+      }
+      if (!isEnvName(var.asString().substr(0, var.asString().find('=')))) {
+        return "invalid environment variable name";
+      }
+    }
+  } else if (environment.isObject()) {
+    for (Json::ValueConstIterator ii = environment.begin(); ii != environment.end(); ++ii) {
+      if (!((*ii).isString() || (*ii).isNumeric() || (*ii).isBool())) {
+        return "environment variable without value";
+      }
+      if (!isEnvName(ii.name())) {
+        return "invalid environment variable name";
+      }
+    }
+  } else if (!environment.isNull()) {
+    return "invalid environment";
+  }
+
+  for (const auto& key : {"command", "entrypoint"}) {
+    if (service.isMember(key) && !isSimpleCommand(service[key])) {
+      return std::string(key) + " with quoting";
+    }
+  }
+  if (service.isMember("restart")) {
+    if (!service["restart"].isString()) {
+      return "restart policy `" + service["restart"].toStyledString() + "`";
+    }
+    const auto restart{service["restart"].asString()};
+    if (restart != "no" && restart != "always" && restart != "unless-stopped" && restart != "on-failure" &&
+        !(boost::starts_with(restart, "on-failure:") && isDigits(restart.substr(11)))) {
+      return "restart policy `" + restart + "`";
+    }
+  }
+  if (service.isMember("network_mode")) {
+    if (!service["network_mode"].isString()) {
+      return "network mode `" + service["network_mode"].toStyledString() + "`";
+    }
+    const auto mode{service["network_mode"].asString()};
+    if (mode != "host" && mode != "none" && mode != "bridge") {
+      return "network mode `" + mode + "`";
+    }
+  }
+  for (const auto& key : {"working_dir", "user", "hostname", "container_name"}) {
+    if (service.isMember(key) && !service[key].isString()) {
+      return std::string("non-string ") + key;
+    }
+  }
+  for (const auto& key : {"privileged", "read_only"}) {
+    if (service.isMember(key) && !service[key].isBool()) {
+      return std::string("non-boolean ") + key;
+    }
+  }
+  if (service.isMember("volumes")) {
+    if (!service["volumes"].isArray()) {
+      return "invalid volumes";
+    }
+    for (const auto& volume : service["volumes"]) {
+      if (!isBindVolume(volume)) {
+        return "volume `" + volume.toStyledString() + "`";
+      }
+    }
+  }
+  if (service.isMember("ports")) {
+    if (!service["ports"].isArray()) {
+      return "invalid ports";
+    }
+    for (const auto& port : service["ports"]) {
+      std::string host_ip;
+      std::string host_port;
+      std::string container_port;
+      if (!parsePort(port, host_ip, host_port, container_port)) {
+        return "port `" + port.toStyledString() + "`";
+      }
+    }
+  }
+  const auto& depends_on{service["depends_on"]};
+  if (depends_on.isObject()) {
+    for (const auto& dependency : depends_on) {
+      if (!dependency.isObject()) {
+        return "invalid depends_on";
+      }
+      const auto& condition{dependency["condition"]};
+      if (!condition.isNull() && (!condition.isString() || condition.asString() != "service_started")) {
+        return "dependency condition `" + (condition.isString() ? condition.asString() : condition.toStyledString()) +
+               "`";
+      }
+    }
+  } else if (depends_on.isArray()) {
+    for (const auto& dependency : depends_on) {
+      if (!dependency.isString()) {
+        return "invalid depends_on";
+      }
+    }
+  } else if (!depends_on.isNull()) {
+    return "invalid depends_on";
+  }
+  for (const auto& dependency : getDependencies(service)) {
+    if (!services.isMember(dependency)) {
+      return "dependency on unknown service `" + dependency + "`";
+    }
+  }
+  return "";
+}
+
+NativeCompose::NativeCompose(DockerClient::Ptr docker_client) : docker_client_{std::move(docker_client)} {}
+
+std::string NativeCompose::getUnsupportedFeature(const Json::Value& compose) {
+  if (!compose.isObject() || !compose["services"].isObject() || compose["services"].empty()) {
+    return "no services";
+  }
+  for (const auto& key : compose.getMemberNames()) {
+    if (key != "services" && key != "version" && !isExtension(key)) {
+      return "top-level key `" + key + "`";
+    }
+  }
+  // compose substitutes the variables with values of the environment and the `.env` file
+  if (containsVariable(compose)) {
+    return "variable interpolation";
+  }
+  const auto& services{compose["services"]};
+  for (const auto& name : services.getMemberNames()) {
+    const auto feature{getUnsupportedServiceFeature(services, name)};
+    if (!feature.empty()) {
+      return name + ": " + feature;
+    }
+  }
+  try {
+    getStartOrder(compose);
+  } catch (const std::exception& exc) {
+    return exc.what();
+  }
+  return "";
+}
+
+std::vector<std::string> NativeCompose::getStartOrder(const Json::Value& compose) {
+  const auto& services{compose["services"]};
+  std::vector<std::string> order;
+  std::set<std::string> visited;
+  std::set<std::string> in_progress;
+  std::function<void(const std::string&)> visit = [&](const std::string& name) {
+    if (visited.count(name) > 0) {
+      return;
+    }
+    if (!in_progress.emplace(name).second) {
+      throw std::invalid_argument("dependency cycle at service `" + name + "`");
+    }
+    for (const auto& dependency : getDependencies(services[name])) {
+      visit(dependency);
+    }
+    in_progress.erase(name);
+    visited.emplace(name);
+    order.push_back(name);
+  };
+  for (const auto& name : services.getMemberNames()) {
+    visit(name);
+  }
+  return order;
+}
+
+bool NativeCompose::areImagesPresent(const ComposeInfo& compose) {
+  for (const auto& service : compose.services()) {
+    if (!docker_client_->isImagePresent(service.image)) {
+      LOG_DEBUG << "Image of service " << service.name << " is not present in the docker store: " << service.image;
+      return false;
+    }
+  }
+  return true;
+}
+
+void NativeCompose::up(const std::string& project, const boost::filesystem::path& app_dir, const ComposeInfo& compose,
+                       bool start) {
+  const auto& services{compose.json()["services"]};
+
+  Json::Value containers;
+  docker_client_->getContainers(containers);
+  std::map<std::string, Container> existing;
+  std::map<std::string, Container> retained;
+  std::map<std::string, std::vector<std::string>> orphans;
+  for (const auto& container : containers) {
+    const auto& labels{container["Labels"]};
+    if (labels[ProjectLabel].asString() != project) {
+      continue;
+    }
+    const auto service{labels[ServiceLabel].asString()};
+    if (services.isMember(service)) {
+      // the names are listed with the leading slash
+      auto name{container["Names"][0].asString()};
+      if (name.empty()) {
+        name = getContainerName(project, service, services[service]);
+      } else if (boost::starts_with(name, "/")) {
+        name.erase(0, 1);
+      }
+      const Container found{container["Id"].asString(), name, labels[ConfigHashLabel].asString(),
+                            container["State"].asString()};
+      if (name == getContainerName(project, service, services[service]) + RetainedSuffix) {
+        retained[service] = found;
+      } else {
+        existing[service] = found;
+      }
+    } else {
+      orphans[service].push_back(container["Id"].asString());
+    }
+  }
+
+  // --remove-orphans
+  const auto remove_orphans = [&]() {
+    for (const auto& orphan : orphans) {
+      LOG_INFO << project << ": removing containers of the service which is not in the compose file: " << orphan.first;
+      for (const auto& id : orphan.second) {
+        docker_client_->stopContainer(id);
+      }
+      docker_client_->removeContainers({ProjectLabel + "=" + project, ServiceLabel + "=" + orphan.first});
+    }
+  };
+  // the orphans are kept until the switch-over succeeds, so they can be fallen back to as well
+  const bool switch_over{start && switch_over_};
+  if (!switch_over) {
+    remove_orphans();
+  }
+
+  const auto network{getNetworkName(project)};
+  const bool default_network{std::any_of(services.begin(), services.end(), usesDefaultNetwork)};
+  if (default_network && !docker_client_->isNetworkPresent(network)) {
+    Json::Value labels;
+    labels[ProjectLabel] = project;
+    labels["com.docker.compose.network"] = "default";
+    docker_client_->createNetwork(network, labels);
+  }
+
+  if (switch_over) {
+    switchOver(project, app_dir, compose, existing, retained);
+    remove_orphans();
+    return;
+  }
+
+  std::unordered_map<std::string, std::string> hashes;
+  for (const auto& service : compose.services()) {
+    hashes.emplace(service.name, service.hash);
+  }
+  for (const auto& service : getStartOrder(compose.json())) {
+    const auto& service_config{services[service]};
+    const auto found_it{existing.find(service)};
+    if (found_it != existing.end()) {
+      if (found_it->second.hash == hashes[service]) {
+        if (start && found_it->second.state != "running") {
+          docker_client_->startContainer(found_it->second.id);
+        }
+        continue;
+      }
+      // the service config has changed, the container is recreated
+      docker_client_->stopContainer(found_it->second.id);
+      docker_client_->removeContainers({ProjectLabel + "=" + project, ServiceLabel + "=" + service});
+    }
+
+    const auto name{getContainerName(project, service, service_config)};
+    LOG_DEBUG << project << ": creating container " << name;
+    const auto id{
+        docker_client_->createContainer(name, getContainerConfig(project, app_dir, service, service_config))};
+    if (start) {
+      docker_client_->startContainer(id);
+    }
+  }
+}
+
+void NativeCompose::switchOver(const std::string& project, const boost::filesystem::path& app_dir,
+                               const ComposeInfo& compose, const std::map<std::string, Container>& existing,
+                               const std::map<std::string, Container>& retained) {
+  struct Step {
+    std::string service;
+    std::string name;
+    std::string hash;
+    std::string id;
+    // the container of the previous version of the service, if any
+    const Container* old{nullptr};
+    // the retained container which is switched over to instead of a new one, if any
+    const Container* reused{nullptr};
+    bool switched{false};
+    bool renamed{false};
+  };
+  const auto& services{compose.json()["services"]};
+  std::unordered_map<std::string, std::string> hashes;
+  for (const auto& service : compose.services()) {
+    hashes.emplace(service.name, service.hash);
+  }
+  // just the containers of the given service version are removed, the stopped containers of its other version are kept
+  const auto remove_version = [this, &project](const std::string& service, const std::string& hash) {
+    docker_client_->removeContainers(
+        {ProjectLabel + "=" + project, ServiceLabel + "=" + service, ConfigHashLabel + "=" + hash});
+  };
+
+  std::vector<Step> steps;
+  try {
+    for (const auto& service : getStartOrder(compose.json())) {
+      Step step{service, getContainerName(project, service, services[service]), hashes[service]};
+      const auto found_it{existing.find(service)};
+      if (found_it != existing.end()) {
+        step.old = &found_it->second;
+        if (step.old->hash == step.hash) {
+          step.id = step.old->id;
+          steps.push_back(step);
+          continue;
+        }
+      }
+      // the new container of a changed service gets the temporary name as the old one still holds the name
+      const auto name{step.old != nullptr ? step.name + "-next" : step.name};
+      const auto retained_it{retained.find(service)};
+      if (retained_it != retained.end()) {
+        if (retained_it->second.hash == step.hash) {
+          // e.g. a rollback to the version the service has been switched over from
+          LOG_INFO << project << ": reusing the retained container of service " << service;
+          docker_client_->renameContainer(retained_it->second.id, name);
+          step.reused = &retained_it->second;
+          step.id = step.reused->id;
+          steps.push_back(step);
+          continue;
+        }
+        // the retained container of an older version gives up its name to the container being replaced
+        remove_version(service, retained_it->second.hash);
+      }
+      LOG_DEBUG << project << ": creating container " << name;
+      step.id = docker_client_->createContainer(name, getContainerConfig(project, app_dir, service, services[service]));
+      steps.push_back(step);
+    }
+  } catch (...) {
+    // nothing has been stopped yet, so just the new containers are removed and the reused ones are retained again
+    for (const auto& step : steps) {
+      if (step.reused != nullptr) {
+        docker_client_->renameContainer(step.id, step.name + RetainedSuffix);
+      } else if (step.old == nullptr || step.old->id != step.id) {
+        remove_version(step.service, step.hash);
+      }
+    }
+    throw;
+  }
+
+  try {
+    for (auto& step : steps) {
+      if (step.old == nullptr || step.old->id == step.id) {
+        // a new service or an unchanged one
+        if (step.old == nullptr || step.old->state != "running") {
+          docker_client_->startContainer(step.id);
+        }
+        continue;
+      }
+      LOG_INFO << project << ": switching service " << step.service << " over to its new container";
+      docker_client_->renameContainer(step.old->id, step.name + RetainedSuffix);
+      step.switched = true;
+      docker_client_->stopContainer(step.old->id);
+      docker_client_->renameContainer(step.id, step.name);
+      step.renamed = true;
+      docker_client_->startContainer(step.id);
+    }
+  } catch (const std::exception& exc) {
+    LOG_ERROR << project << ": failed to switch over to the new containers, switching back to the old ones; err: "
+              << exc.what();
+    for (auto step_it = steps.rbegin(); step_it != steps.rend(); ++step_it) {
+      const auto& step{*step_it};
+      try {
+        if (step.old != nullptr && step.old->id == step.id) {
+          continue;
+        }
+        docker_client_->stopContainer(step.id);
+        if (step.reused == nullptr) {
+          remove_version(step.service, step.hash);
+        } else if (step.renamed) {
+          // the reused container gets the retained name once the old one has given it up
+          docker_client_->renameContainer(step.id, step.name + "-next");
+        }
+        if (step.switched) {
+          docker_client_->renameContainer(step.old->id, step.old->name);
+          if (step.old->state == "running") {
+            docker_client_->startContainer(step.old->id);
+          }
+        }
+        if (step.reused != nullptr) {
+          docker_client_->renameContainer(step.id, step.name + RetainedSuffix);
+        }
+      } catch (const std::exception& fallback_exc) {
+        LOG_ERROR << project << ": failed to switch service " << step.service
+                  << " back to its old container; err: " << fallback_exc.what();
+      }
+    }
+    throw;
+  }
+
+  // all services have been switched over, the old containers are not needed anymore unless they are retained
+  if (!retain_previous_) {
+    for (const auto& step : steps) {
+      if (step.switched) {
+        remove_version(step.service, step.old->hash);
+      }
+    }
+  }
+}
+
+void NativeCompose::down(const std::string& project) {
+  Json::Value containers;
+  docker_client_->getContainers(containers);
+  for (const auto& container : containers) {
+    if (container["Labels"][ProjectLabel].asString() == project) {
+      const auto state{container["State"].asString()};
+      if (state != "exited" && state != "created" && state != "dead") {
+        docker_client_->stopContainer(container["Id"].asString());
+      }
+    }
+  }
+  docker_client_->removeContainers({ProjectLabel + "=" + project});
+  docker_client_->removeNetworks({ProjectLabel + "=" + project});
+}
+
+void NativeCompose::removeRetained(const std::string& project) {
+  Json::Value containers;
+  docker_client_->getContainers(containers);
+  for (const auto& container : containers) {
+    const auto& labels{container["Labels"]};
+    if (labels[ProjectLabel].asString() != project ||
+        !boost::ends_with(container["Names"][0].asString(), RetainedSuffix) ||
+        container["State"].asString() == "running") {
+      continue;
+    }
+    const auto service{labels[ServiceLabel].asString()};
+    LOG_INFO << project << ": removing the retained container of service " << service;
+    docker_client_->removeContainers({ProjectLabel + "=" + project, ServiceLabel + "=" + service,
+                                      ConfigHashLabel + "=" + labels[ConfigHashLabel].asString()});
+  }
+}
+
+std::string NativeCompose::getContainerName(const std::string& project, const std::string& service,
+                                            const Json::Value& service_config) {
+  return service_config.isMember("container_name") ? service_config["container_name"].asString()
+                                                   : project + "-" + service + "-1";
+}
+
+bool NativeCompose::usesDefaultNetwork(const Json::Value& service_config) {
+  return !service_config.isMember("network_mode");
+}
+
+Json::Value NativeCompose::getContainerConfig(const std::string& project, const boost::filesystem::path& app_dir,
+                                              const std::string& service, const Json::Value& service_config) const {
+  Json::Value config;
+  config["Image"] = service_config["image"];
+
+  Json::Value labels{service_config["labels"].isObject() ? service_config["labels"] : Json::Value(Json::objectValue)};
+  labels[ProjectLabel] = project;
+  labels[ServiceLabel] = service;
+  labels["com.docker.compose.container-number"] = "1";
+  labels["com.docker.compose.oneoff"] = "False";
+  labels["com.docker.compose.project.working_dir"] = app_dir.string();
+  if (retain_previous_) {
+    labels[NoPruneLabel] = "true";
+  }
+  config["Labels"] = labels;
+
+  const auto& environment{service_config["environment"]};
+  if (environment.isArray()) {
+    config["Env"] = environment;
+  } else if (environment.isObject()) {
+    for (const auto& var : environment.getMemberNames()) {
+      config["Env"].append(var + "=" + environment[var].asString());
+    }
+  }
+  if (service_config.isMember("command")) {
+    config["Cmd"] = toArgs(service_config["command"]);
+  }
+  if (service_config.isMember("entrypoint")) {
+    config["Entrypoint"] = toArgs(service_config["entrypoint"]);
+  }
+  if (service_config.isMember("working_dir")) {
+    config["WorkingDir"] = service_config["working_dir"];
+  }
+  if (service_config.isMember("user")) {
+    config["User"] = service_config["user"];
+  }
+  if (service_config.isMember("hostname")) {
+    config["Hostname"] = service_config["hostname"];
+  }
+
+  Json::Value host_config;
+  if (service_config.isMember("restart")) {
+    const auto restart{service_config["restart"].asString()};
+    const auto colon_pos{restart.find(':')};
+    host_config["RestartPolicy"]["Name"] = restart.substr(0, colon_pos);
+    if (colon_pos != std::string::npos) {
+      host_config["RestartPolicy"]["MaximumRetryCount"] = std::stoi(restart.substr(colon_pos + 1));
+    }
+  }
+  host_config["Privileged"] = service_config.get("privileged", false).asBool();
+  host_config["ReadonlyRootfs"] = service_config.get("read_only", false).asBool();
+  for (const auto& volume : service_config["volumes"]) {
+    std::vector<std::string> parts;
+    boost::split(parts, volume.asString(), boost::is_any_of(":"));
+    std::string bind{(app_dir / parts[0]).lexically_normal().string()};
+    if (boost::starts_with(parts[0], "/")) {
+      bind = parts[0];
+    }
+    for (std::size_t ii = 1; ii < parts.size(); ++ii) {
+      bind += ":" + parts[ii];
+    }
+    host_config["Binds"].append(bind);
+  }
+  for (const auto& port : service_config["ports"]) {
+    std::string host_ip;
+    std::string host_port;
+    std::string container_port;
+    parsePort(port, host_ip, host_port, container_port);
+    config["ExposedPorts"][container_port] = Json::Value(Json::objectValue);
+    Json::Value binding;
+    binding["HostIp"] = host_ip;
+    binding["HostPort"] = host_port;
+    host_config["PortBindings"][container_port].append(binding);
+  }
+
+  if (usesDefaultNetwork(service_config)) {
+    const auto network{getNetworkName(project)};
+    host_config["NetworkMode"] = network;
+    config["NetworkingConfig"]["EndpointsConfig"][network]["Aliases"].append(service);
+  } else {
+    host_config["NetworkMode"] = service_config["network_mode"];
+  }
+  config["HostConfig"] = host_config;
+  return config;
+}
+
+}  // namespace Docker
@@ -0,0 +1,90 @@
+#ifndef AKTUALIZR_LITE_NATIVE_COMPOSE_H_
+#define AKTUALIZR_LITE_NATIVE_COMPOSE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "docker/composeinfo.h"
+#include "docker/dockerclient.h"
+
+namespace Docker {
+
+/**
+ * @brief NativeCompose, brings Compose Apps up and down by means of the Docker Engine API instead of `docker compose`
+ *
+ * Just a subset of the compose specification is supported, the compose files using other features must be handled
+ * by `docker compose`, see `getUnsupportedFeature()`. The containers and networks are created the same way and
+ * labeled with the same labels as `docker compose` does, so the Apps brought up by either of them can be checked,
+ * updated and brought down by the other one.
+ *
+ * Supported service keys: image, labels (mapping), environment, command, entrypoint, restart, network_mode,
+ * working_dir, user, hostname, privileged, read_only, volumes (bind mounts), ports, depends_on (start order only),
+ * container_name and the `x-` extensions.
+ */
+class NativeCompose {
+ public:
+  static const std::string ProjectLabel;
+  static const std::string ServiceLabel;
+  static const std::string ConfigHashLabel;
+
+  explicit NativeCompose(DockerClient::Ptr docker_client);
+
+  // Returns an empty string if the given compose file can be brought up natively, otherwise the description of
+  // the first found feature which is not supported. The Apps brought up natively are not verified by
+  // `compose config`, so the type and format of each supported value of every service is checked as well, e.g. the
+  // image reference, the command and the environment variables.
+  static std::string getUnsupportedFeature(const Json::Value& compose);
+  // Returns the services in the order they are to be started in, i.e. each one follows the services it depends on
+  static std::vector<std::string> getStartOrder(const Json::Value& compose);
+
+  // Makes up() create the new containers of the changed services while the old ones keep running and then switch
+  // the services over to them one by one, see switchOver()
+  void setSwitchOver(bool switch_over) { switch_over_ = switch_over; }
+  // Makes the switch-over keep the old containers stopped under the `-prev` names instead of removing them, so the
+  // services can be switched back to them later, e.g. on a rollback, without creating them again. The containers
+  // are labeled so the docker store prune doesn't remove them, see removeRetained().
+  void setRetainPrevious(bool retain_previous) { retain_previous_ = retain_previous; }
+
+  bool areImagesPresent(const ComposeInfo& compose);
+  // The same as `docker compose up --remove-orphans [-d|--no-start]`, the containers which services' config hash
+  // has not changed are kept
+  void up(const std::string& project, const boost::filesystem::path& app_dir, const ComposeInfo& compose,
+          bool start);
+  // The same as `docker compose down`
+  void down(const std::string& project);
+  // Removes the containers of the given App retained by the switch-over, see setRetainPrevious()
+  void removeRetained(const std::string& project);
+
+ private:
+  struct Container {
+    std::string id;
+    std::string name;
+    std::string hash;
+    std::string state;
+  };
+
+  // Brings the given App up with the minimal downtime of its changed services. The new containers are created
+  // ahead under temporary names, then each changed service is switched over, i.e. its old container is renamed and
+  // stopped and the new one is renamed and started. The old containers are removed once all new ones have started,
+  // if any of them fails to start then all services are switched back to their old containers. A retained container
+  // of the target service version is switched over to instead of creating a new one.
+  void switchOver(const std::string& project, const boost::filesystem::path& app_dir, const ComposeInfo& compose,
+                  const std::map<std::string, Container>& existing, const std::map<std::string, Container>& retained);
+  Json::Value getContainerConfig(const std::string& project, const boost::filesystem::path& app_dir,
+                                 const std::string& service, const Json::Value& service_config) const;
+  static std::string getNetworkName(const std::string& project) { return project + "_default"; }
+  static std::string getContainerName(const std::string& project, const std::string& service,
+                                      const Json::Value& service_config);
+  static bool usesDefaultNetwork(const Json::Value& service_config);
+
+  DockerClient::Ptr docker_client_;
+  bool switch_over_{false};
+  bool retain_previous_{false};
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_NATIVE_COMPOSE_H_
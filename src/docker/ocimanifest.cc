@@ -0,0 +1,127 @@
+#include "ocimanifest.h"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "utilities/utils.h"
+
+namespace Docker {
+
+const std::size_t OciManifestCache::MaxEntries;
+
+ImageIndex::ImageIndex(const Json::Value& value) {
+  const auto& manifests_json{value["manifests"]};
+  if (!manifests_json.isArray()) {
+    throw std::invalid_argument("Invalid image index, missing or incorrect `manifests` field: " +
+                                Utils::jsonToCanonicalStr(value));
+  }
+  manifests.reserve(manifests_json.size());
+  for (const auto& manifest_json : manifests_json) {
+    manifests.emplace_back(manifest_json);
+  }
+}
+
+const Descriptor& ImageIndex::manifest() const {
+  if (manifests.empty()) {
+    throw std::invalid_argument("Invalid image index, no manifest is listed");
+  }
+  return manifests.front();
+}
+
+const Descriptor* ImageIndex::find(const std::string& arch, const std::string& os) const {
+  for (const auto& manifest : manifests) {
+    // the os is optional in the manifest lists of some registries
+    if (manifest.architecture == arch && (manifest.os.empty() ? "linux" : manifest.os) == os) {
+      return &manifest;
+    }
+  }
+  return nullptr;
+}
+
+static const Json::Value& getConfigDescriptor(const Json::Value& value) {
+  if (!value.isObject() || !value["layers"].isArray()) {
+    throw std::invalid_argument("Invalid image manifest, missing or incorrect `layers` field: " +
+                                Utils::jsonToCanonicalStr(value));
+  }
+  return value["config"];
+}
+
+ImageManifest::ImageManifest(const Json::Value& value)
+    : mediaType{value.get("mediaType", "").asString()}, config{getConfigDescriptor(value)} {
+  const auto& layers_json{value["layers"]};
+  layers.reserve(layers_json.size());
+  for (const auto& layer_json : layers_json) {
+    layers.emplace_back(layer_json);
+  }
+}
+
+OciManifestCache& OciManifestCache::instance() {
+  static OciManifestCache cache;
+  return cache;
+}
+
+std::shared_ptr<const ImageIndex> OciManifestCache::imageIndex(const boost::filesystem::path& image_dir) {
+  return get<ImageIndex>(image_dir / "index.json");
+}
+
+std::shared_ptr<const ImageManifest> OciManifestCache::imageManifest(const boost::filesystem::path& blobs_dir,
+                                                                     const HashedDigest& digest) {
+  return get<ImageManifest>(blobs_dir / digest.hash());
+}
+
+void OciManifestCache::clear() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  entries_.clear();
+  order_.clear();
+}
+
+void OciManifestCache::setMaxEntries(std::size_t max_entries) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  max_entries_ = std::max<std::size_t>(max_entries, 1);
+  while (order_.size() > max_entries_) {
+    entries_.erase(order_.front());
+    order_.pop_front();
+  }
+}
+
+OciManifestCache::FileStat OciManifestCache::getFileStat(const boost::filesystem::path& path) {
+  struct stat st {};
+  if (::stat(path.c_str(), &st) != 0) {
+    throw std::runtime_error("Failed to read " + path.string() + ": " + std::strerror(errno));
+  }
+  FileStat stat{};
+  stat.size = static_cast<uint64_t>(st.st_size);
+  stat.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  stat.inode = static_cast<uint64_t>(st.st_ino);
+  return stat;
+}
+
+template <typename T>
+std::shared_ptr<const T> OciManifestCache::get(const boost::filesystem::path& path) {
+  const auto stat{getFileStat(path)};
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    const auto entry_it{entries_.find(path.string())};
+    if (entry_it != entries_.end() && entry_it->second.stat == stat) {
+      return std::static_pointer_cast<const T>(entry_it->second.value);
+    }
+  }
+
+  // parsed without holding the lock, concurrent callers may parse the same file, the last one wins
+  auto value{std::make_shared<const T>(Utils::parseJSONFile(path))};
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& entry{entries_[path.string()]};
+  if (!entry.value) {
+    order_.emplace_back(path.string());
+  }
+  entry = {stat, value};
+  while (order_.size() > max_entries_) {
+    entries_.erase(order_.front());
+    order_.pop_front();
+  }
+  return value;
+}
+
+}  // namespace Docker
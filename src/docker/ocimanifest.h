@@ -0,0 +1,94 @@
+#ifndef AKTUALIZR_LITE_OCI_MANIFEST_H_
+#define AKTUALIZR_LITE_OCI_MANIFEST_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "docker/docker.h"
+
+namespace Docker {
+
+// An image index or a manifest list, either received from Registry or the index.json of an OCI image layout
+// https://github.com/opencontainers/image-spec/blob/main/image-index.md
+struct ImageIndex {
+  // Throws std::invalid_argument if the index or one of its descriptors is invalid
+  explicit ImageIndex(const Json::Value& value);
+
+  // The first manifest, an image layout stored by `skopeo` or the image puller includes just one manifest
+  const Descriptor& manifest() const;
+  // The manifest of the given platform, nullptr if there is no such one
+  const Descriptor* find(const std::string& arch, const std::string& os = "linux") const;
+
+  std::vector<Descriptor> manifests;
+};
+
+// https://github.com/opencontainers/image-spec/blob/main/manifest.md
+struct ImageManifest {
+  // Throws std::invalid_argument if the manifest or one of its descriptors is invalid
+  explicit ImageManifest(const Json::Value& value);
+
+  std::string mediaType;
+  Descriptor config;
+  std::vector<Descriptor> layers;
+};
+
+/**
+ * @brief OciManifestCache, a process-wide cache of the parsed image indexes and manifests stored on disk.
+ *
+ * The image manifests are looked up by their digest in a blob dir, and the indexes by their image layout dir.
+ * An entry is reused as long as the size, modification time and inode of its file are the same as they were at
+ * the moment of parsing, so the file content is read, parsed and validated just once. All methods are thread-safe,
+ * and throw if a file is missing or invalid.
+ */
+class OciManifestCache {
+ public:
+  static const std::size_t MaxEntries{1024};
+
+  static OciManifestCache& instance();
+
+  // The index.json of the OCI image layout stored in the given dir
+  std::shared_ptr<const ImageIndex> imageIndex(const boost::filesystem::path& image_dir);
+  // The image manifest stored in the given blob dir, i.e. <blobs_dir>/<digest hash>
+  std::shared_ptr<const ImageManifest> imageManifest(const boost::filesystem::path& blobs_dir,
+                                                     const HashedDigest& digest);
+  void clear();
+  // Limits the number of the cached entries, e.g. to keep the memory usage low, the oldest ones are dropped
+  void setMaxEntries(std::size_t max_entries);
+
+ private:
+  struct FileStat {
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t inode;
+
+    bool operator==(const FileStat& other) const {
+      return size == other.size && mtime_ns == other.mtime_ns && inode == other.inode;
+    }
+  };
+  struct Entry {
+    FileStat stat;
+    std::shared_ptr<const void> value;
+  };
+
+  OciManifestCache() = default;
+  static FileStat getFileStat(const boost::filesystem::path& path);
+  template <typename T>
+  std::shared_ptr<const T> get(const boost::filesystem::path& path);
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::size_t max_entries_{MaxEntries};
+  // the insertion order, the oldest entries are dropped once there are more than `max_entries_` of them
+  std::deque<std::string> order_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_OCI_MANIFEST_H_
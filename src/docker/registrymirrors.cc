@@ -0,0 +1,118 @@
+#include "registrymirrors.h"
+
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+
+namespace Docker {
+
+const int RegistryMirrors::FailureBackoffSec;
+const int RegistryMirrors::MaxBackoffSec;
+constexpr double RegistryMirrors::LatencyWeight;
+
+RegistryMirrors::RegistryMirrors(const std::string& spec) {
+  std::vector<std::string> registries;
+  boost::split(registries, spec, boost::is_any_of(";"), boost::token_compress_on);
+  for (auto registry_spec : registries) {
+    boost::trim(registry_spec);
+    if (registry_spec.empty()) {
+      continue;
+    }
+    const auto pos{registry_spec.find('=')};
+    if (pos == std::string::npos || pos == 0) {
+      throw std::invalid_argument("Invalid registry mirrors, expected <registry>=<mirror>[,<mirror>...], got " +
+                                  registry_spec);
+    }
+    const auto registry{boost::trim_copy(registry_spec.substr(0, pos))};
+    std::vector<std::string> mirrors;
+    boost::split(mirrors, registry_spec.substr(pos + 1), boost::is_any_of(", "), boost::token_compress_on);
+    mirrors.erase(std::remove(mirrors.begin(), mirrors.end(), ""), mirrors.end());
+    mirrors.erase(std::remove(mirrors.begin(), mirrors.end(), registry), mirrors.end());
+    if (mirrors.empty()) {
+      throw std::invalid_argument("Invalid registry mirrors, no mirror of " + registry + " is specified");
+    }
+    auto& registry_mirrors{mirrors_[registry]};
+    for (const auto& mirror : mirrors) {
+      if (std::find(registry_mirrors.begin(), registry_mirrors.end(), mirror) == registry_mirrors.end()) {
+        registry_mirrors.emplace_back(mirror);
+      }
+    }
+  }
+}
+
+bool RegistryMirrors::isMirror(const std::string& host) const {
+  return std::any_of(mirrors_.begin(), mirrors_.end(), [&host](const decltype(mirrors_)::value_type& registry) {
+    return std::find(registry.second.begin(), registry.second.end(), host) != registry.second.end();
+  });
+}
+
+std::vector<std::string> RegistryMirrors::getHosts(const std::string& registry) const {
+  std::vector<std::string> hosts;
+  const auto mirrors_it{mirrors_.find(registry)};
+  if (mirrors_it != mirrors_.end()) {
+    const auto now{Clock::now()};
+    std::unordered_map<std::string, double> latencies;
+    std::lock_guard<std::mutex> lock{mutex_};
+    for (const auto& mirror : mirrors_it->second) {
+      const auto health_it{health_.find(mirror)};
+      if (health_it == health_.end()) {
+        latencies[mirror] = -1;
+      } else if (health_it->second.backoff_until <= now) {
+        latencies[mirror] = health_it->second.latency_sec;
+      } else {
+        continue;
+      }
+      hosts.emplace_back(mirror);
+    }
+    // the configured order is kept for the mirrors of the same latency, e.g. the ones that have not been used yet
+    std::stable_sort(hosts.begin(), hosts.end(), [&latencies](const std::string& lhs, const std::string& rhs) {
+      return latencies.at(lhs) < latencies.at(rhs);
+    });
+  }
+  hosts.emplace_back(registry);
+  return hosts;
+}
+
+void RegistryMirrors::send(const std::string& registry, const Request& request, bool track_latency) {
+  for (const auto& host : getHosts(registry)) {
+    if (host == registry) {
+      request(host);
+      return;
+    }
+    const auto started_at{Clock::now()};
+    try {
+      request(host);
+      reportSuccess(host, track_latency ? Clock::now() - started_at : Clock::duration::zero());
+      return;
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Request to registry mirror " << host << " failed, trying the next one; " << exc.what();
+      reportFailure(host);
+    }
+  }
+}
+
+void RegistryMirrors::reportSuccess(const std::string& mirror, Clock::duration latency) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& health{health_[mirror]};
+  health.failures = 0;
+  health.backoff_until = {};
+  if (latency > Clock::duration::zero()) {
+    const auto latency_sec{std::chrono::duration<double>(latency).count()};
+    health.latency_sec =
+        health.latency_sec < 0 ? latency_sec : LatencyWeight * latency_sec + (1 - LatencyWeight) * health.latency_sec;
+  }
+}
+
+void RegistryMirrors::reportFailure(const std::string& mirror) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& health{health_[mirror]};
+  const auto backoff_sec{std::min(MaxBackoffSec, FailureBackoffSec << std::min(health.failures, 16U))};
+  ++health.failures;
+  health.backoff_until = Clock::now() + std::chrono::seconds(backoff_sec);
+  LOG_INFO << "Registry mirror " << mirror << " is not used for " << backoff_sec << " seconds after "
+           << health.failures << " failure(s)";
+}
+
+}  // namespace Docker
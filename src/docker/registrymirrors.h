@@ -0,0 +1,68 @@
+#ifndef AKTUALIZR_LITE_REGISTRY_MIRRORS_H_
+#define AKTUALIZR_LITE_REGISTRY_MIRRORS_H_
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Docker {
+
+/**
+ * @brief RegistryMirrors, the pull-through mirrors of the registries and their health.
+ *
+ * The manifests, blobs and images of a registry are requested from its mirrors first, and from the registry itself
+ * if none of the mirrors has served the request. The mirrors are tried in the order of their latency, the average of
+ * the recent requests, a mirror that has not been used yet goes first, in the configured order. A failed mirror is
+ * not used for `FailureBackoffSec`, the period doubles with each subsequent failure up to `MaxBackoffSec` and it is
+ * reset by a success. All methods are thread-safe.
+ */
+class RegistryMirrors {
+ public:
+  using Ptr = std::shared_ptr<RegistryMirrors>;
+  using Clock = std::chrono::steady_clock;
+  // Sends a request to the given host, throws if the request fails
+  using Request = std::function<void(const std::string&)>;
+
+  static const int FailureBackoffSec{30};
+  static const int MaxBackoffSec{3600};
+  // the weight of the last request latency in the average one
+  static constexpr double LatencyWeight{0.3};
+
+  // `spec` lists the mirrors of each registry, `<registry>=<mirror>[,<mirror>...][;<registry>=...]`,
+  // e.g. `hub.foundries.io=mirror.local:5000`, throws std::invalid_argument if it is malformed
+  explicit RegistryMirrors(const std::string& spec);
+
+  bool empty() const { return mirrors_.empty(); }
+  // Whether the given host is a mirror of any registry
+  bool isMirror(const std::string& host) const;
+  // The healthy mirrors of the given registry in the order they should be tried in, followed by the registry itself
+  std::vector<std::string> getHosts(const std::string& registry) const;
+  // Sends the request to the hosts returned by getHosts() one by one until it succeeds, the outcome and, if
+  // `track_latency` is set, the duration of each request is recorded as the mirror health. The failure of the request
+  // sent to the registry itself is rethrown.
+  void send(const std::string& registry, const Request& request, bool track_latency = false);
+
+  void reportSuccess(const std::string& mirror, Clock::duration latency = Clock::duration::zero());
+  void reportFailure(const std::string& mirror);
+
+ private:
+  struct Health {
+    // the average latency in seconds, negative if it has not been measured yet
+    double latency_sec{-1};
+    unsigned int failures{0};
+    Clock::time_point backoff_until;
+  };
+
+  // registry -> its mirrors, in the configured order
+  std::unordered_map<std::string, std::vector<std::string>> mirrors_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Health> health_;
+};
+
+}  // namespace Docker
+
+#endif  // AKTUALIZR_LITE_REGISTRY_MIRRORS_H_
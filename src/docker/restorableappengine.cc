@@ -1,18 +1,40 @@
 #include "restorableappengine.h"
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <functional>
 #include <limits>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/join.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/process.hpp>
 
+#include "apparchive.h"
 #include "crypto/crypto.h"
 #include "docker/composeappengine.h"
 #include "docker/composeinfo.h"
+#include "docker/ocimanifest.h"
 #include "exec.h"
+#include "resourcecontrol.h"
+#include "updatetrace.h"
 
 namespace Docker {
 
@@ -21,10 +43,15 @@ class InsufficientSpaceError : public std::runtime_error {
   InsufficientSpaceError(const std::string& store, const std::string& path, const uint64_t& required,
                          const uint64_t& available)
       : std::runtime_error("Insufficient storage available; store: " + store + ", path: " + path +
-                           ", required: " + std::to_string(required) + ", available: " + std::to_string(available)) {}
+                           ", required: " + std::to_string(required) + ", available: " + std::to_string(available)),
+        store_path{path} {}
+
+  const std::string store_path;
 };
 
 const std::string RestorableAppEngine::ComposeFile{"docker-compose.yml"};
+const std::string RestorableAppEngine::LayerUsageField{"usage"};
+const std::string RestorableAppEngine::LayerDeltasField{"deltas"};
 
 RestorableAppEngine::StorageSpaceFunc RestorableAppEngine::GetDefStorageSpaceFunc(int watermark) {
   const int low_watermark_limit{LowWatermarkLimit};
@@ -57,7 +84,7 @@ RestorableAppEngine::RestorableAppEngine(boost::filesystem::path store_root, boo
                                          Docker::DockerClient::Ptr docker_client, std::string client,
                                          std::string docker_host, std::string compose_cmd,
                                          StorageSpaceFunc storage_space_func, ClientImageSrcFunc client_image_src_func,
-                                         bool create_containers_if_install)
+                                         bool create_containers_if_install, ImagePuller::Ptr image_puller)
     : store_root_{std::move(store_root)},
       install_root_{std::move(install_root)},
       docker_root_{std::move(docker_root)},
@@ -69,11 +96,18 @@ RestorableAppEngine::RestorableAppEngine(boost::filesystem::path store_root, boo
       docker_client_{std::move(docker_client)},
       storage_space_func_{std::move(storage_space_func)},
       client_image_src_func_{std::move(client_image_src_func)},
-      create_containers_if_install_{create_containers_if_install} {
+      create_containers_if_install_{create_containers_if_install},
+      image_puller_{std::move(image_puller)} {
   boost::filesystem::create_directories(apps_root_);
   boost::filesystem::create_directories(blobs_root_);
 }
 
+RestorableAppEngine::~RestorableAppEngine() {
+  if (docker_prune_thread_.joinable()) {
+    docker_prune_thread_.join();
+  }
+}
+
 AppEngine::Result RestorableAppEngine::fetch(const App& app) {
   Result res{false};
   boost::filesystem::path app_dir;
@@ -82,21 +116,35 @@ AppEngine::Result RestorableAppEngine::fetch(const App& app) {
     app_dir = apps_root_ / uri.app / uri.digest.hash();
     const auto app_compose_file{app_dir / ComposeFile};
 
-    if (!isAppFetched(app)) {
-      LOG_INFO << app.name << ": downloading App from Registry: " << app.uri << " --> " << app_dir;
-      pullApp(uri, app_dir);
-    } else {
-      LOG_INFO << app.name << ": App already fetched: " << app_dir;
+    bool planned{false};
+    {
+      std::lock_guard<std::mutex> lock{fetch_plan_mutex_};
+      planned = fetch_plan_.erase(uri.app + "/" + uri.digest.hash()) > 0;
     }
+    if (planned) {
+      LOG_INFO << app.name << ": App has been fetched and its size has been checked along with the other Apps";
+    } else {
+      if (isAppStepJournaled(uri, app_dir)) {
+        LOG_INFO << app.name << ": App has been fetched by a previous attempt: " << app_dir;
+      } else if (!isAppFetched(app)) {
+        LOG_INFO << app.name << ": downloading App from Registry: " << app.uri << " --> " << app_dir;
+        pullApp(uri, app_dir);
+      } else {
+        LOG_INFO << app.name << ": App already fetched: " << app_dir;
+      }
+      fetch_journal_.setDone(uri.app + "/" + uri.digest.hash(), FetchJournal::AppStep);
 
-    // check App size
-    checkAppUpdateSize(uri, app_dir);
+      // check App size
+      checkAppUpdateSize(uri, app_dir);
+    }
 
     // Invoke download of App images unconditionally because `skopeo` is supposed
     // to skip already downloaded image blobs internally while performing `copy` command
     const auto images_dir{app_dir / "images"};
+    applyLayerDeltas(uri, app_dir);
     LOG_DEBUG << app.name << ": downloading App images from Registry(ies): " << app.uri << " --> " << images_dir;
     pullAppImages(uri, app_compose_file, images_dir);
+    accountAppBlobs(uri, app_dir);
     res = true;
   } catch (const InsufficientSpaceError& exc) {
     res = {Result::ID::InsufficientSpace, exc.what()};
@@ -104,30 +152,252 @@ AppEngine::Result RestorableAppEngine::fetch(const App& app) {
     res = {false, exc.what()};
   }
 
+  if (!app_dir.empty()) {
+    blob_index_.release(app_dir.parent_path().filename().string() + "/" + app_dir.filename().string());
+  }
   if (!res) {
-    if (boost::filesystem::exists(app_dir)) {
-      boost::filesystem::remove_all(app_dir);
+    // a failed fetch might have left some blobs downloaded, let the index find them
+    blob_index_.invalidate();
+    if (!app_dir.empty()) {
+      // the App version is not accounted until its fetch completes, the next prune rescans the store to find
+      // the blobs it has brought
+      blob_refs_.remove(app_dir.parent_path().filename().string() + "/" + app_dir.filename().string());
+      blob_refs_.flush();
+    }
+    if (boost::filesystem::exists(app_dir) &&
+        !fetch_journal_.isDone(app_dir.parent_path().filename().string() + "/" + app_dir.filename().string(),
+                               FetchJournal::AppStep)) {
+      // keep a partially downloaded App archive so the next fetch attempt resumes its download, the fetched App
+      // archive, manifest and images are kept as recorded by the fetch journal
+      for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(app_dir), {})) {
+        if (entry.path().extension() != RegistryClient::PartFileExt) {
+          boost::filesystem::remove_all(entry.path());
+        }
+      }
+    }
+  }
+  return res;
+}
+
+AppEngine::Result RestorableAppEngine::fetchDeferredImages(const Apps& apps) {
+  if (!in_place_image_src_) {
+    return true;
+  }
+  Result res{true};
+  // the image transfer utility inherits the priority of the thread it is run by
+  ResourceControl::LowPriorityScope low_priority;
+  for (const auto& app : apps) {
+    try {
+      const Uri uri{Uri::parseUri(app.uri)};
+      const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
+      if (!boost::filesystem::exists(app_dir / ComposeFile)) {
+        // the App has not been fetched, e.g. it is not in the App shortlist
+        continue;
+      }
+      LOG_INFO << app.name << ": copying App images into the store: " << app_dir;
+      pullAppImages(uri, app_dir / ComposeFile, app_dir / "images", false);
+      accountAppBlobs(uri, app_dir);
+    } catch (const std::exception& exc) {
+      blob_index_.invalidate();
+      res = {false, app.name + ": failed to copy App images into the store: " + exc.what()};
     }
   }
   return res;
 }
 
+AppEngine::Result RestorableAppEngine::planFetch(const Apps& apps) {
+  {
+    // drop a plan left by a previous Target fetch that has not been completed
+    std::lock_guard<std::mutex> lock{fetch_plan_mutex_};
+    for (const auto& owner : fetch_plan_) {
+      blob_index_.release(owner);
+    }
+    fetch_plan_.clear();
+    fetch_plan_blobs_.clear();
+  }
+
+  // the plan is the set of the App versions, so it is the same for each attempt to fetch the Apps of a Target
+  std::set<std::string> plan;
+  for (const auto& app : apps) {
+    plan.emplace(app.uri);
+  }
+  fetch_journal_.begin(boost::algorithm::join(plan, ","));
+
+  std::vector<std::string> owners(apps.size());
+  std::vector<std::unordered_map<std::string, BlobIndex::BlobSize>> missing_blobs(apps.size());
+  std::vector<std::set<std::string>> layers(apps.size());
+  std::vector<bool> checkable(apps.size(), false);
+  std::atomic<std::size_t> next{0};
+  std::mutex err_mutex;
+  Result res{true};
+
+  // stage 1: download Apps' manifests and archives, and find the layers each App misses
+  const auto resolve = [&]() {
+    for (auto ii = next++; ii < apps.size(); ii = next++) {
+      const auto& app{apps[ii]};
+      try {
+        const Uri uri{Uri::parseUri(app.uri)};
+        const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
+        owners[ii] = uri.app + "/" + uri.digest.hash();
+        if (!isAppStepJournaled(uri, app_dir) && !isAppFetched(app)) {
+          LOG_INFO << app.name << ": downloading App from Registry: " << app.uri << " --> " << app_dir;
+          pullApp(uri, app_dir);
+        }
+        fetch_journal_.setDone(owners[ii], FetchJournal::AppStep);
+        checkable[ii] = getAppMissingBlobs(uri, app_dir, missing_blobs[ii], &layers[ii]);
+      } catch (const InsufficientSpaceError& exc) {
+        std::lock_guard<std::mutex> lock{err_mutex};
+        if (res) {
+          res = {Result::ID::InsufficientSpace, app.name + ": failed to fetch App metadata: " + exc.what()};
+        }
+      } catch (const std::exception& exc) {
+        std::lock_guard<std::mutex> lock{err_mutex};
+        if (res) {
+          res = {false, app.name + ": failed to fetch App metadata: " + exc.what()};
+        }
+      }
+    }
+  };
+  const auto worker_numb{std::min(static_cast<std::size_t>(std::max(fetch_concurrency_, 1)), apps.size())};
+  std::vector<std::thread> workers;
+  for (std::size_t ii = 1; ii < worker_numb; ++ii) {
+    workers.emplace_back(resolve);
+  }
+  resolve();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  if (!res) {
+    return res;
+  }
+
+  {
+    // the layers found present in the store are not fetched, so an eviction must not remove them
+    std::lock_guard<std::mutex> lock{fetch_plan_mutex_};
+    for (const auto& app_layers : layers) {
+      fetch_plan_blobs_.insert(app_layers.begin(), app_layers.end());
+    }
+  }
+
+  // stage 2: a single decision whether the missing layers of all Apps fit, the shared layers are counted once
+  BlobIndex::BlobSize total_update_size;
+  bool checkable_apps{false};
+  for (std::size_t ii = 0; ii < apps.size(); ++ii) {
+    if (checkable[ii]) {
+      total_update_size = blob_index_.reserve(owners[ii], missing_blobs[ii]);
+      checkable_apps = true;
+    }
+  }
+  try {
+    if (checkable_apps) {
+      LOG_INFO << "Checking if there is sufficient amount of storage available for " << apps.size() << " Apps...";
+      checkAvailableStorageOrEvict("Apps", total_update_size.size, total_update_size.usage,
+                                   {owners.begin(), owners.end()});
+    }
+  } catch (const InsufficientSpaceError& exc) {
+    res = {Result::ID::InsufficientSpace, exc.what()};
+  } catch (const std::exception& exc) {
+    res = {false, exc.what()};
+  }
+  if (!res) {
+    for (const auto& owner : owners) {
+      blob_index_.release(owner);
+    }
+    return res;
+  }
+
+  // stage 3 is done by the Apps' fetches which pull the Apps' images, concurrently
+  std::lock_guard<std::mutex> lock{fetch_plan_mutex_};
+  fetch_plan_.insert(owners.begin(), owners.end());
+  return res;
+}
+
+AppEngine::Result RestorableAppEngine::estimateFetch(const Apps& apps, FetchCost& cost) const {
+  try {
+    std::unordered_map<std::string, BlobIndex::BlobSize> missing_blobs;
+    // the missing layers that can be reconstructed from a layer present in the store -> their delta size
+    std::unordered_map<std::string, uint64_t> delta_sizes;
+    uint64_t store_size{0};
+    for (const auto& app : apps) {
+      const Uri uri{Uri::parseUri(app.uri)};
+      const auto manifest_file{apps_root_ / uri.app / uri.digest.hash() / Manifest::Filename};
+      // the manifest is stored once the App archive has been downloaded
+      const bool is_app_pulled{boost::filesystem::exists(manifest_file)};
+      const Manifest manifest{is_app_pulled ? Utils::readFile(manifest_file)
+                                            : registry_client_->getAppManifest(uri, Manifest::Format)};
+      if (!is_app_pulled) {
+        cost.archive_size += manifest.archiveSize();
+        store_size += manifest.archiveSize();
+      }
+
+      const auto layers{getAppLayers(uri, manifest)};
+      if (layers.isNull()) {
+        LOG_WARNING << app.name << ": App layers' manifest is missing, the App layers' size is unknown";
+        cost.exact = false;
+        continue;
+      }
+      getAppUpdateSize(layers, blob_index_, missing_blobs);
+      for (const auto& layer : layers) {
+        for (const auto& delta : layer[LayerDeltasField]) {
+          if (blob_index_.isPresent(HashedDigest(delta["from"].asString()).hash()) && delta["size"].isUInt64()) {
+            delta_sizes.emplace(HashedDigest(layer["digest"].asString()).hash(), delta["size"].asUInt64());
+            break;
+          }
+        }
+      }
+    }
+    for (const auto& blob : missing_blobs) {
+      const auto delta_it{delta_sizes.find(blob.first)};
+      cost.layer_size += delta_it != delta_sizes.end() ? delta_it->second : blob.second.size;
+      cost.store_growth += blob.second.usage;
+      // a reconstructed layer takes as much of the store as a downloaded one
+      store_size += blob.second.size;
+    }
+
+    const auto get_shortfall = [this](uint64_t required, const boost::filesystem::path& store_path) -> uint64_t {
+      boost::uintmax_t capacity;
+      boost::uintmax_t available;
+      std::tie(capacity, available) = storage_space_func_(store_path);
+      const auto reserved{getReservedStorage(store_path)};
+      available = available > reserved ? available - reserved : 0;
+      return required > available ? required - available : 0;
+    };
+    cost.shortfall = std::max(get_shortfall(store_size, store_root_), get_shortfall(cost.store_growth, docker_root_));
+    if (docker_and_skopeo_same_volume_) {
+      cost.shortfall = std::max(cost.shortfall, get_shortfall(store_size + cost.store_growth, store_root_));
+    }
+    LOG_INFO << "Fetch cost of " << apps.size() << " Apps: archives: " << cost.archive_size
+             << " bytes, layers: " << cost.layer_size << " bytes, docker store growth: " << cost.store_growth
+             << " bytes, storage shortfall: " << cost.shortfall << " bytes";
+  } catch (const std::exception& exc) {
+    return {false, exc.what()};
+  }
+  return true;
+}
+
 AppEngine::Result RestorableAppEngine::verify(const App& app) {
   Result res{true};
   try {
     const Uri uri{Uri::parseUri(app.uri)};
     const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
     const Manifest manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)};
-    const auto archive_full_path{app_dir / (HashedDigest(manifest.archiveDigest()).hash() + Manifest::ArchiveExt)};
-    TemporaryDirectory app_tmp_dir;
-
-    // extract the compose file (i.e. docker-compose.yml) to a temporary directory to verify it.
-    exec(boost::format{"tar -xzf %s %s"} % archive_full_path % ComposeFile, "no compose file found in archive",
-         boost::process::start_dir = app_tmp_dir.Path());
-
-    LOG_DEBUG << app.name << ": verifying App: " << app_dir << " --> " << app_tmp_dir.Path();
-    exec(boost::format("%s config %s") % compose_cmd_ % "-q", "compose file verification failed",
-         boost::process::start_dir = app_tmp_dir.Path());
+    const auto archive_full_path{app_dir / (HashedDigest(manifest.archiveDigest()).hash() + manifest.archiveExt())};
+
+    // read the compose file (i.e. docker-compose.yml) from the archive and pass it to `compose config` via stdin
+    const auto compose_file{AppArchive(archive_full_path).readFile(ComposeFile)};
+    ComposeInfo::loadContent(compose_file);
+
+    const auto archive_hash{HashedDigest(manifest.archiveDigest()).hash()};
+    if (compose_verify_cache_.isVerified(archive_hash)) {
+      LOG_DEBUG << app.name << ": App has been verified already: " << app_dir;
+    } else if (getNativeCompose(app.name, compose_file) == nullptr) {
+      // the compose file of an App brought up natively is verified by the native compose check, it is not cached
+      // as verified since the App is verified by `compose config` if the native compose gets disabled
+      LOG_DEBUG << app.name << ": verifying App: " << app_dir;
+      exec(boost::format("%s -f - config %s") % compose_cmd_ % "-q", "compose file verification failed",
+           boost::process::std_in < boost::asio::buffer(compose_file), boost::process::start_dir = app_dir);
+      compose_verify_cache_.setVerified(archive_hash);
+    }
   } catch (const std::exception& exc) {
     LOG_ERROR << "failed to verify App; app: " + app.name + "; uri: " + app.uri + "; err: " + exc.what();
     res = {false, exc.what()};
@@ -163,23 +433,37 @@ AppEngine::Result RestorableAppEngine::installAndCreateOrRunContainers(const App
     res = {false, exc.what()};
   }
 
+  const auto app_install_root{install_root_ / app.name};
+  ComposeInfo::Ptr native_compose;
+  try {
+    native_compose = getNativeCompose(app.name, Utils::readFile(app_install_root / ComposeFile));
+  } catch (const std::exception& exc) {
+    LOG_WARNING << app.name << ": failed to check whether the App can be brought up natively: " << exc.what();
+  }
+
   try {
-    const auto app_install_root{install_root_ / app.name};
     // Make the docker store aware about the app images by invoking `docker compose pull` command.
     // The command fetches just image manifests since `installAppAndImages` injects all image data
     // to the docker store. The goal is to update the docker store map (`repositories.json`) between
     // image URIs and internal image represntation's hash.
     // If the pull fails then `ImagePullFailure` error is returned so the client can distnguish it from
     // the other image install/run errors and keep trying to install/run App containers.
-    pullComposeAppImages(compose_cmd_, app_install_root);
+    // The pull is not needed if the App is brought up natively and all its images are already known to the docker
+    // store by their URIs.
+    if (native_compose == nullptr || !native_compose_->areImagesPresent(*native_compose)) {
+      pullComposeAppImages(compose_cmd_, app_install_root);
+    }
   } catch (const std::exception& exc) {
     return {Result::ID::ImagePullFailure, exc.what()};
   }
 
   try {
-    const auto app_install_root{install_root_ / app.name};
-    const std::string flags{run ? "--remove-orphans -d" : "--remove-orphans --no-start"};
-    startComposeApp(compose_cmd_, app_install_root, flags);
+    if (native_compose != nullptr) {
+      native_compose_->up(app.name, app_install_root, *native_compose, run);
+    } else {
+      const std::string flags{run ? "--remove-orphans -d" : "--remove-orphans --no-start"};
+      startComposeApp(compose_cmd_, app_install_root, flags);
+    }
     res = true;
   } catch (const std::exception& exc) {
     res = {false, exc.what()};
@@ -204,6 +488,28 @@ AppEngine::Result RestorableAppEngine::installAndCreateOrRunContainers(const App
   return res;
 }
 
+ComposeInfo::Ptr RestorableAppEngine::getNativeCompose(const std::string& app_name,
+                                                       const std::string& compose_file_content) const {
+  if (native_compose_ == nullptr) {
+    return nullptr;
+  }
+  try {
+    auto compose{ComposeInfo::loadContent(compose_file_content)};
+    const auto feature{NativeCompose::getUnsupportedFeature(compose->json())};
+    if (!feature.empty()) {
+      LOG_DEBUG << app_name << ": the App is handled by `docker compose`, unsupported compose file feature: "
+                << feature;
+      return nullptr;
+    }
+    return compose;
+  } catch (const std::exception& exc) {
+    // whatever compose file can't be checked is left to `docker compose`, which reports what is wrong with it
+    LOG_DEBUG << app_name << ": the App is handled by `docker compose`, failed to check its compose file: "
+              << exc.what();
+    return nullptr;
+  }
+}
+
 AppEngine::Result RestorableAppEngine::run(const App& app) { return installAndCreateOrRunContainers(app, true); }
 
 void RestorableAppEngine::stop(const App& app) {
@@ -211,7 +517,11 @@ void RestorableAppEngine::stop(const App& app) {
     const auto app_install_dir{install_root_ / app.name};
 
     // just installed app are removed, the restorable store Apps will be removed by means of prune() call
-    stopComposeApp(compose_cmd_, app_install_dir);
+    if (getNativeCompose(app.name, Utils::readFile(app_install_dir / ComposeFile)) != nullptr) {
+      native_compose_->down(app.name);
+    } else {
+      stopComposeApp(compose_cmd_, app_install_dir);
+    }
   } catch (const std::exception& exc) {
     LOG_WARNING << "App: " << app.name << ", failed to remove: " << exc.what();
   }
@@ -222,7 +532,11 @@ void RestorableAppEngine::remove(const App& app) {
     const auto app_install_dir{install_root_ / app.name};
 
     // just installed app are removed, the restorable store Apps will be removed by means of prune() call
-    stopComposeApp(compose_cmd_, app_install_dir);
+    if (getNativeCompose(app.name, Utils::readFile(app_install_dir / ComposeFile)) != nullptr) {
+      native_compose_->down(app.name);
+    } else {
+      stopComposeApp(compose_cmd_, app_install_dir);
+    }
     boost::filesystem::remove_all(app_install_dir);
 
   } catch (const std::exception& exc) {
@@ -265,8 +579,22 @@ Json::Value RestorableAppEngine::getRunningAppsInfo() const {
 }
 
 void RestorableAppEngine::prune(const Apps& app_shortlist) {
-  std::unordered_set<std::string> blob_shortlist;
+  {
+    // the images loaded ahead of the Apps might be pruned from the docker store
+    std::lock_guard<std::mutex> lock{preinstalled_images_mutex_};
+    preinstalled_images_.clear();
+  }
+  std::unordered_map<std::string, std::pair<Uri, boost::filesystem::path>> kept_owners;
+  std::vector<std::string> removed_owners;
   bool prune_docker_store{false};
+  // the Apps gone from the shortlist and the images of the removed App versions, for the selective docker prune
+  std::set<std::string> removed_apps;
+  std::set<std::string> removed_images;
+  Json::Value previous_versions{Json::objectValue};
+  if (retain_previous_) {
+    std::lock_guard<std::mutex> lock{previous_versions_mutex_};
+    previous_versions = getPreviousVersions();
+  }
 
   for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(apps_root_), {})) {
     if (!boost::filesystem::is_directory(entry)) {
@@ -278,6 +606,15 @@ void RestorableAppEngine::prune(const Apps& app_shortlist) {
 
     if (foundAppIt == app_shortlist.end()) {
       // remove App dir tree since it's not found in the shortlist
+      for (const auto& version_entry :
+           boost::make_iterator_range(boost::filesystem::directory_iterator(entry.path()), {})) {
+        if (boost::filesystem::is_directory(version_entry)) {
+          removed_owners.emplace_back(dir + "/" + version_entry.path().filename().native());
+          const auto images{getAppImages(version_entry.path())};
+          removed_images.insert(images.begin(), images.end());
+        }
+      }
+      removed_apps.emplace(dir);
       boost::filesystem::remove_all(entry.path());
       LOG_INFO << "Removing App dir: " << entry.path();
       prune_docker_store = true;
@@ -297,71 +634,180 @@ void RestorableAppEngine::prune(const Apps& app_shortlist) {
       }
 
       const std::string app_version_dir = entry.path().filename().native();
+      const std::string owner{uri.app + "/" + app_version_dir};
+      const auto uri_file{entry.path() / "uri"};
+      if (app_version_dir != uri.digest.hash() && previous_versions[app.name].asString() == app_version_dir &&
+          boost::filesystem::exists(uri_file)) {
+        LOG_INFO << "Keeping the previous App version dir for a rollback: " << entry.path();
+        kept_owners.emplace(owner, std::make_pair(Uri::parseUri(Utils::readFile(uri_file)), entry.path()));
+        continue;
+      }
       if (app_version_dir != uri.digest.hash()) {
         LOG_INFO << "Removing App version dir: " << entry.path();
+        const auto images{getAppImages(entry.path())};
+        removed_images.insert(images.begin(), images.end());
         boost::filesystem::remove_all(entry.path());
+        removed_owners.emplace_back(owner);
         prune_docker_store = true;
         continue;
       }
 
-      // add blobs of the shortlisted apps to the blob shortlist
-      ComposeInfo compose{(entry.path() / ComposeFile).string()};
-      for (const auto& service : compose.getServices()) {
-        const auto image = compose.getImage(service);
-        const Uri image_uri{Uri::parseUri(image, false)};
-        const auto image_root{app_dir / app_version_dir / "images" / image_uri.registryHostname / image_uri.repo /
-                              image_uri.digest.hash()};
+      kept_owners.emplace(owner, std::make_pair(uri, entry.path()));
+    }
+  }
 
-        const auto index_manifest{image_root / "index.json"};
-        if (!boost::filesystem::exists(index_manifest)) {
-          LOG_WARNING << "Failed to find an index manifest of App image: " << image << ", removing its directory";
-          boost::filesystem::remove_all(image_root);
-          continue;
-        }
+  // The blobs are pruned incrementally, i.e. only the blobs which reference count drops to zero are removed,
+  // if each App version is accounted. Otherwise, the table is rebuilt by the full store scan, it happens if
+  // the table has never been built or got lost, or if there is an App version which fetch hasn't completed,
+  // so the blobs it has brought are not accounted.
+  bool full_scan{!blob_refs_.isComplete()};
+  for (const auto& owner : kept_owners) {
+    full_scan = full_scan || !blob_refs_.hasOwner(owner.first);
+  }
+  for (const auto& owner : removed_owners) {
+    full_scan = full_scan || !blob_refs_.hasOwner(owner);
+  }
+  std::vector<std::string> unreferenced_blobs;
+  if (full_scan) {
+    for (const auto& owner : kept_owners) {
+      const auto blobs{blob_refs_.add(owner.first, getAppRefs(owner.second.first, owner.second.second))};
+      unreferenced_blobs.insert(unreferenced_blobs.end(), blobs.begin(), blobs.end());
+    }
+  }
+
+  // App versions which dirs are gone but their references are still recorded, e.g. removed by a previous prune
+  // that didn't manage to store the table
+  for (const auto& owner : blob_refs_.owners()) {
+    if (kept_owners.count(owner) == 0 &&
+        std::find(removed_owners.begin(), removed_owners.end(), owner) == removed_owners.end()) {
+      removed_owners.emplace_back(owner);
+    }
+  }
 
-        const auto image_manifest_desc{Utils::parseJSONFile(index_manifest)};
-        HashedDigest image_digest{image_manifest_desc["manifests"][0]["digest"].asString()};
-        blob_shortlist.emplace(image_digest.hash());
+  for (const auto& owner : removed_owners) {
+    fetch_journal_.reset(owner);
+    const auto blobs{blob_refs_.remove(owner)};
+    unreferenced_blobs.insert(unreferenced_blobs.end(), blobs.begin(), blobs.end());
+  }
 
-        const auto image_manifest{Utils::parseJSONFile(blobs_root_ / "sha256" / image_digest.hash())};
-        blob_shortlist.emplace(HashedDigest(image_manifest["config"]["digest"].asString()).hash());
+  registry_client_->pruneManifestCache(blob_refs_.manifests());
 
-        const auto image_layers{image_manifest["layers"]};
-        for (Json::ValueConstIterator ii = image_layers.begin(); ii != image_layers.end(); ++ii) {
-          if ((*ii).isObject() && (*ii).isMember("digest")) {
-            const auto layer_digest{HashedDigest{(*ii)["digest"].asString()}};
-            blob_shortlist.emplace(layer_digest.hash());
-          } else {
-            LOG_ERROR << "Invalid image manifest: " << ii.key().asString() << " -> " << *ii;
+  // prune blobs
+  const auto blob_dir{blobs_root_ / "sha256"};
+  if (full_scan) {
+    if (boost::filesystem::exists(blob_dir)) {
+      for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(blob_dir), {})) {
+        if (boost::filesystem::is_directory(entry)) {
+          continue;
+        }
+
+        if (entry.path().extension() == RegistryClient::PartFileExt) {
+          // the download of a referenced blob is resumed from its `.part` file, the one of a blob which is not
+          // referenced yet may be in progress
+          const auto part_blob_sha{entry.path().stem().native()};
+          boost::system::error_code ec;
+          const auto modified{boost::filesystem::last_write_time(entry.path(), ec)};
+          if (blob_refs_.isReferenced(part_blob_sha) || ec ||
+              std::time(nullptr) - modified < static_cast<std::time_t>(PartFileMaxAgeSec)) {
+            continue;
           }
+          LOG_INFO << "Removing stale partially downloaded blob: " << entry.path();
+          boost::filesystem::remove(entry.path());
+          continue;
+        }
+
+        const std::string blob_sha = entry.path().filename().native();
+        if (!blob_refs_.isReferenced(blob_sha)) {
+          LOG_INFO << "Removing blob: " << entry.path();
+          boost::filesystem::remove_all(entry.path());
+          blob_index_.remove(blob_sha);
+          prune_docker_store = true;
         }
       }
     }
+    blob_refs_.setComplete();
+  } else {
+    for (const auto& blob_sha : unreferenced_blobs) {
+      const auto blob_path{blob_dir / blob_sha};
+      if (boost::filesystem::exists(blob_path)) {
+        LOG_INFO << "Removing blob: " << blob_path;
+        boost::filesystem::remove_all(blob_path);
+        blob_index_.remove(blob_sha);
+        prune_docker_store = true;
+      }
+    }
   }
-
-  // prune blobs
-  if (!boost::filesystem::exists(blobs_root_ / "sha256")) {
-    return;
+  blob_refs_.flush();
+  content_index_.prune();
+
+  if (app_tree_) {
+    try {
+      std::unordered_set<std::string> kept_archives;
+      for (const auto& owner : kept_owners) {
+        const Manifest manifest{Utils::parseJSONFile(owner.second.second / Manifest::Filename)};
+        kept_archives.emplace(HashedDigest(manifest.archiveDigest()).hash());
+      }
+      app_tree_->prune(kept_archives);
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to prune the App tree: " << exc.what();
+    }
   }
 
-  for (const auto& entry :
-       boost::make_iterator_range(boost::filesystem::directory_iterator(blobs_root_ / "sha256"), {})) {
-    if (boost::filesystem::is_directory(entry)) {
-      continue;
+  // prune docker store
+  if (prune_docker_store) {
+    if (docker_cmd_.empty()) {
+      ComposeAppEngine::pruneDockerStore(*docker_client_);
+    } else {
+      // the images shared with the kept App versions are still in use
+      for (const auto& owner : kept_owners) {
+        for (const auto& image : getAppImages(owner.second.second)) {
+          removed_images.erase(image);
+        }
+      }
+      pruneDockerStore(removed_apps, {removed_images.begin(), removed_images.end()});
     }
+  }
+}
 
-    const std::string blob_sha = entry.path().filename().native();
-    if (blob_shortlist.end() == blob_shortlist.find(blob_sha)) {
-      LOG_INFO << "Removing blob: " << entry.path();
-      boost::filesystem::remove_all(entry.path());
-      prune_docker_store = true;
-    }
+void RestorableAppEngine::pruneDockerStore(const std::set<std::string>& removed_apps,
+                                           const std::vector<std::string>& images) {
+  if (docker_prune_thread_.joinable()) {
+    docker_prune_thread_.join();
   }
+  docker_prune_thread_ = std::thread([this, removed_apps, images]() {
+    for (const auto& app : removed_apps) {
+      try {
+        LOG_INFO << app << ": removing containers of the removed App";
+        docker_client_->removeContainers({NativeCompose::ProjectLabel + "=" + app});
+      } catch (const std::exception& exc) {
+        LOG_WARNING << app << ": failed to remove containers of the removed App: " << exc.what();
+      }
+    }
+    if (images.empty()) {
+      return;
+    }
+    try {
+      LOG_INFO << "Removing images of the removed App versions: " << boost::algorithm::join(images, " ");
+      exec(boost::format{"%s image rm %s"} % docker_cmd_ % boost::algorithm::join(images, " "),
+           "failed to remove images");
+    } catch (const std::exception& exc) {
+      // e.g. an image is still used by a container of another App
+      LOG_WARNING << "Failed to remove some of the images of the removed App versions: " << exc.what();
+    }
+  });
+}
 
-  // prune docker store
-  if (prune_docker_store) {
-    ComposeAppEngine::pruneDockerStore(*docker_client_);
+std::set<std::string> RestorableAppEngine::getAppImages(const boost::filesystem::path& app_version_dir) {
+  std::set<std::string> images;
+  try {
+    const auto compose{ComposeInfo::load((app_version_dir / ComposeFile).string())};
+    for (const auto& service : compose->services()) {
+      images.emplace(service.image);
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to get images of the App version " << app_version_dir << ": " << exc.what();
   }
+  return images;
 }
 
 // protected & private implementation
@@ -372,72 +818,266 @@ void RestorableAppEngine::pullApp(const Uri& uri, const boost::filesystem::path&
   const std::string manifest_str{registry_client_->getAppManifest(uri, Manifest::Format)};
   const Manifest manifest{manifest_str};
   Docker::Uri archive_uri{uri.createUri(HashedDigest(manifest.archiveDigest()))};
-  const auto archive_full_path{app_dir / (HashedDigest(manifest.archiveDigest()).hash() + Manifest::ArchiveExt)};
+  const auto archive_full_path{app_dir / (HashedDigest(manifest.archiveDigest()).hash() + manifest.archiveExt())};
 
-  boost::system::error_code ec;
-  boost::filesystem::space_info fs_storage_info{boost::filesystem::space(app_dir, ec)};
-  if (ec.failed()) {
-    LOG_WARNING << "Failed to get an available storage size: " << ec.message();
-  } else {
-    // assume that an extracted files total size is up to 10x larger than the archive size
-    // 80% is a storage space watermark, we don't want to fill a storage volume above it
-    auto need_storage = manifest.archiveSize() * 10;
-    auto available = static_cast<boost::uintmax_t>(fs_storage_info.available * 0.8);
-    if (need_storage > available) {
-      throw std::runtime_error("There is no sufficient storage space available to download App archive, available: " +
-                               std::to_string(available) + " need: " + std::to_string(need_storage));
-    }
+  {
+    // the Apps are pulled concurrently, so each download has to leave room for the others
+    const auto reservation{reserveStorage(app_dir, manifest.archiveSize(), "download App archive")};
+    registry_client_->downloadBlob(archive_uri, archive_full_path, manifest.archiveSize());
   }
-
-  registry_client_->downloadBlob(archive_uri, archive_full_path, manifest.archiveSize());
+  // the archive is extracted into the compose App dir at the install time
+  checkAvailableStorage(install_root_,
+                        AppArchive(archive_full_path).getExtractedSize() + getReservedStorage(install_root_),
+                        "extract App archive");
   Utils::writeFile(app_dir / Manifest::Filename, manifest_str);
   Utils::writeFile(app_dir / "uri", uri.registryHostname + "/" + uri.repo + "@" + uri.digest());
-  // extract docker-compose.yml, temporal hack, we don't need to extract it
-  exec(boost::format{"tar -xzf %s %s"} % archive_full_path % ComposeFile, "no compose file found in archive",
-       boost::process::start_dir = app_dir);
+  // store docker-compose.yml next to the archive, the other App store routines read it from there
+  Utils::writeFile(app_dir / ComposeFile, AppArchive(archive_full_path).readFile(ComposeFile));
 }
 
 void RestorableAppEngine::checkAppUpdateSize(const Uri& uri, const boost::filesystem::path& app_dir) const {
-  const Manifest manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)};
-  const auto arch{docker_client_->arch()};
-  if (arch.empty()) {
-    LOG_WARNING << "Failed to get an info about a system architecture";
+  std::unordered_map<std::string, BlobIndex::BlobSize> missing_blobs;
+  if (!getAppMissingBlobs(uri, app_dir, missing_blobs)) {
     return;
   }
+  uint64_t app_update_size{0};
+  for (const auto& blob : missing_blobs) {
+    app_update_size += blob.second.size;
+  }
+  // Apps fetched at the same time need room for their layers too, the shared layers are counted just once
+  const auto total_update_size{blob_index_.reserve(uri.app + "/" + uri.digest.hash(), missing_blobs)};
+  if (total_update_size.size != app_update_size) {
+    LOG_INFO << "Total size of the new layers of all Apps being fetched: " << total_update_size.size
+             << ", extracted: " << total_update_size.usage;
+  }
 
-  const auto layers_manifest{manifest.layersManifest(arch)};
-  if (!layers_manifest.isObject()) {
+  LOG_INFO << "Checking if there is sufficient amount of storage available for App update...";
+  checkAvailableStorageInStores(uri.app, total_update_size.size, total_update_size.usage);
+}
+
+void RestorableAppEngine::checkAvailableStorageOrEvict(const std::string& app_name, uint64_t store_size,
+                                                       uint64_t docker_size, const std::set<std::string>& keep) {
+  uint64_t freed{0};
+  unsigned int evicted{0};
+  while (true) {
+    try {
+      checkAvailableStorageInStores(app_name, store_size, docker_size);
+      break;
+    } catch (const InsufficientSpaceError& exc) {
+      // the store eviction doesn't free the docker store volume unless it is the store one
+      const bool is_store_short{exc.store_path == store_root_.string()};
+      uint64_t version_freed{0};
+      if (!store_eviction_ || !is_store_short || !evictAppVersion(keep, version_freed)) {
+        if (evicted > 0) {
+          LOG_WARNING << "The fetch doesn't fit the store even after evicting " << evicted
+                      << " App version(s) which freed " << freed << " bytes";
+        }
+        throw;
+      }
+      freed += version_freed;
+      ++evicted;
+    }
+  }
+  if (evicted > 0) {
+    LOG_INFO << "The fetch fits the store after evicting " << evicted << " App version(s) which freed " << freed
+             << " bytes";
+  }
+}
+
+bool RestorableAppEngine::evictAppVersion(const std::set<std::string>& keep, uint64_t& freed) {
+  if (!blob_refs_.isComplete()) {
+    LOG_WARNING << "No App version is evicted from the store, the blob reference table is not complete";
+    return false;
+  }
+  Json::Value previous_versions{Json::objectValue};
+  if (retain_previous_) {
+    std::lock_guard<std::mutex> lock{previous_versions_mutex_};
+    previous_versions = getPreviousVersions();
+  }
+
+  std::string lru_owner;
+  boost::filesystem::path lru_dir;
+  std::time_t lru_time{0};
+  for (const auto& app_entry : boost::make_iterator_range(boost::filesystem::directory_iterator(apps_root_), {})) {
+    if (!boost::filesystem::is_directory(app_entry)) {
+      continue;
+    }
+    const auto app_name{app_entry.path().filename().string()};
+    for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(app_entry), {})) {
+      const auto version{entry.path().filename().string()};
+      const auto owner{app_name + "/" + version};
+      const auto uri_file{entry.path() / "uri"};
+      // the versions which fetch hasn't completed are not accounted, so it is unknown which blobs they use
+      if (!boost::filesystem::is_directory(entry) || keep.count(owner) > 0 || !blob_refs_.hasOwner(owner) ||
+          !boost::filesystem::exists(uri_file) || previous_versions[app_name].asString() == version) {
+        continue;
+      }
+      boost::system::error_code ec;
+      const auto time{boost::filesystem::last_write_time(entry.path(), ec)};
+      if (ec || (!lru_owner.empty() && time >= lru_time) || isRunning({app_name, Utils::readFile(uri_file)})) {
+        continue;
+      }
+      lru_owner = owner;
+      lru_dir = entry.path();
+      lru_time = time;
+    }
+  }
+  if (lru_owner.empty()) {
+    LOG_WARNING << "No App version can be evicted from the store";
+    return false;
+  }
+
+  UpdateTrace::Span span{"app_store_eviction", lru_owner};
+  freed = 0;
+  for (const auto& entry : boost::make_iterator_range(boost::filesystem::recursive_directory_iterator(lru_dir), {})) {
+    boost::system::error_code ec;
+    const auto size{boost::filesystem::file_size(entry.path(), ec)};
+    freed += ec ? 0 : size;
+  }
+  boost::filesystem::remove_all(lru_dir);
+  boost::system::error_code ec;
+  if (boost::filesystem::is_empty(lru_dir.parent_path(), ec)) {
+    boost::filesystem::remove(lru_dir.parent_path(), ec);
+  }
+  fetch_journal_.reset(lru_owner);
+  const auto blob_dir{blobs_root_ / "sha256"};
+  for (const auto& blob_sha : blob_refs_.remove(lru_owner)) {
+    if (isBlobPlanned(blob_sha)) {
+      continue;
+    }
+    const auto size{boost::filesystem::file_size(blob_dir / blob_sha, ec)};
+    if (!ec) {
+      LOG_INFO << "Removing blob: " << blob_dir / blob_sha;
+      boost::filesystem::remove_all(blob_dir / blob_sha);
+      blob_index_.remove(blob_sha);
+      freed += size;
+    }
+  }
+  blob_refs_.flush();
+  registry_client_->pruneManifestCache(blob_refs_.manifests());
+  LOG_INFO << "Evicted App version " << lru_owner << " installed last at " << lru_time
+           << " from the store to make room for the fetch, freed " << freed << " bytes";
+  return true;
+}
+
+bool RestorableAppEngine::getAppMissingBlobs(const Uri& uri, const boost::filesystem::path& app_dir,
+                                             std::unordered_map<std::string, BlobIndex::BlobSize>& missing_blobs,
+                                             std::set<std::string>* layers) const {
+  const auto app_layers{getAppLayers(uri, app_dir)};
+  if (app_layers.isNull()) {
     LOG_WARNING << "App layers' manifest is missing, skip checking an App update size";
-    return;
+    return false;
   }
 
-  if (!(layers_manifest.isMember("digest") && layers_manifest["digest"].isString())) {
-    throw std::invalid_argument("Got invalid layers manifest, missing or incorrect `digest` field");
+  LOG_INFO << uri.app << ": checking for App's new layers...";
+  getAppUpdateSize(app_layers, blob_index_, missing_blobs);
+  if (layers != nullptr) {
+    for (const auto& layer : app_layers) {
+      layers->emplace(HashedDigest(layer["digest"].asString()).hash());
+    }
   }
+  return true;
+}
+
+bool RestorableAppEngine::isBlobPlanned(const std::string& blob) {
+  std::lock_guard<std::mutex> lock{fetch_plan_mutex_};
+  return fetch_plan_blobs_.count(blob) > 0;
+}
 
-  if (!(layers_manifest.isMember("size") && layers_manifest["size"].isInt64())) {
-    throw std::invalid_argument("Got invalid layers manifest, missing or incorrect `size` field");
+Json::Value RestorableAppEngine::getAppLayers(const Uri& uri, const boost::filesystem::path& app_dir) const {
+  return getAppLayers(uri, Manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)});
+}
+
+Json::Value RestorableAppEngine::getAppLayers(const Uri& uri, const Manifest& manifest) const {
+  const auto arch{docker_client_->arch()};
+  if (arch.empty()) {
+    LOG_WARNING << "Failed to get an info about a system architecture";
+    return Json::Value();
   }
 
-  const Docker::Uri layers_manifest_uri{uri.createUri(HashedDigest(layers_manifest["digest"].asString()))};
-  const std::int64_t layers_manifest_size{layers_manifest["size"].asInt64()};
+  const auto layers_manifest{manifest.layersManifest(arch)};
+  if (!layers_manifest) {
+    return Json::Value();
+  }
 
-  const std::string man_str{
-      registry_client_->getAppManifest(layers_manifest_uri, Manifest::IndexFormat, layers_manifest_size)};
-  const auto man{Utils::parseJSON(man_str)};
+  const std::string man_str{registry_client_->getAppManifest(uri.createUri(layers_manifest->digest),
+                                                             Manifest::IndexFormat, layers_manifest->size)};
+  return Utils::parseJSON(man_str)["layers"];
+}
+
+void RestorableAppEngine::applyLayerDeltas(const Uri& uri, const boost::filesystem::path& app_dir) {
+  Json::Value layers;
+  try {
+    layers = getAppLayers(uri, app_dir);
+  } catch (const std::exception& exc) {
+    LOG_WARNING << uri.app << ": failed to get the App layers, the layer deltas are not applied: " << exc.what();
+    return;
+  }
 
-  LOG_INFO << "Checking for App's new layers...";
-  uint64_t skopeo_total_update_size{getAppUpdateSize(man["layers"], blobs_root_ / "sha256")};
-  const uint32_t average_compression_ratio{5} /* gzip layer compression ratio */;
-  uint64_t docker_total_update_size{
-      getDockerStoreSizeForAppUpdate(skopeo_total_update_size, average_compression_ratio)};
+  const auto blob_dir{blobs_root_ / "sha256"};
+  for (const auto& layer : layers) {
+    const auto& deltas{layer[LayerDeltasField]};
+    if (!deltas.isArray() || deltas.empty()) {
+      continue;
+    }
+    try {
+      const HashedDigest digest{layer["digest"].asString()};
+      for (const auto& delta : deltas) {
+        if (blob_index_.isPresent(digest.hash())) {
+          break;
+        }
+        const HashedDigest src_digest{delta["from"].asString()};
+        if (!blob_index_.isPresent(src_digest.hash())) {
+          continue;
+        }
+        const HashedDigest delta_digest{delta["digest"].asString()};
+        const auto format{delta["format"].asString()};
+        const auto delta_file{blob_dir / (delta_digest.hash() + ".delta")};
+        const auto dst_file{blob_dir / (digest.hash() + ".patched")};
+        try {
+          LOG_INFO << uri.app << ": reconstructing layer " << digest.hash() << " from " << src_digest.hash()
+                   << " with the " << format << " delta, size: " << delta["size"].asUInt64();
+          registry_client_->downloadBlob(uri.createUri(delta_digest), delta_file, delta["size"].asUInt64());
+          applyLayerDelta(format, blob_dir / src_digest.hash(), delta_file, dst_file);
+          if (getContentHash(dst_file) != digest.hash()) {
+            throw std::runtime_error("the reconstructed layer hash doesn't match the layer digest");
+          }
+          boost::filesystem::rename(dst_file, blob_dir / digest.hash());
+          blob_index_.update(digest.hash());
+        } catch (const std::exception& exc) {
+          LOG_WARNING << uri.app << ": failed to reconstruct layer " << digest.hash() << " with the delta "
+                      << delta_digest.hash() << ": " << exc.what();
+        }
+        boost::system::error_code ec;
+        boost::filesystem::remove(delta_file, ec);
+        boost::filesystem::remove(dst_file, ec);
+      }
+      if (!blob_index_.isPresent(digest.hash())) {
+        LOG_INFO << uri.app << ": no applicable delta of layer " << digest.hash() << ", it is downloaded as a whole";
+      }
+    } catch (const std::exception& exc) {
+      LOG_WARNING << uri.app << ": invalid layer deltas: " << Utils::jsonToCanonicalStr(deltas) << ", err: "
+                  << exc.what();
+    }
+  }
+}
 
-  LOG_INFO << "Checking if there is sufficient amount of storage available for App update...";
-  checkAvailableStorageInStores(uri.app, skopeo_total_update_size, docker_total_update_size);
+void RestorableAppEngine::applyLayerDelta(const std::string& format, const boost::filesystem::path& src_blob,
+                                          const boost::filesystem::path& delta,
+                                          const boost::filesystem::path& dst_blob) {
+  if (format == "zstd") {
+    // the delta window covers the whole source blob, so the decompression window limit is raised to the max
+    exec(boost::format{"zstd -d -q -f --long=31 --patch-from=%s %s -o %s"} % src_blob % delta % dst_blob,
+         "failed to apply the zstd layer delta");
+  } else if (format == "bsdiff") {
+    exec(boost::format{"bspatch %s %s %s"} % src_blob % dst_blob % delta, "failed to apply the bsdiff layer delta");
+  } else {
+    throw std::invalid_argument("unsupported layer delta format: " + format);
+  }
 }
 
 void RestorableAppEngine::pullAppImages(const Uri& app_uri, const boost::filesystem::path& app_compose_file,
-                                        const boost::filesystem::path& dst_dir) {
+                                        const boost::filesystem::path& dst_dir, bool skip_in_place_images) {
   // REGISTRY_AUTH_FILE env. var. must be set and point to the docker's `config.json` (e.g.
   // /usr/lib/docker/config.json)`
   // {
@@ -451,50 +1091,569 @@ void RestorableAppEngine::pullAppImages(const Uri& app_uri, const boost::filesys
   // cred helper.
   boost::filesystem::create_directories(dst_dir);
 
-  const auto compose{ComposeInfo(app_compose_file.string())};
-  for (const auto& service : compose.getServices()) {
-    const auto image_uri = compose.getImage(service);
+  const auto compose{ComposeInfo::load(app_compose_file.string())};
+  const auto& services{compose->services()};
+  std::vector<ImagePuller::Image> images;
+  // the progress is measured by the growth of the blob store since neither `skopeo` nor the native puller
+  // tells how much data they have received
+  DownloadProgressMeter progress_meter{progress_cb_, DownloadProgress::Source::AppImages,
+                                       app_uri.registryHostname + "/" + app_uri.repo + "@" + app_uri.digest()};
+  const uint64_t blob_store_size{getBlobStoreSize(blobs_root_ / "sha256")};
+  const auto owner{app_uri.app + "/" + app_uri.digest.hash()};
+  std::size_t pulled_images{0};
+  for (const auto& service : services) {
+    const auto& image_uri = service.image;
 
     const Uri uri{Uri::parseUri(image_uri, false)};
     const auto image_dir{dst_dir / uri.registryHostname / uri.repo / uri.digest.hash()};
 
+    if (skip_in_place_images && getInPlaceImageSrc(app_uri, uri)) {
+      LOG_INFO << uri.app << ": image is installed in place, its pull is deferred: " << image_uri;
+      ++pulled_images;
+      continue;
+    }
+    if (fetch_journal_.isDone(owner, uri.digest.hash()) && boost::filesystem::exists(image_dir / "index.json")) {
+      LOG_INFO << uri.app << ": image has been pulled by a previous attempt: " << image_uri;
+      ++pulled_images;
+      continue;
+    }
     LOG_INFO << uri.app << ": downloading image from Registry if missing: " << image_uri << " --> " << image_dir;
-    const std::string image_src{client_image_src_func_(app_uri, image_uri)};
-    pullImage(client_, image_src, image_dir, blobs_root_);
+    if (!blob_import_dir_.empty()) {
+      importImageBlobs(uri);
+    }
+    if (image_puller_) {
+      images.emplace_back(uri, image_dir);
+      continue;
+    }
+    registry_client_->sendToMirrors(uri, [&](const Uri& src_uri) {
+      const auto src_image_uri{src_uri.registryHostname == uri.registryHostname
+                                   ? image_uri
+                                   : src_uri.registryHostname + "/" + src_uri.repo + "@" + src_uri.digest()};
+      pullImage(client_, client_image_src_func_(app_uri, src_image_uri), image_dir, blobs_root_);
+    });
+    fetch_journal_.setDone(owner, uri.digest.hash());
+    progress_meter.update(getBlobStoreSize(blobs_root_ / "sha256") - blob_store_size, image_uri,
+                          static_cast<unsigned int>(++pulled_images * 100 / services.size()));
+  }
+
+  if (!images.empty()) {
+    image_puller_->pull(images, docker_client_->arch(), cancel_check_);
+    for (const auto& image : images) {
+      fetch_journal_.setDone(owner, image.uri.digest.hash());
+    }
+  }
+  progress_meter.update(getBlobStoreSize(blobs_root_ / "sha256") - blob_store_size);
+  progress_meter.complete();
+}
+
+boost::optional<RestorableAppEngine::ImageSrc> RestorableAppEngine::getInPlaceImageSrc(const Uri& app_uri,
+                                                                                      const Uri& image_uri) const {
+  if (!in_place_image_src_) {
+    return boost::none;
+  }
+  auto src{in_place_image_src_(app_uri, image_uri)};
+  if (!boost::filesystem::exists(src.image_dir / "index.json")) {
+    return boost::none;
   }
+  return src;
+}
+
+void RestorableAppEngine::accountAppBlobs(const Uri& uri, const boost::filesystem::path& app_dir) {
+  // account the App blobs so they are kept by prune until the App version is removed
+  const auto refs{getAppRefs(uri, app_dir)};
+  for (const auto& blob : refs.blobs) {
+    blob_index_.update(blob);
+  }
+  // the blobs just the replaced references of the App version referred to, e.g. the ones of a damaged manifest
+  const auto blob_dir{blobs_root_ / "sha256"};
+  for (const auto& blob : blob_refs_.add(uri.app + "/" + uri.digest.hash(), refs)) {
+    if (isBlobPlanned(blob)) {
+      continue;
+    }
+    LOG_INFO << "Removing blob: " << blob_dir / blob;
+    boost::system::error_code ec;
+    boost::filesystem::remove(blob_dir / blob, ec);
+    blob_index_.remove(blob);
+  }
+  blob_refs_.flush();
+}
+
+std::vector<std::string> RestorableAppEngine::getImageLayers(const boost::filesystem::path& image_dir,
+                                                            const boost::filesystem::path& blob_dir) {
+  std::vector<std::string> layers;
+  auto& manifests{OciManifestCache::instance()};
+  const auto index{manifests.imageIndex(image_dir)};
+  const auto manifest{manifests.imageManifest(blob_dir, index->manifest().digest)};
+  for (const auto& layer : manifest->layers) {
+    layers.emplace_back(layer.digest.hash());
+  }
+  return layers;
+}
+
+BlobRefs::Refs RestorableAppEngine::getAppRefs(const Uri& uri, const boost::filesystem::path& app_version_dir) const {
+  BlobRefs::Refs refs;
+  refs.manifests.emplace(uri.digest.hash());
+  if (boost::filesystem::exists(app_version_dir / Manifest::Filename) && !docker_client_->arch().empty()) {
+    const Manifest manifest{Utils::parseJSONFile(app_version_dir / Manifest::Filename)};
+    const auto layers_manifest{manifest.layersManifest(docker_client_->arch())};
+    if (layers_manifest) {
+      refs.manifests.emplace(layers_manifest->digest.hash());
+    }
+  }
+
+  const auto compose{ComposeInfo::load((app_version_dir / ComposeFile).string())};
+  for (const auto& service : compose->services()) {
+    const auto& image = service.image;
+    const Uri image_uri{Uri::parseUri(image, false)};
+    const auto image_root{app_version_dir / "images" / image_uri.registryHostname / image_uri.repo /
+                          image_uri.digest.hash()};
+
+    const auto index_manifest{image_root / "index.json"};
+    if (!boost::filesystem::exists(index_manifest) && getInPlaceImageSrc(uri, image_uri)) {
+      // accounted once the image is copied into the store by `fetchDeferredImages()`
+      continue;
+    }
+    if (!boost::filesystem::exists(index_manifest)) {
+      LOG_WARNING << "Failed to find an index manifest of App image: " << image << ", removing its directory";
+      boost::filesystem::remove_all(image_root);
+      continue;
+    }
+
+    auto& manifests{OciManifestCache::instance()};
+    const auto image_index{manifests.imageIndex(image_root)};
+    const auto& image_digest{image_index->manifest().digest};
+    refs.blobs.emplace(image_digest.hash());
+    refs.manifests.emplace(image_digest.hash());
+    refs.manifests.emplace(image_uri.digest.hash());
+
+    const auto image_manifest{manifests.imageManifest(blobs_root_ / "sha256", image_digest)};
+    refs.blobs.emplace(image_manifest->config.digest.hash());
+    for (const auto& layer : image_manifest->layers) {
+      refs.blobs.emplace(layer.digest.hash());
+    }
+  }
+  return refs;
 }
 
 boost::filesystem::path RestorableAppEngine::installAppAndImages(const App& app) {
   const Uri uri{Uri::parseUri(app.uri)};
   const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
   auto app_install_dir{install_root_ / app.name};
+  if (retain_previous_) {
+    retainInstalledVersion(app);
+  }
   LOG_DEBUG << app.name << ": installing App: " << app_dir << " --> " << app_install_dir;
   installApp(app_dir, app_install_dir);
-  LOG_DEBUG << app.name << ": verifying App: " << app_install_dir;
-  verifyComposeApp(compose_cmd_, app_install_dir);
+  // the App version dir time tells the one least recently installed, see setStoreEviction()
+  boost::system::error_code ec;
+  boost::filesystem::last_write_time(app_dir, std::time(nullptr), ec);
+  const Manifest manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)};
+  const auto archive_hash{HashedDigest(manifest.archiveDigest()).hash()};
+  if (!compose_verify_cache_.isVerified(archive_hash) &&
+      getNativeCompose(app.name, Utils::readFile(app_install_dir / ComposeFile)) == nullptr) {
+    LOG_DEBUG << app.name << ": verifying App: " << app_install_dir;
+    verifyComposeApp(compose_cmd_, app_install_dir);
+    compose_verify_cache_.setVerified(archive_hash);
+  }
   LOG_DEBUG << app.name << ": installing App images: " << app_dir << " --> docker-daemon://";
-  installAppImages(app_dir);
+  installAppImages(uri, app_dir);
   return app_install_dir;
 }
 
+void RestorableAppEngine::retainInstalledVersion(const App& app) {
+  const auto installed_compose_file{install_root_ / app.name / ComposeFile};
+  if (!boost::filesystem::exists(installed_compose_file)) {
+    return;
+  }
+  const Uri uri{Uri::parseUri(app.uri)};
+  const auto installed_compose{Utils::readFile(installed_compose_file)};
+  // the installed version is the one which compose file has been extracted, each fetched version keeps a copy of it
+  const auto app_dir{apps_root_ / uri.app};
+  for (const auto& entry : boost::make_iterator_range(boost::filesystem::directory_iterator(app_dir), {})) {
+    const auto version{entry.path().filename().string()};
+    const auto compose_file{entry.path() / ComposeFile};
+    if (version == uri.digest.hash() || !boost::filesystem::exists(compose_file) ||
+        Utils::readFile(compose_file) != installed_compose) {
+      continue;
+    }
+    LOG_INFO << app.name << ": retaining the previous App version for a rollback: " << version;
+    std::lock_guard<std::mutex> lock{previous_versions_mutex_};
+    auto previous_versions{getPreviousVersions()};
+    previous_versions[app.name] = version;
+    Utils::writeFile(previous_versions_file_, previous_versions);
+    return;
+  }
+}
+
+Json::Value RestorableAppEngine::getPreviousVersions() const {
+  if (!boost::filesystem::exists(previous_versions_file_)) {
+    return Json::Value(Json::objectValue);
+  }
+  try {
+    const auto previous_versions{Utils::parseJSONFile(previous_versions_file_)};
+    if (previous_versions.isObject()) {
+      return previous_versions;
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to load the previous App versions: " << exc.what();
+  }
+  return Json::Value(Json::objectValue);
+}
+
+void RestorableAppEngine::confirm(const Apps& apps) {
+  if (!retain_previous_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock{previous_versions_mutex_};
+  auto previous_versions{getPreviousVersions()};
+  bool released{false};
+  for (const auto& app : apps) {
+    if (!previous_versions.isMember(app.name)) {
+      continue;
+    }
+    if (native_compose_) {
+      try {
+        native_compose_->removeRetained(app.name);
+      } catch (const std::exception& exc) {
+        LOG_WARNING << app.name << ": failed to remove the retained containers: " << exc.what();
+        continue;
+      }
+    }
+    LOG_INFO << app.name << ": releasing the previous App version: " << previous_versions[app.name].asString();
+    previous_versions.removeMember(app.name);
+    released = true;
+  }
+  if (released) {
+    // the released versions are removed from the store by the next prune
+    Utils::writeFile(previous_versions_file_, previous_versions);
+  }
+}
+
 void RestorableAppEngine::installApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& dst_dir) {
   const Manifest manifest{Utils::parseJSONFile(app_dir / Manifest::Filename)};
-  const auto archive_full_path{app_dir / (HashedDigest(manifest.archiveDigest()).hash() + Manifest::ArchiveExt)};
-
-  boost::filesystem::create_directories(dst_dir);
-  exec(boost::format{"tar --overwrite -xzf %s"} % archive_full_path.string(), "failed to install Compose App",
-       boost::process::start_dir = dst_dir);
+  const auto archive_hash{HashedDigest(manifest.archiveDigest()).hash()};
+  const auto archive_full_path{app_dir / (archive_hash + manifest.archiveExt())};
+
+  if (app_tree_) {
+    try {
+      app_tree_->checkout(archive_full_path, archive_hash, dst_dir);
+      return;
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to check out App from the App tree, extracting its archive instead: " << exc.what();
+    }
+  }
+  AppArchive(archive_full_path).extract(dst_dir);
 }
 
-void RestorableAppEngine::installAppImages(const boost::filesystem::path& app_dir) {
-  const auto compose{ComposeInfo((app_dir / ComposeFile).string())};
-  for (const auto& service : compose.getServices()) {
-    const auto image_uri = compose.getImage(service);
+void RestorableAppEngine::installAppImages(const Uri& app_uri, const boost::filesystem::path& app_dir) {
+  const auto compose{ComposeInfo::load((app_dir / ComposeFile).string())};
+  const bool direct_install{isDirectImageInstall()};
+  struct Image {
+    std::vector<std::string> refs;
+    boost::filesystem::path dir;
+    boost::filesystem::path blob_dir;
+  };
+  // the images to import into the docker store
+  std::vector<Image> to_import;
+  const auto preloaded_store{getPreloadedDockerStore()};
+  for (const auto& service : compose->services()) {
+    const auto& image_uri = service.image;
     const Uri uri{Uri::parseUri(image_uri, false)};
     const std::string tag{uri.registryHostname + '/' + uri.repo + ':' + uri.digest.shortHash()};
-    const auto image_dir{app_dir / "images" / uri.registryHostname / uri.repo / uri.digest.hash()};
-    installImage(client_, image_dir, blobs_root_, docker_host_, tag);
+    {
+      std::lock_guard<std::mutex> lock{preinstalled_images_mutex_};
+      // kept for the other Apps of the batch that use the same image
+      if (preinstalled_images_.count(tag) > 0) {
+        LOG_DEBUG << "Image has been already loaded: " << tag;
+        continue;
+      }
+    }
+    auto image_dir{app_dir / "images" / uri.registryHostname / uri.repo / uri.digest.hash()};
+    auto blob_dir{blobs_root_ / "sha256"};
+    const auto in_place_src{getInPlaceImageSrc(app_uri, uri)};
+    if (in_place_src) {
+      LOG_DEBUG << "Installing image in place: " << in_place_src->image_dir;
+      image_dir = in_place_src->image_dir;
+      blob_dir = in_place_src->blob_dir;
+    }
+    if (preloaded_store && preloaded_store->isImported(image_dir, image_uri, blob_dir)) {
+      LOG_DEBUG << "Image is present in the docker store already: " << image_uri;
+      continue;
+    }
+    if (direct_install) {
+      to_import.emplace_back(Image{{image_uri, tag}, image_dir, blob_dir});
+    } else {
+      installImage(client_, image_dir, blob_dir.parent_path(), docker_host_, tag);
+    }
+  }
+  if (to_import.empty()) {
+    return;
+  }
+
+  // Apps can be installed concurrently, the docker store must be updated by one of them at a time
+  std::lock_guard<std::mutex> docker_store_lock{docker_store_mutex_};
+  stopDockerDaemon();
+  try {
+    // the store is read after the daemon has flushed its state on stop
+    DockerStore docker_store{docker_root_, blobs_root_ / "sha256", docker_and_skopeo_same_volume_};
+    for (const auto& image : to_import) {
+      docker_store.importImage(image.dir, image.refs, image.blob_dir);
+    }
+    docker_store.commit();
+  } catch (...) {
+    try {
+      startDockerDaemon();
+    } catch (const std::exception& start_exc) {
+      LOG_ERROR << start_exc.what();
+    }
+    throw;
+  }
+  startDockerDaemon();
+}
+
+std::unique_ptr<DockerStore> RestorableAppEngine::getPreloadedDockerStore() const {
+  if (!DockerStore::isSupported(docker_root_)) {
+    return nullptr;
+  }
+  try {
+    return std::unique_ptr<DockerStore>{new DockerStore(docker_root_, blobs_root_ / "sha256")};
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to read the docker store at " << docker_root_ << ": " << exc.what();
+    return nullptr;
+  }
+}
+
+bool RestorableAppEngine::isDirectImageInstall() const {
+  if (!direct_image_install_) {
+    return false;
+  }
+  if (!DockerStore::isSupported(docker_root_)) {
+    LOG_WARNING << "The docker store at " << docker_root_ << " is not of the `" << DockerStore::Driver
+                << "` driver, the images are loaded through the docker daemon";
+    return false;
+  }
+  return true;
+}
+
+void RestorableAppEngine::stopDockerDaemon() const {
+  if (!docker_stop_cmd_.empty()) {
+    LOG_INFO << "Stopping the docker daemon to import App images into its store";
+    exec(docker_stop_cmd_, "failed to stop the docker daemon");
+  }
+}
+
+void RestorableAppEngine::startDockerDaemon() const {
+  if (!docker_start_cmd_.empty()) {
+    exec(docker_start_cmd_, "failed to start the docker daemon");
+  }
+}
+
+AppEngine::Result RestorableAppEngine::installImages(const Apps& apps) {
+  struct Image {
+    std::string uri;
+    std::string tag;
+    boost::filesystem::path dir;
+    boost::filesystem::path blob_dir;
+  };
+  std::vector<Image> images;
+  // layer digest -> index of the image group the layer belongs to
+  std::unordered_map<std::string, std::size_t> layer_groups;
+  // image groups, the images of a group share layers with each other
+  std::vector<std::vector<std::size_t>> groups;
+
+  {
+    std::lock_guard<std::mutex> lock{preinstalled_images_mutex_};
+    preinstalled_images_.clear();
+  }
+  try {
+    // the images preloaded into the docker store are not loaded again
+    const auto preloaded_store{getPreloadedDockerStore()};
+    std::unordered_set<std::string> tags;
+    for (const auto& app : apps) {
+      const Uri app_uri{Uri::parseUri(app.uri)};
+      const auto app_dir{apps_root_ / app_uri.app / app_uri.digest.hash()};
+      const auto compose{ComposeInfo::load((app_dir / ComposeFile).string())};
+      for (const auto& service : compose->services()) {
+        const Uri uri{Uri::parseUri(service.image, false)};
+        const std::string tag{uri.registryHostname + '/' + uri.repo + ':' + uri.digest.shortHash()};
+        if (!tags.emplace(tag).second) {
+          // the same image used by more than one App is loaded once
+          continue;
+        }
+        const auto in_place_src{getInPlaceImageSrc(app_uri, uri)};
+        const auto image_dir{in_place_src ? in_place_src->image_dir
+                                          : app_dir / "images" / uri.registryHostname / uri.repo / uri.digest.hash()};
+        const auto blob_dir{in_place_src ? in_place_src->blob_dir : blobs_root_ / "sha256"};
+        if (preloaded_store && preloaded_store->isImported(image_dir, service.image, blob_dir)) {
+          LOG_DEBUG << "Image is present in the docker store already: " << service.image;
+          std::lock_guard<std::mutex> lock{preinstalled_images_mutex_};
+          preinstalled_images_.emplace(tag);
+          continue;
+        }
+        const std::size_t image_index{images.size()};
+        images.emplace_back(Image{service.image, tag, image_dir, blob_dir});
+
+        // find the group that already has any of the image layers, merge the groups if there are a few of them
+        std::size_t group{groups.size()};
+        const auto layers{getImageLayers(image_dir, blob_dir)};
+        for (const auto& layer : layers) {
+          const auto layer_it{layer_groups.find(layer)};
+          if (layer_it == layer_groups.end() || layer_it->second == group) {
+            continue;
+          }
+          if (group == groups.size()) {
+            group = layer_it->second;
+            continue;
+          }
+          const std::size_t merged_group{layer_it->second};
+          groups[group].insert(groups[group].end(), groups[merged_group].begin(), groups[merged_group].end());
+          groups[merged_group].clear();
+          for (auto& layer_group : layer_groups) {
+            if (layer_group.second == merged_group) {
+              layer_group.second = group;
+            }
+          }
+        }
+        if (group == groups.size()) {
+          groups.emplace_back();
+        }
+        groups[group].emplace_back(image_index);
+        for (const auto& layer : layers) {
+          layer_groups[layer] = group;
+        }
+      }
+    }
+  } catch (const std::exception& exc) {
+    return {false, exc.what()};
+  }
+
+  // The images sharing layers are loaded one after another, so the daemon doesn't get the same layer
+  // from concurrent loads, the groups of images are loaded concurrently.
+  groups.erase(std::remove_if(groups.begin(), groups.end(),
+                              [](const std::vector<std::size_t>& group) { return group.empty(); }),
+               groups.end());
+  std::unique_ptr<DockerStore> docker_store;
+  std::unique_lock<std::mutex> docker_store_lock;
+  if (!images.empty() && isDirectImageInstall()) {
+    docker_store_lock = std::unique_lock<std::mutex>{docker_store_mutex_};
+    try {
+      stopDockerDaemon();
+    } catch (const std::exception& exc) {
+      return {false, exc.what()};
+    }
+    try {
+      // the store is read after the daemon has flushed its state on stop
+      docker_store.reset(new DockerStore(docker_root_, blobs_root_ / "sha256", docker_and_skopeo_same_volume_));
+    } catch (const std::exception& exc) {
+      std::string err{exc.what()};
+      try {
+        startDockerDaemon();
+      } catch (const std::exception& start_exc) {
+        err += std::string("; ") + start_exc.what();
+      }
+      return {false, err};
+    }
+  }
+  std::atomic<std::size_t> next_group{0};
+  std::mutex err_mutex;
+  std::string err;
+  const auto load_images = [&]() {
+    for (auto ii = next_group++; ii < groups.size(); ii = next_group++) {
+      for (const auto image_index : groups[ii]) {
+        const auto& image{images[image_index]};
+        try {
+          if (docker_store) {
+            LOG_DEBUG << "Importing image: " << image.dir << " --> " << docker_root_ << " as " << image.tag;
+            docker_store->importImage(image.dir, {image.uri, image.tag}, image.blob_dir);
+          } else {
+            LOG_DEBUG << "Loading image: " << image.dir << " --> docker-daemon://" << image.tag;
+            installImage(client_, image.dir, image.blob_dir.parent_path(), docker_host_, image.tag);
+          }
+          std::lock_guard<std::mutex> lock{preinstalled_images_mutex_};
+          preinstalled_images_.emplace(image.tag);
+        } catch (const std::exception& exc) {
+          std::lock_guard<std::mutex> lock{err_mutex};
+          err += (err.empty() ? "" : "; ") + image.tag + ": " + exc.what();
+        }
+      }
+    }
+  };
+
+  const std::size_t worker_numb{std::min(static_cast<std::size_t>(std::max(install_concurrency_, 1)),
+                                         std::max<std::size_t>(groups.size(), 1))};
+  LOG_INFO << "Loading " << images.size() << " App images, up to " << worker_numb << " images concurrently";
+  std::vector<std::thread> workers;
+  for (std::size_t ii = 1; ii < worker_numb; ++ii) {
+    workers.emplace_back(load_images);
+  }
+  load_images();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  if (docker_store) {
+    std::string store_err;
+    try {
+      docker_store->commit();
+    } catch (const std::exception& exc) {
+      store_err = exc.what();
+    }
+    // the daemon is started even if the import failed, it's up to the next install attempt to import the rest
+    try {
+      startDockerDaemon();
+    } catch (const std::exception& exc) {
+      store_err += (store_err.empty() ? "" : "; ") + std::string(exc.what());
+    }
+    if (!store_err.empty()) {
+      std::lock_guard<std::mutex> lock{preinstalled_images_mutex_};
+      preinstalled_images_.clear();
+      return {false, store_err};
+    }
+  }
+  if (!err.empty()) {
+    return {false, err};
+  }
+  return true;
+}
+
+std::vector<AppEngine::Result> RestorableAppEngine::runApps(
+    RestorableAppEngine& engine, const Apps& apps, int jobs,
+    const std::function<std::unique_ptr<RestorableAppEngine>()>& make_engine) {
+  // each image shared by a few Apps is loaded just once and the images sharing layers are loaded one after another
+  engine.setInstallConcurrency(jobs);
+  const auto images_res{engine.installImages(apps)};
+  if (!images_res) {
+    // the images that have not been loaded are loaded again along with their App
+    LOG_WARNING << "Failed to load some of App images ahead of starting Apps: " << images_res.err;
+  }
+  std::unordered_set<std::string> loaded_images;
+  {
+    std::lock_guard<std::mutex> lock{engine.preinstalled_images_mutex_};
+    loaded_images = engine.preinstalled_images_;
+  }
+
+  std::vector<Result> results(apps.size(), Result{false});
+  std::atomic<std::size_t> next{0};
+  std::vector<std::unique_ptr<RestorableAppEngine>> job_engines;
+  const std::size_t job_numb{std::min(static_cast<std::size_t>(std::max(jobs, 1)), apps.size())};
+  for (std::size_t ii = 0; ii < job_numb; ++ii) {
+    job_engines.emplace_back(make_engine());
+    job_engines.back()->preinstalled_images_ = loaded_images;
+  }
+  const auto run_apps = [&](RestorableAppEngine& job_engine) {
+    for (auto ii = next++; ii < apps.size(); ii = next++) {
+      LOG_INFO << "Starting App: " << apps[ii].name;
+      results[ii] = job_engine.run(apps[ii]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (auto& job_engine : job_engines) {
+    workers.emplace_back(run_apps, std::ref(*job_engine));
   }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return results;
 }
 
 bool RestorableAppEngine::isAppFetched(const App& app) const {
@@ -514,7 +1673,7 @@ bool RestorableAppEngine::isAppFetched(const App& app) const {
       break;
     }
 
-    const auto manifest_hash{getContentHash(manifest_file)};
+    const auto manifest_hash{getVerifiedContentHash(manifest_file, uri.digest.hash())};
     if (manifest_hash != uri.digest.hash()) {
       LOG_DEBUG << app.name << ": App manifest hash mismatch; actual: " << manifest_hash
                 << "; expected: " << uri.digest.hash();
@@ -525,14 +1684,14 @@ bool RestorableAppEngine::isAppFetched(const App& app) const {
 
     // verify App archive/blob hash
     const auto archive_manifest_hash{HashedDigest(manifest.archiveDigest()).hash()};
-    const auto archive_full_path{app_dir / (archive_manifest_hash + Manifest::ArchiveExt)};
+    const auto archive_full_path{app_dir / (archive_manifest_hash + manifest.archiveExt())};
     if (!boost::filesystem::exists(archive_full_path)) {
       LOG_DEBUG << app.name << ": missing App archive: " << archive_full_path;
       break;
     }
 
     // we assume that a compose App blob is relatively small so we can just read it all into RAM
-    const auto app_arch_hash{getContentHash(archive_full_path)};
+    const auto app_arch_hash{getVerifiedContentHash(archive_full_path, archive_manifest_hash)};
     if (app_arch_hash != archive_manifest_hash) {
       LOG_DEBUG << app.name << ": App archive hash mismatch; actual: " << app_arch_hash
                 << "; defined in manifest: " << archive_manifest_hash;
@@ -561,19 +1720,38 @@ bool RestorableAppEngine::isAppFetched(const App& app) const {
     res = areAppImagesFetched(app);
   } while (false);
 
+  content_index_.flush();
   return res;
 }
 
+bool RestorableAppEngine::isAppStepJournaled(const Uri& uri, const boost::filesystem::path& app_dir) const {
+  // the files could have been removed since the step was recorded
+  return fetch_journal_.isDone(uri.app + "/" + uri.digest.hash(), FetchJournal::AppStep) &&
+         boost::filesystem::exists(app_dir / Manifest::Filename) && boost::filesystem::exists(app_dir / ComposeFile) &&
+         boost::filesystem::exists(app_dir / "uri");
+}
+
 bool RestorableAppEngine::areAppImagesFetched(const App& app) const {
   const Uri uri{Uri::parseUri(app.uri)};
   const auto app_dir{apps_root_ / uri.app / uri.digest.hash()};
   const auto compose_file{app_dir / ComposeFile};
 
-  ComposeInfo compose{compose_file.string()};
-  for (const auto& service : compose.getServices()) {
-    const auto image = compose.getImage(service);
+  // layers to hash if the deep verification is on, the layers shared by the App images are hashed just once
+  std::set<std::string> layers_to_verify;
+  // the size of the layers shared by the App images is checked just once too
+  std::unordered_set<HashedDigest, HashedDigest::Hasher> checked_layers;
+  const auto compose{ComposeInfo::load(compose_file.string())};
+  for (const auto& service : compose->services()) {
+    const auto& image = service.image;
     const Uri image_uri{Uri::parseUri(image, false)};
-    const auto image_root{app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash()};
+    auto image_root{app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash()};
+    auto blob_dir{blobs_root_ / "sha256"};
+    // an image installed in place doesn't need to be in the store, the bundle it comes from is never altered
+    const auto in_place_src{getInPlaceImageSrc(uri, image_uri)};
+    if (in_place_src) {
+      image_root = in_place_src->image_dir;
+      blob_dir = in_place_src->blob_dir;
+    }
 
     const auto index_manifest{image_root / "index.json"};
     if (!boost::filesystem::exists(index_manifest)) {
@@ -587,34 +1765,41 @@ bool RestorableAppEngine::areAppImagesFetched(const App& app) const {
     // the image digest (image_uri.digest.hash()) with a hash of actuall content of index.json.
     // TODO: consider patching skopeo or adding cli param to make it store an intact image index manifest.
 
-    const auto manifest_desc{Utils::parseJSONFile(index_manifest)};
-    HashedDigest manifest_digest{manifest_desc["manifests"][0]["digest"].asString()};
+    auto& manifests{OciManifestCache::instance()};
+    const auto image_index{manifests.imageIndex(image_root)};
+    const auto& manifest_digest{image_index->manifest().digest};
 
-    const auto manifest_file{blobs_root_ / "sha256" / manifest_digest.hash()};
+    const auto manifest_file{blob_dir / manifest_digest.hash()};
     if (!boost::filesystem::exists(manifest_file)) {
       LOG_DEBUG << app.name << ": missing App image manifest; image: " << image << "; manifest: " << manifest_file;
       return false;
     }
 
-    const auto manifest_hash{getContentHash(manifest_file)};
+    const auto manifest_hash{getVerifiedContentHash(manifest_file, manifest_digest.hash())};
     if (manifest_hash != manifest_digest.hash()) {
       LOG_DEBUG << app.name << ": App image manifest hash mismatch; actual: " << manifest_hash
                 << "; expected: " << manifest_digest.hash();
       return false;
     }
 
-    const auto manifest{Utils::parseJSONFile(blobs_root_ / "sha256" / manifest_digest.hash())};
+    std::shared_ptr<const ImageManifest> manifest;
+    try {
+      manifest = manifests.imageManifest(blob_dir, manifest_digest);
+    } catch (const std::invalid_argument& exc) {
+      LOG_ERROR << app.name << ": invalid image manifest; image: " << image << "; err: " << exc.what();
+      return false;
+    }
 
     // check image config file/blob
-    const auto config_digest{HashedDigest(manifest["config"]["digest"].asString())};
-    const auto config_file{blobs_root_ / "sha256" / config_digest.hash()};
+    const auto& config_digest{manifest->config.digest};
+    const auto config_file{blob_dir / config_digest.hash()};
 
     if (!boost::filesystem::exists(config_file)) {
       LOG_DEBUG << app.name << ": missing App image config file; image: " << image << "; manifest: " << config_file;
       return false;
     }
 
-    const auto config_hash{getContentHash(config_file)};
+    const auto config_hash{getVerifiedContentHash(config_file, config_digest.hash())};
     if (config_hash != config_digest.hash()) {
       LOG_DEBUG << app.name << ": App image config hash mismatch; actual: " << config_hash
                 << "; expected: " << config_digest.hash();
@@ -623,34 +1808,49 @@ bool RestorableAppEngine::areAppImagesFetched(const App& app) const {
 
     // check layers, just check blobs' size since generation of their hashes might consumes
     // too much CPU for a given device ???
-    const auto layers{manifest["layers"]};
-    for (Json::ValueConstIterator ii = layers.begin(); ii != layers.end(); ++ii) {
-      if ((*ii).isObject() && (*ii).isMember("digest") && (*ii).isMember("size")) {
-        const auto layer_digest{HashedDigest{(*ii)["digest"].asString()}};
-        const auto layer_size{(*ii)["size"].asInt64()};
-        const auto blob_path{blobs_root_ / "sha256" / layer_digest.hash()};
-        if (!boost::filesystem::exists(blob_path)) {
-          LOG_DEBUG << app.name << ": missing App image blob; image: " << image << "; blob: " << blob_path;
-          return false;
-        }
-        const auto blob_size{boost::filesystem::file_size(blob_path)};
-        if (blob_size != layer_size) {
-          LOG_DEBUG << app.name << ": App image blob size mismatch; blob: " << blob_path << "; actual: " << blob_size
-                    << "; expected: " << layer_size;
-          // `skopeo copy` gets crazy if one or more blobs are invalid/altered/broken, it just simply fails
-          // instead of refetching it (another candidate for patching),
-          // so, we just remove the broken blob.
+    for (const auto& layer : manifest->layers) {
+      const auto& layer_digest{layer.digest};
+      if (checked_layers.count(layer_digest) > 0) {
+        continue;
+      }
+      const auto blob_path{blob_dir / layer_digest.hash()};
+      if (!boost::filesystem::exists(blob_path)) {
+        LOG_DEBUG << app.name << ": missing App image blob; image: " << image << "; blob: " << blob_path;
+        return false;
+      }
+      const auto blob_size{boost::filesystem::file_size(blob_path)};
+      if (blob_size != static_cast<uint64_t>(layer.size)) {
+        LOG_DEBUG << app.name << ": App image blob size mismatch; blob: " << blob_path << "; actual: " << blob_size
+                  << "; expected: " << layer.size;
+        // `skopeo copy` gets crazy if one or more blobs are invalid/altered/broken, it just simply fails
+        // instead of refetching it (another candidate for patching),
+        // so, we just remove the broken blob.
+        if (!in_place_src) {
           boost::filesystem::remove(blob_path);
-          return false;
+          blob_index_.remove(layer_digest.hash());
         }
-
-      } else {
-        LOG_ERROR << app.name << ": invalid image manifest: " << ii.key().asString() << " -> " << *ii;
         return false;
       }
+      if (deep_verify_ && !in_place_src) {
+        layers_to_verify.emplace(layer_digest.hash());
+      }
+      checked_layers.emplace(layer_digest);
     }
   }
 
+  if (!layers_to_verify.empty()) {
+    LOG_DEBUG << app.name << ": hashing " << layers_to_verify.size() << " App image blobs";
+    const auto corrupted{
+        findCorruptedBlobs(blobs_root_ / "sha256", {layers_to_verify.begin(), layers_to_verify.end()})};
+    for (const auto& blob : corrupted) {
+      LOG_WARNING << app.name << ": App image blob hash mismatch, removing it; blob: " << blob;
+      boost::filesystem::remove(blobs_root_ / "sha256" / blob);
+      blob_index_.remove(blob);
+    }
+    if (!corrupted.empty()) {
+      return false;
+    }
+  }
   return true;
 }
 
@@ -664,13 +1864,9 @@ bool RestorableAppEngine::isAppInstalled(const App& app) const {
     const auto manifest_file{app_dir / Manifest::Filename};
     const Manifest manifest{Utils::parseJSONFile(manifest_file)};
     const auto archive_manifest_hash{HashedDigest(manifest.archiveDigest()).hash()};
-    const auto archive_full_path{app_dir / (archive_manifest_hash + Manifest::ArchiveExt)};
+    const auto archive_full_path{app_dir / (archive_manifest_hash + manifest.archiveExt())};
 
-    exec(boost::format{"tar -xzf %s %s"} % archive_full_path % ComposeFile,
-         app.name + ": failed to extract a compose file from the compose app archive",
-         boost::this_process::environment(), boost::process::start_dir = app_dir);
-
-    const auto compose_file_str = Utils::readFile(app_dir / ComposeFile);
+    const auto compose_file_str = AppArchive(archive_full_path).readFile(ComposeFile);
     const auto compose_file_hash =
         boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(compose_file_str)));
     const auto installed_compose_file_str = Utils::readFile(app_install_dir / ComposeFile);
@@ -703,8 +1899,8 @@ bool RestorableAppEngine::areContainersCreated(const App& app, const std::string
 bool RestorableAppEngine::checkAppContainers(const App& app, const std::string& compose_file,
                                              const Docker::DockerClient::Ptr& docker_client, bool check_state) {
   bool result{true};
-  ComposeInfo compose{compose_file};
-  std::vector<Json::Value> services = compose.getServices();
+  const auto compose{ComposeInfo::load(compose_file)};
+  const auto& services{compose->services()};
 
   if (services.empty()) {
     throw std::runtime_error("No services found in App's compose file");
@@ -712,13 +1908,14 @@ bool RestorableAppEngine::checkAppContainers(const App& app, const std::string&
 
   Json::Value containers;
   docker_client->getContainers(containers);
-
-  for (std::size_t i = 0; i < services.size(); i++) {
-    std::string service = services[i].asString();
-    std::string hash = compose.getHash(services[i]);
-    const auto container_state{docker_client->getContainerState(containers, app.name, service, hash)};
-    if (std::get<0>(container_state) /* container exists */ &&
-        (!check_state || std::get<1>(container_state) != "created")) {
+  const auto container_states{docker_client->getContainerStates(containers)};
+
+  for (const auto& compose_service : services) {
+    const std::string& service = compose_service.name;
+    const std::string& hash = compose_service.hash;
+    const auto container_state{container_states.find(std::make_tuple(app.name, service, hash))};
+    if (container_state != container_states.end() /* container exists */ &&
+        (!check_state || container_state->second != "created")) {
       continue;
     }
     LOG_WARNING << "App: " << app.name << ", service: " << service << ", hash: " << hash << ", not running!";
@@ -770,19 +1967,206 @@ void RestorableAppEngine::stopComposeApp(const std::string& compose_cmd, const b
 }
 
 std::string RestorableAppEngine::getContentHash(const boost::filesystem::path& path) {
-  const auto content{Utils::readFile(path)};
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(content)));
+  // stream the file content through the hasher instead of reading it into memory, App archives and layers can be
+  // big; OpenSSL, which the hasher is backed by, makes use of the CPU SHA extensions if they are available
+  static const std::size_t ReadBufferSize{1024 * 1024};
+  const int fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (fd == -1) {
+    throw std::runtime_error("Failed to open " + path.string() + ": " + std::strerror(errno));
+  }
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  std::vector<unsigned char> buffer(ReadBufferSize);
+  MultiPartSHA256Hasher hasher;
+  ssize_t read_size;
+  while ((read_size = ::read(fd, buffer.data(), buffer.size())) != 0) {
+    if (read_size == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      const std::string err{std::strerror(errno)};
+      ::close(fd);
+      throw std::runtime_error("Failed to read " + path.string() + ": " + err);
+    }
+    hasher.update(buffer.data(), static_cast<uint64_t>(read_size));
+  }
+  ::close(fd);
+  return boost::algorithm::to_lower_copy(hasher.getHexDigest());
 }
 
-uint64_t RestorableAppEngine::getAppUpdateSize(const Json::Value& app_layers, const boost::filesystem::path& blob_dir) {
-  std::unordered_set<std::string> store_blobs;
+std::vector<std::string> RestorableAppEngine::findCorruptedBlobs(const boost::filesystem::path& blob_dir,
+                                                                 const std::vector<std::string>& blobs) {
+  std::vector<std::string> corrupted;
+  std::mutex corrupted_mutex;
+  std::atomic<std::size_t> next_blob{0};
+  const auto verify_blobs = [&]() {
+    for (auto ii = next_blob++; ii < blobs.size(); ii = next_blob++) {
+      std::string hash;
+      try {
+        hash = getContentHash(blob_dir / blobs[ii]);
+      } catch (const std::exception& exc) {
+        LOG_WARNING << "Failed to hash App image blob: " << exc.what();
+      }
+      if (hash != blobs[ii]) {
+        std::lock_guard<std::mutex> lock{corrupted_mutex};
+        corrupted.emplace_back(blobs[ii]);
+      }
+    }
+  };
 
-  if (boost::filesystem::exists(blob_dir)) {
-    for (const boost::filesystem::directory_entry& entry : boost::filesystem::directory_iterator(blob_dir)) {
-      store_blobs.emplace(entry.path().filename().string());
+  const std::size_t worker_numb{
+      std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U), std::max<std::size_t>(blobs.size(), 1))};
+  std::vector<std::thread> workers;
+  for (std::size_t ii = 1; ii < worker_numb; ++ii) {
+    workers.emplace_back(verify_blobs);
+  }
+  verify_blobs();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return corrupted;
+}
+
+void RestorableAppEngine::importImageBlobs(const Uri& image_uri) const {
+  std::vector<std::string> blobs;
+  const auto add_manifest_blobs = [&](const HashedDigest& digest) {
+    if (!boost::filesystem::exists(blob_import_dir_ / digest.hash())) {
+      return;
+    }
+    const ImageManifest manifest{Utils::parseJSONFile(blob_import_dir_ / digest.hash())};
+    blobs.emplace_back(digest.hash());
+    blobs.emplace_back(manifest.config.digest.hash());
+    for (const auto& layer : manifest.layers) {
+      blobs.emplace_back(layer.digest.hash());
     }
+  };
+
+  const auto root_path{blob_import_dir_ / image_uri.digest.hash()};
+  if (!boost::filesystem::exists(root_path)) {
+    return;
   }
+  try {
+    const auto root{Utils::parseJSONFile(root_path)};
+    if (root.isMember("manifests")) {
+      // a multi-arch image, a bundle usually includes the manifests of just some of the platforms
+      blobs.emplace_back(image_uri.digest.hash());
+      for (const auto& manifest : ImageIndex(root).manifests) {
+        add_manifest_blobs(manifest.digest);
+      }
+    } else {
+      add_manifest_blobs(image_uri.digest);
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to parse image manifest, its blobs are not imported: " << root_path << ", " << exc.what();
+    return;
+  }
+  importBlobs(blob_import_dir_, blobs_root_ / "sha256", blobs);
+}
 
+// Tries the cheapest way first: a hardlink and a reflink share the data, copy_file_range() and sendfile() copy it
+// in-kernel, without passing it through userspace buffers
+static void importFile(const boost::filesystem::path& src, const boost::filesystem::path& dst) {
+  if (::link(src.c_str(), dst.c_str()) == 0) {
+    return;
+  }
+  const int src_fd{::open(src.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (src_fd == -1) {
+    throw std::runtime_error("Failed to open " + src.string() + ": " + std::strerror(errno));
+  }
+  const int dst_fd{
+      ::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)};
+  if (dst_fd == -1) {
+    const std::string err{std::strerror(errno)};
+    ::close(src_fd);
+    throw std::runtime_error("Failed to open " + dst.string() + ": " + err);
+  }
+
+  bool done{::ioctl(dst_fd, FICLONE, src_fd) == 0};
+  bool use_sendfile{false};
+  while (!done) {
+    const ssize_t res{use_sendfile ? ::sendfile(dst_fd, src_fd, nullptr, 1U << 30U)
+                                   : ::copy_file_range(src_fd, nullptr, dst_fd, nullptr, 1U << 30U, 0)};
+    if (res > 0) {
+      continue;
+    }
+    if (res == 0) {
+      done = true;
+    } else if (errno == EINTR) {
+      continue;
+    } else if (!use_sendfile && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+      // copy_file_range() across file systems is not supported by older kernels, nothing has been copied yet
+      use_sendfile = true;
+    } else {
+      break;
+    }
+  }
+  const std::string err{std::strerror(errno)};
+  ::close(src_fd);
+  if (::close(dst_fd) != 0 || !done) {
+    throw std::runtime_error("Failed to copy " + src.string() + " to " + dst.string() + ": " + err);
+  }
+}
+
+void RestorableAppEngine::importBlobs(const boost::filesystem::path& src_dir, const boost::filesystem::path& dst_dir,
+                                      const std::vector<std::string>& blobs) {
+  boost::filesystem::create_directories(dst_dir);
+  std::atomic<std::size_t> next_blob{0};
+  std::atomic<std::size_t> imported{0};
+  const auto import_blobs = [&]() {
+    for (auto ii = next_blob++; ii < blobs.size(); ii = next_blob++) {
+      const auto& blob{blobs[ii]};
+      const auto dst_path{dst_dir / blob};
+      if (boost::filesystem::exists(dst_path) || !boost::filesystem::exists(src_dir / blob)) {
+        continue;
+      }
+      const boost::filesystem::path tmp_path{dst_path.string() + ".import"};
+      try {
+        boost::filesystem::remove(tmp_path);
+        importFile(src_dir / blob, tmp_path);
+        // the store blobs are trusted, so the content is verified before it gets there
+        if (getContentHash(tmp_path) != blob) {
+          LOG_WARNING << "Hash of the blob to import doesn't match its name, skipping it: " << src_dir / blob;
+          boost::filesystem::remove(tmp_path);
+          continue;
+        }
+        boost::filesystem::rename(tmp_path, dst_path);
+        ++imported;
+      } catch (const std::exception& exc) {
+        LOG_WARNING << "Failed to import blob " << blob << ": " << exc.what();
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmp_path, ec);
+      }
+    }
+  };
+
+  const std::size_t worker_numb{
+      std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U), std::max<std::size_t>(blobs.size(), 1))};
+  std::vector<std::thread> workers;
+  for (std::size_t ii = 1; ii < worker_numb; ++ii) {
+    workers.emplace_back(import_blobs);
+  }
+  import_blobs();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  LOG_DEBUG << "Imported " << imported << " of " << blobs.size() << " blobs from " << src_dir;
+}
+
+std::string RestorableAppEngine::getVerifiedContentHash(const boost::filesystem::path& path,
+                                                        const std::string& expected_hash) const {
+  if (content_index_.isVerified(path, expected_hash)) {
+    return expected_hash;
+  }
+  const auto hash{getContentHash(path)};
+  if (hash == expected_hash) {
+    content_index_.setVerified(path, hash);
+  }
+  return hash;
+}
+
+BlobIndex::BlobSize RestorableAppEngine::getAppUpdateSize(
+    const Json::Value& app_layers, const BlobIndex& blob_index,
+    std::unordered_map<std::string, BlobIndex::BlobSize>& missing_blobs) {
   // It can happen that one or more currently stored blobs/layers are not needed for the new App
   // and they will be purged after an update completion therefore we actually will need less than
   // `total_update_size` additional storage to accomodate a new App. Moreover, a new App even might
@@ -791,11 +2175,20 @@ uint64_t RestorableAppEngine::getAppUpdateSize(const Json::Value& app_layers, co
   // are stored on storage, thus we need to make sure that underlying storage can accomodate the sum of the Apps'
   // layers set/list.
 
-  uint64_t skopeo_total_update_size{0};
+  BlobIndex::BlobSize total_update_size;
+
+  const auto addSize = [](uint64_t& total, uint64_t size) {
+    const uint64_t new_total = total + size;
+    if (new_total < total || new_total < size) {
+      throw std::overflow_error("Sum of layer sizes exceeded the maximum allowed value: " +
+                                std::to_string(std::numeric_limits<uint64_t>::max()));
+    }
+    total = new_total;
+  };
 
   for (Json::ValueConstIterator ii = app_layers.begin(); ii != app_layers.end(); ++ii) {
     const HashedDigest digest{(*ii)["digest"].asString()};
-    if (store_blobs.count(digest.hash()) == 0) {
+    if (!blob_index.isPresent(digest.hash())) {
       // According to the spec the `size` field must be int64
       // https://github.com/opencontainers/image-spec/blob/main/descriptor.md#properties
       const auto size_obj{(*ii)["size"]};
@@ -808,19 +2201,44 @@ uint64_t RestorableAppEngine::getAppUpdateSize(const Json::Value& app_layers, co
         throw std::range_error("Invalid value of a layer size, must be > 0, got: " + std::to_string(size));
       }
 
-      const uint64_t new_total_update_size = skopeo_total_update_size + size;
-      if (new_total_update_size < skopeo_total_update_size || new_total_update_size < size) {
-        throw std::overflow_error("Sum of layer sizes exceeded the maximum allowed value: " +
-                                  std::to_string(std::numeric_limits<uint64_t>::max()));
+      BlobIndex::BlobSize blob_size{static_cast<uint64_t>(size), 0};
+      // `usage` is the layer size once extracted in the docker store, if the layers manifest doesn't provide it
+      // then it is approximated by means of the average layer compression ratio
+      const auto usage_obj{(*ii)[LayerUsageField]};
+      bool usage_estimated{false};
+      if (usage_obj.isNull()) {
+        blob_size.usage = getDockerStoreSizeForAppUpdate(blob_size.size, AverageCompressionRatio);
+        usage_estimated = true;
+      } else if (!usage_obj.isInt64() || usage_obj.asInt64() < 0) {
+        throw std::range_error("Invalid value of a layer usage, must be a non-negative int64, got: " +
+                               usage_obj.asString());
+      } else {
+        blob_size.usage = usage_obj.asUInt64();
       }
 
-      LOG_INFO << "\t" << digest.hash() << " -> missing; to be downloaded; size: " << size;
-      skopeo_total_update_size = new_total_update_size;
+      addSize(total_update_size.size, blob_size.size);
+      addSize(total_update_size.usage, blob_size.usage);
+      LOG_INFO << "\t" << digest.hash() << " -> missing; to be downloaded; size: " << blob_size.size
+               << ", usage: " << blob_size.usage << (usage_estimated ? " (estimated)" : "");
+      missing_blobs.emplace(digest.hash(), blob_size);
     } else {
       LOG_INFO << "\t" << digest.hash() << " -> exists";
     }
   }
-  return skopeo_total_update_size;
+  return total_update_size;
+}
+
+uint64_t RestorableAppEngine::getBlobStoreSize(const boost::filesystem::path& blob_dir) {
+  uint64_t size{0};
+  boost::system::error_code ec;
+  for (boost::filesystem::directory_iterator it{blob_dir, ec}, end; !ec && it != end; it.increment(ec)) {
+    boost::system::error_code size_ec;
+    const auto file_size{boost::filesystem::file_size(it->path(), size_ec)};
+    if (!size_ec) {
+      size += file_size;
+    }
+  }
+  return size;
 }
 
 uint64_t RestorableAppEngine::getDockerStoreSizeForAppUpdate(const uint64_t& compressed_update_size,
@@ -835,6 +2253,22 @@ uint64_t RestorableAppEngine::getDockerStoreSizeForAppUpdate(const uint64_t& com
   return docker_total_update_size;
 }
 
+void RestorableAppEngine::checkAvailableStorage(const boost::filesystem::path& path, uint64_t required_storage,
+                                                const std::string& purpose) {
+  boost::system::error_code ec;
+  const boost::filesystem::space_info storage_info{boost::filesystem::space(path, ec)};
+  if (ec.failed()) {
+    LOG_WARNING << "Failed to get an available storage size: " << ec.message();
+    return;
+  }
+  // 80% is a storage space watermark, we don't want to fill a storage volume above it
+  const auto available = static_cast<boost::uintmax_t>(storage_info.available * 0.8);
+  if (required_storage > available) {
+    throw std::runtime_error("There is no sufficient storage space available to " + purpose + ", available: " +
+                             std::to_string(available) + " need: " + std::to_string(required_storage));
+  }
+}
+
 void RestorableAppEngine::checkAvailableStorageInStores(const std::string& app_name,
                                                         const uint64_t& skopeo_required_storage,
                                                         const uint64_t& docker_required_storage) const {
@@ -844,8 +2278,11 @@ void RestorableAppEngine::checkAvailableStorageInStores(const std::string& app_n
     boost::uintmax_t available;
 
     std::tie(capacity, available) = storage_space_func_(store_path);
+    // the storage committed to the other transfers in progress, e.g. App archive downloads, is not available
+    const auto reserved{getReservedStorage(store_path)};
+    available = available > reserved ? available - reserved : 0;
     LOG_INFO << app_name << " -> " << store_name << " store total update size: " << required_storage
-             << " bytes; available: " << available << " (out of " << capacity << ") "
+             << " bytes; available: " << available << " (out of " << capacity << ", reserved: " << reserved << ") "
              << ", path: " << store_path.string();
     if (required_storage > available) {
       throw InsufficientSpaceError(store_name, store_path.string(), required_storage, available);
@@ -866,6 +2303,46 @@ void RestorableAppEngine::checkAvailableStorageInStores(const std::string& app_n
   }
 }
 
+RestorableAppEngine::StorageReservation::StorageReservation(const RestorableAppEngine& engine, uint64_t volume,
+                                                            uint64_t size)
+    : engine_{engine}, volume_{volume}, size_{size} {}
+
+RestorableAppEngine::StorageReservation::~StorageReservation() {
+  std::lock_guard<std::mutex> lock{engine_.storage_ledger_mutex_};
+  auto& reserved{engine_.storage_ledger_[volume_]};
+  reserved = reserved > size_ ? reserved - size_ : 0;
+}
+
+std::unique_ptr<RestorableAppEngine::StorageReservation> RestorableAppEngine::reserveStorage(
+    const boost::filesystem::path& path, uint64_t size, const std::string& purpose) const {
+  boost::system::error_code ec;
+  const boost::filesystem::space_info storage_info{boost::filesystem::space(path, ec)};
+  if (ec.failed()) {
+    LOG_WARNING << "Failed to get an available storage size: " << ec.message();
+  }
+  // the same watermark as checkAvailableStorage() applies
+  const auto available{static_cast<boost::uintmax_t>(storage_info.available * 0.8)};
+  // the volume is unknown if its ID cannot be obtained, such reservations are accounted together
+  const auto volume{std::get<0>(getPathVolumeID(path))};
+
+  std::lock_guard<std::mutex> lock{storage_ledger_mutex_};
+  auto& reserved{storage_ledger_[volume]};
+  if (!ec.failed() && size + reserved > available) {
+    LOG_ERROR << "There is no sufficient storage space available to " << purpose << ", available: " << available
+              << " need: " << size << ", reserved by other transfers: " << reserved;
+    throw InsufficientSpaceError("apps", path.string(), size + reserved, available);
+  }
+  reserved += size;
+  return std::unique_ptr<StorageReservation>(new StorageReservation(*this, volume, size));
+}
+
+uint64_t RestorableAppEngine::getReservedStorage(const boost::filesystem::path& path) const {
+  const auto volume{std::get<0>(getPathVolumeID(path))};
+  std::lock_guard<std::mutex> lock{storage_ledger_mutex_};
+  const auto found_it{storage_ledger_.find(volume)};
+  return found_it != storage_ledger_.end() ? found_it->second : 0;
+}
+
 bool RestorableAppEngine::areDockerAndSkopeoOnTheSameVolume(const boost::filesystem::path& skopeo_path,
                                                             const boost::filesystem::path& docker_path) {
   const auto skopeoVolumeID{getPathVolumeID(skopeo_path.parent_path())};
@@ -4,9 +4,24 @@
 #include "appengine.h"
 
 #include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_set>
 
+#include <boost/optional.hpp>
+
+#include "docker/apptree.h"
+#include "docker/blobindex.h"
+#include "docker/blobrefs.h"
+#include "docker/composeverifycache.h"
+#include "docker/contentindex.h"
 #include "docker/docker.h"
 #include "docker/dockerclient.h"
+#include "docker/dockerstore.h"
+#include "docker/fetchjournal.h"
+#include "docker/imagepuller.h"
+#include "docker/nativecompose.h"
 
 namespace Docker {
 
@@ -16,7 +31,7 @@ namespace Docker {
  *
  *
  * PackageManagerInterface::fetchTarget()
- * - Pulls Apps from Registries by using `skopeo` and store Apps' content under the folder defined in
+ * - Pulls Apps from Registries by using `skopeo` (or ImagePuller) and store Apps' content under the folder defined in
  * sota.toml:[pacman].reset_apps_root param
  *
  * PackageManagerInterface::install()
@@ -48,6 +63,16 @@ namespace Docker {
  *          ...
  *          <blob-N>
  *
+ *      manifests/ (App, layers and image manifests cached by RegistryClient, keyed by their hashes)
+ *        <manifest-hash-01>
+ *        ...
+ *
+ *      content-index.json (size, mtime and inode of the App and image files which hashes have been verified)
+ *
+ *      blob-refs.json (blobs and manifests referenced by each fetched App version, i.e. `<app-name>/<app-hash>`)
+ *
+ *      previous-versions.json (the hashes of the App versions kept for a rollback, see `setRetainPrevious()`)
+ *
  *
  * Compose App dir layout
  *
@@ -77,10 +102,33 @@ class RestorableAppEngine : public AppEngine {
   using StorageSpaceFunc =
       std::function<std::tuple<boost::uintmax_t, boost::uintmax_t>(const boost::filesystem::path&)>;
   using ClientImageSrcFunc = std::function<std::string(const Docker::Uri&, const std::string&)>;
+  // An App image stored outside of the store, an OCI image layout dir and the dir its blobs are in, i.e.
+  // `<shared-blob-dir>/sha256`
+  struct ImageSrc {
+    boost::filesystem::path image_dir;
+    boost::filesystem::path blob_dir;
+  };
+  using InPlaceImageSrcFunc = std::function<ImageSrc(const Docker::Uri& app_uri, const Docker::Uri& image_uri)>;
+
+  // the optional field of a layers manifest entry, the amount of storage the layer occupies once extracted
+  static const std::string LayerUsageField;
+  // the optional field of a layers manifest entry, the binary deltas the layer can be reconstructed with from
+  // another layer, e.g. `[{"from": "sha256:<layer>", "digest": "sha256:<delta blob>", "size": 1024,
+  // "format": "zstd"}]`, the delta blobs are stored in the App repository, the supported formats are `zstd`
+  // (`zstd --patch-from`) and `bsdiff`
+  static const std::string LayerDeltasField;
+  // used to approximate the extracted layer size if the layers manifest doesn't specify it
+  static const uint32_t AverageCompressionRatio{5};
+
+  // the partially downloaded blobs not modified for this long are removed by the full-scan prune even if the blob
+  // is not referenced yet, the more recent ones may belong to a download in progress
+  static const int PartFileMaxAgeSec{24 * 60 * 60};
 
   static const int LowWatermarkLimit{20};
   static const int HighWatermarkLimit{95};
   static StorageSpaceFunc GetDefStorageSpaceFunc(int watermark = 80);
+  // The sha256 hash of the given file content, the content is streamed through the hasher
+  static std::string getContentHash(const boost::filesystem::path& path);
 
   RestorableAppEngine(
       boost::filesystem::path store_root, boost::filesystem::path install_root, boost::filesystem::path docker_root,
@@ -90,9 +138,20 @@ class RestorableAppEngine : public AppEngine {
       StorageSpaceFunc storage_space_func = RestorableAppEngine::GetDefStorageSpaceFunc(),
       ClientImageSrcFunc client_image_src_func = [](const Docker::Uri& /* app_uri */,
                                                     const std::string& image_uri) { return "docker://" + image_uri; },
-      bool create_containers_if_install = true);
+      bool create_containers_if_install = true, ImagePuller::Ptr image_puller = nullptr);
+  ~RestorableAppEngine() override;
+  RestorableAppEngine(const RestorableAppEngine&) = delete;
+  RestorableAppEngine& operator=(const RestorableAppEngine&) = delete;
+  RestorableAppEngine(RestorableAppEngine&&) = delete;
+  RestorableAppEngine& operator=(RestorableAppEngine&&) = delete;
 
   Result fetch(const App& app) override;
+  // Downloads the manifests and archives of all the given Apps, up to `setFetchConcurrency()` Apps at once, and
+  // checks the storage for all of their missing layers by a single check. The planned Apps' fetches just pull images.
+  Result planFetch(const Apps& apps) override;
+  // Fetches just the manifests of the Apps missing in the store. A missing layer that has a delta from a layer present
+  // in the store is counted by the delta size.
+  Result estimateFetch(const Apps& apps, FetchCost& cost) const override;
   Result verify(const App& app) override;
   Result install(const App& app) override;
   Result run(const App& app) override;
@@ -102,22 +161,149 @@ class RestorableAppEngine : public AppEngine {
   bool isRunning(const App& app) const override;
   Json::Value getRunningAppsInfo() const override;
   void prune(const Apps& app_shortlist) override;
+  // Loads images of all the given Apps concurrently, up to `setInstallConcurrency()` images at once
+  Result installImages(const Apps& apps) override;
+  // Loads the images of all the given Apps by `installImages()` of the given engine and then runs up to `jobs` Apps
+  // at once. Each job runs its Apps by an engine of its own made by `make_engine`, so the jobs share no engine state,
+  // the engines are told which images have been loaded already. Returns the result of each App, in the given order.
+  static std::vector<Result> runApps(RestorableAppEngine& engine, const Apps& apps, int jobs,
+                                     const std::function<std::unique_ptr<RestorableAppEngine>()>& make_engine);
+  // Releases the previous versions of the given Apps kept by the retention, see `setRetainPrevious()`
+  void confirm(const Apps& apps) override;
+
+  // Sets a callback receiving the progress of App image pulls, it must be set before any fetch starts
+  void setProgressCb(DownloadProgressCb cb) { progress_cb_ = std::move(cb); }
+  // Makes the fetched-state check hash each App layer blob instead of just checking its size, the blobs are hashed
+  // concurrently, by up to one thread per CPU core
+  void setDeepVerify(bool deep_verify) { deep_verify_ = deep_verify; }
+  void setInstallConcurrency(int concurrency) { install_concurrency_ = concurrency; }
+  void setFetchConcurrency(int concurrency) { fetch_concurrency_ = concurrency; }
+  // Makes App images imported into the docker store directly instead of loading them through the daemon. The daemon
+  // reads its store only at its start and overwrites the image references on its stop, so it is stopped by the given
+  // stop command for the import and started by the start command after it. Unless the daemon has `live-restore`
+  // enabled, its containers are stopped along with it. The daemon is used if the docker store storage driver is not
+  // supported.
+  void setDirectImageInstall(std::string docker_stop_cmd, std::string docker_start_cmd) {
+    direct_image_install_ = true;
+    docker_stop_cmd_ = std::move(docker_stop_cmd);
+    docker_start_cmd_ = std::move(docker_start_cmd);
+  }
+  // Makes Apps brought up and down through the Docker Engine API instead of `docker compose` if their compose file
+  // uses just the features supported by `NativeCompose`, the other Apps are handled by `docker compose`. If
+  // `switch_over` is set, the updated services of a running App are switched over to their new containers created
+  // ahead, see `NativeCompose::setSwitchOver()`.
+  void setNativeCompose(bool native_compose, bool switch_over = false) {
+    native_compose_ = native_compose ? std::make_shared<NativeCompose>(docker_client_) : nullptr;
+    if (native_compose_) {
+      native_compose_->setSwitchOver(switch_over);
+    }
+  }
+  // Makes prune() remove just the images and the stopped containers of the removed App versions, by means of the
+  // given docker CLI, instead of pruning all the unused ones of the docker store. The removal runs in the background,
+  // so it doesn't delay the Apps start and the following reports.
+  void setSelectiveDockerPrune(std::string docker_cmd) { docker_cmd_ = std::move(docker_cmd); }
+  // Makes the version an App is updated from kept in the store, along with its images and, if the App is switched
+  // over natively, its stopped containers, till the App is confirmed to run, so a rollback to it neither fetches nor
+  // creates anything. It must be called after `setNativeCompose()`.
+  void setRetainPrevious(bool retain_previous) {
+    retain_previous_ = retain_previous;
+    if (native_compose_) {
+      native_compose_->setRetainPrevious(retain_previous);
+    }
+  }
+  // Makes Apps installed by hardlinking their files from the ostree repo at the given path instead of extracting
+  // their archives, see `AppTree`. An App is extracted if its check-out fails, e.g. the repo is on another volume.
+  void setAppTree(const boost::filesystem::path& path) { app_tree_ = std::make_shared<AppTree>(path); }
+  // Makes the image blobs found in the given OCI blob dir, e.g. the one of an offline update bundle, imported into the
+  // store before the images are pulled, so the image transfer utility finds them in the store and doesn't copy them.
+  // A blob is hardlinked if the dir is on the store volume, otherwise reflinked or copied in-kernel, and verified.
+  void setBlobImportDir(boost::filesystem::path blob_dir) { blob_import_dir_ = std::move(blob_dir); }
+  // Makes the App images found in the image layouts the given function points to, e.g. those of a mounted offline
+  // update bundle, installed right from there. Fetch doesn't pull such images into the store, it is up to the caller
+  // to do it by `fetchDeferredImages()` once Apps are installed, so Apps can still be restored from the store.
+  void setInPlaceImageSrc(InPlaceImageSrcFunc func) { in_place_image_src_ = std::move(func); }
+  // Makes a planned fetch that doesn't fit the store evict App versions from it till the fetch fits, the least recently
+  // installed ones first. The versions being fetched, running or retained for a rollback are not evicted, and just the
+  // blobs no other App version refers to are removed along with a version. Nothing is evicted unless each App version
+  // in the store is accounted in the blob reference table.
+  void setStoreEviction(bool store_eviction) { store_eviction_ = store_eviction; }
+  // The check the image pulls of ImagePuller stop at, before a download of a next blob, e.g. once the download
+  // the fetch is a part of is cancelled
+  void setCancelCheck(ImagePuller::CancelCheck cancel_check) { cancel_check_ = std::move(cancel_check); }
+  // Pulls the images of the given Apps skipped by fetch into the store, at the lowest CPU and IO priority
+  Result fetchDeferredImages(const Apps& apps);
 
  private:
+  // gives the benchmarks and the tests access to the private helpers
+  friend class RestorableAppEngineBench;
+  friend class RestorableAppEngineTestAccess;
+
+  // Returns the total size of the given layers missing in the store, both compressed and extracted, and collects
+  // them into `missing_blobs`
+  static BlobIndex::BlobSize getAppUpdateSize(const Json::Value& app_layers, const BlobIndex& blob_index,
+                                              std::unordered_map<std::string, BlobIndex::BlobSize>& missing_blobs);
   // pull App&Images
   void pullApp(const Uri& uri, const boost::filesystem::path& app_dir);
   void checkAppUpdateSize(const Uri& uri, const boost::filesystem::path& app_dir) const;
+  // Checks whether the update of the given size fits the stores, evicts App versions other than `keep` if it
+  // doesn't and the eviction is enabled, see setStoreEviction()
+  void checkAvailableStorageOrEvict(const std::string& app_name, uint64_t store_size, uint64_t docker_size,
+                                    const std::set<std::string>& keep);
+  // Evicts the least recently installed App version that can be evicted, returns false if there is none
+  bool evictAppVersion(const std::set<std::string>& keep, uint64_t& freed);
+  // Collects the App layers missing in the store, and all the App layers if `layers` is set, returns false if
+  // the App layers are unknown
+  bool getAppMissingBlobs(const Uri& uri, const boost::filesystem::path& app_dir,
+                          std::unordered_map<std::string, BlobIndex::BlobSize>& missing_blobs,
+                          std::set<std::string>* layers = nullptr) const;
+  // Whether the given blob is a layer of an App version planned by `planFetch()`, so it must be kept in the store
+  bool isBlobPlanned(const std::string& blob);
+  // The layers manifest entries of the given App, null if the App layers are unknown
+  Json::Value getAppLayers(const Uri& uri, const boost::filesystem::path& app_dir) const;
+  Json::Value getAppLayers(const Uri& uri, const Manifest& manifest) const;
+  // Reconstructs the missing App layers that have a delta from a layer present in the store, the layers that fail
+  // to be reconstructed are downloaded as a whole along with the App images
+  void applyLayerDeltas(const Uri& uri, const boost::filesystem::path& app_dir);
+  static void applyLayerDelta(const std::string& format, const boost::filesystem::path& src_blob,
+                              const boost::filesystem::path& delta, const boost::filesystem::path& dst_blob);
   void pullAppImages(const Uri& app_uri, const boost::filesystem::path& app_compose_file,
-                     const boost::filesystem::path& dst_dir);
+                     const boost::filesystem::path& dst_dir, bool skip_in_place_images = true);
+  // The in-place source of the given App image if it is set and holds the image
+  boost::optional<ImageSrc> getInPlaceImageSrc(const Uri& app_uri, const Uri& image_uri) const;
+  void accountAppBlobs(const Uri& uri, const boost::filesystem::path& app_dir);
+  // Imports the manifest, config and layer blobs of the given image found in `blob_import_dir_` to the store
+  void importImageBlobs(const Uri& image_uri) const;
+  // Imports the given blobs concurrently, the blobs which content doesn't match their hash are not imported
+  static void importBlobs(const boost::filesystem::path& src_dir, const boost::filesystem::path& dst_dir,
+                          const std::vector<std::string>& blobs);
+  // Collects the blobs and the cached manifests referenced by the given App version
+  BlobRefs::Refs getAppRefs(const Uri& uri, const boost::filesystem::path& app_version_dir) const;
 
   // install App&Images
   Result installAndCreateOrRunContainers(const App& app, bool run = false);
   Result installContainerless(const App& app);
+  // Returns the parsed App compose file if the App is to be handled by `NativeCompose`, nullptr otherwise
+  ComposeInfo::Ptr getNativeCompose(const std::string& app_name, const std::string& compose_file_content) const;
   boost::filesystem::path installAppAndImages(const App& app);
-  static void installApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& dst_dir);
-  void installAppImages(const boost::filesystem::path& app_dir);
+  // Records the version of the given App which is installed currently as its previous version if it differs
+  void retainInstalledVersion(const App& app);
+  // App name -> the hash of its previous version, see `setRetainPrevious()`
+  Json::Value getPreviousVersions() const;
+  void installApp(const boost::filesystem::path& app_dir, const boost::filesystem::path& dst_dir);
+  bool isDirectImageInstall() const;
+  // The docker store the images are looked up in, nullptr if it's not of the supported storage driver
+  std::unique_ptr<DockerStore> getPreloadedDockerStore() const;
+  void stopDockerDaemon() const;
+  void startDockerDaemon() const;
+  // Returns the layer digests of the given image which blobs are stored in the given blob dir
+  static std::vector<std::string> getImageLayers(const boost::filesystem::path& image_dir,
+                                                 const boost::filesystem::path& blob_dir);
+  void installAppImages(const Uri& app_uri, const boost::filesystem::path& app_dir);
 
   bool isAppFetched(const App& app) const;
+  // Whether the App manifest, archive and compose file have been fetched by this or a previous fetch attempt of
+  // the current fetch plan, so they are neither verified nor downloaded again
+  bool isAppStepJournaled(const Uri& uri, const boost::filesystem::path& app_dir) const;
   bool areAppImagesFetched(const App& app) const;
   bool isAppInstalled(const App& app) const;
 
@@ -145,15 +331,50 @@ class RestorableAppEngine : public AppEngine {
                               const std::string& flags = "up --remove-orphans -d");
 
   static void stopComposeApp(const std::string& compose_cmd, const boost::filesystem::path& app_dir);
-  static std::string getContentHash(const boost::filesystem::path& path);
+  // Hashes the given blobs concurrently and returns those which content doesn't match their hash, i.e. the file name
+  static std::vector<std::string> findCorruptedBlobs(const boost::filesystem::path& blob_dir,
+                                                     const std::vector<std::string>& blobs);
+  // Returns the expected hash if the content index confirms the file has not changed since its last successful
+  // verification, otherwise hashes the file content and records it in the index if the hash matches
+  std::string getVerifiedContentHash(const boost::filesystem::path& path, const std::string& expected_hash) const;
 
-  static uint64_t getAppUpdateSize(const Json::Value& app_layers, const boost::filesystem::path& blob_dir);
+  static uint64_t getBlobStoreSize(const boost::filesystem::path& blob_dir);
   static uint64_t getDockerStoreSizeForAppUpdate(const uint64_t& compressed_update_size,
                                                  uint32_t average_compression_ratio);
 
+  // Throws if the volume of the given path lacks the required storage, taking into account the 80% watermark
+  static void checkAvailableStorage(const boost::filesystem::path& path, uint64_t required_storage,
+                                    const std::string& purpose);
+
+  // Storage of a volume committed to a transfer in progress, it is released once the object is destroyed
+  class StorageReservation {
+   public:
+    StorageReservation(const RestorableAppEngine& engine, uint64_t volume, uint64_t size);
+    ~StorageReservation();
+    StorageReservation(const StorageReservation&) = delete;
+    StorageReservation& operator=(const StorageReservation&) = delete;
+    StorageReservation(StorageReservation&&) = delete;
+    StorageReservation& operator=(StorageReservation&&) = delete;
+
+   private:
+    const RestorableAppEngine& engine_;
+    const uint64_t volume_;
+    const uint64_t size_;
+  };
+  // Commits the given amount of storage of the volume of the given path to a transfer, throws InsufficientSpaceError
+  // if the volume lacks it once the storage committed to the other transfers in progress is taken into account
+  std::unique_ptr<StorageReservation> reserveStorage(const boost::filesystem::path& path, uint64_t size,
+                                                     const std::string& purpose) const;
+  // The storage of the volume of the given path committed to the transfers in progress
+  uint64_t getReservedStorage(const boost::filesystem::path& path) const;
   void checkAvailableStorageInStores(const std::string& app_name, const uint64_t& skopeo_required_storage,
                                      const uint64_t& docker_required_storage) const;
 
+  // Removes the stopped containers of the given Apps and the given images, in the background
+  void pruneDockerStore(const std::set<std::string>& removed_apps, const std::vector<std::string>& images);
+  // The images of the services of the App version stored in the given dir
+  static std::set<std::string> getAppImages(const boost::filesystem::path& app_version_dir);
+
   static bool areDockerAndSkopeoOnTheSameVolume(const boost::filesystem::path& skopeo_path,
                                                 const boost::filesystem::path& docker_path);
   static std::tuple<uint64_t, bool> getPathVolumeID(const boost::filesystem::path& path);
@@ -167,11 +388,51 @@ class RestorableAppEngine : public AppEngine {
   const std::string compose_cmd_;
   const boost::filesystem::path apps_root_{store_root_ / "apps"};
   const boost::filesystem::path blobs_root_{store_root_ / "blobs"};
+  mutable ContentIndex content_index_{store_root_ / "content-index.json"};
+  BlobRefs blob_refs_{store_root_ / "blob-refs.json"};
+  FetchJournal fetch_journal_{store_root_ / "fetch-journal.json"};
+  // keyed by the App archive digest, the archive holds the whole compose project
+  mutable ComposeVerifyCache compose_verify_cache_{compose_cmd_, store_root_ / "compose-verify-cache.json"};
+  mutable BlobIndex blob_index_{blobs_root_ / "sha256"};
   Docker::RegistryClient::Ptr registry_client_;
   Docker::DockerClient::Ptr docker_client_;
   StorageSpaceFunc storage_space_func_;
   ClientImageSrcFunc client_image_src_func_;
   bool create_containers_if_install_;
+  // pulls images in-process instead of `skopeo copy` if set
+  ImagePuller::Ptr image_puller_;
+  DownloadProgressCb progress_cb_;
+  bool deep_verify_{false};
+  int install_concurrency_{1};
+  int fetch_concurrency_{1};
+  bool direct_image_install_{false};
+  std::string docker_stop_cmd_;
+  std::string docker_start_cmd_;
+  std::shared_ptr<NativeCompose> native_compose_;
+  std::shared_ptr<AppTree> app_tree_;
+  boost::filesystem::path blob_import_dir_;
+  InPlaceImageSrcFunc in_place_image_src_;
+  std::mutex docker_store_mutex_;
+  // images loaded by `installImages()` which are not installed along with their Apps again, till the next
+  // `installImages()` or `prune()` call
+  std::mutex preinstalled_images_mutex_;
+  std::unordered_set<std::string> preinstalled_images_;
+  // App versions, i.e. `<app-name>/<app-hash>`, which metadata and size have been handled by `planFetch()`
+  std::mutex fetch_plan_mutex_;
+  std::unordered_set<std::string> fetch_plan_;
+  // the layers of the planned App versions, the ones present in the store are not evicted or removed till then
+  std::unordered_set<std::string> fetch_plan_blobs_;
+  // volume ID -> the storage committed to the transfers in progress, see reserveStorage()
+  mutable std::mutex storage_ledger_mutex_;
+  mutable std::unordered_map<uint64_t, uint64_t> storage_ledger_;
+  // the docker CLI the images of the removed App versions are removed with, the whole store is pruned if not set
+  std::string docker_cmd_;
+  std::thread docker_prune_thread_;
+  bool retain_previous_{false};
+  bool store_eviction_{false};
+  ImagePuller::CancelCheck cancel_check_;
+  mutable std::mutex previous_versions_mutex_;
+  const boost::filesystem::path previous_versions_file_{store_root_ / "previous-versions.json"};
 };
 
 }  // namespace Docker
@@ -1,11 +1,30 @@
 #ifndef AKTUALIZR_LITE_DOWNLOADER_H_
 #define AKTUALIZR_LITE_DOWNLOADER_H_
 
+#include <mutex>
+#include <utility>
+
 #include "aktualizr-lite/api.h"
+#include "utilities/apiqueue.h"
 
 class Downloader {
  public:
   virtual DownloadResult Download(const TufTarget& target) = 0;
+  // Estimates what Download() of the given Target would take, without downloading any of its content
+  virtual UpdateCost EstimateCost(const TufTarget& target) = 0;
+
+  // Sets a callback receiving the download progress, it is invoked by one thread at a time
+  void setProgressCb(DownloadProgressCb cb) {
+    std::lock_guard<std::mutex> lock{progress_mutex_};
+    progress_cb_ = std::move(cb);
+  }
+  // Sets a callback receiving the progress of the next downloads only, in addition to the one set by setProgressCb(),
+  // and the token the downloads check whether to stop at, either can be reset by passing nullptr
+  void setDownloadControl(DownloadProgressCb cb, const api::FlowControlToken* token) {
+    std::lock_guard<std::mutex> lock{progress_mutex_};
+    download_progress_cb_ = std::move(cb);
+    token_ = token;
+  }
 
   virtual ~Downloader() = default;
   Downloader(const Downloader&) = delete;
@@ -15,6 +34,39 @@ class Downloader {
 
  protected:
   explicit Downloader() = default;
+
+  void reportProgress(const DownloadProgress& progress) const {
+    std::lock_guard<std::mutex> lock{progress_mutex_};
+    if (progress_cb_) {
+      progress_cb_(progress);
+    }
+    if (download_progress_cb_) {
+      download_progress_cb_(progress);
+    }
+  }
+
+  const api::FlowControlToken* flowControlToken() const {
+    std::lock_guard<std::mutex> lock{progress_mutex_};
+    return token_;
+  }
+  // Makes the following download steps check the given token instead of the one set by setDownloadControl(),
+  // returns the latter so it can be restored
+  const api::FlowControlToken* swapFlowControlToken(const api::FlowControlToken* token) {
+    std::lock_guard<std::mutex> lock{progress_mutex_};
+    std::swap(token_, token);
+    return token;
+  }
+  // Whether the download is to stop, it is checked between the download steps, e.g. the Apps' fetches
+  bool isDownloadCancelled() const {
+    const auto* token{flowControlToken()};
+    return token != nullptr && !token->canContinue(false);
+  }
+
+ private:
+  mutable std::mutex progress_mutex_;
+  DownloadProgressCb progress_cb_;
+  DownloadProgressCb download_progress_cb_;
+  const api::FlowControlToken* token_{nullptr};
 };
 
 #endif  // AKTUALIZR_LITE_DOWNLOADER_H_
@@ -0,0 +1,102 @@
+#include "downloadpolicy.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/algorithm/string.hpp>
+
+RateLimiter::RateLimiter(std::size_t rate, std::size_t burst)
+    : rate_{static_cast<double>(rate)},
+      burst_{static_cast<double>(burst > 0 ? burst : rate)},
+      tokens_{burst_},
+      last_refill_{Clock::now()} {
+  if (rate == 0) {
+    throw std::invalid_argument("Download rate limit must be a positive number of bytes per second");
+  }
+}
+
+void RateLimiter::consume(std::size_t size) {
+  double debt{0};
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    const auto now{Clock::now()};
+    const std::chrono::duration<double> elapsed{now - last_refill_};
+    tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+    last_refill_ = now;
+    tokens_ -= static_cast<double>(size);
+    if (tokens_ < 0) {
+      debt = -tokens_;
+    }
+  }
+  if (debt > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(debt / rate_));
+  }
+}
+
+DownloadWindows::DownloadWindows(const std::string& spec) {
+  std::vector<std::string> ranges;
+  boost::split(ranges, spec, boost::is_any_of(","), boost::token_compress_on);
+  for (auto& range : ranges) {
+    boost::trim(range);
+    if (range.empty()) {
+      continue;
+    }
+    int begin_h{-1};
+    int begin_m{-1};
+    int end_h{-1};
+    int end_m{-1};
+    char tail{0};
+    // NOLINTNEXTLINE(cert-err34-c)
+    if (std::sscanf(range.c_str(), "%d:%d-%d:%d%c", &begin_h, &begin_m, &end_h, &end_m, &tail) != 4 ||
+        begin_h < 0 || begin_h > 23 || end_h < 0 || end_h > 23 || begin_m < 0 || begin_m > 59 || end_m < 0 ||
+        end_m > 59) {
+      throw std::invalid_argument("Invalid download window: `" + range + "`, expected `HH:MM-HH:MM`");
+    }
+    Window window{begin_h * 60 + begin_m, end_h * 60 + end_m};
+    if (window.begin == window.end) {
+      throw std::invalid_argument("Invalid download window: `" + range + "`, it must not be empty");
+    }
+    windows_.emplace_back(window);
+  }
+}
+
+std::chrono::seconds DownloadWindows::timeToOpen(std::time_t now) const {
+  if (windows_.empty()) {
+    return std::chrono::seconds{0};
+  }
+
+  std::tm local_time{};
+  localtime_r(&now, &local_time);
+  const int minute{local_time.tm_hour * 60 + local_time.tm_min};
+
+  int minutes_to_open{MinutesPerDay};
+  for (const auto& window : windows_) {
+    const bool is_open{window.begin < window.end ? (minute >= window.begin && minute < window.end)
+                                                 : (minute >= window.begin || minute < window.end)};
+    if (is_open) {
+      return std::chrono::seconds{0};
+    }
+    minutes_to_open = std::min(minutes_to_open, (window.begin - minute + MinutesPerDay) % MinutesPerDay);
+  }
+  return std::chrono::seconds{minutes_to_open * 60 - local_time.tm_sec};
+}
+
+UpdateStep UpdateStep::next(const DownloadWindows& download_windows, const DownloadWindows& install_windows,
+                            std::time_t now, bool prefetched, bool rollback) {
+  if (rollback) {
+    return {Action::kUpdate, std::chrono::seconds{0}};
+  }
+  if (!prefetched) {
+    const auto time_to_download{download_windows.timeToOpen(now)};
+    if (time_to_download.count() > 0) {
+      return {Action::kWaitForDownloadWindow, time_to_download};
+    }
+  }
+  const auto time_to_install{install_windows.timeToOpen(now)};
+  if (time_to_install.count() > 0) {
+    return {prefetched ? Action::kWaitForInstallWindow : Action::kDownloadInAdvance, time_to_install};
+  }
+  return {Action::kUpdate, std::chrono::seconds{0}};
+}
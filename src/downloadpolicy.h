@@ -0,0 +1,75 @@
+#ifndef AKTUALIZR_LITE_DOWNLOAD_POLICY_H_
+#define AKTUALIZR_LITE_DOWNLOAD_POLICY_H_
+
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Token bucket limiting the overall rate of downloads, it can be shared by concurrent downloads.
+// A download that consumes more than the bucket holds goes into debt and waits until the debt is paid off,
+// so the following consumers wait proportionally longer and the overall rate stays within the limit.
+class RateLimiter {
+ public:
+  using Ptr = std::shared_ptr<RateLimiter>;
+
+  // `rate` is the max average amount of bytes per second, `burst` is the max amount of bytes that can be
+  // consumed at once without waiting after idling, by default it is the amount of data transferred per one second
+  explicit RateLimiter(std::size_t rate, std::size_t burst = 0);
+
+  // Blocks the caller until the given amount of data can be transferred without exceeding the rate
+  void consume(std::size_t size);
+  std::size_t rate() const { return static_cast<std::size_t>(rate_); }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  const double rate_;
+  const double burst_;
+
+  std::mutex mutex_;
+  double tokens_;
+  Clock::time_point last_refill_;
+};
+
+// Daily time windows in the local time during which downloads are allowed.
+// The windows are specified as a comma separated list of `HH:MM-HH:MM` ranges, e.g. "22:00-06:00,12:30-13:30".
+// A window that ends before it begins spans the midnight. No windows means downloads are allowed at any time.
+class DownloadWindows {
+ public:
+  explicit DownloadWindows(const std::string& spec = "");
+
+  bool empty() const { return windows_.empty(); }
+  // Returns zero if downloads are allowed at the given time, otherwise the time left until the nearest window opens
+  std::chrono::seconds timeToOpen(std::time_t now) const;
+
+ private:
+  static const int MinutesPerDay{24 * 60};
+
+  struct Window {
+    // minutes since midnight, `end` is exclusive
+    int begin;
+    int end;
+  };
+  std::vector<Window> windows_;
+};
+
+// The step the daemon takes with a new Target according to the download and install windows. A Target is downloaded
+// within the download windows and installed within the install windows, it is downloaded in advance if the install
+// windows are closed.
+struct UpdateStep {
+  enum class Action { kUpdate, kWaitForDownloadWindow, kDownloadInAdvance, kWaitForInstallWindow };
+
+  // A rollback is neither postponed nor downloaded in advance since it recovers the device from a failing Target,
+  // a `prefetched` Target, the one downloaded in advance, does not wait for a download window
+  static UpdateStep next(const DownloadWindows& download_windows, const DownloadWindows& install_windows,
+                         std::time_t now, bool prefetched, bool rollback);
+
+  Action action;
+  // the time left until the window the action waits for opens, zero if the action is kUpdate
+  std::chrono::seconds time_to_open;
+};
+
+#endif  // AKTUALIZR_LITE_DOWNLOAD_POLICY_H_
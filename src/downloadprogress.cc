@@ -0,0 +1,88 @@
+#include "downloadprogress.h"
+
+#include <algorithm>
+
+#include "logging/logging.h"
+
+const int DownloadProgressMeter::ReportIntervalMs;
+const int DownloadProgressMeter::LogIntervalSec;
+
+DownloadProgressMeter::DownloadProgressMeter(DownloadProgressCb cb, DownloadProgress::Source source, std::string name,
+                                             uint64_t bytes_total)
+    : cb_{std::move(cb)} {
+  progress_.source = source;
+  progress_.name = std::move(name);
+  progress_.bytes_total = bytes_total;
+  start();
+}
+
+void DownloadProgressMeter::start(uint64_t bytes_fetched) {
+  started_at_ = Clock::now();
+  reported_at_ = started_at_;
+  logged_at_ = started_at_;
+  bytes_at_start_ = bytes_fetched;
+  progress_.bytes_fetched = bytes_fetched;
+  progress_.completed = false;
+}
+
+void DownloadProgressMeter::update(uint64_t bytes_fetched, const std::string& description, unsigned int percent) {
+  progress_.bytes_fetched = bytes_fetched;
+  if (!description.empty()) {
+    progress_.description = description;
+  }
+  progress_.percent = progress_.bytes_total > 0
+                          ? static_cast<unsigned int>(std::min<uint64_t>(bytes_fetched, progress_.bytes_total) * 100 /
+                                                      progress_.bytes_total)
+                          : percent;
+
+  const auto now{Clock::now()};
+  if (now - reported_at_ < std::chrono::milliseconds(ReportIntervalMs)) {
+    return;
+  }
+  report(now);
+
+  if (now - logged_at_ >= std::chrono::seconds(LogIntervalSec)) {
+    logged_at_ = now;
+    LOG_INFO << sourceStr(progress_.source) << " download progress: " << progress_.name << "; "
+             << progress_.description << (progress_.description.empty() ? "" : "; ") << progress_.bytes_fetched
+             << " of " << progress_.bytes_total << " bytes, " << progress_.percent << "%, "
+             << static_cast<uint64_t>(progress_.rate / 1024) << " KiB/s";
+  }
+}
+
+void DownloadProgressMeter::complete() {
+  progress_.completed = true;
+  if (progress_.bytes_total > 0) {
+    progress_.bytes_fetched = progress_.bytes_total;
+  }
+  progress_.percent = 100;
+  report(Clock::now());
+  LOG_INFO << sourceStr(progress_.source) << " download completed: " << progress_.name << "; "
+           << bytes_since_start_ << " bytes in " << progress_.elapsed_sec << " sec, "
+           << static_cast<uint64_t>(progress_.rate / 1024) << " KiB/s";
+}
+
+std::string DownloadProgressMeter::sourceStr(DownloadProgress::Source source) {
+  switch (source) {
+    case DownloadProgress::Source::Ostree:
+      return "ostree";
+    case DownloadProgress::Source::AppBlob:
+      return "App blob";
+    case DownloadProgress::Source::AppImages:
+      return "App images";
+    default:
+      return "unknown";
+  }
+}
+
+void DownloadProgressMeter::report(Clock::time_point now) {
+  reported_at_ = now;
+  progress_.elapsed_sec = std::chrono::duration<double>(now - started_at_).count();
+  // the download can be restarted from scratch after the start, e.g. if resuming is not supported by a server
+  bytes_since_start_ =
+      progress_.bytes_fetched > bytes_at_start_ ? progress_.bytes_fetched - bytes_at_start_ : progress_.bytes_fetched;
+  progress_.rate = progress_.elapsed_sec > 0 ? static_cast<double>(bytes_since_start_) / progress_.elapsed_sec : 0;
+  if (cb_) {
+    cb_(progress_);
+  }
+}
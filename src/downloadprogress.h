@@ -0,0 +1,43 @@
+#ifndef AKTUALIZR_LITE_DOWNLOAD_PROGRESS_H_
+#define AKTUALIZR_LITE_DOWNLOAD_PROGRESS_H_
+
+#include <chrono>
+#include <string>
+
+#include "aktualizr-lite/api.h"
+
+// Tracks the progress of a single download and reports it to the log and to the given callback.
+// The progress is reported once per `ReportIntervalMs` (`LogIntervalSec` for the log) at most and once
+// the download completes, so it can be updated on each received chunk of data.
+class DownloadProgressMeter {
+ public:
+  static const int ReportIntervalMs{1000};
+  static const int LogIntervalSec{10};
+
+  DownloadProgressMeter(DownloadProgressCb cb, DownloadProgress::Source source, std::string name,
+                        uint64_t bytes_total = 0);
+
+  // (Re)starts measuring, `bytes_fetched` is the amount of data fetched before the start, e.g. by a previous attempt
+  void start(uint64_t bytes_fetched = 0);
+  // Updates the amount of fetched data, `percent` is used only if the total size is unknown
+  void update(uint64_t bytes_fetched, const std::string& description = "", unsigned int percent = 0);
+  void complete();
+
+  const DownloadProgress& progress() const { return progress_; }
+  static std::string sourceStr(DownloadProgress::Source source);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  void report(Clock::time_point now);
+
+  DownloadProgressCb cb_;
+  DownloadProgress progress_;
+  uint64_t bytes_at_start_{0};
+  uint64_t bytes_since_start_{0};
+  Clock::time_point started_at_;
+  Clock::time_point reported_at_;
+  Clock::time_point logged_at_;
+};
+
+#endif  // AKTUALIZR_LITE_DOWNLOAD_PROGRESS_H_
@@ -1,45 +1,90 @@
 #ifndef AKTUALIZR_LITE_EXEC_H_
 #define AKTUALIZR_LITE_EXEC_H_
 
+#include <signal.h>
+
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/format.hpp>
 #include <boost/process.hpp>
 
+#include "execstats.h"
+
+// the max time a command is allowed to take by default
+static const std::chrono::seconds DefExecTimeout{900};
+
+// The IO service is reused by the consecutive calls made by a thread
+inline boost::asio::io_service& exec_io_service() {
+  thread_local boost::asio::io_service io_service;
+  return io_service;
+}
+
+// Runs the given command and waits for its completion up to the given timeout, the child is killed once the timeout
+// expires. Throws if the command fails, the wall time, exit code and stderr size are recorded into ExecStats.
 template <typename... Args>
-static void exec(const std::string& cmd, const std::string& err_msg_prefix, Args&&... args) {
+static void exec(std::chrono::seconds timeout, const std::string& cmd, const std::string& err_msg_prefix,
+                 Args&&... args) {
   // Implementation is based on test_utils.cc:Process::spawn that has been proven over time
   std::future<std::string> err_output;
-  std::future<int> child_process_exit_code;
-  boost::asio::io_service io_service;
+  int exit_code{EXIT_FAILURE};
+  bool timed_out{false};
+  auto& io_service{exec_io_service()};
+  io_service.reset();
+  boost::asio::steady_timer timer{io_service};
+  const auto started_at{std::chrono::steady_clock::now()};
+  const auto elapsed = [&started_at]() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at);
+  };
 
   try {
-    boost::process::child child_process(cmd, boost::process::std_err > err_output,
-                                        boost::process::on_exit = child_process_exit_code, io_service,
-                                        std::forward<Args>(args)...);
+    boost::process::child child_process(
+        cmd, boost::process::std_err > err_output,
+        boost::process::on_exit =
+            [&exit_code, &timer](int code, const std::error_code&) {
+              exit_code = code;
+              timer.cancel();
+            },
+        io_service, std::forward<Args>(args)...);
 
+    timer.expires_from_now(timeout);
+    timer.async_wait([&timed_out, &child_process](const boost::system::error_code& ec) {
+      if (!ec) {
+        timed_out = true;
+        // not reaped here, so the exit handler is invoked and the IO service run completes
+        kill(child_process.id(), SIGKILL);
+      }
+    });
     io_service.run();
-
-    bool wait_successfull = child_process.wait_for(std::chrono::seconds(900));
-    if (!wait_successfull) {
-      throw std::runtime_error("Timeout occured while waiting for a child process completion");
-    }
-
+    child_process.wait();
   } catch (const std::exception& exc) {
+    ExecStats::instance().record(cmd, elapsed(), -1, 0, false);
     throw std::runtime_error("Failed to spawn process " + cmd + " exited with an error: " + exc.what());
   }
 
-  const auto exit_code{child_process_exit_code.get()};
-
+  const auto err_msg{err_output.get()};
+  ExecStats::instance().record(cmd, elapsed(), exit_code, err_msg.size(), timed_out);
+  if (timed_out) {
+    throw std::runtime_error("Timeout occured while waiting for a child process completion\n\tcmd: " + cmd);
+  }
   if (exit_code != EXIT_SUCCESS) {
-    const auto err_msg{err_output.get()};
     throw std::runtime_error(err_msg_prefix + "\n\tcmd: " + cmd + "\n\terr: " + err_msg);
   }
 }
 
+template <typename... Args>
+static void exec(const std::string& cmd, const std::string& err_msg_prefix, Args&&... args) {
+  exec(DefExecTimeout, cmd, err_msg_prefix, std::forward<Args>(args)...);
+}
+
 template <typename... Args>
 void exec(const boost::format& cmd, const std::string& err_msg, Args&&... args) {
   exec(cmd.str(), err_msg, std::forward<Args>(args)...);
 }
 
+template <typename... Args>
+void exec(std::chrono::seconds timeout, const boost::format& cmd, const std::string& err_msg, Args&&... args) {
+  exec(timeout, cmd.str(), err_msg, std::forward<Args>(args)...);
+}
+
 #endif  // AKTUALIZR_LITE_EXEC_H_
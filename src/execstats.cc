@@ -0,0 +1,99 @@
+#include "execstats.h"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+
+constexpr std::array<int64_t, 5> ExecStats::BucketBoundsMs;
+
+ExecStats& ExecStats::instance() {
+  static ExecStats stats;
+  return stats;
+}
+
+std::string ExecStats::commandClass(const std::string& cmd) {
+  static const std::size_t MaxSubCommands{2};
+  std::istringstream tokens{cmd};
+  std::string token;
+  if (!(tokens >> token)) {
+    return "";
+  }
+  std::string res{boost::filesystem::path(token).filename().string()};
+  for (std::size_t ii = 0; ii < MaxSubCommands && tokens >> token; ++ii) {
+    const bool is_sub_command{std::isalpha(static_cast<unsigned char>(token[0])) != 0 &&
+                              std::all_of(token.begin(), token.end(), [](char c) {
+                                return std::isalnum(static_cast<unsigned char>(c)) != 0 || c == '-' || c == '_';
+                              })};
+    if (!is_sub_command) {
+      break;
+    }
+    res += " " + token;
+  }
+  return res;
+}
+
+void ExecStats::record(const std::string& cmd, std::chrono::milliseconds wall_time, int exit_code,
+                       std::size_t stderr_size, bool timed_out) {
+  const auto cmd_class{commandClass(cmd)};
+  LOG_DEBUG << "Command `" << cmd_class << "` took " << wall_time.count() << " ms, exit code: " << exit_code
+            << ", stderr: " << stderr_size << " bytes" << (timed_out ? ", timed out" : "");
+
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& entry{entries_[cmd_class]};
+  ++entry.count;
+  if (exit_code != EXIT_SUCCESS || timed_out) {
+    ++entry.failures;
+  }
+  if (timed_out) {
+    ++entry.timeouts;
+  }
+  entry.total_time += wall_time;
+  entry.max_time = std::max(entry.max_time, wall_time);
+  entry.stderr_bytes += stderr_size;
+  const auto bucket{std::lower_bound(BucketBoundsMs.begin(), BucketBoundsMs.end(), wall_time.count()) -
+                    BucketBoundsMs.begin()};
+  ++entry.histogram[static_cast<std::size_t>(bucket)];
+}
+
+std::map<std::string, ExecStats::Entry> ExecStats::get() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return entries_;
+}
+
+Json::Value ExecStats::toJson() const {
+  Json::Value res{Json::objectValue};
+  for (const auto& cmd_entry : get()) {
+    const auto& entry{cmd_entry.second};
+    auto& entry_json{res[cmd_entry.first]};
+    entry_json["count"] = Json::UInt64(entry.count);
+    entry_json["failures"] = Json::UInt64(entry.failures);
+    entry_json["timeouts"] = Json::UInt64(entry.timeouts);
+    entry_json["total_ms"] = Json::Int64(entry.total_time.count());
+    entry_json["max_ms"] = Json::Int64(entry.max_time.count());
+    entry_json["stderr_bytes"] = Json::UInt64(entry.stderr_bytes);
+    for (std::size_t ii = 0; ii < entry.histogram.size(); ++ii) {
+      const auto bucket{ii < BucketBoundsMs.size() ? "le_" + std::to_string(BucketBoundsMs[ii]) + "ms" : "inf"};
+      entry_json["histogram"][bucket] = Json::UInt64(entry.histogram[ii]);
+    }
+  }
+  return res;
+}
+
+void ExecStats::log() const {
+  for (const auto& cmd_entry : get()) {
+    const auto& entry{cmd_entry.second};
+    LOG_INFO << "Command `" << cmd_entry.first << "`: runs: " << entry.count << ", failures: " << entry.failures
+             << ", timeouts: " << entry.timeouts << ", total: " << entry.total_time.count()
+             << " ms, avg: " << entry.total_time.count() / static_cast<int64_t>(entry.count)
+             << " ms, max: " << entry.max_time.count() << " ms";
+  }
+}
+
+void ExecStats::reset() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  entries_.clear();
+}
@@ -0,0 +1,50 @@
+#ifndef AKTUALIZR_LITE_EXEC_STATS_H_
+#define AKTUALIZR_LITE_EXEC_STATS_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "json/json.h"
+
+// Process-wide accounting of the commands run by exec(), grouped by command class, e.g. `skopeo copy`, `tar`,
+// `docker compose up`, so it can be told which of the utilities a slow update has spent its time in.
+class ExecStats {
+ public:
+  // the upper bounds of the wall time histogram buckets, the last bucket is for anything longer
+  static constexpr std::array<int64_t, 5> BucketBoundsMs{{100, 1000, 10000, 60000, 300000}};
+
+  struct Entry {
+    uint64_t count{0};
+    uint64_t failures{0};
+    uint64_t timeouts{0};
+    std::chrono::milliseconds total_time{0};
+    std::chrono::milliseconds max_time{0};
+    uint64_t stderr_bytes{0};
+    std::array<uint64_t, BucketBoundsMs.size() + 1> histogram{};
+  };
+
+  static ExecStats& instance();
+  // The program base name followed by its first argument if it is a sub-command, e.g. `/usr/bin/skopeo copy --all
+  // ...` -> `skopeo copy`, `tar -xf ...` -> `tar`
+  static std::string commandClass(const std::string& cmd);
+
+  void record(const std::string& cmd, std::chrono::milliseconds wall_time, int exit_code, std::size_t stderr_size,
+              bool timed_out);
+  std::map<std::string, Entry> get() const;
+  Json::Value toJson() const;
+  // Logs the summary per command class
+  void log() const;
+  void reset();
+
+ private:
+  ExecStats() = default;
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+};
+
+#endif  // AKTUALIZR_LITE_EXEC_STATS_H_
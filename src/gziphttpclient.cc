@@ -0,0 +1,50 @@
+#include "gziphttpclient.h"
+
+#include "helpers.h"
+
+static std::vector<std::string> withEncodingHeader(std::vector<std::string> headers) {
+  headers.emplace_back("Content-Encoding: gzip");
+  return headers;
+}
+
+GzipHttpClient::GzipHttpClient(std::vector<std::string> headers) {
+  const auto client_headers{withEncodingHeader(std::move(headers))};
+  client_.reset(new HttpClient(&client_headers));
+}
+
+GzipHttpClient::GzipHttpClient(const GzipHttpClient& other)
+    : HttpInterface(), client_{new HttpClient(*other.client_)} {}
+
+HttpResponse GzipHttpClient::get(const std::string& url, int64_t maxsize) { return client_->get(url, maxsize); }
+
+HttpResponse GzipHttpClient::post(const std::string& url, const std::string& content_type, const std::string& data) {
+  return client_->post(url, content_type, gzip_compress(data));
+}
+
+HttpResponse GzipHttpClient::post(const std::string& url, const Json::Value& data) {
+  return post(url, "application/json", Utils::jsonToCanonicalStr(data));
+}
+
+HttpResponse GzipHttpClient::put(const std::string& url, const std::string& content_type, const std::string& data) {
+  return client_->put(url, content_type, gzip_compress(data));
+}
+
+HttpResponse GzipHttpClient::put(const std::string& url, const Json::Value& data) {
+  return put(url, "application/json", Utils::jsonToCanonicalStr(data));
+}
+
+HttpResponse GzipHttpClient::download(const std::string& url, curl_write_callback write_cb,
+                                      curl_xferinfo_callback progress_cb, void* userp, curl_off_t from) {
+  return client_->download(url, write_cb, progress_cb, userp, from);
+}
+
+std::future<HttpResponse> GzipHttpClient::downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                                        curl_xferinfo_callback progress_cb, void* userp,
+                                                        curl_off_t from, CurlHandler* easyp) {
+  return client_->downloadAsync(url, write_cb, progress_cb, userp, from, easyp);
+}
+
+void GzipHttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert,
+                              CryptoSource cert_source, const std::string& pkey, CryptoSource pkey_source) {
+  client_->setCerts(ca, ca_source, cert, cert_source, pkey, pkey_source);
+}
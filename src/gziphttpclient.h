@@ -0,0 +1,40 @@
+#ifndef AKTUALIZR_LITE_GZIP_HTTP_CLIENT_H_
+#define AKTUALIZR_LITE_GZIP_HTTP_CLIENT_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "http/httpclient.h"
+
+// HTTP client which gzips the bodies of the POST and PUT requests, all requests are sent along with
+// `Content-Encoding: gzip` since the header can't be set per request.
+class GzipHttpClient : public HttpInterface {
+ public:
+  // The headers are sent along with each request, the same as the `HttpClient` ones
+  explicit GzipHttpClient(std::vector<std::string> headers);
+  // The copy has its own curl handle with the same headers and certificates, so it can be used by another thread
+  GzipHttpClient(const GzipHttpClient& other);
+  ~GzipHttpClient() override = default;
+  GzipHttpClient& operator=(const GzipHttpClient&) = delete;
+  GzipHttpClient(GzipHttpClient&&) = delete;
+  GzipHttpClient& operator=(GzipHttpClient&&) = delete;
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override;
+  HttpResponse post(const std::string& url, const std::string& content_type, const std::string& data) override;
+  HttpResponse post(const std::string& url, const Json::Value& data) override;
+  HttpResponse put(const std::string& url, const std::string& content_type, const std::string& data) override;
+  HttpResponse put(const std::string& url, const Json::Value& data) override;
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override;
+  std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                          CurlHandler* easyp) override;
+  void setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert, CryptoSource cert_source,
+                const std::string& pkey, CryptoSource pkey_source) override;
+
+ private:
+  std::unique_ptr<HttpClient> client_;
+};
+
+#endif  // AKTUALIZR_LITE_GZIP_HTTP_CLIENT_H_
@@ -1,5 +1,8 @@
 #include "helpers.h"
 
+#include <zlib.h>
+#include <unordered_set>
+
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
@@ -77,27 +80,6 @@ bool target_has_tags(const Uptane::Target& t, const std::vector<std::string>& co
   return true;
 }
 
-bool known_local_target(LiteClient& client, const Uptane::Target& t,
-                        std::vector<Uptane::Target>& known_but_not_installed_versions) {
-  bool known_target = false;
-  boost::optional<Uptane::Target> pending;
-  client.storage->loadPrimaryInstalledVersions(nullptr, &pending);
-
-  // current Target can be "known"/failing Target too
-  std::vector<Uptane::Target>::reverse_iterator it;
-  for (it = known_but_not_installed_versions.rbegin(); it != known_but_not_installed_versions.rend(); it++) {
-    if (it->filename() == t.filename()) {
-      // Make sure installed version is not what is currently pending
-      if ((pending != boost::none) && (it->sha256Hash() == pending->sha256Hash())) {
-        continue;
-      }
-      known_target = true;
-      break;
-    }
-  }
-  return known_target;
-}
-
 void get_known_but_not_installed_versions(LiteClient& client,
                                           std::vector<Uptane::Target>& known_but_not_installed_versions) {
   std::vector<Uptane::Target> known_versions;
@@ -105,13 +87,35 @@ void get_known_but_not_installed_versions(LiteClient& client,
 
   std::vector<Uptane::Target> installed_versions;
   client.storage->loadPrimaryInstallationLog(&installed_versions, true);
+  std::unordered_set<std::string> installed_names;
+  for (const auto& t : installed_versions) {
+    installed_names.emplace(t.filename());
+  }
 
   for (const auto& t : known_versions) {
-    if (installed_versions.end() ==
-        std::find_if(installed_versions.begin(), installed_versions.end(),
-                     [&t](const Uptane::Target& t1) { return t.filename() == t1.filename(); })) {
+    if (installed_names.count(t.filename()) == 0) {
       // known but never successfully installed version
       known_but_not_installed_versions.push_back(t);
     }
   }
 }
+
+std::string gzip_compress(const std::string& data) {
+  z_stream stream{};
+  // 15 window bits plus 16 make zlib write the gzip header and trailer
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("Failed to initialize gzip compression");
+  }
+  std::string compressed(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = static_cast<uInt>(data.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  stream.avail_out = static_cast<uInt>(compressed.size());
+  const auto res{deflate(&stream, Z_FINISH)};
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (res != Z_STREAM_END) {
+    throw std::runtime_error("Failed to gzip data: " + std::to_string(res));
+  }
+  return compressed;
+}
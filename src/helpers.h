@@ -7,8 +7,9 @@
 
 void generate_correlation_id(Uptane::Target& t);
 bool target_has_tags(const Uptane::Target& t, const std::vector<std::string>& config_tags);
-bool known_local_target(LiteClient& client, const Uptane::Target& t, std::vector<Uptane::Target>& installed_versions);
 void get_known_but_not_installed_versions(LiteClient& client,
                                           std::vector<Uptane::Target>& known_but_not_installed_versions);
+// Compresses the given data into the gzip format, e.g. for a request body sent with `Content-Encoding: gzip`
+std::string gzip_compress(const std::string& data);
 
 #endif  // AKTUALIZR_LITE_HELPERS_
@@ -1,8 +1,10 @@
 #include "liteclient.h"
 
 #include <fcntl.h>
+#include <sqlite3.h>
 #include <sys/file.h>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/process.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
@@ -10,15 +12,52 @@
 #include "composeappmanager.h"
 #include "crypto/keymanager.h"
 #include "crypto/p11engine.h"
+#include "gziphttpclient.h"
 #include "helpers.h"
 #include "http/httpclient.h"
 #include "offline/client.h"
+#include "pollingscheduler.h"
 #include "primary/reportqueue.h"
+#include "resourcecontrol.h"
 #include "rootfstreemanager.h"
 #include "storage/invstorage.h"
 #include "target.h"
 #include "uptane/exceptions.h"
 #include "uptane/fetcher.h"
+#include "updatetrace.h"
+
+// The journal mode is stored in the DB file, so the connections the storage opens for each of its calls use it too.
+// In the `wal` mode a storage transaction is committed by appending its pages to the write-ahead log and syncing
+// just the log, rather than by syncing a rollback journal, the DB and its dir, and it's as crash-consistent with the
+// default `synchronous=FULL` of the connections.
+static void setStorageJournalMode(const StorageConfig& storage_cfg, const std::string& mode) {
+  if (mode != "wal" && mode != "delete") {
+    throw std::invalid_argument(
+        "Invalid sota.toml:pacman:storage_journal_mode value, should be `wal` or `delete`, got " + mode);
+  }
+  const auto db_path{storage_cfg.sqldb_path.get(storage_cfg.path)};
+  sqlite3* db{nullptr};
+  if (sqlite3_open_v2(db_path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+    LOG_WARNING << "Failed to open the storage DB " << db_path << " to set its journal mode: " << sqlite3_errmsg(db);
+    sqlite3_close(db);
+    return;
+  }
+  sqlite3_busy_timeout(db, 2000);
+  std::string set_mode;
+  const auto on_row = [](void* ctx, int col_numb, char** cols, char**) {
+    if (col_numb > 0 && cols[0] != nullptr) {
+      *static_cast<std::string*>(ctx) = cols[0];
+    }
+    return 0;
+  };
+  if (sqlite3_exec(db, ("PRAGMA journal_mode=" + mode + ";").c_str(), on_row, &set_mode, nullptr) != SQLITE_OK ||
+      set_mode != mode) {
+    LOG_WARNING << "Failed to set the storage DB journal mode to " << mode << ": " << sqlite3_errmsg(db);
+  } else {
+    LOG_DEBUG << "Storage DB journal mode: " << set_mode;
+  }
+  sqlite3_close(db);
+}
 
 LiteClient::LiteClient(Config& config_in, const AppEngine::Ptr& app_engine, const std::shared_ptr<P11EngineGuard>& p11,
                        std::shared_ptr<Uptane::IMetadataFetcher> meta_fetcher)
@@ -26,8 +65,19 @@ LiteClient::LiteClient(Config& config_in, const AppEngine::Ptr& app_engine, cons
       primary_ecu{Uptane::EcuSerial::Unknown(), ""},
       uptane_fetcher_{std::move(meta_fetcher)} {
   storage = INvStorage::newStorage(config.storage, false, StorageClient::kTUF);
+  if (config.pacman.extra.count("storage_journal_mode") == 1) {
+    // before anything is written, the journal mode can't be changed while a transaction is in progress
+    setStorageJournalMode(config.storage, config.pacman.extra.at("storage_journal_mode"));
+  }
   storage->importData(config.import);
 
+  // before any thread is spawned, so they inherit the priority
+  ResourceControl::apply(ResourceControl::Config(config.pacman));
+  // the package manager is created on its first use, so its options are validated here to fail at the start,
+  // so are the daemon update cycle ones, they are used regardless of the package manager type
+  ComposeAppManager::Config{config.pacman};
+  PollingScheduler::Config{config.pacman};
+
   std::map<std::string, std::string>& raw = config.pacman.extra;
   if (raw.count("tags") == 1) {
     std::string val = raw.at("tags");
@@ -45,6 +95,49 @@ LiteClient::LiteClient(Config& config_in, const AppEngine::Ptr& app_engine, cons
     }
   }
 
+  if (raw.count("apps_state_report_mode") == 1) {
+    const auto mode{raw.at("apps_state_report_mode")};
+    if (mode != "full" && mode != "delta") {
+      throw std::invalid_argument(
+          "Invalid sota.toml:pacman:apps_state_report_mode value, should be `full` or `delta`, got " + mode);
+    }
+    apps_state_delta_ = mode == "delta";
+  }
+  if (raw.count("apps_state_report_gzip") == 1) {
+    apps_state_gzip_ = boost::lexical_cast<bool>(raw.at("apps_state_report_gzip"));
+  }
+
+  if (raw.count("update_trace_path") == 1 || raw.count("update_trace_prom_path") == 1) {
+    UpdateTrace::instance().setOutput(raw.count("update_trace_path") == 1 ? raw.at("update_trace_path") : "",
+                                      raw.count("update_trace_prom_path") == 1 ? raw.at("update_trace_prom_path") : "");
+  }
+  if (raw.count("update_trace_report") == 1) {
+    update_trace_report_ = boost::lexical_cast<bool>(raw.at("update_trace_report"));
+  }
+
+  bool report_queue_gzip{false};
+  if (raw.count("report_queue_gzip") == 1) {
+    report_queue_gzip = boost::lexical_cast<bool>(raw.at("report_queue_gzip"));
+  }
+  for (const auto& param : std::vector<std::pair<std::string, int&>>{
+           {"report_queue_flush_interval", report_queue_run_pause_s_},
+           {"report_queue_batch_size", report_queue_event_limit_}}) {
+    if (raw.count(param.first) == 1) {
+      const std::string value_str{raw.at(param.first)};
+      try {
+        param.second = std::stoi(value_str);
+      } catch (const std::exception& exc) {
+        LOG_ERROR << "Invalid sota.toml:pacman:" << param.first << " value, should be an integer, got " << value_str
+                  << ", err: " << exc.what();
+        throw;
+      }
+      if (param.second < 1) {
+        throw std::invalid_argument("Invalid sota.toml:pacman:" + param.first +
+                                    " value, should be a positive integer, got " + value_str);
+      }
+    }
+  }
+
   // figure out the Docker Registry Auth creds endpoint
   const auto& repo_endpoint = config.uptane.repo_server;
   std::string auth_creds_endpoint = Docker::RegistryClient::DefAuthCredsEndpoint;
@@ -103,28 +196,59 @@ LiteClient::LiteClient(Config& config_in, const AppEngine::Ptr& app_engine, cons
   key_manager_ = std_::make_unique<KeyManager>(storage, config.keymanagerConfig(), p11);
   key_manager_->loadKeys();
   key_manager_->copyCertsToCurl(*http_client);
+  std::shared_ptr<GzipHttpClient> gzip_http_client;
+  if (apps_state_gzip_ || report_queue_gzip) {
+    gzip_http_client = std::make_shared<GzipHttpClient>(headers);
+    key_manager_->copyCertsToCurl(*gzip_http_client);
+  }
+  if (apps_state_gzip_) {
+    apps_state_http_client_ = gzip_http_client;
+  }
 
   if (!uptane_fetcher_) {
     uptane_fetcher_ = std::make_shared<Uptane::Fetcher>(config, http_client);
   }
-  report_queue = std_::make_unique<ReportQueue>(config, http_client, storage, report_queue_run_pause_s_,
-                                                report_queue_event_limit_);
+  // the events are stored in the DB until sent, and sent in batches of up to `report_queue_event_limit_` events
+  report_queue = std_::make_unique<ReportQueue>(
+      config, report_queue_gzip ? std::static_pointer_cast<HttpInterface>(gzip_http_client) : http_client, storage,
+      report_queue_run_pause_s_, report_queue_event_limit_);
 
-  if (config.pacman.type == ComposeAppManager::Name) {
-    package_manager_ = std::make_shared<ComposeAppManager>(config.pacman, config.bootloader, storage, http_client,
-                                                           ostree_sysroot, *key_manager_, app_engine);
-  } else if (config.pacman.type == RootfsTreeManager::Name) {
-    package_manager_ = std::make_shared<RootfsTreeManager>(config.pacman, config.bootloader, storage, http_client,
-                                                           ostree_sysroot, *key_manager_);
-  } else {
+  if (config.pacman.type != ComposeAppManager::Name && config.pacman.type != RootfsTreeManager::Name) {
     throw std::runtime_error("Unsupported package manager type: " + config.pacman.type);
   }
+  app_engine_ = app_engine;
+  sysroot_ = ostree_sysroot;
+}
 
-  downloader_ = std::dynamic_pointer_cast<Downloader>(package_manager_);
-  if (!downloader_) {
-    throw std::runtime_error("Invalid package manager: cannot cast to Downloader type");
+const std::shared_ptr<PackageManagerInterface>& LiteClient::packageManager() const {
+  // the package manager is never reset once constructed, so it can be used after the lock is released
+  std::lock_guard<std::mutex> lock{package_manager_mutex_};
+  if (!package_manager_) {
+    std::shared_ptr<PackageManagerInterface> package_manager;
+    if (config.pacman.type == ComposeAppManager::Name) {
+      package_manager = std::make_shared<ComposeAppManager>(config.pacman, config.bootloader, storage, http_client,
+                                                            sysroot_, *key_manager_, app_engine_);
+    } else {
+      package_manager = std::make_shared<RootfsTreeManager>(config.pacman, config.bootloader, storage, http_client,
+                                                            sysroot_, *key_manager_);
+    }
+    auto downloader{std::dynamic_pointer_cast<Downloader>(package_manager)};
+    if (!downloader) {
+      throw std::runtime_error("Invalid package manager: cannot cast to Downloader type");
+    }
+    if (download_progress_cb_) {
+      downloader->setProgressCb(std::move(download_progress_cb_));
+      download_progress_cb_ = nullptr;
+    }
+    downloader_ = std::move(downloader);
+    package_manager_ = std::move(package_manager);
   }
-  sysroot_ = ostree_sysroot;
+  return package_manager_;
+}
+
+const std::shared_ptr<Downloader>& LiteClient::downloader() const {
+  packageManager();
+  return downloader_;
 }
 
 LiteClient::~LiteClient() {}  // NOLINT(modernize-use-equals-default, hicpp-use-equals-default)
@@ -136,7 +260,7 @@ data::InstallationResult LiteClient::finalizePendingUpdate(boost::optional<Uptan
   bool app_start_failed{false};
   LOG_INFO << "Finalizing pending installation; Target: " << target->filename() << ", hash: " << target->sha256Hash();
 
-  ret = package_manager_->finalizeInstall(*target);
+  ret = packageManager()->finalizeInstall(*target);
   if (ret.isSuccess()) {
     LOG_INFO << "Finalization has been completed successfully; Target: " << target->filename();
     mode = InstalledVersionUpdateMode::kCurrent;
@@ -158,12 +282,13 @@ data::InstallationResult LiteClient::finalizePendingUpdate(boost::optional<Uptan
   }
   if (ret.isSuccess() || rollback || app_start_failed) {
     // mark the given Target as "known" Target which indicates that this is a failing/bad Target.
-    storage->saveInstalledVersion("", *target, mode);
+    saveInstalledVersion(*target, mode);
   }
   return ret;
 }
 
 bool LiteClient::finalizeInstall() {
+  UpdateTrace::Phase phase{"finalize"};
   data::InstallationResult ret{data::ResultCode::Numeric::kOk, ""};
   boost::optional<Uptane::Target> pending;
 
@@ -177,15 +302,18 @@ bool LiteClient::finalizeInstall() {
   }
 
   // write current to /var/sota
-  const auto current = getCurrent();
-  update_request_headers(http_client, current, config.pacman);
-  writeCurrentTarget(current);
+  const auto current{getCurrentSnapshot()};
+  update_request_headers(http_client, *current, config.pacman);
+  writeCurrentTarget(*current);
 
   // notify the backend about pending Target installation
   if (!!pending && !ret.needCompletion()) {
     notifyInstallFinished(*pending, ret);
   }
 
+  if (ret.result_code.num_code != data::ResultCode::Numeric::kOk) {
+    phase.setFailed();
+  }
   return ret.result_code.num_code == data::ResultCode::Numeric::kOk;
 }
 
@@ -217,9 +345,9 @@ void LiteClient::callback(const char* msg, const Uptane::Target& install_target,
   boost::process::environment env_copy = env;
   env_copy["MESSAGE"] = msg;
   env_copy["CURRENT_TARGET"] = (config.storage.path / "current-target").string();
-  auto current = getCurrent();
-  if (!current.MatchTarget(Uptane::Target::Unknown())) {
-    env_copy["CURRENT_TARGET_NAME"] = current.filename();
+  const auto current{getCurrentSnapshot()};
+  if (!current->MatchTarget(Uptane::Target::Unknown())) {
+    env_copy["CURRENT_TARGET_NAME"] = current->filename();
   }
 
   if (!install_target.MatchTarget(Uptane::Target::Unknown())) {
@@ -238,6 +366,7 @@ void LiteClient::callback(const char* msg, const Uptane::Target& install_target,
 bool LiteClient::checkForUpdatesBegin() {
   Uptane::Target t = Uptane::Target::Unknown();
   callback("check-for-update-pre", t);
+  update_started_at_ = std::chrono::system_clock::now();
   const auto rc = updateImageMeta();
   if (!std::get<0>(rc)) {
     callback("check-for-update-post", t, "FAILED: " + std::get<1>(rc));
@@ -287,6 +416,7 @@ bool LiteClient::importRootMeta(const boost::filesystem::path& src, Uptane::Vers
   bool res{true};
   try {
     offline::MetaFetcher offline_meta_fetcher{src.string(), max_ver};
+    verified_timestamp_.clear();
     image_repo_.updateRoot(*storage, offline_meta_fetcher);
   } catch (const offline::MetaFetcher::NotFoundException&) {
     // That's OK, it means the latest + 1 root version is not found
@@ -395,25 +525,29 @@ class DetailedInstallCompletedReport : public EcuInstallationCompletedReport {
 };
 
 void LiteClient::notifyInstallFinished(const Uptane::Target& t, data::InstallationResult& ir) {
+  std::unique_ptr<ReportEvent> event;
   if (ir.needCompletion()) {
     callback("install-post", t, "NEEDS_COMPLETION");
-    notify(t, std_::make_unique<DetailedAppliedReport>(primary_ecu.first, t.correlation_id(), ir.description));
-    return;
-  }
-
-  if (ir.result_code == data::ResultCode::Numeric::kOk) {
+    event = std_::make_unique<DetailedAppliedReport>(primary_ecu.first, t.correlation_id(), ir.description);
+  } else if (ir.result_code == data::ResultCode::Numeric::kOk) {
     writeCurrentTarget(t);
     callback("install-post", t, "OK");
-    notify(t, std_::make_unique<DetailedInstallCompletedReport>(primary_ecu.first, t.correlation_id(), true,
-                                                                ir.description));
+    event =
+        std_::make_unique<DetailedInstallCompletedReport>(primary_ecu.first, t.correlation_id(), true, ir.description);
   } else {
     callback("install-post", t, "FAILED");
-    notify(t, std_::make_unique<DetailedInstallCompletedReport>(primary_ecu.first, t.correlation_id(), false,
-                                                                ir.description));
+    event =
+        std_::make_unique<DetailedInstallCompletedReport>(primary_ecu.first, t.correlation_id(), false, ir.description);
   }
+  if (update_trace_report_) {
+    // the spans of the update cycle so far, the install/finalize phases themselves end after the event is sent
+    event->custom["trace"] = UpdateTrace::instance().toJson(update_started_at_);
+  }
+  notify(t, std::move(event));
 }
 
 void LiteClient::writeCurrentTarget(const Uptane::Target& t) const {
+  resetCurrentSnapshot();
   std::stringstream ss;
   ss << "TARGET_NAME=\"" << t.filename() << "\"\n";
   ss << "CUSTOM_VERSION=\"" << t.custom_version() << "\"\n";
@@ -447,25 +581,68 @@ void LiteClient::writeCurrentTarget(const Uptane::Target& t) const {
 }
 
 data::InstallationResult LiteClient::installPackage(const Uptane::Target& target) {
-  LOG_INFO << "Installing package using " << package_manager_->name() << " package manager";
+  LOG_INFO << "Installing package using " << packageManager()->name() << " package manager";
   try {
-    return package_manager_->install(target);
+    return packageManager()->install(target);
   } catch (std::exception& ex) {
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, ex.what());
   }
 }
 
 std::tuple<bool, std::string> LiteClient::updateImageMeta() {
+  UpdateTrace::Phase phase{"tuf_update"};
   try {
+    // the root metadata rotation and expiration are checked on each update, it is just the snapshot and targets
+    // metadata that are not downloaded again if the timestamp metadata have not changed
+    std::string root;
+    storage->loadLatestRoot(&root, Uptane::RepositoryType::Image());
+    image_repo_.updateRoot(*storage, *uptane_fetcher_);
+    std::string updated_root;
+    storage->loadLatestRoot(&updated_root, Uptane::RepositoryType::Image());
+    if (updated_root == root && isImageMetaUpToDate()) {
+      LOG_DEBUG << "Image repo metadata have not changed since the last check, skipping their update";
+      return {true, ""};
+    }
+    verified_timestamp_.clear();
     image_repo_.updateMeta(*storage, *uptane_fetcher_);
+    storage->loadNonRoot(&verified_timestamp_, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
   } catch (const std::exception& e) {
     LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
+    phase.setFailed();
     return {false, e.what()};
   }
 
   return {true, ""};
 }
 
+bool LiteClient::isImageMetaUpToDate() const {
+  const auto targets{image_repo_.getTargets()};
+  if (!targets || verified_timestamp_.empty()) {
+    return false;
+  }
+  // The timestamp metadata are tiny, and any change in the snapshot or targets metadata results in a new timestamp,
+  // so if the timestamp is the same as the one the loaded metadata have been verified with, then the snapshot and
+  // targets metadata don't need to be downloaded and parsed again, just checked for expiration
+  std::string timestamp;
+  uptane_fetcher_->fetchLatestRole(&timestamp, Uptane::kMaxTimestampSize, Uptane::RepositoryType::Image(),
+                                   Uptane::Role::Timestamp());
+  if (timestamp != verified_timestamp_) {
+    return false;
+  }
+  std::string snapshot;
+  if (!storage->loadNonRoot(&snapshot, Uptane::RepositoryType::Image(), Uptane::Role::Snapshot())) {
+    return false;
+  }
+  const auto now{TimeStamp::Now()};
+  for (const auto* meta : {&timestamp, &snapshot}) {
+    const auto expires{Utils::parseJSON(*meta)["signed"]["expires"]};
+    if (!expires.isString() || TimeStamp(expires.asString()).IsExpiredAt(now)) {
+      return false;
+    }
+  }
+  return !targets->isExpired(now);
+}
+
 const std::vector<Uptane::Target>& LiteClient::allTargets() const {
   std::shared_ptr<const Uptane::Targets> targets{image_repo_.getTargets()};
   if (targets) {
@@ -475,9 +652,23 @@ const std::vector<Uptane::Target>& LiteClient::allTargets() const {
   }
 }
 
+TargetCatalog::Ptr LiteClient::targetCatalog() const {
+  std::shared_ptr<const Uptane::Targets> targets{image_repo_.getTargets()};
+  const int version{targets ? targets->version() : -1};
+  if (!target_catalog_ || target_catalog_->version() != version) {
+    // the catalog refers to the verified Targets held by the Image repo instead of copying them
+    target_catalog_ = std::make_shared<const TargetCatalog>(
+        version, targets ? TargetCatalog::TargetsPtr(targets, &targets->targets)
+                         : std::make_shared<const std::vector<Uptane::Target>>());
+  }
+  return target_catalog_;
+}
+
 bool LiteClient::checkImageMetaOffline() {
   try {
+    verified_timestamp_.clear();
     image_repo_.checkMetaOffline(*storage);
+    storage->loadNonRoot(&verified_timestamp_, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
   } catch (const std::exception& e) {
     LOG_ERROR << "Failed to check Image repo metadata: " << e.what();
     return false;
@@ -495,7 +686,7 @@ DownloadResult LiteClient::downloadImage(const Uptane::Target& target, const api
     std::chrono::milliseconds wait(500);
 
     for (; tries < max_tries; tries++) {
-      download_result = downloader_->Download(Target::toTufTarget(target));
+      download_result = downloader()->Download(Target::toTufTarget(target));
       // success = package_manager_->fetchTarget(target, *uptane_fetcher_, *key_manager_, prog_cb, token);
 
       // Skip trying to fetch the 'target' if control flow token transaction
@@ -515,10 +706,60 @@ DownloadResult LiteClient::downloadImage(const Uptane::Target& target, const api
   return download_result;
 }
 
-void LiteClient::reportAktualizrConfiguration() {
+bool LiteClient::reportAktualizrConfiguration() { return sendAktualizrConfiguration(*http_client); }
+
+bool LiteClient::reportNetworkInfo() { return sendNetworkInfo(*http_client); }
+
+bool LiteClient::reportHwInfo() { return sendHwInfo(*http_client); }
+
+bool LiteClient::reportAppsState() {
+  Json::Value apps_state;
+  boost::optional<uint64_t> apps_state_seq;
+  if (!getAppsStateToReport(apps_state, apps_state_seq)) {
+    return false;
+  }
+  if (apps_state.isNull()) {
+    return true;
+  }
+  return apps_state_http_client_ ? sendAppsState(*apps_state_http_client_, apps_state, apps_state_seq)
+                                 : sendAppsState(*http_client, apps_state, apps_state_seq);
+}
+
+std::function<bool()> LiteClient::aktualizrConfigurationReport() {
+  auto http{std::make_shared<HttpClient>(*http_client)};
+  return [this, http]() { return sendAktualizrConfiguration(*http); };
+}
+
+std::function<bool()> LiteClient::networkInfoReport() {
+  auto http{std::make_shared<HttpClient>(*http_client)};
+  return [this, http]() { return sendNetworkInfo(*http); };
+}
+
+std::function<bool()> LiteClient::hwInfoReport() {
+  auto http{std::make_shared<HttpClient>(*http_client)};
+  return [this, http]() { return sendHwInfo(*http); };
+}
+
+std::function<bool()> LiteClient::appsStateReport() {
+  Json::Value apps_state;
+  boost::optional<uint64_t> apps_state_seq;
+  // a failure to obtain the state is retried by the report of the next update cycle
+  if (!getAppsStateToReport(apps_state, apps_state_seq) || apps_state.isNull()) {
+    return nullptr;
+  }
+  std::shared_ptr<HttpInterface> http;
+  if (apps_state_http_client_) {
+    http = std::make_shared<GzipHttpClient>(*apps_state_http_client_);
+  } else {
+    http = std::make_shared<HttpClient>(*http_client);
+  }
+  return [this, http, apps_state, apps_state_seq]() { return sendAppsState(*http, apps_state, apps_state_seq); };
+}
+
+bool LiteClient::sendAktualizrConfiguration(HttpInterface& http) {
   if (!config.telemetry.report_config) {
     LOG_DEBUG << "Not reporting libaktualizr configuration because telemetry is disabled";
-    return;
+    return true;
   }
 
   std::stringstream conf_ss;
@@ -529,119 +770,194 @@ void LiteClient::reportAktualizrConfiguration() {
   if (!(storage->loadDeviceDataHash("configuration", &stored_hash) &&
         new_hash == Hash(Hash::Type::kSha256, stored_hash))) {
     LOG_DEBUG << "Reporting libaktualizr configuration";
-    const HttpResponse response =
-        http_client->put(config.tls.server + "/system_info/config", "application/toml", conf_str);
+    const HttpResponse response = http.put(config.tls.server + "/system_info/config", "application/toml", conf_str);
     if (response.isOk()) {
       storage->storeDeviceDataHash("configuration", new_hash.HashString());
     } else {
       LOG_DEBUG << "Unable to report libaktualizr configuration: " << response.getStatusStr();
+      return false;
     }
   }
+  return true;
 }
 
-void LiteClient::reportNetworkInfo() {
+bool LiteClient::sendNetworkInfo(HttpInterface& http) {
   if (config.telemetry.report_network) {
     LOG_DEBUG << "Reporting network information";
     Json::Value network_info = Utils::getNetworkInfo();
     if (network_info != last_network_info_reported_) {
-      const HttpResponse response = http_client->put(config.tls.server + "/system_info/network", network_info);
+      const HttpResponse response = http.put(config.tls.server + "/system_info/network", network_info);
       if (response.isOk()) {
         last_network_info_reported_ = network_info;
       } else {
         LOG_DEBUG << "Unable to report network information: " << response.getStatusStr();
+        return false;
       }
     }
   } else {
     LOG_DEBUG << "Not reporting network information because telemetry is disabled";
   }
+  return true;
 }
 
-void LiteClient::reportHwInfo() {
+bool LiteClient::sendHwInfo(HttpInterface& http) {
   if (!config.telemetry.report_network) {
     LOG_DEBUG << "Not reporting hwinfo information because telemetry is disabled";
-    return;
+    return true;
   }
 
   if (hwinfo_reported_) {
-    return;
+    return true;
   }
   Json::Value hw_info = Utils::getHardwareInfo();
   if (!hw_info.empty()) {
-    const HttpResponse response = http_client->put(config.tls.server + "/system_info", hw_info);
+    const HttpResponse response = http.put(config.tls.server + "/system_info", hw_info);
     if (response.isOk()) {
       hwinfo_reported_ = true;
     } else {
       LOG_DEBUG << "Unable to report hwinfo information: " << response.getStatusStr();
+      return false;
     }
   } else {
     LOG_WARNING << "Unable to fetch hardware information from host system.";
   }
+  return true;
 }
 
-void LiteClient::reportAppsState() {
-  if (package_manager_->name() != ComposeAppManager::Name) {
-    return;
+bool LiteClient::getAppsStateToReport(Json::Value& apps_state, boost::optional<uint64_t>& apps_state_seq) {
+  if (packageManager()->name() != ComposeAppManager::Name) {
+    return true;
   }
-  auto compose_pacman = std::dynamic_pointer_cast<ComposeAppManager>(package_manager_);
+  auto compose_pacman = std::dynamic_pointer_cast<ComposeAppManager>(packageManager());
   if (!compose_pacman) {
     LOG_ERROR << "Cannot downcast the package manager to Compose App Manager";
-    return;
+    return true;
   }
-  const auto apps_state{compose_pacman->getAppsState()};
-  if (apps_state.isNull()) {
+  // no container event since the reported state has been obtained means that the state has not changed
+  uint64_t seq{0};
+  if (compose_pacman->getAppsStateSeq(seq)) {
+    apps_state_seq = seq;
+    std::lock_guard<std::mutex> lock{apps_state_mutex_};
+    if (!apps_state_.isNull() && apps_state_seq_ == apps_state_seq) {
+      LOG_DEBUG << "No container events since the last Apps state report, skipping sending it to Device Gateway";
+      return true;
+    }
+  }
+  auto state{compose_pacman->getAppsState()};
+  if (state.isNull()) {
     LOG_WARNING << "Failed to obtain Apps state, skipping sending it to Device Gateway";
-    return;
+    return false;
   }
-  if (ComposeAppManager::compareAppsStates(apps_state_, apps_state)) {
+  std::lock_guard<std::mutex> lock{apps_state_mutex_};
+  if (ComposeAppManager::compareAppsStates(apps_state_, state)) {
     LOG_DEBUG << "Apps state has not changed, skipping sending it to Device Gateway";
-    return;
+    apps_state_seq_ = apps_state_seq;
+    return true;
   }
-  auto resp = http_client->post(config.tls.server + "/apps-states", apps_state);
-  if (resp.isOk()) {
-    apps_state_ = apps_state;
-  } else {
+  apps_state = std::move(state);
+  return true;
+}
+
+bool LiteClient::sendAppsState(HttpInterface& http, const Json::Value& apps_state,
+                               const boost::optional<uint64_t>& apps_state_seq) {
+  UpdateTrace::Phase phase{"report_apps_state"};
+  Json::Value report;
+  {
+    std::lock_guard<std::mutex> lock{apps_state_mutex_};
+    // the state may have been acknowledged since it was obtained, e.g. by the retried report
+    if (ComposeAppManager::compareAppsStates(apps_state_, apps_state)) {
+      apps_state_seq_ = apps_state_seq;
+      return true;
+    }
+    // the first state is always sent in full, the following ones relatively to the last acknowledged one
+    report = apps_state_delta_ && !apps_state_.isNull() ? ComposeAppManager::getAppsStateDelta(apps_state_, apps_state)
+                                                        : apps_state;
+  }
+  const auto resp{http.post(config.tls.server + "/apps-states", report)};
+  if (!resp.isOk()) {
     LOG_WARNING << "Failed to send App states to Device Gateway: " << resp.getStatusStr();
+    phase.setFailed();
+    return false;
   }
+  std::lock_guard<std::mutex> lock{apps_state_mutex_};
+  apps_state_ = apps_state;
+  apps_state_seq_ = apps_state_seq;
+  return true;
 }
 
-DownloadResult LiteClient::download(const Uptane::Target& target, const std::string& reason) {
+DownloadResult LiteClient::download(const Uptane::Target& target, const std::string& reason,
+                                    const api::FlowControlToken* token, DownloadProgressCb progress_cb) {
+  UpdateTrace::Phase phase{"download", target.filename()};
   notifyDownloadStarted(target, reason);
-  auto download_result{downloadImage(target)};
+  downloader()->setDownloadControl(std::move(progress_cb), token);
+  DownloadResult download_result;
+  try {
+    download_result = downloadImage(target, token);
+  } catch (...) {
+    downloader()->setDownloadControl(nullptr, nullptr);
+    throw;
+  }
+  downloader()->setDownloadControl(nullptr, nullptr);
+  if (!download_result) {
+    phase.setFailed();
+  }
   notifyDownloadFinished(target, download_result, download_result.description);
   return download_result;
 }
 
+void LiteClient::setDownloadProgressCb(DownloadProgressCb cb) {
+  std::lock_guard<std::mutex> lock{package_manager_mutex_};
+  if (downloader_) {
+    downloader_->setProgressCb(std::move(cb));
+  } else {
+    // set once the package manager is constructed
+    download_progress_cb_ = std::move(cb);
+  }
+}
+
 data::ResultCode::Numeric LiteClient::install(const Uptane::Target& target) {
+  UpdateTrace::Phase phase{"install", target.filename()};
   notifyInstallStarted(target);
   auto iresult = installPackage(target);
+  if (!iresult.isSuccess() && !iresult.needCompletion()) {
+    phase.setFailed();
+  }
   if (iresult.result_code.num_code == data::ResultCode::Numeric::kNeedCompletion) {
     LOG_INFO << "Update complete. Please reboot the device to activate";
-    storage->savePrimaryInstalledVersion(target, InstalledVersionUpdateMode::kPending);
+    saveInstalledVersion(target, InstalledVersionUpdateMode::kPending);
     is_reboot_required_ = (config.pacman.booted == BootedType::kBooted);
   } else if (iresult.result_code.num_code == data::ResultCode::Numeric::kOk) {
     LOG_INFO << "Update complete. No reboot needed";
-    storage->savePrimaryInstalledVersion(target, InstalledVersionUpdateMode::kCurrent);
+    saveInstalledVersion(target, InstalledVersionUpdateMode::kCurrent);
   } else if (iresult.result_code.num_code == data::ResultCode::Numeric::kDownloadFailed) {
     LOG_INFO << "Apps installation failed while the install process was trying to fetch App images data,"
                 " will try the install again at the next update cycle.";
   } else {
     LOG_ERROR << "Unable to install update: " << iresult.description;
     LOG_ERROR << "Marking " << target.filename() << " as a failing Target";
-    storage->saveInstalledVersion("", target, InstalledVersionUpdateMode::kNone);
+    saveInstalledVersion(target, InstalledVersionUpdateMode::kNone);
     // let go of the lock since we couldn't update
   }
   notifyInstallFinished(target, iresult);
   return iresult.result_code.num_code;
 }
 
+std::shared_ptr<const Uptane::Target> LiteClient::getCurrentSnapshot() const {
+  std::lock_guard<std::mutex> lock{current_mutex_};
+  if (!current_) {
+    current_ = std::make_shared<const Uptane::Target>(packageManager()->getCurrent());
+  }
+  return current_;
+}
+
 bool LiteClient::isTargetActive(const Uptane::Target& target) const {
-  const auto current{getCurrent()};
-  return target.filename() == current.filename() && target.sha256Hash() == current.sha256Hash();
+  const auto current{getCurrentSnapshot()};
+  return target.filename() == current->filename() && target.sha256Hash() == current->sha256Hash();
 }
 
 bool LiteClient::appsInSync(const Uptane::Target& target) const {
-  if (package_manager_->name() == ComposeAppManager::Name) {
-    auto* compose_pacman = dynamic_cast<ComposeAppManager*>(package_manager_.get());
+  if (packageManager()->name() == ComposeAppManager::Name) {
+    auto* compose_pacman = dynamic_cast<ComposeAppManager*>(packageManager().get());
     if (compose_pacman == nullptr) {
       LOG_ERROR << "Cannot downcast the package manager to a specific type";
       return false;
@@ -649,7 +965,12 @@ bool LiteClient::appsInSync(const Uptane::Target& target) const {
     LOG_INFO << "Checking Active Target status...";
     auto no_any_app_to_update = compose_pacman->checkForAppsToUpdate(target);
     if (no_any_app_to_update) {
-      compose_pacman->handleRemovedApps(getCurrent());
+      // the Apps run fine, so their previous versions are not needed for a rollback anymore
+      const auto current{getCurrentSnapshot()};
+      compose_pacman->confirmApps(*current);
+      if (!compose_pacman->runDeferredCleanup(*current)) {
+        compose_pacman->handleRemovedApps(*current);
+      }
     }
 
     return no_any_app_to_update;
@@ -658,8 +979,8 @@ bool LiteClient::appsInSync(const Uptane::Target& target) const {
 }
 
 void LiteClient::setAppsNotChecked() {
-  if (package_manager_->name() == ComposeAppManager::Name) {
-    auto* compose_pacman = dynamic_cast<ComposeAppManager*>(package_manager_.get());
+  if (packageManager()->name() == ComposeAppManager::Name) {
+    auto* compose_pacman = dynamic_cast<ComposeAppManager*>(packageManager().get());
     if (compose_pacman == nullptr) {
       LOG_ERROR << "Cannot downcast the package manager to a specific type";
     } else {
@@ -697,7 +1018,49 @@ void LiteClient::logTarget(const std::string& prefix, const Uptane::Target& targ
 }
 
 bool LiteClient::isRollback(const Uptane::Target& target) {
+  const auto& rollback_set{getRollbackSet()};
+  const auto found_it{rollback_set.failed.find(target.filename())};
+  if (found_it == rollback_set.failed.end()) {
+    return false;
+  }
+  // the currently pending Target is not considered as a failing one
+  return std::any_of(found_it->second.begin(), found_it->second.end(),
+                     [&rollback_set](const std::string& hash) { return hash != rollback_set.pending_hash; });
+}
+
+void LiteClient::saveInstalledVersion(const Uptane::Target& target, InstalledVersionUpdateMode mode) {
+  rollback_set_ = boost::none;
+  storage->savePrimaryInstalledVersion(target, mode);
+  resetCurrentSnapshot();
+}
+
+void LiteClient::clearInstalledVersions() {
+  rollback_set_ = boost::none;
+  storage->clearInstalledVersions();
+  resetCurrentSnapshot();
+}
+
+void LiteClient::resetCurrentSnapshot() const {
+  std::lock_guard<std::mutex> lock{current_mutex_};
+  current_.reset();
+}
+
+const LiteClient::RollbackSet& LiteClient::getRollbackSet() {
+  if (!!rollback_set_) {
+    return *rollback_set_;
+  }
   std::vector<Uptane::Target> known_but_not_installed_versions;
   get_known_but_not_installed_versions(*this, known_but_not_installed_versions);
-  return known_local_target(*this, target, known_but_not_installed_versions);
+  boost::optional<Uptane::Target> pending;
+  storage->loadPrimaryInstalledVersions(nullptr, &pending);
+
+  RollbackSet rollback_set;
+  for (const auto& t : known_but_not_installed_versions) {
+    rollback_set.failed[t.filename()].emplace(t.sha256Hash());
+  }
+  if (!!pending) {
+    rollback_set.pending_hash = pending->sha256Hash();
+  }
+  rollback_set_ = std::move(rollback_set);
+  return *rollback_set_;
 }
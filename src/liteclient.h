@@ -1,10 +1,21 @@
 #ifndef AKTUALIZR_LITE_CLIENT_H_
 #define AKTUALIZR_LITE_CLIENT_H_
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <boost/optional.hpp>
+
+#include "aktualizr-lite/api.h"
 #include "gtest/gtest_prod.h"
 #include "libaktualizr/config.h"
 #include "libaktualizr/packagemanagerinterface.h"
 #include "ostree/sysroot.h"
+#include "targetcatalog.h"
 #include "uptane/fetcher.h"
 #include "uptane/imagerepository.h"
 
@@ -15,8 +26,8 @@ class KeyManager;
 class P11EngineGuard;
 class ReportEvent;
 class ReportQueue;
-class DownloadResult;
 class Downloader;
+class GzipHttpClient;
 
 class LiteClient {
  public:
@@ -41,7 +52,10 @@ class LiteClient {
   void checkForUpdatesEndWithFailure(const std::string& err);
   bool finalizeInstall();
   Uptane::Target getRollbackTarget();
-  DownloadResult download(const Uptane::Target& target, const std::string& reason);
+  // The download stops between its steps, e.g. ostree object batches or Apps, once the given token is aborted,
+  // the given callback receives the download progress in addition to the one set by setDownloadProgressCb()
+  DownloadResult download(const Uptane::Target& target, const std::string& reason,
+                          const api::FlowControlToken* token = nullptr, DownloadProgressCb progress_cb = nullptr);
   data::ResultCode::Numeric install(const Uptane::Target& target);
   void notifyInstallFinished(const Uptane::Target& t, data::InstallationResult& ir);
   std::pair<bool, std::string> isRebootRequired() const {
@@ -49,15 +63,29 @@ class LiteClient {
   }
 
   bool composeAppsChanged() const;
-  Uptane::Target getCurrent() const { return package_manager_->getCurrent(); }
+  // The current Target is loaded from the storage and the sysroot once and shared by the callers till it changes,
+  // i.e. till the installation log or the current-target file is written
+  std::shared_ptr<const Uptane::Target> getCurrentSnapshot() const;
+  Uptane::Target getCurrent() const { return *getCurrentSnapshot(); }
   std::tuple<bool, std::string> updateImageMeta();
   bool checkImageMetaOffline();
   const std::vector<Uptane::Target>& allTargets() const;
-  TargetStatus VerifyTarget(const Uptane::Target& target) const { return package_manager_->verifyTarget(target); }
-  void reportAktualizrConfiguration();
-  void reportNetworkInfo();
-  void reportHwInfo();
-  void reportAppsState();
+  // The catalog of the Targets listed in the currently loaded targets.json, rebuilt only if its version changes
+  TargetCatalog::Ptr targetCatalog() const;
+  TargetStatus VerifyTarget(const Uptane::Target& target) const { return packageManager()->verifyTarget(target); }
+  // The reports return false if they have failed to be sent and should be retried
+  bool reportAktualizrConfiguration();
+  bool reportNetworkInfo();
+  bool reportHwInfo();
+  bool reportAppsState();
+  // The same reports to be sent by another thread while the calling one keeps using the client, see ReportWorker.
+  // Each of them sends by means of its own copy of the HTTP client, and the Apps state is obtained by the calling
+  // thread, so they share neither the HTTP client nor the package manager with the update cycle. The Apps state
+  // report is nullptr if there is nothing to send.
+  std::function<bool()> aktualizrConfigurationReport();
+  std::function<bool()> networkInfoReport();
+  std::function<bool()> hwInfoReport();
+  std::function<bool()> appsStateReport();
   bool isTargetActive(const Uptane::Target& target) const;
   bool appsInSync(const Uptane::Target& target) const;
   void setAppsNotChecked();
@@ -66,12 +94,18 @@ class LiteClient {
                                      PackageConfig& config);
   void logTarget(const std::string& prefix, const Uptane::Target& target) const;
   std::unique_ptr<ReportQueue> report_queue;
+  // Whether the given Target is known to be bad, i.e. its installation has failed or it has been rolled back from,
+  // looked up in the cached installation log
   bool isRollback(const Uptane::Target& target);
+  // Write to the installation log, the cached one is updated accordingly
+  void saveInstalledVersion(const Uptane::Target& target, InstalledVersionUpdateMode mode);
+  void clearInstalledVersions();
 
   void notifyDownloadFinished(const Uptane::Target& t, bool success, const std::string& err_msg = "");
   std::tuple<bool, boost::filesystem::path> isRootMetaImportNeeded();
   bool importRootMeta(const boost::filesystem::path& src, Uptane::Version max_ver = Uptane::Version());
   void importRootMetaIfNeededAndPresent();
+  void setDownloadProgressCb(DownloadProgressCb cb);
 
  private:
   FRIEND_TEST(helpers, locking);
@@ -85,18 +119,45 @@ class LiteClient {
   void notifyDownloadStarted(const Uptane::Target& t, const std::string& reason);
   void notifyInstallStarted(const Uptane::Target& t);
   void writeCurrentTarget(const Uptane::Target& t) const;
+  void resetCurrentSnapshot() const;
 
   data::InstallationResult installPackage(const Uptane::Target& target);
   DownloadResult downloadImage(const Uptane::Target& target, const api::FlowControlToken* token = nullptr);
   static void add_apps_header(std::vector<std::string>& headers, PackageConfig& config);
   data::InstallationResult finalizePendingUpdate(boost::optional<Uptane::Target>& target);
+  bool isImageMetaUpToDate() const;
+
+  struct RollbackSet {
+    // Target name -> hashes of the Targets of the name which are known, but have never been successfully installed
+    std::unordered_map<std::string, std::unordered_set<std::string>> failed;
+    std::string pending_hash;
+  };
+  const RollbackSet& getRollbackSet();
+
+  bool sendAktualizrConfiguration(HttpInterface& http);
+  bool sendNetworkInfo(HttpInterface& http);
+  bool sendHwInfo(HttpInterface& http);
+  // Obtains the Apps state to report, it is left null if the state has not changed since the last report,
+  // returns false if the state can't be obtained
+  bool getAppsStateToReport(Json::Value& apps_state, boost::optional<uint64_t>& apps_state_seq);
+  bool sendAppsState(HttpInterface& http, const Json::Value& apps_state,
+                     const boost::optional<uint64_t>& apps_state_seq);
+  // The package manager and the App engine are constructed on first use, so the commands that don't need them, and
+  // the agent startup, don't wait for them
+  const std::shared_ptr<PackageManagerInterface>& packageManager() const;
+  const std::shared_ptr<Downloader>& downloader() const;
 
   boost::filesystem::path callback_program;
   std::unique_ptr<KeyManager> key_manager_;
-  std::shared_ptr<PackageManagerInterface> package_manager_;
+  std::shared_ptr<AppEngine> app_engine_;
+  // guards the construction of the package manager, it may be first used by the report worker thread
+  mutable std::mutex package_manager_mutex_;
+  mutable std::shared_ptr<PackageManagerInterface> package_manager_;
 
   Uptane::ImageRepository image_repo_;
   std::shared_ptr<Uptane::IMetadataFetcher> uptane_fetcher_;
+  // the Image repo timestamp metadata the currently loaded metadata have been verified with
+  std::string verified_timestamp_;
 
   Json::Value last_network_info_reported_;
   bool hwinfo_reported_{false};
@@ -104,11 +165,31 @@ class LiteClient {
 
   std::shared_ptr<OSTree::Sysroot> sysroot_;
   std::vector<Uptane::Target> no_targets_;
-
-  std::shared_ptr<Downloader> downloader_;
+  // the rollback set of the installation log, loaded on demand and reset whenever the log is written
+  boost::optional<RollbackSet> rollback_set_;
+  // the current Target snapshot, loaded on demand and reset whenever the installation log is written
+  mutable std::mutex current_mutex_;
+  mutable std::shared_ptr<const Uptane::Target> current_;
+  mutable TargetCatalog::Ptr target_catalog_;
+
+  mutable std::shared_ptr<Downloader> downloader_;
+  mutable DownloadProgressCb download_progress_cb_;
+  // guards the acknowledged Apps state, it is obtained and sent by different threads in the daemon mode
+  std::mutex apps_state_mutex_;
+  // the last Apps state acknowledged by Device Gateway
   Json::Value apps_state_;
-  const int report_queue_run_pause_s_{10};
-  const int report_queue_event_limit_{6};
+  // the container events sequence number the last reported or unchanged Apps state has been obtained at
+  boost::optional<uint64_t> apps_state_seq_;
+  // report just the Apps whose state differs from the acknowledged one
+  bool apps_state_delta_{false};
+  bool apps_state_gzip_{false};
+  std::shared_ptr<GzipHttpClient> apps_state_http_client_;
+  // how often (seconds) and how many at once the queued events are sent
+  int report_queue_run_pause_s_{10};
+  int report_queue_event_limit_{6};
+  // attach the update trace to the installation events
+  bool update_trace_report_{false};
+  std::chrono::system_clock::time_point update_started_at_;
 };
 
 #endif  // AKTUALIZR_LITE_CLIENT_H_
@@ -11,7 +11,11 @@
 #include <boost/program_options.hpp>
 
 #include "crypto/keymanager.h"
+#include "downloadpolicy.h"
+#include "execstats.h"
 #include "helpers.h"
+#include "pollingscheduler.h"
+#include "reportworker.h"
 #include "http/httpclient.h"
 #include "libaktualizr/config.h"
 #include "storage/invstorage.h"
@@ -102,38 +106,28 @@ static int list_main(LiteClient& client, const bpo::variables_map& unused) {
     }
   }
 
-  boost::container::flat_map<int, Uptane::Target> sorted_targets;
-  for (const auto& t : client.allTargets()) {
+  boost::container::flat_map<int, TargetCatalog::TargetPtr> sorted_targets;
+  for (const auto& t : client.targetCatalog()->getTargets(hwid, client.tags)) {
     int ver = 0;
     try {
-      ver = std::stoi(t.custom_version(), nullptr, 0);
+      ver = std::stoi(t->custom_version(), nullptr, 0);
     } catch (const std::invalid_argument& exc) {
-      LOG_ERROR << "Invalid version number format: " << t.custom_version();
+      LOG_ERROR << "Invalid version number format: " << t->custom_version();
       ver = -1;
     }
-    if (!target_has_tags(t, client.tags)) {
-      continue;
-    }
-    for (const auto& it : t.hardwareIds()) {
-      if (it == hwid) {
-        sorted_targets.emplace(ver, t);
-        break;
-      }
-    }
+    sorted_targets.emplace(ver, t);
   }
 
   LOG_INFO << "Updates available to " << hwid << ":";
   for (auto& pair : sorted_targets) {
-    client.logTarget("", pair.second);
+    client.logTarget("", *pair.second);
   }
   return 0;
 }
 
-static std::pair<bool, std::unique_ptr<Uptane::Target>> find_target(LiteClient& client,
-                                                                    Uptane::HardwareIdentifier& hwid,
-                                                                    const std::vector<std::string>& tags,
-                                                                    const std::string& version) {
-  std::unique_ptr<Uptane::Target> rv;
+static std::pair<bool, TargetCatalog::TargetPtr> find_target(LiteClient& client, Uptane::HardwareIdentifier& hwid,
+                                                             const std::vector<std::string>& tags,
+                                                             const std::string& version) {
   const auto rc = client.updateImageMeta();
   if (!std::get<0>(rc)) {
     LOG_WARNING << "Unable to update latest metadata, using local copy: " << std::get<1>(rc);
@@ -142,47 +136,22 @@ static std::pair<bool, std::unique_ptr<Uptane::Target>> find_target(LiteClient&
     }
   }
 
-  // if a new version of targets.json hasn't been downloaded why do we do the following search
-  // for the latest ??? It's really needed just for the forced update to a specific version
-  bool find_latest = (version == "latest");
-  std::unique_ptr<Uptane::Target> latest = nullptr;
-  for (const auto& t : client.allTargets()) {
-    if (!t.IsValid()) {
-      continue;
-    }
-
-    if (!t.IsOstree()) {
-      continue;
-    }
-
-    if (!target_has_tags(t, tags)) {
-      continue;
-    }
-    for (auto const& it : t.hardwareIds()) {
-      if (it == hwid) {
-        if (find_latest) {
-          if (latest == nullptr || Target::Version(latest->custom_version()) < Target::Version(t.custom_version())) {
-            latest = std_::make_unique<Uptane::Target>(t);
-          }
-        } else if (version == t.filename() || version == t.custom_version()) {
-          return {true, std_::make_unique<Uptane::Target>(t)};
-        }
-      }
-    }
-  }
-  if (find_latest && latest != nullptr) {
-    return {true, std::move(latest)};
+  // The catalog is rebuilt only if a new version of targets.json has been downloaded, so searching for
+  // the latest Target of an unchanged targets.json is just a look-up
+  const auto is_valid_ostree = [](const Uptane::Target& t) { return t.IsValid() && t.IsOstree(); };
+  const auto catalog{client.targetCatalog()};
+  const auto target{version == "latest" ? catalog->getLatest(hwid, tags, is_valid_ostree)
+                                        : catalog->find(hwid, tags, version, is_valid_ostree)};
+  if (target != nullptr) {
+    return {true, target};
   }
 
-  return {false, std_::make_unique<Uptane::Target>(Uptane::Target::Unknown())};
+  return {false, std::make_shared<const Uptane::Target>(Uptane::Target::Unknown())};
 }
 
-static std::tuple<data::ResultCode::Numeric, DownloadResult, std::string> do_update(LiteClient& client,
-                                                                                    Uptane::Target target,
-                                                                                    const std::string& reason) {
-  client.logTarget("Updating Active Target: ", client.getCurrent());
-  client.logTarget("To New Target: ", target);
-
+static std::tuple<data::ResultCode::Numeric, DownloadResult, std::string> do_download(LiteClient& client,
+                                                                                      Uptane::Target& target,
+                                                                                      const std::string& reason) {
   generate_correlation_id(target);
 
   const auto download_res{client.download(target, reason)};
@@ -196,8 +165,30 @@ static std::tuple<data::ResultCode::Numeric, DownloadResult, std::string> do_upd
     LOG_ERROR << "Downloaded target is invalid";
     return {res.result_code.num_code, download_res, target.correlation_id()};
   }
+  return {data::ResultCode::Numeric::kOk, download_res, target.correlation_id()};
+}
+
+// `downloaded` - the Target has been downloaded and verified already, its correlation ID is set
+static std::tuple<data::ResultCode::Numeric, DownloadResult, std::string> do_update(LiteClient& client,
+                                                                                    Uptane::Target target,
+                                                                                    const std::string& reason,
+                                                                                    bool downloaded = false) {
+  client.logTarget("Updating Active Target: ", client.getCurrent());
+  client.logTarget("To New Target: ", target);
+
+  if (!downloaded) {
+    const auto download_res{do_download(client, target, reason)};
+    if (std::get<0>(download_res) != data::ResultCode::Numeric::kOk) {
+      return download_res;
+    }
+  } else {
+    LOG_INFO << "Target has been downloaded already, installing it";
+  }
 
-  return {client.install(target), {DownloadResult::Status::Ok}, target.correlation_id()};
+  const auto install_res{client.install(target)};
+  // where the update has spent its time in
+  ExecStats::instance().log();
+  return {install_res, {DownloadResult::Status::Ok}, target.correlation_id()};
 }
 
 static data::ResultCode::Numeric do_app_sync(LiteClient& client) {
@@ -236,7 +227,7 @@ static int update_main(LiteClient& client, const bpo::variables_map& variables_m
   // This is only available if -DALLOW_MANUAL_ROLLBACK is set in the CLI args below.
   if (variables_map.count("clear-installed-versions") > 0) {
     LOG_WARNING << "Clearing installed version history!!!";
-    client.storage->clearInstalledVersions();
+    client.clearInstalledVersions();
   }
 
   LOG_INFO << "Finding " << version << " to update to...";
@@ -274,6 +265,9 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
     return EXIT_FAILURE;
   }
 
+  // the daemon scheduling options, they have been validated at the config load
+  const PollingScheduler::Config polling_cfg{client.config.pacman};
+
   client.importRootMetaIfNeededAndPresent();
   client.finalizeInstall();
 
@@ -285,7 +279,47 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
     interval = variables_map["interval"].as<uint64_t>();
   }
 
-  client.reportAktualizrConfiguration();
+  // The state reports are sent in the background, so a slow or unreachable Device Gateway does not delay the update
+  // cycles, a failed report is retried with a backoff and superseded by the one posted in the next cycle
+  ReportWorker reports;
+  reports.post("config", client.aktualizrConfigurationReport());
+
+  // The update cycles back off on failures to reach the server, are spread randomly and come faster during rollouts
+  std::string device_id;
+  try {
+    device_id = client.getDeviceID();
+  } catch (const std::exception& exc) {
+    LOG_DEBUG << "Failed to get the device ID, the polling jitter is seeded randomly: " << exc.what();
+  }
+  PollingScheduler polling{std::chrono::seconds(interval), device_id,
+                           std::chrono::seconds(polling_cfg.max_sec), static_cast<unsigned>(polling_cfg.jitter_percent),
+                           std::chrono::seconds(polling_cfg.rollout_sec)};
+  auto sleep_till_next_cycle = [&polling](const std::string& msg) {
+    const auto wait{polling.next()};
+    if (!msg.empty()) {
+      LOG_WARNING << msg << "; going to sleep for " << wait.count() << " seconds before starting a new update cycle";
+    }
+    std::this_thread::sleep_for(wait);
+  };
+  int targets_meta_ver{-1};
+
+  // Downloads are postponed till the nearest window opens if the current time is out of the configured windows
+  const DownloadWindows& download_windows{polling_cfg.download_windows};
+  // New Targets are downloaded as soon as they are found, but installed (and rebooted into) only within the install
+  // windows, the same format as the download windows
+  const DownloadWindows& install_windows{polling_cfg.install_windows};
+  // the Target downloaded in advance and waiting for an install window
+  boost::optional<Uptane::Target> prefetched_target;
+  auto wait_for_download_window = [interval](std::chrono::seconds time_to_open) {
+    if (time_to_open.count() == 0) {
+      return false;
+    }
+    const uint64_t sleep_sec{std::min(interval, static_cast<uint64_t>(time_to_open.count()))};
+    LOG_INFO << "Downloads are not allowed at the moment, the next download window opens in " << time_to_open.count()
+             << " seconds; going to sleep for " << sleep_sec << " seconds before starting a new update cycle";
+    std::this_thread::sleep_for(std::chrono::seconds(sleep_sec));
+    return true;
+  };
 
   struct NoSpaceDownloadState {
     Hash ostree_commit_hash;
@@ -298,40 +332,49 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
     LOG_INFO << "Active Target: " << current.filename() << ", sha256: " << current.sha256Hash();
     LOG_INFO << "Checking for a new Target...";
 
-    client.reportAppsState();
+    auto apps_state_report{client.appsStateReport()};
+    if (apps_state_report) {
+      reports.post("apps-state", std::move(apps_state_report));
+    }
     if (!client.checkForUpdatesBegin()) {
-      LOG_WARNING << "Unable to update latest metadata, going to sleep for " << interval
-                  << " seconds before starting a new update cycle";
-      std::this_thread::sleep_for(std::chrono::seconds(interval));
+      polling.setFailed();
+      sleep_till_next_cycle("Unable to update latest metadata");
       continue;  // There's no point trying to look for an update
     }
 
-    client.reportNetworkInfo();
-    client.reportHwInfo();
+    reports.post("network-info", client.networkInfoReport());
+    reports.post("hw-info", client.hwInfoReport());
 
     std::string exc_msg;
     try {
       // try to find the latest Target for a given device
-      std::pair<bool, std::unique_ptr<Uptane::Target>> find_target_res;
+      std::pair<bool, TargetCatalog::TargetPtr> find_target_res;
       try {
         find_target_res = find_target(client, hwid, client.tags, "latest");
+        polling.setSucceeded();
       } catch (const std::exception& exc) {
         LOG_ERROR << "Failed to check for a new Target: " << exc.what();
         exc_msg = exc.what();
+        polling.setFailed();
       }
+      const auto catalog_ver{client.targetCatalog()->version()};
+      if (targets_meta_ver != -1 && catalog_ver != targets_meta_ver) {
+        polling.setRollout();
+      }
+      targets_meta_ver = catalog_ver;
 
       if (!find_target_res.first) {
         // TODO: consider reporting about it to the backend to make it easier to figure out
         // why specific devices are not picking up a new Target
         const auto log_msg{boost::str(boost::format("No Target found for the device; hw ID: %s; tags: %s") % hwid %
                                       boost::algorithm::join(client.tags, ","))};
-        LOG_WARNING << log_msg << "; going to sleep for " << interval << " seconds before starting a new update cycle";
         // The both cases, "an exception occurs" and "no exception, but Target is not found for a device"
         // are considered as a failure for the "check-for-update-post" callback.
         client.checkForUpdatesEndWithFailure(exc_msg.empty() ? log_msg : exc_msg);
-        std::this_thread::sleep_for(std::chrono::seconds(interval));
+        sleep_till_next_cycle(log_msg);
         continue;
       }
+      polling.setHint(std::chrono::seconds(Target::pollingHint(*find_target_res.second)));
 
       // Handle the case when Apps failed to start on boot just after an update
       bool rollback{false};
@@ -346,9 +389,8 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
                                         current.filename() % current.sha256Hash())};
 
           LOG_ERROR << log_msg;
-          LOG_ERROR << "Going to sleep for " << interval << " seconds before starting a new update cycle";
           client.checkForUpdatesEndWithFailure(log_msg);
-          std::this_thread::sleep_for(std::chrono::seconds(interval));
+          sleep_till_next_cycle("Failed to find Target to rollback to");
           continue;
         }
 
@@ -372,6 +414,16 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
         }
 
         client.checkForUpdatesEnd(target_to_install);
+        const bool is_prefetched{!!prefetched_target && prefetched_target->MatchTarget(target_to_install)};
+        if (is_prefetched) {
+          target_to_install.setCorrelationId(prefetched_target->correlation_id());
+        }
+        const auto step{
+            UpdateStep::next(download_windows, install_windows, std::time(nullptr), is_prefetched, rollback)};
+        if (step.action == UpdateStep::Action::kWaitForDownloadWindow) {
+          wait_for_download_window(step.time_to_open);
+          continue;
+        }
         // New Target is available, try to update a device with it.
         // But prior to performing the update, check if aklite haven't tried to fetch the target ostree before,
         // and it failed due to lack of space, and the space has not increased since that time.
@@ -388,7 +440,7 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
             target_to_install.setCorrelationId(state_when_download_failed.cor_id);
             client.notifyDownloadFinished(target_to_install, false, err_msg);
 
-            std::this_thread::sleep_for(std::chrono::seconds(interval));
+            sleep_till_next_cycle("");
             continue;
           }
         }
@@ -400,7 +452,31 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
         data::ResultCode::Numeric rc;
         DownloadResult dr;
         std::string cor_id;
-        std::tie(rc, dr, cor_id) = do_update(client, target_to_install, reason);
+        if (step.action == UpdateStep::Action::kDownloadInAdvance ||
+            step.action == UpdateStep::Action::kWaitForInstallWindow) {
+          const auto time_to_install{step.time_to_open};
+          rc = data::ResultCode::Numeric::kOk;
+          if (step.action == UpdateStep::Action::kDownloadInAdvance) {
+            LOG_INFO << "Downloading Target in advance of the install window: " << target_to_install.filename();
+            std::tie(rc, dr, cor_id) = do_download(client, target_to_install, reason);
+            prefetched_target = boost::none;
+            if (rc == data::ResultCode::Numeric::kOk) {
+              prefetched_target = target_to_install;
+            }
+          }
+          if (rc == data::ResultCode::Numeric::kOk) {
+            const uint64_t sleep_sec{std::min(interval, static_cast<uint64_t>(time_to_install.count()))};
+            LOG_INFO << "Target " << target_to_install.filename()
+                     << " is downloaded, the next install window opens in " << time_to_install.count()
+                     << " seconds; going to sleep for " << sleep_sec << " seconds before starting a new update cycle";
+            client.setAppsNotChecked();
+            std::this_thread::sleep_for(std::chrono::seconds(sleep_sec));
+            continue;
+          }
+        } else {
+          std::tie(rc, dr, cor_id) = do_update(client, target_to_install, reason, is_prefetched);
+          prefetched_target = boost::none;
+        }
         if (rc == data::ResultCode::Numeric::kOk) {
           current = target_to_install;
           LiteClient::update_request_headers(client.http_client, current, client.config.pacman);
@@ -434,6 +510,9 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
         data::ResultCode::Numeric rc{data::ResultCode::Numeric::kOk};
         if (!client.appsInSync(current)) {
           client.checkForUpdatesEnd(target_to_install);
+          if (wait_for_download_window(download_windows.timeToOpen(std::time(nullptr)))) {
+            continue;
+          }
           rc = do_app_sync(client);
           if (rc == data::ResultCode::Numeric::kOk) {
             LOG_INFO << "Device is up-to-date";
@@ -451,7 +530,7 @@ static int daemon_main(LiteClient& client, const bpo::variables_map& variables_m
     }
 
     client.setAppsNotChecked();
-    std::this_thread::sleep_for(std::chrono::seconds(interval));
+    sleep_till_next_cycle("");
 
   }  // while true
 
@@ -0,0 +1,274 @@
+#include "bundleindex.h"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include <boost/algorithm/string/join.hpp>
+
+#include "docker/docker.h"
+#include "docker/ocimanifest.h"
+#include "docker/restorableappengine.h"
+#include "logging/logging.h"
+#include "ostree/repo.h"
+#include "utilities/utils.h"
+
+namespace offline {
+
+const std::string BundleIndex::Filename{"bundle-index.json"};
+const int BundleIndex::Version{1};
+
+static int64_t getMtime(const boost::filesystem::path& path) {
+  struct stat st {};
+  if (::stat(path.c_str(), &st) != 0) {
+    return -1;
+  }
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+BundleIndex BundleIndex::load(const boost::filesystem::path& ostree_repo_dir,
+                              const boost::filesystem::path& apps_root) {
+  BundleIndex index;
+  index.ostree_repo_dir_ = ostree_repo_dir;
+  index.apps_root_ = apps_root;
+  index.fingerprint_ = getFingerprint(ostree_repo_dir, apps_root);
+
+  const auto index_file{apps_root / Filename};
+  if (boost::filesystem::exists(index_file)) {
+    try {
+      const auto index_json{Utils::parseJSONFile(index_file)};
+      if (index_json["fingerprint"] == index.fingerprint_ && index.fromJson(index_json)) {
+        LOG_INFO << "Using the bundle index: " << index_file;
+        return index;
+      }
+      LOG_INFO << "The bundle index is stale, rebuilding it: " << index_file;
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to read the bundle index, rebuilding it: " << exc.what();
+    }
+  }
+
+  index.scan(ostree_repo_dir, apps_root);
+  index.store();
+  return index;
+}
+
+void BundleIndex::verify(const boost::filesystem::path& tuf_dir) {
+  const auto content_fingerprint{getContentFingerprint(tuf_dir)};
+  std::vector<std::string> errors;
+  if (verification_["fingerprint"] == content_fingerprint && verification_["errors"].isArray()) {
+    LOG_INFO << "The bundle has been verified already";
+    for (const auto& err : verification_["errors"]) {
+      errors.emplace_back(err.asString());
+    }
+  } else {
+    LOG_INFO << "Verifying the bundle content...";
+    if (!boost::filesystem::is_directory(tuf_dir)) {
+      errors.emplace_back("missing TUF metadata dir " + tuf_dir.string());
+    } else {
+      for (const auto& entry : boost::filesystem::directory_iterator{tuf_dir}) {
+        if (entry.path().extension() != ".json" || !boost::filesystem::is_regular_file(entry.path())) {
+          continue;
+        }
+        try {
+          const auto meta{Utils::parseJSONFile(entry.path())};
+          if (!meta["signed"].isObject() || !meta["signatures"].isArray()) {
+            errors.emplace_back("invalid TUF metadata " + entry.path().filename().string());
+          }
+        } catch (const std::exception& exc) {
+          errors.emplace_back("invalid TUF metadata " + entry.path().filename().string() + ": " + exc.what());
+        }
+      }
+    }
+
+    const auto files{getVerifiedFiles(errors)};
+    const std::vector<std::pair<std::string, std::string>> file_list{files.begin(), files.end()};
+    std::atomic<std::size_t> next_file{0};
+    std::mutex errors_mutex;
+    const auto hash_files = [&]() {
+      for (auto ii = next_file++; ii < file_list.size(); ii = next_file++) {
+        const auto& file{file_list[ii]};
+        std::string err;
+        try {
+          const auto hash{Docker::RestorableAppEngine::getContentHash(file.first)};
+          if (hash != file.second) {
+            err = "hash mismatch of " + file.first + "; actual: " + hash + "; expected: " + file.second;
+          }
+        } catch (const std::exception& exc) {
+          err = exc.what();
+        }
+        if (!err.empty()) {
+          std::lock_guard<std::mutex> lock{errors_mutex};
+          errors.emplace_back(err);
+        }
+      }
+    };
+    const auto worker_numb{std::min<std::size_t>(std::max(std::thread::hardware_concurrency(), 1U),
+                                                 std::max<std::size_t>(files.size(), 1))};
+    LOG_INFO << "Hashing " << files.size() << " bundle files, up to " << worker_numb << " files concurrently";
+    std::vector<std::thread> workers;
+    for (std::size_t ii = 1; ii < worker_numb; ++ii) {
+      workers.emplace_back(hash_files);
+    }
+    hash_files();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    verification_ = Json::objectValue;
+    verification_["fingerprint"] = content_fingerprint;
+    verification_["errors"] = Json::arrayValue;
+    for (const auto& err : errors) {
+      verification_["errors"].append(err);
+    }
+    store();
+  }
+
+  if (!errors.empty()) {
+    throw std::runtime_error("Invalid offline update bundle: " + boost::algorithm::join(errors, "; "));
+  }
+  LOG_INFO << "The bundle content is valid";
+}
+
+void BundleIndex::store() const {
+  try {
+    Utils::writeFile(apps_root_ / Filename, toJson(), false);
+  } catch (const std::exception& exc) {
+    LOG_DEBUG << "Failed to store the bundle index, the bundle is read-only? " << exc.what();
+  }
+}
+
+Json::Value BundleIndex::getFingerprint(const boost::filesystem::path& ostree_repo_dir,
+                                        const boost::filesystem::path& apps_root) {
+  Json::Value fingerprint;
+  // the bundle dirs are keyed by their relative paths, so the index stays valid wherever the bundle is mounted
+  const auto add_dir = [&fingerprint](const boost::filesystem::path& dir, const std::string& key) {
+    const auto mtime{getMtime(dir)};
+    if (mtime != -1) {
+      fingerprint[key] = Json::Int64(mtime);
+    }
+  };
+
+  // a ref is added or updated by writing a file to its dir
+  add_dir(ostree_repo_dir / "refs" / "heads", "ostree/refs/heads");
+  add_dir(ostree_repo_dir / "refs" / "remotes", "ostree/refs/remotes");
+  const auto apps_dir{apps_root / "apps"};
+  add_dir(apps_dir, "apps");
+  if (boost::filesystem::is_directory(apps_dir)) {
+    for (const auto& app_dir_entry : boost::filesystem::directory_iterator{apps_dir}) {
+      add_dir(app_dir_entry.path(), "apps/" + app_dir_entry.path().filename().string());
+    }
+  }
+  return fingerprint;
+}
+
+Json::Value BundleIndex::getContentFingerprint(const boost::filesystem::path& tuf_dir) const {
+  // the metadata and blobs are added, replaced and removed as whole files, which updates their dir, the App and ostree
+  // ref dirs are covered by the index fingerprint
+  Json::Value fingerprint;
+  fingerprint["tuf"] = Json::Int64(getMtime(tuf_dir));
+  fingerprint["blobs"] = Json::Int64(getMtime(apps_root_ / "blobs" / "sha256"));
+  return fingerprint;
+}
+
+std::unordered_map<std::string, std::string> BundleIndex::getVerifiedFiles(std::vector<std::string>& errors) const {
+  std::unordered_map<std::string, std::string> files;
+  for (const auto& commit : ostree_commits_) {
+    // the commit object name is the hash of its content
+    files.emplace(
+        (ostree_repo_dir_ / "objects" / commit.first.substr(0, 2) / (commit.first.substr(2) + ".commit")).string(),
+        commit.first);
+  }
+
+  const auto blob_dir{apps_root_ / "blobs" / "sha256"};
+  auto& manifests{Docker::OciManifestCache::instance()};
+  for (const auto& app : apps_) {
+    try {
+      const auto uri{Docker::Uri::parseUri(app.first)};
+      const auto manifest_file{blob_dir / uri.digest.hash()};
+      files.emplace(manifest_file.string(), uri.digest.hash());
+      const Docker::Manifest manifest{Utils::parseJSONFile(manifest_file)};
+      const auto archive_hash{Docker::HashedDigest(manifest.archiveDigest()).hash()};
+      files.emplace((blob_dir / archive_hash).string(), archive_hash);
+
+      const auto images_dir{app.second / "images"};
+      if (!boost::filesystem::is_directory(images_dir)) {
+        continue;
+      }
+      for (const auto& entry : boost::filesystem::recursive_directory_iterator{images_dir}) {
+        if (entry.path().filename() != "index.json") {
+          continue;
+        }
+        const auto image_index{manifests.imageIndex(entry.path().parent_path())};
+        const auto& manifest_digest{image_index->manifest().digest};
+        files.emplace((blob_dir / manifest_digest.hash()).string(), manifest_digest.hash());
+        const auto image_manifest{manifests.imageManifest(blob_dir, manifest_digest)};
+        files.emplace((blob_dir / image_manifest->config.digest.hash()).string(), image_manifest->config.digest.hash());
+        for (const auto& layer : image_manifest->layers) {
+          files.emplace((blob_dir / layer.digest.hash()).string(), layer.digest.hash());
+        }
+      }
+    } catch (const std::exception& exc) {
+      errors.emplace_back("invalid App " + app.first + ": " + exc.what());
+    }
+  }
+  return files;
+}
+
+void BundleIndex::scan(const boost::filesystem::path& ostree_repo_dir, const boost::filesystem::path& apps_root) {
+  {  // parse ostree repo
+    OSTree::Repo ostree_repo{ostree_repo_dir.string()};
+    LOG_INFO << "Parsing a source ostree repo: " << ostree_repo_dir.string();
+    for (const auto& ref : ostree_repo.getRefs()) {
+      ostree_commits_.emplace(ref.second, ref.first);
+    }
+  }
+
+  const auto apps_dir{apps_root / "apps"};
+  if (!boost::filesystem::exists(apps_dir)) {
+    return;
+  }
+  for (auto const& app_dir_entry : boost::filesystem::directory_iterator{apps_dir}) {
+    for (auto const& app_ver_dir_entry : boost::filesystem::directory_iterator{app_dir_entry.path()}) {
+      const auto uri_file{app_ver_dir_entry.path() / "uri"};
+      const auto app_uri{Utils::readFile(uri_file.string())};
+      LOG_INFO << "Found app; uri: " << app_uri;
+      apps_.emplace(app_uri, app_ver_dir_entry.path());
+    }
+  }
+}
+
+Json::Value BundleIndex::toJson() const {
+  Json::Value json;
+  json["version"] = Version;
+  json["fingerprint"] = fingerprint_;
+  json["ostree_commits"] = Json::objectValue;
+  for (const auto& commit : ostree_commits_) {
+    json["ostree_commits"][commit.first] = commit.second;
+  }
+  json["apps"] = Json::objectValue;
+  for (const auto& app : apps_) {
+    json["apps"][app.first] = boost::filesystem::relative(app.second, apps_root_).string();
+  }
+  if (!verification_.isNull()) {
+    json["verification"] = verification_;
+  }
+  return json;
+}
+
+bool BundleIndex::fromJson(const Json::Value& json) {
+  if (json.get("version", 0).asInt() != Version || !json["ostree_commits"].isObject() || !json["apps"].isObject()) {
+    return false;
+  }
+  for (const auto& commit : json["ostree_commits"].getMemberNames()) {
+    ostree_commits_.emplace(commit, json["ostree_commits"][commit].asString());
+  }
+  for (const auto& app_uri : json["apps"].getMemberNames()) {
+    apps_.emplace(app_uri, apps_root_ / json["apps"][app_uri].asString());
+  }
+  verification_ = json["verification"];
+  return true;
+}
+
+}  // namespace offline
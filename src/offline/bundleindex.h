@@ -0,0 +1,69 @@
+#ifndef AKTUALIZR_LITE_OFFLINE_BUNDLE_INDEX_H_
+#define AKTUALIZR_LITE_OFFLINE_BUNDLE_INDEX_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <json/json.h>
+#include <boost/filesystem.hpp>
+
+namespace offline {
+
+/**
+ * @brief BundleIndex, the ostree commits and the App versions an offline update bundle consists of.
+ *
+ * The index is stored in the bundle App dir along with the modification times of the dirs it was built from, the
+ * ostree repo ref dirs, the `apps` dir and its App dirs. It is reused as long as they are the same, so the bundle is
+ * scanned just once, e.g. when it is built, and then matched against Targets by the hash lookups.
+ * The result of the bundle content verification is stored in the index too, along with the modification times of the
+ * TUF metadata and blob dirs.
+ */
+class BundleIndex {
+ public:
+  static const std::string Filename;
+  static const int Version;
+
+  // Loads the index of the bundle consisting of the given ostree repo and the App dir, i.e. the one the `apps` and
+  // `blobs` dirs are in. The bundle is scanned if there is no index or it is stale, and the new index is stored
+  // unless the bundle is read-only.
+  static BundleIndex load(const boost::filesystem::path& ostree_repo_dir, const boost::filesystem::path& apps_root);
+
+  bool hasOstreeCommit(const std::string& commit_hash) const { return ostree_commits_.count(commit_hash) > 0; }
+  bool hasApp(const std::string& app_uri) const { return apps_.count(app_uri) > 0; }
+  // ostree commit hashes mapped to their refs
+  const std::unordered_map<std::string, std::string>& ostreeCommits() const { return ostree_commits_; }
+  // App URIs mapped to their App version dirs in the bundle
+  const std::unordered_map<std::string, boost::filesystem::path>& apps() const { return apps_; }
+
+  // Verifies the bundle content before it is installed, the TUF metadata files must be signed JSON metadata, and the
+  // ostree commit objects, the App manifests and archives, and the image manifests, configs and layers must match
+  // their hashes. The files are hashed concurrently, by up to one thread per CPU core. Throws std::runtime_error
+  // listing the invalid items if the bundle is invalid.
+  void verify(const boost::filesystem::path& tuf_dir);
+
+ private:
+  BundleIndex() = default;
+
+  static Json::Value getFingerprint(const boost::filesystem::path& ostree_repo_dir,
+                                    const boost::filesystem::path& apps_root);
+  void scan(const boost::filesystem::path& ostree_repo_dir, const boost::filesystem::path& apps_root);
+  Json::Value getContentFingerprint(const boost::filesystem::path& tuf_dir) const;
+  // Collects the files to hash, mapped to their expected hashes, the invalid App metadata are added to `errors`
+  std::unordered_map<std::string, std::string> getVerifiedFiles(std::vector<std::string>& errors) const;
+  void store() const;
+  Json::Value toJson() const;
+  bool fromJson(const Json::Value& json);
+
+  boost::filesystem::path ostree_repo_dir_;
+  boost::filesystem::path apps_root_;
+  Json::Value fingerprint_;
+  // the content fingerprint and the errors found by the last verification
+  Json::Value verification_;
+  std::unordered_map<std::string, std::string> ostree_commits_;
+  std::unordered_map<std::string, boost::filesystem::path> apps_;
+};
+
+}  // namespace offline
+
+#endif  // AKTUALIZR_LITE_OFFLINE_BUNDLE_INDEX_H_
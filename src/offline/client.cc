@@ -1,14 +1,16 @@
 #include "client.h"
 
+#include <unordered_set>
+
 #include <boost/process.hpp>
 
 #include "aktualizr-lite/api.h"
 #include "appengine.h"
 #include "composeappmanager.h"
-#include "docker/composeinfo.h"
 #include "docker/docker.h"
+#include "docker/imagerepositories.h"
 #include "docker/restorableappengine.h"
-#include "ostree/repo.h"
+#include "offline/bundleindex.h"
 #include "storage/invstorage.h"
 #include "target.h"
 
@@ -18,7 +20,8 @@ namespace client {
 static std::unique_ptr<LiteClient> createOfflineClient(
     const Config& cfg_in, const UpdateSrc& src,
     std::shared_ptr<HttpInterface> docker_client_http_client =
-        Docker::DockerClient::DefaultHttpClientFactory("unix:///var/run/docker.sock"));
+        Docker::DockerClient::DefaultHttpClientFactory("unix:///var/run/docker.sock"),
+    std::shared_ptr<Docker::RestorableAppEngine>* app_engine_out = nullptr);
 static Uptane::Target getTarget(LiteClient& client, const std::string& target_name = "");
 static void registerApps(const Uptane::Target& target);
 
@@ -63,7 +66,7 @@ class OfflineRegistry : public BaseHttpClient {
     if (boost::starts_with(url, auth_endpoint_)) {
       return HttpResponse("{\"token\":\"token\"}", 200, CURLE_OK, "");
     }
-    return getAppItem(url);
+    return getAppItem(url, maxsize);
   }
 
   HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
@@ -76,18 +79,19 @@ class OfflineRegistry : public BaseHttpClient {
     const auto hash_pos{digest_pos + hash_prefix.size()};
     const auto hash{url.substr(hash_pos)};
 
-    char buf[1024 * 4];
-    std::ifstream blob_file{(blobs_dir_ / hash).string()};
-
-    std::streamsize read_byte_numb;
-    while ((read_byte_numb = blob_file.readsome(buf, sizeof(buf))) > 0) {
-      write_cb(buf, read_byte_numb, 1, userp);
+    std::vector<char> buf(ReadBufferSize);
+    std::ifstream blob_file{(blobs_dir_ / hash).string(), std::ios::binary};
+    while (blob_file.read(buf.data(), static_cast<std::streamsize>(buf.size())) || blob_file.gcount() > 0) {
+      const auto read_byte_numb{static_cast<std::size_t>(blob_file.gcount())};
+      if (write_cb(buf.data(), read_byte_numb, 1, userp) != read_byte_numb) {
+        return HttpResponse("Failed to store blob", 500, CURLE_WRITE_ERROR, "");
+      }
     }
     blob_file.close();
     return HttpResponse("", 200, CURLE_OK, "");
   }
 
-  HttpResponse getAppItem(const std::string& url) const {
+  HttpResponse getAppItem(const std::string& url, int64_t maxsize) const {
     const std::string hash_prefix{"sha256:"};
     const auto digest_pos{url.rfind(hash_prefix)};
     if (digest_pos == std::string::npos) {
@@ -95,6 +99,12 @@ class OfflineRegistry : public BaseHttpClient {
     }
     const auto hash_pos{digest_pos + hash_prefix.size()};
     const auto hash{url.substr(hash_pos)};
+    // the size limit is checked before the blob is read into memory
+    boost::system::error_code ec;
+    const auto size{boost::filesystem::file_size(blobs_dir_ / hash, ec)};
+    if (!ec && maxsize != HttpInterface::kNoLimit && size > static_cast<uintmax_t>(maxsize)) {
+      return HttpResponse("", 200, CURLE_FILESIZE_EXCEEDED, "Maximum file size exceeded");
+    }
     return HttpResponse(Utils::readFile(blobs_dir_ / hash), 200, CURLE_OK, "");
   }
 
@@ -103,6 +113,8 @@ class OfflineRegistry : public BaseHttpClient {
   const boost::filesystem::path& dir() const { return root_dir_; }
 
  private:
+  static const std::size_t ReadBufferSize{1024 * 1024};
+
   const boost::filesystem::path root_dir_;
   const std::string hostname_;
   const std::string auth_endpoint_{"https://" + hostname_ + "/token-auth"};
@@ -111,7 +123,8 @@ class OfflineRegistry : public BaseHttpClient {
 };
 
 static std::unique_ptr<LiteClient> createOfflineClient(const Config& cfg_in, const UpdateSrc& src,
-                                                       std::shared_ptr<HttpInterface> docker_client_http_client) {
+                                                       std::shared_ptr<HttpInterface> docker_client_http_client,
+                                                       std::shared_ptr<Docker::RestorableAppEngine>* app_engine_out) {
   Config cfg{cfg_in};  // make copy of the input config to avoid its modification by LiteClient
 
   // turn off reporting update events to DG
@@ -152,7 +165,7 @@ static std::unique_ptr<LiteClient> createOfflineClient(const Config& cfg_in, con
     docker_host = env.get("DOCKER_HOST");
   }
 
-  AppEngine::Ptr app_engine{std::make_shared<Docker::RestorableAppEngine>(
+  auto app_engine{std::make_shared<Docker::RestorableAppEngine>(
       pacman_cfg.reset_apps_root, pacman_cfg.apps_root, pacman_cfg.images_data_root, registry_client,
       std::make_shared<Docker::DockerClient>(docker_client_http_client), pacman_cfg.skopeo_bin.string(), docker_host,
       compose_cmd, Docker::RestorableAppEngine::GetDefStorageSpaceFunc(),
@@ -165,6 +178,20 @@ static std::unique_ptr<LiteClient> createOfflineClient(const Config& cfg_in, con
       false /* don't create containers on install because it makes dockerd check if pinned images
     present in its store what we should avoid until images are registered (hacked) in dockerd store
   */)};
+  // `skopeo` would copy each blob from the bundle, they are imported in bulk instead
+  app_engine->setBlobImportDir(offline_registry->blobsDir() / "sha256");
+  if (pacman_cfg.offline_in_place_install) {
+    // the bundle image layouts are used as they are, they are copied into the store after the install
+    app_engine->setInPlaceImageSrc([offline_registry](const Docker::Uri& app_uri, const Docker::Uri& image_uri) {
+      const auto app_dir{offline_registry->appsDir() / app_uri.app / app_uri.digest.hash()};
+      return Docker::RestorableAppEngine::ImageSrc{
+          app_dir / "images" / image_uri.registryHostname / image_uri.repo / image_uri.digest.hash(),
+          offline_registry->blobsDir() / "sha256"};
+    });
+  }
+  if (app_engine_out != nullptr) {
+    *app_engine_out = app_engine;
+  }
 
   return std::make_unique<LiteClient>(cfg, app_engine, nullptr, std::make_shared<MetaFetcher>(src.TufDir));
 }
@@ -180,34 +207,6 @@ static Uptane::Target getSpecificTarget(LiteClient& client, const std::string& t
   }
 }
 
-static void parseUpdateContent(const Uptane::HardwareIdentifier& hw_id,
-                               const boost::filesystem::path& src_ostree_repo_dir,
-                               const boost::filesystem::path& apps_dir, std::vector<std::string>& found_ostree_commits,
-                               std::vector<std::string>& found_apps) {
-  {  // parse ostree repo
-    OSTree::Repo ostree_repo{src_ostree_repo_dir.string()};
-    LOG_INFO << "Parsing a source ostree repo: " << src_ostree_repo_dir.string();
-    std::unordered_map<std::string, std::string> refs_map{ostree_repo.getRefs()};
-    for (const auto& ref : refs_map) {
-      found_ostree_commits.push_back(ref.second);
-    }
-  }
-  {
-    if (!boost::filesystem::exists(apps_dir)) {
-      return;
-    }
-    for (auto const& app_dir_entry : boost::filesystem::directory_iterator{apps_dir}) {
-      const auto app_name{app_dir_entry.path().filename().string()};
-      for (auto const& app_ver_dir_entry : boost::filesystem::directory_iterator{app_dir_entry.path()}) {
-        const auto uri_file{app_ver_dir_entry.path() / "uri"};
-        const auto app_uri{Utils::readFile(uri_file.string())};
-        LOG_INFO << "Found app; uri: " << app_uri;
-        found_apps.push_back(app_uri);
-      }
-    }
-  }
-}
-
 static Uptane::Target getTarget(LiteClient& client, const UpdateSrc& src) {
   if (!src.TargetName.empty()) {
     return getSpecificTarget(client, src.TargetName);
@@ -235,40 +234,36 @@ static Uptane::Target getTarget(LiteClient& client, const UpdateSrc& src) {
     available_targets.insert(target);
   }
 
-  // parse the update content
-  std::vector<std::string> found_ostree_commits;
-  std::vector<std::string> found_apps;
-  parseUpdateContent(client.primary_ecu.second, src.OstreeRepoDir, src.AppsDir / "apps", found_ostree_commits,
-                     found_apps);
+  // index the update content
+  const auto bundle_index{BundleIndex::load(src.OstreeRepoDir, src.AppsDir)};
 
   // find Target that matches the given update content, search starting from the most recent Target
   Uptane::Target found_target(Uptane::Target::Unknown());
   for (const auto& t : available_targets) {
     LOG_INFO << "Checking if update content matches the given target: " << t.filename();
-    if (found_ostree_commits.end() ==
-        std::find(found_ostree_commits.begin(), found_ostree_commits.end(), t.sha256Hash())) {
+    if (!bundle_index.hasOstreeCommit(t.sha256Hash())) {
       LOG_DEBUG << "No ostree commit found for Target: " << t.filename();
       continue;
     }
 
-    std::list<std::string> found_but_not_target_apps{found_apps.begin(), found_apps.end()};
+    std::unordered_set<std::string> found_target_apps;
     auto shortlisted_target_apps{Target::appsJson(t)};
 
     for (const auto& app : Target::Apps(t)) {
-      if (found_apps.end() == std::find(found_apps.begin(), found_apps.end(), app.uri)) {
+      if (!bundle_index.hasApp(app.uri)) {
         // It may happen because App was shortlisted during running the CI run that fetched Apps, so we `continue` with
         // the App matching We just need to make sure that all found/update Apps macthes subset of Target Apps
         LOG_DEBUG << "No App found for Target; Target: " << t.filename() << "; app: " << app.uri;
         shortlisted_target_apps.removeMember(app.name);
         continue;
       }
-      found_but_not_target_apps.remove(app.uri);
-      // We cannot exit this loop earlier even if `found_but_not_target_apps` becomes empty,
-      // which indicates that all found Apps are listed in Target, because
+      found_target_apps.emplace(app.uri);
+      // We cannot exit this loop earlier even if all found Apps are listed in Target, because
       // we need to shortlist ALL Target apps that are no found on the provided filesystem.
     }
 
-    if (found_but_not_target_apps.empty()) {
+    // all found Apps are listed in Target
+    if (found_target_apps.size() == bundle_index.apps().size()) {
       found_target = t;
       auto found_target_custom = found_target.custom_data();
       found_target_custom[Target::ComposeAppField] = shortlisted_target_apps;
@@ -282,14 +277,7 @@ static Uptane::Target getTarget(LiteClient& client, const UpdateSrc& src) {
 
 static void registerApps(const Uptane::Target& target, const boost::filesystem::path& apps_store_root,
                          const boost::filesystem::path& docker_root) {
-  const boost::filesystem::path repositories_file{docker_root / "/image/overlay2/repositories.json"};
-  Json::Value repositories;
-  if (boost::filesystem::exists(repositories_file)) {
-    repositories = Utils::parseJSONFile(repositories_file.string());
-  } else {
-    repositories = Utils::parseJSON("{\"Repositories\":{}}");
-  }
-
+  Docker::ImageRepositories repositories{docker_root};
   for (const auto& app : Target::Apps(target)) {
     const Docker::Uri app_uri{Docker::Uri::parseUri(app.uri)};
 
@@ -297,35 +285,20 @@ static void registerApps(const Uptane::Target& target, const boost::filesystem::
     if (!boost::filesystem::exists(app_dir)) {
       continue;
     }
-    const auto app_compose_file{app_dir / Docker::RestorableAppEngine::ComposeFile};
-    const Docker::ComposeInfo app_compose{app_compose_file.string()};
-
-    for (const Json::Value& service : app_compose.getServices()) {
-      const auto image_uri_str{app_compose.getImage(service)};
-      const auto image_uri{Docker::Uri::parseUri(image_uri_str, false)};
-
-      const auto image_index_path{app_dir / "images" / image_uri.registryHostname / image_uri.repo /
-                                  image_uri.digest.hash() / "index.json"};
-      const auto image_index{Utils::parseJSONFile(image_index_path.string())};
-
-      // parse an image index to find a path to an image manifest
-      const Docker::HashedDigest manifest_digest(image_index["manifests"][0]["digest"].asString());
-      const auto image_manifest_path{apps_store_root / "blobs/sha256" / manifest_digest.hash()};
-      const auto image_manifest{Utils::parseJSONFile(image_manifest_path)};
-      // parse an image manifest to get a digest of an image config
-      const Docker::HashedDigest config_digest(image_manifest["config"]["digest"].asString());
-      const auto image_repo{image_uri.registryHostname + "/" + image_uri.repo};
-
-      LOG_INFO << "Registering image: " << image_uri_str << " -> " << config_digest();
-      repositories["Repositories"][image_repo][image_uri_str] = config_digest();
-    }
+    repositories.addApp(app_dir, apps_store_root / "blobs/sha256");
+  }
+  if (!repositories.commit()) {
+    LOG_INFO << "All App images are registered in the docker store already";
   }
-  Utils::writeFile(repositories_file.string(), repositories);
 }
 
 PostInstallAction install(const Config& cfg_in, const UpdateSrc& src,
                           std::shared_ptr<HttpInterface> docker_client_http_client) {
-  auto client{createOfflineClient(cfg_in, src, docker_client_http_client)};
+  // a broken bundle is found before anything is touched, rather than in the middle of its installation
+  BundleIndex::load(src.OstreeRepoDir, src.AppsDir).verify(src.TufDir);
+
+  std::shared_ptr<Docker::RestorableAppEngine> app_engine;
+  auto client{createOfflineClient(cfg_in, src, docker_client_http_client, &app_engine)};
 
   const auto import{client->isRootMetaImportNeeded()};
   if (std::get<0>(import)) {
@@ -371,7 +344,7 @@ PostInstallAction install(const Config& cfg_in, const UpdateSrc& src,
   } else if (client->config.pacman.type == ComposeAppManager::Name) {
     // don't `install` since it will create/run containers and we don't want to do it
     // before we register images and restart dockerd
-    client->storage->savePrimaryInstalledVersion(target, InstalledVersionUpdateMode::kPending);
+    client->saveInstalledVersion(target, InstalledVersionUpdateMode::kPending);
     post_install_action = PostInstallAction::NeedDockerRestart;
   } else {
     post_install_action = PostInstallAction::AlreadyInstalled;
@@ -379,6 +352,17 @@ PostInstallAction install(const Config& cfg_in, const UpdateSrc& src,
 
   if (client->config.pacman.type == ComposeAppManager::Name) {
     const auto pacman_cfg{ComposeAppManager::Config(cfg_in.pacman)};
+    if (pacman_cfg.offline_in_place_install && app_engine) {
+      // `run` installs Apps from the store after reboot, when the bundle might not be available anymore
+      AppEngine::Apps apps;
+      for (const auto& app : Target::Apps(target)) {
+        apps.push_back({app.name, app.uri});
+      }
+      const auto copy_res{app_engine->fetchDeferredImages(apps)};
+      if (!copy_res) {
+        throw std::runtime_error("Failed to copy App images into the store; err: " + copy_res.err);
+      }
+    }
     registerApps(target, pacman_cfg.reset_apps_root, pacman_cfg.images_data_root);
   }
 
@@ -1,5 +1,10 @@
 #include "repo.h"
 
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <stdexcept>
@@ -10,7 +15,10 @@
 
 namespace OSTree {
 
-Repo::Repo(std::string path, bool create) : path_{std::move(path)}, repo_{nullptr} { init(create); }
+Repo::Repo(std::string path, bool create, OstreeRepoMode mode)
+    : path_{std::move(path)}, mode_{mode}, repo_{nullptr} {
+  init(create);
+}
 
 Repo::~Repo() {
   // NOLINTNEXTLINE (bugprone-sizeof-expression)
@@ -18,7 +26,6 @@ Repo::~Repo() {
 }
 
 void Repo::init(bool create) {
-  OstreeRepoMode mode = OSTREE_REPO_MODE_BARE;
   g_autoptr(GFile) path = nullptr;
   g_autoptr(OstreeRepo) repo = nullptr;
   g_autoptr(GError) error = nullptr;
@@ -30,7 +37,7 @@ void Repo::init(bool create) {
   if (create) {
     // initialize OstreeRepo instance from a specified repo on a file system if it exists, if not it
     // create a repo file structure and initialize OstreeRepo instance
-    if (0 == ostree_repo_create(repo, mode, nullptr, &error)) {
+    if (0 == ostree_repo_create(repo, mode_, nullptr, &error)) {
       throw std::runtime_error("Failed to create or init an ostree repo at `" + path_ + "`: " + error->message);
     }
   } else {
@@ -44,7 +51,7 @@ void Repo::init(bool create) {
 }
 
 void Repo::addRemote(const std::string& name, const std::string& url, const std::string& ca, const std::string& cert,
-                     const std::string& key) {
+                     const std::string& key, const std::string& content_url) {
   g_autoptr(GError) error = nullptr;
   GVariantBuilder var_builder;
   g_autoptr(GVariant) remote_options = nullptr;
@@ -61,6 +68,10 @@ void Repo::addRemote(const std::string& name, const std::string& url, const std:
       g_variant_builder_add(&var_builder, "{s@v}", "tls-client-key-path",
                             g_variant_new_variant(g_variant_new_string(key.c_str())));
     }
+    if (!content_url.empty()) {
+      g_variant_builder_add(&var_builder, "{s@v}", "contenturl",
+                            g_variant_new_variant(g_variant_new_string(content_url.c_str())));
+    }
   }
 
   remote_options = g_variant_builder_end(&var_builder);
@@ -107,6 +118,101 @@ void Repo::pull(const std::string& remote_name, const std::string& branch, const
   }
 }
 
+GVariant* Repo::getDeltaPullOptions(const std::string& commit_hash, const Headers& headers, bool dry_run) const {
+  std::array<char*, 2> commit_id{const_cast<char*>(commit_hash.c_str()), nullptr};
+  GVariantBuilder builder;
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+  // the delta is looked up by the commit hash in the delta index or the summary of the remote
+  g_variant_builder_add(
+      &builder, "{s@v}", "refs",
+      g_variant_new_variant(g_variant_new_strv(reinterpret_cast<const char* const*>(&commit_id), -1)));
+  g_variant_builder_add(&builder, "{s@v}", "require-static-deltas", g_variant_new_variant(g_variant_new_boolean(TRUE)));
+  g_variant_builder_add(&builder, "{s@v}", "dry-run", g_variant_new_variant(g_variant_new_boolean(dry_run)));
+
+  if (!headers.empty()) {
+    GVariantBuilder headers_builder;
+    g_variant_builder_init(&headers_builder, G_VARIANT_TYPE("a(ss)"));
+    for (const auto& header : headers) {
+      g_variant_builder_add(&headers_builder, "(ss)", header.first.c_str(), header.second.c_str());
+    }
+    g_variant_builder_add(&builder, "{s@v}", "http-headers",
+                          g_variant_new_variant(g_variant_builder_end(&headers_builder)));
+  }
+  return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+Repo::DeltaStat Repo::getDeltaStat(const std::string& remote_name, const std::string& commit_hash,
+                                   const Headers& headers) {
+  g_autoptr(OstreeAsyncProgress) progress = ostree_async_progress_new();
+  g_autoptr(GVariant) pull_options = getDeltaPullOptions(commit_hash, headers, true);
+  g_autoptr(GError) error = nullptr;
+
+  if (0 == ostree_repo_pull_with_options(repo_, remote_name.c_str(), pull_options, progress, nullptr, &error)) {
+    throw std::runtime_error("Failed to fetch static delta superblock of " + commit_hash + ": " + error->message);
+  }
+
+  guint superblocks{0};
+  guint64 size{0};
+  guint64 usize{0};
+  ostree_async_progress_get(progress, "total-delta-superblocks", "u", &superblocks, "total-delta-part-size", "t", &size,
+                            "total-delta-part-usize", "t", &usize, nullptr);
+  if (superblocks == 0) {
+    throw std::runtime_error("No static delta found for " + commit_hash);
+  }
+  return {size, usize};
+}
+
+static void onDeltaProgress(OstreeAsyncProgress* progress, gpointer user_data) {
+  const auto* const progress_cb = reinterpret_cast<const Repo::DeltaProgressCb*>(user_data);
+  guint64 fetched{0};
+  ostree_async_progress_get(progress, "fetched-delta-part-size", "t", &fetched, nullptr);
+  (*progress_cb)(fetched);
+}
+
+void Repo::pullDelta(const std::string& remote_name, const std::string& commit_hash, const Headers& headers,
+                     const DeltaProgressCb& progress_cb) {
+  g_autoptr(OstreeAsyncProgress) progress =
+      progress_cb ? ostree_async_progress_new_and_connect(onDeltaProgress, const_cast<DeltaProgressCb*>(&progress_cb))
+                  : ostree_async_progress_new();
+  g_autoptr(GVariant) pull_options = getDeltaPullOptions(commit_hash, headers, false);
+  g_autoptr(GError) error = nullptr;
+
+  const gboolean pull_result{
+      ostree_repo_pull_with_options(repo_, remote_name.c_str(), pull_options, progress, nullptr, &error)};
+  ostree_async_progress_finish(progress);
+  if (0 == pull_result) {
+    throw std::runtime_error("Failed to pull static delta of " + commit_hash + ": " + error->message);
+  }
+}
+
+bool Repo::hasCommit(const std::string& commit_hash) const {
+  g_autoptr(GVariant) commit = nullptr;
+  OstreeRepoCommitState state{};
+  g_autoptr(GError) error = nullptr;
+  if (0 == ostree_repo_load_commit(repo_, commit_hash.c_str(), &commit, &state, &error)) {
+    return false;
+  }
+  // a commit is partial till its pull completes
+  return (state & OSTREE_REPO_COMMIT_STATE_PARTIAL) == 0;
+}
+
+uint64_t Repo::getFreeSpace() const {
+  struct statvfs stat_buf {};
+  if (0 != statvfs(path_.c_str(), &stat_buf)) {
+    throw std::runtime_error("Failed to get free space of an ostree repo at `" + path_ + "`: " + std::strerror(errno));
+  }
+  const uint64_t free_space{static_cast<uint64_t>(stat_buf.f_bavail) * stat_buf.f_frsize};
+
+  // ostree refuses to write objects if a pull would eat into the min-free-space-size/percent reserve
+  guint64 reserved{0};
+  g_autoptr(GError) error = nullptr;
+  if (0 == ostree_repo_get_min_free_space_bytes(repo_, &reserved, &error)) {
+    throw std::runtime_error("Failed to get min free space of an ostree repo at `" + path_ + "`: " + error->message);
+  }
+  return free_space > reserved ? free_space - reserved : 0;
+}
+
 void Repo::checkout(const std::string& commit_hash, const std::string& src_dir, const std::string& dst_dir) {
   const char* const OSTREE_GIO_FAST_QUERYINFO =
       "standard::name,standard::type,standard::size,standard::is-symlink,standard::symlink-target,unix::device,unix::"
@@ -146,6 +252,63 @@ void Repo::checkout(const std::string& commit_hash, const std::string& src_dir,
   }
 }
 
+void Repo::checkoutHardlinks(const std::string& commit_hash, const std::string& dst_dir) {
+  OstreeRepoCheckoutAtOptions options{};
+  options.mode = OSTREE_REPO_CHECKOUT_MODE_USER;
+  options.overwrite_mode = OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES;
+  // fail rather than silently duplicate the content if the destination is not on the repo file system
+  options.no_copy_fallback = TRUE;
+  g_autoptr(GError) error = nullptr;
+
+  if (0 == ostree_repo_checkout_at(repo_, &options, AT_FDCWD, dst_dir.c_str(), commit_hash.c_str(), nullptr, &error)) {
+    throw std::runtime_error("Failed to checkout " + commit_hash + " to " + dst_dir + ": " + error->message);
+  }
+}
+
+std::string Repo::commit(const std::string& src_dir, const std::string& branch) {
+  g_autoptr(GFile) src = g_file_new_for_path(src_dir.c_str());
+  g_autoptr(OstreeMutableTree) mtree = ostree_mutable_tree_new();
+  g_autoptr(GFile) root = nullptr;
+  g_autofree char* commit_hash = nullptr;
+  g_autoptr(GError) error = nullptr;
+
+  if (0 == ostree_repo_prepare_transaction(repo_, nullptr, nullptr, &error)) {
+    throw std::runtime_error("Failed to start a transaction in " + path_ + ": " + error->message);
+  }
+  if (0 == ostree_repo_write_directory_to_mtree(repo_, src, mtree, nullptr, nullptr, &error) ||
+      0 == ostree_repo_write_mtree(repo_, mtree, &root, nullptr, &error) ||
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-cstyle-cast)
+      0 == ostree_repo_write_commit(repo_, nullptr, branch.c_str(), nullptr, nullptr, OSTREE_REPO_FILE(root),
+                                    &commit_hash, nullptr, &error)) {
+    const std::string err_msg{error->message};
+    ostree_repo_abort_transaction(repo_, nullptr, nullptr);
+    throw std::runtime_error("Failed to commit " + src_dir + " to " + path_ + ": " + err_msg);
+  }
+  ostree_repo_transaction_set_ref(repo_, nullptr, branch.c_str(), commit_hash);
+  if (0 == ostree_repo_commit_transaction(repo_, nullptr, nullptr, &error)) {
+    throw std::runtime_error("Failed to commit a transaction in " + path_ + ": " + error->message);
+  }
+  return commit_hash;
+}
+
+void Repo::removeRef(const std::string& branch) {
+  g_autoptr(GError) error = nullptr;
+  if (0 == ostree_repo_set_ref_immediate(repo_, nullptr, branch.c_str(), nullptr, nullptr, &error)) {
+    throw std::runtime_error("Failed to remove ref " + branch + " from " + path_ + ": " + error->message);
+  }
+}
+
+void Repo::prune() {
+  gint objects_total{0};
+  gint objects_pruned{0};
+  guint64 pruned_size{0};
+  g_autoptr(GError) error = nullptr;
+  if (0 == ostree_repo_prune(repo_, OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY, -1, &objects_total, &objects_pruned,
+                             &pruned_size, nullptr, &error)) {
+    throw std::runtime_error("Failed to prune " + path_ + ": " + error->message);
+  }
+}
+
 static void addRefInfo(gpointer key, gpointer value, gpointer user_data) {
   auto* const refs = reinterpret_cast<std::unordered_map<std::string, std::string>*>(user_data);
   refs->emplace(
@@ -166,4 +329,31 @@ std::unordered_map<std::string, std::string> Repo::getRefs() const {
   return found_refs;
 }
 
+void Repo::exportArchiveFile(const std::string& checksum,
+                             const std::function<bool(const char*, std::size_t)>& sink) const {
+  g_autoptr(GInputStream) input = nullptr;
+  g_autoptr(GFileInfo) file_info = nullptr;
+  g_autoptr(GVariant) xattrs = nullptr;
+  g_autoptr(GInputStream) archive_input = nullptr;
+  g_autoptr(GError) error = nullptr;
+
+  if (0 == ostree_repo_load_file(repo_, checksum.c_str(), &input, &file_info, &xattrs, nullptr, &error)) {
+    throw std::runtime_error("Failed to load file object " + checksum + ": " + error->message);
+  }
+  if (0 == ostree_raw_file_to_archive_z2_stream(input, file_info, xattrs, &archive_input, nullptr, &error)) {
+    throw std::runtime_error("Failed to compress file object " + checksum + ": " + error->message);
+  }
+
+  std::array<char, 64 * 1024> buf{};
+  gssize read_size;
+  while ((read_size = g_input_stream_read(archive_input, buf.data(), buf.size(), nullptr, &error)) > 0) {
+    if (!sink(buf.data(), static_cast<std::size_t>(read_size))) {
+      return;
+    }
+  }
+  if (read_size < 0) {
+    throw std::runtime_error("Failed to read file object " + checksum + ": " + error->message);
+  }
+}
+
 }  // namespace OSTree
@@ -1,6 +1,8 @@
 #ifndef AKTUALIZR_LITE_REPO_H
 #define AKTUALIZR_LITE_REPO_H
 
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -11,7 +13,19 @@ namespace OSTree {
 
 class Repo {
  public:
-  explicit Repo(std::string path, bool create = false);
+  using Headers = std::unordered_map<std::string, std::string>;
+  // Receives the number of the delta bytes fetched so far
+  using DeltaProgressCb = std::function<void(uint64_t)>;
+
+  // The size of a static delta as stated by its superblock
+  struct DeltaStat {
+    // the size of the delta parts to download
+    uint64_t size;
+    // the size of the delta parts once uncompressed, i.e. the space required to apply the delta
+    uint64_t usize;
+  };
+
+  explicit Repo(std::string path, bool create = false, OstreeRepoMode mode = OSTREE_REPO_MODE_BARE);
   ~Repo();
 
   Repo(const Repo&) = delete;
@@ -19,17 +33,43 @@ class Repo {
   Repo& operator=(const Repo&) = delete;
   Repo& operator=(Repo&&) = delete;
 
+  // If `content_url` is set then the objects and deltas are fetched from it, and the rest from `url`,
+  // e.g. `mirrorlist=file:///<path>` makes ostree try the mirrors listed in a file one by one
   void addRemote(const std::string& name, const std::string& url, const std::string& ca, const std::string& cert,
-                 const std::string& key);
+                 const std::string& key, const std::string& content_url = "");
 
   void pull(const std::string& remote_name, const std::string& branch, const std::string& commit_hash);
+  // Fetches just the superblock of the static delta leading to the given commit, i.e. makes a dry-run pull.
+  // Throws std::runtime_error if the remote has no such delta.
+  DeltaStat getDeltaStat(const std::string& remote_name, const std::string& commit_hash, const Headers& headers);
+  // Pulls the given commit by means of a static delta, throws std::runtime_error if it fails or there is no delta
+  void pullDelta(const std::string& remote_name, const std::string& commit_hash, const Headers& headers,
+                 const DeltaProgressCb& progress_cb = nullptr);
+  // Whether the given commit and all the objects it refers to are present in the repo
+  bool hasCommit(const std::string& commit_hash) const;
+  // The space available to pulls, i.e. the free space of the repo file system minus its min-free-space reserve
+  uint64_t getFreeSpace() const;
   void checkout(const std::string& commit_hash, const std::string& src_dir, const std::string& dst_dir);
+  // Checks out the given commit by hardlinking the repo files, throws std::runtime_error instead of falling back to
+  // copying if a file cannot be hardlinked, e.g. `dst_dir` is on another file system than the repo. The repo must be
+  // in the bare-user-only mode, and the checked out files must never be modified in place.
+  void checkoutHardlinks(const std::string& commit_hash, const std::string& dst_dir);
+  // Commits the content of the given dir and sets the given branch to the commit, returns the commit hash
+  std::string commit(const std::string& src_dir, const std::string& branch);
+  void removeRef(const std::string& branch);
+  // Removes the objects not reachable from any of the refs
+  void prune();
   std::unordered_map<std::string, std::string> getRefs() const;
+  // Streams the given file object as it is stored in an archive repo, i.e. the header and the compressed content, to
+  // the sink until it returns false. Throws std::runtime_error if there is no such object.
+  void exportArchiveFile(const std::string& checksum, const std::function<bool(const char*, std::size_t)>& sink) const;
 
  private:
   void init(bool create);
+  GVariant* getDeltaPullOptions(const std::string& commit_hash, const Headers& headers, bool dry_run) const;
 
   const std::string path_;
+  const OstreeRepoMode mode_;
   OstreeRepo* repo_;
 };
 
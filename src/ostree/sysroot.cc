@@ -33,11 +33,9 @@ std::string Sysroot::getDeploymentHash(Deployment deployment_type) const {
     case BootedType::kStaged:
       if (deployment_type == Deployment::kPending) {
         OstreeDeployment* cur_deployment = getDeploymentIfStaged(sysroot_.get(), os_name_.c_str(), deployment_type);
-        // Load the sysroot to make sure we get its latest state, so we can get real "pending" deployment caused by
-        // successful installation
-        GObjectUniquePtr<OstreeSysroot> changed_sysroot = OstreeManager::LoadSysroot(path_);
+        // Get the latest sysroot state, so we can get real "pending" deployment caused by successful installation
         OstreeDeployment* pend_deployment =
-            getDeploymentIfStaged(changed_sysroot.get(), os_name_.c_str(), deployment_type);
+            getDeploymentIfStaged(getLatestSysroot(), os_name_.c_str(), deployment_type);
         deployment =
             (strcmp(ostree_deployment_get_csum(pend_deployment), ostree_deployment_get_csum(cur_deployment)) == 0)
                 ? nullptr
@@ -56,6 +54,21 @@ std::string Sysroot::getDeploymentHash(Deployment deployment_type) const {
   return deployment_hash;
 }
 
+OstreeSysroot* Sysroot::getLatestSysroot() const {
+  std::lock_guard<std::mutex> lock{latest_sysroot_mutex_};
+  if (!latest_sysroot_) {
+    latest_sysroot_ = OstreeManager::LoadSysroot(path_);
+    return latest_sysroot_.get();
+  }
+  // just stats the deployment dir, its mtime is bumped each time the deployments are written
+  g_autoptr(GError) error = nullptr;
+  if (0 == ostree_sysroot_load_if_changed(latest_sysroot_.get(), nullptr, nullptr, &error)) {
+    LOG_WARNING << "Failed to check whether the sysroot has changed, reloading it: " << error->message;
+    latest_sysroot_ = OstreeManager::LoadSysroot(path_);
+  }
+  return latest_sysroot_.get();
+}
+
 OstreeDeployment* Sysroot::getDeploymentIfBooted(OstreeSysroot* sysroot, const char* os_name,
                                                  Deployment deployment_type) {
   OstreeDeployment* deployment{nullptr};
@@ -2,6 +2,7 @@
 #define AKTUALIZR_LITE_OSTREE_H_
 
 #include <ostree.h>
+#include <mutex>
 #include <string>
 
 #include "package_manager/ostreemanager.h"
@@ -26,6 +27,8 @@ class Sysroot {
                                                  Deployment deployment_type);
   static OstreeDeployment* getDeploymentIfStaged(OstreeSysroot* sysroot, const char* os_name,
                                                  Deployment deployment_type);
+  // The up-to-date sysroot state, it is loaded once and then reloaded only if its deployments have changed
+  OstreeSysroot* getLatestSysroot() const;
 
   const std::string path_;
   const BootedType booted_;
@@ -33,6 +36,9 @@ class Sysroot {
   const std::string deployment_path_;
 
   GObjectUniquePtr<OstreeSysroot> sysroot_;
+  // kStaged: the state the "pending" deployment is looked up in, `sysroot_` keeps the state as of the agent start
+  mutable std::mutex latest_sysroot_mutex_;
+  mutable GObjectUniquePtr<OstreeSysroot> latest_sysroot_;
 };
 
 }  // namespace OSTree
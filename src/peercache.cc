@@ -0,0 +1,395 @@
+#include "peercache.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/format.hpp>
+
+#include "crypto/crypto.h"
+#include "http/httpclient.h"
+#include "logging/logging.h"
+#include "ostree/repo.h"
+
+const uint16_t PeerCache::DefPort;
+const int PeerCache::AnnounceIntervalSec;
+const int PeerCache::PeerTtlSec;
+const int PeerCache::IoTimeoutSec;
+const std::size_t PeerCache::ServerWorkers;
+const std::string PeerCache::AnnounceMagic{"aklite-peer-cache/1"};
+const std::string PeerCache::PartFileExt{".peer"};
+
+namespace {
+
+const std::size_t MaxRequestSize{8192};
+const int PollIntervalMs{1000};
+
+bool isHex(const std::string& str, std::size_t len) {
+  return str.size() == len &&
+         std::all_of(str.begin(), str.end(), [](char chr) { return std::isdigit(chr) || (chr >= 'a' && chr <= 'f'); });
+}
+
+bool sendAll(int fd, const char* data, std::size_t size) {
+  while (size > 0) {
+    const auto sent{::send(fd, data, size, MSG_NOSIGNAL)};
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= static_cast<std::size_t>(sent);
+  }
+  return true;
+}
+
+bool sendHeader(int fd, const std::string& status, int64_t content_length = -1) {
+  std::string header{"HTTP/1.1 " + status + "\r\nConnection: close\r\n"};
+  if (content_length >= 0) {
+    header += "Content-Length: " + std::to_string(content_length) + "\r\n";
+  }
+  header += "\r\n";
+  return sendAll(fd, header.data(), header.size());
+}
+
+void setSocketTimeouts(int fd, int timeout_sec) {
+  struct timeval timeout {};
+  timeout.tv_sec = timeout_sec;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+std::string genInstanceId() {
+  std::random_device rand;
+  return boost::str(boost::format("%08x%08x") % rand() % rand());
+}
+
+struct BlobDownloadCtx {
+  std::ofstream file;
+  MultiPartSHA256Hasher hasher;
+  uint64_t expected_size;
+  uint64_t received_size{0};
+  const PeerCache::ProgressCb* progress_cb;
+};
+
+size_t onBlobData(char* data, size_t buf_size, size_t buf_numb, void* user_ctx) {
+  auto* ctx = reinterpret_cast<BlobDownloadCtx*>(user_ctx);
+  const auto size{buf_size * buf_numb};
+  // a peer must not make the device store more than the Target states, the transfer is aborted then
+  if (ctx->received_size + size > ctx->expected_size) {
+    return 0;
+  }
+  ctx->file.write(data, static_cast<std::streamsize>(size));
+  if (!ctx->file) {
+    return 0;
+  }
+  ctx->hasher.update(reinterpret_cast<const unsigned char*>(data), size);
+  ctx->received_size += size;
+  if (*ctx->progress_cb) {
+    (*ctx->progress_cb)(ctx->received_size);
+  }
+  return size;
+}
+
+}  // namespace
+
+PeerCache::PeerCache(Config cfg) : cfg_{std::move(cfg)}, instance_id_{genInstanceId()} {
+  server_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (server_fd_ == -1) {
+    throw std::runtime_error(std::string("Failed to create the peer cache server socket: ") + std::strerror(errno));
+  }
+  const int enable{1};
+  setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  struct sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(cfg_.port);
+  if (::bind(server_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(server_fd_, 16) != 0) {
+    const std::string err{std::strerror(errno)};
+    ::close(server_fd_);
+    throw std::runtime_error("Failed to listen on the peer cache port " + std::to_string(cfg_.port) + ": " + err);
+  }
+  socklen_t addr_len{sizeof(addr)};
+  if (::getsockname(server_fd_, reinterpret_cast<struct sockaddr*>(&addr), &addr_len) != 0) {
+    const std::string err{std::strerror(errno)};
+    ::close(server_fd_);
+    throw std::runtime_error("Failed to get the peer cache server address: " + err);
+  }
+  port_ = ntohs(addr.sin_port);
+  for (std::size_t ii = 0; ii < ServerWorkers; ++ii) {
+    workers_.emplace_back(&PeerCache::serve, this);
+  }
+
+  if (cfg_.discovery) {
+    discovery_fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (discovery_fd_ == -1 || setsockopt(discovery_fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) != 0 ||
+        setsockopt(discovery_fd_, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable)) != 0 ||
+        ::bind(discovery_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+      // the static peers are still used, and the peers can still get the content of this device
+      LOG_WARNING << "Failed to set up the peer cache discovery, only the configured peers are used: "
+                  << std::strerror(errno);
+    } else {
+      workers_.emplace_back(&PeerCache::discover, this);
+    }
+  }
+  LOG_INFO << "Peer cache is serving on port " << port_ << (discovery_fd_ != -1 ? ", discovery is on" : "");
+}
+
+PeerCache::~PeerCache() {
+  stop_ = true;
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  ::close(server_fd_);
+  if (discovery_fd_ != -1) {
+    ::close(discovery_fd_);
+  }
+}
+
+void PeerCache::serveBlobs(boost::filesystem::path blob_dir) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  blob_dir_ = std::move(blob_dir);
+}
+
+std::vector<std::string> PeerCache::peers() const {
+  std::vector<std::string> res{cfg_.peers};
+  const auto now{std::chrono::steady_clock::now()};
+  std::lock_guard<std::mutex> lock{mutex_};
+  for (const auto& peer : discovered_peers_) {
+    if (now - peer.second < std::chrono::seconds(PeerTtlSec) &&
+        std::find(res.begin(), res.end(), peer.first) == res.end()) {
+      res.emplace_back(peer.first);
+    }
+  }
+  return res;
+}
+
+std::vector<std::string> PeerCache::ostreeMirrors() const {
+  std::vector<std::string> res;
+  for (const auto& peer : peers()) {
+    res.emplace_back("http://" + peer + "/ostree");
+  }
+  return res;
+}
+
+bool PeerCache::fetchBlob(const std::string& hash, uint64_t size, const boost::filesystem::path& dst,
+                          const ProgressCb& progress_cb) const {
+  const boost::filesystem::path part_path{dst.string() + PartFileExt};
+  for (const auto& peer : peers()) {
+    const std::string url{"http://" + peer + "/blobs/sha256/" + hash};
+    BlobDownloadCtx ctx{std::ofstream{part_path.string(), std::ios::binary | std::ios::trunc},
+                        MultiPartSHA256Hasher{}, size, 0, &progress_cb};
+    if (!ctx.file) {
+      LOG_WARNING << "Failed to create a file for a blob fetched from peers: " << part_path;
+      return false;
+    }
+    HttpClient http_client;
+    const auto resp{http_client.download(url, onBlobData, nullptr, &ctx, 0)};
+    ctx.file.close();
+
+    if (!resp.isOk()) {
+      LOG_DEBUG << "Failed to fetch blob " << hash << " from peer " << peer << ": " << resp.getStatusStr();
+    } else if (ctx.received_size != size) {
+      LOG_WARNING << "Peer " << peer << " sent " << ctx.received_size << " bytes of blob " << hash << " instead of "
+                  << size;
+    } else if (boost::algorithm::to_lower_copy(ctx.hasher.getHexDigest()) != hash) {
+      LOG_WARNING << "Peer " << peer << " sent blob " << hash << " of a different hash";
+    } else {
+      boost::filesystem::rename(part_path, dst);
+      LOG_DEBUG << "Fetched blob " << hash << " from peer " << peer;
+      return true;
+    }
+  }
+  boost::system::error_code ec;
+  boost::filesystem::remove(part_path, ec);
+  return false;
+}
+
+void PeerCache::serve() {
+  while (!stop_) {
+    struct pollfd pfd {
+      server_fd_, POLLIN, 0
+    };
+    if (::poll(&pfd, 1, PollIntervalMs) <= 0) {
+      continue;
+    }
+    // another worker may have accepted the connection, the server socket is non-blocking
+    const int fd{::accept4(server_fd_, nullptr, nullptr, SOCK_CLOEXEC)};
+    if (fd == -1) {
+      continue;
+    }
+    setSocketTimeouts(fd, IoTimeoutSec);
+    try {
+      serveRequest(fd);
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to serve a peer cache request: " << exc.what();
+    }
+    ::close(fd);
+  }
+}
+
+void PeerCache::serveRequest(int fd) const {
+  std::string request;
+  std::array<char, 1024> buf{};
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < MaxRequestSize) {
+    const auto received{::recv(fd, buf.data(), buf.size(), 0)};
+    if (received <= 0) {
+      return;
+    }
+    request.append(buf.data(), static_cast<std::size_t>(received));
+  }
+
+  // GET <path> HTTP/1.1
+  std::vector<std::string> request_line;
+  boost::split(request_line, request.substr(0, request.find("\r\n")), boost::is_any_of(" "));
+  if (request_line.size() != 3 || request_line[0] != "GET") {
+    sendHeader(fd, "405 Method Not Allowed", 0);
+    return;
+  }
+  const auto path{request_line[1].substr(0, request_line[1].find('?'))};
+  std::vector<std::string> elements;
+  boost::split(elements, path, boost::is_any_of("/"));
+
+  // the paths are never mapped to the file system as they are, just the hashes taken from them are
+  if (elements.size() == 4 && elements[1] == "blobs" && elements[2] == "sha256" && isHex(elements[3], 64)) {
+    boost::filesystem::path blob_dir;
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      blob_dir = blob_dir_;
+    }
+    if (!blob_dir.empty()) {
+      serveFile(fd, blob_dir / elements[3]);
+      return;
+    }
+  } else if (elements.size() == 5 && elements[1] == "ostree" && elements[2] == "objects" && isHex(elements[3], 2) &&
+             !cfg_.ostree_repo.empty()) {
+    const auto ext_pos{elements[4].find('.')};
+    const auto hash{elements[4].substr(0, ext_pos)};
+    const auto ext{ext_pos == std::string::npos ? "" : elements[4].substr(ext_pos + 1)};
+    if (isHex(hash, 62)) {
+      // the metadata objects are stored the same way in all repo modes, unlike the file objects
+      if (ext == "commit" || ext == "dirtree" || ext == "dirmeta") {
+        serveFile(fd, cfg_.ostree_repo / "objects" / elements[3] / elements[4]);
+        return;
+      }
+      if (ext == "filez") {
+        serveOstreeFile(fd, elements[3] + hash);
+        return;
+      }
+    }
+  }
+  sendHeader(fd, "404 Not Found", 0);
+}
+
+void PeerCache::serveFile(int fd, const boost::filesystem::path& path) const {
+  const int file_fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  struct stat st {};
+  if (file_fd == -1 || ::fstat(file_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    if (file_fd != -1) {
+      ::close(file_fd);
+    }
+    sendHeader(fd, "404 Not Found", 0);
+    return;
+  }
+  if (sendHeader(fd, "200 OK", st.st_size)) {
+    off_t offset{0};
+    while (offset < st.st_size &&
+           ::sendfile(fd, file_fd, &offset, static_cast<std::size_t>(st.st_size - offset)) > 0) {
+    }
+  }
+  ::close(file_fd);
+}
+
+void PeerCache::serveOstreeFile(int fd, const std::string& checksum) const {
+  bool header_sent{false};
+  try {
+    OSTree::Repo repo{cfg_.ostree_repo.string()};
+    // the size of the archived object is not known before it is compressed
+    repo.exportArchiveFile(checksum, [fd, &header_sent](const char* data, std::size_t size) {
+      if (!header_sent) {
+        header_sent = true;
+        if (!sendHeader(fd, "200 OK")) {
+          return false;
+        }
+      }
+      return sendAll(fd, data, size);
+    });
+  } catch (const std::exception& exc) {
+    if (!header_sent) {
+      LOG_DEBUG << "Failed to serve ostree object " << checksum << " to a peer: " << exc.what();
+      sendHeader(fd, "404 Not Found", 0);
+    }
+    // otherwise the connection is just closed, the receiver detects the incomplete object by its checksum
+    return;
+  }
+  if (!header_sent) {
+    sendHeader(fd, "200 OK", 0);
+  }
+}
+
+void PeerCache::discover() {
+  const std::string announcement{AnnounceMagic + " " + instance_id_ + " " + std::to_string(port_)};
+  struct sockaddr_in broadcast_addr {};
+  broadcast_addr.sin_family = AF_INET;
+  broadcast_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+  broadcast_addr.sin_port = htons(port_);
+  auto announce_at{std::chrono::steady_clock::now()};
+
+  while (!stop_) {
+    if (std::chrono::steady_clock::now() >= announce_at) {
+      if (::sendto(discovery_fd_, announcement.data(), announcement.size(), 0,
+                   reinterpret_cast<struct sockaddr*>(&broadcast_addr), sizeof(broadcast_addr)) == -1) {
+        LOG_DEBUG << "Failed to announce the peer cache: " << std::strerror(errno);
+      }
+      announce_at += std::chrono::seconds(AnnounceIntervalSec);
+    }
+
+    struct pollfd pfd {
+      discovery_fd_, POLLIN, 0
+    };
+    if (::poll(&pfd, 1, PollIntervalMs) <= 0) {
+      continue;
+    }
+    std::array<char, 256> buf{};
+    struct sockaddr_in src_addr {};
+    socklen_t src_addr_len{sizeof(src_addr)};
+    const auto received{::recvfrom(discovery_fd_, buf.data(), buf.size(), 0,
+                                   reinterpret_cast<struct sockaddr*>(&src_addr), &src_addr_len)};
+    if (received <= 0) {
+      continue;
+    }
+    std::array<char, INET_ADDRSTRLEN> host{};
+    if (::inet_ntop(AF_INET, &src_addr.sin_addr, host.data(), host.size()) != nullptr) {
+      onAnnouncement(std::string(buf.data(), static_cast<std::size_t>(received)), host.data());
+    }
+  }
+}
+
+void PeerCache::onAnnouncement(const std::string& msg, const std::string& host) {
+  // <magic> <instance ID> <port>
+  std::vector<std::string> fields;
+  boost::split(fields, msg, boost::is_any_of(" "));
+  if (fields.size() != 3 || fields[0] != AnnounceMagic || fields[1] == instance_id_ ||
+      !std::all_of(fields[2].begin(), fields[2].end(), ::isdigit) || fields[2].empty() || fields[2].size() > 5) {
+    return;
+  }
+  const auto peer{host + ":" + fields[2]};
+  std::lock_guard<std::mutex> lock{mutex_};
+  if (discovered_peers_.count(peer) == 0) {
+    LOG_INFO << "Discovered peer cache " << peer;
+  }
+  discovered_peers_[peer] = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,98 @@
+#ifndef AKTUALIZR_LITE_PEER_CACHE_H_
+#define AKTUALIZR_LITE_PEER_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * @brief PeerCache, an opt-in cache of App blobs and ostree objects shared by the devices of the same LAN.
+ *
+ * Each device serves the blobs of its restorable App store and the objects of its ostree repo over plain HTTP:
+ *  GET /blobs/sha256/<hash>                - an App blob, i.e. a manifest, an image config or a layer;
+ *  GET /ostree/objects/<xx>/<hash>.<type>  - an ostree object, files are served as they are stored in an archive repo.
+ * Only the content that has been verified on its download is served, i.e. the blobs that have been moved to the store
+ * after their hash check and the objects committed to the ostree repo, everything received from a peer is verified
+ * again by the receiver, by the blob digest or by ostree against the commit hash taken from the TUF Target. So a peer
+ * can make a download fail over to the upstream, but it cannot make a device install the content it is not supposed to.
+ *
+ * The peers are either listed in the config or discovered, each device broadcasts an announcement of its server
+ * on the LAN each `AnnounceIntervalSec`, and a peer is forgotten if it is not heard of for `PeerTtlSec`.
+ */
+class PeerCache {
+ public:
+  using Ptr = std::shared_ptr<PeerCache>;
+  // Receives the number of bytes received so far
+  using ProgressCb = std::function<void(uint64_t)>;
+
+  static const uint16_t DefPort{8413};
+  static const int AnnounceIntervalSec{30};
+  static const int PeerTtlSec{90};
+  static const int IoTimeoutSec{30};
+  // The number of requests served concurrently
+  static const std::size_t ServerWorkers{4};
+  static const std::string AnnounceMagic;
+  static const std::string PartFileExt;
+
+  struct Config {
+    // the TCP port of the server and the UDP port of the announcements, any free port if 0, e.g. for tests
+    uint16_t port{DefPort};
+    // the static peers, <host>:<port>
+    std::vector<std::string> peers;
+    bool discovery{true};
+    // the ostree repo to serve the objects of, nothing is served if it is not set
+    boost::filesystem::path ostree_repo;
+  };
+
+  // Starts the server and the discovery, throws std::runtime_error if the server socket cannot be set up
+  explicit PeerCache(Config cfg);
+  ~PeerCache();
+  PeerCache(const PeerCache&) = delete;
+  PeerCache& operator=(const PeerCache&) = delete;
+  PeerCache(PeerCache&&) = delete;
+  PeerCache& operator=(PeerCache&&) = delete;
+
+  // The port the server listens on
+  uint16_t port() const { return port_; }
+  // Sets the dir of the blobs to serve, the blobs are stored in it by their hashes
+  void serveBlobs(boost::filesystem::path blob_dir);
+  // The static peers followed by the ones discovered recently, <host>:<port>
+  std::vector<std::string> peers() const;
+  // The base URLs of the ostree repos served by the peers
+  std::vector<std::string> ostreeMirrors() const;
+  // Tries to download the given blob from the peers one by one, the blob is moved to `dst` only if its size and
+  // hash match the expected ones. Returns false if none of the peers has provided the valid blob.
+  bool fetchBlob(const std::string& hash, uint64_t size, const boost::filesystem::path& dst,
+                 const ProgressCb& progress_cb = nullptr) const;
+
+ private:
+  void serve();
+  void serveRequest(int fd) const;
+  void serveFile(int fd, const boost::filesystem::path& path) const;
+  void serveOstreeFile(int fd, const std::string& checksum) const;
+  void discover();
+  void onAnnouncement(const std::string& msg, const std::string& host);
+
+  const Config cfg_;
+  const std::string instance_id_;
+  uint16_t port_{0};
+  std::atomic_bool stop_{false};
+  int server_fd_{-1};
+  int discovery_fd_{-1};
+  mutable std::mutex mutex_;
+  boost::filesystem::path blob_dir_;
+  // <host>:<port> -> when it was announced last time
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point> discovered_peers_;
+  std::vector<std::thread> workers_;
+};
+
+#endif  // AKTUALIZR_LITE_PEER_CACHE_H_
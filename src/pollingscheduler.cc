@@ -0,0 +1,93 @@
+#include "pollingscheduler.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+
+#include "logging/logging.h"
+
+constexpr std::chrono::seconds PollingScheduler::MinHint;
+constexpr std::chrono::seconds PollingScheduler::MaxHint;
+
+namespace {
+
+int parseInt(const std::string& key, const std::string& val, int min, int max) {
+  int res{0};
+  try {
+    res = std::stoi(val);
+  } catch (const std::exception& exc) {
+    LOG_ERROR << "Invalid value of sota.toml:pacman:" << key << ": " << val << "; " << exc.what();
+    throw;
+  }
+  if (res < min || res > max) {
+    throw std::invalid_argument("Invalid sota.toml:pacman:" + key + " value, should be within [" +
+                                std::to_string(min) + ", " + std::to_string(max) + "], got " + val);
+  }
+  return res;
+}
+
+DownloadWindows parseWindows(const std::string& key, const std::string& val) {
+  try {
+    return DownloadWindows(val);
+  } catch (const std::invalid_argument& exc) {
+    throw std::invalid_argument("Invalid sota.toml:pacman:" + key + " value: " + exc.what());
+  }
+}
+
+}  // namespace
+
+PollingScheduler::Config::Config(const PackageConfig& pconfig) {
+  const std::map<std::string, std::string>& raw = pconfig.extra;
+
+  if (raw.count("polling_max_sec") == 1) {
+    max_sec = parseInt("polling_max_sec", raw.at("polling_max_sec"), 0, std::numeric_limits<int>::max());
+  }
+  if (raw.count("polling_jitter_percent") == 1) {
+    jitter_percent = parseInt("polling_jitter_percent", raw.at("polling_jitter_percent"), 0, 100);
+  }
+  if (raw.count("polling_rollout_sec") == 1) {
+    rollout_sec = parseInt("polling_rollout_sec", raw.at("polling_rollout_sec"), 0, std::numeric_limits<int>::max());
+  }
+
+  if (raw.count("download_windows") == 1) {
+    download_windows = parseWindows("download_windows", raw.at("download_windows"));
+  }
+  if (raw.count("install_windows") == 1) {
+    install_windows = parseWindows("install_windows", raw.at("install_windows"));
+  }
+}
+
+PollingScheduler::PollingScheduler(std::chrono::seconds interval, const std::string& device_id,
+                                   std::chrono::seconds max_interval, unsigned jitter_percent,
+                                   std::chrono::seconds rollout_interval)
+    : interval_{interval},
+      max_interval_{max_interval},
+      jitter_percent_{std::min(jitter_percent, 100U)},
+      rollout_interval_{rollout_interval},
+      rand_{device_id.empty() ? std::random_device{}()
+                              : static_cast<std::mt19937::result_type>(std::hash<std::string>{}(device_id))} {}
+
+std::chrono::seconds PollingScheduler::next() {
+  auto wait{interval_};
+  if (failures_ > 0 && max_interval_ > interval_) {
+    for (unsigned ii = 0; ii < failures_ && wait < max_interval_; ++ii) {
+      wait *= 2;
+    }
+    wait = std::min(wait, max_interval_);
+  } else if (rollout_ && rollout_interval_ > std::chrono::seconds::zero()) {
+    wait = std::min(wait, rollout_interval_);
+  }
+  if (hint_ > std::chrono::seconds::zero()) {
+    wait = std::min(std::max(hint_, MinHint), std::max(MaxHint, interval_));
+  }
+  rollout_ = false;
+  hint_ = std::chrono::seconds::zero();
+
+  const auto spread{wait.count() * jitter_percent_ / 100};
+  if (spread > 0) {
+    std::uniform_int_distribution<std::chrono::seconds::rep> jitter{-spread, spread};
+    wait += std::chrono::seconds(jitter(rand_));
+  }
+  return wait;
+}
@@ -0,0 +1,65 @@
+#ifndef AKTUALIZR_LITE_POLLING_SCHEDULER_H_
+#define AKTUALIZR_LITE_POLLING_SCHEDULER_H_
+
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "downloadpolicy.h"
+#include "libaktualizr/config.h"
+
+// Determines how long to wait before the next update cycle.
+// The base wait time is the polling interval. It is:
+//  - doubled after each consecutive failure to reach the server, up to the max interval (no backoff if it is zero);
+//  - shortened to the rollout interval, if it is set, after a cycle in which the Targets metadata have changed,
+//    since the following changes of an ongoing rollout are likely to come soon;
+//  - replaced by the server hint if one has been received, within the [MinHint, max(MaxHint, interval)] range.
+// The base time is then randomly spread by up to the jitter percent in both directions, the random sequence is
+// seeded by the device ID so the devices of a fleet started at the same time don't poll the server in sync.
+class PollingScheduler {
+ public:
+  static constexpr std::chrono::seconds MinHint{10};
+  static constexpr std::chrono::seconds MaxHint{24 * 3600};
+
+  // The daemon update cycle options, they are set in sota.toml:[pacman] and apply to any package manager type
+  struct Config {
+   public:
+    explicit Config(const PackageConfig& pconfig);
+
+    // sota.toml:[pacman].polling_max_sec/polling_jitter_percent/polling_rollout_sec, the max interval, the jitter
+    // percent (0..100) and the rollout interval, 0 disables the backoff, jitter and rollout interval respectively
+    int max_sec{0};
+    int jitter_percent{0};
+    int rollout_sec{0};
+    // sota.toml:[pacman].download_windows/install_windows, the daily windows new Targets are downloaded and installed
+    // within, e.g. `22:00-06:00`, a Target is downloaded in advance of its install window, no windows means any time
+    DownloadWindows download_windows;
+    DownloadWindows install_windows;
+  };
+
+  PollingScheduler(std::chrono::seconds interval, const std::string& device_id,
+                   std::chrono::seconds max_interval = std::chrono::seconds::zero(), unsigned jitter_percent = 0,
+                   std::chrono::seconds rollout_interval = std::chrono::seconds::zero());
+
+  std::chrono::seconds interval() const { return interval_; }
+  void setSucceeded() { failures_ = 0; }
+  void setFailed() { ++failures_; }
+  void setRollout() { rollout_ = true; }
+  // The time to wait before the next check suggested by the server, zero if none
+  void setHint(std::chrono::seconds hint) { hint_ = hint; }
+  // Returns the time to wait before the next cycle, the rollout and hint states are reset
+  std::chrono::seconds next();
+
+ private:
+  const std::chrono::seconds interval_;
+  const std::chrono::seconds max_interval_;
+  const unsigned jitter_percent_;
+  const std::chrono::seconds rollout_interval_;
+  std::mt19937 rand_;
+
+  unsigned failures_{0};
+  bool rollout_{false};
+  std::chrono::seconds hint_{0};
+};
+
+#endif  // AKTUALIZR_LITE_POLLING_SCHEDULER_H_
@@ -0,0 +1,96 @@
+#include "reportworker.h"
+
+#include <algorithm>
+
+#include "logging/logging.h"
+
+const int ReportWorker::MinBackoffSec;
+const int ReportWorker::MaxBackoffSec;
+
+ReportWorker::ReportWorker(Clock::duration min_backoff, Clock::duration max_backoff)
+    : min_backoff_{min_backoff}, max_backoff_{std::max(min_backoff, max_backoff)} {
+  thread_ = std::thread(&ReportWorker::run, this);
+}
+
+ReportWorker::~ReportWorker() {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void ReportWorker::post(const std::string& kind, Report report) {
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto& slot{slots_[kind]};
+    if (!slot.report && slot.failures == 0) {
+      slot.due = Clock::now();
+    }
+    slot.report = std::move(report);
+  }
+  cv_.notify_all();
+}
+
+bool ReportWorker::wait(Clock::duration timeout) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  return idle_cv_.wait_for(lock, timeout, [this]() { return isIdle(); });
+}
+
+bool ReportWorker::isIdle() const {
+  return !running_ && std::none_of(slots_.begin(), slots_.end(),
+                                   [](const std::pair<const std::string, Slot>& slot) { return !!slot.second.report; });
+}
+
+void ReportWorker::run() {
+  std::unique_lock<std::mutex> lock{mutex_};
+  while (!stop_) {
+    auto next{slots_.end()};
+    for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+      if (it->second.report && (next == slots_.end() || it->second.due < next->second.due)) {
+        next = it;
+      }
+    }
+    if (next == slots_.end()) {
+      idle_cv_.notify_all();
+      cv_.wait(lock);
+      continue;
+    }
+    if (next->second.due > Clock::now()) {
+      cv_.wait_until(lock, next->second.due);
+      continue;
+    }
+
+    const auto kind{next->first};
+    auto report{std::move(next->second.report)};
+    next->second.report = nullptr;
+    running_ = true;
+    lock.unlock();
+    bool sent{false};
+    try {
+      sent = report();
+    } catch (const std::exception& exc) {
+      LOG_WARNING << "Failed to send the " << kind << " report: " << exc.what();
+    }
+    lock.lock();
+    running_ = false;
+
+    // looked up again since post() may have rehashed the slots in the meantime
+    auto& slot{slots_[kind]};
+    if (sent) {
+      slot.failures = 0;
+      slot.due = Clock::now();
+      continue;
+    }
+    const auto backoff{std::min<Clock::duration>(max_backoff_, min_backoff_ * (1U << std::min(slot.failures, 16U)))};
+    ++slot.failures;
+    slot.due = Clock::now() + backoff;
+    if (!slot.report) {
+      slot.report = std::move(report);
+    }
+    LOG_DEBUG << "The " << kind << " report is retried in "
+              << std::chrono::duration_cast<std::chrono::seconds>(backoff).count() << " seconds after "
+              << slot.failures << " failure(s)";
+  }
+}
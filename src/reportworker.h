@@ -0,0 +1,64 @@
+#ifndef AKTUALIZR_LITE_REPORT_WORKER_H_
+#define AKTUALIZR_LITE_REPORT_WORKER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief ReportWorker, sends the device state reports in the background so they don't delay the update cycles.
+ *
+ * A report is posted under its kind, e.g. "apps-state", and only the latest report of each kind is kept, a report
+ * posted while the previous one of the same kind is still pending supersedes it. A report that fails is retried,
+ * unless superseded, after `MinBackoffSec`, the period doubles with each subsequent failure of the kind up to
+ * `MaxBackoffSec` and it is reset by a success. The superseding reports don't bypass the backoff, so a server that is
+ * not reachable is not hit each update cycle. The pending reports are dropped on destruction, a report in progress is
+ * waited for. All methods are thread-safe.
+ */
+class ReportWorker {
+ public:
+  using Clock = std::chrono::steady_clock;
+  // Sends a report, returns false if it should be retried
+  using Report = std::function<bool()>;
+
+  static const int MinBackoffSec{10};
+  static const int MaxBackoffSec{600};
+
+  explicit ReportWorker(Clock::duration min_backoff = std::chrono::seconds(MinBackoffSec),
+                        Clock::duration max_backoff = std::chrono::seconds(MaxBackoffSec));
+  ~ReportWorker();
+  ReportWorker(const ReportWorker&) = delete;
+  ReportWorker& operator=(const ReportWorker&) = delete;
+  ReportWorker(ReportWorker&&) = delete;
+  ReportWorker& operator=(ReportWorker&&) = delete;
+
+  void post(const std::string& kind, Report report);
+  // Waits until all the posted reports have been sent, returns false if it has not happened within the given time
+  bool wait(Clock::duration timeout);
+
+ private:
+  struct Slot {
+    Report report;
+    unsigned int failures{0};
+    Clock::time_point due;
+  };
+
+  void run();
+  bool isIdle() const;
+
+  const Clock::duration min_backoff_;
+  const Clock::duration max_backoff_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable idle_cv_;
+  bool stop_{false};
+  bool running_{false};
+  std::unordered_map<std::string, Slot> slots_;
+  std::thread thread_;
+};
+
+#endif  // AKTUALIZR_LITE_REPORT_WORKER_H_
@@ -0,0 +1,146 @@
+#include "resourcecontrol.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+
+namespace {
+
+// see linux/ioprio.h
+const int IoPrioClassShift{13};
+const int IoPrioWhoProcess{1};
+const int MaxNice{19};
+
+int parseInt(const std::string& key, const std::string& val, int min, int max) {
+  int res{0};
+  try {
+    res = std::stoi(val);
+  } catch (const std::exception& exc) {
+    LOG_ERROR << "Invalid value of sota.toml:pacman:" << key << ": " << val << "; " << exc.what();
+    throw;
+  }
+  if (res < min || res > max) {
+    throw std::invalid_argument("Invalid sota.toml:pacman:" + key + " value, should be within [" +
+                                std::to_string(min) + ", " + std::to_string(max) + "], got " + val);
+  }
+  return res;
+}
+
+bool writeCgroupFile(const boost::filesystem::path& path, const std::string& value) {
+  std::ofstream file{path.string()};
+  file << value;
+  file.close();
+  if (!file) {
+    LOG_WARNING << "Failed to write `" << value << "` to " << path << ": " << std::strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+ResourceControl::Config::Config(const PackageConfig& pconfig) {
+  const std::map<std::string, std::string>& raw = pconfig.extra;
+
+  if (raw.count("nice") == 1) {
+    nice = parseInt("nice", raw.at("nice"), -20, 19);
+  }
+
+  if (raw.count("ionice") == 1) {
+    std::vector<std::string> parts;
+    boost::split(parts, raw.at("ionice"), boost::is_any_of(":"));
+    const auto io_class_str{boost::trim_copy(parts[0])};
+    if (io_class_str == "idle" && parts.size() == 1) {
+      io_class = IoClass::kIdle;
+    } else if ((io_class_str == "best-effort" || io_class_str == "realtime") && parts.size() <= 2) {
+      io_class = io_class_str == "realtime" ? IoClass::kRealtime : IoClass::kBestEffort;
+      if (parts.size() == 2) {
+        io_level = parseInt("ionice", boost::trim_copy(parts[1]), 0, 7);
+      }
+    } else {
+      throw std::invalid_argument(
+          "Invalid sota.toml:pacman:ionice value, should be `idle`, `best-effort[:<level>]` or "
+          "`realtime[:<level>]`, got " +
+          raw.at("ionice"));
+    }
+  }
+
+  if (raw.count("cgroup") == 1) {
+    cgroup = raw.at("cgroup");
+  }
+  if (raw.count("cgroup_cpu_weight") == 1) {
+    cpu_weight = parseInt("cgroup_cpu_weight", raw.at("cgroup_cpu_weight"), 1, 10000);
+  }
+  if (raw.count("cgroup_io_weight") == 1) {
+    io_weight = parseInt("cgroup_io_weight", raw.at("cgroup_io_weight"), 1, 10000);
+  }
+  if ((cpu_weight != 0 || io_weight != 0) && cgroup.empty()) {
+    throw std::invalid_argument("sota.toml:pacman:cgroup must be set if the cgroup weights are set");
+  }
+}
+
+// the libc doesn't wrap the ioprio syscalls, the priority of the calling thread is got and set if `who` is 0
+ResourceControl::LowPriorityScope::LowPriorityScope()
+    : nice_{getpriority(PRIO_PROCESS, 0)},
+      ioprio_{static_cast<int>(syscall(SYS_ioprio_get, IoPrioWhoProcess, 0))} {
+  const int idle{static_cast<int>(IoClass::kIdle) << IoPrioClassShift};
+  if (setpriority(PRIO_PROCESS, 0, MaxNice) != 0 || syscall(SYS_ioprio_set, IoPrioWhoProcess, 0, idle) != 0) {
+    LOG_WARNING << "Failed to lower the thread priority: " << std::strerror(errno);
+  }
+}
+
+ResourceControl::LowPriorityScope::~LowPriorityScope() {
+  setpriority(PRIO_PROCESS, 0, nice_);
+  if (ioprio_ >= 0) {
+    syscall(SYS_ioprio_set, IoPrioWhoProcess, 0, ioprio_);
+  }
+}
+
+void ResourceControl::apply(const Config& cfg) {
+  if (!!cfg.nice) {
+    // Linux sets the nice value of the calling thread only, the threads spawned by it inherit it
+    if (setpriority(PRIO_PROCESS, 0, *cfg.nice) == -1) {
+      LOG_WARNING << "Failed to set the nice value to " << *cfg.nice << ": " << std::strerror(errno);
+    } else {
+      LOG_INFO << "The nice value is set to " << *cfg.nice;
+    }
+  }
+
+  if (cfg.io_class != IoClass::kNone) {
+    const int level{cfg.io_class == IoClass::kIdle ? 0 : cfg.io_level};
+    const int ioprio{(static_cast<int>(cfg.io_class) << IoPrioClassShift) | level};
+    if (syscall(SYS_ioprio_set, IoPrioWhoProcess, 0, ioprio) == -1) {
+      LOG_WARNING << "Failed to set the IO priority: " << std::strerror(errno);
+    } else {
+      LOG_INFO << "The IO priority is set to class " << static_cast<int>(cfg.io_class) << ", level " << level;
+    }
+  }
+
+  if (cfg.cgroup.empty()) {
+    return;
+  }
+  boost::system::error_code ec;
+  boost::filesystem::create_directories(cfg.cgroup, ec);
+  if (ec) {
+    LOG_WARNING << "Failed to create cgroup " << cfg.cgroup << ": " << ec.message();
+    return;
+  }
+  // the controllers must be enabled in the parent to set the weights, it may have been done already
+  const auto parent_control{cfg.cgroup.parent_path() / "cgroup.subtree_control"};
+  if (cfg.cpu_weight != 0 && writeCgroupFile(parent_control, "+cpu")) {
+    writeCgroupFile(cfg.cgroup / "cpu.weight", std::to_string(cfg.cpu_weight));
+  }
+  if (cfg.io_weight != 0 && writeCgroupFile(parent_control, "+io")) {
+    writeCgroupFile(cfg.cgroup / "io.weight", "default " + std::to_string(cfg.io_weight));
+  }
+  if (writeCgroupFile(cfg.cgroup / "cgroup.procs", std::to_string(getpid()))) {
+    LOG_INFO << "Moved to cgroup " << cfg.cgroup;
+  }
+}
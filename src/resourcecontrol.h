@@ -0,0 +1,57 @@
+#ifndef AKTUALIZR_LITE_RESOURCE_CONTROL_H_
+#define AKTUALIZR_LITE_RESOURCE_CONTROL_H_
+
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+#include "libaktualizr/config.h"
+
+// Lowers the CPU and IO priority of the update activity, so it doesn't cause latency spikes in the workloads running
+// on the same device. The priority is set for the calling thread, the threads and child processes (skopeo, tar,
+// compose, etc) it spawns afterwards inherit it, so it is to be applied at start, before any thread is spawned.
+// Optionally, the whole process is moved to a dedicated cgroup (v2) with the given CPU and IO weights.
+// Note that the work done by the docker daemon on behalf of aklite, e.g. image extraction, is not affected.
+class ResourceControl {
+ public:
+  enum class IoClass { kNone = 0, kRealtime = 1, kBestEffort = 2, kIdle = 3 };
+
+  struct Config {
+   public:
+    explicit Config(const PackageConfig& pconfig);
+    bool empty() const { return !nice && io_class == IoClass::kNone && cgroup.empty(); }
+
+    // sota.toml:[pacman].nice, -20..19
+    boost::optional<int> nice;
+    // sota.toml:[pacman].ionice, `idle`, `best-effort[:<level>]` or `realtime[:<level>]`, the level is 0..7
+    IoClass io_class{IoClass::kNone};
+    int io_level{4};
+    // sota.toml:[pacman].cgroup, a path in the cgroup v2 hierarchy, e.g. `/sys/fs/cgroup/aklite`, created if missing
+    boost::filesystem::path cgroup;
+    // sota.toml:[pacman].cgroup_cpu_weight/cgroup_io_weight, 1..10000, the default weight is 100
+    int cpu_weight{0};
+    int io_weight{0};
+  };
+
+  // Lowers the CPU and IO priority of the calling thread to the lowest ones until it goes out of scope, the priority
+  // is inherited by the processes the thread runs
+  class LowPriorityScope {
+   public:
+    LowPriorityScope();
+    ~LowPriorityScope();
+    LowPriorityScope(const LowPriorityScope&) = delete;
+    LowPriorityScope& operator=(const LowPriorityScope&) = delete;
+    LowPriorityScope(LowPriorityScope&&) = delete;
+    LowPriorityScope& operator=(LowPriorityScope&&) = delete;
+
+   private:
+    const int nice_;
+    const int ioprio_;
+  };
+
+  // Failures are logged, they are not fatal since the update can go on at the default priority
+  static void apply(const Config& cfg);
+};
+
+#endif  // AKTUALIZR_LITE_RESOURCE_CONTROL_H_
@@ -1,17 +1,35 @@
 #include "rootfstreemanager.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 
+#include "downloadprogress.h"
+#include "http/httpclient.h"
 #include "ostree/repo.h"
 #include "target.h"
+#include "updatetrace.h"
+#include "utilities/utils.h"
 
 RootfsTreeManager::RootfsTreeManager(const PackageConfig& pconfig, const BootloaderConfig& bconfig,
                                      const std::shared_ptr<INvStorage>& storage,
                                      const std::shared_ptr<HttpInterface>& http,
                                      std::shared_ptr<OSTree::Sysroot> sysroot, const KeyManager& keys)
-    : OstreeManager(pconfig, bconfig, storage, http, new bootloader::BootloaderLite(bconfig, *storage, sysroot)),
+    : RootfsTreeManager(pconfig, bconfig, storage, http, std::move(sysroot), keys,
+                        bootloader::BootloaderEnv::create(bconfig.rollback_mode)) {}
+
+RootfsTreeManager::RootfsTreeManager(const PackageConfig& pconfig, const BootloaderConfig& bconfig,
+                                     const std::shared_ptr<INvStorage>& storage,
+                                     const std::shared_ptr<HttpInterface>& http,
+                                     std::shared_ptr<OSTree::Sysroot> sysroot, const KeyManager& keys,
+                                     const bootloader::BootloaderEnv::Ptr& boot_env)
+    : OstreeManager(pconfig, bconfig, storage, http,
+                    new bootloader::BootloaderLite(bconfig, *storage, sysroot, boot_env)),
       sysroot_{std::move(sysroot)},
-      boot_fw_update_status_{new bootloader::BootloaderLite(bconfig, *storage, sysroot)},
+      boot_fw_update_status_{new bootloader::BootloaderLite(bconfig, *storage, sysroot, boot_env)},
       http_client_{http},
       gateway_url_{pconfig.ostree_server},
       keys_{keys} {
@@ -20,12 +38,60 @@ RootfsTreeManager::RootfsTreeManager(const PackageConfig& pconfig, const Bootloa
     std::string val{pconfig.extra.at(update_block_attr_name)};
     update_block_ = val != "0" && val != "false";
   }
+
+  const std::string remote_selection_attr_name{"ostree_remote_selection"};
+  if (pconfig.extra.count(remote_selection_attr_name) == 1) {
+    const std::string val{pconfig.extra.at(remote_selection_attr_name)};
+    if (val != "ordered" && val != "latency") {
+      throw std::invalid_argument("Invalid sota.toml:pacman:" + remote_selection_attr_name +
+                                  " value, should be `ordered` or `latency`, got " + val);
+    }
+    rank_remotes_ = val == "latency";
+  }
+
+  const std::string pull_mode_attr_name{"ostree_pull_mode"};
+  if (pconfig.extra.count(pull_mode_attr_name) == 1) {
+    const std::string val{pconfig.extra.at(pull_mode_attr_name)};
+    if (val != "objects" && val != "delta") {
+      throw std::invalid_argument("Invalid sota.toml:pacman:" + pull_mode_attr_name +
+                                  " value, should be `objects` or `delta`, got " + val);
+    }
+    prefer_deltas_ = val == "delta";
+  }
+
+  const std::string peer_cache_attr_name{"peer_cache"};
+  if (pconfig.extra.count(peer_cache_attr_name) == 1 &&
+      boost::lexical_cast<bool>(pconfig.extra.at(peer_cache_attr_name))) {
+    PeerCache::Config peer_cache_cfg;
+    if (pconfig.extra.count("peer_cache_port") == 1) {
+      const auto port{std::stoi(pconfig.extra.at("peer_cache_port"))};
+      if (port <= 0 || port > std::numeric_limits<uint16_t>::max()) {
+        throw std::invalid_argument("Invalid sota.toml:pacman:peer_cache_port value, got " + std::to_string(port));
+      }
+      peer_cache_cfg.port = static_cast<uint16_t>(port);
+    }
+    if (pconfig.extra.count("peer_cache_peers") == 1) {
+      boost::split(peer_cache_cfg.peers, pconfig.extra.at("peer_cache_peers"), boost::is_any_of(", "),
+                   boost::token_compress_on);
+      peer_cache_cfg.peers.erase(std::remove(peer_cache_cfg.peers.begin(), peer_cache_cfg.peers.end(), ""),
+                                 peer_cache_cfg.peers.end());
+    }
+    if (pconfig.extra.count("peer_cache_discovery") == 1) {
+      peer_cache_cfg.discovery = boost::lexical_cast<bool>(pconfig.extra.at("peer_cache_discovery"));
+    }
+    peer_cache_cfg.ostree_repo = sysroot_->path() + "/ostree/repo";
+    peer_cache_ = std::make_shared<PeerCache>(peer_cache_cfg);
+  }
 }
 
 DownloadResult RootfsTreeManager::Download(const TufTarget& target) {
-  auto prog_cb = [this](const Uptane::Target& t, const std::string& description, unsigned int progress) {
-    // report_progress_cb(events_channel.get(), t, description, progress);
-    // TODO: consider make use of it for download progress reporting
+  UpdateTrace::Span span{"ostree_pull", target.Name()};
+  // OstreeManager::pull() reports only the pull phase and the share of fetched objects, not the amount of data
+  DownloadProgressMeter progress_meter{[this](const DownloadProgress& progress) { reportProgress(progress); },
+                                       DownloadProgress::Source::Ostree, target.Sha256Hash()};
+  auto prog_cb = [&progress_meter](const Uptane::Target& t, const std::string& description, unsigned int progress) {
+    (void)t;
+    progress_meter.update(0, description, progress);
   };
 
   std::vector<Remote> remotes = {{remote, config.ostree_server, {{"X-Correlation-ID", target.Name()}}, &keys_, false}};
@@ -37,6 +103,9 @@ DownloadResult RootfsTreeManager::Download(const TufTarget& target) {
   if (!config.ostree_server.empty() && boost::starts_with(config.ostree_server, "http")) {
     getAdditionalRemotes(remotes, target.Name());
   }
+  if (rank_remotes_ && remotes.size() > 1) {
+    rankRemotes(remotes);
+  }
 
   DownloadResult res{DownloadResult::Status::Ok, ""};
   data::InstallationResult pull_err{data::ResultCode::Numeric::kUnknown, ""};
@@ -46,9 +115,26 @@ DownloadResult RootfsTreeManager::Download(const TufTarget& target) {
     if (!remote.isRemoteSet) {
       setRemote(remote.name, remote.baseUrl, remote.keys);
     }
-    pull_err = OstreeManager::pull(config.sysroot, remote.baseUrl, keys_, Target::fromTufTarget(target), nullptr,
-                                   prog_cb, remote.isRemoteSet ? nullptr : remote.name.c_str(), remote.headers);
+    if (prefer_deltas_) {
+      const auto delta_res{pullDelta(remote, target, progress_meter)};
+      if (!!delta_res) {
+        res = *delta_res;
+        if (res) {
+          progress_meter.complete();
+        }
+        break;
+      }
+    }
+    if (isDownloadCancelled()) {
+      res = {DownloadResult::Status::DownloadFailed, "Download has been cancelled"};
+      break;
+    }
+    // the pull stops at the next batch of objects once the token is aborted
+    pull_err = OstreeManager::pull(config.sysroot, remote.baseUrl, keys_, Target::fromTufTarget(target),
+                                   flowControlToken(), prog_cb, remote.isRemoteSet ? nullptr : remote.name.c_str(),
+                                   remote.headers);
     if (pull_err.isSuccess()) {
+      progress_meter.complete();
       res = {DownloadResult::Status::Ok, ""};
       break;
     }
@@ -63,13 +149,43 @@ DownloadResult RootfsTreeManager::Download(const TufTarget& target) {
              sysroot_->path()};
       break;
     }
+    if (rank_remotes_) {
+      demoteRemote(remote);
+    }
     error_desc += pull_err.description + "\n";
     res = {DownloadResult::Status::DownloadFailed, error_desc};
   }
 
+  if (!res) {
+    span.setFailed();
+  }
   return res;
 }
 
+UpdateCost RootfsTreeManager::EstimateCost(const TufTarget& target) {
+  UpdateCost cost;
+  OSTree::Repo repo{sysroot_->path() + "/ostree/repo"};
+  if (repo.hasCommit(target.Sha256Hash())) {
+    LOG_INFO << "Ostree commit " << target.Sha256Hash() << " is present, nothing to download";
+    return cost;
+  }
+  setRemote(remote, config.ostree_server, &keys_);
+  try {
+    const auto delta{repo.getDeltaStat(remote, target.Sha256Hash(), {{"X-Correlation-ID", target.Name()}})};
+    const auto free_space{repo.getFreeSpace()};
+    LOG_INFO << "Static delta of ostree commit " << target.Sha256Hash() << ": to download: " << delta.size
+             << " bytes, required: " << delta.usize << " bytes, available: " << free_space << " bytes";
+    cost.ostree_download = delta.size;
+    cost.ostree_usage = delta.usize;
+    cost.space_shortfall = delta.usize > free_space ? delta.usize - free_space : 0;
+  } catch (const std::exception& exc) {
+    LOG_INFO << "No static delta of ostree commit " << target.Sha256Hash() << " at " << config.ostree_server
+             << ", its download size is unknown; " << exc.what();
+    cost.exact = false;
+  }
+  return cost;
+}
+
 bool RootfsTreeManager::fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const KeyManager& keys,
                                     const FetcherProgressCb& progress_cb, const api::FlowControlToken* token) {
   (void)target;
@@ -117,7 +233,13 @@ data::InstallationResult RootfsTreeManager::install(const Uptane::Target& target
     // and a false notification doesn't hurt with rollback support in place
     // Hacking in order to invoke non-const method from the const one !!!
     const_cast<RootfsTreeManager*>(this)->updateNotify();
-    res = OstreeManager::install(target);
+    {
+      UpdateTrace::Span span{"ostree_deploy", target.filename()};
+      res = OstreeManager::install(target);
+      if (res.result_code.num_code == data::ResultCode::Numeric::kInstallFailed) {
+        span.setFailed();
+      }
+    }
     if (res.result_code.num_code == data::ResultCode::Numeric::kInstallFailed) {
       LOG_ERROR << "Failed to install OSTree target";
       return res;
@@ -162,13 +284,115 @@ void RootfsTreeManager::getAdditionalRemotes(std::vector<Remote>& remotes, const
   }
 }
 
+boost::optional<DownloadResult> RootfsTreeManager::pullDelta(const Remote& remote, const TufTarget& target,
+                                                             DownloadProgressMeter& progress_meter) {
+  OSTree::Repo repo{sysroot_->path() + "/ostree/repo"};
+  OSTree::Repo::DeltaStat delta{};
+  try {
+    delta = repo.getDeltaStat(remote.name, target.Sha256Hash(), remote.headers);
+  } catch (const std::exception& exc) {
+    LOG_INFO << "No static delta of ostree commit " << target.Sha256Hash() << " at " << remote.baseUrl
+             << ", pulling its objects; " << exc.what();
+    return boost::none;
+  }
+
+  const auto free_space{repo.getFreeSpace()};
+  LOG_INFO << "Static delta of ostree commit " << target.Sha256Hash() << ": to download: " << delta.size
+           << " bytes, required: " << delta.usize << " bytes, available: " << free_space << " bytes";
+  if (delta.usize > free_space) {
+    return DownloadResult{DownloadResult::Status::DownloadFailed_NoSpace,
+                          "Insufficient storage available; path: " + config.sysroot.string() +
+                              "; required: " + std::to_string(delta.usize) +
+                              ", available: " + std::to_string(free_space),
+                          sysroot_->path()};
+  }
+
+  try {
+    repo.pullDelta(remote.name, target.Sha256Hash(), remote.headers, [&progress_meter, &delta](uint64_t fetched) {
+      progress_meter.update(fetched, "Fetching static delta",
+                            delta.size == 0 ? 100 : static_cast<unsigned int>(std::min(fetched, delta.size) * 100 /
+                                                                               delta.size));
+    });
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to pull static delta from " << remote.baseUrl << ", pulling the commit objects; "
+                << exc.what();
+    return boost::none;
+  }
+  return DownloadResult{DownloadResult::Status::Ok, ""};
+}
+
 void RootfsTreeManager::setRemote(const std::string& name, const std::string& url,
                                   const boost::optional<const KeyManager*>& keys) {
   OSTree::Repo repo{sysroot_->path() + "/ostree/repo"};
 
+  // The objects are fetched from the LAN peers first, and from the remote itself if no peer has them, ostree verifies
+  // each object against the commit hash anyway. Not done for the remotes authorized by a token, e.g. a GCS one,
+  // since the token would be sent to the peers along with the object requests.
+  std::string content_url;
+  if (peer_cache_ && url == gateway_url_) {
+    auto mirrors{peer_cache_->ostreeMirrors()};
+    if (!mirrors.empty()) {
+      mirrors.emplace_back(url);
+      const auto mirrorlist{sysroot_->path() + "/ostree/repo/" + PeerMirrorListFile};
+      Utils::writeFile(mirrorlist, boost::algorithm::join(mirrors, "\n") + "\n");
+      content_url = "mirrorlist=file://" + mirrorlist;
+    }
+  }
+
   if (!!keys) {
-    repo.addRemote(name, url, (*keys)->getCaFile(), (*keys)->getCertFile(), (*keys)->getPkeyFile());
+    repo.addRemote(name, url, (*keys)->getCaFile(), (*keys)->getCertFile(), (*keys)->getPkeyFile(), content_url);
   } else {
-    repo.addRemote(name, url, "", "", "");
+    repo.addRemote(name, url, "", "", "", content_url);
   }
 }
+
+const int RootfsTreeManager::RemoteProbeTtlSec;
+
+void RootfsTreeManager::rankRemotes(std::vector<Remote>& remotes) {
+  const auto now{std::chrono::steady_clock::now()};
+  std::unordered_map<std::string, double> latencies;
+  for (const auto& remote : remotes) {
+    auto rank_it{remote_ranks_.find(remote.baseUrl)};
+    if (rank_it == remote_ranks_.end() ||
+        now - rank_it->second.probed_at >= std::chrono::seconds(RemoteProbeTtlSec)) {
+      remote_ranks_[remote.baseUrl] = {probeRemote(remote), now};
+    }
+    latencies[remote.baseUrl] = remote_ranks_.at(remote.baseUrl).latency_sec;
+  }
+
+  // the original order is kept for remotes of the same latency, e.g. the ones that have failed
+  std::stable_sort(remotes.begin(), remotes.end(), [&latencies](const Remote& lhs, const Remote& rhs) {
+    return latencies.at(lhs.baseUrl) < latencies.at(rhs.baseUrl);
+  });
+
+  for (const auto& remote : remotes) {
+    LOG_INFO << "ostree remote " << remote.baseUrl << ", latency: "
+             << (std::isinf(latencies.at(remote.baseUrl)) ? "unavailable"
+                                                          : std::to_string(latencies.at(remote.baseUrl)) + " sec");
+  }
+}
+
+double RootfsTreeManager::probeRemote(const Remote& remote) const {
+  // a remote with keys is the Device Gateway, it requires the device's TLS credentials configured in `http_client_`
+  std::shared_ptr<HttpInterface> client{http_client_};
+  if (!remote.keys) {
+    std::vector<std::string> headers;
+    for (const auto& header : remote.headers) {
+      headers.emplace_back(header.first + ": " + header.second);
+    }
+    client = std::make_shared<HttpClient>(&headers);
+  }
+
+  const auto started_at{std::chrono::steady_clock::now()};
+  const auto resp{client->get(remote.baseUrl + "/config", RemoteProbeMaxSize)};
+  const std::chrono::duration<double> latency{std::chrono::steady_clock::now() - started_at};
+  if (!resp.isOk()) {
+    LOG_WARNING << "Failed to probe ostree remote " << remote.baseUrl << ": " << resp.getStatusStr();
+    return std::numeric_limits<double>::infinity();
+  }
+  return latency.count();
+}
+
+void RootfsTreeManager::demoteRemote(const Remote& remote) {
+  remote_ranks_[remote.baseUrl] = {std::numeric_limits<double>::infinity(), std::chrono::steady_clock::now()};
+}
@@ -1,11 +1,16 @@
 #ifndef AKTUALIZR_LITE_ROOTFS_TREE_MANAGER_H_
 #define AKTUALIZR_LITE_ROOTFS_TREE_MANAGER_H_
 
+#include <chrono>
+#include <unordered_map>
+
 #include "bootloader/bootloaderlite.h"
 #include "downloader.h"
+#include "downloadprogress.h"
 #include "http/httpinterface.h"
 #include "ostree/sysroot.h"
 #include "package_manager/ostreemanager.h"
+#include "peercache.h"
 
 class RootfsTreeManager : public OstreeManager, public Downloader {
  public:
@@ -24,6 +29,8 @@ class RootfsTreeManager : public OstreeManager, public Downloader {
                     std::shared_ptr<OSTree::Sysroot> sysroot, const KeyManager& keys);
 
   DownloadResult Download(const TufTarget& target) override;
+  // The ostree cost is the size of the static delta of the Target commit, it is unknown if there is no delta
+  UpdateCost EstimateCost(const TufTarget& target) override;
 
   bool fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const KeyManager& keys,
                    const FetcherProgressCb& progress_cb, const api::FlowControlToken* token) override;
@@ -32,15 +39,42 @@ class RootfsTreeManager : public OstreeManager, public Downloader {
   void installNotify(const Uptane::Target& target) override;
   data::InstallationResult install(const Uptane::Target& target) const override;
   const std::shared_ptr<OSTree::Sysroot>& sysroot() const { return sysroot_; }
+  // The LAN peer cache, nullptr unless it is enabled by sota.toml:pacman:peer_cache
+  const PeerCache::Ptr& peerCache() const { return peer_cache_; }
 
  private:
+  // the bootloader env is shared by the bootloader and the boot firmware update status, so they see the same values
+  RootfsTreeManager(const PackageConfig& pconfig, const BootloaderConfig& bconfig,
+                    const std::shared_ptr<INvStorage>& storage, const std::shared_ptr<HttpInterface>& http,
+                    std::shared_ptr<OSTree::Sysroot> sysroot, const KeyManager& keys,
+                    const bootloader::BootloaderEnv::Ptr& boot_env);
+
   std::string getCurrentHash() const override {
     return sysroot_->getDeploymentHash(OSTree::Sysroot::Deployment::kCurrent);
   }
   void getAdditionalRemotes(std::vector<Remote>& remotes, const std::string& target_name);
+  // Pulls the Target commit by means of a static delta. The delta size is fetched before the transfer, so
+  // the lack of storage is detected up front. Returns none if the remote provides no delta of the commit or the delta
+  // pull fails, the commit objects are pulled one by one then.
+  boost::optional<DownloadResult> pullDelta(const Remote& remote, const TufTarget& target,
+                                            DownloadProgressMeter& progress_meter);
 
   void setRemote(const std::string& name, const std::string& url, const boost::optional<const KeyManager*>& keys);
 
+  // Orders the remotes by their latency, the latency is measured once per `RemoteProbeTtlSec` by fetching
+  // a small file, the repo config, from a remote. A remote that has failed a probe or a pull goes to the end.
+  void rankRemotes(std::vector<Remote>& remotes);
+  double probeRemote(const Remote& remote) const;
+  void demoteRemote(const Remote& remote);
+
+  static constexpr const char* const PeerMirrorListFile{"aklite-peer-mirrorlist"};
+  static const int RemoteProbeTtlSec{3600};
+  static const int RemoteProbeMaxSize{16384};
+  struct RemoteRank {
+    double latency_sec;
+    std::chrono::steady_clock::time_point probed_at;
+  };
+
   const KeyManager& keys_;
   std::shared_ptr<OSTree::Sysroot> sysroot_;
   std::unique_ptr<bootloader::BootFwUpdateStatus> boot_fw_update_status_;
@@ -49,6 +83,13 @@ class RootfsTreeManager : public OstreeManager, public Downloader {
   // A flag enabling/disabling ostree update blocking if there is ongoing boot firmware update
   // that requires confirmation by means of reboot.
   bool update_block_{true};
+  // Try remotes in an order of their latency instead of the order they are listed in
+  bool rank_remotes_{false};
+  // Try to pull a static delta of a Target commit before pulling its objects
+  bool prefer_deltas_{false};
+  // remote base URL -> its latency measured recently
+  std::unordered_map<std::string, RemoteRank> remote_ranks_;
+  PeerCache::Ptr peer_cache_;
 };
 
 #endif  // AKTUALIZR_LITE_ROOTFS_TREE_MANAGER_H_
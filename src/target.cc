@@ -43,6 +43,47 @@ Json::Value Target::appsJson(const Uptane::Target& target) {
   return target.custom_data().get(Target::ComposeAppField, Json::Value(Json::nullValue));
 }
 
+std::vector<std::vector<std::string>> Target::appStartOrder(const Uptane::Target& target) {
+  std::vector<std::vector<std::string>> order;
+  const auto order_json{target.custom_data().get(Target::AppStartOrderField, Json::Value(Json::nullValue))};
+  if (order_json.isNull()) {
+    return order;
+  }
+  if (!order_json.isArray()) {
+    LOG_WARNING << "Invalid format of App start order in Target json, the order is ignored: " << order_json;
+    return order;
+  }
+  for (const auto& stage_json : order_json) {
+    std::vector<std::string> stage;
+    if (stage_json.isString()) {
+      // a single App stage can be specified just by the App name
+      stage.push_back(stage_json.asString());
+    } else if (stage_json.isArray()) {
+      for (const auto& app_json : stage_json) {
+        stage.push_back(app_json.isString() ? app_json.asString() : "");
+      }
+    }
+    if (stage.empty() || std::find(stage.begin(), stage.end(), "") != stage.end()) {
+      LOG_WARNING << "Invalid format of App start order in Target json, the order is ignored: " << order_json;
+      return {};
+    }
+    order.push_back(stage);
+  }
+  return order;
+}
+
+int64_t Target::pollingHint(const Uptane::Target& target) {
+  const auto hint_json{target.custom_data().get(Target::PollingHintField, Json::Value(Json::nullValue))};
+  if (hint_json.isNull()) {
+    return 0;
+  }
+  if (!hint_json.isIntegral() || hint_json.asInt64() < 0) {
+    LOG_WARNING << "Invalid format of polling hint in Target json, the hint is ignored: " << hint_json;
+    return 0;
+  }
+  return hint_json.asInt64();
+}
+
 std::string Target::appsStr(const Uptane::Target& target,
                             const boost::optional<std::vector<std::string>>& app_shortlist) {
   std::vector<std::string> apps;
@@ -12,6 +12,8 @@ class Target {
   static constexpr const char* const TagField{"tags"};
   static constexpr const char* const ComposeAppField{"docker_compose_apps"};
   static constexpr const char* const ComposeAppOstreeUri{"compose-apps-uri"};
+  static constexpr const char* const AppStartOrderField{"app_start_order"};
+  static constexpr const char* const PollingHintField{"polling_hint_sec"};
 
   struct Version {
     std::string raw_ver;
@@ -24,6 +26,12 @@ class Target {
   static void setCorrelationID(Uptane::Target& target);
   static std::string ostreeURI(const Uptane::Target& target);
   static Json::Value appsJson(const Uptane::Target& target);
+  // Returns the stages the Target's Apps are to be started in, e.g. `[["db"], ["broker", "ui"]]`, each stage's
+  // Apps are started once all Apps of the previous stages have started. Empty if the Target declares no order.
+  static std::vector<std::vector<std::string>> appStartOrder(const Uptane::Target& target);
+  // Returns the time in seconds to wait before the next check for updates suggested by the server for devices
+  // running or updating to the Target, e.g. during its rollout. Zero if the Target doesn't suggest any.
+  static int64_t pollingHint(const Uptane::Target& target);
   static std::string appsStr(const Uptane::Target& target,
                              const boost::optional<std::vector<std::string>>& app_shortlist = boost::none);
   static void log(const std::string& prefix, const Uptane::Target& target,
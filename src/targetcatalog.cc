@@ -0,0 +1,132 @@
+#include "targetcatalog.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_set>
+
+#include "target.h"
+
+TargetCatalog::TargetCatalog(int version, TargetsPtr targets) : version_{version}, targets_{std::move(targets)} {
+  std::vector<TargetPtr> target_ptrs;
+  target_ptrs.reserve(targets_->size());
+  std::vector<std::string> versions;
+  versions.reserve(targets_->size());
+  for (const auto& t : *targets_) {
+    // aliasing, the Target is owned by the list
+    target_ptrs.emplace_back(targets_, &t);
+    versions.emplace_back(t.custom_version());
+    by_name_.emplace(t.filename(), target_ptrs.back());
+  }
+
+  // Sort by version, the Targets of the same version are ordered so the one listed first in targets.json goes last,
+  // hence it is the first one found when looking for the latest Target, the same as the linear search did
+  std::vector<std::size_t> order(target_ptrs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&versions](std::size_t a, std::size_t b) {
+    const auto cmp{strverscmp(versions[a].c_str(), versions[b].c_str())};
+    return cmp < 0 || (cmp == 0 && a > b);
+  });
+
+  for (const auto i : order) {
+    const auto& target{target_ptrs[i]};
+    for (const auto& hwid : target->hardwareIds()) {
+      auto& hw_targets{by_hwid_[hwid.ToString()]};
+      if (!hw_targets.all.empty() && hw_targets.all.back() == target) {
+        continue;
+      }
+      hw_targets.all.emplace_back(target);
+      const auto tags{target->custom_data()[Target::TagField]};
+      for (Json::ValueConstIterator it = tags.begin(); it != tags.end(); ++it) {
+        auto& tag_targets{hw_targets.by_tag[(*it).asString()]};
+        if (tag_targets.empty() || tag_targets.back() != target) {
+          tag_targets.emplace_back(target);
+        }
+      }
+    }
+  }
+}
+
+TargetCatalog::TargetList TargetCatalog::getTargets(const Uptane::HardwareIdentifier& hwid,
+                                                    const std::vector<std::string>& tags) const {
+  TargetList merged;
+  const auto* list{getList(hwid, tags, merged)};
+  return list == &merged ? merged : *list;
+}
+
+TargetCatalog::TargetPtr TargetCatalog::getLatest(const Uptane::HardwareIdentifier& hwid,
+                                                  const std::vector<std::string>& tags,
+                                                  const TargetFilter& filter) const {
+  TargetList merged;
+  const auto* list{getList(hwid, tags, merged)};
+  for (auto it = list->crbegin(); it != list->crend(); ++it) {
+    if (!filter || filter(**it)) {
+      return *it;
+    }
+  }
+  return nullptr;
+}
+
+TargetCatalog::TargetPtr TargetCatalog::find(const Uptane::HardwareIdentifier& hwid,
+                                             const std::vector<std::string>& tags,
+                                             const std::string& name_or_version, const TargetFilter& filter) const {
+  TargetList merged;
+  const auto* list{getList(hwid, tags, merged)};
+  for (auto it = list->crbegin(); it != list->crend(); ++it) {
+    if (((*it)->filename() == name_or_version || (*it)->custom_version() == name_or_version) &&
+        (!filter || filter(**it))) {
+      return *it;
+    }
+  }
+  return nullptr;
+}
+
+TargetCatalog::TargetPtr TargetCatalog::find(const std::string& name) const {
+  const auto found_it{by_name_.find(name)};
+  return found_it != by_name_.end() ? found_it->second : nullptr;
+}
+
+const TargetCatalog::TargetList* TargetCatalog::getList(const Uptane::HardwareIdentifier& hwid,
+                                                        const std::vector<std::string>& tags,
+                                                        TargetList& merged) const {
+  const auto hw_it{by_hwid_.find(hwid.ToString())};
+  if (hw_it == by_hwid_.end()) {
+    return &merged;
+  }
+  const auto& hw_targets{hw_it->second};
+  if (tags.empty()) {
+    return &hw_targets.all;
+  }
+
+  const TargetList* single{nullptr};
+  std::size_t found_lists{0};
+  for (const auto& tag : tags) {
+    const auto tag_it{hw_targets.by_tag.find(tag)};
+    if (tag_it != hw_targets.by_tag.end() && (found_lists == 0 || single != &tag_it->second)) {
+      single = &tag_it->second;
+      ++found_lists;
+    }
+  }
+  if (found_lists == 0) {
+    return &merged;
+  }
+  if (found_lists == 1) {
+    return single;
+  }
+
+  // A Target may have a few of the given tags, so collect the unique ones in the same order as in the full list
+  std::unordered_set<const Uptane::Target*> tagged;
+  for (const auto& tag : tags) {
+    const auto tag_it{hw_targets.by_tag.find(tag)};
+    if (tag_it != hw_targets.by_tag.end()) {
+      for (const auto& t : tag_it->second) {
+        tagged.emplace(t.get());
+      }
+    }
+  }
+  for (const auto& t : hw_targets.all) {
+    if (tagged.count(t.get()) != 0) {
+      merged.emplace_back(t);
+    }
+  }
+  return &merged;
+}
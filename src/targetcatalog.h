@@ -0,0 +1,57 @@
+#ifndef AKTUALIZR_LITE_TARGET_CATALOG_H_
+#define AKTUALIZR_LITE_TARGET_CATALOG_H_
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "uptane/tuf.h"
+
+// An index of the Targets listed in a given version of targets.json, built once per version.
+// The Targets are indexed by hardware ID and tag and sorted by version (Target::Version). The catalog doesn't copy
+// the Targets, the returned Targets point into and share the ownership of the given list, so they can be held without
+// copying and the list is not released while any of them is in use.
+class TargetCatalog {
+ public:
+  using Ptr = std::shared_ptr<const TargetCatalog>;
+  using TargetPtr = std::shared_ptr<const Uptane::Target>;
+  using TargetList = std::vector<TargetPtr>;
+  using TargetFilter = std::function<bool(const Uptane::Target&)>;
+  using TargetsPtr = std::shared_ptr<const std::vector<Uptane::Target>>;
+
+  TargetCatalog(int version, TargetsPtr targets);
+
+  // The version of targets.json the catalog has been built from
+  int version() const { return version_; }
+  std::size_t size() const { return targets_->size(); }
+  // The Targets of the given hardware ID having any of the given tags, or all of them if no tags are given,
+  // sorted by version in ascending order
+  TargetList getTargets(const Uptane::HardwareIdentifier& hwid, const std::vector<std::string>& tags) const;
+  // The highest version Target matching the given hardware ID and tags as well as the filter, if any
+  TargetPtr getLatest(const Uptane::HardwareIdentifier& hwid, const std::vector<std::string>& tags,
+                      const TargetFilter& filter = nullptr) const;
+  // The Target matching the given hardware ID and tags whose name or version equals to the given one
+  TargetPtr find(const Uptane::HardwareIdentifier& hwid, const std::vector<std::string>& tags,
+                 const std::string& name_or_version, const TargetFilter& filter = nullptr) const;
+  TargetPtr find(const std::string& name) const;
+
+ private:
+  struct HwTargets {
+    TargetList all;
+    std::map<std::string, TargetList> by_tag;
+  };
+
+  const TargetList* getList(const Uptane::HardwareIdentifier& hwid, const std::vector<std::string>& tags,
+                            TargetList& merged) const;
+
+  const int version_;
+  // all Targets in the targets.json order
+  const TargetsPtr targets_;
+  std::unordered_map<std::string, TargetPtr> by_name_;
+  std::unordered_map<std::string, HwTargets> by_hwid_;
+};
+
+#endif  // AKTUALIZR_LITE_TARGET_CATALOG_H_
@@ -0,0 +1,154 @@
+#include "updatetrace.h"
+
+#include <sys/resource.h>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+const std::size_t UpdateTrace::MaxSpans;
+
+UpdateTrace::Span::Span(std::string name, std::string label, bool save_on_end)
+    : name_{std::move(name)},
+      label_{std::move(label)},
+      save_on_end_{save_on_end},
+      start_{std::chrono::system_clock::now()},
+      steady_start_{std::chrono::steady_clock::now()} {}
+
+UpdateTrace::Span::~Span() {
+  const auto duration{
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - steady_start_)};
+  try {
+    auto& trace{UpdateTrace::instance()};
+    trace.add({name_, label_, start_, duration, failed_ || std::uncaught_exception()});
+    if (save_on_end_) {
+      trace.save();
+    }
+  } catch (const std::exception& exc) {
+    LOG_WARNING << "Failed to record the update trace span " << name_ << ": " << exc.what();
+  }
+}
+
+UpdateTrace& UpdateTrace::instance() {
+  static UpdateTrace trace;
+  return trace;
+}
+
+void UpdateTrace::setOutput(boost::filesystem::path json_path, boost::filesystem::path prom_path) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  json_path_ = std::move(json_path);
+  prom_path_ = std::move(prom_path);
+}
+
+void UpdateTrace::add(Record record) {
+  LOG_DEBUG << "Update phase " << record.name << (record.label.empty() ? "" : " (" + record.label + ")") << " took "
+            << record.duration.count() << " ms" << (record.failed ? ", failed" : "");
+  std::lock_guard<std::mutex> lock{mutex_};
+  auto& summary{summary_[record.name]};
+  ++summary.count;
+  if (record.failed) {
+    ++summary.failures;
+  }
+  summary.last_sec = static_cast<double>(record.duration.count()) / 1000;
+  summary.total_sec += summary.last_sec;
+
+  spans_.emplace_back(std::move(record));
+  if (spans_.size() > MaxSpans) {
+    spans_.pop_front();
+  }
+}
+
+Json::Value UpdateTrace::toJson(std::chrono::system_clock::time_point since) const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  Json::Value res{Json::arrayValue};
+  for (const auto& span : spans_) {
+    if (span.start < since) {
+      continue;
+    }
+    Json::Value span_json;
+    span_json["name"] = span.name;
+    if (!span.label.empty()) {
+      span_json["label"] = span.label;
+    }
+    span_json["start_ms"] = Json::Int64(
+        std::chrono::duration_cast<std::chrono::milliseconds>(span.start.time_since_epoch()).count());
+    span_json["duration_ms"] = Json::Int64(span.duration.count());
+    span_json["failed"] = span.failed;
+    res.append(span_json);
+  }
+  return res;
+}
+
+std::string UpdateTrace::toPrometheus() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  std::ostringstream res;
+  const auto write_metric = [this, &res](const std::string& metric, const std::string& type,
+                                         const std::string& help, const std::function<double(const Summary&)>& value) {
+    res << "# HELP " << metric << " " << help << "\n# TYPE " << metric << " " << type << "\n";
+    for (const auto& phase : summary_) {
+      res << metric << "{phase=\"" << phase.first << "\"} " << value(phase.second) << "\n";
+    }
+  };
+  write_metric("aklite_update_phase_runs_total", "counter", "Number of runs of the update phase",
+               [](const Summary& summary) { return summary.count; });
+  write_metric("aklite_update_phase_failures_total", "counter", "Number of failed runs of the update phase",
+               [](const Summary& summary) { return summary.failures; });
+  write_metric("aklite_update_phase_seconds_total", "counter", "Total time spent in the update phase",
+               [](const Summary& summary) { return summary.total_sec; });
+  write_metric("aklite_update_phase_last_seconds", "gauge", "Duration of the last run of the update phase",
+               [](const Summary& summary) { return summary.last_sec; });
+  res << "# HELP aklite_peak_rss_bytes Peak resident set size of the agent\n# TYPE aklite_peak_rss_bytes gauge\n"
+      << "aklite_peak_rss_bytes " << getPeakRss() << "\n";
+  return res.str();
+}
+
+uint64_t UpdateTrace::getPeakRss() {
+  struct rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // in kilobytes on Linux
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+void UpdateTrace::save() const {
+  boost::filesystem::path json_path;
+  boost::filesystem::path prom_path;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    json_path = json_path_;
+    prom_path = prom_path_;
+  }
+  if (!json_path.empty()) {
+    writeFile(json_path, Utils::jsonToStr(toJson()));
+  }
+  if (!prom_path.empty()) {
+    writeFile(prom_path, toPrometheus());
+  }
+}
+
+void UpdateTrace::reset() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  spans_.clear();
+  summary_.clear();
+}
+
+void UpdateTrace::writeFile(const boost::filesystem::path& path, const std::string& content) {
+  // written to a temporary file first and renamed, so the readers, e.g. node exporter, never see a partial file
+  const auto tmp_path{path.string() + ".tmp"};
+  std::ofstream file{tmp_path};
+  file << content;
+  file.close();
+  boost::system::error_code ec;
+  if (!file) {
+    LOG_WARNING << "Failed to write the update trace to " << tmp_path;
+    return;
+  }
+  boost::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    LOG_WARNING << "Failed to write the update trace to " << path << ": " << ec.message();
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef AKTUALIZR_LITE_UPDATE_TRACE_H_
+#define AKTUALIZR_LITE_UPDATE_TRACE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "json/json.h"
+
+// Process-wide trace of where the update cycles spend their time, e.g. check-in, TUF metadata update, ostree pull,
+// Apps fetch, install, finalization. Each phase is recorded as a span. The last `MaxSpans` spans are kept in memory,
+// and if the output paths are set then they are saved on disk as JSON and/or as a Prometheus textfile (node exporter's
+// textfile collector format) each time a top-level phase ends.
+class UpdateTrace {
+ public:
+  static const std::size_t MaxSpans{256};
+
+  struct Record {
+    std::string name;
+    // e.g. the Target or App name
+    std::string label;
+    std::chrono::system_clock::time_point start;
+    std::chrono::milliseconds duration;
+    bool failed;
+  };
+
+  // Records the time from its construction till its destruction. It is considered failed if destroyed by
+  // an exception, or if `setFailed()` is called.
+  class Span {
+   public:
+    explicit Span(std::string name, std::string label = "") : Span(std::move(name), std::move(label), false) {}
+    ~Span();
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+    Span(Span&&) = delete;
+    Span& operator=(Span&&) = delete;
+
+    void setFailed() { failed_ = true; }
+
+   protected:
+    Span(std::string name, std::string label, bool save_on_end);
+
+   private:
+    std::string name_;
+    std::string label_;
+    const bool save_on_end_;
+    std::chrono::system_clock::time_point start_;
+    std::chrono::steady_clock::time_point steady_start_;
+    bool failed_{false};
+  };
+
+  // A top-level span, the trace is saved once it ends
+  class Phase : public Span {
+   public:
+    explicit Phase(std::string name, std::string label = "") : Span(std::move(name), std::move(label), true) {}
+  };
+
+  static UpdateTrace& instance();
+
+  void setOutput(boost::filesystem::path json_path, boost::filesystem::path prom_path);
+  void add(Record record);
+  // The spans started at or after the given time as a JSON array
+  Json::Value toJson(std::chrono::system_clock::time_point since = {}) const;
+  // The count, the total and the last duration of each span name and the peak RSS, in the Prometheus text format
+  std::string toPrometheus() const;
+  // The peak resident set size of the process in bytes
+  static uint64_t getPeakRss();
+  // Writes the trace to the output files, if set, failures are just logged
+  void save() const;
+  void reset();
+
+ private:
+  struct Summary {
+    uint64_t count{0};
+    uint64_t failures{0};
+    double total_sec{0};
+    double last_sec{0};
+  };
+
+  UpdateTrace() = default;
+  static void writeFile(const boost::filesystem::path& path, const std::string& content);
+
+  mutable std::mutex mutex_;
+  std::deque<Record> spans_;
+  std::map<std::string, Summary> summary_;
+  boost::filesystem::path json_path_;
+  boost::filesystem::path prom_path_;
+};
+
+#endif  // AKTUALIZR_LITE_UPDATE_TRACE_H_
@@ -1,15 +1,50 @@
 #include "yaml2json.h"
+
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+
+#include <libfyaml.h>
+
 #include <logging/logging.h>
-#include "utilities/utils.h"
 
-Yaml2Json::Yaml2Json(const std::string& yaml) {
-  std::string cmd = "/usr/bin/fy-tool --mode json " + yaml;
-  std::string data;
-  if (Utils::shell(cmd, &data, true) == EXIT_SUCCESS) {
-    std::istringstream sin(data);
-    sin >> root_;
+using YamlDocumentPtr = std::unique_ptr<fy_document, decltype(&fy_document_destroy)>;
+
+static Json::Value toJson(const YamlDocumentPtr& doc, const std::string& src) {
+  if (!doc) {
+    throw std::runtime_error("Failed to parse YAML " + src);
+  }
+  // resolve anchors, aliases and merge keys, e.g. `<<: *default-service`
+  if (fy_document_resolve(doc.get()) != 0) {
+    throw std::runtime_error("Failed to resolve YAML " + src);
   }
-  if (root_.empty()) {
-    throw std::runtime_error(cmd.c_str());
+
+  Json::Value root;
+  std::unique_ptr<char, decltype(&std::free)> json{fy_emit_document_to_string(doc.get(), FYECF_MODE_JSON), std::free};
+  if (json) {
+    std::istringstream sin(json.get());
+    sin >> root;
   }
+  if (root.empty()) {
+    throw std::runtime_error("Failed to convert YAML " + src + " to JSON");
+  }
+  return root;
+}
+
+Yaml2Json::Yaml2Json(const std::string& yaml) {
+  // parse and convert in-process, the same as `fy-tool --mode json <yaml>` does but with no process fork
+  fy_parse_cfg parse_cfg{};
+  parse_cfg.flags = FYPCF_QUIET;
+  root_ = toJson(YamlDocumentPtr{fy_document_build_from_file(&parse_cfg, yaml.c_str()), fy_document_destroy},
+                 "file: " + yaml);
+}
+
+Yaml2Json Yaml2Json::fromString(const std::string& content) {
+  fy_parse_cfg parse_cfg{};
+  parse_cfg.flags = FYPCF_QUIET;
+  Yaml2Json res;
+  res.root_ = toJson(
+      YamlDocumentPtr{fy_document_build_from_string(&parse_cfg, content.data(), content.size()), fy_document_destroy},
+      "content");
+  return res;
 }
@@ -6,8 +6,15 @@
 
 class Yaml2Json {
  public:
+  // Parses the given YAML file
   explicit Yaml2Json(const std::string& yaml);
+  // Parses the given YAML content
+  static Yaml2Json fromString(const std::string& content);
+
   Json::Value root_;
+
+ private:
+  Yaml2Json() = default;
 };
 
 #endif  // AKTUALIZR_LITE_YAML2JSON_H
@@ -0,0 +1,231 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+#include <boost/format.hpp>
+
+#include "docker/blobindex.h"
+#include "docker/blobrefs.h"
+#include "docker/composeinfo.h"
+#include "docker/docker.h"
+#include "docker/restorableappengine.h"
+#include "logging/logging.h"
+#include "targetcatalog.h"
+#include "utilities/utils.h"
+
+// Micro-benchmarks of the parsing and the App store paths that run for each App at each update cycle.
+// Run `aklite-bench --benchmark_format=json` (or `--benchmark_out=<file>`) to get the machine-readable results,
+// the store benchmarks take the number of blobs in the synthetic store as the argument.
+
+namespace {
+
+const std::string Hash{"b0150d88116219cbf46ebb5dc08d8a559c4f1ab2731a788628fc7375b2372cb0"};
+
+std::string blobHash(int64_t index) { return boost::str(boost::format("%064x") % index); }
+
+// Synthetic App store blob directories, created once per size and shared by the benchmarks
+boost::filesystem::path getBlobStore(int64_t blob_numb) {
+  static std::map<int64_t, std::unique_ptr<TemporaryDirectory>> stores;
+  auto& store{stores[blob_numb]};
+  if (!store) {
+    store.reset(new TemporaryDirectory());
+    for (int64_t ii = 0; ii < blob_numb; ++ii) {
+      Utils::writeFile(store->Path() / blobHash(ii), std::string(static_cast<std::size_t>(ii % 64 + 1), 'b'));
+    }
+  }
+  return store->Path();
+}
+
+// The layers of an App, every other one of them is present in the store of the given size
+Json::Value makeAppLayers(int64_t blob_numb, int64_t layer_numb) {
+  Json::Value layers{Json::arrayValue};
+  for (int64_t ii = 0; ii < layer_numb; ++ii) {
+    const auto index{ii % 2 == 0 && ii / 2 < blob_numb ? ii / 2 : blob_numb + ii};
+    Json::Value layer;
+    layer["digest"] = "sha256:" + blobHash(index);
+    layer["size"] = Json::Int64(1024 * (ii + 1));
+    layers.append(layer);
+  }
+  return layers;
+}
+
+std::string makeComposeFile(int64_t service_numb) {
+  // YAML is a superset of JSON
+  Json::Value compose;
+  compose["version"] = "3.2";
+  for (int64_t ii = 0; ii < service_numb; ++ii) {
+    auto& service{compose["services"]["service-" + std::to_string(ii)]};
+    service["image"] = "hub.foundries.io/factory/image-" + std::to_string(ii) + "@sha256:" + Hash;
+    service["labels"]["io.compose-spec.config-hash"] = Hash;
+    service["restart"] = "unless-stopped";
+  }
+  return Utils::jsonToStr(compose);
+}
+
+Uptane::Target makeTarget(int64_t version, const std::string& hwid, const std::string& tag) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Hash;
+  target_json["length"] = 0;
+  target_json["custom"]["targetFormat"] = "OSTREE";
+  target_json["custom"]["version"] = std::to_string(version);
+  target_json["custom"]["hardwareIds"].append(hwid);
+  target_json["custom"]["tags"].append(tag);
+  return Uptane::Target(hwid + "-lmp-" + std::to_string(version), target_json);
+}
+
+// Targets of two hardware IDs and two tags, as it is usual for a targets.json of a Factory
+TargetCatalog::TargetsPtr makeTargets(int64_t target_numb) {
+  auto targets{std::make_shared<std::vector<Uptane::Target>>()};
+  targets->reserve(static_cast<std::size_t>(target_numb));
+  for (int64_t ii = 0; ii < target_numb; ++ii) {
+    targets->emplace_back(
+        makeTarget(ii, ii % 2 == 0 ? "intel-corei7-64" : "raspberrypi4-64", ii % 4 < 2 ? "main" : "qa"));
+  }
+  return targets;
+}
+
+}  // namespace
+
+static void BM_ParseUri(benchmark::State& state) {
+  const std::string uri{"hub.foundries.io/factory/app@sha256:" + Hash};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Docker::Uri::parseUri(uri));
+  }
+}
+BENCHMARK(BM_ParseUri);
+
+static void BM_HashedDigest(benchmark::State& state) {
+  const std::string digest{"sha256:" + Hash};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Docker::HashedDigest(digest));
+  }
+}
+BENCHMARK(BM_HashedDigest);
+
+static void BM_Manifest(benchmark::State& state) {
+  Json::Value manifest_json;
+  manifest_json["annotations"]["compose-app"] = Docker::Manifest::Version;
+  manifest_json["layers"][0]["digest"] = "sha256:" + Hash;
+  manifest_json["layers"][0]["size"] = 4096;
+  for (const auto& arch : {"amd64", "arm", "arm64", "riscv64"}) {
+    Json::Value layers_manifest;
+    layers_manifest["digest"] = "sha256:" + Hash;
+    layers_manifest["size"] = 1024;
+    layers_manifest["platform"]["architecture"] = arch;
+    manifest_json["manifests"].append(layers_manifest);
+  }
+  const auto manifest_str{Utils::jsonToStr(manifest_json)};
+  for (auto _ : state) {
+    const Docker::Manifest manifest{manifest_str};
+    benchmark::DoNotOptimize(manifest.archiveDigest());
+    benchmark::DoNotOptimize(manifest.archiveSize());
+    benchmark::DoNotOptimize(manifest.layersManifest("riscv64"));
+  }
+}
+BENCHMARK(BM_Manifest);
+
+static void BM_ComposeInfo(benchmark::State& state) {
+  const auto compose{makeComposeFile(state.range(0))};
+  for (auto _ : state) {
+    const Docker::ComposeInfo compose_info{Yaml2Json::fromString(compose)};
+    benchmark::DoNotOptimize(compose_info.services());
+  }
+}
+BENCHMARK(BM_ComposeInfo)->Arg(1)->Arg(10)->Arg(50);
+
+namespace Docker {
+class RestorableAppEngineBench {
+ public:
+  static BlobIndex::BlobSize getAppUpdateSize(const Json::Value& app_layers, const BlobIndex& blob_index,
+                                              std::unordered_map<std::string, BlobIndex::BlobSize>& missing_blobs) {
+    return RestorableAppEngine::getAppUpdateSize(app_layers, blob_index, missing_blobs);
+  }
+};
+}  // namespace Docker
+
+static void BM_AppUpdateSize(benchmark::State& state) {
+  const Docker::BlobIndex blob_index{getBlobStore(state.range(0))};
+  const auto layers{makeAppLayers(state.range(0), 64)};
+  for (auto _ : state) {
+    std::unordered_map<std::string, Docker::BlobIndex::BlobSize> missing_blobs;
+    benchmark::DoNotOptimize(Docker::RestorableAppEngineBench::getAppUpdateSize(layers, blob_index, missing_blobs));
+  }
+}
+BENCHMARK(BM_AppUpdateSize)->Arg(10)->Arg(1000)->Arg(10000);
+
+// The full store scan, done once per process and each time the index is invalidated
+static void BM_BlobIndexBuild(benchmark::State& state) {
+  Docker::BlobIndex blob_index{getBlobStore(state.range(0))};
+  for (auto _ : state) {
+    blob_index.invalidate();
+    benchmark::DoNotOptimize(blob_index.isPresent(Hash));
+  }
+}
+BENCHMARK(BM_BlobIndexBuild)->Arg(10)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// The bookkeeping of an incremental prune, an App version is dropped and another one is recorded, each of ten App
+// versions references a tenth of the store blobs and shares half of them with the next version
+static void BM_Prune(benchmark::State& state) {
+  const auto blob_numb{state.range(0)};
+  const int64_t owner_numb{10};
+  const auto owner_blob_numb{std::max<int64_t>(blob_numb / owner_numb, 1)};
+  const auto make_refs = [&](int64_t owner) {
+    Docker::BlobRefs::Refs refs;
+    for (int64_t ii = 0; ii < owner_blob_numb; ++ii) {
+      refs.blobs.emplace(blobHash((owner * owner_blob_numb + ii / 2 * 2) % blob_numb + ii % 2));
+    }
+    refs.manifests.emplace(blobHash(owner));
+    return refs;
+  };
+  TemporaryDirectory dir;
+  Docker::BlobRefs blob_refs{dir / "blob-refs.json"};
+  for (int64_t ii = 0; ii < owner_numb; ++ii) {
+    blob_refs.add("app/" + std::to_string(ii), make_refs(ii));
+  }
+  blob_refs.setComplete();
+  int64_t owner{0};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(blob_refs.remove("app/" + std::to_string(owner % owner_numb)));
+    blob_refs.add("app/" + std::to_string(owner % owner_numb), make_refs(owner));
+    blob_refs.flush();
+    ++owner;
+  }
+}
+BENCHMARK(BM_Prune)->Arg(10)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// The catalog is built each time a new targets.json is received
+static void BM_TargetCatalogBuild(benchmark::State& state) {
+  const auto targets{makeTargets(state.range(0))};
+  for (auto _ : state) {
+    const TargetCatalog catalog{1, targets};
+    benchmark::DoNotOptimize(catalog.size());
+  }
+}
+BENCHMARK(BM_TargetCatalogBuild)->Arg(10)->Arg(1000)->Arg(10000)->Unit(benchmark::kMicrosecond);
+
+// What `aklite update <version>` does to find the Target to install
+static void BM_FindTarget(benchmark::State& state) {
+  const auto target_numb{state.range(0)};
+  const TargetCatalog catalog{1, makeTargets(target_numb)};
+  const Uptane::HardwareIdentifier hwid{"intel-corei7-64"};
+  const std::string version{std::to_string(target_numb / 2 / 4 * 4)};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(catalog.find(hwid, {"main"}, version));
+    benchmark::DoNotOptimize(catalog.getLatest(hwid, {"main"}));
+  }
+}
+BENCHMARK(BM_FindTarget)->Arg(10)->Arg(1000)->Arg(10000);
+
+int main(int argc, char** argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::error);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return EXIT_FAILURE;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return EXIT_SUCCESS;
+}
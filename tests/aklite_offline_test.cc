@@ -10,6 +10,7 @@
 #include "composeappmanager.h"
 #include "docker/restorableappengine.h"
 #include "liteclient.h"
+#include "offline/bundleindex.h"
 #include "offline/client.h"
 #include "target.h"
 
@@ -271,6 +272,72 @@ TEST_F(AkliteOffline, OfflineClientOstreeOnly) {
   ASSERT_NO_THROW(offline::client::run(cfg_, daemon_.getClient()));
 }
 
+TEST_F(AkliteOffline, OfflineClientInvalidBundle) {
+  const auto layer_size{1024};
+  Json::Value layers;
+  layers["layers"][0]["digest"] =
+      "sha256:" + boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+  layers["layers"][0]["size"] = layer_size;
+
+  const auto compose_app{fixtures::ComposeApp::createAppWithCustomeLayers("app-01", layers)};
+  const auto app01{app_store_.addApp(compose_app)};
+  const std::vector<AppEngine::App> apps{app01};
+  addTarget(&apps);
+
+  // alter the App archive in the bundle
+  Utils::writeFile(app_store_.blobsDir() / "sha256" / compose_app->archHash(), std::string("broken archive"));
+  offline::UpdateSrc src{tuf_repo_.getRepoPath(), ostree_repo_.getPath(), app_store_.dir(), ""};
+
+  // the bundle is rejected before anything is installed, and the verification result is reused by the next attempt
+  for (int ii = 0; ii < 2; ++ii) {
+    ASSERT_THROW(offline::client::install(cfg_, src, daemon_.getClient()), std::runtime_error);
+    ASSERT_FALSE(boost::filesystem::exists(getSentinelFilePath()));
+    ASSERT_FALSE(boost::filesystem::exists(test_dir_.Path() / "reset-apps" / "apps" / app01.name));
+  }
+  const auto index_json{Utils::parseJSONFile(app_store_.dir() / offline::BundleIndex::Filename)};
+  ASSERT_GT(index_json["verification"]["errors"].size(), 0U);
+}
+
+TEST_F(AkliteOffline, BundleIndex) {
+  Json::Value layers;
+  layers["layers"][0]["digest"] =
+      "sha256:" + boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+  layers["layers"][0]["size"] = 1024;
+
+  const auto app01{app_store_.addApp(fixtures::ComposeApp::createAppWithCustomeLayers("app-01", layers))};
+  const std::vector<AppEngine::App> apps{app01};
+  const auto target{addTarget(&apps)};
+
+  const auto index_file{app_store_.dir() / offline::BundleIndex::Filename};
+  const std::string fake_uri{"hub.foundries.io/factory/app-02@sha256:" + std::string(64, 'a')};
+  {
+    const auto index{offline::BundleIndex::load(ostree_repo_.getPath(), app_store_.dir())};
+    ASSERT_TRUE(index.hasOstreeCommit(target.sha256Hash()));
+    ASSERT_TRUE(index.hasApp(app01.uri));
+    ASSERT_FALSE(index.hasApp(fake_uri));
+    ASSERT_TRUE(boost::filesystem::exists(index_file));
+  }
+  {
+    // the stored index is reused as long as the bundle dirs are intact, so the bundle is not scanned again
+    auto index_json{Utils::parseJSONFile(index_file)};
+    index_json["apps"][fake_uri] = "apps/app-02/" + std::string(64, 'a');
+    Utils::writeFile(index_file, index_json);
+    const auto index{offline::BundleIndex::load(ostree_repo_.getPath(), app_store_.dir())};
+    ASSERT_TRUE(index.hasApp(fake_uri));
+    ASSERT_TRUE(index.hasApp(app01.uri));
+  }
+  {
+    // a new App makes the index stale, so the bundle is rescanned
+    const auto app03{app_store_.addApp(fixtures::ComposeApp::createAppWithCustomeLayers("app-03", layers))};
+    const auto index{offline::BundleIndex::load(ostree_repo_.getPath(), app_store_.dir())};
+    ASSERT_TRUE(index.hasApp(app01.uri));
+    ASSERT_TRUE(index.hasApp(app03.uri));
+    ASSERT_FALSE(index.hasApp(fake_uri));
+    ASSERT_EQ(2U, index.apps().size());
+    ASSERT_TRUE(index.hasOstreeCommit(target.sha256Hash()));
+  }
+}
+
 int main(int argc, char** argv) {
   if (argc != 2) {
     std::cerr << argv[0] << " invalid arguments\n";
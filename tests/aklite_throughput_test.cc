@@ -0,0 +1,189 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/process.hpp>
+#include <boost/process/env.hpp>
+
+#include "test_utils.h"
+#include "utilities/utils.h"
+
+#include "composeappmanager.h"
+#include "docker/restorableappengine.h"
+#include "liteclient.h"
+#include "target.h"
+#include "updatetrace.h"
+#include "uptane_generator/image_repo.h"
+
+#include "fixtures/aklitetest.cc"
+
+/**
+ * End-to-end update throughput harness.
+ *
+ * Runs a full update, an ostree and Apps update followed by a reboot and finalization, against the fake Device
+ * Gateway, Registry and docker daemon, and reports the wall time of the download, install and finalize phases, the
+ * update phase spans and the peak RSS of the agent and of the utilities it runs. It is not run by ctest, the
+ * workload, the network conditions and the agent configuration are set by the environment variables:
+ *  AKLITE_THROUGHPUT_APPS           - the number of Apps in the Target, 4 by default;
+ *  AKLITE_THROUGHPUT_IMAGES         - the number of images of each App, 2 by default;
+ *  AKLITE_THROUGHPUT_LAYER_SIZE     - the layer size of each image in bytes, 1MB by default;
+ *  AKLITE_THROUGHPUT_LATENCY_MS     - the latency of each Registry request;
+ *  AKLITE_THROUGHPUT_BANDWIDTH_KBPS - the bandwidth cap of each Registry connection in KB/s;
+ *  AKLITE_THROUGHPUT_LOSS_PERCENT   - the share of Registry requests that are dropped;
+ *  AKLITE_THROUGHPUT_CONFIG         - sota.toml:pacman options, e.g. "fetch_concurrency=4,image_pull_concurrency=8";
+ *  AKLITE_THROUGHPUT_REPORT         - the file to store the results in as JSON, in addition to stdout.
+ */
+
+namespace {
+
+int64_t getEnvInt(const char* name, int64_t def_val) {
+  const char* val{std::getenv(name)};
+  return val == nullptr ? def_val : std::stoll(val);
+}
+
+double getEnvDouble(const char* name, double def_val) {
+  const char* val{std::getenv(name)};
+  return val == nullptr ? def_val : std::stod(val);
+}
+
+std::string getEnvStr(const char* name) {
+  const char* val{std::getenv(name)};
+  return val == nullptr ? "" : val;
+}
+
+// The peak RSS in KB of the process itself and of the largest of its terminated children
+Json::Value getPeakRss() {
+  Json::Value res;
+  struct rusage usage {};
+  getrusage(RUSAGE_SELF, &usage);
+  res["agent_kb"] = Json::Int64(usage.ru_maxrss);
+  getrusage(RUSAGE_CHILDREN, &usage);
+  res["children_kb"] = Json::Int64(usage.ru_maxrss);
+  return res;
+}
+
+class PhaseTimer {
+ public:
+  explicit PhaseTimer(Json::Value& phases) : phases_{phases} {}
+  void start(const std::string& phase) {
+    phase_ = phase;
+    started_at_ = std::chrono::steady_clock::now();
+  }
+  void stop() {
+    const auto duration{std::chrono::steady_clock::now() - started_at_};
+    phases_[phase_] = Json::Int64(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+  }
+
+ private:
+  Json::Value& phases_;
+  std::string phase_;
+  std::chrono::steady_clock::time_point started_at_;
+};
+
+}  // namespace
+
+class AkliteThroughputTest : public AkliteTest {
+ protected:
+  void tweakConf(Config& conf) override {
+    std::vector<std::string> options;
+    const auto config{getEnvStr("AKLITE_THROUGHPUT_CONFIG")};
+    if (config.empty()) {
+      return;
+    }
+    boost::split(options, config, boost::is_any_of(","), boost::token_compress_on);
+    for (const auto& option : options) {
+      const auto pos{option.find('=')};
+      if (pos == std::string::npos) {
+        throw std::invalid_argument("Invalid AKLITE_THROUGHPUT_CONFIG option, expected <key>=<value>, got " + option);
+      }
+      conf.pacman.extra[boost::trim_copy(option.substr(0, pos))] = boost::trim_copy(option.substr(pos + 1));
+    }
+  }
+};
+
+TEST_P(AkliteThroughputTest, Update) {
+  const auto app_numb{getEnvInt("AKLITE_THROUGHPUT_APPS", 4)};
+  const auto image_numb{getEnvInt("AKLITE_THROUGHPUT_IMAGES", 2)};
+  const auto layer_size{getEnvInt("AKLITE_THROUGHPUT_LAYER_SIZE", 1024 * 1024)};
+
+  Json::Value report;
+  report["workload"]["apps"] = Json::Int64(app_numb);
+  report["workload"]["images_per_app"] = Json::Int64(image_numb);
+  report["workload"]["layer_size"] = Json::Int64(layer_size);
+  report["network"]["latency_ms"] = fixtures::DockerRegistry::Network.latency_ms;
+  report["network"]["bandwidth_kbps"] = fixtures::DockerRegistry::Network.bandwidth_kbps;
+  report["network"]["loss_percent"] = fixtures::DockerRegistry::Network.loss_percent;
+  report["config"] = getEnvStr("AKLITE_THROUGHPUT_CONFIG");
+
+  std::vector<AppEngine::App> apps;
+  for (int64_t ii = 0; ii < app_numb; ++ii) {
+    apps.emplace_back(registry.addApp(fixtures::ComposeApp::createWithImages(
+        boost::str(boost::format("app-%02d") % ii), static_cast<std::size_t>(image_numb),
+        static_cast<std::size_t>(layer_size))));
+  }
+
+  auto client = createLiteClient();
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), getInitialTarget()));
+  const auto target{createTarget(&apps)};
+  UpdateTrace::instance().reset();
+
+  PhaseTimer timer{report["phases_ms"]};
+  timer.start("check");
+  ASSERT_TRUE(client->checkForUpdatesBegin());
+  timer.stop();
+
+  timer.start("download");
+  const auto download_res{client->download(target, "throughput test")};
+  timer.stop();
+  ASSERT_TRUE(download_res) << download_res.description;
+
+  timer.start("install");
+  ASSERT_EQ(data::ResultCode::Numeric::kNeedCompletion, client->install(target));
+  timer.stop();
+
+  // includes the agent start after the reboot
+  timer.start("finalize");
+  reboot(client);
+  timer.stop();
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), target));
+  for (const auto& app : apps) {
+    ASSERT_TRUE(app_engine->isRunning(app));
+  }
+
+  report["peak_rss"] = getPeakRss();
+  report["spans"] = UpdateTrace::instance().toJson();
+
+  std::cout << Utils::jsonToStr(report) << std::endl;
+  const auto report_file{getEnvStr("AKLITE_THROUGHPUT_REPORT")};
+  if (!report_file.empty()) {
+    Utils::writeFile(report_file, Utils::jsonToStr(report));
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(MultiEngine, AkliteThroughputTest, ::testing::Values("RestorableAppEngine"));
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    std::cerr << argv[0] << " invalid arguments\n";
+    return EXIT_FAILURE;
+  }
+
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+
+  // options passed as args in CMakeLists.txt
+  fixtures::DeviceGatewayMock::RunCmd = argv[1];
+  fixtures::SysRootFS::CreateCmd = argv[2];
+  // must be set before the fake Registry is started
+  fixtures::DockerRegistry::Network.latency_ms = static_cast<int>(getEnvInt("AKLITE_THROUGHPUT_LATENCY_MS", 0));
+  fixtures::DockerRegistry::Network.bandwidth_kbps = static_cast<int>(getEnvInt("AKLITE_THROUGHPUT_BANDWIDTH_KBPS", 0));
+  fixtures::DockerRegistry::Network.loss_percent = getEnvDouble("AKLITE_THROUGHPUT_LOSS_PERCENT", 0);
+  return RUN_ALL_TESTS();
+}
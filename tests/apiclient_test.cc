@@ -1,6 +1,8 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
+
 #include <boost/filesystem.hpp>
 #include <boost/process.hpp>
 #include <boost/process/env.hpp>
@@ -121,6 +123,60 @@ TEST_F(ApiClientTest, CheckIn) {
   ASSERT_EQ(new_target.sha256Hash(), result.Targets()[0].Sha256Hash());
 }
 
+TEST_F(ApiClientTest, CheckInTargetsOrder) {
+  AkliteClient client(createLiteClient());
+
+  // the Targets are sorted by version, the ones of the same version are listed in the order of the TUF metadata
+  getTufRepo().addTarget("target-b", std::string(64, 'b'), hw_id, "2");
+  getTufRepo().addTarget("target-a", std::string(64, 'a'), hw_id, "2");
+  auto result = client.CheckIn();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+  ASSERT_EQ(3, result.Targets().size());
+  ASSERT_EQ(getInitialTarget().filename(), result.Targets()[0].Name());
+  ASSERT_EQ("target-a", result.Targets()[1].Name());
+  ASSERT_EQ("target-b", result.Targets()[2].Name());
+}
+
+TEST_F(ApiClientTest, CheckForUpdate) {
+  AkliteClient client(createLiteClient());
+
+  auto result = client.CheckForUpdate();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+  ASSERT_FALSE(result.update_available);
+
+  auto new_target = createTarget();
+  result = client.CheckForUpdate();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+  ASSERT_TRUE(result.update_available);
+  ASSERT_EQ(new_target.filename(), result.latest.Name());
+  ASSERT_EQ(new_target.filename(), client.CheckIn().GetLatest().Name());
+}
+
+TEST_F(ApiClientTest, CheckForUpdateNotNewer) {
+  auto liteclient = createLiteClient();
+  AkliteClient client(liteclient);
+
+  // a Target of the current version is not an update even if its content differs
+  getTufRepo().addTarget("rebuild-1", std::string(64, 'a'), hw_id, getInitialTarget().custom_version());
+  auto result = client.CheckForUpdate();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+  ASSERT_EQ("rebuild-1", result.latest.Name());
+  ASSERT_FALSE(result.update_available);
+
+  // neither is an older Target, e.g. the latest one of a tag the device has been moved to
+  Json::Value custom;
+  custom["targetFormat"] = "OSTREE";
+  custom["version"] = "0";
+  custom["tags"][0] = "devel";
+  getTufRepo().repo().addCustomImage("devel-0", Hash{Hash::Type::kSha256, std::string(64, 'b')}, 0, hw_id, "", 0,
+                                     Delegation{}, custom);
+  liteclient->tags = {"devel"};
+  result = client.CheckForUpdate();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+  ASSERT_EQ("devel-0", result.latest.Name());
+  ASSERT_FALSE(result.update_available);
+}
+
 TEST_F(ApiClientTest, Rollback) {
   auto liteclient = createLiteClient();
   ASSERT_TRUE(targetsMatch(liteclient->getCurrent(), getInitialTarget()));
@@ -168,6 +224,65 @@ TEST_F(ApiClientTest, Install) {
   ASSERT_EQ(InstallResult::Status::NeedsCompletion, iresult.status);
 }
 
+TEST_F(ApiClientTest, EstimateUpdateCost) {
+  auto liteclient = createLiteClient();
+  auto new_target = createTarget();
+
+  AkliteClient client(liteclient);
+  auto result = client.CheckIn();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+  auto latest = result.GetLatest();
+
+  // the commit is not pulled yet and the repo provides no static delta of it, so its size is unknown
+  auto cost = client.EstimateUpdateCost(latest);
+  ASSERT_TRUE(cost) << cost.description;
+  ASSERT_FALSE(cost.exact);
+  ASSERT_FALSE(cost.noSpace());
+  ASSERT_EQ(0, cost.download());
+
+  auto installer = client.Installer(latest);
+  ASSERT_NE(nullptr, installer);
+  ASSERT_EQ(DownloadResult::Status::Ok, installer->Download().status);
+  // nothing is left to download
+  cost = client.EstimateUpdateCost(latest);
+  ASSERT_TRUE(cost) << cost.description;
+  ASSERT_TRUE(cost.exact);
+  ASSERT_EQ(0, cost.download());
+
+  ASSERT_FALSE(client.EstimateUpdateCost(TufTarget("unknown-target", "", 0, Json::Value())));
+}
+
+TEST_F(ApiClientTest, InstallAsync) {
+  auto liteclient = createLiteClient();
+  ASSERT_TRUE(targetsMatch(liteclient->getCurrent(), getInitialTarget()));
+
+  // Create a new Target: update rootfs and commit it into Treehub's repo
+  auto new_target = createTarget();
+
+  AkliteClient client(liteclient);
+  auto result = client.CheckIn();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+
+  auto installer = client.Installer(result.GetLatest());
+  ASSERT_NE(nullptr, installer);
+
+  // a cancelled download stops before fetching anything
+  auto token{std::make_shared<CancellationToken>()};
+  ASSERT_TRUE(token->Cancel());
+  ASSERT_EQ(DownloadResult::Status::DownloadFailed, installer->DownloadAsync(nullptr, token).get().status);
+  ASSERT_EQ(InstallResult::Status::Failed, installer->InstallAsync(token).get().status);
+
+  bool completed{false};
+  auto dresult = installer->DownloadAsync([&completed](const DownloadProgress& progress) {
+                           completed = completed || progress.completed;
+                         }).get();
+  ASSERT_EQ(DownloadResult::Status::Ok, dresult.status);
+  ASSERT_TRUE(completed);
+
+  auto iresult = installer->InstallAsync().get();
+  ASSERT_EQ(InstallResult::Status::NeedsCompletion, iresult.status);
+}
+
 TEST_F(ApiClientTest, InstallWithCorrelationId) {
   auto liteclient = createLiteClient();
   ASSERT_TRUE(targetsMatch(liteclient->getCurrent(), getInitialTarget()));
@@ -217,6 +332,38 @@ TEST_F(ApiClientTest, Secondaries) {
   ASSERT_EQ(secondary_target.filename(), result.GetLatest("riscv").Name());
 }
 
+TEST_F(ApiClientTest, UpdateSecondaries) {
+  auto liteclient = createLiteClient();
+  auto new_target = createTarget();
+  AkliteClient client(liteclient);
+  auto result = client.CheckIn();
+  ASSERT_EQ(CheckInResult::Status::Ok, result.status);
+  auto installer = client.Installer(result.GetLatest());
+  ASSERT_NE(nullptr, installer);
+
+  // the secondary Target is not listed in the TUF metadata, so each download fails and no ECU is flashed
+  const std::string hash{"b0150d88116219cbf46ebb5dc08d8a559c4f1ab2731a788628fc7375b2372cb0"};
+  std::atomic<int> finished{0};
+  std::vector<SecondaryUpdate> updates;
+  for (const auto& serial : {"ecu-1", "ecu-2", "ecu-3"}) {
+    updates.emplace_back(
+        SecondaryEcu{serial, "riscv", "riscv-target-1"},
+        TufTarget{"riscv-target-1", hash, 1, Json::Value()},
+        [](const char*, std::size_t) { return true; },
+        [&finished](const SecondaryEcu&) {
+          ++finished;
+          return InstallResult{InstallResult::Status::Ok, ""};
+        });
+  }
+  const auto results{installer->UpdateSecondaries(updates, 2)};
+  ASSERT_EQ(updates.size(), results.size());
+  for (std::size_t ii = 0; ii < updates.size(); ++ii) {
+    ASSERT_EQ(updates[ii].ecu.serial, results[ii].serial);
+    ASSERT_EQ(DownloadResult::Status::DownloadFailed, results[ii].download.status);
+  }
+  ASSERT_EQ(0, finished);
+}
+
 TEST_F(ApiClientTest, SwitchTag) {
   auto liteclient = createLiteClient();
   ASSERT_TRUE(targetsMatch(liteclient->getCurrent(), getInitialTarget()));
@@ -177,6 +177,66 @@ TEST(ComposeApp, Config) {
   config.pacman.extra["storage_watermark"] = "50";
   cfg = ComposeAppManager::Config(config.pacman);
   ASSERT_EQ(cfg.storage_watermark, 50);
+
+  ASSERT_EQ(cfg.fetch_concurrency, 1);
+  config.pacman.extra["fetch_concurrency"] = "foobar";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+
+  config.pacman.extra["fetch_concurrency"] = "0";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+
+  config.pacman.extra["fetch_concurrency"] = "4";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.fetch_concurrency, 4);
+
+  ASSERT_EQ(cfg.image_puller, "skopeo");
+  config.pacman.extra["image_puller"] = "foobar";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["image_puller"] = "native";
+  config.pacman.extra["image_pull_concurrency"] = "8";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.image_puller, "native");
+  ASSERT_EQ(cfg.image_pull_concurrency, 8);
+
+  ASSERT_EQ(cfg.app_start_concurrency, 1);
+  ASSERT_TRUE(cfg.app_start_order.empty());
+  config.pacman.extra["app_start_concurrency"] = "0";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["app_start_concurrency"] = "3";
+  config.pacman.extra["app_start_order"] = "db; broker, ui;";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.app_start_concurrency, 3);
+  ASSERT_EQ(cfg.app_start_order, (std::vector<std::vector<std::string>>{{"db"}, {"broker", "ui"}}));
+
+  ASSERT_EQ(cfg.app_stop_concurrency, 1);
+  config.pacman.extra["app_stop_concurrency"] = "foobar";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["app_stop_concurrency"] = "4";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.app_stop_concurrency, 4);
+
+  ASSERT_EQ(cfg.apps_audit_interval, 0);
+  config.pacman.extra["apps_audit_interval"] = "-1";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["apps_audit_interval"] = "3600";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.apps_audit_interval, 3600);
+
+  // the memory budget limits the number of concurrent blob downloads
+  ASSERT_EQ(cfg.memory_budget, 0);
+  config.pacman.extra["memory_budget"] = "foobar";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["memory_budget"] = "-1";
+  EXPECT_THROW(ComposeAppManager::Config(config.pacman), std::invalid_argument);
+  config.pacman.extra["memory_budget"] = "64";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.memory_budget, 64);
+  ASSERT_EQ(cfg.fetch_concurrency, 4);
+  ASSERT_EQ(cfg.image_pull_concurrency, 4);
+  config.pacman.extra["memory_budget"] = "8";
+  cfg = ComposeAppManager::Config(config.pacman);
+  ASSERT_EQ(cfg.fetch_concurrency, 2);
+  ASSERT_EQ(cfg.image_pull_concurrency, 1);
 }
 
 class TestSysroot: public OSTree::Sysroot {
@@ -216,6 +276,7 @@ struct TestClient {
       config.pacman.extra["compose_apps"] = apps;
     }
     config.pacman.extra["compose_apps_tree"] = (tempdir->Path() / "apps-tree").string();
+    config.pacman.extra["docker_stop_cmd"] = "/bin/true";
     config.pacman.extra["docker_images_reload_cmd"] = "/bin/true";
     config.pacman.extra["docker_compose_bin"] = "tests/compose_fake.sh";
     boost::filesystem::copy("tests/docker_fake.sh", tempdir->Path() / "docker_fake.sh");
@@ -1028,6 +1089,33 @@ TEST(ComposeApp, AppsStateComparison) {
    }
 }
 
+TEST(ComposeApp, AppsStateDelta) {
+  Json::Value base;
+  base["ostree"] = "hash-01";
+  base["apps"]["app-01"]["state"] = "healthy";
+  base["apps"]["app-01"]["uri"] = "uri-01";
+  base["apps"]["app-02"]["state"] = "healthy";
+  base["apps"]["app-03"]["state"] = "healthy";
+
+  Json::Value state{base};
+  state["deviceTime"] = "now";
+  state["apps"]["app-02"]["state"] = "unhealthy";
+  state["apps"].removeMember("app-03");
+  state["apps"]["app-04"]["state"] = "healthy";
+
+  const auto delta{ComposeAppManager::getAppsStateDelta(base, state)};
+  ASSERT_TRUE(delta["delta"].asBool());
+  ASSERT_EQ("now", delta["deviceTime"].asString());
+  ASSERT_EQ("hash-01", delta["ostree"].asString());
+  ASSERT_EQ((std::vector<std::string>{"app-02", "app-04"}), delta["apps"].getMemberNames());
+  ASSERT_EQ("unhealthy", delta["apps"]["app-02"]["state"].asString());
+  ASSERT_EQ(1, delta["removed_apps"].size());
+  ASSERT_EQ("app-03", delta["removed_apps"][0].asString());
+
+  // no changes
+  ASSERT_TRUE(ComposeAppManager::getAppsStateDelta(base, base)["apps"].empty());
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <iostream>
+#include <thread>
 #include <unordered_set>
 
 #include <boost/filesystem.hpp>
@@ -9,6 +10,9 @@
 #include "crypto/crypto.h"
 #include "test_utils.h"
 
+#ifdef BUILD_AKLITE_WITH_NERDCTL
+#include "containerd/engine.h"
+#endif
 #include "docker/composeappengine.h"
 #include "logging/logging.h"
 
@@ -50,6 +54,22 @@ TEST_F(ComposeAppEngineTest, FetchIfInvalidAuth) {
   registry.setAuthFunc(nullptr);
 }
 
+TEST_F(ComposeAppEngineTest, FetchWithImagePullPerImage) {
+  auto engine{std::make_shared<Docker::ComposeAppEngine>(apps_root_dir, compose_cmd, docker_client_, registry_client_)};
+  engine->setImagePull(2, 0);
+  auto app = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  ASSERT_TRUE(engine->fetch(app));
+  ASSERT_TRUE(engine->install(app));
+
+  // the failed image is reported
+  daemon_.setImagePullFailFlag(true);
+  auto app_02 = registry.addApp(fixtures::ComposeApp::create("app-02"));
+  const auto res{engine->fetch(app_02)};
+  daemon_.setImagePullFailFlag(false);
+  ASSERT_TRUE(res.imagePullFailure());
+  ASSERT_TRUE(boost::starts_with(res.err, "failed to pull App image ")) << res.err;
+}
+
 TEST_F(ComposeAppEngineTest, FetchAndInstall) {
   auto app = registry.addApp(fixtures::ComposeApp::create("app-01"));
   ASSERT_TRUE(app_engine->fetch(app));
@@ -111,6 +131,52 @@ TEST_F(ComposeAppEngineTest, FetchRunCompare) {
   ASSERT_EQ(apps_info["app-02"]["services"][0]["image"].asString(), app->image().uri());
 }
 
+#ifdef BUILD_AKLITE_WITH_NERDCTL
+TEST_F(ComposeAppEngineTest, ContainerdLazyPull) {
+  // a fake nerdctl, it logs its arguments and runs the fake compose
+  const auto nerdctl{test_dir_.Path() / "nerdctl"};
+  const auto nerdctl_log{test_dir_.Path() / "nerdctl.log"};
+  Utils::writeFile(nerdctl, "#!/bin/bash\n"
+                            "echo \"$@\" >> " + nerdctl_log.string() + "\n"
+                            "[ \"$1\" = \"--snapshotter=stargz\" ] && shift\n"
+                            "[ \"$1\" = \"compose\" ] || exit 0\n"
+                            "shift\n"
+                            "[ \"$1\" = \"--project-directory\" ] && cd \"$2\" && shift 2\n"
+                            "exec " + compose_cmd + " \"$@\"\n");
+  boost::filesystem::permissions(nerdctl, boost::filesystem::owner_all);
+
+  auto compose_app{fixtures::ComposeApp::create("app-01")};
+  const auto app{registry.addApp(compose_app)};
+  const std::string background_pull{"--snapshotter=stargz pull --unpack=false " + compose_app->image().uri()};
+  {
+    containerd::Engine engine{apps_root_dir, nerdctl.string(), docker_client_, registry_client_, "stargz"};
+    ASSERT_TRUE(engine.fetch(app));
+    ASSERT_TRUE(engine.run(app));
+    ASSERT_TRUE(engine.isRunning(app));
+
+    // the images are pulled and run through the snapshotter, and then fetched as a whole in the background
+    const auto log{Utils::readFile(nerdctl_log)};
+    ASSERT_NE(std::string::npos, log.find("--snapshotter=stargz compose --project-directory "));
+    ASSERT_NE(std::string::npos, log.find(" pull"));
+    ASSERT_NE(std::string::npos, log.find(" up --remove-orphans -d"));
+    for (int ii = 0; ii < 50 && Utils::readFile(nerdctl_log).find(background_pull) == std::string::npos; ++ii) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_NE(std::string::npos, Utils::readFile(nerdctl_log).find(background_pull));
+  }
+
+  // by default the images are fully pulled before the App is started
+  boost::filesystem::remove(nerdctl_log);
+  const auto next_app{registry.addApp(fixtures::ComposeApp::create("app-02"))};
+  containerd::Engine engine{apps_root_dir, nerdctl.string(), docker_client_, registry_client_};
+  ASSERT_TRUE(engine.fetch(next_app));
+  ASSERT_TRUE(engine.run(next_app));
+  const auto log{Utils::readFile(nerdctl_log)};
+  ASSERT_EQ(std::string::npos, log.find("--snapshotter"));
+  ASSERT_EQ(std::string::npos, log.find("--unpack=false"));
+}
+#endif  // BUILD_AKLITE_WITH_NERDCTL
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   logger_init();
@@ -3,9 +3,11 @@
 import os
 import sys
 import argparse
+import gzip
 import json
 import logging
 import ssl
+import time
 
 from http.server import SimpleHTTPRequestHandler, HTTPServer
 
@@ -14,6 +16,9 @@ logger = logging.getLogger("Fake Device Gateway")
 
 class Handler(SimpleHTTPRequestHandler):
     TreehubPrefix = "/treehub/"
+    # the same ostree repo as the treehub one, served slowly, the requested paths are recorded
+    SlowTreehubPrefix = "/treehub-slow/"
+    SlowTreehubDelaySec = 0.5
     TufRepoPrefix = "/repo/"
     AuthPrefix = "/hub-creds/"
     RegistryAuthPrefix = "/token-auth/"
@@ -55,6 +60,12 @@ class Handler(SimpleHTTPRequestHandler):
     def do_POST(self):
         if self.path.startswith(self.EventPrefix):
             self.event_handler()
+        elif self.path == "/download-urls" and os.path.exists(self._download_urls_file()):
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.end_headers()
+            with open(self._download_urls_file(), 'rb') as f:
+                self.wfile.write(f.read())
         else:
             self.send_response(200)
             self.end_headers()
@@ -64,6 +75,8 @@ class Handler(SimpleHTTPRequestHandler):
             self.tuf_handler()
         if self.path.startswith(self.TreehubPrefix):
             self.treehub_handler()
+        if self.path.startswith(self.SlowTreehubPrefix):
+            self.slow_treehub_handler()
         if self.path.startswith(self.AuthPrefix):
             self.auth_handler()
         if self.path.startswith(self.RegistryAuthPrefix):
@@ -89,6 +102,19 @@ class Handler(SimpleHTTPRequestHandler):
             self.send_response_only(404)
             self.end_headers()
 
+    def slow_treehub_handler(self):
+        logger.info("Slow Treehub: GET request %s" % self.path)
+        requests = []
+        if os.path.exists(self._slow_treehub_requests_file()):
+            with open(self._slow_treehub_requests_file()) as f:
+                requests = json.load(f)
+        requests.append(self.path[len(self.SlowTreehubPrefix):])
+        with open(self._slow_treehub_requests_file(), "w") as f:
+            json.dump(requests, f)
+        time.sleep(self.SlowTreehubDelaySec)
+        self.path = self.TreehubPrefix + self.path[len(self.SlowTreehubPrefix):]
+        self.treehub_handler()
+
     def auth_handler(self):
         self.send_response(200)
         self.send_header('Content-Type', 'application/json')
@@ -153,6 +179,15 @@ class Handler(SimpleHTTPRequestHandler):
     def _tuf_repo(self):
         return os.path.join(self.server.tuf_repo, 'repo')
 
+    def _events_headers_file(self):
+        return os.path.join(self.server.tuf_repo, 'events-headers.json')
+
+    def _download_urls_file(self):
+        return os.path.join(self.server.tuf_repo, 'download-urls.json')
+
+    def _slow_treehub_requests_file(self):
+        return os.path.join(self.server.tuf_repo, 'slow-treehub-requests.json')
+
     def _dump_event(self):
         if os.path.exists(self.server.events_file):
             with open(self.server.events_file) as f:
@@ -167,6 +202,10 @@ class Handler(SimpleHTTPRequestHandler):
 
         data_len = int(self.headers.get('content-length', 0))
         body = self.rfile.read(data_len)
+        if self.headers.get('content-encoding') == 'gzip':
+            body = gzip.decompress(body)
+        with open(self._events_headers_file(), "w") as f:
+            json.dump(dict(self.headers.items()), f)
         with open(self.server.events_file, "w+") as f:
             events = json.loads(body.decode('utf-8'))
             for e in events:
@@ -12,7 +12,7 @@ import json
 logger = logging.getLogger("Fake Docker Compose")
 
 
-def pull(out_dir, compose):
+def pull(out_dir, compose, services):
     logger.info("Pulling App images... ")
 
     if os.path.exists(os.path.join(out_dir, "image-pull-fails")):
@@ -23,7 +23,10 @@ def pull(out_dir, compose):
             images = json.load(f)
     except FileNotFoundError:
         images = {}
-    for service in compose["services"].values():
+    for name, service in compose["services"].items():
+        # just the images of the given services are pulled if any is given
+        if services and name not in services:
+            continue
         logger.info("Pulling service image " + service["image"])
         images[service["image"]] = True
 
@@ -100,7 +103,7 @@ def main():
         elif cmd == "config":
             exit_code = subprocess.call(["docker-compose", "config"], timeout=10)
         elif cmd == "pull":
-            pull(out_dir, compose)
+            pull(out_dir, compose, [arg for arg in sys.argv[3:] if not arg.startswith("-")])
 
     except Exception as exc:
         logger.error("Failed to process compose file: {}\n{}".format(exc, traceback.format_exc()))
@@ -5,9 +5,12 @@ import sys
 import argparse
 import json
 import logging
+import random
 import ssl
+import time
 
 from http.server import SimpleHTTPRequestHandler, HTTPServer
+from socketserver import ThreadingMixIn
 
 logger = logging.getLogger("Fake Docker Registry")
 
@@ -16,6 +19,14 @@ class Handler(SimpleHTTPRequestHandler):
     def do_GET(self):
         logger.info(">>> GET  %s" % self.path)
 
+        if self.server.latency > 0:
+            time.sleep(self.server.latency / 1000)
+        if self.server.loss > 0 and random.uniform(0, 100) < self.server.loss:
+            # emulate a lost connection, the client gets neither a response nor data
+            logger.info(">>> Dropping the request: %s" % self.path)
+            self.close_connection = True
+            return
+
         if not self.path.startswith('/v2'):
             self.send_response(404)
             self.end_headers()
@@ -63,29 +74,42 @@ class Handler(SimpleHTTPRequestHandler):
         self.send_response(200)
         self.send_header('Content-type', 'application/vnd.docker.distribution.manifest.v2+json')
         self.end_headers()
+        chunk_size = 1024
         with open(full_path, 'rb') as f:
             while True:
-                data = f.read(1024)
+                data = f.read(chunk_size)
                 if not data:
                     break
                 self.wfile.write(data)
+                if self.server.bandwidth > 0:
+                    # bandwidth cap per connection, in KB/s
+                    time.sleep(len(data) / (self.server.bandwidth * 1024))
+
 
+# requests are served concurrently as a client pulls blobs in parallel
+class FakeDockerRegistry(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
 
-class FakeDockerRegistry(HTTPServer):
-    def __init__(self, addr, root_dir):
+    def __init__(self, addr, root_dir, latency=0, bandwidth=0, loss=0):
         super(HTTPServer, self).__init__(server_address=addr, RequestHandlerClass=Handler)
         self.root_dir = root_dir
+        self.latency = latency
+        self.bandwidth = bandwidth
+        self.loss = loss
 
 
 def main():
     parser = argparse.ArgumentParser(description='Run a fake Docker Registry')
     parser.add_argument('-p', '--port', type=int, help='server port')
     parser.add_argument('-d', '--dir', type=str, help='registry root dir')
+    parser.add_argument('-l', '--latency', type=int, default=0, help='latency of each request in ms')
+    parser.add_argument('-b', '--bandwidth', type=int, default=0, help='bandwidth cap of each connection in KB/s')
+    parser.add_argument('-x', '--loss', type=float, default=0, help='share of dropped requests in percents')
 
     args = parser.parse_args()
 
     try:
-        httpd = FakeDockerRegistry(('', args.port), args.dir)
+        httpd = FakeDockerRegistry(('', args.port), args.dir, args.latency, args.bandwidth, args.loss)
         httpd.serve_forever()
     except KeyboardInterrupt:
         httpd.server_close()
@@ -1,8 +1,36 @@
 #include <gtest/gtest.h>
 
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "boost/algorithm/hex.hpp"
+#include "boost/algorithm/string/case_conv.hpp"
+#include "boost/algorithm/string/predicate.hpp"
 #include "boost/format.hpp"
+#include "boost/process.hpp"
 
+#include "crypto/crypto.h"
+#ifdef BUILD_AKLITE_WITH_NERDCTL
+#include "containerd/client.h"
+#endif
+#include "docker/blobindex.h"
+#include "docker/blobrefs.h"
+#include "docker/composeverifycache.h"
+#include "docker/contentindex.h"
 #include "docker/docker.h"
+#include "docker/dockerclient.h"
+#include "docker/dockerstore.h"
+#include "docker/fetchjournal.h"
+#include "docker/imagepuller.h"
+#include "docker/imagerepositories.h"
+#include "docker/nativecompose.h"
+#include "docker/ocimanifest.h"
+#include "utilities/utils.h"
+
+#include "fixtures/basehttpclient.cc"
 
 TEST(Docker, ParseUri) {
   const std::string host{"host"};
@@ -97,6 +125,30 @@ TEST(Docker, ParseUriNegative) {
       std::invalid_argument);
 }
 
+TEST(Docker, HashedDigest) {
+  const std::string hash{"b0150d88116219cbf46ebb5dc08d8a559c4f1ab2731a788628fc7375b2372cb0"};
+  const Docker::HashedDigest digest{"sha256:" + hash};
+  const Docker::HashedDigest upper_digest{"SHA256:" + boost::algorithm::to_upper_copy(hash)};
+  ASSERT_EQ(digest(), "sha256:" + hash);
+  ASSERT_EQ(upper_digest(), "sha256:" + hash);
+  ASSERT_EQ(upper_digest.hash(), hash);
+  ASSERT_EQ(upper_digest.shortHash(), "b0150d8");
+  ASSERT_EQ(digest, upper_digest);
+  ASSERT_EQ(digest.binary()[0], 0xb0);
+  ASSERT_EQ(digest.binary()[Docker::HashedDigest::HashSize - 1], 0xb0);
+
+  std::string other_hash{hash};
+  other_hash.back() = '1';
+  const Docker::HashedDigest other_digest{"sha256:" + other_hash};
+  ASSERT_NE(digest, other_digest);
+  ASSERT_TRUE(digest < other_digest);
+  std::unordered_set<Docker::HashedDigest, Docker::HashedDigest::Hasher> digests{digest, upper_digest, other_digest};
+  ASSERT_EQ(digests.size(), 2);
+
+  EXPECT_THROW(Docker::HashedDigest("sha512:" + hash), std::invalid_argument);
+  EXPECT_THROW(Docker::HashedDigest("sha256:" + hash + "0"), std::invalid_argument);
+}
+
 TEST(Docker, BearerAuth) {
   {
     const auto auth{
@@ -169,7 +221,1519 @@ TEST(Docker, BearerAuthNegative) {
   }
 }
 
+// Serves a blob, the first download request is interrupted after the given number of bytes is sent.
+// If the error page is set then the second request is answered with it and the 500 status.
+class FlakyBlobHttpClient : public fixtures::BaseHttpClient {
+ public:
+  FlakyBlobHttpClient(const std::string& blob, std::size_t break_after, std::vector<curl_off_t>& requests,
+                      std::string error_page = "")
+      : blob_{blob}, break_after_{break_after}, requests_{requests}, error_page_{std::move(error_page)} {}
+
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)url;
+    (void)progress_cb;
+    requests_.push_back(from);
+    std::string data{blob_.substr(static_cast<std::size_t>(from))};
+    if (requests_.size() == 1) {
+      data = data.substr(0, break_after_);
+      write_cb(const_cast<char*>(data.c_str()), data.size(), 1, userp);
+      return HttpResponse("", 200, CURLE_PARTIAL_FILE, "connection dropped");
+    }
+    if (requests_.size() == 2 && !error_page_.empty()) {
+      write_cb(const_cast<char*>(error_page_.c_str()), error_page_.size(), 1, userp);
+      return HttpResponse("", 500, CURLE_OK, "Internal Server Error");
+    }
+    write_cb(const_cast<char*>(data.c_str()), data.size(), 1, userp);
+    return HttpResponse("", from > 0 ? 206 : 200, CURLE_OK, "");
+  }
+
+ private:
+  const std::string blob_;
+  const std::size_t break_after_;
+  std::vector<curl_off_t>& requests_;
+  const std::string error_page_;
+};
+
+TEST(Docker, DownloadBlobResume) {
+  TemporaryDirectory dir;
+  const std::string blob(256 * 1024, 'x');
+  const std::string blob_hash{
+      boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(blob)))};
+  const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + blob_hash)};
+  const auto blob_file{dir.Path() / blob_hash};
+
+  std::vector<curl_off_t> requests;
+  Docker::RegistryClient client{
+      nullptr, Docker::RegistryClient::DefAuthCredsEndpoint,
+      [&](const std::vector<std::string>*, const std::set<std::string>*) {
+        return std::make_shared<FlakyBlobHttpClient>(blob, 100 * 1024, requests);
+      }};
+
+  EXPECT_THROW(client.downloadBlob(uri, blob_file, blob.size()), std::runtime_error);
+  ASSERT_FALSE(boost::filesystem::exists(blob_file));
+  ASSERT_EQ(100 * 1024, boost::filesystem::file_size(blob_file.string() + Docker::RegistryClient::PartFileExt));
+
+  std::vector<DownloadProgress> progress;
+  client.setProgressCb([&progress](const DownloadProgress& p) { progress.push_back(p); });
+  client.downloadBlob(uri, blob_file, blob.size());
+  ASSERT_EQ(2, requests.size());
+  ASSERT_EQ(100 * 1024, requests[1]);
+  ASSERT_EQ(blob, Utils::readFile(blob_file));
+  ASSERT_FALSE(boost::filesystem::exists(blob_file.string() + Docker::RegistryClient::PartFileExt));
+
+  // the completion is reported regardless of the reporting interval
+  ASSERT_FALSE(progress.empty());
+  ASSERT_TRUE(progress.back().completed);
+  ASSERT_EQ(DownloadProgress::Source::AppBlob, progress.back().source);
+  ASSERT_EQ("hub.foundries.io/factory/app@sha256:" + blob_hash, progress.back().name);
+  ASSERT_EQ(blob.size(), progress.back().bytes_fetched);
+  ASSERT_EQ(blob.size(), progress.back().bytes_total);
+  ASSERT_EQ(100, progress.back().percent);
+}
+
+// Delivers a blob in small chunks, the first request is broken after the given amount of data
+class ChunkedBlobHttpClient : public fixtures::BaseHttpClient {
+ public:
+  static const std::size_t ChunkSize{4 * 1024 + 1};
+
+  ChunkedBlobHttpClient(const std::string& blob, std::size_t break_after, int& requests)
+      : blob_{blob}, break_after_{break_after}, requests_{requests} {}
+
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)url;
+    (void)progress_cb;
+    const auto end{++requests_ == 1 ? break_after_ : blob_.size()};
+    for (auto pos{static_cast<std::size_t>(from)}; pos < end; pos += ChunkSize) {
+      std::string chunk{blob_.substr(pos, std::min(ChunkSize, end - pos))};
+      if (write_cb(const_cast<char*>(chunk.c_str()), chunk.size(), 1, userp) != chunk.size()) {
+        return HttpResponse("", 200, CURLE_WRITE_ERROR, "write error");
+      }
+    }
+    if (end < blob_.size()) {
+      return HttpResponse("", 200, CURLE_PARTIAL_FILE, "connection dropped");
+    }
+    return HttpResponse("", from > 0 ? 206 : 200, CURLE_OK, "");
+  }
+
+ private:
+  const std::string blob_;
+  const std::size_t break_after_;
+  int& requests_;
+};
+
+const std::size_t ChunkedBlobHttpClient::ChunkSize;
+
+TEST(Docker, DownloadBlobBufferedWrites) {
+  TemporaryDirectory dir;
+  // the data differ from chunk to chunk, so a chunk written out of order breaks the blob hash
+  std::string blob;
+  for (int ii = 0; blob.size() < 300 * 1024; ++ii) {
+    blob += std::to_string(ii) + ",";
+  }
+  const std::string blob_hash{boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(blob)))};
+  const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + blob_hash)};
+  const auto blob_file{dir.Path() / blob_hash};
+  const auto part_file{blob_file.string() + Docker::RegistryClient::PartFileExt};
+  // not aligned to the chunk and write buffer sizes
+  const std::size_t break_after{150 * 1024 + 123};
+
+  int requests{0};
+  Docker::RegistryClient client{nullptr, Docker::RegistryClient::DefAuthCredsEndpoint,
+                                [&](const std::vector<std::string>*, const std::set<std::string>*) {
+                                  return std::make_shared<ChunkedBlobHttpClient>(blob, break_after, requests);
+                                }};
+  client.setWriteBufferSize(64 * 1024);
+
+  // the data remaining in the write buffer are stored once the download fails, the part file size is exactly the
+  // received amount, i.e. the preallocated space is not counted in
+  EXPECT_THROW(client.downloadBlob(uri, blob_file, blob.size()), std::runtime_error);
+  ASSERT_EQ(break_after, boost::filesystem::file_size(part_file));
+  ASSERT_EQ(blob.substr(0, break_after), Utils::readFile(part_file));
+
+  client.downloadBlob(uri, blob_file, blob.size());
+  ASSERT_EQ(2, requests);
+  ASSERT_EQ(blob, Utils::readFile(blob_file));
+  ASSERT_FALSE(boost::filesystem::exists(part_file));
+}
+
+TEST(Docker, DownloadBlobResumeAfterErrorResponse) {
+  TemporaryDirectory dir;
+  const std::string blob(256 * 1024, 'x');
+  const std::string blob_hash{
+      boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(blob)))};
+  const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + blob_hash)};
+  const auto blob_file{dir.Path() / blob_hash};
+  const auto part_file{blob_file.string() + Docker::RegistryClient::PartFileExt};
+
+  std::vector<curl_off_t> requests;
+  Docker::RegistryClient client{
+      nullptr, Docker::RegistryClient::DefAuthCredsEndpoint,
+      [&](const std::vector<std::string>*, const std::set<std::string>*) {
+        return std::make_shared<FlakyBlobHttpClient>(blob, 100 * 1024, requests, "<html>Internal Server Error</html>");
+      }};
+
+  EXPECT_THROW(client.downloadBlob(uri, blob_file, blob.size()), std::runtime_error);
+  ASSERT_EQ(100 * 1024, boost::filesystem::file_size(part_file));
+  // the error page body is not appended to the partially downloaded blob
+  EXPECT_THROW(client.downloadBlob(uri, blob_file, blob.size()), std::runtime_error);
+  ASSERT_EQ(100 * 1024, boost::filesystem::file_size(part_file));
+
+  client.downloadBlob(uri, blob_file, blob.size());
+  ASSERT_EQ(3, requests.size());
+  ASSERT_EQ(100 * 1024, requests[1]);
+  ASSERT_EQ(100 * 1024, requests[2]);
+  ASSERT_EQ(blob, Utils::readFile(blob_file));
+  ASSERT_FALSE(boost::filesystem::exists(part_file));
+}
+
+// Serves the manifest from any host except the `down.mirror` one, records the requested URLs
+class MirroredRegistryHttpClient : public fixtures::BaseHttpClient {
+ public:
+  explicit MirroredRegistryHttpClient(std::vector<std::string>& urls) : urls_{urls} {}
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    urls_.push_back(url);
+    if (boost::starts_with(url, "https://down.mirror/")) {
+      return HttpResponse("", 503, CURLE_OK, "Service Unavailable");
+    }
+    return HttpResponse(Manifest, 200, CURLE_OK, "");
+  }
+
+  static const std::string Manifest;
+
+ private:
+  std::vector<std::string>& urls_;
+};
+
+const std::string MirroredRegistryHttpClient::Manifest{"{\"annotations\":{\"compose-app\":\"v1\"}}"};
+
+TEST(Docker, RegistryMirrors) {
+  EXPECT_THROW(Docker::RegistryMirrors("hub.foundries.io"), std::invalid_argument);
+  EXPECT_THROW(Docker::RegistryMirrors("=mirror.local"), std::invalid_argument);
+  EXPECT_THROW(Docker::RegistryMirrors("hub.foundries.io="), std::invalid_argument);
+  ASSERT_TRUE(Docker::RegistryMirrors("").empty());
+
+  {
+    Docker::RegistryMirrors mirrors{"hub.foundries.io=a.mirror, b.mirror,c.mirror; docker.io=d.mirror"};
+    ASSERT_EQ(mirrors.getHosts("hub.foundries.io"),
+              (std::vector<std::string>{"a.mirror", "b.mirror", "c.mirror", "hub.foundries.io"}));
+    ASSERT_EQ(mirrors.getHosts("ghcr.io"), std::vector<std::string>{"ghcr.io"});
+
+    // the unused mirrors go first, then the ones of the lowest latency, the failed ones are skipped
+    mirrors.reportSuccess("a.mirror", std::chrono::milliseconds(200));
+    mirrors.reportSuccess("b.mirror", std::chrono::milliseconds(100));
+    ASSERT_EQ(mirrors.getHosts("hub.foundries.io"),
+              (std::vector<std::string>{"c.mirror", "b.mirror", "a.mirror", "hub.foundries.io"}));
+    mirrors.reportFailure("c.mirror");
+    ASSERT_EQ(mirrors.getHosts("hub.foundries.io"),
+              (std::vector<std::string>{"b.mirror", "a.mirror", "hub.foundries.io"}));
+    // the latency is averaged over the recent requests
+    mirrors.reportSuccess("b.mirror", std::chrono::milliseconds(1000));
+    ASSERT_EQ(mirrors.getHosts("hub.foundries.io"),
+              (std::vector<std::string>{"a.mirror", "b.mirror", "hub.foundries.io"}));
+
+    // the registry itself is requested if all mirrors fail, its failure is rethrown
+    std::vector<std::string> hosts;
+    EXPECT_THROW(mirrors.send("docker.io",
+                              [&hosts](const std::string& host) {
+                                hosts.push_back(host);
+                                throw std::runtime_error("failed");
+                              }),
+                 std::runtime_error);
+    ASSERT_EQ(hosts, (std::vector<std::string>{"d.mirror", "docker.io"}));
+    ASSERT_EQ(mirrors.getHosts("docker.io"), std::vector<std::string>{"docker.io"});
+  }
+
+  {
+    const std::string manifest_hash{boost::algorithm::to_lower_copy(
+        boost::algorithm::hex(Crypto::sha256digest(MirroredRegistryHttpClient::Manifest)))};
+    const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + manifest_hash)};
+    std::vector<std::string> urls;
+    Docker::RegistryClient client{nullptr, Docker::RegistryClient::DefAuthCredsEndpoint,
+                                  [&urls](const std::vector<std::string>*, const std::set<std::string>*) {
+                                    return std::make_shared<MirroredRegistryHttpClient>(urls);
+                                  }};
+    auto mirrors{std::make_shared<Docker::RegistryMirrors>("hub.foundries.io=down.mirror,up.mirror")};
+    client.setMirrors(mirrors);
+
+    ASSERT_EQ(MirroredRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+    ASSERT_EQ(urls, (std::vector<std::string>{"https://down.mirror/v2/factory/app/manifests/sha256:" + manifest_hash,
+                                              "https://up.mirror/v2/factory/app/manifests/sha256:" + manifest_hash}));
+    ASSERT_EQ(mirrors->getHosts("hub.foundries.io"), (std::vector<std::string>{"up.mirror", "hub.foundries.io"}));
+  }
+}
+
+// Emulates a Registry requiring a bearer token, counts the token requests
+class AuthRegistryHttpClient : public fixtures::BaseHttpClient {
+ public:
+  AuthRegistryHttpClient(const std::vector<std::string>* headers, int& token_requests, int expires_in)
+      : token_requests_{token_requests}, expires_in_{expires_in} {
+    if (headers != nullptr) {
+      headers_ = *headers;
+    }
+  }
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    if (url == Docker::RegistryClient::DefAuthCredsEndpoint) {
+      return HttpResponse("{\"Secret\":\"secret\",\"Username\":\"test-user\"}", 200, CURLE_OK, "");
+    }
+    if (boost::starts_with(url, "https://hub.foundries.io/token-auth/")) {
+      ++token_requests_;
+      return HttpResponse("{\"token\":\"token\",\"expires_in\":" + std::to_string(expires_in_) + "}", 200,
+                          CURLE_OK, "");
+    }
+    if (std::find(headers_.begin(), headers_.end(), "authorization: bearer token") == headers_.end()) {
+      return HttpResponse("", 401, CURLE_OK, "Unauthorized",
+                          {{"www-authenticate",
+                            "bearer realm=\"https://hub.foundries.io/token-auth/\",service=\"registry\",scope=\"repository:"
+                            "factory/app:pull\""}});
+    }
+    return HttpResponse(Manifest, 200, CURLE_OK, "");
+  }
+
+  static const std::string Manifest;
+
+ private:
+  std::vector<std::string> headers_;
+  int& token_requests_;
+  const int expires_in_;
+};
+
+const std::string AuthRegistryHttpClient::Manifest{"{\"annotations\":{\"compose-app\":\"v1\"}}"};
+
+TEST(Docker, TokenCache) {
+  const std::string manifest_hash{
+      boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(AuthRegistryHttpClient::Manifest)))};
+  const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + manifest_hash)};
+
+  for (const auto& expires_in : {300, 5}) {
+    int token_requests{0};
+    const auto http_client_factory{[&](const std::vector<std::string>* headers, const std::set<std::string>*) {
+      return std::make_shared<AuthRegistryHttpClient>(headers, token_requests, expires_in);
+    }};
+    Docker::RegistryClient client{http_client_factory(nullptr, nullptr), Docker::RegistryClient::DefAuthCredsEndpoint,
+                                  http_client_factory};
+
+    for (int ii = 0; ii < 3; ++ii) {
+      ASSERT_EQ(AuthRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+    }
+    // a token is cached unless its lifetime is too short
+    ASSERT_EQ(expires_in > Docker::RegistryClient::TokenExpiryMarginSec ? 1 : 3, token_requests);
+  }
+}
+
+TEST(Docker, HttpClientReuse) {
+  const std::string manifest_hash{
+      boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(AuthRegistryHttpClient::Manifest)))};
+  const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + manifest_hash)};
+
+  int token_requests{0};
+  int created_clients{0};
+  const auto http_client_factory{[&](const std::vector<std::string>* headers, const std::set<std::string>*) {
+    ++created_clients;
+    return std::make_shared<AuthRegistryHttpClient>(headers, token_requests, 300);
+  }};
+  Docker::RegistryClient client{std::make_shared<AuthRegistryHttpClient>(nullptr, token_requests, 300),
+                                Docker::RegistryClient::DefAuthCredsEndpoint, http_client_factory};
+
+  for (int ii = 0; ii < 3; ++ii) {
+    ASSERT_EQ(AuthRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+  }
+  // unauthorized request, token request, authorized request, the latter client is reused by the following requests
+  ASSERT_EQ(3, created_clients);
+}
+
+TEST(Docker, MirrorAnonymousToken) {
+  const std::string manifest_hash{
+      boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(AuthRegistryHttpClient::Manifest)))};
+  const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + manifest_hash)};
+  const std::string basic_auth_header{"authorization: basic " + Utils::toBase64("test-user:secret")};
+
+  int token_requests{0};
+  std::vector<std::vector<std::string>> client_headers;
+  const auto http_client_factory{[&](const std::vector<std::string>* headers, const std::set<std::string>*) {
+    client_headers.emplace_back(headers != nullptr ? *headers : std::vector<std::string>{});
+    return std::make_shared<AuthRegistryHttpClient>(headers, token_requests, 300);
+  }};
+  Docker::RegistryClient client{std::make_shared<AuthRegistryHttpClient>(nullptr, token_requests, 300),
+                                Docker::RegistryClient::DefAuthCredsEndpoint, http_client_factory};
+  auto mirrors{std::make_shared<Docker::RegistryMirrors>("hub.foundries.io=mirror.local")};
+  client.setMirrors(mirrors);
+
+  // the mirror refers to the registry token realm, yet the token is requested without the registry credentials
+  ASSERT_EQ(AuthRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+  ASSERT_EQ(1, token_requests);
+  for (const auto& headers : client_headers) {
+    ASSERT_EQ(headers.end(), std::find(headers.begin(), headers.end(), basic_auth_header));
+  }
+
+  // the anonymous token is not reused for the registry itself, the registry gets the credentials
+  client_headers.clear();
+  mirrors->reportFailure("mirror.local");
+  ASSERT_EQ(AuthRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+  ASSERT_EQ(2, token_requests);
+  ASSERT_TRUE(std::any_of(client_headers.begin(), client_headers.end(), [&](const std::vector<std::string>& headers) {
+    return std::find(headers.begin(), headers.end(), basic_auth_header) != headers.end();
+  }));
+}
+
+// Serves blobs and manifests by their digests, no auth
+class BlobStoreHttpClient : public fixtures::BaseHttpClient {
+ public:
+  BlobStoreHttpClient(std::unordered_map<std::string, std::string>& blobs, std::vector<std::string>& downloads)
+      : blobs_{blobs}, downloads_{downloads} {}
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    const auto found_it{blobs_.find(url.substr(url.rfind(':') + 1))};
+    if (found_it == blobs_.end()) {
+      return HttpResponse("", 404, CURLE_OK, "Not Found");
+    }
+    return HttpResponse(found_it->second, 200, CURLE_OK, "");
+  }
+
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)progress_cb;
+    (void)from;
+    const auto found_it{blobs_.find(url.substr(url.rfind(':') + 1))};
+    if (found_it == blobs_.end()) {
+      return HttpResponse("", 404, CURLE_OK, "Not Found");
+    }
+    {
+      std::lock_guard<std::mutex> lock{mutex_};
+      downloads_.emplace_back(found_it->first);
+    }
+    write_cb(const_cast<char*>(found_it->second.c_str()), found_it->second.size(), 1, userp);
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+
+ private:
+  std::unordered_map<std::string, std::string>& blobs_;
+  std::vector<std::string>& downloads_;
+  std::mutex mutex_;
+};
+
+TEST(Docker, ImagePuller) {
+  TemporaryDirectory dir;
+  std::unordered_map<std::string, std::string> blobs;
+  std::vector<std::string> downloads;
+  const auto add_blob{[&blobs](const std::string& data) {
+    const auto hash{boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(data)))};
+    blobs.emplace(hash, data);
+    return hash;
+  }};
+  const auto blob_desc{[&blobs](const std::string& hash) {
+    Json::Value desc;
+    desc["digest"] = "sha256:" + hash;
+    desc["size"] = static_cast<Json::UInt64>(blobs.at(hash).size());
+    return desc;
+  }};
+
+  // two images sharing the same base layer, the second one is multi-platform
+  const auto base_layer{add_blob("base-layer")};
+  std::vector<std::string> image_hashes;
+  for (const auto& image : {"image-01", "image-02"}) {
+    Json::Value manifest;
+    manifest["schemaVersion"] = 2;
+    manifest["mediaType"] = Docker::ImagePuller::ManifestFormat;
+    manifest["config"] = blob_desc(add_blob(std::string(image) + "-config"));
+    manifest["layers"].append(blob_desc(base_layer));
+    manifest["layers"].append(blob_desc(add_blob(std::string(image) + "-layer")));
+    image_hashes.emplace_back(add_blob(Utils::jsonToCanonicalStr(manifest)));
+  }
+  Json::Value index;
+  index["mediaType"] = Docker::ImagePuller::ManifestListFormat;
+  index["manifests"][0] = blob_desc(image_hashes[1]);
+  index["manifests"][0]["platform"]["architecture"] = "arm64";
+  const auto index_hash{add_blob(Utils::jsonToCanonicalStr(index))};
+
+  Docker::RegistryClient::Ptr registry_client{std::make_shared<Docker::RegistryClient>(
+      nullptr, "",
+      [&](const std::vector<std::string>*, const std::set<std::string>*) {
+        return std::make_shared<BlobStoreHttpClient>(blobs, downloads);
+      })};
+  Docker::ImagePuller puller{registry_client, dir / "blobs", 2};
+
+  const std::vector<Docker::ImagePuller::Image> images{
+      {Docker::Uri::parseUri("hub.foundries.io/factory/image-01@sha256:" + image_hashes[0], false), dir / "image-01"},
+      {Docker::Uri::parseUri("hub.foundries.io/factory/image-02@sha256:" + index_hash, false), dir / "image-02"}};
+  puller.pull(images, "arm64");
+
+  // configs of two images, their unique layers and the shared layer
+  ASSERT_EQ(5, downloads.size());
+  for (std::size_t ii = 0; ii < images.size(); ++ii) {
+    ASSERT_TRUE(boost::filesystem::exists(images[ii].dir / Docker::ImagePuller::LayoutFile));
+    const auto image_index{Utils::parseJSONFile(images[ii].dir / Docker::ImagePuller::IndexFile)};
+    ASSERT_EQ("sha256:" + image_hashes[ii], image_index["manifests"][0]["digest"].asString());
+    ASSERT_TRUE(boost::filesystem::exists(dir / "blobs" / "sha256" / image_hashes[ii]));
+  }
+  for (const auto& blob : downloads) {
+    ASSERT_EQ(blobs.at(blob), Utils::readFile(dir / "blobs" / "sha256" / blob));
+  }
+
+  // all blobs are present, nothing to download
+  downloads.clear();
+  puller.pull(images, "arm64");
+  ASSERT_EQ(0, downloads.size());
+
+  EXPECT_THROW(puller.pull({images[1]}, "amd64"), std::runtime_error);
+
+  // a cancelled pull downloads nothing and doesn't affect the following ones
+  boost::filesystem::remove_all(dir / "blobs");
+  downloads.clear();
+  EXPECT_THROW(puller.pull(images, "arm64", []() { return true; }), std::runtime_error);
+  ASSERT_EQ(0, downloads.size());
+  puller.pull(images, "arm64", []() { return false; });
+  ASSERT_EQ(5, downloads.size());
+}
+
+TEST(Docker, OciManifest) {
+  const std::string hash{"b0150d88116219cbf46ebb5dc08d8a559c4f1ab2731a788628fc7375b2372cb0"};
+  Json::Value index_json;
+  index_json["manifests"][0]["digest"] = "sha256:" + hash;
+  index_json["manifests"][0]["size"] = 1024;
+  index_json["manifests"][0]["platform"]["architecture"] = "amd64";
+  index_json["manifests"][1] = index_json["manifests"][0];
+  index_json["manifests"][1]["platform"]["architecture"] = "arm64";
+  index_json["manifests"][1]["platform"]["os"] = "linux";
+  const Docker::ImageIndex index{index_json};
+  ASSERT_EQ(2, index.manifests.size());
+  ASSERT_EQ("amd64", index.manifest().architecture);
+  ASSERT_NE(nullptr, index.find("amd64"));
+  ASSERT_EQ("arm64", index.find("arm64")->architecture);
+  ASSERT_EQ(nullptr, index.find("arm64", "windows"));
+  ASSERT_EQ(nullptr, index.find("riscv64"));
+
+  Json::Value manifest_json;
+  manifest_json["config"]["digest"] = "sha256:" + hash;
+  manifest_json["config"]["size"] = 2;
+  manifest_json["layers"][0]["mediaType"] = "application/vnd.docker.image.rootfs.diff.tar.gzip";
+  manifest_json["layers"][0]["digest"] = "sha256:" + hash;
+  manifest_json["layers"][0]["size"] = 4096;
+  const Docker::ImageManifest manifest{manifest_json};
+  ASSERT_EQ(hash, manifest.config.digest.hash());
+  ASSERT_EQ(1, manifest.layers.size());
+  ASSERT_EQ(4096, manifest.layers[0].size);
+  ASSERT_FALSE(manifest.layers[0].isZstd());
+  ASSERT_TRUE(Docker::Descriptor::isZstdMediaType("application/vnd.oci.image.layer.v1.tar+zstd"));
+  ASSERT_TRUE(Docker::Descriptor::isZstdMediaType("application/vnd.docker.image.rootfs.diff.tar.zstd"));
+
+  // the App archive extension follows its compression
+  Json::Value app_manifest_json;
+  app_manifest_json["annotations"]["compose-app"] = Docker::Manifest::Version;
+  app_manifest_json["layers"][0]["digest"] = "sha256:" + hash;
+  app_manifest_json["layers"][0]["size"] = 4096;
+  ASSERT_EQ(std::string(Docker::Manifest::ArchiveExt), Docker::Manifest{app_manifest_json}.archiveExt());
+  app_manifest_json["layers"][0]["mediaType"] = "application/vnd.oci.image.layer.v1.tar+zstd";
+  ASSERT_TRUE(Docker::Manifest{app_manifest_json}.isZstdArchive());
+  ASSERT_EQ(std::string(Docker::Manifest::ZstdArchiveExt), Docker::Manifest{app_manifest_json}.archiveExt());
+
+  // invalid descriptors
+  auto invalid_json{manifest_json};
+  invalid_json["layers"][0]["size"] = -1;
+  EXPECT_THROW(Docker::ImageManifest{invalid_json}, std::invalid_argument);
+  invalid_json["layers"][0]["size"] = "4096";
+  EXPECT_THROW(Docker::ImageManifest{invalid_json}, std::invalid_argument);
+  invalid_json = manifest_json;
+  invalid_json["config"].removeMember("digest");
+  EXPECT_THROW(Docker::ImageManifest{invalid_json}, std::invalid_argument);
+  invalid_json = manifest_json;
+  invalid_json.removeMember("layers");
+  EXPECT_THROW(Docker::ImageManifest{invalid_json}, std::invalid_argument);
+  EXPECT_THROW(Docker::ImageIndex{manifest_json}, std::invalid_argument);
+  EXPECT_THROW(Docker::ImageIndex{Utils::parseJSON("{\"manifests\":[]}")}.manifest(), std::invalid_argument);
+
+  // an entry is reused till its file is changed
+  TemporaryDirectory dir;
+  auto& cache{Docker::OciManifestCache::instance()};
+  Utils::writeFile(dir / hash, manifest_json);
+  const auto cached_manifest{cache.imageManifest(dir.Path(), manifest.config.digest)};
+  ASSERT_EQ(cached_manifest, cache.imageManifest(dir.Path(), manifest.config.digest));
+  manifest_json["layers"][1] = manifest_json["layers"][0];
+  Utils::writeFile(dir / hash, manifest_json);
+  ASSERT_EQ(2, cache.imageManifest(dir.Path(), manifest.config.digest)->layers.size());
+  ASSERT_EQ(1, cached_manifest->layers.size());
+
+  Utils::writeFile(dir / "index.json", index_json);
+  ASSERT_EQ(hash, cache.imageIndex(dir.Path())->manifest().digest.hash());
+  boost::filesystem::remove(dir / "index.json");
+  EXPECT_THROW(cache.imageIndex(dir.Path()), std::runtime_error);
+
+  // the oldest entries are dropped once there are more of them than the limit
+  cache.setMaxEntries(1);
+  const auto limited_manifest{cache.imageManifest(dir.Path(), manifest.config.digest)};
+  ASSERT_EQ(limited_manifest, cache.imageManifest(dir.Path(), manifest.config.digest));
+  Utils::writeFile(dir / "index.json", index_json);
+  cache.imageIndex(dir.Path());
+  ASSERT_NE(limited_manifest, cache.imageManifest(dir.Path(), manifest.config.digest));
+  cache.setMaxEntries(Docker::OciManifestCache::MaxEntries);
+  cache.clear();
+}
+
+TEST(Docker, ManifestCache) {
+  TemporaryDirectory dir;
+  const std::string manifest_hash{
+      boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(AuthRegistryHttpClient::Manifest)))};
+  const auto uri{Docker::Uri::parseUri("hub.foundries.io/factory/app@sha256:" + manifest_hash)};
+
+  int token_requests{0};
+  int created_clients{0};
+  const auto http_client_factory{[&](const std::vector<std::string>* headers, const std::set<std::string>*) {
+    ++created_clients;
+    return std::make_shared<AuthRegistryHttpClient>(headers, token_requests, 300);
+  }};
+
+  {
+    Docker::RegistryClient client{std::make_shared<AuthRegistryHttpClient>(nullptr, token_requests, 300),
+                                  Docker::RegistryClient::DefAuthCredsEndpoint, http_client_factory, dir.Path()};
+    ASSERT_EQ(AuthRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+    ASSERT_LT(0, created_clients);
+    ASSERT_EQ(AuthRegistryHttpClient::Manifest, Utils::readFile(dir / manifest_hash));
+  }
+  {
+    // a new client instance, no requests to Registry, the manifest is taken from the cache
+    created_clients = 0;
+    Docker::RegistryClient client{std::make_shared<AuthRegistryHttpClient>(nullptr, token_requests, 300),
+                                  Docker::RegistryClient::DefAuthCredsEndpoint, http_client_factory, dir.Path()};
+    ASSERT_EQ(AuthRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+    ASSERT_EQ(0, created_clients);
+
+    // a corrupted cached manifest is not used
+    Utils::writeFile(dir / manifest_hash, std::string("{}"));
+    ASSERT_EQ(AuthRegistryHttpClient::Manifest, client.getAppManifest(uri, Docker::Manifest::Format));
+    ASSERT_LT(0, created_clients);
+
+    client.pruneManifestCache({});
+    ASSERT_FALSE(boost::filesystem::exists(dir / manifest_hash));
+  }
+}
+
+TEST(Docker, ContentIndex) {
+  TemporaryDirectory dir;
+  const auto index_file{dir / "content-index.json"};
+  const auto blob_file{dir / "blob"};
+  Utils::writeFile(blob_file, std::string("blob"));
+
+  {
+    Docker::ContentIndex index{index_file};
+    ASSERT_FALSE(index.isVerified(blob_file, "hash"));
+    index.setVerified(blob_file, "hash");
+    ASSERT_TRUE(index.isVerified(blob_file, "hash"));
+    ASSERT_FALSE(index.isVerified(blob_file, "another-hash"));
+    index.flush();
+  }
+  {
+    // the index survives restarts
+    Docker::ContentIndex index{index_file};
+    ASSERT_TRUE(index.isVerified(blob_file, "hash"));
+
+    // a file change invalidates its entry
+    Utils::writeFile(blob_file, std::string("altered blob"));
+    ASSERT_FALSE(index.isVerified(blob_file, "hash"));
+
+    index.setVerified(blob_file, "hash");
+    boost::filesystem::remove(blob_file);
+    index.prune();
+  }
+  {
+    Utils::writeFile(blob_file, std::string("blob"));
+    Docker::ContentIndex index{index_file};
+    ASSERT_FALSE(index.isVerified(blob_file, "hash"));
+  }
+  {
+    // a corrupted index is just dropped
+    Utils::writeFile(index_file, std::string("corrupted"));
+    Docker::ContentIndex index{index_file};
+    ASSERT_FALSE(index.isVerified(blob_file, "hash"));
+  }
+}
+
+TEST(Docker, BlobRefs) {
+  TemporaryDirectory dir;
+  const auto table_file{dir / "blob-refs.json"};
+
+  {
+    Docker::BlobRefs refs{table_file};
+    ASSERT_FALSE(refs.isComplete());
+    refs.add("app-01/hash-01", {{"layer-01", "layer-02"}, {"manifest-01"}});
+    refs.add("app-02/hash-01", {{"layer-02", "layer-03"}, {"manifest-02"}});
+    refs.setComplete();
+    refs.flush();
+  }
+  {
+    // the table survives restarts
+    Docker::BlobRefs refs{table_file};
+    ASSERT_TRUE(refs.isComplete());
+    ASSERT_TRUE(refs.hasOwner("app-01/hash-01"));
+    ASSERT_TRUE(refs.isReferenced("layer-02"));
+    ASSERT_EQ(2, refs.manifests().size());
+    Docker::BlobRefs::Refs owner_refs;
+    ASSERT_TRUE(refs.getRefs("app-02/hash-01", owner_refs));
+    ASSERT_EQ((std::set<std::string>{"layer-02", "layer-03"}), owner_refs.blobs);
+    ASSERT_FALSE(refs.getRefs("app-03/hash-01", owner_refs));
+
+    // a blob shared with another App version is kept
+    ASSERT_EQ(std::vector<std::string>{"layer-01"}, refs.remove("app-01/hash-01"));
+    ASSERT_FALSE(refs.hasOwner("app-01/hash-01"));
+    ASSERT_FALSE(refs.isReferenced("layer-01"));
+    ASSERT_TRUE(refs.isReferenced("layer-02"));
+    ASSERT_TRUE(refs.remove("app-01/hash-01").empty());
+
+    // re-adding an App version replaces its references and yields the blobs not referenced by anyone anymore
+    ASSERT_TRUE(refs.add("app-02/hash-01", {{"layer-02", "layer-03"}, {"manifest-02"}}).empty());
+    ASSERT_EQ(std::vector<std::string>{"layer-02"}, refs.add("app-02/hash-01", {{"layer-03"}, {"manifest-02"}}));
+    ASSERT_FALSE(refs.isReferenced("layer-02"));
+    ASSERT_EQ(std::vector<std::string>{"layer-03"}, refs.remove("app-02/hash-01"));
+    ASSERT_TRUE(refs.owners().empty());
+  }
+  {
+    // a corrupted table is dropped and must be rebuilt
+    Utils::writeFile(table_file, std::string("corrupted"));
+    Docker::BlobRefs refs{table_file};
+    ASSERT_FALSE(refs.isComplete());
+    ASSERT_TRUE(refs.owners().empty());
+  }
+}
+
+TEST(Docker, FetchJournal) {
+  TemporaryDirectory dir;
+  const auto journal_file{dir / "fetch-journal.json"};
+  const auto app_step{Docker::FetchJournal::AppStep};
+
+  {
+    Docker::FetchJournal journal{journal_file};
+    journal.begin("plan-01");
+    ASSERT_FALSE(journal.isDone("app-01/hash-01", app_step));
+    journal.setDone("app-01/hash-01", app_step);
+    journal.setDone("app-01/hash-01", "image-01");
+    journal.setDone("app-02/hash-01", app_step);
+  }
+  {
+    // the journal survives restarts and the same plan is resumed
+    Docker::FetchJournal journal{journal_file};
+    journal.begin("plan-01");
+    ASSERT_TRUE(journal.isDone("app-01/hash-01", app_step));
+    ASSERT_TRUE(journal.isDone("app-01/hash-01", "image-01"));
+    ASSERT_FALSE(journal.isDone("app-01/hash-01", "image-02"));
+    journal.reset("app-02/hash-01");
+    ASSERT_FALSE(journal.isDone("app-02/hash-01", app_step));
+  }
+  {
+    // another plan drops the records
+    Docker::FetchJournal journal{journal_file};
+    ASSERT_TRUE(journal.isDone("app-01/hash-01", app_step));
+    journal.begin("plan-02");
+    ASSERT_FALSE(journal.isDone("app-01/hash-01", app_step));
+  }
+  {
+    // a corrupted journal is dropped
+    Utils::writeFile(journal_file, std::string("corrupted"));
+    Docker::FetchJournal journal{journal_file};
+    journal.begin("plan-01");
+    ASSERT_FALSE(journal.isDone("app-01/hash-01", app_step));
+  }
+}
+
+TEST(Docker, BlobIndex) {
+  TemporaryDirectory dir;
+  Utils::writeFile(dir / "blob-01", std::string("blob"));
+
+  Docker::BlobIndex index{dir.Path()};
+  uint64_t size{0};
+  ASSERT_TRUE(index.getSize("blob-01", size));
+  ASSERT_EQ(4, size);
+  ASSERT_FALSE(index.isPresent("blob-02"));
+
+  // the index does not list the store again
+  Utils::writeFile(dir / "blob-02", std::string("blob-02"));
+  ASSERT_FALSE(index.isPresent("blob-02"));
+  index.update("blob-02");
+  ASSERT_TRUE(index.isPresent("blob-02"));
+  index.remove("blob-01");
+  ASSERT_FALSE(index.isPresent("blob-01"));
+  index.invalidate();
+  ASSERT_TRUE(index.isPresent("blob-01"));
+
+  // a layer shared by Apps being fetched is counted once, the present blobs are not counted at all
+  ASSERT_EQ(30, index.reserve("app-01", {{"layer-01", {10, 100}}, {"layer-02", {20, 200}}}).size);
+  const auto total{index.reserve("app-02", {{"layer-02", {20, 200}}, {"layer-03", {40, 400}}, {"blob-01", {4, 40}}})};
+  ASSERT_EQ(70, total.size);
+  ASSERT_EQ(700, total.usage);
+  index.release("app-01");
+  ASSERT_EQ(60, index.reserve("app-02", {{"layer-02", {20, 200}}, {"layer-03", {40, 400}}}).size);
+}
+
+class DockerDaemonMock : public fixtures::BaseHttpClient {
+ public:
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    if (url == "http://localhost/version") {
+      return HttpResponse("{\"Arch\": \"amd64\"}", 200, CURLE_OK, "");
+    }
+    if (url == "http://localhost/containers/json?all=1") {
+      ++listings;
+      return HttpResponse(containers, 200, CURLE_OK, "");
+    }
+    if (boost::starts_with(url, "http://localhost/containers/") && boost::ends_with(url, "/json")) {
+      ++inspects;
+      return HttpResponse(R"({"State": {"ExitCode": 1, "Health": {"Status": "unhealthy"}}})", 200, CURLE_OK, "");
+    }
+    if (boost::starts_with(url, "http://localhost/containers/") && url.find("/logs?") != std::string::npos) {
+      ++logs;
+      return HttpResponse("logs", 200, CURLE_OK, "");
+    }
+    return HttpResponse("", 500, CURLE_OK, "not supported");
+  }
+
+  std::string containers{
+      R"([{"Id": "id-01", "State": "running", "Status": "Up 1 minute", "Labels": {"com.docker.compose.project": "app-01"}}])"};
+  std::atomic_int listings{0};
+  std::atomic_int inspects{0};
+  std::atomic_int logs{0};
+};
+
+class DockerEventsMock : public fixtures::BaseHttpClient {
+ public:
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)url;
+    (void)from;
+    std::unique_lock<std::mutex> lock{mutex};
+    connected = true;
+    cv.notify_all();
+    while (progress_cb(userp, 0, 0, 0, 0) == 0) {
+      if (pending_events > 0) {
+        std::string event{"{\"Type\": \"container\", \"Action\": \"die\"}\n"};
+        write_cb(&event[0], 1, event.size(), userp);
+        --pending_events;
+        cv.notify_all();
+      }
+      cv.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    return HttpResponse("", 200, CURLE_ABORTED_BY_CALLBACK, "aborted");
+  }
+
+  void waitForConnection() {
+    std::unique_lock<std::mutex> lock{mutex};
+    cv.wait(lock, [this]() { return connected; });
+  }
+  void sendEvent() {
+    std::unique_lock<std::mutex> lock{mutex};
+    ++pending_events;
+    cv.notify_all();
+    cv.wait(lock, [this]() { return pending_events == 0; });
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool connected{false};
+  int pending_events{0};
+};
+
+TEST(Docker, ContainerCache) {
+  auto daemon{std::make_shared<DockerDaemonMock>()};
+  auto events{std::make_shared<DockerEventsMock>()};
+  Json::Value containers;
+  {
+    Docker::DockerClient client{daemon};
+    // no events stream, each query lists the containers
+    client.getContainers(containers);
+    client.getContainers(containers);
+    ASSERT_EQ(2, daemon->listings);
+
+    client.followEvents(events);
+    events->waitForConnection();
+    client.getContainers(containers);
+    client.getContainers(containers);
+    ASSERT_EQ(3, daemon->listings);
+    ASSERT_EQ("running", std::get<1>(client.getContainerState(containers, "app-01", "", "")));
+
+    // a container event makes the listing stale
+    events->sendEvent();
+    client.getContainers(containers);
+    client.getContainers(containers);
+    ASSERT_EQ(4, daemon->listings);
+    // the events stream is stopped along with the client
+  }
+}
+
+TEST(Docker, ContainerStates) {
+  Docker::DockerClient client{std::make_shared<DockerDaemonMock>()};
+  const auto containers{Utils::parseJSON(R"([
+    {"State": "running", "Labels": {"com.docker.compose.project": "app-01", "com.docker.compose.service": "srv-01",
+                                    "io.compose-spec.config-hash": "hash-01"}},
+    {"State": "created", "Labels": {"com.docker.compose.project": "app-01", "com.docker.compose.service": "srv-02",
+                                    "io.compose-spec.config-hash": "hash-02"}},
+    {"State": "running", "Labels": {}}
+  ])")};
+  const auto states{client.getContainerStates(containers)};
+  ASSERT_EQ(2, states.size());
+  ASSERT_EQ("running", states.at(std::make_tuple("app-01", "srv-01", "hash-01")));
+  ASSERT_EQ("created", states.at(std::make_tuple("app-01", "srv-02", "hash-02")));
+  ASSERT_EQ(0, states.count(std::make_tuple("app-01", "srv-01", "hash-02")));
+  // the same as the per-service lookup
+  ASSERT_EQ("created", std::get<1>(client.getContainerState(containers, "app-01", "srv-02", "hash-02")));
+}
+
+TEST(Docker, RunningAppsHealth) {
+  auto daemon{std::make_shared<DockerDaemonMock>()};
+  const auto listing = [](const std::string& uptime, const std::string& health) {
+    Json::Value containers;
+    containers[0]["Id"] = "id-01";
+    containers[0]["State"] = "running";
+    containers[0]["Status"] = "Up " + uptime + " (" + health + ")";
+    containers[1]["Id"] = "id-02";
+    containers[1]["State"] = "exited";
+    containers[1]["Status"] = "Exited (1) " + uptime + " ago";
+    containers[2]["Id"] = "id-03";
+    containers[2]["State"] = "running";
+    containers[2]["Status"] = "Up " + uptime;
+    for (Json::ArrayIndex ii = 0; ii < containers.size(); ++ii) {
+      containers[ii]["Labels"]["com.docker.compose.project"] = "app-01";
+      containers[ii]["Labels"]["com.docker.compose.service"] = "srv-0" + std::to_string(ii + 1);
+    }
+    return Utils::jsonToCanonicalStr(containers);
+  };
+  Docker::DockerClient client{daemon};
+
+  daemon->containers = listing("1 minute", "unhealthy");
+  auto apps{client.getRunningApps(nullptr)};
+  ASSERT_EQ(3, apps["app-01"]["services"].size());
+  ASSERT_EQ("unhealthy", apps["app-01"]["services"][0]["health"].asString());
+  ASSERT_EQ("logs", apps["app-01"]["services"][0]["logs"].asString());
+  ASSERT_EQ("unhealthy", apps["app-01"]["services"][1]["health"].asString());
+  ASSERT_EQ("healthy", apps["app-01"]["services"][2]["health"].asString());
+  ASSERT_EQ(2, daemon->inspects);
+  ASSERT_EQ(2, daemon->logs);
+
+  // the containers' states have not changed, just their uptime
+  daemon->containers = listing("2 minutes", "unhealthy");
+  apps = client.getRunningApps(nullptr);
+  ASSERT_EQ("unhealthy", apps["app-01"]["services"][0]["health"].asString());
+  ASSERT_EQ("logs", apps["app-01"]["services"][0]["logs"].asString());
+  ASSERT_EQ("unhealthy", apps["app-01"]["services"][1]["health"].asString());
+  ASSERT_EQ(2, daemon->inspects);
+  ASSERT_EQ(2, daemon->logs);
+
+  // the health check status change is a state transition
+  daemon->containers = listing("2 minutes", "health: starting");
+  client.getRunningApps(nullptr);
+  ASSERT_EQ(3, daemon->inspects);
+  ASSERT_EQ(3, daemon->logs);
+}
+
+class SlowDockerDaemonMock : public fixtures::BaseHttpClient {
+ public:
+  struct Stat {
+    std::mutex mutex;
+    int in_flight{0};
+    int max_in_flight{0};
+    int version_requests{0};
+  };
+  explicit SlowDockerDaemonMock(std::shared_ptr<Stat> stat) : stat_{std::move(stat)} {}
+
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    {
+      std::lock_guard<std::mutex> lock{stat_->mutex};
+      if (url == "http://localhost/version") {
+        ++stat_->version_requests;
+        return HttpResponse("{\"Arch\": \"arm64\"}", 200, CURLE_OK, "");
+      }
+      stat_->max_in_flight = std::max(stat_->max_in_flight, ++stat_->in_flight);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock{stat_->mutex};
+    --stat_->in_flight;
+    return HttpResponse("{\"State\": {\"ExitCode\": 0}}", 200, CURLE_OK, "");
+  }
+
+ private:
+  std::shared_ptr<Stat> stat_;
+};
+
+TEST(Docker, ConcurrentRequests) {
+  auto stat{std::make_shared<SlowDockerDaemonMock::Stat>()};
+  std::atomic_int connections{0};
+  Docker::DockerClient client{"unix:///var/run/docker.sock", 3, [&](const std::string& docker_host) {
+                                EXPECT_EQ("unix:///var/run/docker.sock", docker_host);
+                                ++connections;
+                                return std::make_shared<SlowDockerDaemonMock>(stat);
+                              }};
+  // nothing is requested until the engine info is used
+  ASSERT_EQ(0, connections);
+  ASSERT_EQ("arm64", client.arch());
+  ASSERT_EQ("arm64", client.engineInfo()["Arch"].asString());
+  ASSERT_EQ(1, stat->version_requests);
+
+  std::vector<std::future<Json::Value>> infos;
+  for (int ii = 0; ii < 6; ++ii) {
+    infos.emplace_back(client.getContainerInfoAsync("id-0" + std::to_string(ii)));
+  }
+  for (auto& info : infos) {
+    ASSERT_EQ(0, info.get()["State"]["ExitCode"].asInt());
+  }
+  // the connections are reused and no more than the max number of them are used at once
+  ASSERT_EQ(3, stat->max_in_flight);
+  ASSERT_LE(connections, 3);
+}
+
+class NativeDockerDaemonMock : public fixtures::BaseHttpClient {
+ public:
+  HttpResponse get(const std::string& url, int64_t maxsize) override {
+    (void)maxsize;
+    if (url == "http://localhost/containers/json?all=1") {
+      return HttpResponse(Utils::jsonToCanonicalStr(containers), 200, CURLE_OK, "");
+    }
+    if (boost::starts_with(url, "http://localhost/networks/")) {
+      return HttpResponse("", network_present ? 200 : 404, CURLE_OK, "");
+    }
+    return HttpResponse("", 500, CURLE_OK, "not supported");
+  }
+  HttpResponse post(const std::string& url, const Json::Value& data) override {
+    requests.push_back(url.substr(std::string("http://localhost").size()));
+    if (failing.count(requests.back()) > 0) {
+      return HttpResponse("", 500, CURLE_OK, "failed");
+    }
+    if (boost::starts_with(url, "http://localhost/containers/create?name=")) {
+      created.push_back(data);
+      return HttpResponse("{\"Id\": \"new-id-0" + std::to_string(created.size()) + "\"}", 201, CURLE_OK, "");
+    }
+    return HttpResponse("", 204, CURLE_OK, "");
+  }
+
+  void addContainer(const std::string& id, const std::string& service, const std::string& hash,
+                    const std::string& state, const std::string& name = "") {
+    Json::Value container;
+    container["Id"] = id;
+    container["State"] = state;
+    if (!name.empty()) {
+      container["Names"].append("/" + name);
+    }
+    container["Labels"][Docker::NativeCompose::ProjectLabel] = "app-01";
+    container["Labels"][Docker::NativeCompose::ServiceLabel] = service;
+    container["Labels"][Docker::NativeCompose::ConfigHashLabel] = hash;
+    containers.append(container);
+  }
+
+  Json::Value containers{Json::arrayValue};
+  bool network_present{false};
+  std::vector<std::string> requests;
+  std::set<std::string> failing;
+  std::vector<Json::Value> created;
+};
+
+TEST(Docker, NativeCompose) {
+  // JSON is YAML as well
+  const std::string compose_file{R"({
+    "services": {
+      "app": {
+        "image": "hub.io/factory/app@sha256:01",
+        "labels": {"io.compose-spec.config-hash": "app-hash"},
+        "command": "serve --port 8080",
+        "environment": {"MODE": "prod", "WORKERS": 4},
+        "ports": ["127.0.0.1:80:8080", "9090/udp"],
+        "volumes": ["./data:/data:ro", "/var/run/app:/run"],
+        "restart": "on-failure:3",
+        "depends_on": {"db": {"condition": "service_started"}}
+      },
+      "db": {
+        "image": "hub.io/factory/db@sha256:02",
+        "labels": {"io.compose-spec.config-hash": "db-hash"},
+        "network_mode": "host"
+      }
+    }
+  })"};
+  const auto compose{Docker::ComposeInfo::loadContent(compose_file)};
+  ASSERT_EQ("", Docker::NativeCompose::getUnsupportedFeature(compose->json()));
+  ASSERT_EQ((std::vector<std::string>{"db", "app"}), Docker::NativeCompose::getStartOrder(compose->json()));
+
+  {
+    // the compose files using features which are not supported are left for `docker compose`
+    const auto unsupported{[&compose](const std::function<void(Json::Value&)>& change) {
+      Json::Value json{compose->json()};
+      change(json);
+      return Docker::NativeCompose::getUnsupportedFeature(json);
+    }};
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["volumes"]["data"] = Json::objectValue; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["build"] = "."; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["volumes"][0] = "data:/data"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["ports"][0] = "80-81:80-81"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["command"] = "sh -c 'serve'"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["environment"]["MODE"] = "${MODE}"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) {
+      json["services"]["app"]["depends_on"]["db"]["condition"] = "service_healthy";
+    }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["db"]["depends_on"][0] = "app"; }));
+    // the values which `compose config` would reject are not brought up natively
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["image"] = "hub.io/app ; rm -rf /"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["image"] = 42; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["command"][0] = 8080; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["entrypoint"]["sh"] = "-c"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["environment"]["MY VAR"] = "1"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["environment"]["LIST"][0] = "a"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) {
+      json["services"]["app"]["environment"] = Json::arrayValue;
+      json["services"]["app"]["environment"][0] = "=value";
+    }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["my app"] = json["services"]["db"]; }));
+    // the values of an unexpected type are reported rather than thrown on
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["restart"]["name"] = "always"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["db"]["network_mode"][0] = "host"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["ports"][0]["target"] = 8080; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) {
+      json["services"]["app"]["depends_on"]["db"]["condition"]["type"] = "service_started";
+    }));
+    ASSERT_NE("", unsupported([](Json::Value& json) { json["services"]["app"]["depends_on"]["db"] = "started"; }));
+    ASSERT_NE("", unsupported([](Json::Value& json) {
+      json["services"]["app"]["depends_on"] = Json::arrayValue;
+      json["services"]["app"]["depends_on"][0]["db"] = "started";
+    }));
+  }
+
+  const boost::filesystem::path app_dir{"/var/sota/compose-apps/app-01"};
+  {
+    // a fresh App
+    auto daemon{std::make_shared<NativeDockerDaemonMock>()};
+    Docker::NativeCompose native_compose{std::make_shared<Docker::DockerClient>(daemon)};
+    native_compose.up("app-01", app_dir, *compose, true);
+    ASSERT_EQ((std::vector<std::string>{"/networks/create", "/containers/create?name=app-01-db-1",
+                                        "/containers/new-id-01/start", "/containers/create?name=app-01-app-1",
+                                        "/containers/new-id-02/start"}),
+              daemon->requests);
+
+    const auto& db{daemon->created[0]};
+    ASSERT_EQ("host", db["HostConfig"]["NetworkMode"].asString());
+    ASSERT_EQ("db-hash", db["Labels"][Docker::NativeCompose::ConfigHashLabel].asString());
+    ASSERT_EQ("app-01", db["Labels"][Docker::NativeCompose::ProjectLabel].asString());
+
+    const auto& app{daemon->created[1]};
+    ASSERT_EQ("hub.io/factory/app@sha256:01", app["Image"].asString());
+    ASSERT_EQ("app", app["Labels"][Docker::NativeCompose::ServiceLabel].asString());
+    ASSERT_EQ(Utils::parseJSON(R"(["serve", "--port", "8080"])"), app["Cmd"]);
+    ASSERT_EQ(Utils::parseJSON(R"(["MODE=prod", "WORKERS=4"])"), app["Env"]);
+    ASSERT_EQ("app-01_default", app["HostConfig"]["NetworkMode"].asString());
+    ASSERT_EQ("app", app["NetworkingConfig"]["EndpointsConfig"]["app-01_default"]["Aliases"][0].asString());
+    ASSERT_EQ(Utils::parseJSON(R"(["/var/sota/compose-apps/app-01/data:/data:ro", "/var/run/app:/run"])"),
+              app["HostConfig"]["Binds"]);
+    ASSERT_EQ("on-failure", app["HostConfig"]["RestartPolicy"]["Name"].asString());
+    ASSERT_EQ(3, app["HostConfig"]["RestartPolicy"]["MaximumRetryCount"].asInt());
+    ASSERT_EQ("127.0.0.1", app["HostConfig"]["PortBindings"]["8080/tcp"][0]["HostIp"].asString());
+    ASSERT_EQ("80", app["HostConfig"]["PortBindings"]["8080/tcp"][0]["HostPort"].asString());
+    ASSERT_TRUE(app["ExposedPorts"].isMember("9090/udp"));
+  }
+  {
+    // an updated App, just the changed service is recreated and the orphaned one is removed
+    auto daemon{std::make_shared<NativeDockerDaemonMock>()};
+    daemon->network_present = true;
+    daemon->addContainer("db-id", "db", "db-hash", "exited");
+    daemon->addContainer("app-id", "app", "old-app-hash", "running");
+    daemon->addContainer("cache-id", "cache", "cache-hash", "running");
+    Docker::NativeCompose native_compose{std::make_shared<Docker::DockerClient>(daemon)};
+    native_compose.up("app-01", app_dir, *compose, false);
+    ASSERT_EQ(5, daemon->requests.size());
+    ASSERT_EQ("/containers/cache-id/stop", daemon->requests[0]);
+    ASSERT_TRUE(boost::starts_with(daemon->requests[1], "/containers/prune?filters="));
+    ASSERT_EQ("/containers/app-id/stop", daemon->requests[2]);
+    ASSERT_TRUE(boost::starts_with(daemon->requests[3], "/containers/prune?filters="));
+    ASSERT_EQ("/containers/create?name=app-01-app-1", daemon->requests[4]);
+    ASSERT_EQ(1, daemon->created.size());
+
+    daemon->requests.clear();
+    native_compose.down("app-01");
+    ASSERT_EQ("/containers/app-id/stop", daemon->requests[0]);
+    ASSERT_TRUE(boost::starts_with(daemon->requests[daemon->requests.size() - 2], "/containers/prune?filters="));
+    ASSERT_TRUE(boost::starts_with(daemon->requests.back(), "/networks/prune?filters="));
+  }
+  {
+    // an updated App switched over, the new container is created before the old one is stopped
+    auto daemon{std::make_shared<NativeDockerDaemonMock>()};
+    daemon->network_present = true;
+    daemon->addContainer("db-id", "db", "db-hash", "running");
+    daemon->addContainer("app-id", "app", "old-app-hash", "running");
+    daemon->addContainer("cache-id", "cache", "cache-hash", "running");
+    Docker::NativeCompose native_compose{std::make_shared<Docker::DockerClient>(daemon)};
+    native_compose.setSwitchOver(true);
+    native_compose.up("app-01", app_dir, *compose, true);
+    ASSERT_EQ(8, daemon->requests.size());
+    ASSERT_EQ("/containers/create?name=app-01-app-1-next", daemon->requests[0]);
+    ASSERT_EQ("/containers/app-id/rename?name=app-01-app-1-prev", daemon->requests[1]);
+    ASSERT_EQ("/containers/app-id/stop", daemon->requests[2]);
+    ASSERT_EQ("/containers/new-id-01/rename?name=app-01-app-1", daemon->requests[3]);
+    ASSERT_EQ("/containers/new-id-01/start", daemon->requests[4]);
+    // just the old version of the service is removed
+    ASSERT_TRUE(boost::starts_with(daemon->requests[5], "/containers/prune?filters="));
+    ASSERT_NE(std::string::npos, daemon->requests[5].find("old-app-hash"));
+    ASSERT_EQ("/containers/cache-id/stop", daemon->requests[6]);
+
+    // the new container fails to start, the service is switched back to the old one
+    daemon->requests.clear();
+    daemon->created.clear();
+    daemon->failing.emplace("/containers/new-id-01/start");
+    EXPECT_THROW(native_compose.up("app-01", app_dir, *compose, true), std::runtime_error);
+    ASSERT_EQ(9, daemon->requests.size());
+    ASSERT_EQ("/containers/new-id-01/start", daemon->requests[4]);
+    ASSERT_EQ("/containers/new-id-01/stop", daemon->requests[5]);
+    ASSERT_NE(std::string::npos, daemon->requests[6].find("app-hash"));
+    ASSERT_EQ(std::string::npos, daemon->requests[6].find("old-app-hash"));
+    ASSERT_EQ("/containers/app-id/rename?name=app-01-app-1", daemon->requests[7]);
+    ASSERT_EQ("/containers/app-id/start", daemon->requests[8]);
+  }
+  {
+    // the old containers are retained, so switching back to them, e.g. on a rollback, doesn't create them again
+    auto daemon{std::make_shared<NativeDockerDaemonMock>()};
+    daemon->network_present = true;
+    daemon->addContainer("db-id", "db", "db-hash", "running");
+    daemon->addContainer("app-id", "app", "old-app-hash", "running");
+    Docker::NativeCompose native_compose{std::make_shared<Docker::DockerClient>(daemon)};
+    native_compose.setSwitchOver(true);
+    native_compose.setRetainPrevious(true);
+    native_compose.up("app-01", app_dir, *compose, true);
+    ASSERT_EQ(5, daemon->requests.size());
+    ASSERT_EQ("/containers/create?name=app-01-app-1-next", daemon->requests[0]);
+    ASSERT_EQ("true", daemon->created[0]["Labels"]["aktualizr-no-prune"].asString());
+    ASSERT_EQ("/containers/app-id/rename?name=app-01-app-1-prev", daemon->requests[1]);
+    ASSERT_EQ("/containers/new-id-01/start", daemon->requests[4]);
+
+    // the retained container is of the target version
+    daemon->requests.clear();
+    daemon->created.clear();
+    daemon->containers = Json::arrayValue;
+    daemon->addContainer("db-id", "db", "db-hash", "running");
+    daemon->addContainer("new-id-01", "app", "new-app-hash", "running", "app-01-app-1");
+    daemon->addContainer("app-id", "app", "app-hash", "exited", "app-01-app-1-prev");
+    native_compose.up("app-01", app_dir, *compose, true);
+    ASSERT_EQ(0, daemon->created.size());
+    ASSERT_EQ((std::vector<std::string>{"/containers/app-id/rename?name=app-01-app-1-next",
+                                        "/containers/new-id-01/rename?name=app-01-app-1-prev",
+                                        "/containers/new-id-01/stop", "/containers/app-id/rename?name=app-01-app-1",
+                                        "/containers/app-id/start"}),
+              daemon->requests);
+
+    // the reused container fails to start, it is retained again
+    daemon->requests.clear();
+    daemon->failing.emplace("/containers/app-id/start");
+    EXPECT_THROW(native_compose.up("app-01", app_dir, *compose, true), std::runtime_error);
+    ASSERT_EQ(0, daemon->created.size());
+    ASSERT_EQ("/containers/app-id/stop", daemon->requests[5]);
+    ASSERT_EQ("/containers/app-id/rename?name=app-01-app-1-next", daemon->requests[6]);
+    ASSERT_EQ("/containers/new-id-01/rename?name=app-01-app-1", daemon->requests[7]);
+    ASSERT_EQ("/containers/new-id-01/start", daemon->requests[8]);
+    ASSERT_EQ("/containers/app-id/rename?name=app-01-app-1-prev", daemon->requests[9]);
+
+    // the retained containers are removed once they are not needed anymore
+    daemon->requests.clear();
+    native_compose.removeRetained("app-01");
+    ASSERT_EQ(1, daemon->requests.size());
+    ASSERT_TRUE(boost::starts_with(daemon->requests[0], "/containers/prune?filters="));
+    ASSERT_NE(std::string::npos, daemon->requests[0].find("app-hash"));
+    ASSERT_EQ(std::string::npos, daemon->requests[0].find("new-app-hash"));
+  }
+}
+
+TEST(Docker, DockerStore) {
+  TemporaryDirectory dir;
+  const auto blob_dir{dir / "blobs" / "sha256"};
+  const auto docker_root{dir / "docker"};
+  boost::filesystem::create_directories(blob_dir);
+  boost::filesystem::create_directories(docker_root / "image" / "overlay2" / "layerdb");
+  boost::filesystem::create_directories(docker_root / "overlay2");
+  ASSERT_TRUE(Docker::DockerStore::isSupported(docker_root));
+  ASSERT_FALSE(Docker::DockerStore::isSupported(dir.Path()));
+
+  const auto sha256 = [](const std::string& data) {
+    return boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(data)));
+  };
+  const auto add_blob = [&](const std::string& data) {
+    const auto hash{sha256(data)};
+    Utils::writeFile(blob_dir / hash, data);
+    return "sha256:" + hash;
+  };
+
+  Json::Value manifest;
+  Json::Value config;
+  for (const auto& file : {"bin/app", "etc/app.conf"}) {
+    const auto layer_dir{dir / "layer"};
+    boost::filesystem::remove_all(layer_dir);
+    Utils::writeFile(layer_dir / file, std::string(file));
+    ASSERT_EQ(0, boost::process::system("tar -cf " + (dir / "layer.tar").string() + " -C " + layer_dir.string() +
+                                        " " + file));
+    config["rootfs"]["diff_ids"].append("sha256:" + sha256(Utils::readFile(dir / "layer.tar")));
+    ASSERT_EQ(0, boost::process::system("gzip -nf " + (dir / "layer.tar").string()));
+    Json::Value layer;
+    layer["digest"] = add_blob(Utils::readFile(dir / "layer.tar.gz"));
+    layer["size"] = Json::Int64(boost::filesystem::file_size(dir / "layer.tar.gz"));
+    manifest["layers"].append(layer);
+  }
+  config["architecture"] = "amd64";
+  const auto config_digest{add_blob(Utils::jsonToCanonicalStr(config))};
+  manifest["config"]["digest"] = config_digest;
+  manifest["config"]["size"] = Json::Int64(Utils::jsonToCanonicalStr(config).size());
+  Json::Value index;
+  index["manifests"][0]["digest"] = add_blob(Utils::jsonToCanonicalStr(manifest));
+  index["manifests"][0]["size"] = Json::Int64(Utils::jsonToCanonicalStr(manifest).size());
+  Utils::writeFile(dir / "image" / "index.json", index);
+
+  const std::string image_uri{"hub.foundries.io/factory/app@sha256:" + sha256("image")};
+  const std::string tag{"hub.foundries.io/factory/app:" + sha256("image").substr(0, 7)};
+  {
+    Docker::DockerStore store{docker_root, blob_dir};
+    ASSERT_EQ(config_digest, store.importImage(dir / "image", {image_uri, tag}));
+    store.commit();
+  }
+
+  const auto image_root{docker_root / "image" / "overlay2"};
+  const auto repositories{Utils::parseJSONFile(image_root / "repositories.json")};
+  ASSERT_EQ(config_digest, repositories["Repositories"]["hub.foundries.io/factory/app"][image_uri].asString());
+  ASSERT_EQ(config_digest, repositories["Repositories"]["hub.foundries.io/factory/app"][tag].asString());
+  ASSERT_EQ(Utils::jsonToCanonicalStr(config),
+            Utils::readFile(image_root / "imagedb" / "content" / "sha256" / Docker::HashedDigest(config_digest).hash()));
+
+  const auto base_chain_id{config["rootfs"]["diff_ids"][0].asString()};
+  const auto chain_id{sha256(base_chain_id + " " + config["rootfs"]["diff_ids"][1].asString())};
+  const auto base_layer_db{image_root / "layerdb" / "sha256" / Docker::HashedDigest(base_chain_id).hash()};
+  const auto layer_db{image_root / "layerdb" / "sha256" / chain_id};
+  ASSERT_FALSE(boost::filesystem::exists(base_layer_db / "parent"));
+  ASSERT_EQ(base_chain_id, Utils::readFile(layer_db / "parent"));
+  ASSERT_EQ(config["rootfs"]["diff_ids"][1].asString(), Utils::readFile(layer_db / "diff"));
+  ASSERT_EQ(std::to_string(std::string("etc/app.conf").size()), Utils::readFile(layer_db / "size"));
+
+  const auto base_layer_dir{docker_root / "overlay2" / Utils::readFile(base_layer_db / "cache-id")};
+  const auto layer_dir{docker_root / "overlay2" / Utils::readFile(layer_db / "cache-id")};
+  ASSERT_EQ("bin/app", Utils::readFile(base_layer_dir / "diff" / "bin" / "app"));
+  ASSERT_EQ("etc/app.conf", Utils::readFile(layer_dir / "diff" / "etc" / "app.conf"));
+  ASSERT_EQ("l/" + Utils::readFile(base_layer_dir / "link"), Utils::readFile(layer_dir / "lower"));
+  ASSERT_TRUE(boost::filesystem::exists(docker_root / "overlay2" / "l" / Utils::readFile(layer_dir / "link") /
+                                        "etc" / "app.conf"));
+
+  {
+    // the daemon reassembles the layer tarball from the layer tar-split and the layer files
+    ASSERT_EQ(0, boost::process::system("gzip -dc " + (base_layer_db / "tar-split.json.gz").string(),
+                                        boost::process::std_out > (dir / "tar-split.json").string()));
+    std::ifstream tar_split{(dir / "tar-split.json").string()};
+    std::string tar;
+    std::string line;
+    int position{0};
+    while (std::getline(tar_split, line)) {
+      const auto entry{Utils::parseJSON(line)};
+      ASSERT_EQ(position++, entry["position"].asInt());
+      if (entry["type"].asInt() == 2) {
+        tar += Utils::fromBase64(entry["payload"].asString());
+      } else {
+        ASSERT_EQ(1, entry["type"].asInt());
+        ASSERT_EQ("bin/app", entry["name"].asString());
+        ASSERT_EQ(std::string("bin/app").size(), entry["size"].asUInt64());
+        tar += Utils::readFile(base_layer_dir / "diff" / entry["name"].asString());
+      }
+    }
+    ASSERT_EQ(base_chain_id, "sha256:" + sha256(tar));
+  }
+
+  {
+    // the layers present in the store are not imported again
+    const auto cache_id{Utils::readFile(layer_db / "cache-id")};
+    Docker::DockerStore store{docker_root, blob_dir};
+    store.importImage(dir / "image", {tag});
+    ASSERT_EQ(cache_id, Utils::readFile(layer_db / "cache-id"));
+  }
+  {
+    // an image is known to the store once it is tagged with the reference and its config is present
+    const Docker::DockerStore store{docker_root, blob_dir};
+    ASSERT_TRUE(store.isImported(dir / "image", image_uri));
+    ASSERT_FALSE(store.isImported(dir / "image", "hub.foundries.io/factory/app:other"));
+    const auto config_file{image_root / "imagedb" / "content" / "sha256" / Docker::HashedDigest(config_digest).hash()};
+    boost::filesystem::remove(config_file);
+    ASSERT_FALSE(store.isImported(dir / "image", image_uri));
+  }
+}
+
+TEST(Docker, ImageRepositories) {
+  TemporaryDirectory dir;
+  const auto blob_dir{dir / "blobs" / "sha256"};
+  const auto docker_root{dir / "docker"};
+  const auto repositories_file{docker_root / "image" / "overlay2" / Docker::ImageRepositories::Filename};
+  const auto add_blob = [&](const Json::Value& value) {
+    const auto data{Utils::jsonToCanonicalStr(value)};
+    const auto hash{boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(data)))};
+    Utils::writeFile(blob_dir / hash, data);
+    Json::Value descriptor;
+    descriptor["digest"] = "sha256:" + hash;
+    descriptor["size"] = Json::Int64(data.size());
+    return descriptor;
+  };
+
+  Json::Value config;
+  config["architecture"] = "amd64";
+  Json::Value manifest;
+  manifest["config"] = add_blob(config);
+  manifest["layers"] = Json::arrayValue;
+  Json::Value index;
+  index["manifests"][0] = add_blob(manifest);
+  Utils::writeFile(dir / "image" / "index.json", index);
+  const auto image_id{manifest["config"]["digest"].asString()};
+
+  const std::string image_uri{"hub.foundries.io:443/factory/app@" + image_id};
+  ASSERT_EQ("hub.foundries.io:443/factory/app", Docker::ImageRepositories::getRepo(image_uri));
+  ASSERT_EQ("hub.foundries.io:443/factory/app",
+            Docker::ImageRepositories::getRepo("hub.foundries.io:443/factory/app:v1"));
+  {
+    Docker::ImageRepositories repositories{docker_root};
+    // nothing is stored if nothing has been added
+    ASSERT_FALSE(repositories.commit());
+    ASSERT_FALSE(boost::filesystem::exists(repositories_file));
+
+    ASSERT_EQ(image_id, repositories.addImage(image_uri, dir / "image", blob_dir));
+    ASSERT_TRUE(repositories.add("hub.foundries.io:443/factory/app:v1", image_id));
+    ASSERT_TRUE(repositories.isModified());
+    ASSERT_TRUE(repositories.commit());
+    ASSERT_FALSE(repositories.isModified());
+    ASSERT_FALSE(boost::filesystem::exists(repositories_file.string() + ".tmp"));
+  }
+
+  const auto repositories_json{Utils::parseJSONFile(repositories_file)};
+  ASSERT_EQ(image_id, repositories_json["Repositories"]["hub.foundries.io:443/factory/app"][image_uri].asString());
+  {
+    // the same references don't modify the stored ones
+    const auto mtime{boost::filesystem::last_write_time(repositories_file)};
+    boost::filesystem::last_write_time(repositories_file, mtime - 10);
+    Docker::ImageRepositories repositories{docker_root};
+    ASSERT_EQ(image_id, repositories.get(image_uri));
+    ASSERT_TRUE(repositories.get("hub.foundries.io:443/factory/app:v2").empty());
+    ASSERT_FALSE(repositories.add("hub.foundries.io:443/factory/app:v1", image_id));
+    repositories.addImage(image_uri, dir / "image", blob_dir);
+    ASSERT_FALSE(repositories.commit());
+    ASSERT_EQ(mtime - 10, boost::filesystem::last_write_time(repositories_file));
+
+    // the other references are kept as they are
+    ASSERT_TRUE(repositories.add("hub.foundries.io:443/factory/app:v1", "sha256:other"));
+    ASSERT_TRUE(repositories.commit());
+  }
+  const Docker::ImageRepositories repositories{docker_root};
+  ASSERT_EQ(image_id, repositories.get(image_uri));
+  ASSERT_EQ("sha256:other", repositories.get("hub.foundries.io:443/factory/app:v1"));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
+
+TEST(Docker, ComposeVerifyCache) {
+  TemporaryDirectory dir;
+  const auto cache_file{dir / "compose-verify-cache.json"};
+
+  {
+    // `echo version --short` stands for the compose version query
+    Docker::ComposeVerifyCache cache{"echo v2", cache_file};
+    ASSERT_FALSE(cache.isVerified("hash-01"));
+    cache.setVerified("hash-01");
+    ASSERT_TRUE(cache.isVerified("hash-01"));
+    ASSERT_FALSE(cache.isVerified("hash-02"));
+  }
+  {
+    // the cache survives restarts
+    Docker::ComposeVerifyCache cache{"echo v2", cache_file};
+    ASSERT_TRUE(cache.isVerified("hash-01"));
+  }
+  {
+    // the content verified by another compose version is verified again
+    Docker::ComposeVerifyCache cache{"echo v3", cache_file};
+    ASSERT_FALSE(cache.isVerified("hash-01"));
+  }
+  {
+    // nothing is cached if the compose version is unknown
+    Docker::ComposeVerifyCache cache{"false", cache_file};
+    cache.setVerified("hash-02");
+    ASSERT_FALSE(cache.isVerified("hash-02"));
+  }
+  {
+    // only the latest entries are kept
+    Docker::ComposeVerifyCache cache{"echo v2", cache_file};
+    for (std::size_t ii = 0; ii < Docker::ComposeVerifyCache::MaxEntries; ++ii) {
+      cache.setVerified("hash-" + std::to_string(ii + 2));
+    }
+    ASSERT_FALSE(cache.isVerified("hash-01"));
+    ASSERT_TRUE(cache.isVerified("hash-2"));
+  }
+}
+
+#ifdef BUILD_AKLITE_WITH_NERDCTL
+TEST(Docker, ContainerdClient) {
+  TemporaryDirectory dir;
+  // a fake nerdctl, it records the container listings and the version queries, and streams the lines of `events`
+  const auto nerdctl{dir.Path() / "nerdctl"};
+  Utils::writeFile(nerdctl, std::string(R"(#!/bin/bash
+dir=$(dirname "$0")
+case "$1" in
+  ps) echo >> "$dir/listings"; cat "$dir/containers";;
+  logs) echo "logs of $4";;
+  version) echo >> "$dir/versions"; echo '{"Client": {"Arch": "arm64"}}';;
+  events) exec tail -n +1 -f "$dir/events";;
+esac
+)"));
+  boost::filesystem::permissions(nerdctl, boost::filesystem::owner_all);
+  Utils::writeFile(dir.Path() / "events", std::string());
+  Utils::writeFile(
+      dir.Path() / "containers",
+      std::string(R"({"ID": "id-01", "Labels": {"com.docker.compose.project": "app-01",
+                   "com.docker.compose.service": "srv-01"}, "State": {"Status": "running"}, "Status": "Up"})"
+                  "\n"
+                  R"({"ID": "id-02", "Labels": {"com.docker.compose.project": "app-01",
+                   "com.docker.compose.service": "srv-02"}, "State": {"Status": "stopped", "ExitStatus": 1}})"
+                  "\n"));
+  const auto count = [&dir](const std::string& file) {
+    return boost::filesystem::exists(dir.Path() / file) ? Utils::readFile(dir.Path() / file).size() : 0;
+  };
+
+  {
+    containerd::Client client{nerdctl.string()};
+    ASSERT_EQ("arm64", client.arch());
+    ASSERT_EQ("arm64", client.engineInfo()["Client"]["Arch"].asString());
+    ASSERT_EQ(1, count("versions"));
+
+    // the unhealthy services are reported along with their logs
+    const auto apps{client.getRunningApps(nullptr)};
+    ASSERT_EQ(2, apps["app-01"]["services"].size());
+    ASSERT_EQ("healthy", apps["app-01"]["services"][0]["health"].asString());
+    ASSERT_FALSE(apps["app-01"]["services"][0].isMember("logs"));
+    ASSERT_EQ("unhealthy", apps["app-01"]["services"][1]["health"].asString());
+    ASSERT_EQ("exited", apps["app-01"]["services"][1]["state"].asString());
+    ASSERT_EQ("logs of id-02\n", apps["app-01"]["services"][1]["logs"].asString());
+
+    // no events stream, each query lists the containers
+    Json::Value containers;
+    client.getContainers(containers);
+    ASSERT_EQ(2, count("listings"));
+    ASSERT_EQ("running", std::get<1>(client.getContainerState(containers, "app-01", "srv-01", "")));
+
+    uint64_t seq{0};
+    client.followEvents();
+    for (int ii = 0; ii < 100 && !client.getEventsSeq(seq); ++ii) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_TRUE(client.getEventsSeq(seq));
+    client.getContainers(containers);
+    client.getContainers(containers);
+    ASSERT_EQ(3, count("listings"));
+
+    // an event makes the listing stale
+    Utils::writeFile(dir.Path() / "events", std::string("{\"Topic\": \"/tasks/exit\"}\n"));
+    uint64_t next_seq{seq};
+    for (int ii = 0; ii < 100 && next_seq == seq; ++ii) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      client.getEventsSeq(next_seq);
+    }
+    ASSERT_NE(seq, next_seq);
+    client.getContainers(containers);
+    client.getContainers(containers);
+    ASSERT_EQ(4, count("listings"));
+    // the events stream is stopped along with the client
+  }
+}
+#endif  // BUILD_AKLITE_WITH_NERDCTL
@@ -41,6 +41,42 @@ TEST(Exec, SuccessfulExecFailedExecutable) {
   }
 }
 
+TEST(Exec, Timeout) {
+  ExecStats::instance().reset();
+  const auto begin{std::chrono::steady_clock::now()};
+  ASSERT_THROW(exec(std::chrono::seconds(1), "sleep 10", "sleep failed"), std::runtime_error);
+  ASSERT_LT(std::chrono::steady_clock::now() - begin, std::chrono::seconds(5));
+
+  const auto stats{ExecStats::instance().get()};
+  ASSERT_EQ(1, stats.count("sleep"));
+  ASSERT_EQ(1, stats.at("sleep").timeouts);
+  ASSERT_EQ(1, stats.at("sleep").failures);
+  // the IO service is reusable after the timeout
+  exec("true", "true failed");
+}
+
+TEST(Exec, Stats) {
+  ExecStats::instance().reset();
+  exec("true", "true failed");
+  exec("true", "true failed");
+  ASSERT_THROW(exec("ls --foobar", "ls failed"), std::runtime_error);
+
+  const auto stats{ExecStats::instance().get()};
+  ASSERT_EQ(2, stats.at("true").count);
+  ASSERT_EQ(0, stats.at("true").failures);
+  ASSERT_EQ(2, stats.at("true").histogram[0] + stats.at("true").histogram[1]);
+  ASSERT_EQ(1, stats.at("ls").failures);
+  ASSERT_GT(stats.at("ls").stderr_bytes, 0);
+  const auto stats_json{ExecStats::instance().toJson()};
+  ASSERT_EQ(2, stats_json["true"]["count"].asUInt64());
+
+  ASSERT_EQ("skopeo copy", ExecStats::commandClass("/usr/bin/skopeo copy --all oci:/a docker-daemon:b"));
+  ASSERT_EQ("docker compose up", ExecStats::commandClass("/usr/bin/docker compose up -d"));
+  ASSERT_EQ("tar", ExecStats::commandClass("tar -xzf app.tgz"));
+  ASSERT_EQ("touch", ExecStats::commandClass("touch /tmp/file"));
+  ASSERT_EQ("", ExecStats::commandClass(""));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -1,5 +1,7 @@
+#include <cstring>
 #include <limits>
 #include <random>
+#include <vector>
 
 #include <boost/optional.hpp>
 #include <boost/algorithm/hex.hpp>
@@ -20,7 +22,8 @@ class Image {
      std::size_t size;
    };
 
-   Image(const std::string& name):name_{name}, layer_blob_{Utils::randomUuid()}, manifest_str_{"undefined"} {
+   // the layer is `layer_size` bytes of random data, or a random UUID if the size is not specified
+   Image(const std::string& name, std::size_t layer_size = 0):name_{name}, layer_blob_{randomData(layer_size)}, manifest_str_{"undefined"} {
      manifest_["mediaType"] = "application/vnd.docker.distribution.manifest.v2+json";
      manifest_["schemaVersion"] = 2;
 
@@ -42,6 +45,19 @@ class Image {
    std::string uri(const std::string host = "localhost") const { return host + "/" + uri_; }
 
   private:
+   static std::string randomData(std::size_t size) {
+     if (size == 0) {
+       return Utils::randomUuid();
+     }
+     std::mt19937 gen{std::random_device{}()};
+     std::uniform_int_distribution<int> dist{0, 255};
+     std::string res(size, '\0');
+     for (auto& byte : res) {
+       byte = static_cast<char>(dist(gen));
+     }
+     return res;
+   }
+
    const std::string name_;
    const HashedData layer_blob_;
    const HashedData image_config_{"{}"};
@@ -92,6 +108,19 @@ class ComposeApp {
     return app;
   }
 
+  // An App of `image_numb` services, each of them runs its own image, the layer of each image is `layer_size` bytes
+  static Ptr createWithImages(const std::string& name, std::size_t image_numb, std::size_t layer_size) {
+    Ptr app{new ComposeApp(name, Docker::ComposeAppEngine::ComposeFile, "factory/" + name, image_numb, layer_size)};
+    // the layers manifest lists the actual image layers
+    Json::Value layers_json;
+    for (std::size_t ii = 0; ii < app->images_.size(); ++ii) {
+      layers_json["layers"][static_cast<int>(ii)]["digest"] = "sha256:" + app->images_[ii].layerBlob().hash;
+      layers_json["layers"][static_cast<int>(ii)]["size"] = Json::UInt64(app->images_[ii].layerBlob().size);
+    }
+    app->updateService("service-01", ServiceTemplate, "none", layers_json);
+    return app;
+  }
+
   static Ptr createAppWithCustomeLayers(const std::string& name, const Json::Value& layers, boost::optional<std::size_t> layer_man_size = boost::none) {
     Ptr app{new ComposeApp(name, Docker::ComposeAppEngine::ComposeFile, "factory/image-01")};
     app->updateService("service-01", ServiceTemplate, "none", layers, layer_man_size);
@@ -99,10 +128,17 @@ class ComposeApp {
   }
 
   const std::string& updateService(const std::string& service, const std::string& service_template = ServiceTemplate, const std::string& failure = "none", const Json::Value& layers = Json::Value(), boost::optional<std::size_t> layer_man_size = boost::none) {
-    char service_content[1024];
-    sprintf(service_content, service_template.c_str(), service.c_str(), image_.uri().c_str());
+    std::string service_content;
+    for (std::size_t ii = 0; ii < images_.size(); ++ii) {
+      char content[1024];
+      const auto service_name{ii == 0 ? service : service + "-" + std::to_string(ii)};
+      sprintf(content, service_template.c_str(), service_name.c_str(), images_[ii].uri().c_str());
+      service_content += content;
+    }
     auto service_hash = boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(service_content)));
-    sprintf(content_, DefaultTemplate, service_content, service_hash.c_str(), failure.c_str());
+    std::vector<char> content(strlen(DefaultTemplate) + service_content.size() + service_hash.size() + failure.size());
+    sprintf(content.data(), DefaultTemplate, service_content.c_str(), service_hash.c_str(), failure.c_str());
+    content_ = content.data();
     return update(layers, layer_man_size);
   }
 
@@ -111,19 +147,24 @@ class ComposeApp {
   const std::string& archHash() const { return arch_hash_; }
   const std::string& archive() const { return arch_; }
   const std::string& manifest() const { return manifest_; }
-  const Image& image() const { return image_; }
+  const Image& image() const { return images_.front(); }
+  const std::vector<Image>& images() const { return images_; }
   const std::string& layersManifest() const { return layers_manifest_; }
   const std::string& layersHash() const { return layers_hash_; }
 
 
  private:
-  ComposeApp(const std::string& name, const std::string& compose_file, const std::string& image_name):compose_file_{compose_file}, name_{name}, image_{image_name} {}
+  ComposeApp(const std::string& name, const std::string& compose_file, const std::string& image_name, std::size_t image_numb = 1, std::size_t layer_size = 0):compose_file_{compose_file}, name_{name} {
+    for (std::size_t ii = 0; ii < image_numb; ++ii) {
+      images_.emplace_back(image_numb == 1 ? image_name : image_name + "-image-" + std::to_string(ii), layer_size);
+    }
+  }
 
   const std::string& update(const Json::Value& layers = Json::Value(), boost::optional<std::size_t> layer_man_size = boost::none) {
     TemporaryDirectory app_dir;
     TemporaryFile arch_file{"arch.tgz"};
 
-    Utils::writeFile(app_dir.Path() / compose_file_, std::string(content_));
+    Utils::writeFile(app_dir.Path() / compose_file_, content_);
     auto cmd = std::string("tar -czf ") + arch_file.Path().string() + " " + compose_file_;
     if (0 != boost::process::system(cmd, boost::process::start_dir = app_dir.Path())) {
       throw std::runtime_error("failed to create App archive: " + name());
@@ -172,8 +213,8 @@ class ComposeApp {
  private:
   const std::string compose_file_;
   const std::string name_;
-  const Image image_;
-  char content_[4096];
+  std::vector<Image> images_;
+  std::string content_;
 
   std::string arch_;
   std::string arch_hash_;
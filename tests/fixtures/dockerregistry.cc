@@ -1,8 +1,19 @@
+#include <random>
+#include <thread>
+
 namespace fixtures {
 
 class DockerRegistry {
  public:
+  // emulated network conditions, applied to both the fake registry process and the in-process HTTP client
+  struct NetworkConditions {
+    int latency_ms{0};
+    int bandwidth_kbps{0};
+    double loss_percent{0};
+  };
+
   static std::string RunCmd;
+  static NetworkConditions Network;
 
  public:
   DockerRegistry(const boost::filesystem::path& dir,
@@ -10,7 +21,7 @@ class DockerRegistry {
                  const std::string& auth_url = "https://ota-lite.foundries.io:8443/hub-creds/",
                  const std::string& repo = "factory",
                  bool no_auth = false):
-                 dir_{dir}, base_url_{base_url}, auth_url_{auth_url}, repo_{repo}, port_{TestUtils::getFreePort()}, process_{RunCmd, "--port", port_, "--dir", dir.string()}, no_auth_{no_auth} {
+                 dir_{dir}, base_url_{base_url}, auth_url_{auth_url}, repo_{repo}, port_{TestUtils::getFreePort()}, process_{RunCmd, "--port", port_, "--dir", dir.string(), "--latency", std::to_string(Network.latency_ms), "--bandwidth", std::to_string(Network.bandwidth_kbps), "--loss", std::to_string(Network.loss_percent)}, no_auth_{no_auth} {
     TestUtils::waitForServer("http://localhost:" + port_ + "/v2/");
   }
 
@@ -53,12 +64,21 @@ class DockerRegistry {
     manifest2pull_numb_.emplace("sha256:" + app->hash(), 0);
     blob2app_.emplace("sha256:" + app->archHash(), app);
 
-    Utils::writeFile(dir_ / app->image().name() / "blobs" / app->image().layerBlob().hash, app->image().layerBlob().data);
-    Utils::writeFile(dir_ / app->image().name() / "blobs" / app->image().config().hash, app->image().config().data);
-    Utils::writeFile(dir_ / app->image().name() / "manifests" / app->image().manifest().hash, app->image().manifest().data);
+    for (const auto& image : app->images()) {
+      Utils::writeFile(dir_ / image.name() / "blobs" / image.layerBlob().hash, image.layerBlob().data);
+      Utils::writeFile(dir_ / image.name() / "blobs" / image.config().hash, image.config().data);
+      Utils::writeFile(dir_ / image.name() / "manifests" / image.manifest().hash, image.manifest().data);
+    }
     return {app->name(), app_uri};
   }
 
+  // Publishes a blob in the App repository, e.g. a layer delta, returns its hash
+  std::string addBlob(const std::string& data) {
+    const auto hash{boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(data)))};
+    hash2blob_.emplace("sha256:" + hash, data);
+    return hash;
+  }
+
   std::string getAppManifest(const std::string &url) {
     auto digest = parseUrl(url, "manifests");
     if (hash2manifest_.count(digest) == 0) {
@@ -78,6 +98,9 @@ class DockerRegistry {
 
   std::string getAppArchive(const std::string &url) const {
     auto digest = parseUrl(url, "blobs");
+    if (hash2blob_.count(digest) == 1) {
+      return hash2blob_.at(digest);
+    }
     if (blob2app_.count(digest) == 0) {
       return ""; //TODO: throw exception
     }
@@ -109,21 +132,29 @@ class DockerRegistry {
  private:
   class HttpClient: public BaseHttpClient {
    public:
-    HttpClient(DockerRegistry& registry, const std::vector<std::string>* headers_in = nullptr):registry_{registry}, headers_in_{headers_in}{}
+    HttpClient(DockerRegistry& registry, const std::vector<std::string>* headers_in = nullptr):registry_{registry} {
+      // make a copy of headers since RegistryClient can reuse an instance of the client
+      if (headers_in != nullptr) {
+        headers_in_ = *headers_in;
+      }
+    }
     HttpResponse get(const std::string &url, int64_t maxsize) override {
       std::string resp;
+      if (!applyNetworkConditions(0)) {
+        return HttpResponse(resp, 0, CURLE_RECV_ERROR, "Failure when receiving data from the peer");
+      }
       if (std::string::npos != url.find(registry_.base_url_ + "/token-auth/")) {
         // request for OAuth token
         resp = "{\"token\":\"token\"}";
       } else if (std::string::npos != url.find(registry_.base_url_ + "/v2/")) {
         if (registry_.auth()) {
-          if (headers_in_ == nullptr || headers_in_->size() == 0) {
+          if (headers_in_.size() == 0) {
             return HttpResponse(resp, 401, CURLE_OK, "Unauthorized", {{"www-authenticate", registry_.getWwwAuthHeader(url)}});
           }
-          auto auth_find_it = std::find_if(headers_in_->begin(), headers_in_->end(), [](const std::string& header) {
+          auto auth_find_it = std::find_if(headers_in_.begin(), headers_in_.end(), [](const std::string& header) {
               return boost::starts_with(header, "authorization");
           });
-          if (auth_find_it == headers_in_->end()) {
+          if (auth_find_it == headers_in_.end()) {
             return HttpResponse(resp, 401, CURLE_OK, "Unauthorized", {{"www-authenticate", registry_.getWwwAuthHeader(url)}});
           }
         }
@@ -146,28 +177,49 @@ class DockerRegistry {
     HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) override {
       (void)url;
       (void)progress_cb;
-      (void)from;
 
       if (registry_.auth()) {
-          if (headers_in_ == nullptr || headers_in_->size() == 0) {
+          if (headers_in_.size() == 0) {
             return HttpResponse("", 401, CURLE_OK, "Unauthorized", {{"www-authenticate", registry_.getWwwAuthHeader(url)}});
           }
-          auto auth_find_it = std::find_if(headers_in_->begin(), headers_in_->end(), [](const std::string& header) {
+          auto auth_find_it = std::find_if(headers_in_.begin(), headers_in_.end(), [](const std::string& header) {
               return boost::starts_with(header, "authorization");
           });
-          if (auth_find_it == headers_in_->end()) {
+          if (auth_find_it == headers_in_.end()) {
             return HttpResponse("", 401, CURLE_OK, "Unauthorized", {{"www-authenticate", registry_.getWwwAuthHeader(url)}});
           }
       }
 
       std::string data{registry_.getAppArchive(url)};
+      if (from > 0) {
+        data = data.substr(std::min(static_cast<std::size_t>(from), data.size()));
+      }
+      if (!applyNetworkConditions(data.size())) {
+        return HttpResponse("", 0, CURLE_RECV_ERROR, "Failure when receiving data from the peer");
+      }
       write_cb(const_cast<char*>(data.c_str()), data.size(), 1, userp);
 
-      return HttpResponse("resp", 200, CURLE_OK, "");
+      return HttpResponse("resp", from > 0 ? 206 : 200, CURLE_OK, "");
     }
    private:
+    // Delays the response as the network would, returns false if the request is "lost"
+    static bool applyNetworkConditions(std::size_t data_size) {
+      thread_local std::mt19937 gen{std::random_device{}()};
+      std::uniform_real_distribution<double> dist{0, 100};
+      if (Network.latency_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(Network.latency_ms));
+      }
+      if (Network.loss_percent > 0 && dist(gen) < Network.loss_percent) {
+        return false;
+      }
+      if (Network.bandwidth_kbps > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(data_size * 1000 / (Network.bandwidth_kbps * 1024)));
+      }
+      return true;
+    }
+
     DockerRegistry& registry_;
-    const std::vector<std::string>* headers_in_;
+    std::vector<std::string> headers_in_;
   };
 
   std::array<std::string, 5> parseUrlExt(const std::string& url, std::string endpoint = "") const {
@@ -223,11 +275,13 @@ class DockerRegistry {
   std::unordered_map<std::string, std::string> hash2manifest_;
   std::unordered_map<std::string, int> manifest2pull_numb_;
   std::unordered_map<std::string, ComposeApp::Ptr> blob2app_;
+  std::unordered_map<std::string, std::string> hash2blob_;
 
   bool no_auth_;
   std::function<std::string(const std::string&)> www_auth_func_;
 };
 
 std::string DockerRegistry::RunCmd{"./tests/docker-registry_fake.py"};
+DockerRegistry::NetworkConditions DockerRegistry::Network;
 
 } // namespace fixtures
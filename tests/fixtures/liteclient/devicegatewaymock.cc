@@ -46,12 +46,25 @@ class DeviceGatewayMock {
  public:
   std::string getTreeUri() const { return url_ + "/"; }
   std::string getOsTreeUri() const { return url_ + "/treehub"; }
+  // the same ostree repo served slowly, see getSlowOsTreeRequests()
+  std::string getSlowOsTreeUri() const { return url_ + "/treehub-slow"; }
   std::string getTufRepoUri() const { return url_ + "/repo"; }
   std::string getTlsUri() const { return url_; }
   const std::string& getPort() const { return port_; }
   Json::Value getReqHeaders() const { return Utils::parseJSONFile(req_headers_file_); }
   Json::Value getEvents() const { return Utils::parseJSONFile(events_file_); }
+  // the headers of the last events request
+  Json::Value getEventsReqHeaders() const { return Utils::parseJSONFile(tuf_.getPath() + "/events-headers.json"); }
   bool resetEvents() const { return boost::filesystem::remove(events_file_); }
+  // the paths requested from the slow ostree repo
+  Json::Value getSlowOsTreeRequests() const {
+    const auto file{tuf_.getPath() + "/slow-treehub-requests.json"};
+    return boost::filesystem::exists(file) ? Utils::parseJSONFile(file) : Json::Value(Json::arrayValue);
+  }
+  // the additional ostree remotes returned by `/download-urls`
+  void setDownloadUrls(const Json::Value& urls) const {
+    Utils::writeFile(tuf_.getPath() + "/download-urls.json", Utils::jsonToCanonicalStr(urls));
+  }
   std::string readSotaToml() const { return Utils::readFile(sota_toml_file_); }
   bool resetSotaToml() const { return boost::filesystem::remove(sota_toml_file_); }
 
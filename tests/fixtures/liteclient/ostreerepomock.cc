@@ -12,6 +12,12 @@ class OSTreeRepoMock {
                       "commit from " + src_dir + " to " + path_);
   }
 
+  // Generates a static delta to the given commit, from the given one or from scratch if `from` is empty
+  void generateDelta(const std::string& to, const std::string& from = "") {
+    executeCmd("ostree", { "static-delta", "generate", "--repo", path_, from.empty() ? "--empty" : "--from=" + from,
+                           "--to=" + to }, "generate a static delta to " + to + " in " + path_);
+  }
+
   void set_mode(const std::string& mode) {
     executeCmd("ostree", { "config", "--repo", path_, "set", "core.mode", mode }, "set mode for repo " + path_);
   }
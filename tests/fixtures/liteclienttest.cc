@@ -184,7 +184,10 @@ class ClientTest :virtual public ::testing::Test {
     // Recreate the report queue with the configuration needed for tests, specifically:
     // - make the worker thread not to wait before reading from DB and sending to DG the next set of events;
     // - make the report queue include just one event in a single request to DG.
-    client->report_queue = std::make_unique<ReportQueue>(client->config, client->http_client, client->storage, 0, 1);
+    // The report queue configured by a test is kept as is.
+    if (conf.pacman.extra.count("report_queue_batch_size") == 0) {
+      client->report_queue = std::make_unique<ReportQueue>(client->config, client->http_client, client->storage, 0, 1);
+    }
 
     // import root metadata
     const auto import{client->isRootMetaImportNeeded()};
@@ -1,10 +1,24 @@
 #include <gtest/gtest.h>
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <boost/process.hpp>
+
+#include "appchangetracker.h"
+#include "appdiagnostics.h"
+#include "apparchive.h"
 #include "helpers.h"
 #include "composeappmanager.h"
+#include "downloadpolicy.h"
+#include "pollingscheduler.h"
 #include "primary/reportqueue.h"
+#include "reportworker.h"
+#include "resourcecontrol.h"
 #include "storage/invstorage.h"
 #include "target.h"
+#include "targetcatalog.h"
+#include "updatetrace.h"
 #include "appengine.h"
 
 #include "fixtures/basehttpclient.cc"
@@ -59,6 +73,7 @@ TEST(helpers, lite_client_finalize) {
   config.pacman.booted = BootedType::kStaged;
   config.pacman.extra["compose_apps_root"] = (cfg_dir.Path() / "compose_apps").string();
   config.pacman.extra["compose_apps_tree"] = (cfg_dir.Path() / "apps-tree").string();
+  config.pacman.extra["docker_stop_cmd"] = "/bin/true";
   config.pacman.extra["docker_images_reload_cmd"] = "/bin/true";
   std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
 
@@ -82,6 +97,7 @@ TEST(helpers, lite_client_finalize) {
   config.pacman.booted = BootedType::kStaged;
   config.pacman.extra["compose_apps_root"] = (cfg_dir.Path() / "compose_apps").string();
   config.pacman.extra["compose_apps_tree"] = (cfg_dir.Path() / "apps-tree").string();
+  config.pacman.extra["docker_stop_cmd"] = "/bin/true";
   config.pacman.extra["docker_images_reload_cmd"] = "/bin/true";
 
   target_json["hashes"]["sha256"] = "abcd";
@@ -197,6 +213,7 @@ static LiteClient createClient(TemporaryDirectory& cfg_dir,
   config.pacman.extra["docker_bin"] = "tests/docker_fake.sh";
   config.pacman.extra["compose_apps_root"] = (cfg_dir.Path() / "compose_apps").string();
   config.pacman.extra["compose_apps_tree"] = (cfg_dir.Path() / "apps-tree").string();
+  config.pacman.extra["docker_stop_cmd"] = "/bin/true";
   config.pacman.extra["docker_images_reload_cmd"] = "/bin/true";
 
   std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
@@ -381,7 +398,547 @@ TEST(helpers, rollback_versions) {
   ASSERT_TRUE(known_local_target(client, target_03, known_but_not_installed_versions));
 }
 
+static std::time_t localTime(int hour, int min, int sec = 0) {
+  std::time_t now{std::time(nullptr)};
+  std::tm tm{};
+  localtime_r(&now, &tm);
+  tm.tm_hour = hour;
+  tm.tm_min = min;
+  tm.tm_sec = sec;
+  tm.tm_isdst = -1;
+  return std::mktime(&tm);
+}
+
+TEST(helpers, download_windows) {
+  ASSERT_TRUE(DownloadWindows("").empty());
+  ASSERT_EQ(DownloadWindows("").timeToOpen(std::time(nullptr)).count(), 0);
+
+  const DownloadWindows windows{"22:00-06:00, 12:30-13:30"};
+  ASSERT_FALSE(windows.empty());
+  // within the window spanning midnight
+  ASSERT_EQ(windows.timeToOpen(localTime(23, 15)).count(), 0);
+  ASSERT_EQ(windows.timeToOpen(localTime(5, 59)).count(), 0);
+  ASSERT_EQ(windows.timeToOpen(localTime(12, 30)).count(), 0);
+  // out of the windows, the end is exclusive
+  ASSERT_EQ(windows.timeToOpen(localTime(6, 0)).count(), (6 * 60 + 30) * 60);
+  ASSERT_EQ(windows.timeToOpen(localTime(13, 30, 30)).count(), (8 * 60 + 30) * 60 - 30);
+
+  ASSERT_THROW(DownloadWindows("22:00"), std::invalid_argument);
+  ASSERT_THROW(DownloadWindows("22:00-24:00"), std::invalid_argument);
+  ASSERT_THROW(DownloadWindows("10:00-10:00"), std::invalid_argument);
+  ASSERT_THROW(DownloadWindows("10:00-11:00x"), std::invalid_argument);
+}
+
+TEST(helpers, update_step) {
+  using Action = UpdateStep::Action;
+  const DownloadWindows download_windows{"22:00-06:00"};
+  const DownloadWindows install_windows{"02:00-04:00"};
+
+  // no windows, any time
+  ASSERT_EQ(UpdateStep::next(DownloadWindows(), DownloadWindows(), localTime(12, 0), false, false).action,
+            Action::kUpdate);
+  // out of the download windows
+  {
+    const auto step{UpdateStep::next(download_windows, install_windows, localTime(21, 0), false, false)};
+    ASSERT_EQ(step.action, Action::kWaitForDownloadWindow);
+    ASSERT_EQ(step.time_to_open.count(), 60 * 60);
+  }
+  // within the download windows, but out of the install ones
+  {
+    const auto step{UpdateStep::next(download_windows, install_windows, localTime(23, 0), false, false)};
+    ASSERT_EQ(step.action, Action::kDownloadInAdvance);
+    ASSERT_EQ(step.time_to_open.count(), 3 * 60 * 60);
+  }
+  // the Target downloaded in advance waits for the install window, and then is installed
+  ASSERT_EQ(UpdateStep::next(download_windows, install_windows, localTime(23, 0), true, false).action,
+            Action::kWaitForInstallWindow);
+  ASSERT_EQ(UpdateStep::next(download_windows, install_windows, localTime(3, 0), true, false).action, Action::kUpdate);
+  // the Target downloaded in advance is installed even if the download windows are closed
+  const DownloadWindows day_install_windows{"12:00-13:00"};
+  ASSERT_EQ(UpdateStep::next(download_windows, day_install_windows, localTime(12, 30), true, false).action,
+            Action::kUpdate);
+  ASSERT_EQ(UpdateStep::next(download_windows, day_install_windows, localTime(12, 30), false, false).action,
+            Action::kWaitForDownloadWindow);
+  // a rollback is not postponed
+  ASSERT_EQ(UpdateStep::next(download_windows, install_windows, localTime(12, 0), false, true).action,
+            Action::kUpdate);
+}
+
+TEST(helpers, rate_limiter) {
+  ASSERT_THROW(RateLimiter(0), std::invalid_argument);
+
+  RateLimiter rate_limiter{100 * 1024, 10 * 1024};
+  const auto begin{std::chrono::steady_clock::now()};
+  // the burst is consumed without waiting
+  rate_limiter.consume(10 * 1024);
+  ASSERT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(100));
+  // the rest is consumed at the given rate, regardless of the chunk size
+  rate_limiter.consume(10 * 1024);
+  rate_limiter.consume(40 * 1024);
+  ASSERT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(450));
+}
+
+TEST(helpers, report_worker) {
+  using std::chrono::milliseconds;
+  ReportWorker reports{milliseconds(50), milliseconds(100)};
+  // a failed report is retried with the backoff till it succeeds
+  int attempts{0};
+  const auto started_at{ReportWorker::Clock::now()};
+  reports.post("state", [&attempts]() { return ++attempts == 3; });
+  ASSERT_TRUE(reports.wait(std::chrono::seconds(10)));
+  ASSERT_EQ(attempts, 3);
+  ASSERT_GE(ReportWorker::Clock::now() - started_at, milliseconds(150));
+
+  // the reports posted while one is being sent supersede each other, just the latest one of each kind is sent
+  std::mutex mutex;
+  std::unique_lock<std::mutex> blocked{mutex};
+  std::vector<std::string> sent;
+  reports.post("blocker", [&mutex]() {
+    std::lock_guard<std::mutex> lock{mutex};
+    return true;
+  });
+  std::this_thread::sleep_for(milliseconds(50));
+  for (const auto& value : {"1", "2", "3"}) {
+    reports.post("state", [&sent, value]() {
+      sent.emplace_back(value);
+      return true;
+    });
+  }
+  reports.post("other", [&sent]() {
+    sent.emplace_back("other");
+    return true;
+  });
+  ASSERT_FALSE(reports.wait(milliseconds(50)));
+  blocked.unlock();
+  ASSERT_TRUE(reports.wait(std::chrono::seconds(10)));
+  ASSERT_EQ(sent.size(), 2);
+  ASSERT_NE(std::find(sent.begin(), sent.end(), "3"), sent.end());
+  ASSERT_NE(std::find(sent.begin(), sent.end(), "other"), sent.end());
+
+  // an exception is a failure
+  attempts = 0;
+  reports.post("state", [&attempts]() -> bool {
+    if (++attempts == 1) {
+      throw std::runtime_error("no connection");
+    }
+    return true;
+  });
+  ASSERT_TRUE(reports.wait(std::chrono::seconds(10)));
+  ASSERT_EQ(attempts, 2);
+}
+
+TEST(helpers, polling_scheduler) {
+  using std::chrono::seconds;
+  {
+    // the default, a fixed interval
+    PollingScheduler polling{seconds(300), "device"};
+    ASSERT_EQ(polling.next(), seconds(300));
+    polling.setFailed();
+    ASSERT_EQ(polling.next(), seconds(300));
+    polling.setRollout();
+    ASSERT_EQ(polling.next(), seconds(300));
+  }
+  {
+    PollingScheduler polling{seconds(300), "device", seconds(1000), 0, seconds(60)};
+    // exponential backoff up to the max interval
+    polling.setFailed();
+    ASSERT_EQ(polling.next(), seconds(600));
+    polling.setFailed();
+    ASSERT_EQ(polling.next(), seconds(1000));
+    polling.setFailed();
+    ASSERT_EQ(polling.next(), seconds(1000));
+    polling.setSucceeded();
+    ASSERT_EQ(polling.next(), seconds(300));
+    // faster re-check during a rollout, just once
+    polling.setRollout();
+    ASSERT_EQ(polling.next(), seconds(60));
+    ASSERT_EQ(polling.next(), seconds(300));
+    // the server hint overrides, within the limits
+    polling.setHint(seconds(120));
+    ASSERT_EQ(polling.next(), seconds(120));
+    polling.setHint(seconds(1));
+    ASSERT_EQ(polling.next(), PollingScheduler::MinHint);
+    polling.setHint(seconds(10 * 24 * 3600));
+    ASSERT_EQ(polling.next(), PollingScheduler::MaxHint);
+    ASSERT_EQ(polling.next(), seconds(300));
+  }
+  {
+    // the jitter spreads the intervals, the same way for the same device
+    PollingScheduler polling{seconds(1000), "device-01", seconds::zero(), 10};
+    PollingScheduler same_polling{seconds(1000), "device-01", seconds::zero(), 10};
+    PollingScheduler other_polling{seconds(1000), "device-02", seconds::zero(), 10};
+    bool differs{false};
+    bool varies{false};
+    auto prev{seconds::zero()};
+    for (int ii = 0; ii < 20; ++ii) {
+      const auto wait{polling.next()};
+      ASSERT_GE(wait, seconds(900));
+      ASSERT_LE(wait, seconds(1100));
+      ASSERT_EQ(wait, same_polling.next());
+      differs = differs || wait != other_polling.next();
+      varies = varies || (ii > 0 && wait != prev);
+      prev = wait;
+    }
+    ASSERT_TRUE(differs);
+    ASSERT_TRUE(varies);
+  }
+}
+
+TEST(helpers, polling_scheduler_config) {
+  // the options are not specific to any package manager type
+  PackageConfig pconfig;
+  pconfig.type = "ostree";
+  {
+    const PollingScheduler::Config cfg{pconfig};
+    ASSERT_EQ(cfg.max_sec, 0);
+    ASSERT_EQ(cfg.jitter_percent, 0);
+    ASSERT_TRUE(cfg.download_windows.empty());
+  }
+
+  pconfig.extra["polling_jitter_percent"] = "101";
+  ASSERT_THROW(PollingScheduler::Config{pconfig}, std::invalid_argument);
+  pconfig.extra["polling_jitter_percent"] = "10";
+  pconfig.extra["polling_max_sec"] = "-1";
+  ASSERT_THROW(PollingScheduler::Config{pconfig}, std::invalid_argument);
+  pconfig.extra["polling_max_sec"] = "3600";
+  pconfig.extra["download_windows"] = "22:00";
+  ASSERT_THROW(PollingScheduler::Config{pconfig}, std::invalid_argument);
+  pconfig.extra["download_windows"] = "22:00-06:00";
+  {
+    const PollingScheduler::Config cfg{pconfig};
+    ASSERT_EQ(cfg.jitter_percent, 10);
+    ASSERT_EQ(cfg.max_sec, 3600);
+    ASSERT_FALSE(cfg.download_windows.empty());
+    ASSERT_TRUE(cfg.install_windows.empty());
+  }
+}
+
+TEST(helpers, resource_control) {
+  PackageConfig pconfig;
+  ASSERT_TRUE(ResourceControl::Config(pconfig).empty());
+
+  pconfig.extra["nice"] = "20";
+  ASSERT_THROW(ResourceControl::Config{pconfig}, std::invalid_argument);
+  pconfig.extra["nice"] = "5";
+  pconfig.extra["ionice"] = "best-effort:8";
+  ASSERT_THROW(ResourceControl::Config{pconfig}, std::invalid_argument);
+  pconfig.extra["ionice"] = "low";
+  ASSERT_THROW(ResourceControl::Config{pconfig}, std::invalid_argument);
+  pconfig.extra["ionice"] = "best-effort:6";
+  {
+    const ResourceControl::Config cfg{pconfig};
+    ASSERT_EQ(5, *cfg.nice);
+    ASSERT_EQ(ResourceControl::IoClass::kBestEffort, cfg.io_class);
+    ASSERT_EQ(6, cfg.io_level);
+  }
+  pconfig.extra["cgroup_cpu_weight"] = "50";
+  ASSERT_THROW(ResourceControl::Config{pconfig}, std::invalid_argument);
+  pconfig.extra.erase("cgroup_cpu_weight");
+
+  // applied to the calling thread and the threads it spawns, not to the other threads
+  pconfig.extra["nice"] = "19";
+  pconfig.extra["ionice"] = "idle";
+  const auto nice_before{getpriority(PRIO_PROCESS, 0)};
+  int nice{0};
+  int child_nice{0};
+  long ioprio{0};
+  std::thread([&]() {
+    ResourceControl::apply(ResourceControl::Config(pconfig));
+    nice = getpriority(PRIO_PROCESS, 0);
+    ioprio = syscall(SYS_ioprio_get, 1, 0);
+    std::thread([&child_nice]() { child_nice = getpriority(PRIO_PROCESS, 0); }).join();
+  }).join();
+  ASSERT_EQ(19, nice);
+  ASSERT_EQ(nice, child_nice);
+  ASSERT_EQ(3, ioprio >> 13);
+  ASSERT_EQ(nice_before, getpriority(PRIO_PROCESS, 0));
+}
+
+TEST(helpers, update_trace) {
+  TemporaryDirectory dir;
+  auto& trace{UpdateTrace::instance()};
+  trace.reset();
+  trace.setOutput(dir / "trace.json", dir / "trace.prom");
+
+  { UpdateTrace::Span span{"apps_fetch", "app-01"}; }
+  {
+    UpdateTrace::Span span{"apps_fetch", "app-02"};
+    span.setFailed();
+  }
+  ASSERT_FALSE(boost::filesystem::exists(dir / "trace.json"));
+  try {
+    UpdateTrace::Phase phase{"download", "target-01"};
+    throw std::runtime_error("download failure");
+  } catch (const std::runtime_error&) {
+  }
+  // saved once the top-level phase ends
+  ASSERT_TRUE(boost::filesystem::exists(dir / "trace.json"));
+  ASSERT_TRUE(boost::filesystem::exists(dir / "trace.prom"));
+
+  const auto spans{Utils::parseJSONFile(dir / "trace.json")};
+  ASSERT_EQ(3, spans.size());
+  ASSERT_EQ("apps_fetch", spans[0]["name"].asString());
+  ASSERT_EQ("app-01", spans[0]["label"].asString());
+  ASSERT_FALSE(spans[0]["failed"].asBool());
+  ASSERT_TRUE(spans[1]["failed"].asBool());
+  ASSERT_EQ("download", spans[2]["name"].asString());
+  ASSERT_TRUE(spans[2]["failed"].asBool());
+  ASSERT_EQ(0, trace.toJson(std::chrono::system_clock::now() + std::chrono::hours(1)).size());
+
+  const auto prom{Utils::readFile(dir / "trace.prom")};
+  ASSERT_NE(std::string::npos, prom.find("# TYPE aklite_update_phase_runs_total counter"));
+  ASSERT_NE(std::string::npos, prom.find("aklite_update_phase_runs_total{phase=\"apps_fetch\"} 2\n"));
+  ASSERT_NE(std::string::npos, prom.find("aklite_update_phase_failures_total{phase=\"apps_fetch\"} 1\n"));
+  ASSERT_NE(std::string::npos, prom.find("aklite_update_phase_failures_total{phase=\"download\"} 1\n"));
+
+  // just the last spans are kept
+  for (std::size_t ii = 0; ii < UpdateTrace::MaxSpans; ++ii) {
+    UpdateTrace::Span span{"install"};
+  }
+  const auto last_spans{trace.toJson()};
+  ASSERT_EQ(UpdateTrace::MaxSpans, last_spans.size());
+  ASSERT_EQ("install", last_spans[0]["name"].asString());
+  trace.reset();
+  trace.setOutput("", "");
+}
+
 #ifndef __NO_MAIN__
+TEST(helpers, app_archive) {
+  TemporaryDirectory dir;
+  const auto src_dir{dir / "src"};
+  Utils::writeFile(src_dir / "docker-compose.yml", std::string("services:\n  app:\n    image: app:latest\n"));
+  Utils::writeFile(src_dir / "config" / "app.conf", std::string("conf"));
+  boost::filesystem::create_symlink("config/app.conf", src_dir / "app.conf");
+  const auto archive_file{dir / "app.tgz"};
+  ASSERT_EQ(0, boost::process::system("tar -czf " + archive_file.string() + " -C " + src_dir.string() + " ."));
+
+  ASSERT_TRUE(AppArchive::isGzip(archive_file));
+  ASSERT_FALSE(AppArchive::isGzip(src_dir / "docker-compose.yml"));
+  const AppArchive archive{archive_file};
+  ASSERT_EQ("services:\n  app:\n    image: app:latest\n", archive.readFile("docker-compose.yml"));
+  ASSERT_EQ("conf", archive.readFile("./config/app.conf"));
+  ASSERT_THROW(archive.readFile("missing.yml"), std::runtime_error);
+  ASSERT_EQ(Utils::readFile(src_dir / "docker-compose.yml").size() + 4, archive.getExtractedSize());
+
+  const auto dst_dir{dir / "dst"};
+  Utils::writeFile(dst_dir / "config" / "app.conf", std::string("old conf"));
+  archive.extract(dst_dir);
+  ASSERT_EQ(Utils::readFile(src_dir / "docker-compose.yml"), Utils::readFile(dst_dir / "docker-compose.yml"));
+  ASSERT_EQ("conf", Utils::readFile(dst_dir / "config" / "app.conf"));
+  ASSERT_TRUE(boost::filesystem::is_symlink(dst_dir / "app.conf"));
+  ASSERT_EQ("conf", Utils::readFile(dst_dir / "app.conf"));
+
+  // a member that points outside of the destination dir is rejected
+  Utils::writeFile(dir / "evil" / "file", std::string("evil"));
+  ASSERT_EQ(0, boost::process::system("tar -czf " + archive_file.string() + " -C " + (dir / "evil").string() +
+                                      " --transform=s,^,../, file"));
+  ASSERT_THROW(AppArchive(archive_file).extract(dst_dir), std::runtime_error);
+  ASSERT_FALSE(boost::filesystem::exists(dir / "file"));
+}
+
+TEST(helpers, app_change_tracker) {
+  TemporaryDirectory dir;
+  const auto apps_root{dir / "compose-apps"};
+  Utils::writeFile(apps_root / "app-01" / "docker-compose.yml", std::string("services: {}"));
+  bool events_connected{true};
+  uint64_t events_seq{1};
+  AppChangeTracker tracker{{apps_root, dir / "reset-apps" / "apps"},
+                           [&](uint64_t& seq) {
+                             seq = events_seq;
+                             return events_connected;
+                           },
+                           std::chrono::seconds(3600)};
+
+  tracker.update("target-01");
+  ASSERT_TRUE(tracker.isDirty("app-01", "uri-01"));
+  tracker.setClean("app-01", "uri-01");
+  tracker.update("target-01");
+  ASSERT_FALSE(tracker.isDirty("app-01", "uri-01"));
+  // the App has been updated
+  ASSERT_TRUE(tracker.isDirty("app-01", "uri-02"));
+
+  // a file of the App has been removed
+  boost::filesystem::remove(apps_root / "app-01" / "docker-compose.yml");
+  tracker.update("target-01");
+  ASSERT_TRUE(tracker.isDirty("app-01", "uri-01"));
+  tracker.setClean("app-01", "uri-01");
+
+  // a container event
+  ++events_seq;
+  tracker.update("target-01");
+  ASSERT_TRUE(tracker.isDirty("app-01", "uri-01"));
+  tracker.setClean("app-01", "uri-01");
+  tracker.update("target-01");
+  ASSERT_FALSE(tracker.isDirty("app-01", "uri-01"));
+
+  // the container events are not received
+  events_connected = false;
+  tracker.update("target-01");
+  ASSERT_TRUE(tracker.isDirty("app-01", "uri-01"));
+  events_connected = true;
+  tracker.setClean("app-01", "uri-01");
+
+  // a new Target
+  tracker.update("target-02");
+  ASSERT_TRUE(tracker.isDirty("app-01", "uri-01"));
+  tracker.setClean("app-01", "uri-01");
+
+  // the App dir has been removed
+  boost::filesystem::remove_all(apps_root / "app-01");
+  tracker.update("target-02");
+  ASSERT_TRUE(tracker.isDirty("app-01", "uri-01"));
+}
+
+TEST(helpers, app_diagnostics) {
+  const auto service = [](const std::string& name, const std::string& state, const std::string& status,
+                          const std::string& health, const std::string& logs) {
+    Json::Value val;
+    val["name"] = name;
+    val["hash"] = name + "-hash";
+    val["image"] = "hub.foundries.io/factory/" + name;
+    val["state"] = state;
+    val["status"] = status;
+    val["health"] = health;
+    if (health != "healthy") {
+      val["logs"] = logs;
+    }
+    return val;
+  };
+  Json::Value apps_info;
+  apps_info["app-01"]["uri"] = "hub.foundries.io/factory/app-01@sha256:01";
+  apps_info["app-01"]["services"][0] = service("srv-01", "running", "Up 2 minutes", "healthy", "");
+  const std::string frame_header("\x01\0\0\0\0\0\0\x05", 8);
+  apps_info["app-01"]["services"][1] =
+      service("srv-02", "exited", "Exited (1) 1 minute ago", "unhealthy", frame_header + "boom\n");
+
+  AppDiagnostics diagnostics{1024};
+  const auto report{diagnostics.report(apps_info)};
+  ASSERT_NE(std::string::npos, report.find("\tsrv-01: srv-01-hash; image: hub.foundries.io/factory/srv-01"));
+  // the binary log frame headers are dropped
+  ASSERT_NE(std::string::npos, report.find("app-01/srv-02 (exited (1); unhealthy; srv-02-hash):\nboom\n"));
+  ASSERT_EQ(std::string::npos, report.find("srv-01 ("));
+  // the logs are captured once per transition
+  apps_info["app-01"]["services"][1]["logs"] = "boom again";
+  ASSERT_EQ(report, diagnostics.report(apps_info));
+  apps_info["app-01"]["services"][1]["status"] = "Exited (1) 2 minutes ago";
+  ASSERT_EQ(std::string::npos, diagnostics.report(apps_info).find("boom again"));
+
+  // the last transitions of each service are kept, the latest first
+  for (int ii = 2; ii < 10; ++ii) {
+    apps_info["app-01"]["services"][1]["status"] = "Exited (" + std::to_string(ii) + ") 1 minute ago";
+    apps_info["app-01"]["services"][1]["logs"] = "exit " + std::to_string(ii);
+    diagnostics.report(apps_info);
+  }
+  const auto last_report{diagnostics.report(apps_info)};
+  ASSERT_LT(last_report.find("exit 9"), last_report.find("exit 8"));
+  ASSERT_LT(last_report.find("exit 8"), last_report.find("exit 7"));
+  ASSERT_EQ(std::string::npos, last_report.find("exit 6"));
+
+  // the report is cut at the given size
+  apps_info["app-01"]["services"][1]["status"] = "Exited (10) 1 minute ago";
+  apps_info["app-01"]["services"][1]["logs"] = std::string(4096, 'x');
+  const auto big_report{diagnostics.report(apps_info)};
+  ASSERT_EQ(1024, big_report.size());
+  ASSERT_EQ("\n... truncated\n", big_report.substr(big_report.size() - 15));
+  ASSERT_EQ(0, big_report.find("app-01: hub.foundries.io/factory/app-01@sha256:01"));
+
+  // the logs of a service that is healthy again are dropped
+  apps_info["app-01"]["services"][1] = service("srv-02", "running", "Up 1 second", "healthy", "");
+  ASSERT_EQ(std::string::npos, diagnostics.report(apps_info).find("# Logs of failing services"));
+
+  // the frame sizes of 32 bytes and more are not taken for the log text
+  const std::string stdout_line(64, 'o');
+  const std::string stderr_line{"failed to bind 0.0.0.0:8080: address in use\n"};
+  const std::string frames{std::string("\x01\0\0\0\0\0\0\x40", 8) + stdout_line +
+                           std::string("\x02\0\0\0\0\0\0", 7) + static_cast<char>(stderr_line.size()) +
+                           stderr_line};
+  apps_info["app-01"]["services"][1] = service("srv-02", "exited", "Exited (3) 1 minute ago", "unhealthy", frames);
+  ASSERT_NE(std::string::npos, diagnostics.report(apps_info).find("(exited (3); unhealthy; srv-02-hash):\n" +
+                                                                  stdout_line + stderr_line));
+  // the logs of a container with TTY are not framed
+  apps_info["app-01"]["services"][1] =
+      service("srv-02", "exited", "Exited (4) 1 minute ago", "unhealthy", "tty output\n");
+  ASSERT_NE(std::string::npos,
+            diagnostics.report(apps_info).find("(exited (4); unhealthy; srv-02-hash):\ntty output\n"));
+}
+
+TEST(helpers, target_catalog) {
+  const auto make_target = [](const std::string& name, const std::string& version,
+                              const std::vector<std::string>& hwids, const std::vector<std::string>& tags) {
+    Json::Value target_json;
+    target_json["hashes"]["sha256"] = "00";
+    target_json["length"] = 0;
+    target_json["custom"]["targetFormat"] = "OSTREE";
+    target_json["custom"]["version"] = version;
+    for (const auto& hwid : hwids) {
+      target_json["custom"]["hardwareIds"].append(hwid);
+    }
+    for (const auto& tag : tags) {
+      target_json["custom"]["tags"].append(tag);
+    }
+    return Uptane::Target(name, target_json);
+  };
+  const auto targets{std::make_shared<const std::vector<Uptane::Target>>(std::vector<Uptane::Target>{
+      make_target("hw1-lmp-10", "10", {"hw1"}, {"main"}),   make_target("hw1-lmp-9", "9", {"hw1"}, {"main", "qa"}),
+      make_target("hw1-lmp-11", "11", {"hw1"}, {"qa"}),     make_target("hw2-lmp-12", "12", {"hw2"}, {"main"}),
+      make_target("both-lmp-8", "8", {"hw1", "hw2"}, {}),   make_target("hw1-lmp-10-dup", "10", {"hw1"}, {"main"}),
+  })};
+  const TargetCatalog catalog(7, targets);
+  const Uptane::HardwareIdentifier hw1{"hw1"};
+
+  ASSERT_EQ(7, catalog.version());
+  ASSERT_EQ(targets->size(), catalog.size());
+
+  const auto all{catalog.getTargets(hw1, {})};
+  ASSERT_EQ(5, all.size());
+  ASSERT_EQ("both-lmp-8", all.front()->filename());
+  ASSERT_EQ("hw1-lmp-11", all.back()->filename());
+  ASSERT_EQ("hw1-lmp-11", catalog.getLatest(hw1, {})->filename());
+
+  // the same versions Targets, the one listed first is preferred
+  ASSERT_EQ("hw1-lmp-10", catalog.getLatest(hw1, {"main"})->filename());
+  ASSERT_EQ("hw1-lmp-10", catalog.find(hw1, {"main"}, "10")->filename());
+  ASSERT_EQ("hw1-lmp-10-dup", catalog.find(hw1, {"main"}, "hw1-lmp-10-dup")->filename());
+
+  // a Target having the both tags is listed once
+  const auto tagged{catalog.getTargets(hw1, {"main", "qa"})};
+  ASSERT_EQ(4, tagged.size());
+  ASSERT_EQ("hw1-lmp-9", tagged.front()->filename());
+  ASSERT_EQ("hw1-lmp-11", tagged.back()->filename());
+
+  ASSERT_EQ("hw1-lmp-9", catalog.getLatest(hw1, {"main"}, [](const Uptane::Target& t) {
+                                 return t.custom_version() != "10";
+                               })->filename());
+  ASSERT_EQ(nullptr, catalog.getLatest(hw1, {"foo"}));
+  ASSERT_EQ(nullptr, catalog.getLatest(Uptane::HardwareIdentifier("hw3"), {}));
+  ASSERT_EQ(nullptr, catalog.find(hw1, {"qa"}, "12"));
+  ASSERT_EQ("hw2-lmp-12", catalog.find("hw2-lmp-12")->filename());
+  ASSERT_EQ(nullptr, catalog.find("foo"));
+  // the same instance is returned each time, and it is the one of the given list, not a copy
+  ASSERT_EQ(catalog.find("both-lmp-8"), catalog.getTargets(Uptane::HardwareIdentifier("hw2"), {}).front());
+  ASSERT_EQ(&targets->at(4), catalog.find("both-lmp-8").get());
+  // the list is kept while the returned Targets are in use
+  TargetCatalog::TargetPtr target;
+  {
+    const auto list{std::make_shared<const std::vector<Uptane::Target>>(*targets)};
+    target = TargetCatalog(1, list).find("hw1-lmp-9");
+  }
+  ASSERT_EQ("hw1-lmp-9", target->filename());
+}
+
+TEST(helpers, gzip_compress) {
+  TemporaryDirectory dir;
+  std::string data;
+  for (int ii = 0; ii < 1000; ++ii) {
+    data += "{\"app-" + std::to_string(ii) + "\": {\"state\": \"healthy\"}}\n";
+  }
+  const auto compressed{gzip_compress(data)};
+  ASSERT_LT(compressed.size(), data.size() / 10);
+  Utils::writeFile(dir / "data.gz", compressed);
+  ASSERT_EQ(0, boost::process::system("gzip -d " + (dir / "data.gz").string()));
+  ASSERT_EQ(data, Utils::readFile(dir / "data"));
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -5,6 +5,8 @@
 #include <boost/process.hpp>
 #include <boost/process/env.hpp>
 
+#include <sqlite3.h>
+
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
 #include "test_utils.h"
@@ -16,6 +18,7 @@
 
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include "docker/composeappengine.h"
 #include "helpers.h"
@@ -76,6 +79,43 @@ class LiteClientTest : public fixtures::ClientTest {
   std::shared_ptr<NiceMock<MockAppEngine>> app_engine_mock_;
 };
 
+class LiteClientTestWal : public LiteClientTest {
+ protected:
+  void tweakConf(Config& conf) override { conf.pacman.extra["storage_journal_mode"] = "wal"; };
+};
+
+class LiteClientTestDeferredCleanup : public LiteClientTest {
+ protected:
+  void tweakConf(Config& conf) override { conf.pacman.extra["deferred_cleanup"] = "1"; };
+};
+
+class LiteClientTestReportQueue : public LiteClientTest {
+ protected:
+  void tweakConf(Config& conf) override {
+    conf.pacman.extra["report_queue_flush_interval"] = "1";
+    conf.pacman.extra["report_queue_batch_size"] = "2";
+    conf.pacman.extra["report_queue_gzip"] = "1";
+  };
+};
+
+class LiteClientTestDeltaPull : public LiteClientTest {
+ protected:
+  void tweakConf(Config& conf) override { conf.pacman.extra["ostree_pull_mode"] = "delta"; };
+};
+
+class LiteClientTestOverlappedDownload : public LiteClientTest {
+ protected:
+  void tweakConf(Config& conf) override { conf.pacman.extra["overlapped_download"] = "1"; };
+};
+
+class LiteClientTestRemoteSelection : public LiteClientTest {
+ protected:
+  void tweakConf(Config& conf) override {
+    conf.pacman.type = RootfsTreeManager::Name;
+    conf.pacman.extra["ostree_remote_selection"] = "latency";
+  };
+};
+
 class LiteClientTestMultiPacman : public LiteClientTest, public ::testing::WithParamInterface<std::string> {
  protected:
   void tweakConf(Config& conf) override { conf.pacman.type = GetParam(); };
@@ -214,6 +254,12 @@ TEST_P(LiteClientTestMultiPacman, OstreeUpdateRollback) {
   reboot(client);
   ASSERT_TRUE(targetsMatch(client->getCurrent(), new_target_03));
   checkHeaders(*client, new_target_03);
+  ASSERT_TRUE(client->isRollback(new_target));
+  ASSERT_FALSE(client->isRollback(new_target_03));
+
+  // the cached rollback set follows the installation log updates
+  client->saveInstalledVersion(new_target, InstalledVersionUpdateMode::kCurrent);
+  ASSERT_FALSE(client->isRollback(new_target));
 }
 
 TEST_P(LiteClientTestMultiPacman, OstreeUpdateToLatestAfterManualUpdate) {
@@ -251,6 +297,82 @@ TEST_P(LiteClientTestMultiPacman, OstreeUpdateToLatestAfterManualUpdate) {
   checkHeaders(*client, new_target);
 }
 
+TEST_F(LiteClientTestDeltaPull, OstreeUpdate) {
+  auto client = createLiteClient();
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), getInitialTarget()));
+
+  // no static delta, the commit objects are pulled
+  auto target_01 = createTarget();
+  update(*client, getInitialTarget(), target_01);
+  reboot(client);
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), target_01));
+
+  auto target_02 = createTarget();
+  getOsTreeRepo().generateDelta(target_02.sha256Hash());
+  getOsTreeRepo().generateDelta(target_02.sha256Hash(), target_01.sha256Hash());
+  // the lack of storage is detected by the delta size check before any data are pulled
+  sys_repo_.setMinFreeSpace("1TB");
+  update(*client, target_01, target_02, data::ResultCode::Numeric::kDownloadFailed,
+         {DownloadResult::Status::DownloadFailed_NoSpace, "; required: "});
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), target_01));
+
+  // the commit is pulled by means of the static delta
+  sys_repo_.setMinFreeSpace("1MB");
+  update(*client, target_01, target_02);
+  reboot(client);
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), target_02));
+}
+
+TEST_F(LiteClientTestRemoteSelection, OstreeUpdateFromFastestRemote) {
+  // the additional remote is listed before the Device Gateway one, yet it is slower
+  Json::Value download_urls{Json::arrayValue};
+  download_urls[0]["download_url"] = getDeviceGateway().getSlowOsTreeUri();
+  download_urls[0]["access_token"] = "token";
+  getDeviceGateway().setDownloadUrls(download_urls);
+
+  auto client = createLiteClient();
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), getInitialTarget()));
+  auto new_target = createTarget();
+  update(*client, getInitialTarget(), new_target);
+  reboot(client);
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), new_target));
+
+  // the slow remote has been probed only, the commit has been pulled from the Device Gateway
+  Json::Value expected_requests{Json::arrayValue};
+  expected_requests.append("config");
+  ASSERT_EQ(expected_requests, getDeviceGateway().getSlowOsTreeRequests());
+}
+
+TEST_F(LiteClientTest, PackageManagerOnFirstUse) {
+  // the pending update is not finalized, so nothing has used the package manager yet and the callback is kept
+  // till it is constructed
+  auto client = createLiteClient(InitialVersion::kOn, boost::none, false);
+  std::vector<DownloadProgress> progress;
+  client->setDownloadProgressCb([&progress](const DownloadProgress& p) { progress.push_back(p); });
+
+  // the threads using the client first get the same package manager
+  std::vector<std::shared_ptr<PackageManagerInterface>> pacmans(8);
+  std::vector<std::thread> threads;
+  for (auto& pacman : pacmans) {
+    threads.emplace_back([&client, &pacman]() { pacman = client->packageManager(); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& pacman : pacmans) {
+    ASSERT_EQ(client->packageManager(), pacman);
+  }
+  ASSERT_EQ(client->packageManager(), std::dynamic_pointer_cast<PackageManagerInterface>(client->downloader()));
+  client->finalizeInstall();
+
+  // the progress callback has been applied to the package manager
+  auto new_target = createTarget();
+  update(*client, getInitialTarget(), new_target);
+  ASSERT_FALSE(progress.empty());
+  ASSERT_EQ(DownloadProgress::Source::Ostree, progress.back().source);
+  ASSERT_TRUE(progress.back().completed);
+}
+
 TEST_F(LiteClientTest, AppUpdate) {
   // boot device
   auto client = createLiteClient();
@@ -272,6 +394,28 @@ TEST_F(LiteClientTest, AppUpdate) {
   updateApps(*client, getInitialTarget(), new_target);
 }
 
+TEST_F(LiteClientTestWal, AppUpdate) {
+  auto client = createLiteClient();
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), getInitialTarget()));
+
+  sqlite3* db{nullptr};
+  ASSERT_EQ(SQLITE_OK, sqlite3_open_v2((test_dir_ / "sql.db").c_str(), &db, SQLITE_OPEN_READONLY, nullptr));
+  sqlite3_stmt* stmt{nullptr};
+  ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "PRAGMA journal_mode;", -1, &stmt, nullptr));
+  ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+  const std::string journal_mode{reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))};
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  ASSERT_EQ("wal", journal_mode);
+
+  // the storage is written and read as usual
+  auto new_target = createAppTarget({createApp("app-01")});
+  EXPECT_CALL(*getAppEngine(), fetch).Times(1);
+  EXPECT_CALL(*getAppEngine(), run).Times(1);
+  updateApps(*client, getInitialTarget(), new_target);
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), new_target));
+}
+
 TEST_F(LiteClientTest, AppUpdateWithShortlist) {
   // boot device
   auto client = createLiteClient(InitialVersion::kOn, boost::make_optional(std::vector<std::string>{"app-02"}));
@@ -337,6 +481,81 @@ TEST_F(LiteClientTest, OstreeAndAppUpdate) {
   }
 }
 
+TEST_F(LiteClientTestDeferredCleanup, ResumeAfterRestart) {
+  auto client = createLiteClient();
+  std::vector<AppEngine::App> apps{createApp("app-01")};
+  auto new_target = createTarget(&apps);
+  update(*client, getInitialTarget(), new_target);
+
+  // the cleanup is deferred by the finalization after the reboot
+  reboot(client);
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), new_target));
+  const auto pending_file{boost::filesystem::path(client->config.pacman.extra.at("compose_apps_root")) /
+                          ComposeAppManager::CleanupPendingFile};
+  ASSERT_TRUE(boost::filesystem::exists(pending_file));
+
+  // and it is still pending after a restart
+  restart(client);
+  ASSERT_TRUE(boost::filesystem::exists(pending_file));
+
+  // it runs once the Apps are found in sync, the Apps state is obtained after it completes
+  EXPECT_CALL(*getAppEngine(), prune).Times(1);
+  ASSERT_TRUE(client->appsInSync(client->getCurrent()));
+  client->reportAppsState();
+  ASSERT_FALSE(boost::filesystem::exists(pending_file));
+
+  // and it doesn't run again
+  restart(client);
+  EXPECT_CALL(*getAppEngine(), prune).Times(0);
+  ASSERT_TRUE(client->appsInSync(client->getCurrent()));
+  client->reportAppsState();
+}
+
+TEST_F(LiteClientTestReportQueue, GzippedEventBatches) {
+  auto client = createLiteClient();
+  getDeviceGateway().resetEvents();
+  for (int ii = 0; ii < 3; ++ii) {
+    client->notifyDownloadStarted(getInitialTarget(), "test");
+  }
+  // the events are sent in two batches, the second one within the flush interval after the first one
+  std::this_thread::sleep_for(std::chrono::seconds(3));
+  const auto events{getDeviceGateway().getEvents()};
+  ASSERT_EQ(3, events.size()) << events;
+  for (const auto& event : events) {
+    ASSERT_EQ("EcuDownloadStarted", event["eventType"]["id"].asString());
+  }
+  ASSERT_EQ("gzip", getDeviceGateway().getEventsReqHeaders()["Content-Encoding"].asString());
+}
+
+TEST_F(LiteClientTestOverlappedDownload, OstreeAndAppUpdate) {
+  auto client = createLiteClient();
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), getInitialTarget()));
+
+  // the ostree commit is pulled while the App is fetched
+  std::vector<AppEngine::App> apps{createApp("app-01")};
+  auto new_target = createTarget(&apps);
+  {
+    EXPECT_CALL(*getAppEngine(), fetch).Times(1);
+    EXPECT_CALL(*getAppEngine(), install).Times(1);
+    EXPECT_CALL(*getAppEngine(), run).Times(0);
+    update(*client, getInitialTarget(), new_target);
+  }
+  reboot(client);
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), new_target));
+
+  // the App fetch failure fails the whole download, nothing is installed
+  std::vector<AppEngine::App> next_apps{createApp("app-01", "test-factory", "new-hash")};
+  auto next_target = createTarget(&next_apps);
+  {
+    EXPECT_CALL(*getAppEngine(), fetch).WillRepeatedly(Return(false));
+    EXPECT_CALL(*getAppEngine(), install).Times(0);
+    EXPECT_CALL(*getAppEngine(), run).Times(0);
+    update(*client, new_target, next_target, data::ResultCode::Numeric::kDownloadFailed,
+           {DownloadResult::Status::DownloadFailed, ""});
+  }
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), new_target));
+}
+
 TEST_F(LiteClientTest, AppUpdateDownloadFailure) {
   // boot device
   auto client = createLiteClient();
@@ -422,6 +641,43 @@ TEST_F(LiteClientTest, OstreeAndAppUpdateIfRollback) {
   }
 }
 
+TEST_F(LiteClientTest, CurrentTargetSnapshot) {
+  auto client = createLiteClient();
+  const auto snapshot{client->getCurrentSnapshot()};
+  ASSERT_TRUE(targetsMatch(*snapshot, getInitialTarget()));
+  // the snapshot is shared till the installation log is written
+  ASSERT_EQ(snapshot, client->getCurrentSnapshot());
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), *snapshot));
+
+  // the install writes the pending Target to the log, the current one is loaded again but stays the same
+  auto new_target = createTarget();
+  update(*client, getInitialTarget(), new_target);
+  const auto pending_snapshot{client->getCurrentSnapshot()};
+  ASSERT_NE(snapshot, pending_snapshot);
+  ASSERT_TRUE(targetsMatch(*pending_snapshot, getInitialTarget()));
+  // the snapshot handed out before is still valid
+  ASSERT_TRUE(targetsMatch(*snapshot, getInitialTarget()));
+
+  reboot(client);
+  ASSERT_TRUE(targetsMatch(*client->getCurrentSnapshot(), new_target));
+  ASSERT_EQ(client->getCurrentSnapshot(), client->getCurrentSnapshot());
+}
+
+TEST_F(LiteClientTest, PendingDeploymentFollowsSysrootChanges) {
+  const OSTree::Sysroot sysroot{sys_repo_.getPath(), BootedType::kStaged, os};
+  ASSERT_TRUE(sysroot.getDeploymentHash(OSTree::Sysroot::Deployment::kPending).empty());
+
+  // the sysroot state is cached after the first query, the deployments made afterwards are still found
+  for (int ii = 0; ii < 2; ++ii) {
+    Utils::writeFile(sys_rootfs_.path + "/" + Utils::randomUuid(), Utils::randomUuid(), true);
+    const auto hash{sys_repo_.getRepo().commit(sys_rootfs_.path, sys_rootfs_.branch)};
+    sys_repo_.deploy(hash);
+    ASSERT_EQ(hash, sysroot.getDeploymentHash(OSTree::Sysroot::Deployment::kPending));
+    ASSERT_EQ(hash, sysroot.getDeploymentHash(OSTree::Sysroot::Deployment::kPending));
+    ASSERT_EQ(sysroot_hash_, sysroot.getDeploymentHash(OSTree::Sysroot::Deployment::kCurrent));
+  }
+}
+
 TEST_F(LiteClientTest, CheckEmptyTargets) {
   // boot device with no installed versions
   auto client = createLiteClient(InitialVersion::kOff);
@@ -443,6 +699,38 @@ TEST_F(LiteClientTest, CheckEmptyTargets) {
   ASSERT_GT(client->allTargets().size(), 0);
 }
 
+TEST_F(LiteClientTest, UpdateImageMetaIfChanged) {
+  auto client = createLiteClient();
+  ASSERT_TRUE(targetsMatch(client->getCurrent(), getInitialTarget()));
+
+  auto new_target = createTarget();
+  ASSERT_TRUE(std::get<0>(client->updateImageMeta()));
+  const auto catalog{client->targetCatalog()};
+  ASSERT_NE(nullptr, catalog->find(new_target.filename()));
+
+  // nothing has changed, the loaded metadata and the catalog are kept
+  ASSERT_TRUE(std::get<0>(client->updateImageMeta()));
+  ASSERT_EQ(catalog, client->targetCatalog());
+
+  // the root metadata are updated even if the timestamp has not changed
+  const auto root_version = [&client]() {
+    std::string root;
+    client->storage->loadLatestRoot(&root, Uptane::RepositoryType::Image());
+    return Utils::parseJSON(root)["signed"]["version"].asInt();
+  };
+  const auto prev_root_version{root_version()};
+  getTufRepo().repo().rotate(Uptane::Role::Root());
+  ASSERT_TRUE(std::get<0>(client->updateImageMeta()));
+  ASSERT_EQ(prev_root_version + 1, root_version());
+
+  // a new Target is added, so the metadata are updated and the catalog is rebuilt
+  new_target = createTarget();
+  ASSERT_TRUE(std::get<0>(client->updateImageMeta()));
+  ASSERT_NE(catalog, client->targetCatalog());
+  ASSERT_NE(nullptr, client->targetCatalog()->find(new_target.filename()));
+  ASSERT_GT(client->targetCatalog()->version(), catalog->version());
+}
+
 TEST_P(LiteClientTestMultiPacman, OstreeUpdateIfSameVersion) {
   // boot device
   auto client = createLiteClient();
@@ -48,6 +48,27 @@ TEST_F(OSTreeTest, AddRemote) {
   repo_->addRemote("treehub", "http://localhost", "", "", "");
 }
 
+TEST_F(OSTreeTest, CommitAndCheckoutHardlinks) {
+  TemporaryDirectory dir;
+  OSTree::Repo repo{(dir / "repo").string(), true, OSTREE_REPO_MODE_BARE_USER_ONLY};
+  Utils::writeFile(dir / "src" / "docker-compose.yml", std::string("services: {}"));
+  Utils::writeFile(dir / "src" / "config" / "app.conf", std::string("key=value"));
+
+  const auto commit_hash{repo.commit((dir / "src").string(), "apps/foo")};
+  ASSERT_EQ(commit_hash, repo.getRefs().at("apps/foo"));
+  // the same content results in the same tree, and its files are shared between the checkouts
+  ASSERT_NE(commit_hash, repo.commit((dir / "src").string(), "apps/bar"));
+  repo.checkoutHardlinks(commit_hash, (dir / "foo").string());
+  repo.checkoutHardlinks(repo.getRefs().at("apps/bar"), (dir / "bar").string());
+  ASSERT_EQ("key=value", Utils::readFile(dir / "foo" / "config" / "app.conf"));
+  ASSERT_TRUE(boost::filesystem::equivalent(dir / "foo" / "config" / "app.conf", dir / "bar" / "config" / "app.conf"));
+
+  repo.removeRef("apps/foo");
+  repo.prune();
+  ASSERT_EQ(0, repo.getRefs().count("apps/foo"));
+  ASSERT_EQ(1, repo.getRefs().count("apps/bar"));
+}
+
 // TODO: Add Treehub mock and uncomment the following tests
 //TEST_F(OSTreeTest, Pull) {
 //  ASSERT_TRUE(isRepoInited());
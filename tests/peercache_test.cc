@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include "boost/algorithm/hex.hpp"
+#include "boost/algorithm/string/case_conv.hpp"
+#include "boost/filesystem.hpp"
+
+#include "crypto/crypto.h"
+#include "peercache.h"
+#include "utilities/utils.h"
+
+class PeerCacheTest : public ::testing::Test {
+ protected:
+  PeerCacheTest() : server_{makeConfig({})}, client_{makeConfig({"127.0.0.1:" + std::to_string(server_.port())})} {
+    boost::filesystem::create_directories(blob_dir_);
+    server_.serveBlobs(blob_dir_);
+  }
+
+  static PeerCache::Config makeConfig(std::vector<std::string> peers) {
+    PeerCache::Config cfg;
+    cfg.port = 0;
+    cfg.discovery = false;
+    cfg.peers = std::move(peers);
+    return cfg;
+  }
+
+  std::string addBlob(const std::string& content) {
+    const auto hash{boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(content)))};
+    Utils::writeFile(blob_dir_ / hash, content);
+    return hash;
+  }
+
+  TemporaryDirectory dir_;
+  const boost::filesystem::path blob_dir_{dir_ / "server" / "blobs"};
+  const boost::filesystem::path dst_dir_{dir_.Path()};
+  PeerCache server_;
+  PeerCache client_;
+};
+
+TEST_F(PeerCacheTest, FetchBlob) {
+  const std::string content{"some blob content"};
+  const auto hash{addBlob(content)};
+  const auto dst{dst_dir_ / hash};
+  uint64_t fetched{0};
+
+  ASSERT_TRUE(client_.fetchBlob(hash, content.size(), dst, [&fetched](uint64_t val) { fetched = val; }));
+  ASSERT_EQ(Utils::readFile(dst), content);
+  ASSERT_EQ(fetched, content.size());
+  ASSERT_FALSE(boost::filesystem::exists(dst.string() + PeerCache::PartFileExt));
+}
+
+TEST_F(PeerCacheTest, FetchInvalidBlob) {
+  const std::string content{"some blob content"};
+  const auto hash{addBlob(content)};
+
+  // missing at the peer
+  const std::string missing_hash(64, 'a');
+  ASSERT_FALSE(client_.fetchBlob(missing_hash, content.size(), dst_dir_ / missing_hash));
+  ASSERT_FALSE(boost::filesystem::exists(dst_dir_ / missing_hash));
+
+  // the size differs from the expected one
+  ASSERT_FALSE(client_.fetchBlob(hash, content.size() - 1, dst_dir_ / hash));
+  ASSERT_FALSE(client_.fetchBlob(hash, content.size() + 1, dst_dir_ / hash));
+  ASSERT_FALSE(boost::filesystem::exists(dst_dir_ / hash));
+
+  // the content does not match the hash the peer serves it by
+  const std::string tampered_hash(64, 'b');
+  Utils::writeFile(blob_dir_ / tampered_hash, content);
+  ASSERT_FALSE(client_.fetchBlob(tampered_hash, content.size(), dst_dir_ / tampered_hash));
+  ASSERT_FALSE(boost::filesystem::exists(dst_dir_ / tampered_hash));
+  ASSERT_FALSE(boost::filesystem::exists((dst_dir_ / tampered_hash).string() + PeerCache::PartFileExt));
+}
+
+TEST_F(PeerCacheTest, NoPeers) {
+  const std::string content{"some blob content"};
+  const auto hash{addBlob(content)};
+  PeerCache no_peers_client{makeConfig({})};
+  ASSERT_TRUE(no_peers_client.peers().empty());
+  ASSERT_TRUE(no_peers_client.ostreeMirrors().empty());
+  ASSERT_FALSE(no_peers_client.fetchBlob(hash, content.size(), dst_dir_ / hash));
+  ASSERT_EQ(client_.ostreeMirrors(),
+            std::vector<std::string>{"http://127.0.0.1:" + std::to_string(server_.port()) + "/ostree"});
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -70,6 +70,23 @@ class RestorableAppEngineTest : public fixtures::AppEngineTest {
   float watermark_{0.8};
 };
 
+namespace Docker {
+class RestorableAppEngineTestAccess {
+ public:
+  static std::unique_ptr<RestorableAppEngine::StorageReservation> reserveStorage(const RestorableAppEngine& engine,
+                                                                               const boost::filesystem::path& path,
+                                                                               uint64_t size) {
+    return engine.reserveStorage(path, size, "test");
+  }
+  static uint64_t getReservedStorage(const RestorableAppEngine& engine, const boost::filesystem::path& path) {
+    return engine.getReservedStorage(path);
+  }
+  static void checkAvailableStorageInStores(const RestorableAppEngine& engine, uint64_t required_storage) {
+    engine.checkAvailableStorageInStores("app-01", required_storage, 0);
+  }
+};
+}  // namespace Docker
+
 class RestorableAppEngineTestParameterized : public RestorableAppEngineTest,
                                              public ::testing::WithParamInterface<std::string> {
  protected:
@@ -278,6 +295,78 @@ TEST_F(RestorableAppEngineTest, FetchCheckAndRefetch) {
   }
 }
 
+TEST_F(RestorableAppEngineTest, FetchAndDeepVerify) {
+  auto app = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  const auto app_dir{storeRoot() / "apps" / uri.app / uri.digest.hash()};
+  const auto compose{Docker::ComposeInfo::load((app_dir / Docker::RestorableAppEngine::ComposeFile).string())};
+  const Docker::Uri image_uri{Docker::Uri::parseUri(compose->services()[0].image, false)};
+  const auto index_manifest{app_dir / "images" / image_uri.registryHostname / image_uri.repo /
+                            image_uri.digest.hash() / "index.json"};
+  const auto manifest_desc{Utils::parseJSONFile(index_manifest)};
+  const auto blob_dir{storeRoot() / "blobs" / "sha256"};
+  const auto image_manifest{Utils::parseJSONFile(
+      blob_dir / Docker::HashedDigest(manifest_desc["manifests"][0]["digest"].asString()).hash())};
+  const auto blob_path{blob_dir / Docker::HashedDigest(image_manifest["layers"][0]["digest"].asString()).hash()};
+
+  // alter App image blob without changing its size, just the blob size is checked by default
+  auto blob{Utils::readFile(blob_path)};
+  ASSERT_FALSE(blob.empty());
+  blob[0] = static_cast<char>(~blob[0]);
+  Utils::writeFile(blob_path, blob);
+  ASSERT_TRUE(app_engine->isFetched(app));
+
+  std::dynamic_pointer_cast<Docker::RestorableAppEngine>(app_engine)->setDeepVerify(true);
+  ASSERT_FALSE(app_engine->isFetched(app));
+  ASSERT_FALSE(boost::filesystem::exists(blob_path));
+
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+  ASSERT_TRUE(app_engine->verify(app));
+}
+
+TEST_F(RestorableAppEngineTest, FetchWithBlobImport) {
+  auto app = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  ASSERT_TRUE(app_engine->fetch(app));
+
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  const auto app_dir{storeRoot() / "apps" / uri.app / uri.digest.hash()};
+  const auto compose{Docker::ComposeInfo::load((app_dir / Docker::RestorableAppEngine::ComposeFile).string())};
+  const Docker::Uri image_uri{Docker::Uri::parseUri(compose->services()[0].image, false)};
+  const auto index_manifest{app_dir / "images" / image_uri.registryHostname / image_uri.repo /
+                            image_uri.digest.hash() / "index.json"};
+  const auto manifest_hash{
+      Docker::HashedDigest(Utils::parseJSONFile(index_manifest)["manifests"][0]["digest"].asString()).hash()};
+
+  // an offline bundle carrying the image blobs, one of which is corrupted
+  const auto import_dir{test_dir_ / "bundle-blobs"};
+  boost::filesystem::create_directories(import_dir);
+  for (const auto& entry : boost::filesystem::directory_iterator(storeRoot() / "blobs" / "sha256")) {
+    boost::filesystem::copy_file(entry.path(), import_dir / entry.path().filename());
+  }
+  const auto image_manifest{Utils::parseJSONFile(import_dir / manifest_hash)};
+  const auto layer_hash{Docker::HashedDigest(image_manifest["layers"][0]["digest"].asString()).hash()};
+  auto layer{Utils::readFile(import_dir / layer_hash)};
+  ASSERT_FALSE(layer.empty());
+  layer[0] = static_cast<char>(~layer[0]);
+  Utils::writeFile(import_dir / layer_hash, layer);
+
+  boost::filesystem::remove_all(storeRoot());
+  std::dynamic_pointer_cast<Docker::RestorableAppEngine>(app_engine)->setBlobImportDir(import_dir);
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+  ASSERT_TRUE(app_engine->verify(app));
+
+  // the bundle is on the store volume, so the valid blobs are hardlinked, the corrupted one is fetched again
+  const auto blob_dir{storeRoot() / "blobs" / "sha256"};
+  ASSERT_EQ(2, boost::filesystem::hard_link_count(blob_dir / manifest_hash));
+  ASSERT_EQ(1, boost::filesystem::hard_link_count(blob_dir / layer_hash));
+  ASSERT_NE(layer, Utils::readFile(blob_dir / layer_hash));
+}
+
 TEST_F(RestorableAppEngineTest, FetchAndInstall) {
   auto app = registry.addApp(fixtures::ComposeApp::create("app-02"));
   ASSERT_TRUE(app_engine->fetch(app));
@@ -292,6 +381,47 @@ TEST_F(RestorableAppEngineTest, FetchAndInstall) {
   ASSERT_FALSE(app_engine->isRunning(app));
 }
 
+TEST_F(RestorableAppEngineTest, FetchAndInstallImages) {
+  auto app01 = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  auto app02 = registry.addApp(fixtures::ComposeApp::create("app-02"));
+  ASSERT_TRUE(app_engine->fetch(app01));
+  ASSERT_TRUE(app_engine->fetch(app02));
+
+  std::dynamic_pointer_cast<Docker::RestorableAppEngine>(app_engine)->setInstallConcurrency(2);
+  const auto images_res{app_engine->installImages({app01, app02})};
+  ASSERT_TRUE(images_res) << images_res.err;
+  ASSERT_TRUE(app_engine->install(app01));
+  ASSERT_TRUE(app_engine->install(app02));
+  ASSERT_FALSE(app_engine->isRunning(app01));
+  ASSERT_FALSE(app_engine->isRunning(app02));
+  ASSERT_TRUE(app_engine->run(app01));
+  ASSERT_TRUE(app_engine->isRunning(app01));
+}
+
+TEST_F(RestorableAppEngineTest, FetchAndRunAppsInParallel) {
+  auto app01 = registry.addApp(fixtures::ComposeApp::create("app-01"));
+  auto app02 = registry.addApp(fixtures::ComposeApp::create("app-02"));
+  ASSERT_TRUE(app_engine->fetch(app01));
+  ASSERT_TRUE(app_engine->fetch(app02));
+
+  // the same as `aklite-apps run --jobs 2`, each job runs its Apps by an engine of its own
+  std::size_t engine_numb{0};
+  const auto make_engine = [this, &engine_numb]() {
+    ++engine_numb;
+    return std::unique_ptr<Docker::RestorableAppEngine>{new Docker::RestorableAppEngine{
+        skopeo_store_root_, apps_root_dir, daemon_.dataRoot(), registry_client_, docker_client_,
+        registry.getSkopeoClient(), daemon_.getUrl(), compose_cmd}};
+  };
+  const auto results{Docker::RestorableAppEngine::runApps(
+      *std::dynamic_pointer_cast<Docker::RestorableAppEngine>(app_engine), {app01, app02}, 2, make_engine)};
+  ASSERT_EQ(2, engine_numb);
+  ASSERT_EQ(2, results.size());
+  ASSERT_TRUE(results[0]) << results[0].err;
+  ASSERT_TRUE(results[1]) << results[1].err;
+  ASSERT_TRUE(app_engine->isRunning(app01));
+  ASSERT_TRUE(app_engine->isRunning(app02));
+}
+
 TEST_F(RestorableAppEngineTest, FetchAndRun) {
   auto app = registry.addApp(fixtures::ComposeApp::create("app-03"));
   ASSERT_TRUE(app_engine->fetch(app));
@@ -369,12 +499,248 @@ TEST_P(RestorableAppEngineTestParameterized, FetchAndCheckSizeInsufficientSpace)
   ASSERT_FALSE(app_engine->isRunning(app));
 }
 
+TEST_P(RestorableAppEngineTestParameterized, FetchAndCheckSizeLayerUsage) {
+  const auto layer_size{1024};
+  Json::Value layers;
+  layers["layers"][0]["digest"] =
+      "sha256:" + boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+  layers["layers"][0]["size"] = layer_size;
+  // the layer is hardly compressible, its extracted size is close to the compressed one
+  layers["layers"][0]["usage"] = layer_size;
+
+  // not sufficient to accomodate a layer if its extracted size is approximated by the average compression ratio
+  setAvailableStorageSpace(layer_size * 3);
+  auto app = registry.addApp(fixtures::ComposeApp::createAppWithCustomeLayers("app-01", layers));
+  ASSERT_TRUE(app_engine->fetch(app));
+  ASSERT_TRUE(app_engine->isFetched(app));
+
+  // the extracted layer doesn't fit
+  layers["layers"][0]["digest"] =
+      "sha256:" + boost::algorithm::to_lower_copy(boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+  layers["layers"][0]["usage"] = layer_size * 4;
+  app = registry.addApp(fixtures::ComposeApp::createAppWithCustomeLayers("app-01", layers));
+  ASSERT_TRUE(app_engine->fetch(app).noSpace());
+  ASSERT_FALSE(app_engine->isFetched(app));
+}
+
+TEST_F(RestorableAppEngineTest, PlanFetch) {
+  const auto layer_size{1024};
+  const auto createApp = [&](const std::string& name) {
+    Json::Value layers;
+    layers["layers"][0]["digest"] = "sha256:" + boost::algorithm::to_lower_copy(
+                                                    boost::algorithm::hex(Crypto::sha256digest(Utils::randomUuid())));
+    layers["layers"][0]["size"] = layer_size;
+    layers["layers"][0]["usage"] = layer_size;
+    return registry.addApp(fixtures::ComposeApp::createAppWithCustomeLayers(name, layers));
+  };
+  std::dynamic_pointer_cast<Docker::RestorableAppEngine>(app_engine)->setFetchConcurrency(2);
+
+  // each App fits on its own, but not both of them
+  setAvailableStorageSpace(layer_size * 3);
+  const AppEngine::Apps apps{createApp("app-01"), createApp("app-02")};
+  ASSERT_TRUE(app_engine->planFetch(apps).noSpace());
+  // the reservations of the failed plan are dropped
+  ASSERT_TRUE(app_engine->fetch(apps[0]));
+  ASSERT_TRUE(app_engine->isFetched(apps[0]));
+
+  setAvailableStorageSpace(layer_size * 4);
+  const AppEngine::Apps next_apps{createApp("app-01"), createApp("app-02")};
+  ASSERT_TRUE(app_engine->planFetch(next_apps));
+  // the planned Apps are not checked again
+  setAvailableStorageSpace(0);
+  for (const auto& app : next_apps) {
+    ASSERT_TRUE(app_engine->fetch(app));
+    ASSERT_TRUE(app_engine->isFetched(app));
+  }
+}
+
+TEST_F(RestorableAppEngineTest, PruneKeepsPartialBlobs) {
+  const auto app{registry.addApp(fixtures::ComposeApp::create("app-01"))};
+  ASSERT_TRUE(app_engine->fetch(app));
+
+  // the partially downloaded blobs of a download in progress are kept, the stale ones are removed
+  const auto blob_dir{storeRoot() / "blobs" / "sha256"};
+  const auto fresh_part{blob_dir / (std::string(64, 'a') + Docker::RegistryClient::PartFileExt)};
+  const auto stale_part{blob_dir / (std::string(64, 'b') + Docker::RegistryClient::PartFileExt)};
+  Utils::writeFile(fresh_part, std::string("partial"));
+  Utils::writeFile(stale_part, std::string("partial"));
+  boost::filesystem::last_write_time(
+      stale_part, std::time(nullptr) - 2 * Docker::RestorableAppEngine::PartFileMaxAgeSec);
+
+  // the first prune scans the whole store
+  app_engine->prune({app});
+  ASSERT_TRUE(boost::filesystem::exists(fresh_part));
+  ASSERT_FALSE(boost::filesystem::exists(stale_part));
+  ASSERT_TRUE(app_engine->isFetched(app));
+}
+
+TEST_F(RestorableAppEngineTest, PruneSelectiveDockerStore) {
+  // a fake docker CLI, it logs its arguments
+  const auto docker_cli{test_dir_.Path() / "docker"};
+  const auto docker_cli_log{test_dir_.Path() / "docker.log"};
+  Utils::writeFile(docker_cli, "#!/bin/bash\necho \"$@\" >> " + docker_cli_log.string() + "\n");
+  boost::filesystem::permissions(docker_cli, boost::filesystem::owner_all);
+  std::dynamic_pointer_cast<Docker::RestorableAppEngine>(app_engine)->setSelectiveDockerPrune(docker_cli.string());
+
+  const auto compose_app_01{fixtures::ComposeApp::createWithImages("app-01", 1, 1024)};
+  const auto compose_app_02{fixtures::ComposeApp::createWithImages("app-02", 1, 1024)};
+  const auto next_compose_app_01{fixtures::ComposeApp::createWithImages("app-01", 1, 1024)};
+  const auto app_01{registry.addApp(compose_app_01)};
+  const auto app_02{registry.addApp(compose_app_02)};
+  const auto next_app_01{registry.addApp(next_compose_app_01)};
+  ASSERT_TRUE(app_engine->fetch(app_01));
+  ASSERT_TRUE(app_engine->fetch(app_02));
+  ASSERT_TRUE(app_engine->fetch(next_app_01));
+
+  app_engine->prune({next_app_01});
+  ASSERT_TRUE(app_engine->isFetched(next_app_01));
+  ASSERT_FALSE(app_engine->isFetched(app_01));
+  ASSERT_FALSE(app_engine->isFetched(app_02));
+  // the engine waits for the background removal on destruction
+  app_engine.reset();
+
+  // just the images of the removed App versions are removed
+  const auto log{Utils::readFile(docker_cli_log)};
+  ASSERT_TRUE(boost::starts_with(log, "image rm ")) << log;
+  ASSERT_NE(std::string::npos, log.find(compose_app_01->image().uri()));
+  ASSERT_NE(std::string::npos, log.find(compose_app_02->image().uri()));
+  ASSERT_EQ(std::string::npos, log.find(next_compose_app_01->image().uri()));
+  ASSERT_EQ(std::string::npos, log.find("prune"));
+}
+
+TEST_F(RestorableAppEngineTest, PlanFetchWithStoreEviction) {
+  boost::filesystem::path evictable_app_dir;
+  // there is no storage space available till the given App version is evicted from the store
+  auto engine{std::make_shared<Docker::RestorableAppEngine>(
+      skopeo_store_root_, apps_root_dir, daemon_.dataRoot(), registry_client_, docker_client_,
+      registry.getSkopeoClient(), daemon_.getUrl(), compose_cmd, [&evictable_app_dir](const boost::filesystem::path&) {
+        const boost::uintmax_t available{
+            boost::filesystem::exists(evictable_app_dir) ? 0 : std::numeric_limits<boost::uintmax_t>::max() / 2};
+        return std::tuple<boost::uintmax_t, boost::uintmax_t>{available, available};
+      })};
+
+  const auto app{registry.addApp(fixtures::ComposeApp::create("app-01"))};
+  ASSERT_TRUE(engine->fetch(app));
+  // makes the blob reference table complete, the eviction relies on it
+  engine->prune({app});
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  evictable_app_dir = storeRoot() / "apps" / uri.app / uri.digest.hash();
+  ASSERT_TRUE(boost::filesystem::exists(evictable_app_dir));
+
+  const auto next_app{registry.addApp(fixtures::ComposeApp::create("app-02"))};
+  ASSERT_TRUE(engine->planFetch({next_app}).noSpace());
+  ASSERT_TRUE(engine->isFetched(app));
+
+  engine->setStoreEviction(true);
+  ASSERT_TRUE(engine->planFetch({next_app}));
+  ASSERT_FALSE(engine->isFetched(app));
+  ASSERT_TRUE(engine->fetch(next_app));
+  ASSERT_TRUE(engine->isFetched(next_app));
+}
+
+TEST_F(RestorableAppEngineTest, PlanFetchWithStoreEvictionSharedLayer) {
+  boost::filesystem::path evictable_app_dir;
+  auto engine{std::make_shared<Docker::RestorableAppEngine>(
+      skopeo_store_root_, apps_root_dir, daemon_.dataRoot(), registry_client_, docker_client_,
+      registry.getSkopeoClient(), daemon_.getUrl(), compose_cmd, [&evictable_app_dir](const boost::filesystem::path&) {
+        const boost::uintmax_t available{
+            boost::filesystem::exists(evictable_app_dir) ? 0 : std::numeric_limits<boost::uintmax_t>::max() / 2};
+        return std::tuple<boost::uintmax_t, boost::uintmax_t>{available, available};
+      })};
+  engine->setStoreEviction(true);
+
+  auto compose_app{fixtures::ComposeApp::createWithImages("app-01", 1, 1024)};
+  const auto& layer{compose_app->image().layerBlob()};
+  Json::Value layers;
+  layers["layers"][0]["digest"] = "sha256:" + layer.hash;
+  layers["layers"][0]["size"] = Json::UInt64(layer.size);
+  const auto app{registry.addApp(compose_app)};
+  ASSERT_TRUE(engine->fetch(app));
+  engine->prune({app});
+  const Docker::Uri uri{Docker::Uri::parseUri(app.uri)};
+  evictable_app_dir = storeRoot() / "apps" / uri.app / uri.digest.hash();
+  const auto layer_blob{storeRoot() / "blobs" / "sha256" / layer.hash};
+  ASSERT_TRUE(boost::filesystem::exists(layer_blob));
+
+  // the next version runs the same image, so its layer is found in the store and is not fetched again
+  compose_app->updateService("service-02", fixtures::ComposeApp::ServiceTemplate, "none", layers);
+  const auto next_app{registry.addApp(compose_app)};
+  ASSERT_TRUE(engine->planFetch({next_app}));
+  ASSERT_FALSE(boost::filesystem::exists(evictable_app_dir));
+  ASSERT_TRUE(boost::filesystem::exists(layer_blob));
+  ASSERT_TRUE(engine->fetch(next_app));
+  ASSERT_TRUE(engine->isFetched(next_app));
+  ASSERT_TRUE(boost::filesystem::exists(layer_blob));
+}
+
+TEST_F(RestorableAppEngineTest, FetchWithLayerDelta) {
+  auto compose_app{fixtures::ComposeApp::createWithImages("app-01", 1, 4096)};
+  const auto app{registry.addApp(compose_app)};
+  ASSERT_TRUE(app_engine->fetch(app));
+  const auto& src_layer{compose_app->image().layerBlob()};
+
+  // the next version's layer is published just as a zstd delta from the current version's layer
+  auto next_compose_app{fixtures::ComposeApp::createWithImages("app-01", 1, 4096)};
+  const auto& layer{next_compose_app->image().layerBlob()};
+  TemporaryDirectory delta_dir;
+  Utils::writeFile(delta_dir / "src", src_layer.data);
+  Utils::writeFile(delta_dir / "dst", layer.data);
+  ASSERT_EQ(0, boost::process::system("zstd -q --long=31 --patch-from=" + (delta_dir / "src").string() + " " +
+                                      (delta_dir / "dst").string() + " -o " + (delta_dir / "delta").string()));
+  const auto delta{Utils::readFile(delta_dir / "delta")};
+  const auto delta_hash{registry.addBlob(delta)};
+
+  Json::Value layers;
+  layers["layers"][0]["digest"] = "sha256:" + layer.hash;
+  layers["layers"][0]["size"] = Json::UInt64(layer.size);
+  auto& layer_delta{layers["layers"][0][Docker::RestorableAppEngine::LayerDeltasField][0]};
+  layer_delta["from"] = "sha256:" + src_layer.hash;
+  layer_delta["digest"] = "sha256:" + delta_hash;
+  layer_delta["size"] = Json::UInt64(delta.size());
+  layer_delta["format"] = "zstd";
+  next_compose_app->updateService("service-01", fixtures::ComposeApp::ServiceTemplate, "none", layers);
+  const auto next_app{registry.addApp(next_compose_app)};
+  boost::filesystem::remove(test_dir_.Path() / "registry" / next_compose_app->image().name() / "blobs" / layer.hash);
+
+  ASSERT_TRUE(app_engine->fetch(next_app));
+  ASSERT_TRUE(app_engine->isFetched(next_app));
+  ASSERT_TRUE(app_engine->verify(next_app));
+  ASSERT_EQ(layer.data, Utils::readFile(storeRoot() / "blobs" / "sha256" / layer.hash));
+  ASSERT_FALSE(boost::filesystem::exists(storeRoot() / "blobs" / "sha256" / (delta_hash + ".delta")));
+}
+
 // Run FetchAndCheckSizeInsufficientSpace test for two use-cases:
 // 1. The skopeo and docker store are located on the same volume.
 // 2. The skopeo and docker store are located on different volumes.
 INSTANTIATE_TEST_SUITE_P(CheckSizeTests, RestorableAppEngineTestParameterized,
                          ::testing::Values("", "/var/non-existing-dir/docker"));
 
+TEST_F(RestorableAppEngineTest, StorageReservation) {
+  using Access = Docker::RestorableAppEngineTestAccess;
+  const auto& engine{*std::dynamic_pointer_cast<Docker::RestorableAppEngine>(app_engine)};
+  setAvailableStorageSpaceWithoutWatermark(4096);
+  ASSERT_EQ(0, Access::getReservedStorage(engine, storeRoot()));
+  ASSERT_NO_THROW(Access::checkAvailableStorageInStores(engine, 3000));
+  {
+    const auto reservation{Access::reserveStorage(engine, storeRoot(), 1024)};
+    ASSERT_EQ(1024, Access::getReservedStorage(engine, storeRoot()));
+    {
+      const auto another_reservation{Access::reserveStorage(engine, storeRoot(), 2048)};
+      ASSERT_EQ(3072, Access::getReservedStorage(engine, storeRoot()));
+    }
+    ASSERT_EQ(1024, Access::getReservedStorage(engine, storeRoot()));
+
+    // the storage committed to the transfers in progress is not available to the others
+    const auto available{static_cast<uint64_t>(boost::filesystem::space(storeRoot()).available * 0.8)};
+    ASSERT_THROW(Access::reserveStorage(engine, storeRoot(), available - 512), std::runtime_error);
+    ASSERT_EQ(1024, Access::getReservedStorage(engine, storeRoot()));
+    ASSERT_NO_THROW(Access::checkAvailableStorageInStores(engine, 2000));
+    ASSERT_THROW(Access::checkAvailableStorageInStores(engine, 3000), std::runtime_error);
+  }
+  ASSERT_EQ(0, Access::getReservedStorage(engine, storeRoot()));
+  ASSERT_NO_THROW(Access::checkAvailableStorageInStores(engine, 3000));
+}
+
 TEST_F(RestorableAppEngineTest, FetchAndCheckSizeOverflowLayerSize) {
   // generate a list of layers an overall size of which exceeds std::uint64_t/std::size_t
   // layer sizes must be correct, i.e. int64, so we need 2 layers with int64::max + 2
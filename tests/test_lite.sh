@@ -111,6 +111,7 @@ os = "dummy-os"
 docker_compose_bin = "${compose_bin}"
 docker_bin = "/bin/true"
 booted = "staged"
+docker_stop_cmd = "/bin/true"
 docker_images_reload_cmd = "/bin/true"
 compose_apps_root = "$sota_dir/compose-apps"
 compose_apps_tree = "$sota_dir/apps-tree"
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include "docker/composeinfo.h"
 #include "logging/logging.h"
+#include "utilities/utils.h"
 #include "yaml2json.h"
 
 class Yaml2JsonTest : public ::testing::Test {
@@ -54,6 +55,50 @@ TEST_F(Yaml2JsonTest, compose_parser) {
   }
 }
 
+TEST_F(Yaml2JsonTest, anchors) {
+  TemporaryDirectory dir;
+  const auto yaml{dir / "docker-compose.yml"};
+  Utils::writeFile(yaml, std::string("x-defaults: &defaults\n"
+                                     "  restart: always\n"
+                                     "services:\n"
+                                     "  app:\n"
+                                     "    <<: *defaults\n"
+                                     "    image: hub.foundries.io/factory/app:latest\n"));
+  Yaml2Json json(yaml.string());
+  ASSERT_EQ(json.root_["services"]["app"]["restart"], "always");
+  ASSERT_EQ(json.root_["services"]["app"]["image"], "hub.foundries.io/factory/app:latest");
+}
+
+TEST_F(Yaml2JsonTest, invalid_file) {
+  TemporaryDirectory dir;
+  ASSERT_THROW(Yaml2Json((dir / "missing.yml").string()), std::runtime_error);
+  Utils::writeFile(dir / "invalid.yml", std::string("services: [app\n"));
+  ASSERT_THROW(Yaml2Json((dir / "invalid.yml").string()), std::runtime_error);
+}
+
+TEST_F(Yaml2JsonTest, compose_cache) {
+  TemporaryDirectory dir;
+  const auto compose_file{dir / "docker-compose.yml"};
+  Utils::writeFile(compose_file, Utils::readFile("tests/template.yaml"));
+
+  const auto compose{Docker::ComposeInfo::load(compose_file.string())};
+  ASSERT_EQ(compose->services().size(), compose->getServices().size());
+  for (const auto& service : compose->services()) {
+    ASSERT_EQ(service.image, compose->getImage(service.name));
+    ASSERT_EQ(service.hash, compose->getHash(service.name));
+  }
+
+  // the same content, regardless of the file path, is parsed just once
+  ASSERT_EQ(compose, Docker::ComposeInfo::load("tests/template.yaml"));
+
+  Utils::writeFile(compose_file, std::string("services:\n  app:\n    image: hub.foundries.io/factory/app:latest\n"));
+  const auto updated_compose{Docker::ComposeInfo::load(compose_file.string())};
+  ASSERT_NE(compose, updated_compose);
+  ASSERT_EQ(1, updated_compose->services().size());
+  ASSERT_EQ("app", updated_compose->services()[0].name);
+  ASSERT_EQ("hub.foundries.io/factory/app:latest", updated_compose->services()[0].image);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();